@@ -3,7 +3,11 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/trace.h"
+#include "threads/thread.h"
 
 /* A block device. */
 struct block
@@ -19,8 +23,37 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request statistics, updated with interrupts off. */
+    struct block_stats stats;           /* All but the sector counts. */
+    block_sector_t next_sector;         /* Sector after the last request. */
+
+    /* Device this one is a part of, at sector PARENT_START, whose
+       queue it uses, or a null pointer. */
+    struct block *parent;
+    block_sector_t parent_start;
+
+    /* Request queue, sorted by sector, and its thread, started by
+       the first block_submit(). */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_ready;       /* Signaled when queue grows. */
+    struct list queue;                  /* Queued block_requests. */
+    block_sector_t head;                /* Sector after the last request. */
+    bool dispatching;                   /* Thread started? */
   };
 
+/* Time within which a queued request is started, even if the
+   elevator is busy elsewhere; reads are waited for, so they are
+   given less. */
+#define READ_DEADLINE (TIMER_FREQ / 20)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
+
+/* Ticks a queued request waits to rise one I/O class. */
+#define IOPRIO_AGE (TIMER_FREQ / 25)
+
+/* Most sectors in one merged request. */
+#define MERGE_MAX 256
+
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
@@ -28,6 +61,11 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void dispatch_thread (void *block_);
+static void read_sectors (struct block *, block_sector_t, block_sector_t cnt,
+                          uint8_t *);
+static void write_sectors (struct block *, block_sector_t, block_sector_t cnt,
+                           const uint8_t *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -121,8 +159,99 @@ void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
   check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  read_sectors (block, sector, 1, buffer);
+}
+
+/* Records in BLOCK's statistics a request for the CNT sectors
+   starting at SECTOR, which started at time stamp START. */
+static void
+account_request (struct block *block, bool write, block_sector_t sector,
+                 block_sector_t cnt, uint64_t start)
+{
+  uint64_t cycles = rdtsc () - start;
+  size_t bucket;
+  enum intr_level old_level;
+
+  for (bucket = 0; bucket < BLOCK_LATENCY_BUCKETS - 1
+                   && (cycles >> (bucket + 1)) != 0; bucket++)
+    continue;
+
+  old_level = intr_disable ();
+  if (write)
+    {
+      block->stats.writes++;
+      block->write_cnt += cnt;
+    }
+  else
+    {
+      block->stats.reads++;
+      block->read_cnt += cnt;
+    }
+  if (sector == block->next_sector)
+    block->stats.sequential++;
+  block->next_sector = sector + cnt;
+  block->stats.cycles += cycles;
+  block->stats.latency[bucket]++;
+  intr_set_level (old_level);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, with the driver's READ_MULTIPLE if it has one. */
+static void
+read_sectors (struct block *block, block_sector_t sector,
+              block_sector_t cnt, uint8_t *buffer)
+{
+  uint64_t start = rdtsc ();
+
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      block_sector_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->read (block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  account_request (block, false, sector, cnt, start);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, with the driver's WRITE_MULTIPLE if it has one. */
+static void
+write_sectors (struct block *block, block_sector_t sector,
+               block_sector_t cnt, const uint8_t *buffer)
+{
+  uint64_t start = rdtsc ();
+
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      block_sector_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->write (block->aux, sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  account_request (block, true, sector, cnt, start);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes, in as few requests to the device as its driver
+   allows. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  read_sectors (block, sector, cnt, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -135,8 +264,281 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
   check_sector (block, sector);
   ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  write_sectors (block, sector, 1, buffer);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, in as
+   few requests to the device as its driver allows.  Returns
+   after the device has acknowledged receiving all of them. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  write_sectors (block, sector, cnt, buffer);
+}
+
+/* Makes the writes to BLOCK that have completed so far durable,
+   by having the device write its volatile cache back, if it has
+   one.  This is the only barrier: a completed write may still be
+   lost, or reach the medium after later ones, until a flush that
+   follows it returns. */
+void
+block_flush (struct block *block)
+{
+  enum intr_level old_level;
+
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->flush == NULL)
+    return;
+
+  block->ops->flush (block->aux);
+  old_level = intr_disable ();
+  block->stats.flushes++;
+  intr_set_level (old_level);
+}
+
+/* Tells BLOCK that the CNT sectors starting at SECTOR hold
+   nothing of value any more, so that a thin-provisioned disk image
+   may give back the space they take up.  What they read back as
+   is undefined until they are written again, so nothing may write
+   them meanwhile.  Does nothing if the device cannot discard. */
+void
+block_discard (struct block *block, block_sector_t sector,
+               block_sector_t cnt)
+{
+  enum intr_level old_level;
+
+  if (cnt == 0 || !block_can_discard (block))
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+
+  block->ops->discard (block->aux, sector, cnt);
+  old_level = intr_disable ();
+  block->stats.discards++;
+  block->stats.discard_sectors += cnt;
+  intr_set_level (old_level);
+}
+
+/* Returns true if block_discard() on BLOCK reaches a device that
+   can discard: BLOCK itself or, for a partition, its disk. */
+bool
+block_can_discard (struct block *block)
+{
+  for (; block->parent != NULL; block = block->parent)
+    continue;
+  return block->ops->discard != NULL;
+}
+
+/* Initializes R to transfer the CNT sectors starting at SECTOR
+   between the device and BUFFER: out of BUFFER if WRITE, into it
+   otherwise.  R has no COMPLETE callback. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, block_sector_t cnt, void *buffer)
+{
+  ASSERT (cnt > 0);
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->complete = NULL;
+  r->aux = NULL;
+  sema_init (&r->done, 0);
+}
+
+/* Returns true if request A's first sector precedes B's. */
+static bool
+request_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return (list_entry (a, struct block_request, elem)->sector
+          < list_entry (b, struct block_request, elem)->sector);
+}
+
+/* Queues R on BLOCK, or on the disk BLOCK is part of, and
+   returns at once.  R's sector is translated to the latter's. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  /* Account the sectors to a partition now, as only the disk
+     that carries out R counts them otherwise. */
+  if (block->parent != NULL)
+    {
+      enum intr_level old_level = intr_disable ();
+      if (r->write)
+        block->write_cnt += r->cnt;
+      else
+        block->read_cnt += r->cnt;
+      intr_set_level (old_level);
+    }
+  for (; block->parent != NULL; block = block->parent)
+    r->sector += block->parent_start;
+
+  r->submitted = timer_ticks ();
+  r->deadline = r->submitted + (r->write ? WRITE_DEADLINE : READ_DEADLINE);
+  r->ioprio = thread_get_priority () * IOPRIO_CNT / (PRI_MAX + 1);
+
+  lock_acquire (&block->queue_lock);
+  if (!block->dispatching)
+    {
+      if (thread_create (block->name, PRI_DEFAULT, dispatch_thread, block)
+          == TID_ERROR)
+        PANIC ("%s: could not start request thread", block->name);
+      block->dispatching = true;
+    }
+  TRACE (TRACE_BLOCK_SUBMIT, r, r->sector);
+  list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+  if (++block->stats.queued > block->stats.max_queued)
+    block->stats.max_queued = block->stats.queued;
+  cond_signal (&block->queue_ready, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for R, which was submitted without a COMPLETE callback,
+   to be carried out. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Returns R's I/O class at NOW: the class it was submitted in,
+   raised by one for each IOPRIO_AGE ticks it has waited. */
+static int
+request_ioprio (const struct block_request *r, int64_t now)
+{
+  int64_t ioprio = r->ioprio + (now - r->submitted) / IOPRIO_AGE;
+  return ioprio < IOPRIO_CNT ? ioprio : IOPRIO_CNT - 1;
+}
+
+/* Removes and returns the next request of BLOCK's queue, which
+   must not be empty: one whose deadline has passed, if any,
+   otherwise, among those of the highest I/O class, the first one
+   at or past the head in sector order, wrapping around to the
+   lowest sector (C-LOOK).
+   BLOCK's queue_lock must be held. */
+static struct block_request *
+next_request (struct block *block)
+{
+  struct block_request *oldest = NULL, *lowest = NULL, *next = NULL;
+  int64_t now = timer_ticks ();
+  int best = -1;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&block->queue));
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      int ioprio = request_ioprio (r, now);
+
+      if (oldest == NULL || r->deadline < oldest->deadline)
+        oldest = r;
+      if (ioprio > best)
+        {
+          /* The queue is in sector order, so R is the lowest of
+             its class. */
+          best = ioprio;
+          lowest = r;
+          next = NULL;
+        }
+      if (ioprio == best && next == NULL && r->sector >= block->head)
+        next = r;
+    }
+  if (oldest->deadline <= now)
+    next = oldest;
+  else if (next == NULL)
+    next = lowest;
+  list_remove (&next->elem);
+  block->stats.queued--;
+  return next;
+}
+
+/* Carries out the requests queued on BLOCK_, forever.  Requests
+   that continue each other, on disk and in memory, in the same
+   direction, are done in a single transfer. */
+static void
+dispatch_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct block_request *first, *last;
+      block_sector_t cnt;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_ready, &block->queue_lock);
+
+      /* Take the next request, and the queued ones that it can be
+         merged with. */
+      list_init (&batch);
+      first = last = next_request (block);
+      list_push_back (&batch, &first->elem);
+      cnt = first->cnt;
+      while (!list_empty (&block->queue))
+        {
+          struct list_elem *e;
+          struct block_request *r = NULL;
+
+          for (e = list_begin (&block->queue); e != list_end (&block->queue);
+               e = list_next (e))
+            {
+              r = list_entry (e, struct block_request, elem);
+              if (r->sector >= last->sector + last->cnt)
+                break;
+            }
+          if (e == list_end (&block->queue)
+              || r->sector != last->sector + last->cnt
+              || r->write != first->write
+              || (uint8_t *) r->buffer
+                 != (uint8_t *) last->buffer + last->cnt * BLOCK_SECTOR_SIZE
+              || cnt + r->cnt > MERGE_MAX)
+            break;
+          list_remove (&r->elem);
+          block->stats.queued--;
+          list_push_back (&batch, &r->elem);
+          cnt += r->cnt;
+          last = r;
+        }
+      block->head = first->sector + cnt;
+      lock_release (&block->queue_lock);
+
+      if (first->write)
+        write_sectors (block, first->sector, cnt, first->buffer);
+      else
+        read_sectors (block, first->sector, cnt, first->buffer);
+
+      while (!list_empty (&batch))
+        {
+          struct block_request *r = list_entry (list_pop_front (&batch),
+                                                struct block_request, elem);
+          TRACE (TRACE_BLOCK_DONE, r, r->sector);
+          if (r->complete != NULL)
+            r->complete (r);
+          else
+            sema_up (&r->done);
+        }
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -178,6 +580,17 @@ block_print_stats (void)
     }
 }
 
+/* Copies BLOCK's statistics into *STATS. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  stats->read_sectors = block->read_cnt;
+  stats->write_sectors = block->write_cnt;
+  intr_set_level (old_level);
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -200,6 +613,16 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  strlcpy (block->stats.name, block->name, sizeof block->stats.name);
+  block->next_sector = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->head = 0;
+  block->dispatching = false;
+  block->parent = NULL;
+  block->parent_start = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +634,18 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Makes BLOCK part of PARENT, starting at sector START of it.
+   Requests submitted to BLOCK then go into PARENT's queue, which
+   orders them together with those of PARENT's other parts. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (start + block->size <= parent->size);
+  block->parent = parent;
+  block->parent_start = start;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
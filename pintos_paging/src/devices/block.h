@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <syscall-nr.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -52,12 +55,59 @@ struct block *block_next (struct block *);
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
+void block_read_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                          void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_write_multiple (struct block *, block_sector_t, block_sector_t cnt,
+                           const void *);
+void block_flush (struct block *);
+void block_discard (struct block *, block_sector_t, block_sector_t cnt);
+bool block_can_discard (struct block *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+
+   A request is queued with block_submit() and carried out later
+   by a thread of the device, or of the disk it is part of, which
+   takes the queued requests in elevator order.  Each disk has its
+   own thread, so disks on different IDE channels have a request
+   in flight each at the same time.  The request's SECTOR is
+   then relative to that disk.  When it is done, COMPLETE is called from that
+   thread if it is set, else block_wait() returns.  The request
+   and its buffer must stay valid until then.
+
+   Each request is in one of IOPRIO_CNT classes, after the
+   priority of the thread that submits it, donations included.
+   Requests of higher classes are taken first; one that waits
+   rises a class every so often, so that none starves. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in the device's queue. */
+    bool write;                 /* Write, or read? */
+    block_sector_t sector;      /* First sector. */
+    block_sector_t cnt;         /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    int64_t submitted;          /* Timer tick it was submitted at. */
+    int64_t deadline;           /* Timer tick to be started by. */
+    int ioprio;                 /* I/O class, higher first. */
+    void (*complete) (struct block_request *); /* Callback, or null. */
+    void *aux;                  /* For COMPLETE's use. */
+    struct semaphore done;      /* Up'd when done, if no COMPLETE. */
+  };
+
+/* Number of I/O priority classes. */
+#define IOPRIO_CNT 4
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t sector, block_sector_t cnt,
+                         void *buffer);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
+void block_get_stats (struct block *, struct block_stats *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +115,30 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Read and write consecutive sectors in one request.
+       Optional: a null pointer makes block_read_multiple() or
+       block_write_multiple() fall back to READ or WRITE. */
+    void (*read_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, block_sector_t cnt,
+                            const void *buffer);
+
+    /* Write back the device's volatile write cache.  Optional: a
+       null pointer means the device has none, and writes are
+       durable once they complete. */
+    void (*flush) (void *aux);
+
+    /* Tell the device that consecutive sectors hold nothing of
+       value, so that it may unmap them.  Optional: a null pointer
+       means the device cannot, and block_discard() does nothing. */
+    void (*discard) (void *aux, block_sector_t, block_sector_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
 
 #endif /* devices/block.h */
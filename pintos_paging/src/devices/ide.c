@@ -5,13 +5,22 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  If the
+   controller is a PCI bus master, transfers to and from kernel
+   memory use DMA, as described by the Programming Interface for
+   Bus Master IDE Controller.  A disk's write cache is turned on
+   if it has one, so that writes complete once the disk has taken
+   the data, and flushed only by block_flush().  A disk that can
+   TRIM by DMA, as QEMU's can with "discard=unmap", is sent DATA
+   SET MANAGEMENT commands for block_discard(). */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -23,6 +32,7 @@
 #define reg_device(CHANNEL) ((CHANNEL)->reg_base + 6)   /* Device/LBA 27:24. */
 #define reg_status(CHANNEL) ((CHANNEL)->reg_base + 7)   /* Status (r/o). */
 #define reg_command(CHANNEL) reg_status (CHANNEL)       /* Command (w/o). */
+#define reg_features(CHANNEL) reg_error (CHANNEL)       /* Features (w/o). */
 
 /* ATA control block port addresses.
    (If we supported non-legacy ATA controllers this would not be
@@ -34,6 +44,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +60,55 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_SET_FEATURES 0xef           /* SET FEATURES. */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+#define CMD_DATA_SET_MANAGEMENT 0x06    /* DATA SET MANAGEMENT. */
+
+/* SET FEATURES subcommands, in the Features register. */
+#define FEAT_WCACHE_ON 0x02             /* Enable write cache. */
+
+/* DATA SET MANAGEMENT function, in the Features register. */
+#define DSM_TRIM 0x01                   /* Trim the ranges given. */
+
+/* Bus master IDE registers, relative to a channel's BM_BASE. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus master Command and Status register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+#define BM_STA_ERR 0x02         /* Transfer failed. */
+#define BM_STA_IRQ 0x04         /* Interrupt raised; write 1 to clear. */
+
+/* A physical region descriptor: one contiguous piece of a DMA
+   buffer, which must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000
+
+/* PRDs per channel, enough for IDE_MULTIPLE_CNT sectors. */
+#define PRD_CNT 4
+
+/* Most sectors transferred by one command.  The sector count
+   register holds up to 256 (as 0). */
+#define IDE_MULTIPLE_CNT 256
+
+/* A TRIM command takes one sector of ranges, each 8 bytes: the
+   first sector in bits 47:0 and the number of sectors, up to
+   TRIM_RANGE_MAX, in bits 63:48.  Ranges of 0 sectors are
+   ignored. */
+#define TRIM_RANGES (BLOCK_SECTOR_SIZE / sizeof (uint64_t))
+#define TRIM_RANGE_MAX 0xffff
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +117,13 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int block_cnt;              /* Sectors per interrupt in transfers of
+                                   several sectors: more than 1 if READ
+                                   and WRITE MULTIPLE are enabled. */
+    bool dma;                   /* Transfer by bus master DMA? */
+    bool write_cache;           /* Write cache on, for FLUSH CACHE to
+                                   write back? */
+    bool trim;                  /* Discard by TRIM? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +138,12 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct intr_work completion_work;   /* Ups completion_wait. */
+    unsigned completion_cnt;            /* Completions not yet up'd. */
+
+    uint16_t bm_base;           /* Bus master registers, or 0 if none. */
+    struct prd *prdt;           /* PRD table for DMA. */
+    uint64_t *trim;             /* Ranges for TRIM. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -79,13 +152,31 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables, so aligned that none crosses a 64 kB boundary. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
+/* TRIM range tables, one sector each, sent by DMA. */
+static uint64_t trim_tables[CHANNEL_CNT][TRIM_RANGES]
+  __attribute__ ((aligned (BLOCK_SECTOR_SIZE)));
+
 static struct block_operations ide_operations;
+static struct block_operations ide_trim_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static bool set_multiple_mode (struct ata_disk *, int block_cnt);
+static bool set_write_cache (struct ata_disk *);
+
+static void select_sectors (struct ata_disk *, block_sector_t,
+                            block_sector_t cnt);
+static void select_trim (struct ata_disk *);
+static void ide_read_multiple (void *, block_sector_t, block_sector_t cnt,
+                               void *);
+static void ide_write_multiple (void *, block_sector_t, block_sector_t cnt,
+                                const void *);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -96,11 +187,13 @@ static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static void complete_channel (void *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +216,14 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      lock_init_named (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      intr_work_init (&c->completion_work, complete_channel, c);
+      c->completion_cnt = 0;
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = prd_tables[chan_no];
+      c->trim = trim_tables[chan_no];
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +234,10 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->block_cnt = 1;
+          d->dma = false;
+          d->write_cache = false;
+          d->trim = false;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +257,29 @@ ide_init (void)
     }
 }
 
+/* Returns the base I/O port of the bus master registers of the
+   PCI IDE controller, with bus mastering enabled, or 0 if there
+   is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  struct pci_addr addr;
+  uint32_t class_reg, bar4;
+
+  if (!pci_find_class (0x01, 0x01, &addr))
+    return 0;
+
+  /* Bit 7 of the programming interface: bus master capable. */
+  class_reg = pci_read_config (addr, 0x08);
+  bar4 = pci_read_config (addr, 0x20);
+  if (!(class_reg & (0x80 << 8)) || !(bar4 & 1))
+    return 0;
+
+  /* Enable I/O space and bus mastering in the Command register. */
+  pci_write_config (addr, 0x04, pci_read_config (addr, 0x04) | 0x05);
+  return bar4 & 0xfffc;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -281,6 +406,36 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
+  /* Enable READ and WRITE MULTIPLE in blocks as large as the
+     device allows, given in word 47, rounded down to a power of
+     2. */
+  d->block_cnt = 1;
+  if ((uint8_t) id[47 * 2] > 1)
+    {
+      int block_cnt = 1;
+      while (block_cnt * 2 <= (uint8_t) id[47 * 2])
+        block_cnt *= 2;
+      if (set_multiple_mode (d, block_cnt))
+        d->block_cnt = block_cnt;
+    }
+
+  /* Use DMA if the channel and the device, by bit 8 of word 49,
+     support it. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
+  /* Turn on the write cache if the device has one, by bit 5 of
+     word 82, and can flush it, by bit 12 of word 83, which is
+     valid if its bits 15:14 are 01. */
+  d->write_cache = ((uint8_t) id[82 * 2] & 0x20) != 0
+                   && ((uint8_t) id[83 * 2 + 1] & 0xd0) == 0x50
+                   && set_write_cache (d);
+
+  /* TRIM if the device supports it, by bit 0 of word 169, and
+     the 48-bit commands it takes, by bit 10 of word 83.  We send
+     its ranges by DMA only. */
+  d->trim = d->dma && ((uint8_t) id[169 * 2] & 0x01) != 0
+            && ((uint8_t) id[83 * 2 + 1] & 0xc4) == 0x44;
+
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
@@ -305,7 +460,8 @@ identify_ata_device (struct ata_disk *d)
 
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
-                          &ide_operations, d);
+                          d->trim ? &ide_trim_operations : &ide_operations,
+                          d);
   partition_scan (block);
 }
 
@@ -337,63 +493,332 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Sets the number of sectors that disk D transfers per interrupt
+   in READ and WRITE MULTIPLE commands to BLOCK_CNT.  Returns
+   false if D refuses. */
+static bool
+set_multiple_mode (struct ata_disk *d, int block_cnt)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), block_cnt);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_until_idle (d);
+  return (inb (reg_status (c)) & STA_ERR) == 0;
+}
+
+/* Turns on disk D's write cache.  Returns false if D refuses. */
+static bool
+set_write_cache (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_features (c), FEAT_WCACHE_ON);
+  issue_pio_command (c, CMD_SET_FEATURES);
+  sema_down (&c->completion_wait);
+  wait_until_idle (d);
+  return (inb (reg_status (c)) & STA_ERR) == 0;
+}
+
+/* Reads the N sectors starting at SEC_NO from disk D into BUFFER
+   with a single PIO command.  The disk interrupts once for each
+   block of D->block_cnt sectors it has ready.  D's channel lock
+   must be held. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, block_sector_t n,
+          uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  block_sector_t i, j;
+
+  select_sectors (d, sec_no, n);
+  issue_pio_command (c, d->block_cnt > 1
+                        ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < n; i += d->block_cnt)
+    {
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      for (j = i; j < n && j < i + d->block_cnt; j++)
+        {
+          input_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+        }
+    }
+}
+
+/* Writes the N sectors starting at SEC_NO to disk D from BUFFER
+   with a single PIO command.  The disk interrupts once it has
+   taken each block of D->block_cnt sectors, and after the last
+   one once it is done.  D's channel lock must be held. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, block_sector_t n,
+           const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  block_sector_t i, j;
+
+  select_sectors (d, sec_no, n);
+  issue_pio_command (c, d->block_cnt > 1
+                        ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < n; i += d->block_cnt)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      for (j = i; j < n && j < i + d->block_cnt; j++)
+        {
+          output_sector (c, buffer);
+          buffer += BLOCK_SECTOR_SIZE;
+        }
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Sets up channel C's bus master to transfer the BYTES of
+   BUFFER, which must be in kernel memory, where it is physically
+   contiguous, into BUFFER if READ, else out of it, by the DMA
+   command that dma_run() issues next. */
+static void
+dma_prepare (struct channel *c, void *buffer, size_t bytes, bool read)
+{
+  uintptr_t phys;
+  size_t i;
+
+  /* Describe BUFFER with one PRD for each 64 kB region it
+     touches. */
+  phys = vtop (buffer);
+  for (i = 0; bytes > 0; i++)
+    {
+      size_t chunk = 0x10000 - (phys & 0xffff);
+      if (chunk > bytes)
+        chunk = bytes;
+      ASSERT (i < PRD_CNT);
+      c->prdt[i].addr = phys;
+      c->prdt[i].size = chunk & 0xffff;
+      c->prdt[i].flags = 0;
+      phys += chunk;
+      bytes -= chunk;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, read ? BM_CMD_READ : 0);
+  outb (c->bm_base + BM_STATUS,
+        inb (c->bm_base + BM_STATUS) | BM_STA_ERR | BM_STA_IRQ);
+}
+
+/* Issues DMA COMMAND, whose registers are set, on channel C, for
+   the transfer that dma_prepare() set up, and waits for the disk
+   to interrupt at the end; the CPU is free for other threads
+   meanwhile.  Returns false if the controller or the disk
+   reports an error. */
+static bool
+dma_run (struct channel *c, uint8_t command, bool read)
+{
+  uint8_t direction = read ? BM_CMD_READ : 0;
+  uint8_t status;
+
+  issue_pio_command (c, command);
+  outb (c->bm_base + BM_COMMAND, direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+  outb (c->bm_base + BM_COMMAND, direction);
+
+  status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, status | BM_STA_ERR | BM_STA_IRQ);
+  return (status & BM_STA_ERR) == 0 && (inb (reg_status (c)) & STA_ERR) == 0;
+}
+
+/* Transfers the N sectors starting at SEC_NO between disk D and
+   BUFFER by bus master DMA, into BUFFER if READ, else out of it.
+   Returns false, transferring nothing, if D cannot use DMA or
+   BUFFER is not in kernel memory; after a failed transfer, D
+   falls back to PIO for good.  D's channel lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, block_sector_t n,
+              void *buffer, bool read)
+{
+  struct channel *c = d->channel;
+
+  if (!d->dma || !is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+    return false;
+
+  dma_prepare (c, buffer, n * BLOCK_SECTOR_SIZE, read);
+  select_sectors (d, sec_no, n);
+  if (!dma_run (c, read ? CMD_READ_DMA : CMD_WRITE_DMA, read))
+    {
+      printf ("%s: DMA failed at sector %"PRDSNu", using PIO\n",
+              d->name, sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read (void *d, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+   acknowledged receiving the data, which may be in its write
+   cache until ide_flush().
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, with a single command for each run of up to
+   IDE_MULTIPLE_CNT of them: by DMA if possible, else by PIO. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                   void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < IDE_MULTIPLE_CNT ? cnt : IDE_MULTIPLE_CNT;
+
+      if (!dma_transfer (d, sec_no, n, buffer, true))
+        pio_read (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D from
+   BUFFER, with a single command for each run of up to
+   IDE_MULTIPLE_CNT of them: by DMA if possible, else by PIO. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, block_sector_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < IDE_MULTIPLE_CNT ? cnt : IDE_MULTIPLE_CNT;
+
+      if (!dma_transfer (d, sec_no, n, (void *) buffer, false))
+        pio_write (d, sec_no, n, buffer);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sec_no += n;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes disk D's write cache back to the medium, if it is on,
+   returning once the disk is done. */
+static void
+ide_flush (void *d_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  if (!d->write_cache)
+    return;
+
+  lock_acquire (&c->lock);
+  select_device_wait (d);
+  issue_pio_command (c, CMD_FLUSH_CACHE);
   sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: cache flush failed", d->name);
+  lock_release (&c->lock);
+}
+
+/* Discards the CNT sectors starting at SEC_NO of disk D, with a
+   TRIM command for each TRIM_RANGES ranges of up to TRIM_RANGE_MAX
+   of them.  After a TRIM that fails, D is not trimmed again. */
+static void
+ide_discard (void *d_, block_sector_t sec_no, block_sector_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0 && d->trim && d->dma)
+    {
+      block_sector_t first = sec_no;
+      size_t i;
+
+      for (i = 0; i < TRIM_RANGES; i++)
+        {
+          block_sector_t n = cnt < TRIM_RANGE_MAX ? cnt : TRIM_RANGE_MAX;
+          c->trim[i] = n > 0 ? sec_no | (uint64_t) n << 48 : 0;
+          sec_no += n;
+          cnt -= n;
+        }
+
+      dma_prepare (c, c->trim, BLOCK_SECTOR_SIZE, false);
+      select_trim (d);
+      if (!dma_run (c, CMD_DATA_SET_MANAGEMENT, false))
+        {
+          printf ("%s: TRIM failed at sector %"PRDSNu", not trimming\n",
+                  d->name, first);
+          d->trim = false;
+        }
+    }
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_flush,
+    NULL                /* DISCARD: no TRIM. */
+  };
+
+static struct block_operations ide_trim_operations =
+  {
+    ide_read,
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    ide_flush,
+    ide_discard
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection registers,
+   for a command on the CNT sectors starting at SEC_NO.  (We use
+   LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= IDE_MULTIPLE_CNT);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt & 0xff);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -401,6 +826,30 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
         DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
 }
 
+/* Selects device D, waiting for it to become ready, and then sets
+   up its registers for a DATA SET MANAGEMENT command that trims
+   the ranges in one sector.  The command is a 48-bit one, whose
+   registers are each written twice, high-order byte first. */
+static void
+select_trim (struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_features (c), 0);
+  outb (reg_features (c), DSM_TRIM);
+  outb (reg_nsect (c), 0);
+  outb (reg_nsect (c), 1);
+  outb (reg_lbal (c), 0);
+  outb (reg_lbal (c), 0);
+  outb (reg_lbam (c), 0);
+  outb (reg_lbam (c), 0);
+  outb (reg_lbah (c), 0);
+  outb (reg_lbah (c), 0);
+  outb (reg_device (c),
+        DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+}
+
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
@@ -514,7 +963,8 @@ interrupt_handler (struct intr_frame *f)
         if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            c->completion_cnt++;
+            intr_defer (&c->completion_work);   /* Wake up waiter later. */
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -524,4 +974,18 @@ interrupt_handler (struct intr_frame *f)
   NOT_REACHED ();
 }
 
+/* Wakes up the waiters on channel C_ for the completions that
+   interrupt_handler() has seen.  Runs as deferred interrupt
+   work. */
+static void
+complete_channel (void *c_) 
+{
+  struct channel *c = c_;
+  enum intr_level old_level = intr_disable ();
+
+  for (; c->completion_cnt > 0; c->completion_cnt--)
+    sema_up (&c->completion_wait);
+  intr_set_level (old_level);
+}
+
 
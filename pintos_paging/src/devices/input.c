@@ -1,5 +1,6 @@
 #include "devices/input.h"
 #include <debug.h>
+#include <string.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
 
@@ -41,6 +42,40 @@ input_getc (void)
   return key;
 }
 
+/* Waits for a key, then moves it and the rest of the keys in the
+   input buffer, up to SIZE in all, into BUF.  Returns the number
+   of keys moved, which is 0 only if SIZE is.
+
+   The keys are taken from the buffer a chunk at a time, with
+   interrupts off once per chunk, and copied to BUF with them on,
+   so BUF may be user memory that faults. */
+size_t
+input_read (void *buf_, size_t size) 
+{
+  uint8_t *buf = buf_;
+  size_t cnt = 0;
+
+  while (cnt < size)
+    {
+      uint8_t chunk[INTQ_BUFSIZE];
+      size_t n = 0, want = size - cnt < sizeof chunk ? size - cnt : sizeof chunk;
+      enum intr_level old_level = intr_disable ();
+
+      /* Wait for the first key only. */
+      if (cnt == 0)
+        chunk[n++] = intq_getc (&buffer);
+      n += intq_read (&buffer, chunk + n, want - n);
+      serial_notify ();
+      intr_set_level (old_level);
+
+      if (n == 0)
+        break;
+      memcpy (buf + cnt, chunk, n);
+      cnt += n;
+    }
+  return cnt;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
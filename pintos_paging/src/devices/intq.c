@@ -2,7 +2,6 @@
 #include <debug.h>
 #include "threads/thread.h"
 
-static int next (int pos);
 static void wait (struct intq *q, struct thread **waiter);
 static void signal (struct intq *q, struct thread **waiter);
 
@@ -12,7 +11,7 @@ intq_init (struct intq *q)
 {
   lock_init (&q->lock);
   q->not_full = q->not_empty = NULL;
-  q->head = q->tail = 0;
+  ring_init (&q->ring, q->buf, sizeof q->buf);
 }
 
 /* Returns true if Q is empty, false otherwise. */
@@ -20,7 +19,7 @@ bool
 intq_empty (const struct intq *q) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return q->head == q->tail;
+  return ring_empty (&q->ring);
 }
 
 /* Returns true if Q is full, false otherwise. */
@@ -28,7 +27,7 @@ bool
 intq_full (const struct intq *q) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  return next (q->head) == q->tail;
+  return ring_full (&q->ring);
 }
 
 /* Removes a byte from Q and returns it.
@@ -48,12 +47,25 @@ intq_getc (struct intq *q)
       lock_release (&q->lock);
     }
   
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
+  ring_read (&q->ring, &byte, 1);
   signal (q, &q->not_full);
   return byte;
 }
 
+/* Removes up to SIZE bytes from Q into BUF, as many as Q holds,
+   without waiting, and returns their number. */
+size_t
+intq_read (struct intq *q, void *buf, size_t size) 
+{
+  size_t cnt;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  cnt = ring_read (&q->ring, buf, size);
+  if (cnt > 0)
+    signal (q, &q->not_full);
+  return cnt;
+}
+
 /* Adds BYTE to the end of Q.
    If Q is full, sleeps until a byte is removed.
    When called from an interrupt handler, Q must not be full. */
@@ -69,18 +81,10 @@ intq_putc (struct intq *q, uint8_t byte)
       lock_release (&q->lock);
     }
 
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
+  ring_write (&q->ring, &byte, 1);
   signal (q, &q->not_empty);
 }
 
-/* Returns the position after POS within an intq. */
-static int
-next (int pos) 
-{
-  return (pos + 1) % INTQ_BUFSIZE;
-}
-
 /* WAITER must be the address of Q's not_empty or not_full
    member.  Waits until the given condition is true. */
 static void
@@ -1,6 +1,7 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <ring.h>
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
@@ -17,7 +18,7 @@
    protect kernel threads from one another, not from interrupt
    handlers. */
 
-/* Queue buffer size, in bytes. */
+/* Queue buffer size, in bytes.  A power of 2. */
 #define INTQ_BUFSIZE 64
 
 /* A circular queue of bytes. */
@@ -30,14 +31,14 @@ struct intq
 
     /* Queue. */
     uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
-    int head;                   /* New data is written here. */
-    int tail;                   /* Old data is read here. */
+    struct ring ring;           /* Data in BUF. */
   };
 
 void intq_init (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
 uint8_t intq_getc (struct intq *);
+size_t intq_read (struct intq *, void *, size_t);
 void intq_putc (struct intq *, uint8_t);
 
 #endif /* devices/intq.h */
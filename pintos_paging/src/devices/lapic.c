@@ -0,0 +1,169 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Local APIC.
+
+   Every CPU has one, at the same physical address, through which
+   it takes interrupts and sends interprocessor interrupts (IPIs)
+   to the others.  See [IA32-v3a] chapter 10 "Advanced Programmable
+   Interrupt Controller (APIC)".
+
+   The registers are mapped at LAPIC_VADDR, above the physical
+   memory mapping (which ends at LOADER_PHYS_BASE +
+   LOADER_RAM_MAX), in the kernel page directory, so that every process's page directory has them
+   too.  The 8259A PIC still delivers the device interrupts, in
+   the APIC's virtual wire mode as the BIOS left it. */
+
+/* Kernel virtual address of the registers. */
+#define LAPIC_VADDR ((void *) 0xfee00000)
+
+/* Registers, as byte offsets. */
+#define LAPIC_ID     0x020      /* Local APIC ID, in bits 24...31. */
+#define LAPIC_TPR    0x080      /* Task priority. */
+#define LAPIC_EOI    0x0b0      /* End of interrupt. */
+#define LAPIC_SVR    0x0f0      /* Spurious interrupt vector. */
+#define LAPIC_ICR_LO 0x300      /* Interrupt command, low half. */
+#define LAPIC_ICR_HI 0x310      /* Interrupt command, high half. */
+
+/* Spurious interrupt vector register. */
+#define SVR_ENABLE   0x100      /* APIC software enable. */
+#define SVR_VECTOR   0xff       /* Vector for spurious interrupts. */
+
+/* Interrupt command register. */
+#define ICR_FIXED    0x00000    /* Deliver VECTOR. */
+#define ICR_INIT     0x00500    /* Reset the target. */
+#define ICR_STARTUP  0x00600    /* Start the target at VECTOR << 12. */
+#define ICR_PENDING  0x01000    /* Delivery in progress. */
+#define ICR_ASSERT   0x04000    /* Level assert (always set). */
+
+/* Page table flag: caching disabled. */
+#define PTE_PCD 0x10
+
+/* Mapped registers, or a null pointer if there is no local
+   APIC. */
+static volatile uint32_t *lapic;
+
+/* Returns local APIC register REG. */
+static uint32_t
+lapic_read (int reg)
+{
+  return lapic[reg / 4];
+}
+
+/* Sets local APIC register REG to VALUE. */
+static void
+lapic_write (int reg, uint32_t value)
+{
+  lapic[reg / 4] = value;
+  lapic_read (LAPIC_ID);        /* Wait for the write to finish. */
+}
+
+/* Maps the local APICs' registers, at physical address PADDR,
+   and enables the one of the calling CPU.  Returns false,
+   leaving the kernel without APIC support, if a page table
+   cannot be allocated. */
+bool
+lapic_init (uintptr_t paddr)
+{
+  uint32_t *pde = init_page_dir + pd_no (LAPIC_VADDR);
+  uint32_t *pt;
+
+  ASSERT (lapic == NULL);
+  ASSERT (pg_ofs ((void *) paddr) == 0);
+
+  if (*pde == 0) 
+    {
+      pt = palloc_get_page (PAL_ZERO);
+      if (pt == NULL)
+        return false;
+      *pde = pde_create (pt);
+    }
+  else
+    pt = pde_get_pt (*pde);
+  pt[pt_no (LAPIC_VADDR)] = paddr | PTE_PCD | PTE_W | PTE_P;
+
+  lapic = LAPIC_VADDR;
+  lapic_init_ap ();
+  return true;
+}
+
+/* Enables the local APIC of the calling CPU, once lapic_init()
+   has mapped it. */
+void
+lapic_init_ap (void)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | SVR_VECTOR);
+  lapic_write (LAPIC_TPR, 0);
+}
+
+/* Returns true if lapic_init() has set up the local APICs. */
+bool
+lapic_present (void)
+{
+  return lapic != NULL;
+}
+
+/* Returns the APIC ID of the calling CPU, or 0 if there are no
+   local APICs. */
+uint8_t
+lapic_id (void)
+{
+  return lapic != NULL ? lapic_read (LAPIC_ID) >> 24 : 0;
+}
+
+/* Acknowledges the interrupt being handled, if it came through
+   the local APIC. */
+void
+lapic_eoi (void)
+{
+  if (lapic != NULL)
+    lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends the interrupt command LOW to the CPU with APIC_ID and
+   waits for it to be delivered. */
+static void
+send_command (uint8_t apic_id, uint32_t low)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, low);
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    barrier ();
+}
+
+/* Interrupts the CPU with APIC_ID with VECTOR. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vector)
+{
+  send_command (apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+/* Starts the application processor with APIC_ID in real mode at
+   physical address ENTRY, which must be page-aligned and below
+   1 MB, by the INIT-SIPI-SIPI sequence of the MultiProcessor
+   Specification, appendix B.4.  Sleeps about 10 ms. */
+void
+lapic_start_ap (uint8_t apic_id, uintptr_t entry)
+{
+  int i;
+
+  ASSERT (entry % PGSIZE == 0 && entry < 0x100000);
+
+  send_command (apic_id, ICR_INIT | ICR_ASSERT);
+  timer_msleep (10);
+  for (i = 0; i < 2; i++)
+    {
+      send_command (apic_id, ICR_STARTUP | ICR_ASSERT | (entry >> 12));
+      timer_usleep (200);
+    }
+}
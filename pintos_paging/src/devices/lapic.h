@@ -0,0 +1,15 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool lapic_init (uintptr_t paddr);
+void lapic_init_ap (void);
+bool lapic_present (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vector);
+void lapic_start_ap (uint8_t apic_id, uintptr_t entry);
+
+#endif /* devices/lapic.h */
@@ -0,0 +1,130 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Access to PCI configuration space, through configuration
+   mechanism #1: the address of a 32-bit configuration register
+   is written to CONFIG_ADDRESS, and the register is then read or
+   written at CONFIG_DATA. */
+
+#define CONFIG_ADDRESS 0xcf8
+#define CONFIG_DATA 0xcfc
+
+/* Configuration registers. */
+#define PCI_REG_ID 0x00         /* Device ID, vendor ID. */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog IF, revision. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+
+/* Selects configuration register REG of function ADDR. */
+static void
+select_config (struct pci_addr addr, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  ASSERT (addr.dev < 32 && addr.func < 8);
+
+  outl (CONFIG_ADDRESS, (1u << 31) | ((uint32_t) addr.bus << 16)
+                        | ((uint32_t) addr.dev << 11)
+                        | ((uint32_t) addr.func << 8) | reg);
+}
+
+/* Returns configuration register REG of function ADDR. */
+uint32_t
+pci_read_config (struct pci_addr addr, uint8_t reg)
+{
+  select_config (addr, reg);
+  return inl (CONFIG_DATA);
+}
+
+/* Sets configuration register REG of function ADDR to VALUE. */
+void
+pci_write_config (struct pci_addr addr, uint8_t reg, uint32_t value)
+{
+  select_config (addr, reg);
+  outl (CONFIG_DATA, value);
+}
+
+/* Searches the PCI buses for functions for which MATCH, given
+   each one's location and AUX, returns true.  Returns true and
+   stores in *ADDR the location of the INDEXth of them, counting
+   from 0, if there are that many, otherwise false. */
+static bool
+find_function (bool (*match) (struct pci_addr, const void *aux),
+               const void *aux, int index, struct pci_addr *addr)
+{
+  struct pci_addr a;
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          a.bus = bus;
+          a.dev = dev;
+          a.func = func;
+          if ((pci_read_config (a, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device at all. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (match (a, aux) && index-- == 0)
+            {
+              *addr = a;
+              return true;
+            }
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (a, PCI_REG_HEADER) & (0x80 << 16)))
+            break;
+        }
+  return false;
+}
+
+/* Returns true if function A has the class and subclass in the
+   two bytes at AUX. */
+static bool
+class_matches (struct pci_addr a, const void *aux)
+{
+  const uint8_t *class = aux;
+  uint32_t class_reg = pci_read_config (a, PCI_REG_CLASS);
+
+  return (class_reg >> 24) == class[0]
+         && ((class_reg >> 16) & 0xff) == class[1];
+}
+
+/* Searches the PCI buses for the first function of the given
+   CLASS and SUBCLASS.  Returns true and stores its location in
+   *ADDR if one exists, otherwise false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *addr)
+{
+  uint8_t aux[2];
+
+  aux[0] = class;
+  aux[1] = subclass;
+  return find_function (class_matches, aux, 0, addr);
+}
+
+/* Returns true if function A has the vendor and device IDs in
+   the 32-bit word at AUX. */
+static bool
+id_matches (struct pci_addr a, const void *aux)
+{
+  return pci_read_config (a, PCI_REG_ID) == *(const uint32_t *) aux;
+}
+
+/* Searches the PCI buses for functions with the given VENDOR and
+   DEVICE IDs.  Returns true and stores in *ADDR the location of
+   the INDEXth of them, counting from 0, if there are that many,
+   otherwise false. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int index,
+                 struct pci_addr *addr)
+{
+  uint32_t id = ((uint32_t) device << 16) | vendor;
+
+  return find_function (id_matches, &id, index, addr);
+}
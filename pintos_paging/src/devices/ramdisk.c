@@ -0,0 +1,128 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory, in pages of the kernel pool,
+   which need not be contiguous.  Its sectors are copied with
+   memcpy(), so it has no seek time and no interrupts, and needs
+   no locking: as with a disk, callers do not access one sector
+   concurrently. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The RAM disk's pages. */
+static uint8_t **pages;
+static size_t page_cnt;
+
+static struct block_operations ramdisk_operations;
+
+/* Registers a RAM disk of KB kilobytes, named "ram0", if KB is
+   nonzero.  Its contents start out as zeros. */
+void
+ramdisk_init (size_t kb)
+{
+  block_sector_t size = kb * 1024 / BLOCK_SECTOR_SIZE;
+  size_t i;
+
+  if (size == 0)
+    return;
+
+  page_cnt = DIV_ROUND_UP (size, SECTORS_PER_PAGE);
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ram0: out of memory");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ram0: out of memory for %zu kB", kb);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk", size,
+                  &ramdisk_operations, NULL);
+}
+
+/* Returns the address of SECTOR. */
+static uint8_t *
+sector_addr (block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < page_cnt);
+  return (pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Returns the number of sectors, at most CNT, starting at SECTOR
+   that lie in the same page as SECTOR. */
+static block_sector_t
+run_in_page (block_sector_t sector, block_sector_t cnt)
+{
+  block_sector_t left = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+  return cnt < left ? cnt : left;
+}
+
+/* Reads the CNT sectors starting at SECTOR into BUFFER_, a page
+   at a time. */
+static void
+ramdisk_read_multiple (void *aux UNUSED, block_sector_t sector,
+                       block_sector_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t n = run_in_page (sector, cnt);
+      memcpy (buffer, sector_addr (sector), n * BLOCK_SECTOR_SIZE);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Writes the CNT sectors starting at SECTOR from BUFFER_, a page
+   at a time. */
+static void
+ramdisk_write_multiple (void *aux UNUSED, block_sector_t sector,
+                        block_sector_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t n = run_in_page (sector, cnt);
+      memcpy (sector_addr (sector), buffer, n * BLOCK_SECTOR_SIZE);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Reads SECTOR into BUFFER. */
+static void
+ramdisk_read (void *aux, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (aux, sector, 1, buffer);
+}
+
+/* Writes SECTOR from BUFFER. */
+static void
+ramdisk_write (void *aux, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (aux, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL,
+    NULL
+  };
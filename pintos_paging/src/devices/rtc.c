@@ -1,5 +1,7 @@
 #include "devices/rtc.h"
+#include <debug.h>
 #include <stdio.h>
+#include "threads/interrupt.h"
 #include "threads/io.h"
 
 /* This code is an interface to the MC146818A-compatible real
@@ -28,14 +30,24 @@
 
 /* Register A. */
 #define RTCSA_UIP	0x80	/* Set while time update in progress. */
+#define RTCSA_RATE	0x0f	/* Periodic interrupt rate select. */
 
 /* Register B. */
 #define	RTCSB_SET	0x80	/* Disables update to let time be set. */
+#define RTCSB_PIE	0x40	/* Periodic interrupt enable. */
 #define RTCSB_DM	0x04	/* 0 = BCD time format, 1 = binary format. */
 #define RTCSB_24HR	0x02    /* 0 = 12-hour format, 1 = 24-hour format. */
 
+/* Periodic interrupts come at 32768 >> (RATE - 1) Hz: with rate
+   3, at 8192 Hz, about every 122 us. */
+#define RTC_PERIODIC_RATE 3
+
 static int bcd_to_bin (uint8_t);
 static uint8_t cmos_read (uint8_t index);
+static void cmos_write (uint8_t index, uint8_t);
+
+/* Called on each periodic interrupt. */
+static void (*periodic_handler) (void);
 
 /* Returns number of seconds since Unix epoch of January 1,
    1970. */
@@ -107,6 +119,57 @@ bcd_to_bin (uint8_t x)
 static uint8_t
 cmos_read (uint8_t index)
 {
+  enum intr_level old_level = intr_disable ();
+  uint8_t data;
+
+  outb (CMOS_REG_SET, index);
+  data = inb (CMOS_REG_IO);
+  intr_set_level (old_level);
+  return data;
+}
+
+/* Writes DATA to the CMOS register with the given INDEX. */
+static void
+cmos_write (uint8_t index, uint8_t data)
+{
+  enum intr_level old_level = intr_disable ();
+
   outb (CMOS_REG_SET, index);
-  return inb (CMOS_REG_IO);
+  outb (CMOS_REG_IO, data);
+  intr_set_level (old_level);
+}
+
+/* RTC interrupt handler. */
+static void
+rtc_interrupt (struct intr_frame *f UNUSED)
+{
+  /* Reading register C acknowledges the interrupt; until then
+     the RTC raises no other. */
+  if (cmos_read (RTC_REG_C) & RTCSB_PIE)
+    periodic_handler ();
+}
+
+/* Sets up the RTC's periodic interrupt, initially disabled, to
+   call HANDLER in interrupt context. */
+void
+rtc_periodic_init (void (*handler) (void))
+{
+  ASSERT (handler != NULL);
+
+  periodic_handler = handler;
+  cmos_write (RTC_REG_A, (cmos_read (RTC_REG_A) & ~RTCSA_RATE)
+                         | RTC_PERIODIC_RATE);
+  intr_register_ext (0x28, rtc_interrupt, "RTC");
+}
+
+/* Turns the periodic interrupt on or off. */
+void
+rtc_periodic_enable (bool enable)
+{
+  enum intr_level old_level = intr_disable ();
+  uint8_t b = cmos_read (RTC_REG_B);
+
+  cmos_write (RTC_REG_B, enable ? b | RTCSB_PIE : b & ~RTCSB_PIE);
+  cmos_read (RTC_REG_C);
+  intr_set_level (old_level);
 }
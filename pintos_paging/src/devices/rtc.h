@@ -1,8 +1,12 @@
 #ifndef RTC_H
 #define RTC_H
 
+#include <stdbool.h>
+
 typedef unsigned long time_t;
 
 time_t rtc_get_time (void);
+void rtc_periodic_init (void (*handler) (void));
+void rtc_periodic_enable (bool);
 
 #endif
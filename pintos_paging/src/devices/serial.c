@@ -1,7 +1,8 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <ring.h>
+#include <stdio.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -37,6 +38,11 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear both FIFOs. */
+#define FIFO_SIZE 16            /* Bytes in the transmit FIFO. */
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -51,8 +57,30 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
+/* Data to be transmitted, in a ring that serial_putc() appends
+   to and the interrupt handler drains.  A writer that finds it
+   full waits if it can sleep, and otherwise drops its byte,
+   rather than busy-waiting for the UART. */
+#define TXBUF_SIZE 16384        /* Power of 2. */
+static uint8_t txbuf[TXBUF_SIZE];
+static struct ring tx_ring;
+static struct semaphore tx_space; /* Up'd as the buffer drains. */
+static unsigned tx_waiters;     /* Threads waiting on tx_space. */
+static long long tx_dropped;    /* Bytes dropped for lack of room. */
+
+/* Returns true if the transmit buffer is empty. */
+static bool
+tx_empty (void)
+{
+  return ring_empty (&tx_ring);
+}
+
+/* Returns true if the transmit buffer is full. */
+static bool
+tx_full (void)
+{
+  return ring_full (&tx_ring);
+}
 
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
@@ -71,7 +99,8 @@ init_poll (void)
   outb (FCR_REG, 0);                    /* Disable FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  ring_init (&tx_ring, txbuf, sizeof txbuf);
+  sema_init (&tx_space, 0);
   mode = POLL;
 } 
 
@@ -88,6 +117,7 @@ serial_init_queue (void)
   ASSERT (mode == POLL);
 
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);
   mode = QUEUE;
   old_level = intr_disable ();
   write_ier ();
@@ -110,19 +140,24 @@ serial_putc (uint8_t byte)
     }
   else 
     {
-      /* Otherwise, queue a byte and update the interrupt enable
+      /* Otherwise, buffer a byte and update the interrupt enable
          register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
+      while (tx_full ())
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
+          if (old_level == INTR_OFF)
+            {
+              /* If we wanted to wait for the buffer to drain,
+                 we'd have to reenable interrupts.  That's
+                 impolite, so we drop the byte instead. */
+              tx_dropped++;
+              intr_set_level (old_level);
+              return;
+            }
+          tx_waiters++;
+          sema_down (&tx_space);
         }
 
-      intq_putc (&txq, byte); 
+      ring_write (&tx_ring, &byte, 1);
       write_ier ();
     }
   
@@ -135,11 +170,20 @@ void
 serial_flush (void) 
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  uint8_t byte;
+
+  while (ring_read (&tx_ring, &byte, 1) > 0)
+    putc_poll (byte);
   intr_set_level (old_level);
 }
 
+/* Prints serial port statistics. */
+void
+serial_print_stats (void)
+{
+  printf ("Serial: %lld characters dropped\n", tx_dropped);
+}
+
 /* The fullness of the input buffer may have changed.  Reassess
    whether we should block receive interrupts.
    Called by the input buffer routines when characters are added
@@ -182,7 +226,7 @@ write_ier (void)
 
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (!tx_empty ())
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
@@ -218,10 +262,22 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* As long as we have bytes to transmit, and the hardware's
+     transmit FIFO is empty, fill it. */
+  while (!tx_empty () && (inb (LSR_REG) & LSR_THRE) != 0) 
+    {
+      uint8_t chunk[FIFO_SIZE];
+      size_t i, n;
+
+      n = ring_read (&tx_ring, chunk, sizeof chunk);
+      for (i = 0; i < n; i++)
+        outb (THR_REG, chunk[i]);
+    }
+
+  /* Wake up the writers waiting for room. */
+  if (!tx_full ())
+    for (; tx_waiters > 0; tx_waiters--)
+      sema_up (&tx_space);
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
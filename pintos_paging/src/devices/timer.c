@@ -3,8 +3,12 @@
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
+#include <syscall-nr.h>
 #include "devices/pit.h"
+#include "devices/rtc.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -17,16 +21,76 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
+/* Number of timer ticks since OS booted.  Only the timer
+   interrupt writes it, and it is read without turning interrupts
+   off: TICKS_SEQ is odd while it is being written, and changes
+   with every write, so that a reader retries a torn read. */
 static int64_t ticks;
-
-/* Number of loops per timer tick.
-   Initialized by timer_calibrate(). */
-static unsigned loops_per_tick;
+static unsigned ticks_seq;
+
+/* Monotonic clock.
+
+   Up to timer_calibrate(), timer_ns() counts in whole ticks.
+   From then on it counts time stamp counter cycles since TSC_BASE,
+   when it stood at NS_BASE, converted at the TSC_HZ measured
+   against the PIT.  Brief delays spin on the TSC too. */
+#define NS_PER_SEC 1000000000
+#define NS_PER_TICK (NS_PER_SEC / TIMER_FREQ)
+#define CALIBRATE_TICKS 4       /* Ticks to measure TSC_HZ over. */
+static uint64_t tsc_hz;         /* TSC cycles per second, 0 if unknown. */
+static uint64_t tsc_base;
+static int64_t ns_base;
+
+/* Copy of the clock for user programs, which map it read-only. */
+static struct time_page *time_page;
+static void time_page_update (void);
+
+/* High-resolution timers, pending, in order of expiry.  While
+   there are any, the RTC's periodic interrupt checks them. */
+static struct list hrtimers;
+
+/* Hierarchical timer wheel of pending timeouts.
+
+   Level 0 has a slot for each of the next WHEEL_SIZE ticks.  Each
+   slot of level L > 0 holds the timeouts of a span of
+   WHEEL_SIZE**L ticks, which are redistributed to the lower
+   levels, a span at a time, when level L-1 wraps around.  Setting
+   and canceling a timeout is a list insertion or removal, and
+   each timeout is moved at most once per level before it runs.
+   Timeouts more than WHEEL_SIZE**WHEEL_LEVELS ticks away wait in
+   the last level's slot for that limit and are placed again from
+   there. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static int64_t wheel_ticks;     /* Next tick to be run. */
+
+/* The timer interrupt only counts the tick and leaves the wheel
+   to deferred work, which catches it up to `ticks'. */
+static struct intr_work wheel_work;
+static void run_wheel (void *);
+
+/* Dynamic ticks.
+
+   If timer_tickless is set, the idle thread stops the periodic
+   tick while it waits: timer_idle_enter() programs the PIT to
+   interrupt once, just in time for the next tick at which a
+   timeout is due or the wheel cascades, as far ahead as the
+   16-bit counter allows.  If that interrupt comes, it makes up
+   for all the ticks it stood for.  If another interrupt ends the
+   wait first, timer_idle_exit() works out from the counter how
+   many ticks have passed, to be made up by the next periodic
+   interrupt, and restarts the periodic tick. */
+bool timer_tickless;
+#define CYCLES_PER_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define ONESHOT_MAX_TICKS (UINT16_MAX / CYCLES_PER_TICK)
+static int oneshot_ticks;       /* Ticks a running one-shot stands for. */
+static int lost_ticks;          /* Ticks to make up at the next tick. */
+static unsigned lost_cycles;    /* Fraction of a tick to make up. */
 
 static intr_handler_func timer_interrupt;
-static bool too_many_loops (unsigned loops);
-static void busy_wait (int64_t loops);
+static void hrtimer_interrupt (void);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
@@ -35,44 +99,115 @@ static void real_time_delay (int64_t num, int32_t denom);
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+
+  list_init (&hrtimers);
+  intr_work_init (&wheel_work, run_wheel, NULL);
+
+  time_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  time_page->tick_ns = NS_PER_TICK;
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  rtc_periodic_init (hrtimer_interrupt);
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Measures the rate of the time stamp counter, used for the
+   monotonic clock and to implement brief delays, over a few
+   timer ticks. */
 void
 timer_calibrate (void) 
 {
-  unsigned high_bit, test_bit;
+  int64_t start;
+  uint64_t tsc;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
-  /* Approximate loops_per_tick as the largest power-of-two
-     still less than one timer tick. */
-  loops_per_tick = 1u << 10;
-  while (!too_many_loops (loops_per_tick << 1)) 
-    {
-      loops_per_tick <<= 1;
-      ASSERT (loops_per_tick != 0);
-    }
+  /* Count cycles from the start of one tick to the start of
+     another. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  tsc = rdtsc ();
+  start = ticks;
+  while (ticks - start < CALIBRATE_TICKS)
+    barrier ();
+
+  intr_disable ();
+  tsc_base = rdtsc ();
+  ns_base = ticks * NS_PER_TICK;
+  tsc_hz = (tsc_base - tsc) * TIMER_FREQ / CALIBRATE_TICKS;
+  time_page_update ();
+  intr_enable ();
+
+  printf ("%'"PRIu64" cycles/s.\n", tsc_hz);
+}
+
+/* Returns the nanoseconds since the OS booted. */
+int64_t
+timer_ns (void)
+{
+  uint64_t cycles;
 
-  /* Refine the next 8 bits of loops_per_tick. */
-  high_bit = loops_per_tick;
-  for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-    if (!too_many_loops (high_bit | test_bit))
-      loops_per_tick |= test_bit;
+  if (tsc_hz == 0)
+    return timer_ticks () * NS_PER_TICK;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  /* Split CYCLES to keep the products in range. */
+  cycles = rdtsc () - tsc_base;
+  return ns_base + cycles / tsc_hz * NS_PER_SEC
+         + cycles % tsc_hz * NS_PER_SEC / tsc_hz;
+}
+
+/* Returns the TSC cycles per second, or 0 before
+   timer_calibrate(). */
+uint64_t
+timer_tsc_hz (void)
+{
+  return tsc_hz;
+}
+
+/* Returns the kernel address of the time page, which processes
+   map read-only at TIME_PAGE. */
+void *
+timer_time_page (void)
+{
+  return time_page;
+}
+
+/* Brings the time page up to date.  Interrupts must be off. */
+static void
+time_page_update (void)
+{
+  time_page->seq++;
+  barrier ();
+  time_page->ticks = ticks;
+  time_page->tsc_hz = tsc_hz;
+  time_page->tsc_base = tsc_base;
+  time_page->ns_base = ns_base;
+  barrier ();
+  time_page->seq++;
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = ticks_seq;
+      barrier ();
+      t = ticks;
+      barrier ();
+    }
+  while ((seq & 1) != 0 || seq != ticks_seq);
   return t;
 }
 
@@ -172,95 +307,379 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Initializes TO to call FUNC, which may use AUX, when it
+   expires.  TO is not pending. */
+void
+timeout_init (struct timeout *to, timeout_func *func, void *aux)
+{
+  to->pending = false;
+  to->func = func;
+  to->aux = aux;
+}
+
+/* Puts TO in its slot of the wheel.  Interrupts must be off. */
+static void
+wheel_insert (struct timeout *to)
+{
+  int64_t delta = to->expires - wheel_ticks;
+  int64_t expires = to->expires;
+  int level;
+
+  if (delta < 0)
+    {
+      /* Already due: run at the next tick. */
+      expires = wheel_ticks;
+      level = 0;
+    }
+  else
+    {
+      for (level = 0; level < WHEEL_LEVELS - 1; level++)
+        if (delta < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+          break;
+      if (delta >= (int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+        expires = wheel_ticks + ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+                  - 1;
+    }
+  list_push_back (&wheel[level][(expires >> (WHEEL_BITS * level))
+                                & (WHEEL_SIZE - 1)],
+                  &to->elem);
+}
+
+/* Arranges for TO's function to be called, from the timer
+   interrupt handler, once timer tick WHEN has been reached, or at
+   the next tick if WHEN has already passed.  If TO was already
+   pending, it is moved. */
+void
+timeout_set (struct timeout *to, int64_t when)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (to->pending)
+    list_remove (&to->elem);
+  to->expires = when;
+  to->pending = true;
+  wheel_insert (to);
+
+  intr_set_level (old_level);
+}
+
+/* Cancels TO.  Returns true if it was pending, false if its
+   function has already been called or it was never set. */
+bool
+timeout_cancel (struct timeout *to)
+{
+  enum intr_level old_level = intr_disable ();
+  bool was_pending = to->pending;
+
+  if (was_pending)
+    {
+      list_remove (&to->elem);
+      to->pending = false;
+    }
+
+  intr_set_level (old_level);
+  return was_pending;
+}
+
+/* Moves the timeouts of slot SLOT of wheel level LEVEL down to
+   the lower levels and returns SLOT. */
+static int
+cascade (int level, int slot)
+{
+  struct list *list = &wheel[level][slot];
+
+  while (!list_empty (list))
+    wheel_insert (list_entry (list_pop_front (list), struct timeout, elem));
+  return slot;
+}
+
+/* Runs the timeouts that have expired by tick NOW. */
+static void
+run_timeouts (int64_t now)
+{
+  while (wheel_ticks <= now)
+    {
+      int slot = wheel_ticks & (WHEEL_SIZE - 1);
+      struct list expired;
+      int level;
+
+      /* When a level wraps around, bring down the next span of
+         the level above. */
+      for (level = 1; slot == 0 && level < WHEEL_LEVELS; level++)
+        slot = cascade (level, (wheel_ticks >> (WHEEL_BITS * level))
+                               & (WHEEL_SIZE - 1));
+      slot = wheel_ticks & (WHEEL_SIZE - 1);
+      wheel_ticks++;
+
+      /* Timeouts set by the functions below, if already due, go
+         into the next tick's slot. */
+      list_init (&expired);
+      while (!list_empty (&wheel[0][slot]))
+        list_push_back (&expired, list_pop_front (&wheel[0][slot]));
+      while (!list_empty (&expired))
+        {
+          struct timeout *to = list_entry (list_pop_front (&expired),
+                                           struct timeout, elem);
+          to->pending = false;
+          to->func (to);
+        }
+    }
+}
+
+/* Runs the timeouts that have expired by now, as deferred
+   interrupt work.  The wheel is still only touched with
+   interrupts off. */
+static void
+run_wheel (void *aux UNUSED)
+{
+  enum intr_level old_level = intr_disable ();
+  run_timeouts (ticks);
+  intr_set_level (old_level);
+}
+
+/* Returns the number of ticks, at most ONESHOT_MAX_TICKS, until
+   the timer wheel next has work to do.  Interrupts must be off. */
+static int
+ticks_until_work (void)
+{
+  int n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (n = 1; n < (int) ONESHOT_MAX_TICKS; n++)
+    {
+      int slot = (wheel_ticks + n - 1) & (WHEEL_SIZE - 1);
+      if (slot == 0 || !list_empty (&wheel[0][slot]))
+        break;
+    }
+  return n;
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   waits for an interrupt.  In tickless mode, replaces the
+   periodic tick by a single interrupt at the next tick with work
+   to do. */
+void
+timer_idle_enter (void)
+{
+  int n;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || lost_ticks > 0)
+    return;
+
+  n = ticks_until_work ();
+  if (n > 1)
+    {
+      oneshot_ticks = n;
+      pit_start_oneshot (0, n * CYCLES_PER_TICK);
+    }
+}
+
+/* Called by the idle thread, with interrupts off, once it has
+   been woken up.  If the one-shot interrupt has not come yet,
+   accounts for the time passed and goes back to periodic
+   ticks. */
+void
+timer_idle_exit (void)
+{
+  unsigned count, remaining, elapsed;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  count = oneshot_ticks * CYCLES_PER_TICK;
+  remaining = pit_read_count (0);
+  if (remaining > count)
+    {
+      /* The count ran out, and wrapped around, since interrupts
+         were turned off: its interrupt, still pending, will
+         count as the last tick. */
+      lost_ticks += oneshot_ticks - 1;
+    }
+  else
+    {
+      elapsed = count - remaining + lost_cycles;
+      lost_ticks += elapsed / CYCLES_PER_TICK;
+      lost_cycles = elapsed % CYCLES_PER_TICK;
+    }
+  oneshot_ticks = 0;
+  pit_configure_channel (0, 2, TIMER_FREQ);
+}
+
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
-  ticks++;
+  int n = 1 + lost_ticks;
 
-  // 
-  thread_tick (timer_ticks());
-  
-  // // add
-  // if (thread_mlfqs)
-  // {
-  //   thread_mlfqs_increase_recent_cpu ();
-  //   if (ticks % TIMER_FREQ == 0)
-  //     thread_mlfqs_update_load_avg_and_recent_cpu ();
-  //   else if (ticks % 4 == 0)
-  //     thread_mlfqs_update_priority (thread_current ());
-  // }
+  lost_ticks = 0;
+  if (oneshot_ticks > 0)
+    {
+      n = oneshot_ticks;
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  while (n-- > 0)
+    {
+      ticks_seq++;
+      barrier ();
+      ticks++;
+      barrier ();
+      ticks_seq++;
+
+      /* The low bits of CS hold the interrupted code's privilege
+         level. */
+      thread_tick (ticks, (args->cs & 3) != 0);
+    }
+  time_page_update ();
+  profile_tick (args);
+  intr_defer (&wheel_work);
+}
 
+/* Initializes H to call FUNC, which may use AUX, when it
+   expires.  H is not pending. */
+void
+hrtimer_init (struct hrtimer *h, hrtimer_func *func, void *aux)
+{
+  h->pending = false;
+  h->func = func;
+  h->aux = aux;
 }
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
+/* Returns true if hrtimer A expires before B. */
 static bool
-too_many_loops (unsigned loops) 
+hrtimer_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
 {
-  /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier ();
+  return (list_entry (a, struct hrtimer, elem)->expires
+          < list_entry (b, struct hrtimer, elem)->expires);
+}
 
-  /* Run LOOPS loops. */
-  start = ticks;
-  busy_wait (loops);
+/* Arranges for H's function to be called, from an interrupt
+   handler, once timer_ns() reaches WHEN.  If H was already
+   pending, it is moved.  Meant for waits shorter than a tick:
+   the periodic interrupt runs as long as any H is pending. */
+void
+hrtimer_set (struct hrtimer *h, int64_t when)
+{
+  enum intr_level old_level = intr_disable ();
 
-  /* If the tick count changed, we iterated too long. */
-  barrier ();
-  return start != ticks;
-}
+  if (h->pending)
+    list_remove (&h->elem);
+  else if (list_empty (&hrtimers))
+    rtc_periodic_enable (true);
+  h->expires = when;
+  h->pending = true;
+  list_insert_ordered (&hrtimers, &h->elem, hrtimer_less, NULL);
 
-/* Iterates through a simple loop LOOPS times, for implementing
-   brief delays.
+  intr_set_level (old_level);
+}
 
-   Marked NO_INLINE because code alignment can significantly
-   affect timings, so that if this function was inlined
-   differently in different places the results would be difficult
-   to predict. */
-static void NO_INLINE
-busy_wait (int64_t loops) 
+/* Cancels H.  Returns true if it was pending, false if its
+   function has already been called or it was never set. */
+bool
+hrtimer_cancel (struct hrtimer *h)
 {
-  while (loops-- > 0)
-    barrier ();
+  enum intr_level old_level = intr_disable ();
+  bool was_pending = h->pending;
+
+  if (was_pending)
+    {
+      list_remove (&h->elem);
+      h->pending = false;
+      if (list_empty (&hrtimers))
+        rtc_periodic_enable (false);
+    }
+
+  intr_set_level (old_level);
+  return was_pending;
 }
 
-/* Sleep for approximately NUM/DENOM seconds. */
+/* RTC periodic interrupt handler: runs the expired hrtimers. */
 static void
-real_time_sleep (int64_t num, int32_t denom) 
+hrtimer_interrupt (void)
 {
-  /* Convert NUM/DENOM seconds into timer ticks, rounding down.
-          
-        (NUM / DENOM) s          
-     ---------------------- = NUM * TIMER_FREQ / DENOM ticks. 
-     1 s / TIMER_FREQ ticks
-  */
-  int64_t ticks = num * TIMER_FREQ / denom;
+  int64_t now = timer_ns ();
 
-  ASSERT (intr_get_level () == INTR_ON);
-  if (ticks > 0)
+  while (!list_empty (&hrtimers))
     {
-      /* We're waiting for at least one full timer tick.  Use
-         timer_sleep() because it will yield the CPU to other
-         processes. */                
-      timer_sleep (ticks); 
+      struct hrtimer *h = list_entry (list_front (&hrtimers),
+                                      struct hrtimer, elem);
+      if (h->expires > now)
+        break;
+      list_pop_front (&hrtimers);
+      h->pending = false;
+      h->func (h);
     }
-  else 
+  if (list_empty (&hrtimers))
+    rtc_periodic_enable (false);
+}
+
+/* Wakes up the thread sleeping on H, preempting the running
+   thread if it has a lower priority. */
+static void
+hrtimer_wake (struct hrtimer *h)
+{
+  struct thread *t = h->aux;
+
+  thread_unblock (t);
+  if (t->priority > thread_current ()->priority)
+    intr_yield_on_return ();
+}
+
+/* Blocks until timer_ns() reaches WHEN.  Interrupts must be
+   turned on. */
+void
+hrtimer_sleep_until (int64_t when)
+{
+  struct hrtimer h;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (timer_ns () < when)
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      hrtimer_init (&h, hrtimer_wake, thread_current ());
+      hrtimer_set (&h, when);
+      thread_block ();
     }
+  intr_set_level (old_level);
+}
+
+/* Sleep for approximately NUM/DENOM seconds. */
+static void
+real_time_sleep (int64_t num, int32_t denom) 
+{
+  int64_t ns = num * (NS_PER_SEC / denom);
+  int64_t deadline = timer_ns () + ns;
+
+  ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (NS_PER_SEC % denom == 0);
+
+  /* Sleep the whole ticks with timer_sleep(), and then the rest,
+     less than a tick, on a high-resolution timer. */
+  if (ns >= NS_PER_TICK)
+    timer_sleep (ns / NS_PER_TICK);
+  hrtimer_sleep_until (deadline);
 }
 
 /* Busy-wait for approximately NUM/DENOM seconds. */
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  uint64_t end;
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
+  end = rdtsc () + num * (int64_t) (tsc_hz / 1000) / (denom / 1000);
+  while (rdtsc () < end)
+    barrier ();
 }
 
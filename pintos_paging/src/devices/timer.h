@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -13,6 +15,20 @@ void timer_calibrate (void);
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
 
+/* Monotonic clock, in nanoseconds since boot. */
+int64_t timer_ns (void);
+uint64_t timer_tsc_hz (void);
+void *timer_time_page (void);
+
+/* Returns the CPU's time stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
@@ -26,4 +42,46 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* Dynamic ticks for the idle thread. */
+extern bool timer_tickless;
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+/* Timeouts: functions called by the timer interrupt handler
+   once a given tick has been reached. */
+struct timeout;
+typedef void timeout_func (struct timeout *);
+
+struct timeout
+  {
+    struct list_elem elem;      /* In a timer wheel slot. */
+    int64_t expires;            /* Tick to run at. */
+    bool pending;               /* Set and not yet run or canceled? */
+    timeout_func *func;         /* Function to call. */
+    void *aux;                  /* For FUNC's use. */
+  };
+
+void timeout_init (struct timeout *, timeout_func *, void *aux);
+void timeout_set (struct timeout *, int64_t when);
+bool timeout_cancel (struct timeout *);
+
+/* High-resolution timers: like timeouts, but due at a time of
+   timer_ns(), and run within about 122 us of it. */
+struct hrtimer;
+typedef void hrtimer_func (struct hrtimer *);
+
+struct hrtimer
+  {
+    struct list_elem elem;      /* In hrtimers, by expiry. */
+    int64_t expires;            /* timer_ns() to run at. */
+    bool pending;               /* Set and not yet run or canceled? */
+    hrtimer_func *func;         /* Function to call. */
+    void *aux;                  /* For FUNC's use. */
+  };
+
+void hrtimer_init (struct hrtimer *, hrtimer_func *, void *aux);
+void hrtimer_set (struct hrtimer *, int64_t when);
+bool hrtimer_cancel (struct hrtimer *);
+void hrtimer_sleep_until (int64_t when);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,462 @@
+#include "devices/virtio-balloon.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "devices/virtio.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* A driver for the virtio memory balloon, as provided by QEMU's
+   "-device virtio-balloon", through which the host takes memory
+   back from the guest.
+
+   The host sets a target number of pages in the device's
+   configuration.  The driver inflates the balloon towards it by
+   taking free pages of the user pool and giving their frame
+   numbers to the host on the inflate queue, and deflates it by
+   giving frame numbers back on the deflate queue and freeing the
+   pages.  Inflating never evicts: the balloon only takes pages
+   that are free, and leaves BALLOON_RESERVE of them, so that the
+   target is a ceiling the guest gets to when it is idle.
+
+   Under memory pressure, vm_frame_allocate() calls
+   virtio_balloon_reclaim() before it evicts a frame.  If the
+   device allows it, with VIRTIO_BALLOON_F_DEFLATE_ON_OOM and
+   without VIRTIO_BALLOON_F_MUST_TELL_HOST, pages come out of the
+   balloon at once, and the host is told afterwards.  The balloon
+   then stops growing for BALLOON_BACKOFF, not to take them again.
+
+   With VIRTIO_BALLOON_F_REPORTING, the driver also reports free
+   blocks of the user pool to the host, which may drop their
+   memory until they are used again (see palloc_report_take()).
+
+   All of this is done by the "balloon" thread, which polls the
+   device every BALLOON_INTERVAL.  The device's interrupts stay
+   disabled: its line may be shared with a virtio disk, and
+   nothing that the balloon does is in a hurry. */
+
+/* PCI device ID of a transitional virtio balloon device. */
+#define VIRTIO_BALLOON_DEVICE 0x1002
+
+/* Balloon configuration, at reg_config(), in 4 kB pages. */
+#define reg_num_pages(B) (reg_config (B) + 0x00) /* Host's target. */
+#define reg_actual(B) (reg_config (B) + 0x04)    /* In the balloon. */
+
+/* Feature bits. */
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST (1u << 0) /* Before reuse. */
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM (1u << 2) /* Reuse at will. */
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT (1u << 3) /* Has its queue. */
+#define VIRTIO_BALLOON_F_REPORTING (1u << 5)      /* Free page reports. */
+
+/* Virtqueues.  The reporting queue follows the statistics queue,
+   2, and the free page hint queue, 3, if the device has it. */
+#define INFLATE_QUEUE 0
+#define DEFLATE_QUEUE 1
+#define REPORT_QUEUE 3
+
+/* Time between two polls of the device, in timer ticks. */
+#define BALLOON_INTERVAL (TIMER_FREQ / 10)
+
+/* Time the balloon does not grow after a reclaim, in timer ticks. */
+#define BALLOON_BACKOFF (5 * TIMER_FREQ)
+
+/* Free user pages that inflating and reporting leave alone. */
+#define BALLOON_RESERVE 64
+
+/* Most frame numbers in one inflate or deflate message. */
+#define PFN_MAX 256
+
+/* Most pages taken back by one virtio_balloon_reclaim(). */
+#define RECLAIM_PAGES 32
+
+/* Free blocks are reported 2**REPORT_ORDER pages at a time, up to
+   REPORT_MAX of them in one report. */
+#define REPORT_ORDER 4
+#define REPORT_MAX 16
+
+/* A virtqueue, which the driver uses for one descriptor chain at
+   a time, starting at descriptor 0. */
+struct queue
+  {
+    uint16_t index;             /* Queue number. */
+    uint16_t size;              /* Number of descriptors. */
+    struct vring_desc *desc;    /* SIZE descriptors. */
+    struct vring_avail *avail;  /* SIZE available entries. */
+    struct vring_used *used;    /* SIZE used entries, page aligned. */
+    uint16_t last_used;         /* Used entries seen. */
+  };
+
+/* The balloon device. */
+struct balloon
+  {
+    uint16_t io_base;           /* Base of the virtio registers. */
+    uint32_t features;          /* Negotiated features. */
+    struct queue inflate, deflate, report;
+    uint32_t pfns[PFN_MAX];     /* Inflate or deflate message. */
+
+    struct lock lock;           /* Protects the members below. */
+    struct bitmap *pages;       /* User pages in the balloon. */
+    size_t page_cnt;            /* Number of them. */
+    uint32_t reclaimed[PFN_MAX]; /* Reclaimed, host not told yet. */
+    size_t reclaimed_cnt;
+    int64_t reclaim_time;       /* Ticks at the last reclaim. */
+  };
+
+static struct balloon balloon;
+
+static bool setup_queue (struct queue *, uint16_t index);
+static void balloon_thread (void *aux);
+
+/* Finds the virtio balloon device on the PCI buses, if there is
+   one, and starts the balloon thread to drive it. */
+void
+virtio_balloon_init (void)
+{
+  struct balloon *b = &balloon;
+  struct pci_addr addr;
+  uint32_t bar, offered;
+
+  if (!pci_find_device (VIRTIO_VENDOR, VIRTIO_BALLOON_DEVICE, 0, &addr))
+    return;
+
+  bar = pci_read_config (addr, PCI_REG_BAR0);
+  if (!(bar & 1))
+    {
+      printf ("virtio-balloon: device has no I/O space, ignoring\n");
+      return;
+    }
+  b->io_base = bar & ~3u;
+  pci_write_config (addr, PCI_REG_COMMAND,
+                    pci_read_config (addr, PCI_REG_COMMAND)
+                    | PCI_CMD_IO | PCI_CMD_MASTER | PCI_CMD_INTX_OFF);
+
+  /* Reset the device and tell it that we drive it. */
+  outb (reg_status (b), 0);
+  outb (reg_status (b), STATUS_ACKNOWLEDGE);
+  outb (reg_status (b), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  offered = inl (reg_features (b));
+  b->features = offered & (VIRTIO_BALLOON_F_MUST_TELL_HOST
+                           | VIRTIO_BALLOON_F_DEFLATE_ON_OOM
+                           | VIRTIO_BALLOON_F_REPORTING);
+  outl (reg_guest_features (b), b->features);
+  if (!setup_queue (&b->inflate, INFLATE_QUEUE)
+      || !setup_queue (&b->deflate, DEFLATE_QUEUE))
+    {
+      printf ("virtio-balloon: could not set up virtqueues, ignoring\n");
+      outb (reg_status (b), STATUS_FAILED);
+      return;
+    }
+  if (b->features & VIRTIO_BALLOON_F_REPORTING
+      && !setup_queue (&b->report,
+                       REPORT_QUEUE
+                       + (offered & VIRTIO_BALLOON_F_FREE_PAGE_HINT
+                          ? 1 : 0)))
+    b->features &= ~VIRTIO_BALLOON_F_REPORTING;
+
+  lock_init (&b->lock);
+  b->pages = bitmap_create (palloc_user_page_cnt ());
+  if (b->pages == NULL)
+    PANIC ("virtio-balloon: out of memory");
+  b->page_cnt = 0;
+  b->reclaimed_cnt = 0;
+  b->reclaim_time = -BALLOON_BACKOFF;
+  outb (reg_status (b),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  thread_create ("balloon", PRI_DEFAULT, balloon_thread, NULL);
+}
+
+/* Takes pages out of the balloon for vm_frame_allocate(), which
+   is short of frames, if the device lets the guest do so without
+   telling the host first.  Returns the number of pages freed. */
+size_t
+virtio_balloon_reclaim (void)
+{
+  struct balloon *b = &balloon;
+  uint8_t *base = palloc_user_base ();
+  size_t cnt = 0;
+
+  if (b->pages == NULL
+      || (b->features & (VIRTIO_BALLOON_F_DEFLATE_ON_OOM
+                         | VIRTIO_BALLOON_F_MUST_TELL_HOST))
+         != VIRTIO_BALLOON_F_DEFLATE_ON_OOM)
+    return 0;
+
+  lock_acquire (&b->lock);
+  while (cnt < RECLAIM_PAGES && b->reclaimed_cnt < PFN_MAX)
+    {
+      size_t idx = bitmap_scan_and_flip (b->pages, 0, 1, true);
+      uint8_t *page;
+
+      if (idx == BITMAP_ERROR)
+        break;
+      page = base + PGSIZE * idx;
+      b->reclaimed[b->reclaimed_cnt++] = vtop (page) >> PGBITS;
+      b->page_cnt--;
+      palloc_free_page (page);
+      cnt++;
+    }
+  if (cnt > 0)
+    b->reclaim_time = timer_ticks ();
+  lock_release (&b->lock);
+
+  return cnt;
+}
+
+/* Allocates virtqueue INDEX in the size the device asks for,
+   into Q, and hands it to the device.  Returns false on
+   failure. */
+static bool
+setup_queue (struct queue *q, uint16_t index)
+{
+  size_t used_ofs, page_cnt;
+  uint8_t *ring;
+
+  outw (reg_queue_select (&balloon), index);
+  q->index = index;
+  q->size = inw (reg_queue_size (&balloon));
+  if (q->size == 0)
+    return false;
+
+  /* The descriptors and the available ring are followed, at the
+     next page boundary, by the used ring. */
+  used_ofs = ROUND_UP (q->size * sizeof (struct vring_desc)
+                       + sizeof (struct vring_avail)
+                       + (q->size + 1) * sizeof (uint16_t), PGSIZE);
+  page_cnt = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+                           + q->size * sizeof (struct vring_used_elem)
+                           + sizeof (uint16_t), PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (ring == NULL)
+    return false;
+
+  q->desc = (struct vring_desc *) ring;
+  q->avail = (struct vring_avail *) (ring + q->size
+                                     * sizeof (struct vring_desc));
+  q->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+  q->used = (struct vring_used *) (ring + used_ofs);
+  q->last_used = 0;
+  outl (reg_queue_pfn (&balloon), vtop (ring) >> PGBITS);
+  return true;
+}
+
+/* Makes the chain of descriptors at the start of Q available to
+   the device and waits until the device is done with it. */
+static void
+queue_run (struct queue *q)
+{
+  /* The device must see the descriptors before the ring entry,
+     and the entry before the index. */
+  q->avail->ring[q->avail->idx % q->size] = 0;
+  barrier ();
+  q->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (&balloon), q->index);
+
+  while (q->used->idx == q->last_used)
+    {
+      timer_sleep (1);
+      barrier ();
+    }
+  q->last_used++;
+}
+
+/* Sends the CNT frame numbers in the balloon's message on Q. */
+static void
+send_pfns (struct queue *q, size_t cnt)
+{
+  q->desc[0].addr = vtop (balloon.pfns);
+  q->desc[0].len = cnt * sizeof *balloon.pfns;
+  q->desc[0].flags = 0;
+  q->desc[0].next = 0;
+  queue_run (q);
+}
+
+/* Tells the host about the pages taken back by
+   virtio_balloon_reclaim(). */
+static void
+tell_reclaimed (void)
+{
+  struct balloon *b = &balloon;
+  size_t cnt;
+
+  lock_acquire (&b->lock);
+  cnt = b->reclaimed_cnt;
+  memcpy (b->pfns, b->reclaimed, cnt * sizeof *b->pfns);
+  b->reclaimed_cnt = 0;
+  lock_release (&b->lock);
+
+  if (cnt > 0)
+    send_pfns (&b->deflate, cnt);
+}
+
+/* Puts up to CNT free user pages into the balloon, but no more
+   than PFN_MAX, nor any of the last BALLOON_RESERVE free pages.
+   Returns the number of pages put in. */
+static size_t
+inflate (size_t cnt)
+{
+  struct balloon *b = &balloon;
+  uint8_t *base = palloc_user_base ();
+  size_t i, n = 0;
+
+  if (cnt > PFN_MAX)
+    cnt = PFN_MAX;
+  while (n < cnt && palloc_free_count (PAL_USER) > BALLOON_RESERVE)
+    {
+      void *page = palloc_get_page (PAL_USER);
+      if (page == NULL)
+        break;
+      b->pfns[n++] = vtop (page) >> PGBITS;
+    }
+  if (n == 0)
+    return 0;
+
+  send_pfns (&b->inflate, n);
+
+  lock_acquire (&b->lock);
+  for (i = 0; i < n; i++)
+    {
+      uint8_t *page = ptov ((uintptr_t) b->pfns[i] << PGBITS);
+      bitmap_mark (b->pages, (page - base) / PGSIZE);
+    }
+  b->page_cnt += n;
+  lock_release (&b->lock);
+  return n;
+}
+
+/* Takes up to CNT pages out of the balloon, but no more than
+   PFN_MAX, and frees them.  Returns the number of pages taken
+   out. */
+static size_t
+deflate (size_t cnt)
+{
+  struct balloon *b = &balloon;
+  uint8_t *base = palloc_user_base ();
+  size_t i, n = 0;
+
+  if (cnt > PFN_MAX)
+    cnt = PFN_MAX;
+  lock_acquire (&b->lock);
+  while (n < cnt)
+    {
+      size_t idx = bitmap_scan_and_flip (b->pages, 0, 1, true);
+      if (idx == BITMAP_ERROR)
+        break;
+      b->pfns[n++] = vtop (base + PGSIZE * idx) >> PGBITS;
+    }
+  b->page_cnt -= n;
+  lock_release (&b->lock);
+  if (n == 0)
+    return 0;
+
+  /* Unless the host must be told first, it could be told after
+     the pages are used again, but there is no hurry. */
+  send_pfns (&b->deflate, n);
+  for (i = 0; i < n; i++)
+    palloc_free_page (ptov ((uintptr_t) b->pfns[i] << PGBITS));
+  return n;
+}
+
+/* Inflates or deflates the balloon towards the host's target,
+   and tells the host how large it is. */
+static void
+adjust (void)
+{
+  struct balloon *b = &balloon;
+
+  for (;;)
+    {
+      size_t target = inl (reg_num_pages (b));
+      size_t cnt;
+      bool backoff;
+
+      lock_acquire (&b->lock);
+      cnt = b->page_cnt;
+      backoff = timer_elapsed (b->reclaim_time) < BALLOON_BACKOFF;
+      lock_release (&b->lock);
+
+      if (target > cnt && !backoff)
+        {
+          if (inflate (target - cnt) == 0)
+            break;
+        }
+      else if (target < cnt)
+        {
+          if (deflate (cnt - target) == 0)
+            break;
+        }
+      else
+        break;
+      thread_preempt_point ();
+    }
+
+  lock_acquire (&b->lock);
+  outl (reg_actual (b), b->page_cnt);
+  lock_release (&b->lock);
+}
+
+/* Reports up to REPORT_MAX free blocks of the user pool to the
+   host, as long as BALLOON_RESERVE pages stay free meanwhile.
+   Returns true if there may be more to report. */
+static bool
+report_free (void)
+{
+  struct balloon *b = &balloon;
+  struct queue *q = &b->report;
+  void *blocks[REPORT_MAX];
+  size_t max = q->size < REPORT_MAX ? q->size : REPORT_MAX;
+  size_t i, cnt = 0;
+
+  while (cnt < max
+         && palloc_free_count (PAL_USER)
+            >= BALLOON_RESERVE + ((size_t) 1 << REPORT_ORDER))
+    {
+      void *block = palloc_report_take (REPORT_ORDER);
+      if (block == NULL)
+        break;
+
+      /* Device-writable, because the host may discard what they
+         hold. */
+      q->desc[cnt].addr = vtop (block);
+      q->desc[cnt].len = PGSIZE << REPORT_ORDER;
+      q->desc[cnt].flags = VRING_DESC_F_WRITE | VRING_DESC_F_NEXT;
+      q->desc[cnt].next = cnt + 1;
+      blocks[cnt++] = block;
+    }
+  if (cnt == 0)
+    return false;
+
+  q->desc[cnt - 1].flags = VRING_DESC_F_WRITE;
+  queue_run (q);
+  for (i = 0; i < cnt; i++)
+    palloc_report_done (blocks[i], REPORT_ORDER);
+  return cnt == max;
+}
+
+/* Body of the balloon thread. */
+static void
+balloon_thread (void *aux UNUSED)
+{
+  struct balloon *b = &balloon;
+
+  for (;;)
+    {
+      timer_sleep (BALLOON_INTERVAL);
+
+      tell_reclaimed ();
+      adjust ();
+      if (b->features & VIRTIO_BALLOON_F_REPORTING)
+        while (report_free ())
+          thread_preempt_point ();
+    }
+}
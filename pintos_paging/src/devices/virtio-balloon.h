@@ -0,0 +1,9 @@
+#ifndef DEVICES_VIRTIO_BALLOON_H
+#define DEVICES_VIRTIO_BALLOON_H
+
+#include <stddef.h>
+
+void virtio_balloon_init (void);
+size_t virtio_balloon_reclaim (void);
+
+#endif /* devices/virtio-balloon.h */
@@ -0,0 +1,464 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "devices/virtio.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A driver for virtio block devices, as provided by QEMU's
+   "-drive if=virtio", through the legacy PCI interface of the
+   Virtio 0.9.5 specification.
+
+   Each disk has one virtqueue, a ring of descriptors shared with
+   the device.  A request takes three descriptors: a header with
+   the sector and direction, the data, and a status byte that the
+   device fills in.  Requests from different threads are in
+   flight at the same time, as many as the ring has room for, and
+   each thread sleeps until the interrupt handler finds its
+   request in the ring of used descriptors.
+
+   If the device offers it, as QEMU's does with "discard=unmap",
+   the driver also takes the discard feature, with which a
+   request's data is a range of sectors to unmap instead. */
+
+/* PCI device ID of a transitional virtio block device. */
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Block device configuration, at reg_config(). */
+#define reg_capacity(DISK) (reg_config (DISK) + 0x00)   /* Sectors. */
+#define reg_max_discard(DISK) (reg_config (DISK) + 0x24) /* Sectors. */
+
+/* Feature bits. */
+#define VIRTIO_BLK_F_RO (1u << 5)       /* Device is read-only. */
+#define VIRTIO_BLK_F_DISCARD (1u << 13) /* Takes discard requests. */
+
+/* Request header. */
+struct virtio_blk_hdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_T_DISCARD 11 /* Discard. */
+
+/* Data of a discard request: one range of sectors. */
+struct virtio_blk_discard
+  {
+    uint64_t sector;            /* First sector. */
+    uint32_t cnt;               /* Number of sectors. */
+    uint32_t flags;             /* 0. */
+  };
+
+#define VIRTIO_BLK_S_OK 0       /* Status of a successful request. */
+
+/* Descriptors per request. */
+#define DESC_PER_SLOT 3
+
+/* Most sectors in one request. */
+#define VIRTIO_MAX_SECTORS 256
+
+/* A request in flight, which owns descriptors DESC_PER_SLOT * I
+   through DESC_PER_SLOT * I + 2 of the ring, for slot I. */
+struct slot
+  {
+    struct virtio_blk_hdr hdr;  /* Header, read by the device. */
+    uint8_t status;             /* Status, written by the device. */
+    bool busy;                  /* In use? */
+    struct semaphore done;      /* Up'd when the device is done. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base of the virtio registers. */
+    uint8_t irq;                /* Interrupt vector. */
+    uint32_t max_discard;       /* Most sectors per discard, or 0. */
+
+    /* The virtqueue, in PAGE_CNT physically contiguous pages. */
+    uint16_t size;              /* Number of descriptors. */
+    struct vring_desc *desc;    /* SIZE descriptors. */
+    struct vring_avail *avail;  /* SIZE available entries. */
+    struct vring_used *used;    /* SIZE used entries, page aligned. */
+    size_t page_cnt;
+    uint16_t last_used;         /* Used entries seen by the handler. */
+
+    /* Requests. */
+    struct lock lock;           /* Protects BUSY and the avail ring. */
+    struct semaphore free_slots; /* Number of slots not busy. */
+    struct slot *slots;         /* SIZE / DESC_PER_SLOT slots. */
+    size_t slot_cnt;
+  };
+
+/* Most disks we drive. */
+#define DISK_CNT 4
+static struct virtio_disk *disks[DISK_CNT];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+static struct block_operations virtio_discard_operations;
+
+static bool setup_queue (struct virtio_disk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds the virtio block devices on the PCI buses and registers
+   each one as a block device, "vda", "vdb", and so on, whose
+   partitions are then scanned. */
+void
+virtio_blk_init (void)
+{
+  struct pci_addr addr;
+
+  while (disk_cnt < DISK_CNT
+         && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, disk_cnt,
+                             &addr))
+    {
+      struct virtio_disk *d;
+      struct block *block;
+      uint32_t bar, features;
+      uint64_t capacity;
+      size_t i;
+
+      bar = pci_read_config (addr, PCI_REG_BAR0);
+      if (!(bar & 1))
+        {
+          printf ("virtio: device has no I/O space, ignoring\n");
+          break;
+        }
+
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        PANIC ("virtio: out of memory");
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      d->io_base = bar & ~3u;
+      d->irq = (pci_read_config (addr, PCI_REG_INTR) & 0xff) + 0x20;
+      pci_write_config (addr, PCI_REG_COMMAND,
+                        pci_read_config (addr, PCI_REG_COMMAND)
+                        | PCI_CMD_IO | PCI_CMD_MASTER);
+
+      /* Reset the device and tell it that we drive it, with none
+         of its optional features but discard. */
+      outb (reg_status (d), 0);
+      outb (reg_status (d), STATUS_ACKNOWLEDGE);
+      outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+      features = inl (reg_features (d));
+      outl (reg_guest_features (d), features & VIRTIO_BLK_F_DISCARD);
+      if (!setup_queue (d))
+        {
+          printf ("%s: could not set up virtqueue, ignoring\n", d->name);
+          outb (reg_status (d), STATUS_FAILED);
+          free (d);
+          break;
+        }
+
+      lock_init (&d->lock);
+      d->slot_cnt = d->size / DESC_PER_SLOT;
+      sema_init (&d->free_slots, d->slot_cnt);
+      d->slots = calloc (d->slot_cnt, sizeof *d->slots);
+      if (d->slots == NULL)
+        PANIC ("%s: out of memory", d->name);
+      for (i = 0; i < d->slot_cnt; i++)
+        sema_init (&d->slots[i].done, 0);
+
+      /* The interrupt line may be shared with another virtio
+         device, whose handler serves both. */
+      for (i = 0; i < disk_cnt; i++)
+        if (disks[i]->irq == d->irq)
+          break;
+      if (i == disk_cnt)
+        intr_register_ext (d->irq, interrupt_handler, "virtio");
+      disks[disk_cnt++] = d;
+      outb (reg_status (d),
+            STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+      capacity = inl (reg_capacity (d))
+                 | ((uint64_t) inl (reg_capacity (d) + 4) << 32);
+      if (capacity > UINT32_MAX)
+        capacity = UINT32_MAX;
+      d->max_discard = ((features & VIRTIO_BLK_F_DISCARD)
+                        && !(features & VIRTIO_BLK_F_RO)
+                        ? inl (reg_max_discard (d)) : 0);
+      block = block_register (d->name, BLOCK_RAW,
+                              features & VIRTIO_BLK_F_RO
+                              ? "virtio, read-only"
+                              : d->max_discard > 0
+                              ? "virtio, discard" : "virtio",
+                              capacity,
+                              d->max_discard > 0
+                              ? &virtio_discard_operations
+                              : &virtio_operations, d);
+      partition_scan (block);
+    }
+}
+
+/* Allocates D's virtqueue 0 in the size the device asks for and
+   hands it to the device.  Returns false on failure. */
+static bool
+setup_queue (struct virtio_disk *d)
+{
+  size_t used_ofs;
+  uint8_t *ring;
+
+  outw (reg_queue_select (d), 0);
+  d->size = inw (reg_queue_size (d));
+  if (d->size < DESC_PER_SLOT)
+    return false;
+
+  /* The descriptors and the available ring are followed, at the
+     next page boundary, by the used ring. */
+  used_ofs = ROUND_UP (d->size * sizeof (struct vring_desc)
+                       + sizeof (struct vring_avail)
+                       + (d->size + 1) * sizeof (uint16_t), PGSIZE);
+  d->page_cnt = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+                              + d->size * sizeof (struct vring_used_elem)
+                              + sizeof (uint16_t), PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, d->page_cnt);
+  if (ring == NULL)
+    return false;
+
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + d->size
+                                     * sizeof (struct vring_desc));
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->last_used = 0;
+  outl (reg_queue_pfn (d), vtop (ring) >> PGBITS);
+  return true;
+}
+
+/* Sends disk D a request of the given TYPE for SEC_NO, with the
+   LEN bytes of DATA, which the device writes if TYPE is
+   VIRTIO_BLK_T_IN and reads otherwise, and waits for it to finish.
+   DATA must be in kernel memory, which is physically contiguous.
+   Returns the status the device reports. */
+static uint8_t
+request (struct virtio_disk *d, uint32_t type, block_sector_t sec_no,
+         void *data, size_t len)
+{
+  struct vring_desc *desc;
+  struct slot *s;
+  size_t slot_no;
+  uint8_t status;
+
+  sema_down (&d->free_slots);
+  lock_acquire (&d->lock);
+  for (slot_no = 0; d->slots[slot_no].busy; slot_no++)
+    ASSERT (slot_no < d->slot_cnt);
+  s = &d->slots[slot_no];
+  s->busy = true;
+
+  s->hdr.type = type;
+  s->hdr.reserved = 0;
+  s->hdr.sector = sec_no;
+  s->status = 0xff;
+
+  desc = &d->desc[slot_no * DESC_PER_SLOT];
+  desc[0].addr = vtop (&s->hdr);
+  desc[0].len = sizeof s->hdr;
+  desc[0].flags = VRING_DESC_F_NEXT;
+  desc[0].next = slot_no * DESC_PER_SLOT + 1;
+  desc[1].addr = vtop (data);
+  desc[1].len = len;
+  desc[1].flags = (VRING_DESC_F_NEXT
+                   | (type == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0));
+  desc[1].next = slot_no * DESC_PER_SLOT + 2;
+  desc[2].addr = vtop (&s->status);
+  desc[2].len = sizeof s->status;
+  desc[2].flags = VRING_DESC_F_WRITE;
+  desc[2].next = 0;
+
+  /* The device must see the descriptors before the ring entry,
+     and the entry before the index. */
+  d->avail->ring[d->avail->idx % d->size] = slot_no * DESC_PER_SLOT;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (d), 0);
+  lock_release (&d->lock);
+
+  sema_down (&s->done);
+  status = s->status;
+
+  lock_acquire (&d->lock);
+  s->busy = false;
+  lock_release (&d->lock);
+  sema_up (&d->free_slots);
+  return status;
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFER, into BUFFER if READ, else out of it, in a single
+   request.  BUFFER must be in kernel memory.  Panics if the
+   device reports an error. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sec_no, block_sector_t cnt,
+          void *buffer, bool read)
+{
+  uint8_t status;
+
+  ASSERT (is_kernel_vaddr (buffer));
+  ASSERT (cnt > 0 && cnt <= VIRTIO_MAX_SECTORS);
+
+  status = request (d, read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT, sec_no,
+                    buffer, cnt * BLOCK_SECTOR_SIZE);
+  if (status != VIRTIO_BLK_S_OK)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu", status=%d",
+           d->name, read ? "read" : "write", sec_no, status);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D
+   and BUFFER_, into BUFFER_ if READ, else out of it.  A buffer
+   outside kernel memory, which might not be physically
+   contiguous, is bounced through a kernel page. */
+static void
+transfer_multiple (struct virtio_disk *d, block_sector_t sec_no,
+                   block_sector_t cnt, void *buffer_, bool read)
+{
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce = NULL;
+  block_sector_t max = VIRTIO_MAX_SECTORS;
+
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce = palloc_get_page (PAL_ASSERT);
+      max = PGSIZE / BLOCK_SECTOR_SIZE;
+    }
+
+  while (cnt > 0)
+    {
+      block_sector_t n = cnt < max ? cnt : max;
+      size_t size = n * BLOCK_SECTOR_SIZE;
+
+      if (bounce == NULL)
+        transfer (d, sec_no, n, buffer, read);
+      else if (read)
+        {
+          transfer (d, sec_no, n, bounce, true);
+          memcpy (buffer, bounce, size);
+        }
+      else
+        {
+          memcpy (bounce, buffer, size);
+          transfer (d, sec_no, n, bounce, false);
+        }
+      buffer += size;
+      sec_no += n;
+      cnt -= n;
+    }
+
+  palloc_free_page (bounce);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER. */
+static void
+virtio_read_multiple (void *d, block_sector_t sec_no, block_sector_t cnt,
+                      void *buffer)
+{
+  transfer_multiple (d, sec_no, cnt, buffer, true);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER. */
+static void
+virtio_write_multiple (void *d, block_sector_t sec_no, block_sector_t cnt,
+                       const void *buffer)
+{
+  transfer_multiple (d, sec_no, cnt, (void *) buffer, false);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER. */
+static void
+virtio_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  transfer_multiple (d, sec_no, 1, buffer, true);
+}
+
+/* Writes sector SEC_NO to disk D from BUFFER. */
+static void
+virtio_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  transfer_multiple (d, sec_no, 1, (void *) buffer, false);
+}
+
+/* Discards the CNT sectors starting at SEC_NO of disk D, with a
+   request for each D->max_discard of them.  A discard is only a
+   hint, so one that the device fails is not retried. */
+static void
+virtio_discard (void *d_, block_sector_t sec_no, block_sector_t cnt)
+{
+  struct virtio_disk *d = d_;
+
+  while (cnt > 0)
+    {
+      struct virtio_blk_discard range;
+
+      range.sector = sec_no;
+      range.cnt = cnt < d->max_discard ? cnt : d->max_discard;
+      range.flags = 0;
+      if (request (d, VIRTIO_BLK_T_DISCARD, 0, &range, sizeof range)
+          != VIRTIO_BLK_S_OK)
+        return;
+      sec_no += range.cnt;
+      cnt -= range.cnt;
+    }
+}
+
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multiple,
+    virtio_write_multiple,
+    NULL,               /* FLUSH not negotiated: writes are durable. */
+    NULL                /* DISCARD not offered. */
+  };
+
+static struct block_operations virtio_discard_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_read_multiple,
+    virtio_write_multiple,
+    NULL,
+    virtio_discard
+  };
+
+/* virtio interrupt handler.  Wakes the thread of each request
+   that a disk on this interrupt line has finished. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = disks[i];
+
+      if (d->irq != f->vec_no)
+        continue;
+
+      inb (reg_isr (d));                /* Acknowledge interrupt. */
+      barrier ();
+      while (d->last_used != d->used->idx)
+        {
+          struct vring_used_elem *e;
+
+          e = &d->used->ring[d->last_used % d->size];
+          sema_up (&d->slots[e->id / DESC_PER_SLOT].done);
+          d->last_used++;
+          barrier ();
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef DEVICES_VIRTIO_H
+#define DEVICES_VIRTIO_H
+
+#include <stdint.h>
+
+/* Definitions shared by the drivers of virtio devices, through
+   the legacy PCI interface of the Virtio 0.9.5 specification. */
+
+/* PCI vendor ID of virtio devices. */
+#define VIRTIO_VENDOR 0x1af4
+
+/* PCI configuration registers. */
+#define PCI_REG_COMMAND 0x04    /* Command in bits 15:0. */
+#define PCI_REG_BAR0 0x10       /* Base address register 0. */
+#define PCI_REG_INTR 0x3c       /* Interrupt line in bits 7:0. */
+#define PCI_CMD_IO 0x01         /* I/O space enable. */
+#define PCI_CMD_MASTER 0x04     /* Bus master enable. */
+#define PCI_CMD_INTX_OFF 0x400  /* Interrupt disable. */
+
+/* Legacy virtio registers, in I/O space at BAR0 of device DEV,
+   which has an `io_base' member. */
+#define reg_features(DEV) ((DEV)->io_base + 0x00)       /* Device's. */
+#define reg_guest_features(DEV) ((DEV)->io_base + 0x04) /* Driver's. */
+#define reg_queue_pfn(DEV) ((DEV)->io_base + 0x08)      /* Ring page. */
+#define reg_queue_size(DEV) ((DEV)->io_base + 0x0c)     /* Ring size. */
+#define reg_queue_select(DEV) ((DEV)->io_base + 0x0e)   /* Ring index. */
+#define reg_queue_notify(DEV) ((DEV)->io_base + 0x10)   /* Kick. */
+#define reg_status(DEV) ((DEV)->io_base + 0x12)         /* Status. */
+#define reg_isr(DEV) ((DEV)->io_base + 0x13)            /* ISR status. */
+#define reg_config(DEV) ((DEV)->io_base + 0x14)         /* Device's own. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Driver found the device. */
+#define STATUS_DRIVER 0x02      /* Driver knows how to drive it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up on it. */
+
+/* A descriptor, naming one physically contiguous buffer. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+
+#define VRING_DESC_F_NEXT 1     /* Chained with NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Written by the device. */
+
+/* Ring of descriptor chains made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;             /* VRING_AVAIL_F_*. */
+    uint16_t idx;               /* Where the next entry goes. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1 /* Driver polls the used ring. */
+
+/* Ring of descriptor chains the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of the descriptor chain. */
+    uint32_t len;               /* Bytes written into it. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+#endif /* devices/virtio.h */
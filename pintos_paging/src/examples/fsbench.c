@@ -0,0 +1,283 @@
+/* fsbench.c
+
+   Benchmark of file system throughput and metadata operations.
+
+   Usage: fsbench [TEST...]
+
+   Runs each TEST named, or all of them:
+
+     seq      writes a file, then reads it back, REQ bytes at a time,
+              for each of several request sizes
+     rand     the same with pwrite() and pread() at random offsets
+     files    creates, opens and removes many small files
+     dirs     looks up names in directories of growing size
+
+   Each measurement prints one line of KEY=VALUE pairs, for a script
+   to compare run over run, e.g.
+
+     fsbench: test=seq-read bytes=262144 req=4096 ns=... kb_per_sec=... \
+       cache_hits=... cache_misses=... reads=... writes=... \
+       read_sectors=... write_sectors=...
+
+   The last six are the buffer cache and block device counters for
+   the measurement (block devices summed), as from fsstats() and
+   blkstats(); writes are followed by sync() so that they include
+   writing the data back.  The tests need room for a 256 kB file and
+   create and remove their files in the current directory. */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Size of the file of "seq" and "rand". */
+#define FILE_SIZE (256 * 1024)
+
+/* Largest request size. */
+#define REQ_MAX 16384
+
+/* Number of files of "files". */
+#define FILE_CNT 100
+
+static char buf[REQ_MAX];
+
+/* Counters at the start of a measurement. */
+struct snapshot
+  {
+    int64_t ns;                 /* clock_ns() */
+    struct fs_stats fs;         /* fsstats() */
+    struct block_stats blk;     /* Sum of blkstats() of all devices. */
+  };
+
+/* Takes a snapshot of the counters into S. */
+static void
+snapshot (struct snapshot *s)
+{
+  struct block_stats b;
+  int i;
+
+  memset (s, 0, sizeof *s);
+  fsstats (&s->fs);
+  for (i = 0; blkstats (i, &b) == 0; i++)
+    {
+      s->blk.reads += b.reads;
+      s->blk.writes += b.writes;
+      s->blk.read_sectors += b.read_sectors;
+      s->blk.write_sectors += b.write_sectors;
+    }
+  s->ns = clock_ns ();
+}
+
+/* Prints the line of measurement TEST, started at snapshot START,
+   with KEY=VALUE pairs FIELDS (which may be empty) in front of the
+   counters.  Its rate is of OPS operations and BYTES bytes. */
+static void
+report (const char *test, const struct snapshot *start, const char *fields,
+        uint64_t ops, uint64_t bytes)
+{
+  struct snapshot end;
+  int64_t ns;
+
+  snapshot (&end);
+  ns = end.ns - start->ns;
+  if (ns <= 0)
+    ns = 1;
+  printf ("fsbench: test=%s %s ns=%lld ", test, fields, ns);
+  if (bytes != 0)
+    printf ("kb_per_sec=%llu ", bytes * 1000000000ULL / 1024 / ns);
+  else
+    printf ("ops_per_sec=%llu ", ops * 1000000000ULL / ns);
+  printf ("cache_hits=%llu cache_misses=%llu reads=%llu writes=%llu "
+          "read_sectors=%llu write_sectors=%llu\n",
+          end.fs.cache_hits - start->fs.cache_hits,
+          end.fs.cache_misses - start->fs.cache_misses,
+          end.blk.reads - start->blk.reads,
+          end.blk.writes - start->blk.writes,
+          end.blk.read_sectors - start->blk.read_sectors,
+          end.blk.write_sectors - start->blk.write_sectors);
+}
+
+/* Opens file NAME, or gives up. */
+static int
+open_or_die (const char *name)
+{
+  int fd = open (name);
+  if (fd < 0)
+    {
+      printf ("fsbench: cannot open %s\n", name);
+      exit (1);
+    }
+  return fd;
+}
+
+/* Measures writing and reading "fsbench.dat" in requests of REQ
+   bytes, in order or at random offsets if RANDOM. */
+static void
+throughput (bool random, size_t req)
+{
+  const char *name = random ? "rand" : "seq";
+  size_t cnt = FILE_SIZE / req;
+  struct snapshot s;
+  char test[16], fields[48];
+  size_t i;
+  int fd;
+
+  if (!create ("fsbench.dat", 0))
+    {
+      printf ("fsbench: cannot create fsbench.dat\n");
+      exit (1);
+    }
+  fd = open_or_die ("fsbench.dat");
+  random_init (req);
+  snprintf (fields, sizeof fields, "bytes=%d req=%zu", FILE_SIZE, req);
+
+  /* The random writes go to a file of its full size, for them not
+     to measure extending it. */
+  if (random)
+    {
+      for (i = 0; i < cnt; i++)
+        write (fd, buf, req);
+      sync ();
+    }
+
+  snapshot (&s);
+  for (i = 0; i < cnt; i++)
+    if (random)
+      pwrite (fd, buf, req, random_ulong () % cnt * req);
+    else
+      write (fd, buf, req);
+  sync ();
+  snprintf (test, sizeof test, "%s-write", name);
+  report (test, &s, fields, cnt, cnt * req);
+
+  seek (fd, 0);
+  snapshot (&s);
+  for (i = 0; i < cnt; i++)
+    if (random)
+      pread (fd, buf, req, random_ulong () % cnt * req);
+    else
+      read (fd, buf, req);
+  snprintf (test, sizeof test, "%s-read", name);
+  report (test, &s, fields, cnt, cnt * req);
+
+  close (fd);
+  remove ("fsbench.dat");
+}
+
+/* Measures creating, opening and removing FILE_CNT small files. */
+static void
+small_files (void)
+{
+  struct snapshot s;
+  char name[16], fields[16];
+  int i;
+
+  snprintf (fields, sizeof fields, "files=%d", FILE_CNT);
+  snapshot (&s);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      create (name, 512);
+    }
+  report ("create", &s, fields, FILE_CNT, 0);
+
+  snapshot (&s);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      close (open_or_die (name));
+    }
+  report ("open", &s, fields, FILE_CNT, 0);
+
+  snapshot (&s);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      remove (name);
+    }
+  sync ();
+  report ("remove", &s, fields, FILE_CNT, 0);
+}
+
+/* Measures looking up the names of directory "fsbench.dir" as it
+   grows to 16, 64 and 256 entries. */
+static void
+dir_lookups (void)
+{
+  static const int sizes[] = { 16, 64, 256 };
+  struct snapshot s;
+  char name[16], fields[16];
+  int entries = 0;
+  size_t i;
+  int j;
+
+  if (!mkdir ("fsbench.dir") || !chdir ("fsbench.dir"))
+    {
+      printf ("fsbench: cannot make fsbench.dir\n");
+      exit (1);
+    }
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      for (; entries < sizes[i]; entries++)
+        {
+          snprintf (name, sizeof name, "e%d", entries);
+          create (name, 0);
+        }
+      snapshot (&s);
+      for (j = 0; j < FILE_CNT; j++)
+        {
+          snprintf (name, sizeof name, "e%d", j * 7 % entries);
+          close (open_or_die (name));
+        }
+      snprintf (fields, sizeof fields, "entries=%d", entries);
+      report ("lookup", &s, fields, FILE_CNT, 0);
+    }
+  for (j = 0; j < entries; j++)
+    {
+      snprintf (name, sizeof name, "e%d", j);
+      remove (name);
+    }
+  chdir ("..");
+  remove ("fsbench.dir");
+}
+
+/* Runs test NAME.  Returns false if there is no such test. */
+static bool
+run (const char *name)
+{
+  static const size_t reqs[] = { 512, 4096, REQ_MAX };
+  size_t i;
+
+  if (!strcmp (name, "seq") || !strcmp (name, "rand"))
+    for (i = 0; i < sizeof reqs / sizeof *reqs; i++)
+      throughput (!strcmp (name, "rand"), reqs[i]);
+  else if (!strcmp (name, "files"))
+    small_files ();
+  else if (!strcmp (name, "dirs"))
+    dir_lookups ();
+  else
+    return false;
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int i;
+
+  if (argc == 1)
+    {
+      run ("seq");
+      run ("rand");
+      run ("files");
+      run ("dirs");
+    }
+  for (i = 1; i < argc; i++)
+    if (!run (argv[i]))
+      {
+        printf ("usage: fsbench [seq|rand|files|dirs]...\n");
+        return 1;
+      }
+  return 0;
+}
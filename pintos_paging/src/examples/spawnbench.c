@@ -0,0 +1,215 @@
+/* spawnbench.c
+
+   Benchmark of process creation and system call overhead.
+
+   Usage: spawnbench [TEST...]
+
+   Runs each TEST named, or all of them:
+
+     exec     exec() and wait() for a child that exits at once, for
+              a small and a large binary, with and without arguments
+     syscall  tell() and filesize() on an open file, calls that do
+              next to nothing in the kernel
+     write    small write()s to the console and to a file
+
+   Each measurement prints one line of KEY=VALUE pairs, for a script
+   to compare run over run, e.g.
+
+     spawnbench: test=exec binary=large args=32 ops=20 ns=... \
+       ns_per_op=... min_ns=... max_ns=...
+
+   The small binary is "true"; the large one is spawnbench itself,
+   whose child touches every page of 256 kB of initialized data so
+   that it is read in from the executable.  Both must be on the file
+   system.  The write test creates and removes "spawnbench.dat" in
+   the current directory, and writes lines of dots to the console. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+#define PAGE_SIZE 4096
+
+/* Number of exec() and wait() round trips per measurement. */
+#define EXEC_CNT 20
+
+/* Number of arguments of the "args" exec measurements. */
+#define ARG_CNT 32
+
+/* Number of calls per syscall and file write measurement. */
+#define CALL_CNT 10000
+
+/* Number of console writes. */
+#define CONSOLE_CNT 200
+
+/* Initialized data, to make this a large binary.  Not zero, so that
+   it is stored in the executable rather than allocated as BSS. */
+static char ballast[256 * 1024] = { 1 };
+
+/* Prints the line of measurement TEST, with KEY=VALUE pairs FIELDS,
+   of OPS operations that took NS nanoseconds in all. */
+static void
+report (const char *test, const char *fields, unsigned ops, int64_t ns)
+{
+  if (ns <= 0)
+    ns = 1;
+  printf ("spawnbench: test=%s %s ops=%u ns=%lld ns_per_op=%lld\n",
+          test, fields, ops, ns, ns / ops);
+}
+
+/* Measures EXEC_CNT round trips of running BINARY with ARGS
+   arguments, named SIZE in the output. */
+static void
+exec_wait (const char *size, const char *binary, int args)
+{
+  char cmd[64 + ARG_CNT * 16];
+  char fields[48];
+  int64_t total = 0, min = INT64_MAX, max = 0;
+  int i;
+
+  snprintf (cmd, sizeof cmd, "%s -", binary);
+  for (i = 0; i < args; i++)
+    snprintf (cmd + strlen (cmd), sizeof cmd - strlen (cmd),
+              " argument-%06d", i);
+
+  for (i = 0; i < EXEC_CNT; i++)
+    {
+      int64_t start = clock_ns ();
+      int64_t ns;
+      pid_t pid = exec (cmd);
+
+      if (pid == PID_ERROR || wait (pid) != 0)
+        {
+          printf ("spawnbench: cannot run %s\n", binary);
+          exit (1);
+        }
+      ns = clock_ns () - start;
+      total += ns;
+      if (ns < min)
+        min = ns;
+      if (ns > max)
+        max = ns;
+    }
+
+  snprintf (fields, sizeof fields, "binary=%s args=%d", size, args);
+  printf ("spawnbench: test=exec %s ops=%d ns=%lld ns_per_op=%lld "
+          "min_ns=%lld max_ns=%lld\n",
+          fields, EXEC_CNT, total, total / EXEC_CNT, min, max);
+}
+
+/* Measures CALL_CNT calls each of tell() and filesize(). */
+static void
+null_syscalls (void)
+{
+  int64_t start;
+  int fd, i;
+
+  if (!create ("spawnbench.dat", 512)
+      || (fd = open ("spawnbench.dat")) < 0)
+    {
+      printf ("spawnbench: cannot create spawnbench.dat\n");
+      exit (1);
+    }
+
+  start = clock_ns ();
+  for (i = 0; i < CALL_CNT; i++)
+    tell (fd);
+  report ("syscall", "call=tell", CALL_CNT, clock_ns () - start);
+
+  start = clock_ns ();
+  for (i = 0; i < CALL_CNT; i++)
+    filesize (fd);
+  report ("syscall", "call=filesize", CALL_CNT, clock_ns () - start);
+
+  close (fd);
+  remove ("spawnbench.dat");
+}
+
+/* Measures small writes to the console and to a file. */
+static void
+small_writes (void)
+{
+  static const unsigned sizes[] = { 1, 16, 64 };
+  static const char line[] = "...............\n";
+  char buf[64], fields[32];
+  int64_t start;
+  size_t i;
+  int fd, j;
+
+  start = clock_ns ();
+  for (j = 0; j < CONSOLE_CNT; j++)
+    write (STDOUT_FILENO, line, sizeof line - 1);
+  snprintf (fields, sizeof fields, "fd=console bytes=%u",
+            (unsigned) sizeof line - 1);
+  report ("write", fields, CONSOLE_CNT, clock_ns () - start);
+
+  memset (buf, '.', sizeof buf);
+  for (i = 0; i < sizeof sizes / sizeof *sizes; i++)
+    {
+      if (!create ("spawnbench.dat", 0)
+          || (fd = open ("spawnbench.dat")) < 0)
+        {
+          printf ("spawnbench: cannot create spawnbench.dat\n");
+          exit (1);
+        }
+      start = clock_ns ();
+      for (j = 0; j < CALL_CNT; j++)
+        write (fd, buf, sizes[i]);
+      snprintf (fields, sizeof fields, "fd=file bytes=%u", sizes[i]);
+      report ("write", fields, CALL_CNT, clock_ns () - start);
+      close (fd);
+      remove ("spawnbench.dat");
+    }
+}
+
+/* Runs test NAME.  Returns false if there is no such test. */
+static bool
+run (const char *name)
+{
+  if (!strcmp (name, "exec"))
+    {
+      exec_wait ("small", "true", 0);
+      exec_wait ("small", "true", ARG_CNT);
+      exec_wait ("large", "spawnbench", 0);
+      exec_wait ("large", "spawnbench", ARG_CNT);
+    }
+  else if (!strcmp (name, "syscall"))
+    null_syscalls ();
+  else if (!strcmp (name, "write"))
+    small_writes ();
+  else
+    return false;
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int i;
+
+  /* Run by exec_wait(): read in the ballast and exit. */
+  if (argc > 1 && !strcmp (argv[1], "-"))
+    {
+      volatile char *p;
+      int sum = 0;
+
+      for (p = ballast; p < ballast + sizeof ballast; p += PAGE_SIZE)
+        sum += *p;
+      return sum == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+  if (argc == 1)
+    {
+      run ("exec");
+      run ("syscall");
+      run ("write");
+    }
+  for (i = 1; i < argc; i++)
+    if (!run (argv[i]))
+      {
+        printf ("usage: spawnbench [exec|syscall|write]...\n");
+        return 1;
+      }
+  return 0;
+}
@@ -0,0 +1,12 @@
+/* true.c
+
+   Exits successfully, doing nothing else.  The small binary of
+   spawnbench's exec test. */
+
+#include <syscall.h>
+
+int
+main (void)
+{
+  return EXIT_SUCCESS;
+}
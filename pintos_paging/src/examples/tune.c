@@ -0,0 +1,110 @@
+/* tune.c
+
+   Reads and sets the kernel's tunables at run time.
+
+   Usage: tune [NAME[=VALUE]...]
+
+   With no argument, prints every tunable, one per line:
+
+     vm.fault_around = 8 (0..1024)
+
+   Each NAME argument prints that tunable alone; each NAME=VALUE
+   sets it, then prints it.  Exits with status 1 if a NAME is
+   unknown or a VALUE is out of bounds. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Prints INFO. */
+static void
+print_tunable (const struct tunable_info *info)
+{
+  printf ("%s = %lld (%lld..%lld)\n",
+          info->name, info->value, info->min, info->max);
+}
+
+/* Looks up the tunable named NAME into INFO.  Returns false if
+   there is none. */
+static bool
+find_tunable (const char *name, struct tunable_info *info)
+{
+  int i;
+
+  for (i = 0; tunable_get (i, info) == 0; i++)
+    if (!strcmp (info->name, name))
+      return true;
+  return false;
+}
+
+/* Parses the decimal integer S into *VALUE.  Returns false if S is
+   not one. */
+static bool
+parse_value (const char *s, int64_t *value)
+{
+  bool negative = *s == '-';
+  int64_t v = 0;
+
+  if (negative)
+    s++;
+  if (*s == '\0')
+    return false;
+  for (; *s != '\0'; s++)
+    {
+      if (*s < '0' || *s > '9')
+        return false;
+      v = v * 10 + (*s - '0');
+    }
+  *value = negative ? -v : v;
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct tunable_info info;
+  int status = 0;
+  int i;
+
+  if (argc < 2)
+    {
+      for (i = 0; tunable_get (i, &info) == 0; i++)
+        print_tunable (&info);
+      return 0;
+    }
+
+  for (i = 1; i < argc; i++)
+    {
+      char *value = strchr (argv[i], '=');
+
+      if (value != NULL)
+        {
+          *value++ = '\0';
+          if (strlen (argv[i]) >= sizeof info.name
+              || !parse_value (value, &info.value))
+            {
+              printf ("%s: bad tunable or value\n", argv[i]);
+              status = 1;
+              continue;
+            }
+          strlcpy (info.name, argv[i], sizeof info.name);
+          if (tunable_set (&info) < 0)
+            {
+              printf ("%s: no such tunable, or %s out of bounds\n",
+                      argv[i], value);
+              status = 1;
+              continue;
+            }
+        }
+      if (!find_tunable (argv[i], &info))
+        {
+          printf ("%s: no such tunable\n", argv[i]);
+          status = 1;
+          continue;
+        }
+      print_tunable (&info);
+    }
+  return status;
+}
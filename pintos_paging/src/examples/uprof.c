@@ -0,0 +1,147 @@
+/* uprof.c
+
+   Profiles its own user code with profil() while it runs a small
+   workload, then prints where the timer ticks found it.
+
+   Usage: uprof [ROUNDS]
+
+   Each of ROUNDS rounds (default 20) sorts an array, multiplies two
+   matrices and hashes a buffer, each in a function of its own.  The
+   counters are printed the way the kernel prints its own profile
+   at shutdown, on "Profile samples:" lines of ADDRESS*COUNT,
+   most frequent first, which utils/backtrace turns into a flat
+   profile against this binary:
+
+     backtrace uprof 0x804812a*57 0x80481f3*41 ...
+
+   The whole of the text segment is profiled, with as fine counters
+   as fit in BUCKET_CNT. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Number of 16-bit counters. */
+#define BUCKET_CNT 16384
+
+/* Size of the workload's arrays. */
+#define SORT_CNT 512
+#define MATRIX_DIM 24
+#define HASH_SIZE 8192
+
+/* Bounds of the text segment, from the linker script. */
+extern char __executable_start[], etext[];
+
+static uint16_t buckets[BUCKET_CNT];
+
+static int sort_data[SORT_CNT];
+static int a[MATRIX_DIM][MATRIX_DIM], b[MATRIX_DIM][MATRIX_DIM];
+static int c[MATRIX_DIM][MATRIX_DIM];
+static unsigned char hash_data[HASH_SIZE];
+
+/* Fills SORT_DATA with numbers in decreasing order and sorts it
+   the slow way. */
+static void
+bubble_sort (void)
+{
+  int i, j;
+
+  for (i = 0; i < SORT_CNT; i++)
+    sort_data[i] = SORT_CNT - i;
+  for (i = 0; i < SORT_CNT; i++)
+    for (j = 0; j + 1 < SORT_CNT - i; j++)
+      if (sort_data[j] > sort_data[j + 1])
+        {
+          int t = sort_data[j];
+          sort_data[j] = sort_data[j + 1];
+          sort_data[j + 1] = t;
+        }
+}
+
+/* Sets C to A times B. */
+static void
+matrix_multiply (void)
+{
+  int i, j, k;
+
+  for (i = 0; i < MATRIX_DIM; i++)
+    for (j = 0; j < MATRIX_DIM; j++)
+      {
+        a[i][j] = i + j;
+        b[i][j] = i - j;
+      }
+  for (i = 0; i < MATRIX_DIM; i++)
+    for (j = 0; j < MATRIX_DIM; j++)
+      {
+        int sum = 0;
+        for (k = 0; k < MATRIX_DIM; k++)
+          sum += a[i][k] * b[k][j];
+        c[i][j] = sum;
+      }
+}
+
+/* Returns the FNV-1a hash of HASH_DATA, a few times over. */
+static unsigned
+hash_buffer (void)
+{
+  unsigned hash = 2166136261u;
+  int round, i;
+
+  for (round = 0; round < 16; round++)
+    for (i = 0; i < HASH_SIZE; i++)
+      hash = (hash ^ (hash_data[i] + round)) * 16777619u;
+  return hash;
+}
+
+int
+main (int argc, char *argv[])
+{
+  uintptr_t text = (uintptr_t) __executable_start;
+  size_t text_size = etext - __executable_start;
+  unsigned scale, hash = 0;
+  int rounds = argc > 1 ? atoi (argv[1]) : 20;
+  size_t i, printed;
+  int round;
+
+  /* One counter per 2 bytes, or coarser if the text does not fit. */
+  scale = 0x10000;
+  while ((uint64_t) (text_size / 2) * scale >> 16 >= BUCKET_CNT)
+    scale /= 2;
+
+  if (profil (buckets, sizeof buckets, text, scale) < 0)
+    {
+      printf ("uprof: profil failed\n");
+      return EXIT_FAILURE;
+    }
+  for (round = 0; round < rounds; round++)
+    {
+      bubble_sort ();
+      matrix_multiply ();
+      hash += hash_buffer ();
+    }
+  profil (NULL, 0, 0, 0);
+
+  /* Print the counters from the largest down, taking each out as
+     it is printed. */
+  printf ("uprof: %d rounds, hash %08x, %u bytes per counter\n",
+          rounds, hash, 2 * 0x10000 / scale);
+  for (printed = 0; ; printed++)
+    {
+      size_t max = 0;
+
+      for (i = 1; i < BUCKET_CNT; i++)
+        if (buckets[i] > buckets[max])
+          max = i;
+      if (buckets[max] == 0)
+        break;
+
+      if (printed % 6 == 0)
+        printf ("%sProfile samples:", printed > 0 ? "\n" : "");
+      printf (" %#x*%u", (unsigned) (text + max * 2 * 0x10000 / scale),
+              buckets[max]);
+      buckets[max] = 0;
+    }
+  printf ("\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/* vmbench.c
+
+   Benchmark of page faults, eviction and swap.
+
+   Usage: vmbench PATTERN PAGES [PROCS [PASSES]]
+
+   Allocates PAGES pages of memory with sbrk() and touches all of
+   them PASSES times (3 by default), a page at a time, in one of
+   these orders:
+
+     seq      pages 0, 1, 2, ...
+     rand     pages picked at random, PAGES of them per pass
+     stride   every 17th page, in 17 sweeps over the region
+
+   Make PAGES larger than the user pool (see the -ul kernel option)
+   to make it page.  With PROCS greater than 1, runs that many copies
+   of itself at once and waits for them all.
+
+   Each process prints one line of KEY=VALUE pairs, for a script to
+   compare run over run:
+
+     vmbench: pattern=seq pages=2048 pool=1024 passes=3 ns=... \
+       faults=... faults_per_sec=... swap_ins=... swap_ins_per_sec=... \
+       swap_outs=... swap_kb_per_sec=... evictions=...
+
+   POOL is the size of the user pool, in pages.  The counts are those
+   of getrusage(): faults include the first touch of each page, and
+   swap_outs counts the pages this process wrote to swap itself while
+   evictions counts its pages evicted by anyone.  The parent of a
+   multi-process run adds a line with PROCS and the wall-clock time
+   of the whole run. */
+
+#include <random.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+#define PAGE_SIZE 4096
+
+/* Distance between the pages touched in a row by "stride". */
+#define STRIDE 17
+
+/* Touches page PAGE of the region at BASE: checks the number it
+   was first given, and dirties it again. */
+static void
+touch (uint8_t *base, size_t page)
+{
+  uint32_t *p = (uint32_t *) (base + page * PAGE_SIZE);
+
+  if (p[0] != page)
+    {
+      printf ("vmbench: page %zu holds %u\n", page, (unsigned) p[0]);
+      exit (1);
+    }
+  p[1]++;
+}
+
+/* Returns N events over NS nanoseconds, as events per second. */
+static uint64_t
+per_sec (uint64_t n, int64_t ns)
+{
+  return ns > 0 ? n * 1000000000ULL / ns : 0;
+}
+
+/* Runs the benchmark in this process. */
+static void
+run (const char *pattern, size_t pages, int passes)
+{
+  struct rusage before, after;
+  struct mem_stats mem;
+  uint64_t faults, swap_ins, swap_outs;
+  int64_t start, ns;
+  uint8_t *base;
+  size_t i, j;
+  int pass;
+
+  base = sbrk (pages * PAGE_SIZE);
+  if (base == (void *) -1)
+    {
+      printf ("vmbench: cannot allocate %zu pages\n", pages);
+      exit (1);
+    }
+  random_init (pages);
+
+  getrusage (RUSAGE_SELF, &before);
+  start = clock_ns ();
+  for (i = 0; i < pages; i++)
+    *(uint32_t *) (base + i * PAGE_SIZE) = i;
+  for (pass = 0; pass < passes; pass++)
+    if (!strcmp (pattern, "seq"))
+      for (i = 0; i < pages; i++)
+        touch (base, i);
+    else if (!strcmp (pattern, "rand"))
+      for (i = 0; i < pages; i++)
+        touch (base, random_ulong () % pages);
+    else
+      for (i = 0; i < STRIDE; i++)
+        for (j = i; j < pages; j += STRIDE)
+          touch (base, j);
+  ns = clock_ns () - start;
+  getrusage (RUSAGE_SELF, &after);
+  memstats (&mem);
+
+  faults = (after.minor_faults + after.major_faults
+            - before.minor_faults - before.major_faults);
+  swap_ins = after.swap_ins - before.swap_ins;
+  swap_outs = after.swap_outs - before.swap_outs;
+  printf ("vmbench: pattern=%s pages=%zu pool=%u passes=%d ns=%lld "
+          "faults=%llu faults_per_sec=%llu "
+          "swap_ins=%llu swap_ins_per_sec=%llu "
+          "swap_outs=%llu swap_kb_per_sec=%llu evictions=%llu\n",
+          pattern, pages, (unsigned) mem.user_pool.pages, passes, ns,
+          faults, per_sec (faults, ns),
+          swap_ins, per_sec (swap_ins, ns),
+          swap_outs, per_sec ((swap_ins + swap_outs) * (PAGE_SIZE / 1024), ns),
+          after.evictions - before.evictions);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *pattern;
+  size_t pages;
+  int procs, passes;
+
+  if (argc < 3 || argc > 5)
+    {
+      printf ("usage: vmbench PATTERN PAGES [PROCS [PASSES]]\n");
+      return 1;
+    }
+  pattern = argv[1];
+  pages = atoi (argv[2]);
+  procs = argc > 3 ? atoi (argv[3]) : 1;
+  passes = argc > 4 ? atoi (argv[4]) : 3;
+  if ((strcmp (pattern, "seq") && strcmp (pattern, "rand")
+       && strcmp (pattern, "stride"))
+      || pages == 0 || procs < 1 || procs > 16 || passes < 1)
+    {
+      printf ("vmbench: bad arguments\n");
+      return 1;
+    }
+
+  if (procs == 1)
+    run (pattern, pages, passes);
+  else
+    {
+      pid_t children[16];
+      char cmd[64];
+      int64_t start;
+      int i;
+
+      snprintf (cmd, sizeof cmd, "vmbench %s %zu 1 %d",
+                pattern, pages, passes);
+      start = clock_ns ();
+      for (i = 0; i < procs; i++)
+        children[i] = exec (cmd);
+      for (i = 0; i < procs; i++)
+        if (children[i] == PID_ERROR || wait (children[i]) != 0)
+          {
+            printf ("vmbench: child %d failed\n", i);
+            return 1;
+          }
+      printf ("vmbench: pattern=%s pages=%zu procs=%d passes=%d ns=%lld\n",
+              pattern, pages, procs, passes, clock_ns () - start);
+    }
+  return 0;
+}
@@ -0,0 +1,620 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tunable.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+
+/* Buffer cache.
+
+   Sectors of the file system device are read and written through
+   a fixed set of CACHE_CNT sector buffers.  A sector that is not
+   cached takes the buffer chosen by the clock algorithm, whose
+   previous sector is first written back if it is dirty.  Writes
+   only dirty the buffer: dirty buffers are written back by the
+   write-behind thread every cache_writeback_ticks, along with the
+   free map, when they are replaced, and at cache_done().
+
+   cache_read_direct() and cache_write_direct() transfer whole
+   sectors between the disk and the caller's buffer without taking
+   entries, so that large transfers do not push the frequently
+   used sectors out; a sector that is cached is still served from
+   the cache.
+
+   cache_readahead() queues sectors that are likely to be read
+   soon; the readahead thread reads them in meanwhile.
+
+   Metadata is written with cache_log_write() and
+   cache_log_write_at(), which add the sector to the journal's
+   running transaction: until the transaction is committed to
+   the log, the sector is pinned, neither written back nor
+   replaced, so that its home location never holds a change that
+   the log could not redo or undo.
+
+   A single lock protects the whole cache, but it is not held
+   during the disk I/O: the entry being read or written is marked
+   busy instead, and waited for by whoever needs it, while the
+   other entries stay usable. */
+
+/* Number of cached sectors. */
+#define CACHE_CNT 64
+
+/* Time between two write-behind passes, in timer ticks; 0
+   disables them. */
+int64_t cache_writeback_ticks = TIMER_FREQ * 5;
+
+/* Maximum number of sectors queued for readahead. */
+#define READAHEAD_CNT 32
+
+/* No sector. */
+#define SECTOR_NONE ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;      /* Sector held, if valid. */
+    bool valid;                 /* Holds a sector? */
+    bool dirty;                 /* Modified since read or written back? */
+    bool accessed;              /* Used since the last visit of the hand? */
+    bool busy;                  /* Being read or written back? */
+    bool prefetched;            /* Read by readahead, not used since? */
+    bool logged;                /* In the running transaction? */
+    bool writing;               /* Busy being written back? */
+    block_sector_t old_sector;  /* If busy, the sector being written back
+                                   before `sector' is read, or SECTOR_NONE. */
+    uint8_t *data;              /* BLOCK_SECTOR_SIZE bytes. */
+    struct block_request req;   /* Readahead or write-back in flight. */
+  };
+
+static struct cache_entry cache[CACHE_CNT];
+static struct lock cache_lock;
+static struct condition cache_io; /* Signaled when entries stop being busy. */
+static size_t cache_hand;       /* Clock hand: an index into cache. */
+
+/* Readahead queue: a ring of sectors, protected by cache_lock. */
+static block_sector_t readahead_queue[READAHEAD_CNT];
+static size_t readahead_head, readahead_cnt;
+
+/* Background work: write-behind every cache_writeback_ticks,
+   and readahead of the queued sectors.  Two workers, so that a
+   long write-behind does not hold up readahead. */
+static struct workqueue cache_wq;
+static struct work write_behind_work;
+static struct work readahead_work;
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_claim (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool load);
+static void write_behind (struct work *);
+static void writeback_tuned (void);
+static void readahead (struct work *);
+static void write_at (block_sector_t, const void *, int ofs, int size,
+                      bool logged);
+
+static struct tunable cache_tunables[] =
+  {
+    TUNABLE ("fs.writeback_ticks", cache_writeback_ticks, 0,
+             TIMER_FREQ * 3600, writeback_tuned),
+  };
+
+/* Initializes the buffer cache, and starts its write-behind and
+   readahead work. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              DIV_ROUND_UP (CACHE_CNT * BLOCK_SECTOR_SIZE,
+                                            PGSIZE));
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      cache[i].valid = false;
+      cache[i].dirty = false;
+      cache[i].accessed = false;
+      cache[i].busy = false;
+      cache[i].prefetched = false;
+      cache[i].logged = false;
+      cache[i].writing = false;
+      cache[i].old_sector = SECTOR_NONE;
+      cache[i].data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  lock_init_named (&cache_lock, "cache");
+  cond_init (&cache_io);
+  cache_hand = 0;
+
+  readahead_head = readahead_cnt = 0;
+
+  if (!workqueue_init (&cache_wq, "cache", PRI_DEFAULT, 2, 0))
+    PANIC ("cannot start buffer cache workers");
+  work_init (&write_behind_work, write_behind, NULL);
+  work_init (&readahead_work, readahead, NULL);
+  if (cache_writeback_ticks > 0)
+    work_queue_delayed (&cache_wq, &write_behind_work, cache_writeback_ticks);
+  tunable_register (cache_tunables,
+                    sizeof cache_tunables / sizeof *cache_tunables);
+}
+
+/* Writes all the dirty sectors back, before shutdown. */
+void
+cache_done (void)
+{
+  cache_flush ();
+}
+
+/* Writes all the dirty sectors back to disk. */
+void
+cache_flush (void)
+{
+  cache_flush_range (0, SECTOR_NONE);
+}
+
+/* Writes all the dirty sectors back to disk, like cache_flush(),
+   and waits for the write-backs that others have in flight too,
+   so that every sector written to the cache so far, except those
+   still in the running transaction, is on disk. */
+void
+cache_flush_wait (void)
+{
+  size_t i;
+
+  cache_flush ();
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    while (cache[i].writing)
+      cond_wait (&cache_io, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Queues SECTOR to be read into the cache in the background, if
+   it is not there yet.  It is dropped if the queue is full. */
+void
+cache_readahead (block_sector_t sector)
+{
+  lock_acquire (&cache_lock);
+  if (readahead_cnt < READAHEAD_CNT && cache_lookup (sector) == NULL)
+    {
+      readahead_queue[(readahead_head + readahead_cnt++) % READAHEAD_CNT]
+        = sector;
+      work_queue (&cache_wq, &readahead_work);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SECTOR from BUFFER, which must contain BLOCK_SECTOR_SIZE
+   bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR.  The rest
+   of the sector is read from disk first, unless the whole sector
+   is written. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  write_at (sector, buffer, ofs, size, false);
+}
+
+/* Writes metadata SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes, as part of the running transaction.
+   The caller must be in a journal handle. */
+void
+cache_log_write (block_sector_t sector, const void *buffer)
+{
+  write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE, true);
+}
+
+/* Writes SIZE bytes of metadata from BUFFER at offset OFS of
+   SECTOR, as part of the running transaction.  The caller must be
+   in a journal handle. */
+void
+cache_log_write_at (block_sector_t sector, const void *buffer, int ofs,
+                    int size)
+{
+  write_at (sector, buffer, ofs, size, true);
+}
+
+/* Takes SECTOR, which the journal has committed or dropped, out
+   of the running transaction, so that it may be written back. */
+void
+cache_unlog (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  e = cache_lookup (sector);
+  if (e != NULL && e->logged)
+    {
+      e->logged = false;
+      cond_broadcast (&cache_io, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR, adding
+   SECTOR to the running transaction if LOGGED and the journal is
+   open. */
+static void
+write_at (block_sector_t sector, const void *buffer, int ofs, int size,
+          bool logged)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  if (logged && !e->logged && journal_add (sector))
+    e->logged = true;
+  lock_release (&cache_lock);
+}
+
+/* Returns the number of sectors, at most CNT, starting at SECTOR
+   that are not cached.
+   cache_lock must be held. */
+static block_sector_t
+uncached_run (block_sector_t sector, block_sector_t cnt)
+{
+  block_sector_t run;
+
+  for (run = 0; run < cnt && cache_lookup (sector + run) == NULL; run++)
+    continue;
+  return run;
+}
+
+/* Reads the CNT sectors starting at SECTOR into BUFFER, which
+   must have room for CNT * BLOCK_SECTOR_SIZE bytes, straight from
+   disk except for those that are cached.  Runs of uncached
+   sectors take one disk request each.  The caller must keep the
+   sectors from being written meanwhile. */
+void
+cache_read_direct (block_sector_t sector, block_sector_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t run;
+
+      lock_acquire (&cache_lock);
+      run = uncached_run (sector, cnt);
+      if (run == 0)
+        {
+          struct cache_entry *e = cache_get (sector, true);
+          memcpy (buffer, e->data, BLOCK_SECTOR_SIZE);
+          lock_release (&cache_lock);
+          run = 1;
+        }
+      else
+        {
+          lock_release (&cache_lock);
+          block_read_multiple (fs_device, sector, run, buffer);
+        }
+
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Writes the CNT sectors starting at SECTOR from BUFFER, which
+   must contain CNT * BLOCK_SECTOR_SIZE bytes, straight to disk
+   except for those that are cached, which are only dirtied.  Runs
+   of uncached sectors take one disk request each.  The caller
+   must keep the sectors from being read or written meanwhile; a
+   copy of one that readahead brings in during the write is
+   brought up to date afterward. */
+void
+cache_write_direct (block_sector_t sector, block_sector_t cnt,
+                    const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      struct cache_entry *e;
+      block_sector_t run, i;
+
+      lock_acquire (&cache_lock);
+      run = uncached_run (sector, cnt);
+      if (run == 0)
+        {
+          e = cache_get (sector, false);
+          memcpy (e->data, buffer, BLOCK_SECTOR_SIZE);
+          e->dirty = true;
+          lock_release (&cache_lock);
+          run = 1;
+        }
+      else
+        {
+          lock_release (&cache_lock);
+          block_write_multiple (fs_device, sector, run, buffer);
+
+          lock_acquire (&cache_lock);
+          for (i = 0; i < run; i++)
+            if (cache_lookup (sector + i) != NULL)
+              {
+                e = cache_get (sector + i, false);
+                memcpy (e->data, buffer + i * BLOCK_SECTOR_SIZE,
+                        BLOCK_SECTOR_SIZE);
+              }
+          lock_release (&cache_lock);
+        }
+
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Returns the cache entry holding SECTOR, or a null pointer if
+   it is not cached.  The entry may be busy.
+   cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (i = 0; i < CACHE_CNT; i++)
+    if ((cache[i].valid && cache[i].sector == sector)
+        || (cache[i].busy && cache[i].old_sector == sector))
+      return &cache[i];
+  return NULL;
+}
+
+/* Chooses the entry that SECTOR, which is not cached, replaces,
+   and marks it busy for SECTOR, with its old sector to be written
+   back first if dirty.  Returns a null pointer, after waiting for
+   an entry to become free, if all of them are busy.
+   cache_lock must be held. */
+static struct cache_entry *
+cache_claim (block_sector_t sector)
+{
+  struct cache_entry *e;
+  size_t i;
+
+  /* Clock: the first entry not used since the hand last passed.
+     At most two sweeps, unless every entry is busy. */
+  for (i = 0; ; i++)
+    {
+      if (i >= 2 * CACHE_CNT)
+        {
+          cond_wait (&cache_io, &cache_lock);
+          return NULL;
+        }
+
+      e = &cache[cache_hand];
+      if (++cache_hand >= CACHE_CNT)
+        cache_hand = 0;
+      if (e->busy || e->logged)
+        continue;
+      if (!e->valid || !e->accessed)
+        break;
+      e->accessed = false;
+    }
+
+  fs_stats.cache_misses++;
+  e->busy = true;
+  e->prefetched = false;
+  e->old_sector = e->valid && e->dirty ? e->sector : SECTOR_NONE;
+  e->writing = e->old_sector != SECTOR_NONE;
+  e->dirty = false;
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  return e;
+}
+
+/* Returns the cache entry holding SECTOR, which replaces another
+   one if SECTOR is not cached yet.  Its contents are only read
+   from disk in that case if LOAD is true.  The entry returned is
+   not busy.
+   cache_lock must be held; it is released while waiting for the
+   disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e == NULL)
+        break;
+      if (!e->busy && e->sector == sector)
+        {
+          fs_stats.cache_hits++;
+          if (e->prefetched)
+            {
+              fs_stats.readahead_hits++;
+              e->prefetched = false;
+            }
+          e->accessed = true;
+          return e;
+        }
+      cond_wait (&cache_io, &cache_lock);
+    }
+
+  e = cache_claim (sector);
+  if (e == NULL)
+    return cache_get (sector, load);
+
+  /* Write the old sector back and read the new one, without the
+     lock: lookups for either one wait for E meanwhile. */
+  lock_release (&cache_lock);
+  if (e->old_sector != SECTOR_NONE)
+    block_write (fs_device, e->old_sector, e->data);
+  if (load)
+    block_read (fs_device, sector, e->data);
+  lock_acquire (&cache_lock);
+
+  e->busy = e->writing = false;
+  e->old_sector = SECTOR_NONE;
+  cond_broadcast (&cache_io, &cache_lock);
+  return e;
+}
+
+/* Writes the dirty sectors among the CNT sectors starting at
+   START back to disk, all submitted at once to the device's
+   queue, whose elevator sweeps across them and merges the
+   neighbors.  The entries are busy during the writes, which are
+   done without cache_lock. */
+void
+cache_flush_range (block_sector_t start, block_sector_t cnt)
+{
+  struct cache_entry *batch[CACHE_CNT];
+  size_t batch_cnt = 0;
+  size_t i, j;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_CNT; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      if (!e->valid || !e->dirty || e->busy || e->logged
+          || e->sector - start >= cnt)
+        continue;
+
+      /* Insertion sort by sector. */
+      for (j = batch_cnt++; j > 0 && batch[j - 1]->sector > e->sector; j--)
+        batch[j] = batch[j - 1];
+      batch[j] = e;
+      e->busy = true;
+      e->writing = true;
+      e->dirty = false;
+    }
+  lock_release (&cache_lock);
+  if (batch_cnt == 0)
+    return;
+
+  for (i = 0; i < batch_cnt; i++)
+    {
+      block_request_init (&batch[i]->req, true, batch[i]->sector, 1,
+                          batch[i]->data);
+      block_submit (fs_device, &batch[i]->req);
+    }
+  for (i = 0; i < batch_cnt; i++)
+    block_wait (&batch[i]->req);
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < batch_cnt; i++)
+    batch[i]->busy = batch[i]->writing = false;
+  cond_broadcast (&cache_io, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Writes the dirty sectors back, every cache_writeback_ticks, so
+   that they do not stay in memory only for long. */
+static void
+write_behind (struct work *w)
+{
+  filesys_sync ();
+  if (cache_writeback_ticks > 0)
+    work_queue_delayed (&cache_wq, w, cache_writeback_ticks);
+}
+
+/* Starts write-behind over with the new interval, which may turn
+   it back on. */
+static void
+writeback_tuned (void)
+{
+  if (cache_writeback_ticks > 0)
+    work_queue_delayed (&cache_wq, &write_behind_work, cache_writeback_ticks);
+}
+
+/* Finishes the readahead of the entry in R. */
+static void
+readahead_done (struct block_request *r)
+{
+  struct cache_entry *e = r->aux;
+
+  lock_acquire (&cache_lock);
+  e->busy = e->writing = false;
+  e->old_sector = SECTOR_NONE;
+  cond_broadcast (&cache_io, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Starts reading in the sectors queued by cache_readahead(),
+   without waiting for one to arrive before the next, so that the
+   device's elevator can order them.  They are not marked
+   accessed, so that they are replaced first if they are not
+   used. */
+static void
+readahead (struct work *w UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e = NULL;
+      block_sector_t sector;
+
+      lock_acquire (&cache_lock);
+      if (readahead_cnt == 0)
+        {
+          lock_release (&cache_lock);
+          return;
+        }
+      sector = readahead_queue[readahead_head];
+      readahead_head = (readahead_head + 1) % READAHEAD_CNT;
+      readahead_cnt--;
+
+      if (cache_lookup (sector) == NULL)
+        e = cache_claim (sector);
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->accessed = false;
+      e->prefetched = true;
+      fs_stats.readahead_reads++;
+      lock_release (&cache_lock);
+
+      /* The old sector must be on disk before the buffer is
+         overwritten. */
+      if (e->old_sector != SECTOR_NONE)
+        block_write (fs_device, e->old_sector, e->data);
+      block_request_init (&e->req, false, sector, 1, e->data);
+      e->req.complete = readahead_done;
+      e->req.aux = e;
+      block_submit (fs_device, &e->req);
+    }
+}
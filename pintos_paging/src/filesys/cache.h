@@ -0,0 +1,26 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdint.h>
+#include "devices/block.h"
+
+extern int64_t cache_writeback_ticks;
+
+void cache_init (void);
+void cache_done (void);
+void cache_flush (void);
+void cache_flush_wait (void);
+void cache_flush_range (block_sector_t start, block_sector_t cnt);
+void cache_readahead (block_sector_t);
+
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_at (block_sector_t, void *, int ofs, int size);
+void cache_write_at (block_sector_t, const void *, int ofs, int size);
+void cache_log_write (block_sector_t, const void *);
+void cache_log_write_at (block_sector_t, const void *, int ofs, int size);
+void cache_unlog (block_sector_t);
+void cache_read_direct (block_sector_t, block_sector_t cnt, void *);
+void cache_write_direct (block_sector_t, block_sector_t cnt, const void *);
+
+#endif /* filesys/cache.h */
@@ -1,10 +1,16 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/packfs.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,6 +27,78 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Maximum number of directories with an index. */
+#define DIR_INDEX_CNT 32
+
+/* In-memory index of a directory's entries, built when the
+   directory is first searched and kept up to date by dir_add()
+   and dir_remove(), so that neither has to scan the directory.
+
+   Together, the indexes are the cache of name lookups, keyed by
+   the directory's inode sector and then the name.  Each index
+   holds every entry of its directory, so a name that is not in it
+   does not exist, without a negative entry for it.  Only the
+   DIR_INDEX_CNT most recently searched directories keep their
+   index, so that the cache stays bounded however many
+   directories there are. */
+struct dir_index
+  {
+    struct hash_elem elem;              /* Element in dir_indexes. */
+    struct list_elem lru_elem;          /* Element in index_lru. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    struct hash names;                  /* `struct dir_name's by name. */
+    struct list free_slots;             /* `struct dir_slot's. */
+    off_t end;                          /* Offset past the last entry. */
+  };
+
+/* An entry in use, in a directory index. */
+struct dir_name
+  {
+    struct hash_elem elem;              /* Element in `names'. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    off_t ofs;                          /* Offset of the entry. */
+  };
+
+/* An unused entry, in a directory index. */
+struct dir_slot
+  {
+    struct list_elem elem;              /* Element in `free_slots'. */
+    off_t ofs;                          /* Offset of the entry. */
+  };
+
+/* Serializes the updates of directory entries against each other
+   and against searches, so that two files cannot be added under
+   one name, nor an entry be reused while it is being looked up.
+   Also protects the directory indexes.  dir_lookup() only needs
+   it for reading when the directory's index is already built,
+   so that lookups, by far the most common operation, do not wait
+   for each other. */
+static struct rwlock dir_rw;
+
+/* Directory indexes, keyed by the directory's inode sector, and
+   also on index_lru, most recently searched first. */
+static struct hash dir_indexes;
+static struct list index_lru;
+static size_t index_cnt;
+
+static unsigned index_hash_func (const struct hash_elem *, void *);
+static bool index_less_func (const struct hash_elem *,
+                             const struct hash_elem *, void *);
+static unsigned name_hash_func (const struct hash_elem *, void *);
+static bool name_less_func (const struct hash_elem *,
+                            const struct hash_elem *, void *);
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  rwlock_init (&dir_rw);
+  hash_init (&dir_indexes, index_hash_func, index_less_func, NULL);
+  list_init (&index_lru);
+  index_cnt = 0;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -37,6 +115,7 @@ dir_open (struct inode *inode)
   struct dir *dir = calloc (1, sizeof *dir);
   if (inode != NULL && dir != NULL)
     {
+      inode_set_metadata (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -83,34 +162,290 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns a hash value for the directory index in E. */
+static unsigned
+index_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct dir_index, elem)->sector);
+}
+
+/* Returns true if the directory index in A precedes the one in
+   B. */
+static bool
+index_less_func (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct dir_index, elem)->sector
+          < hash_entry (b, struct dir_index, elem)->sector);
+}
+
+/* Returns a hash value for the name in E. */
+static unsigned
+name_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_string (hash_entry (e, struct dir_name, elem)->name);
+}
+
+/* Returns true if the name in A precedes the one in B. */
+static bool
+name_less_func (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct dir_name, elem)->name,
+                 hash_entry (b, struct dir_name, elem)->name) < 0;
+}
+
+/* Frees the name in E. */
+static void
+name_destroy_func (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_name, elem));
+}
+
+/* Adds an entry for NAME, with inode INODE_SECTOR, at offset OFS
+   to INDEX.  Returns false if memory allocation fails. */
+static bool
+index_add_name (struct dir_index *index, const char *name,
+                block_sector_t inode_sector, off_t ofs)
+{
+  struct dir_name *n = malloc (sizeof *n);
+  if (n == NULL)
+    return false;
+  strlcpy (n->name, name, sizeof n->name);
+  n->inode_sector = inode_sector;
+  n->ofs = ofs;
+  hash_insert (&index->names, &n->elem);
+  return true;
+}
+
+/* Records that the entry at OFS is unused in INDEX.  Returns
+   false if memory allocation fails. */
+static bool
+index_add_slot (struct dir_index *index, off_t ofs)
+{
+  struct dir_slot *slot = malloc (sizeof *slot);
+  if (slot == NULL)
+    return false;
+  slot->ofs = ofs;
+  list_push_back (&index->free_slots, &slot->elem);
+  return true;
+}
+
+/* Returns the entry for NAME in INDEX, or a null pointer if
+   there is none. */
+static struct dir_name *
+index_find (struct dir_index *index, const char *name)
+{
+  struct dir_name probe;
+  struct hash_elem *e;
+
+  /* A longer name would match a stored prefix of itself. */
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (probe.name, name, sizeof probe.name);
+  e = hash_find (&index->names, &probe.elem);
+  return e != NULL ? hash_entry (e, struct dir_name, elem) : NULL;
+}
+
+/* Frees INDEX, which must not be in dir_indexes. */
+static void
+index_free (struct dir_index *index)
+{
+  hash_destroy (&index->names, name_destroy_func);
+  while (!list_empty (&index->free_slots))
+    free (list_entry (list_pop_front (&index->free_slots),
+                      struct dir_slot, elem));
+  free (index);
+}
+
+/* Discards the index of the directory in SECTOR, if there is one.
+   It is built again on the next search of the directory. */
+static void
+index_drop (block_sector_t sector)
+{
+  struct dir_index probe;
+  struct hash_elem *e;
+
+  probe.sector = sector;
+  e = hash_delete (&dir_indexes, &probe.elem);
+  if (e != NULL)
+    {
+      struct dir_index *index = hash_entry (e, struct dir_index, elem);
+      list_remove (&index->lru_elem);
+      index_cnt--;
+      index_free (index);
+    }
+}
+
+/* Returns the index of DIR if it is built, otherwise a null
+   pointer.  dir_rw must be held, for reading at least. */
+static struct dir_index *
+index_cached (const struct dir *dir)
+{
+  struct dir_index probe;
+  struct hash_elem *he;
+  struct dir_index *index;
+  enum intr_level old_level;
+
+  probe.sector = inode_get_inumber (dir->inode);
+  he = hash_find (&dir_indexes, &probe.elem);
+  if (he == NULL)
+    return NULL;
+
+  /* Readers may race for the LRU list. */
+  index = hash_entry (he, struct dir_index, elem);
+  old_level = intr_disable ();
+  list_remove (&index->lru_elem);
+  list_push_front (&index_lru, &index->lru_elem);
+  intr_set_level (old_level);
+  return index;
+}
+
+/* Returns the index of DIR, reading the directory to build it if
+   needed.  Returns a null pointer if memory allocation fails, in
+   which case the directory must be scanned instead.
+   dir_rw must be held for writing. */
+static struct dir_index *
+index_get (const struct dir *dir)
+{
+  struct dir_index *index;
+  struct dir_entry e;
+  off_t ofs;
+
+  ASSERT (rwlock_held_for_write (&dir_rw));
+
+  index = index_cached (dir);
+  if (index != NULL)
+    return index;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  index->sector = inode_get_inumber (dir->inode);
+  list_init (&index->free_slots);
+  if (!hash_init (&index->names, name_hash_func, name_less_func, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+
+  fs_stats.dir_index_builds++;
+  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+       ofs += sizeof e)
+    {
+      fs_stats.dir_entries_read++;
+      if (e.in_use ? !index_add_name (index, e.name, e.inode_sector, ofs)
+                   : !index_add_slot (index, ofs))
+        {
+          index_free (index);
+          return NULL;
+        }
+    }
+  index->end = ofs;
+
+  /* Make room by dropping the least recently searched index. */
+  if (index_cnt >= DIR_INDEX_CNT)
+    index_drop (list_entry (list_back (&index_lru),
+                            struct dir_index, lru_elem)->sector);
+  hash_insert (&dir_indexes, &index->elem);
+  list_push_front (&index_lru, &index->lru_elem);
+  index_cnt++;
+  return index;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   dir_rw must be held for writing. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   size_t ofs;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  fs_stats.dir_lookups++;
+  index = index_get (dir);
+  if (index != NULL)
+    {
+      struct dir_name *n = index_find (index, name);
+      if (n == NULL)
+        return false;
+      if (ep != NULL)
+        {
+          ep->inode_sector = n->inode_sector;
+          strlcpy (ep->name, n->name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = n->ofs;
+      return true;
+    }
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+    {
+      fs_stats.dir_entries_read++;
+      if (e.in_use && !strcmp (name, e.name)) 
+        {
+          if (ep != NULL)
+            *ep = e;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          return true;
+        }
+    }
   return false;
 }
 
+/* Searches DIR, in a packed image, for a file with the given NAME
+   by binary search, since its entries are sorted by name and
+   never change.  Returns the file's inode sector, or 0 if there
+   is no such file. */
+static block_sector_t
+packed_lookup (const struct dir *dir, const char *name)
+{
+  struct dir_entry e;
+  off_t lo = 0, hi = inode_length (dir->inode) / sizeof e;
+  unsigned entries_read = 0;
+  block_sector_t sector = 0;
+  enum intr_level old_level;
+
+  while (lo < hi)
+    {
+      off_t mid = lo + (hi - lo) / 2;
+      int cmp;
+
+      if (inode_read_at (dir->inode, &e, sizeof e, mid * sizeof e)
+          != sizeof e)
+        break;
+      entries_read++;
+      e.name[NAME_MAX] = '\0';
+      cmp = strcmp (name, e.name);
+      if (cmp == 0)
+        {
+          sector = e.inode_sector;
+          break;
+        }
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+
+  old_level = intr_disable ();
+  fs_stats.dir_lookups++;
+  fs_stats.dir_entries_read += entries_read;
+  intr_set_level (old_level);
+  return sector;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -119,15 +454,42 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  struct dir_index *index;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (packfs_mounted ())
+    {
+      block_sector_t sector = packed_lookup (dir, name);
+      *inode = sector != 0 ? inode_open (sector) : NULL;
+      return *inode != NULL;
+    }
+
+  /* Look in the index, if there is one, sharing dir_rw. */
+  rwlock_acquire_read (&dir_rw);
+  index = index_cached (dir);
+  if (index != NULL)
+    {
+      struct dir_name *n = index_find (index, name);
+      enum intr_level old_level = intr_disable ();
+      fs_stats.dir_lookups++;
+      intr_set_level (old_level);
+
+      *inode = n != NULL ? inode_open (n->inode_sector) : NULL;
+      rwlock_release_read (&dir_rw);
+      return *inode != NULL;
+    }
+  rwlock_release_read (&dir_rw);
+
+  /* Otherwise build it, or scan the directory. */
+  rwlock_acquire_write (&dir_rw);
   if (lookup (dir, name, &e, NULL))
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
+  rwlock_release_write (&dir_rw);
 
   return *inode != NULL;
 }
@@ -141,6 +503,8 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *slot = NULL;
   struct dir_entry e;
   off_t ofs;
   bool success = false;
@@ -152,6 +516,12 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  /* A packed image is read-only. */
+  if (packfs_mounted ())
+    return false;
+
+  rwlock_acquire_write (&dir_rw);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
@@ -163,10 +533,23 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  index = index_get (dir);
+  if (index != NULL)
+    {
+      if (!list_empty (&index->free_slots))
+        {
+          slot = list_entry (list_pop_front (&index->free_slots),
+                             struct dir_slot, elem);
+          ofs = slot->ofs;
+        }
+      else
+        ofs = index->end;
+    }
+  else
+    for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+         ofs += sizeof e) 
+      if (!e.in_use)
+        break;
 
   /* Write slot. */
   e.in_use = true;
@@ -174,16 +557,34 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+  /* Bring the index up to date, or give it up if that fails. */
+  if (index != NULL)
+    {
+      if (!success && slot != NULL)
+        list_push_front (&index->free_slots, &slot->elem);
+      else
+        {
+          free (slot);
+          if (slot == NULL && success)
+            index->end += sizeof e;
+          if (success && !index_add_name (index, name, inode_sector, ofs))
+            index_drop (index->sector);
+        }
+    }
+
  done:
+  rwlock_release_write (&dir_rw);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME or
+   the file system is a packed image. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
@@ -192,6 +593,11 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (packfs_mounted ())
+    return false;
+
+  rwlock_acquire_write (&dir_rw);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -210,7 +616,25 @@ dir_remove (struct dir *dir, const char *name)
   inode_remove (inode);
   success = true;
 
+  /* Bring the index up to date, or give it up if that fails.  If
+     the file was itself a directory, its index goes too. */
+  index_drop (e.inode_sector);
+  index = index_get (dir);
+  if (index != NULL)
+    {
+      /* A freshly built index already has the entry free. */
+      struct dir_name *n = index_find (index, name);
+      if (n != NULL)
+        {
+          hash_delete (&index->names, &n->elem);
+          free (n);
+          if (!index_add_slot (index, ofs))
+            index_drop (index->sector);
+        }
+    }
+
  done:
+  rwlock_release_write (&dir_rw);
   inode_close (inode);
   return success;
 }
@@ -222,15 +646,120 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool found = false;
 
+  rwlock_acquire_read (&dir_rw);
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  rwlock_release_read (&dir_rw);
+  return found;
+}
+
+/* Number of entries read at a time by dir_read_entries(). */
+#define READ_BATCH 64
+
+/* Orders `struct dir_name' pointers by the offset of the entry. */
+static int
+name_ofs_compare (const void *a_, const void *b_, void *aux UNUSED)
+{
+  const struct dir_name *const *a = a_;
+  const struct dir_name *const *b = b_;
+
+  return (*a)->ofs < (*b)->ofs ? -1 : (*a)->ofs > (*b)->ofs;
+}
+
+/* Passes the entries of DIR in use from byte offset *POS on, in
+   the order they are stored, to FUNC along with AUX, until FUNC
+   returns false or the directory ends, and advances *POS past the
+   entries FUNC took.  Takes them from DIR's index if it is built,
+   without reading the directory, and otherwise reads READ_BATCH
+   entries at a time.  Returns false if memory runs out. */
+bool
+dir_read_entries (struct dir *dir, off_t *pos, dir_entry_func *func,
+                  void *aux)
+{
+  struct dir_index *index;
+  bool success = true;
+
+  rwlock_acquire_read (&dir_rw);
+  index = index_cached (dir);
+  if (index != NULL)
+    {
+      struct dir_name **names;
+      struct hash_iterator i;
+      size_t cnt = 0, j;
+
+      names = malloc ((hash_size (&index->names) + 1) * sizeof *names);
+      if (names == NULL)
+        {
+          success = false;
+          goto done;
+        }
+      hash_first (&i, &index->names);
+      while (hash_next (&i))
+        {
+          struct dir_name *n = hash_entry (hash_cur (&i),
+                                           struct dir_name, elem);
+          if (n->ofs >= *pos)
+            names[cnt++] = n;
+        }
+      sort (names, cnt, sizeof *names, name_ofs_compare, NULL);
+
+      for (j = 0; j < cnt; j++)
+        if (!func (names[j]->name, names[j]->inode_sector, aux))
+          break;
+      *pos = j < cnt ? names[j]->ofs : index->end;
+      free (names);
+    }
+  else
+    {
+      struct dir_entry *batch = malloc (READ_BATCH * sizeof *batch);
+      off_t size;
+
+      if (batch == NULL)
+        {
+          success = false;
+          goto done;
+        }
+      while ((size = inode_read_at (dir->inode, batch,
+                                    READ_BATCH * sizeof *batch, *pos))
+             >= (off_t) sizeof *batch)
+        {
+          size_t cnt = size / sizeof *batch, j;
+
+          fs_stats.dir_entries_read += cnt;
+          for (j = 0; j < cnt; j++, *pos += sizeof *batch)
+            if (batch[j].in_use
+                && !func (batch[j].name, batch[j].inode_sector, aux))
+              break;
+          if (j < cnt)
+            break;
+        }
+      free (batch);
+    }
+
+ done:
+  rwlock_release_read (&dir_rw);
+  return success;
+}
+
+/* Allocates a sector for the inode of a file to be added to DIR,
+   close after DIR's own inode, so that a directory and the files
+   in it, whose data follows their inodes, stay together on disk.
+   Stores it into *SECTORP and returns true if successful, false
+   if the disk is full or the file system is a packed image. */
+bool
+dir_alloc_inode (struct dir *dir, block_sector_t *sectorp)
+{
+  if (packfs_mounted ())
+    return false;
+  return free_map_allocate_near (inode_get_inumber (dir->inode), 1, sectorp);
 }
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -13,6 +14,8 @@
 
 struct inode;
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -27,4 +30,11 @@ bool dir_add (struct dir *, const char *name, block_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 
+/* Called by dir_read_entries() for each entry, with its NAME and
+   its inode's sector.  Returns false to stop before the entry. */
+typedef bool dir_entry_func (const char *name, block_sector_t, void *aux);
+bool dir_read_entries (struct dir *, off_t *pos, dir_entry_func *,
+                       void *aux);
+bool dir_alloc_inode (struct dir *, block_sector_t *);
+
 #endif /* filesys/directory.h */
@@ -1,7 +1,24 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "filesys/pipe.h"
+#include "threads/slab.h"
+#include "threads/palloc.h"
+#include "threads/spinlock.h"
+#include "threads/vaddr.h"
+
+/* Bytes read ahead of a sequential file_read(). */
+#define READAHEAD_BYTES (8 * BLOCK_SECTOR_SIZE)
+
+/* Reads and writes of at least this many bytes move their whole
+   sectors directly between the disk and the caller's buffer,
+   bypassing the buffer cache, and are not read ahead of: they are
+   streaming transfers that would only push the frequently used
+   sectors out of the cache. */
+#define DIRECT_IO_BYTES (16 * BLOCK_SECTOR_SIZE)
+
+static off_t read_at (struct file *, void *, off_t size, off_t start);
+static off_t write_at (struct file *, const void *, off_t size, off_t start);
 
 /* An open file. */
 struct file 
@@ -9,67 +26,199 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t next_pos;             /* Where the last file_read() ended. */
+    off_t readahead_end;        /* End of the bytes already read ahead. */
+    struct pipe *pipe;          /* Pipe of which this is an end, if
+                                   INODE is null. */
+    bool pipe_write;            /* Is it the write end? */
+    struct spinlock lock;       /* Protects REF_CNT. */
+    int ref_cnt;                /* References, see file_dup(). */
   };
 
+/* Open files. */
+static struct kmem_cache file_cache;
+
+/* Initializes the cache of open files. */
+void
+file_init (void)
+{
+  kmem_cache_init (&file_cache, "file", sizeof (struct file), 0, NULL);
+  pipe_init ();
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->next_pos = 0;
+      file->readahead_end = 0;
+      file->pipe = NULL;
+      file->pipe_write = false;
+      spinlock_init (&file->lock);
+      file->ref_cnt = 1;
       return file;
     }
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (&file_cache, file);
       return NULL; 
     }
 }
 
-/* Opens and returns a new file for the same inode as FILE.
+/* Opens a new end of pipe P, for writing if WRITE, else for
+   reading, and returns it.  Returns a null pointer if an allocation
+   fails. */
+static struct file *
+open_pipe_end (struct pipe *p, bool write)
+{
+  struct file *file = kmem_cache_alloc (&file_cache);
+  if (file == NULL)
+    return NULL;
+
+  file->inode = NULL;
+  file->pos = 0;
+  file->deny_write = false;
+  file->next_pos = 0;
+  file->readahead_end = 0;
+  file->pipe = p;
+  file->pipe_write = write;
+  spinlock_init (&file->lock);
+  file->ref_cnt = 1;
+  pipe_open_end (p, write);
+  return file;
+}
+
+/* Creates a pipe and opens its read end into ENDS[0] and its write
+   end into ENDS[1].  Returns false if an allocation fails.
+
+   A pipe end works with file_read() or file_write(), as the end
+   allows, and file_reopen() and file_close(); it has no position
+   or length. */
+bool
+file_open_pipe (struct file *ends[2])
+{
+  struct pipe *p = pipe_create ();
+  if (p == NULL)
+    return false;
+
+  ends[0] = open_pipe_end (p, false);
+  if (ends[0] == NULL)
+    {
+      /* Closing its only end frees the pipe. */
+      pipe_open_end (p, false);
+      pipe_close_end (p, false);
+      return false;
+    }
+  ends[1] = open_pipe_end (p, true);
+  if (ends[1] == NULL)
+    {
+      file_close (ends[0]);
+      return false;
+    }
+  return true;
+}
+
+/* Opens and returns a new file for the same inode as FILE, or
+   another end of the same pipe.
    Returns a null pointer if unsuccessful. */
 struct file *
 file_reopen (struct file *file) 
 {
+  if (file->pipe != NULL)
+    return open_pipe_end (file->pipe, file->pipe_write);
   return file_open (inode_reopen (file->inode));
 }
 
-/* Closes FILE. */
+/* Returns another reference to FILE, which stays open, with the
+   same position, until each of them is closed: the way a fork()ed
+   process shares the files of its parent. */
+struct file *
+file_dup (struct file *file)
+{
+  spinlock_acquire (&file->lock);
+  file->ref_cnt++;
+  spinlock_release (&file->lock);
+  return file;
+}
+
+/* Closes FILE, or drops one reference to it (see file_dup()). */
 void
 file_close (struct file *file) 
 {
   if (file != NULL)
     {
+      int ref_cnt;
+
+      spinlock_acquire (&file->lock);
+      ref_cnt = --file->ref_cnt;
+      spinlock_release (&file->lock);
+      if (ref_cnt > 0)
+        return;
+
+      if (file->pipe != NULL)
+        pipe_close_end (file->pipe, file->pipe_write);
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      kmem_cache_free (&file_cache, file);
     }
 }
 
-/* Returns the inode encapsulated by FILE. */
+/* Returns the inode encapsulated by FILE, or a null pointer if it
+   is a pipe end. */
 struct inode *
 file_get_inode (struct file *file) 
 {
   return file->inode;
 }
 
+/* Returns the pipe of which FILE is the end for writing if WRITE,
+   for reading otherwise, or a null pointer if it is no such end. */
+struct pipe *
+file_get_pipe (struct file *file, bool write)
+{
+  return file->pipe != NULL && file->pipe_write == write ? file->pipe : NULL;
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+   A read that starts where the previous one ended also starts
+   reading the following READAHEAD_BYTES in the background. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  if (file->pipe != NULL)
+    return !file->pipe_write ? pipe_read (file->pipe, buffer, size, NULL) : -1;
+
+  bool sequential = file->pos == file->next_pos && size < DIRECT_IO_BYTES;
+  off_t bytes_read = read_at (file, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->next_pos = file->pos;
+  if (!sequential)
+    file->readahead_end = 0;    /* Moved elsewhere: start over. */
+
+  if (sequential && bytes_read > 0)
+    {
+      off_t start = file->pos > file->readahead_end
+                    ? file->pos : file->readahead_end;
+      off_t end = file->pos + READAHEAD_BYTES;
+      if (start < end)
+        {
+          inode_readahead (file->inode, end - start, start);
+          file->readahead_end = end;
+        }
+    }
   return bytes_read;
 }
 
@@ -77,24 +226,28 @@ file_read (struct file *file, void *buffer, off_t size)
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   The file's current position is unaffected. */
+   The file's current position is unaffected.
+   Returns -1 for a pipe end. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  if (file->pipe != NULL)
+    return -1;
+  return read_at (file, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file cannot grow that far.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
 {
-  off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
+  if (file->pipe != NULL)
+    return file->pipe_write ? pipe_write (file->pipe, buffer, size) : -1;
+
+  off_t bytes_written = write_at (file, buffer, size, file->pos);
   file->pos += bytes_written;
   return bytes_written;
 }
@@ -102,17 +255,93 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
-   The file's current position is unaffected. */
+   which may be less than SIZE if the file cannot grow that far.
+   The file's current position is unaffected.
+   Returns -1 for a pipe end. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
                off_t file_ofs) 
 {
+  if (file->pipe != NULL)
+    return -1;
+  return write_at (file, buffer, size, file_ofs);
+}
+
+/* Reads SIZE bytes from FILE into BUFFER at FILE_OFS, directly if
+   the read is large. */
+static off_t
+read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
+{
+  if (size >= DIRECT_IO_BYTES)
+    return inode_read_direct (file->inode, buffer, size, file_ofs);
+  return inode_read_at (file->inode, buffer, size, file_ofs);
+}
+
+/* Writes SIZE bytes from BUFFER into FILE at FILE_OFS, directly if
+   the write is large. */
+static off_t
+write_at (struct file *file, const void *buffer, off_t size, off_t file_ofs)
+{
+  if (size >= DIRECT_IO_BYTES)
+    return inode_write_direct (file->inode, buffer, size, file_ofs);
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Copies up to SIZE bytes from SRC, starting at its current
+   position, into DST, starting at its current position, a page
+   at a time through kernel memory.
+   Returns the number of bytes actually copied, which may be less
+   than SIZE if SRC ends or DST cannot grow that far, or if no
+   page is available.  Advances both positions by that amount. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size)
+{
+  void *buffer = palloc_get_page (0);
+  off_t bytes_copied = 0;
+
+  if (buffer == NULL)
+    return 0;
+
+  while (size > 0)
+    {
+      off_t chunk = size < PGSIZE ? size : PGSIZE;
+      off_t bytes_read = file_read (src, buffer, chunk);
+      off_t bytes_written = file_write (dst, buffer, bytes_read);
+
+      bytes_copied += bytes_written;
+      size -= bytes_written;
+      if (bytes_written < bytes_read)
+        {
+          /* Give back what DST did not take. */
+          file_seek (src, file_tell (src) - (bytes_read - bytes_written));
+          break;
+        }
+      if (bytes_read < chunk)
+        break;
+    }
+
+  palloc_free_page (buffer);
+  return bytes_copied;
+}
+
+/* Allocates the disk space for FILE to grow to SIZE bytes,
+   without changing its length.  Returns false if the disk is full
+   or writes to FILE are denied. */
+bool
+file_reserve (struct file *file, off_t size)
+{
+  ASSERT (file != NULL);
+  return file->pipe == NULL && inode_reserve (file->inode, size);
+}
+
+/* Writes the dirty cached data of FILE back to disk. */
+void
+file_sync (struct file *file)
+{
+  if (file->pipe == NULL)
+    inode_sync (file->inode);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -140,12 +369,12 @@ file_allow_write (struct file *file)
     }
 }
 
-/* Returns the size of FILE in bytes. */
+/* Returns the size of FILE in bytes, 0 for a pipe end. */
 off_t
 file_length (struct file *file) 
 {
   ASSERT (file != NULL);
-  return inode_length (file->inode);
+  return file->pipe == NULL ? inode_length (file->inode) : 0;
 }
 
 /* Sets the current position in FILE to NEW_POS bytes from the
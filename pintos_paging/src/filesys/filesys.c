@@ -2,18 +2,29 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/packfs.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* File system counters. */
+struct fs_stats fs_stats;
+
+/* Skip writing the file system back at shutdown?  (-crash) */
+bool filesys_crash;
+
 static void do_format (void);
 
 /* Initializes the file system module.
-   If FORMAT is true, reformats the file system. */
+   If FORMAT is true, reformats the file system.  Otherwise, if
+   the device holds a packed image, mounts it read-only, without
+   a free map or a journal. */
 void
 filesys_init (bool format) 
 {
@@ -21,12 +32,19 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
+  journal_init ();
 
   if (format) 
     do_format ();
+  else if (packfs_mount ())
+    return;
 
+  journal_open ();
   free_map_open ();
 }
 
@@ -35,9 +53,26 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  if (filesys_crash)
+    {
+      printf ("Crashing without writing back the file system.\n");
+      return;
+    }
+  journal_close ();
   free_map_close ();
+  cache_done ();
+  block_flush (fs_device);
 }
 
+/* Commits the metadata changed so far, the free map with it, to
+   the journal, and writes all the cached sectors back to disk. */
+void
+filesys_sync (void)
+{
+  journal_commit ();
+  cache_flush ();
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
@@ -46,14 +81,19 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && dir_alloc_inode (dir, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   if (!success)
   {
@@ -90,9 +130,14 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -105,6 +150,7 @@ do_format (void)
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
+  journal_create ();
   free_map_close ();
   printf ("done.\n");
 }
@@ -2,17 +2,29 @@
 #define FILESYS_FILESYS_H
 
 #include <stdbool.h>
+#include <syscall-nr.h>
 #include "filesys/off_t.h"
 
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define LOG_SECTOR 2            /* Journal log file inode sector. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
 
+/* File system counters.  Each is updated under the lock of the
+   module that counts it, if any, so a copy may be slightly
+   inconsistent. */
+extern struct fs_stats fs_stats;
+
+/* If true, filesys_done() writes nothing back, as if the power
+   failed, so that the next boot has to redo the journal. */
+extern bool filesys_crash;
+
 void filesys_init (bool format);
 void filesys_done (void);
+void filesys_sync (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
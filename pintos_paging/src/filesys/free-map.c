@@ -1,52 +1,410 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/tunable.h"
+
+/* The free map is changed in memory only.  Each sector of the
+   free map file whose bits have changed is marked in dirty_map,
+   and free_map_flush() writes just those sectors, when the file
+   system is synced and when the free map is closed. */
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* One bit per free map file sector. */
+static size_t dirty_cnt;             /* Bits set in dirty_map. */
+
+/* Number of free map bits in a sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+/* Protects free_map, dirty_map and the writes to free_map_file.
+   It may be taken with a file's inode locked for writing, and
+   takes the free map file's own inode lock, so nothing that holds
+   the latter may allocate. */
+static struct lock free_map_lock;
+
+/* Where free_map_allocate() looks first: the end of the sectors
+   it allocated last.  Protected by free_map_lock. */
+static block_sector_t next_sector;
+
+/* Sectors freed and not allocated since, that the device has not
+   been told of, one bit each, or a null pointer if it cannot
+   discard.  free_map_discard() discards them once the commit that
+   freed them is durable: until then, a crash would bring back the
+   files that own them.  Protected by free_map_lock. */
+static struct bitmap *discard_map;
+
+/* Fewest freed sectors in a row worth a discard, which is about as
+   much as a host file system can give back; shorter runs wait for
+   their neighbours to be freed too.  0 turns discard off. */
+static size_t free_map_discard_min = 8;
+
+static struct tunable free_map_tunables[] =
+  {
+    TUNABLE ("fs.discard_min", free_map_discard_min, 0, 65536, NULL),
+  };
+
+/* Returns the number of the free map file sectors that hold the
+   bits of the CNT sectors starting at SECTOR that are not dirty
+   yet.  free_map_lock must be held. */
+static size_t
+count_clean (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  return bitmap_count (dirty_map, first, last - first + 1, false);
+}
+
+/* Marks the free map file sectors that hold the bits of the CNT
+   sectors starting at SECTOR as dirty.  free_map_lock must be
+   held. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  dirty_cnt += count_clean (sector, cnt);
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Returns true if the CNT sectors starting at SECTOR may be taken
+   within the running journal transaction, which has to log the
+   free map sectors that their bits dirty when it commits.
+   free_map_lock must be held. */
+static bool
+journal_allows (block_sector_t sector, size_t cnt)
+{
+  return journal_room (dirty_cnt + count_clean (sector, cnt));
+}
+
+/* The disk is divided into groups of sectors, as ext2 divides it
+   into block groups, each with the bits of one free map file
+   sector.  cursors[G] is the first sector of group G that may be
+   free: all of the group before it is in use, so searches in the
+   group start there.  Protected by free_map_lock. */
+#define GROUP_SECTORS BITS_PER_SECTOR
+static block_sector_t *cursors;
+static size_t group_cnt;
+
+/* Returns the group that holds SECTOR. */
+static inline size_t
+group_of (block_sector_t sector)
+{
+  return sector / GROUP_SECTORS;
+}
+
+/* Returns the sector after the last one of group G. */
+static inline block_sector_t
+group_end (size_t g)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Points the cursor of every group at its first sector. */
+static void
+reset_cursors (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    cursors[g] = g * GROUP_SECTORS;
+}
+
+/* Moves the cursors of the groups that the CNT sectors starting
+   at SECTOR fall in past them, if they pointed into them, now
+   that they are in use.  free_map_lock must be held. */
+static void
+cursors_allocated (block_sector_t sector, size_t cnt)
+{
+  size_t g;
+
+  for (g = group_of (sector); g <= group_of (sector + cnt - 1); g++)
+    if (cursors[g] >= sector && cursors[g] < sector + cnt)
+      cursors[g] = (sector + cnt < group_end (g)
+                    ? sector + cnt : group_end (g));
+}
+
+/* Moves the cursors of the groups that the CNT sectors starting
+   at SECTOR fall in back to them, now that they are free.
+   free_map_lock must be held. */
+static void
+cursors_released (block_sector_t sector, size_t cnt)
+{
+  size_t g;
+
+  for (g = group_of (sector); g <= group_of (sector + cnt - 1); g++)
+    {
+      block_sector_t first = sector > g * GROUP_SECTORS
+                             ? sector : g * GROUP_SECTORS;
+      if (first < cursors[g])
+        cursors[g] = first;
+    }
+}
+
+/* Marks the CNT sectors starting at SECTOR as in use.
+   free_map_lock must be held. */
+static void
+take (block_sector_t sector, size_t cnt)
+{
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  cursors_allocated (sector, cnt);
+  if (discard_map != NULL)
+    bitmap_set_multiple (discard_map, sector, cnt, false);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init_named (&free_map_lock, "free_map");
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  cursors = malloc (group_cnt * sizeof *cursors);
+  if (cursors == NULL)
+    PANIC ("free map group cursor allocation failed");
+  reset_cursors ();
+  if (block_can_discard (fs_device))
+    {
+      discard_map = bitmap_create (bitmap_size (free_map));
+      if (discard_map == NULL)
+        PANIC ("bitmap creation failed--file system device is too large");
+    }
+  tunable_register (free_map_tunables,
+                    sizeof free_map_tunables / sizeof *free_map_tunables);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, LOG_SECTOR);
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   that starts at or after START, or BITMAP_ERROR if there is
+   none. */
+static block_sector_t
+scan (block_sector_t start, size_t cnt)
+{
+  return start < bitmap_size (free_map)
+         ? bitmap_scan (free_map, start, cnt, false) : BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors near HINT and stores the
+   first into *SECTORP.  Takes the first free run after HINT in
+   HINT's group, else the first one before HINT in the group, else
+   the first one in the groups that follow, else the first one on
+   the disk.  Returns false if there is none, or if the running
+   journal transaction has no room for the free map sectors that
+   it dirties.  free_map_lock must be held. */
+static bool
+allocate_near (block_sector_t hint, size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  size_t g;
+
+  ASSERT (cnt > 0);
+
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  g = group_of (hint);
+
+  sector = scan (hint > cursors[g] ? hint : cursors[g], cnt);
+  if ((sector == BITMAP_ERROR || sector >= group_end (g))
+      && cursors[g] < hint)
+    {
+      block_sector_t before = scan (cursors[g], cnt);
+      if (before < hint)
+        sector = before;
+    }
+  if (sector == BITMAP_ERROR)
+    sector = scan (cursors[0], cnt);
+  if (sector == BITMAP_ERROR || !journal_allows (sector, cnt))
+    return false;
+
+  take (sector, cnt);
+  next_sector = sector + cnt;
+  fs_stats.free_map_allocs++;
+  if (group_of (sector) != g)
+    fs_stats.free_map_far++;
+  *sectorp = sector;
+  return true;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate_near (next_sector, cnt, sectorp);
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates CNT consecutive sectors from the free map, as close
+   after HINT as they can be found, and stores the first into
+   *SECTORP.  An inode allocated with its directory's sector as
+   hint, or data with its inode's, so lands next to it.
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate_near (hint, cnt, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates as many of the CNT sectors starting at SECTOR as are
+   free in a row, and returns their number, which is 0 if SECTOR
+   is in use or the running journal transaction has no room for
+   them. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t size = bitmap_size (free_map);
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  while (n < cnt && sector + n < size && !bitmap_test (free_map, sector + n))
+    n++;
+  if (n > 0 && !journal_allows (sector, n))
+    n = 0;
+  if (n > 0)
+    take (sector, n);
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.  Must
+   be called within a journal handle, which revokes the copies of
+   them that the log holds. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  cursors_released (sector, cnt);
+  if (discard_map != NULL)
+    bitmap_set_multiple (discard_map, sector, cnt, true);
+  journal_revoke (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Tells the file system device of the runs of at least
+   free_map_discard_min sectors freed since it was last told, which
+   must all have been freed by commits that are durable now.  Runs
+   that are shorter are left for later.  Sectors cannot be
+   allocated meanwhile, so that none is discarded after it has been
+   written again. */
+void
+free_map_discard (void)
+{
+  size_t start = 0;
+
+  if (discard_map == NULL || free_map_discard_min == 0)
+    return;
+
+  lock_acquire (&free_map_lock);
+  for (;;)
+    {
+      size_t end, cnt;
+
+      start = bitmap_scan (discard_map, start, 1, true);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (discard_map, start, 1, false);
+      cnt = (end != BITMAP_ERROR ? end : bitmap_size (discard_map)) - start;
+      if (cnt >= free_map_discard_min)
+        {
+          block_discard (fs_device, start, cnt);
+          bitmap_set_multiple (discard_map, start, cnt, false);
+          fs_stats.discard_sectors += cnt;
+        }
+      start += cnt;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the dirty sectors of the free map to the free map file,
+   in runs.  Does nothing while the file is not open.  Sectors
+   that could not be written stay dirty.  While the journal is
+   open, only its commits call it, so that the free map is logged
+   together with the operations that changed it. */
+void
+free_map_flush (void)
+{
+  size_t start = 0;
+  bool wrote = false;
+
+  lock_acquire (&free_map_lock);
+  while (free_map_file != NULL)
+    {
+      size_t cnt;
+
+      start = bitmap_scan (dirty_map, start, 1, true);
+      if (start == BITMAP_ERROR)
+        break;
+      for (cnt = 1; start + cnt < bitmap_size (dirty_map)
+                    && bitmap_test (dirty_map, start + cnt); cnt++)
+        continue;
+
+      if (bitmap_write_at (free_map, free_map_file,
+                           start * BLOCK_SECTOR_SIZE,
+                           cnt * BLOCK_SECTOR_SIZE))
+        {
+          bitmap_set_multiple (dirty_map, start, cnt, false);
+          dirty_cnt -= cnt;
+          fs_stats.free_map_sectors += cnt;
+          wrote = true;
+        }
+      start += cnt;
+    }
+  if (wrote)
+    fs_stats.free_map_flushes++;
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of dirty free map sectors, which the next
+   journal commit logs.  It may be stale by the time the caller
+   looks at it, unless free_map_lock is held. */
+size_t
+free_map_dirty_cnt (void)
+{
+  return dirty_cnt;
+}
+
+/* Makes the free map durable, along with every other metadata
+   change made so far, by committing the journal. */
+void
+free_map_sync (void)
+{
+  journal_commit ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,15 +414,25 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  reset_cursors ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -80,6 +448,10 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  inode_set_metadata (file_get_inode (free_map_file));
+  lock_acquire (&free_map_lock);
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+  lock_release (&free_map_lock);
 }
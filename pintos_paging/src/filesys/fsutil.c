@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <round.h>
 #include <string.h>
 #include <ustar.h>
 #include "filesys/directory.h"
@@ -67,8 +68,16 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Number of pages of file data that fsutil_extract() reads from
+   the scratch device at a time. */
+#define EXTRACT_PAGE_CNT 8
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+   Each file is created at its full size, so that its sectors are
+   allocated together up front, then filled in batches of up to
+   EXTRACT_PAGE_CNT pages: one multi-sector read of the scratch
+   device and one write of the file each. */
 void
 fsutil_extract (char **argv UNUSED) 
 {
@@ -76,10 +85,13 @@ fsutil_extract (char **argv UNUSED)
 
   struct block *src;
   void *header, *data;
+  size_t data_pages = EXTRACT_PAGE_CNT;
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = palloc_get_multiple (0, data_pages);
+  if (data == NULL)
+    data = palloc_get_multiple (0, data_pages = 1);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -127,10 +139,13 @@ fsutil_extract (char **argv UNUSED)
           /* Do copy. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              int chunk_size = (size > (int) (data_pages * PGSIZE)
+                                ? (int) (data_pages * PGSIZE)
                                 : size);
-              block_read (src, sector++, data);
+              block_sector_t chunk_sectors = DIV_ROUND_UP (chunk_size,
+                                                           BLOCK_SECTOR_SIZE);
+              block_read_multiple (src, sector, chunk_sectors, data);
+              sector += chunk_sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
@@ -151,7 +166,7 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
+  palloc_free_multiple (data, data_pages);
   free (header);
 }
 
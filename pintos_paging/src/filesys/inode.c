@@ -1,23 +1,70 @@
 #include "filesys/inode.h"
+#include <ihash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/packfs.h"
 #include "threads/malloc.h"
+#include "threads/shrink.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tunable.h"
+#ifdef VM
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of closed inodes kept in memory for reopening. */
+#define CLOSED_INODE_CNT 16
+
+/* Number of extents in an inode. */
+#define INODE_EXTENT_CNT 61
+
+/* Largest file whose data is kept in its inode, in place of the
+   extents. */
+#define INODE_INLINE_SIZE (INODE_EXTENT_CNT * sizeof (struct inode_extent))
+
+/* A run of consecutive data sectors. */
+struct inode_extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   The data sectors are the concatenation of the extents, in
+   order; they are allocated as the file grows.  Only the first
+   INIT_CNT of them have ever been written: the others are not
+   zeroed when they are allocated, but read as zeros, and zeroed
+   when a write reaches past them.
+   Sectors may also be reserved past the end of the file, by
+   inode_reserve(), or allocated ahead of need by a write that
+   extends it (see inode_grow()), for its later growth to use.
+   The data of a file no longer than INODE_INLINE_SIZE bytes that
+   has no data sectors is stored in the inode itself; files never
+   shrink, so one that grows past that size keeps its extents. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents in use. */
+    union
+      {
+        struct inode_extent extents[INODE_EXTENT_CNT]; /* Data sectors. */
+        uint8_t inline_data[INODE_INLINE_SIZE];  /* Data of small file. */
+      };
+    uint32_t init_cnt;                  /* Data sectors written so far. */
+    uint32_t unused[2];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -25,17 +72,54 @@ struct inode_disk
 static inline size_t
 bytes_to_sectors (off_t size)
 {
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+  return size > (off_t) INODE_INLINE_SIZE
+         ? DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE) : 0;
+}
+
+/* Returns true if the data of DISK_INODE is stored inline. */
+static inline bool
+is_inline (const struct inode_disk *disk_inode)
+{
+  return disk_inode->extent_cnt == 0;
 }
 
-/* In-memory inode. */
+/* Returns the number of data sectors allocated to DISK_INODE,
+   which may exceed what its length needs. */
+static size_t
+allocated_sectors (const struct inode_disk *disk_inode)
+{
+  size_t cnt = 0;
+  uint32_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    cnt += disk_inode->extents[i].cnt;
+  return cnt;
+}
+
+/* In-memory inode.
+   HASH_ELEM, LRU_ELEM, OPEN_CNT and REMOVED are protected by
+   inode_table_lock; DENY_WRITE_CNT, PREALLOC_CNT, DATA and AUX by
+   RW, which readers of the file hold shared and writers (which may
+   extend DATA) exclusively.  METADATA is only ever set.
+   The inode itself is metadata, written through the journal;
+   so is the data of a directory or of the free map, whose inode
+   has METADATA set.
+   The small members come first and the 512-byte DATA last, so
+   that inode_table lookups and closed_inodes walks touch a single
+   cache line of each inode, rather than also the lines past DATA
+   that AUX and METADATA used to sit in. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct ihash_elem hash_elem;        /* Element in inode_table. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool metadata;                      /* Data journaled too? */
+    struct list_elem lru_elem;          /* Element in closed_inodes. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    size_t prealloc_cnt;                /* Last sectors allocated ahead. */
+    void *aux;                          /* See inode_set_aux(). */
+    struct rwlock rw;                   /* Guards the data and its length. */
     struct inode_disk data;             /* Inode content. */
   };
 
@@ -48,20 +132,483 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    {
+      size_t idx = pos / BLOCK_SECTOR_SIZE;
+      const struct inode_extent *e;
+
+      for (e = inode->data.extents; idx >= e->cnt; e++)
+        idx -= e->cnt;
+      return e->start + idx;
+    }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the number of data sectors of INODE, at most MAX, that
+   start with the one holding byte POS, which must be within
+   INODE, and follow it on disk without a gap. */
+static size_t
+sector_run (const struct inode *inode, off_t pos, size_t max)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  const struct inode_extent *e;
+
+  ASSERT (pos < inode->data.length);
+  for (e = inode->data.extents; idx >= e->cnt; e++)
+    idx -= e->cnt;
+  return e->cnt - idx < max ? e->cnt - idx : max;
+}
+
+/* A sector of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Fewest and most data sectors that a write extending a file
+   allocates ahead of need (see inode_allocate()).  The most is
+   also the tunable "fs.prealloc_max", which 0 turns it off. */
+#define PREALLOC_MIN 8
+static size_t inode_prealloc_max = 256;
+
+/* Most data sectors that one journal handle allocates or frees
+   for a file: the bits of one free map sector, so that it dirties
+   at most two of those, which its transaction has to log.  Larger
+   reservations and removals go a piece per handle. */
+#define HANDLE_SECTORS (BLOCK_SECTOR_SIZE * 8)
+
+/* Adds CNT data sectors at the end of DISK_INODE, the inode in
+   sector SECTOR, which is not written back.  The sectors after
+   the last extent are taken if they are free, else runs that are
+   as long as possible, as close after the last extent, or the
+   first one after the inode itself, as they can be found.
+   Returns false, allocating nothing, if the disk (or the extents)
+   are full. */
+static bool
+extend_sectors (struct inode_disk *disk_inode, block_sector_t sector,
+                size_t cnt)
+{
+  uint32_t extent_cnt = disk_inode->extent_cnt;
+  uint32_t last_cnt = extent_cnt > 0
+                      ? disk_inode->extents[extent_cnt - 1].cnt : 0;
+
+  while (cnt > 0)
+    {
+      struct inode_extent *last = disk_inode->extent_cnt > 0
+        ? &disk_inode->extents[disk_inode->extent_cnt - 1] : NULL;
+      block_sector_t start;
+      size_t n = 0;
+
+      /* Grow the last extent in place, if possible. */
+      if (last != NULL)
+        {
+          start = last->start + last->cnt;
+          n = free_map_allocate_at (start, cnt);
+          last->cnt += n;
+        }
+
+      /* Otherwise, a new extent: the largest run that fits. */
+      if (n == 0)
+        {
+          block_sector_t hint = last != NULL ? last->start + last->cnt
+                                             : sector + 1;
+
+          if (disk_inode->extent_cnt >= INODE_EXTENT_CNT)
+            goto fail;
+          for (n = cnt; n > 0; n /= 2)
+            if (free_map_allocate_near (hint, n, &start))
+              break;
+          if (n == 0)
+            goto fail;
+          last = &disk_inode->extents[disk_inode->extent_cnt++];
+          last->start = start;
+          last->cnt = n;
+        }
+
+      cnt -= n;
+    }
+  return true;
+
+ fail:
+  /* Give back what was allocated by this call. */
+  while (disk_inode->extent_cnt > extent_cnt)
+    {
+      struct inode_extent *e = &disk_inode->extents[--disk_inode->extent_cnt];
+      free_map_release (e->start, e->cnt);
+    }
+  if (extent_cnt > 0)
+    {
+      struct inode_extent *e = &disk_inode->extents[extent_cnt - 1];
+      if (e->cnt > last_cnt)
+        free_map_release (e->start + last_cnt, e->cnt - last_cnt);
+      e->cnt = last_cnt;
+    }
+  return false;
+}
+
+/* Gives back the last CNT data sectors of DISK_INODE, which has
+   more than that, but does not write it back. */
+static void
+release_sectors (struct inode_disk *disk_inode, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      struct inode_extent *e = &disk_inode->extents[disk_inode->extent_cnt - 1];
+      size_t n = cnt < e->cnt ? cnt : e->cnt;
+
+      free_map_release (e->start + e->cnt - n, n);
+      e->cnt -= n;
+      if (e->cnt == 0)
+        disk_inode->extent_cnt--;
+      cnt -= n;
+    }
+  ASSERT (disk_inode->extent_cnt > 0);
+}
+
+/* Moves the inline data of INODE, which is LENGTH bytes long, to
+   the first of CNT newly allocated data sectors.  Returns false,
+   leaving INODE as it was, if the sectors could not be allocated
+   or memory runs out. */
+static bool
+inline_to_extents (struct inode *inode, size_t cnt)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  uint8_t *first = calloc (1, BLOCK_SECTOR_SIZE);
+
+  if (first == NULL)
+    return false;
+  memcpy (first, disk_inode->inline_data, disk_inode->length);
+
+  memset (disk_inode->extents, 0, sizeof disk_inode->extents);
+  disk_inode->extent_cnt = 0;
+  if (!extend_sectors (disk_inode, inode->sector, cnt))
+    {
+      memcpy (disk_inode->inline_data, first, INODE_INLINE_SIZE);
+      free (first);
+      return false;
+    }
+
+  if (disk_inode->length > 0)
+    {
+      cache_log_write (disk_inode->extents[0].start, first);
+      disk_inode->init_cnt = 1;
+    }
+  free (first);
+  return true;
+}
+
+/* Adds CNT data sectors at the end of INODE, moving its inline
+   data to the first of them if it has none yet, but does not
+   write it back.  Returns false, adding none, if they could not
+   be allocated. */
+static bool
+add_sectors (struct inode *inode, size_t cnt)
+{
+  return (is_inline (&inode->data)
+          ? inline_to_extents (inode, cnt)
+          : extend_sectors (&inode->data, inode->sector, cnt));
+}
+
+/* Returns the number of sectors to allocate ahead of need for a
+   file that grows to NEED sectors: as many again, so that a file
+   that keeps growing takes runs twice as long each time, within
+   PREALLOC_MIN and inode_prealloc_max. */
+static size_t
+prealloc_sectors (size_t need)
+{
+  size_t cnt = need > PREALLOC_MIN ? need : PREALLOC_MIN;
+  return cnt < inode_prealloc_max ? cnt : inode_prealloc_max;
+}
+
+/* Makes sure INODE has the data sectors for LENGTH bytes, taking
+   the ones it is missing in as few runs as possible, but does not
+   write it back.  If it is missing any and AHEAD is true, also
+   takes more after them for its later growth, as long as there
+   are enough free.  Returns false if the sectors could not be
+   allocated. */
+static bool
+inode_allocate (struct inode *inode, off_t length, bool ahead)
+{
+  size_t old_sectors, new_sectors, extra;
+
+  if (is_inline (&inode->data))
+    {
+      old_sectors = 0;
+      new_sectors = bytes_to_sectors (length);
+    }
+  else
+    {
+      old_sectors = allocated_sectors (&inode->data);
+      new_sectors = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+    }
+  if (new_sectors <= old_sectors)
+    return true;
+
+  /* All the sectors it had are in use now, including any taken
+     ahead before. */
+  inode->prealloc_cnt = 0;
+  extra = ahead && !inode->metadata ? prealloc_sectors (new_sectors) : 0;
+  if (extra > 0 && add_sectors (inode, new_sectors - old_sectors + extra))
+    {
+      inode->prealloc_cnt = extra;
+      fs_stats.prealloc_sectors += extra;
+      return true;
+    }
+  return add_sectors (inode, new_sectors - old_sectors);
+}
+
+/* Returns the number of the sectors that INODE took ahead of need
+   that neither its data nor its first LENGTH bytes use. */
+static size_t
+prealloc_unused (const struct inode *inode, off_t length)
+{
+  size_t have, need;
+
+  if (is_inline (&inode->data))
+    return 0;
+  if (length < inode->data.length)
+    length = inode->data.length;
+  have = allocated_sectors (&inode->data);
+  need = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+  if (have <= need)
+    return 0;
+  return have - need < inode->prealloc_cnt ? have - need : inode->prealloc_cnt;
+}
+
+/* Gives back the sectors that INODE took ahead of need and has
+   not grown into, and writes it back if there were any. */
+static void
+inode_trim (struct inode *inode)
+{
+  journal_begin ();
+  rwlock_acquire_write (&inode->rw);
+  if (inode->prealloc_cnt > 0)
+    {
+      size_t cnt = prealloc_unused (inode, 0);
+      if (cnt > 0)
+        {
+          release_sectors (&inode->data, cnt);
+          cache_log_write (inode->sector, &inode->data);
+          fs_stats.prealloc_trimmed += cnt;
+        }
+      inode->prealloc_cnt = 0;
+    }
+  rwlock_release_write (&inode->rw);
+  journal_end ();
+}
+
+/* Extends INODE to LENGTH bytes, which are zero beyond its current
+   length, and writes it back.  Returns false if the sectors could
+   not be allocated.
+   Writes that extend a file, such as the appends of a log, each
+   take the sectors they are missing and some more, which the
+   next ones then grow into without allocating: the file is laid
+   out in long runs even if other files grow at the same time,
+   and the free map changes once per run rather than per write.
+   What is left over is given back when the file is last closed
+   (see inode_close()). */
+static bool
+inode_grow (struct inode *inode, off_t length)
+{
+  ASSERT (length >= inode->data.length);
+
+  if (!inode_allocate (inode, length, true))
+    return false;
+  inode->data.length = length;
+  cache_log_write (inode->sector, &inode->data);
+  return true;
+}
+
+/* Returns the length, up to LENGTH, that one journal handle can
+   reserve sectors for in INODE: HANDLE_SECTORS more than it has.
+   INODE's lock must be held. */
+static off_t
+reserve_step (const struct inode *inode, off_t length)
+{
+  size_t have = (is_inline (&inode->data)
+                 ? 0 : allocated_sectors (&inode->data));
+  off_t max = (off_t) (have + HANDLE_SECTORS) * BLOCK_SECTOR_SIZE;
+
+  return length < max ? length : max;
+}
+
+/* Allocates the data sectors INODE needs to grow to LENGTH bytes,
+   without changing its length or writing any data: the sectors
+   read as zeros once the file grows over them, and writes that
+   extend the file then go to sectors that were allocated
+   together.  They are taken HANDLE_SECTORS at a time, each piece
+   in a journal handle of its own, and those taken stay if a later
+   piece fails.  Returns false if the disk is full or writes to
+   INODE are denied. */
+bool
+inode_reserve (struct inode *inode, off_t length)
+{
+  bool success;
+  off_t step;
+
+  if (packfs_mounted ())
+    return false;
+
+  do
+    {
+      journal_begin ();
+      rwlock_acquire_write (&inode->rw);
+      step = reserve_step (inode, length);
+      success = (inode->deny_write_cnt == 0
+                 && inode_allocate (inode, step, false));
+      if (success)
+        {
+          /* The sectors for STEP bytes stay when the file is
+             closed. */
+          inode->prealloc_cnt = prealloc_unused (inode, step);
+          cache_log_write (inode->sector, &inode->data);
+        }
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+    }
+  while (success && step < length);
+  return success;
+}
+
+/* Returns true if the data sector of INODE that holds byte OFFSET
+   has ever been written, false if it reads as zeros. */
+static inline bool
+sector_initialized (const struct inode *inode, off_t offset)
+{
+  return (uint32_t) (offset / BLOCK_SECTOR_SIZE) < inode->data.init_cnt;
+}
+
+/* Writes data sector SECTOR of INODE from BUFFER, through the
+   journal if INODE's data is metadata. */
+static void
+write_sector (const struct inode *inode, block_sector_t sector,
+              const void *buffer)
+{
+  if (inode->metadata)
+    cache_log_write (sector, buffer);
+  else
+    cache_write (sector, buffer);
+}
+
+/* Returns true if writing SIZE bytes at OFFSET to INODE changes
+   metadata, so that it must be done within a journal handle.
+   INODE's lock must be held. */
+static bool
+write_changes_metadata (const struct inode *inode, off_t size,
+                        off_t offset)
+{
+  return (size > 0
+          && (inode->metadata || is_inline (&inode->data)
+              || offset + size > inode->data.length
+              || !sector_initialized (inode, offset + size - 1)));
+}
+
+/* Prepares the data sector of INODE that holds byte OFFSET for a
+   write, by zeroing it and the sectors before it that have never
+   been written.  OFFSET's own sector is left alone if WHOLE, as
+   the caller overwrites all of it.  Returns true if INODE's
+   INIT_CNT changed, so that INODE must be written back. */
+static bool
+init_sectors (struct inode *inode, off_t offset, bool whole)
+{
+  uint32_t idx = offset / BLOCK_SECTOR_SIZE;
+
+  if (sector_initialized (inode, offset))
+    return false;
+
+  for (; inode->data.init_cnt < idx; inode->data.init_cnt++)
+    {
+      write_sector (inode, byte_to_sector (inode, inode->data.init_cnt
+                                                  * BLOCK_SECTOR_SIZE),
+                    zeros);
+      thread_preempt_point ();
+    }
+  if (!whole)
+    write_sector (inode, byte_to_sector (inode, offset), zeros);
+  inode->data.init_cnt = idx + 1;
+  return true;
+}
+
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Besides
+   the open inodes, it holds the last CLOSED_INODE_CNT closed ones
+   that were not removed, which are also on closed_inodes, most
+   recently closed first: reopening one of those does not read
+   the inode from disk again. */
+static struct ihash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;
+static struct lock inode_table_lock;
+
+/* In-memory inodes. */
+static struct kmem_cache inode_cache;
+
+/* Shrinker for the closed inodes. */
+static size_t inode_shrink_count (void);
+static size_t inode_shrink_scan (size_t nr);
+static struct shrinker inode_shrinker =
+  {
+    .name = "inode",
+    .count = inode_shrink_count,
+    .scan = inode_shrink_scan,
+  };
+
+static struct tunable inode_tunables[] =
+  {
+    TUNABLE ("fs.prealloc_max", inode_prealloc_max, 0, 2048, NULL),
+  };
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  ihash_init (&inode_table);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init_named (&inode_table_lock, "inode_table");
+  kmem_cache_init (&inode_cache, "inode", sizeof (struct inode), 0, NULL);
+  shrinker_register (&inode_shrinker);
+  tunable_register (inode_tunables,
+                    sizeof inode_tunables / sizeof *inode_tunables);
+}
+
+/* Returns the number of closed inodes kept in memory. */
+static size_t
+inode_shrink_count (void)
+{
+  return closed_cnt;
+}
+
+/* Frees up to NR of the least recently closed inodes, unless the
+   inode table is locked, and returns the number freed. */
+static size_t
+inode_shrink_scan (size_t nr)
+{
+  struct list victims;
+  size_t cnt = 0;
+
+  if (lock_held_by_current_thread (&inode_table_lock)
+      || !lock_try_acquire (&inode_table_lock))
+    return 0;
+  list_init (&victims);
+  while (cnt < nr && !list_empty (&closed_inodes))
+    {
+      struct inode *inode = list_entry (list_pop_back (&closed_inodes),
+                                        struct inode, lru_elem);
+      ihash_delete (&inode_table, inode->sector);
+      list_push_back (&victims, &inode->lru_elem);
+      closed_cnt--;
+      cnt++;
+    }
+  lock_release (&inode_table_lock);
+
+  /* Closed inodes were not removed, and nobody can reach them
+     any more. */
+  while (!list_empty (&victims))
+    {
+      struct inode *inode = list_entry (list_pop_front (&victims),
+                                        struct inode, lru_elem);
+      free (inode->aux);
+      kmem_cache_free (&inode_cache, inode);
+    }
+  return cnt;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -87,17 +634,11 @@ inode_create (block_sector_t sector, off_t length)
       size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->extent_cnt = 0;
+      disk_inode->init_cnt = 0;
+      if (extend_sectors (disk_inode, sector, sectors)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_log_write (sector, disk_inode);
           success = true; 
         } 
       free (disk_inode);
@@ -107,37 +648,86 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.  In a packed
+   image, SECTOR is an inode number, and the inode is made up from
+   the image's inode table, without a read. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct ihash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory, open or
+     recently closed.  The lock is held until a new inode is in
+     the table, so that two openers of the same sector cannot both
+     create one. */
+  lock_acquire (&inode_table_lock);
+  fs_stats.inode_opens++;
+  e = ihash_find (&inode_table, sector);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      fs_stats.inode_open_hits++;
+      inode = ihash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          closed_cnt--;
         }
+      lock_release (&inode_table_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (&inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  inode->prealloc_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->aux = NULL;
+  inode->metadata = false;
+  rwlock_init (&inode->rw);
+  inode->hash_elem.key = sector;
+  if (!ihash_insert (&inode_table, &inode->hash_elem))
+    {
+      lock_release (&inode_table_lock);
+      kmem_cache_free (&inode_cache, inode);
+      return NULL;
+    }
+  if (packfs_mounted ())
+    {
+      block_sector_t start;
+      off_t length;
+      size_t sectors;
+
+      if (!packfs_inode (sector, &start, &length))
+        {
+          ihash_delete (&inode_table, sector);
+          lock_release (&inode_table_lock);
+          kmem_cache_free (&inode_cache, inode);
+          return NULL;
+        }
+
+      /* The file's data is one extent, all of it written. */
+      sectors = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+      memset (&inode->data, 0, sizeof inode->data);
+      inode->data.magic = INODE_MAGIC;
+      inode->data.length = length;
+      inode->data.extent_cnt = sectors > 0;
+      inode->data.extents[0].start = start;
+      inode->data.extents[0].cnt = sectors;
+      inode->data.init_cnt = sectors;
+    }
+  else
+    cache_read (inode->sector, &inode->data);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -146,7 +736,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -158,30 +753,89 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, it is kept in memory
+   among the recently closed inodes, unless it was removed, in
+   which case its memory and its blocks are freed.  The least
+   recently closed inode beyond CLOSED_INODE_CNT is freed. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
+  /* The closer that would drop the last reference first gives
+     back the sectors allocated ahead of need, while that reference
+     keeps INODE off closed_inodes.  The trim starts a journal
+     handle, which cannot be done under inode_table_lock, since
+     threads inside a handle open inodes, so the lock is dropped
+     for it and OPEN_CNT checked again: an opener that came in
+     meanwhile trims on its own last close instead. */
+  lock_acquire (&inode_table_lock);
+  ASSERT (inode->open_cnt > 0);
+  while (inode->open_cnt == 1 && inode->prealloc_cnt > 0
+         && !inode->removed)
+    {
+      lock_release (&inode_table_lock);
+      inode_trim (inode);
+      lock_acquire (&inode_table_lock);
+    }
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      if (inode->removed)
+        victim = inode;
+      else
+        {
+          list_push_front (&closed_inodes, &inode->lru_elem);
+          if (++closed_cnt > CLOSED_INODE_CNT)
+            {
+              victim = list_entry (list_pop_back (&closed_inodes),
+                                   struct inode, lru_elem);
+              closed_cnt--;
+            }
+        }
+      if (victim != NULL)
+        ihash_delete (&inode_table, victim->sector);
+    }
+  lock_release (&inode_table_lock);
+
+  /* Nobody else can reach VICTIM any more, so no lock is
+     needed. */
+  if (victim != NULL)
+    {
+      inode = victim;
+
+      /* Deallocate blocks if removed, HANDLE_SECTORS per journal
+         handle, and the inode itself last.  A crash in between
+         only leaks the rest, as no directory refers to INODE. */
       if (inode->removed) 
         {
+          uint32_t i;
+
+          for (i = inode->data.extent_cnt; i-- > 0; )
+            {
+              struct inode_extent *e = &inode->data.extents[i];
+
+              while (e->cnt > 0)
+                {
+                  size_t n = e->cnt < HANDLE_SECTORS ? e->cnt
+                                                     : HANDLE_SECTORS;
+
+                  journal_begin ();
+                  free_map_release (e->start + e->cnt - n, n);
+                  journal_end ();
+                  e->cnt -= n;
+                }
+            }
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_end ();
         }
 
-      free (inode); 
+      free (inode->aux);
+      kmem_cache_free (&inode_cache, inode);
     }
 }
 
@@ -191,19 +845,34 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+   OFFSET, through the buffer cache for the sectors that are only
+   partly read, and for all of them unless DIRECT.
+   Returns the number of bytes actually read. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset,
+         bool direct) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rw);
+  if (is_inline (&inode->data))
+    {
+      if (offset < inode_length (inode) && size > 0)
+        {
+          bytes_read = inode_length (inode) - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,51 +889,159 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+#ifdef VM
+      /* A page of an executable that a process has mapped is
+         copied out of its frame, which is the page cache of the
+         file's text. */
+      if (inode->deny_write_cnt > 0)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          off_t page_left = PGSIZE - offset % PGSIZE;
+          off_t page_chunk = size < page_left ? size : page_left;
+          if (page_chunk > inode_left)
+            page_chunk = inode_left;
+          if (page_chunk > 0
+              && vm_frame_read_shared (inode, offset, buffer + bytes_read,
+                                       page_chunk))
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              size -= page_chunk;
+              offset += page_chunk;
+              bytes_read += page_chunk;
+              continue;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
+#endif
+
+      /* Copy out of the cached sector, unless it was never
+         written. */
+      if (!sector_initialized (inode, offset))
+        memset (buffer + bytes_read, 0, chunk_size);
+      else if (direct && chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* As many whole, written sectors as are consecutive. */
+          size_t cnt = size < inode_left ? size : inode_left;
+          size_t init_left = inode->data.init_cnt
+                             - offset / BLOCK_SECTOR_SIZE;
+          cnt = sector_run (inode, offset, cnt / BLOCK_SECTOR_SIZE);
+          if (cnt > init_left)
+            cnt = init_left;
+          cache_read_direct (sector_idx, cnt, buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
+        }
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  return read_at (inode, buffer, size, offset, false);
+}
+
+/* Like inode_read_at(), but reads the whole sectors that are not
+   cached straight from disk into BUFFER, without caching them. */
+off_t
+inode_read_direct (struct inode *inode, void *buffer, off_t size,
+                   off_t offset)
+{
+  return read_at (inode, buffer, size, offset, true);
+}
+
+/* Starts reading the sectors of the SIZE bytes of INODE at OFFSET
+   into the buffer cache in the background, as far as they are
+   within the file. */
+void
+inode_readahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rw);
+  if (is_inline (&inode->data))
+    end = 0;
+  else if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    if (sector_initialized (inode, offset))
+      cache_readahead (byte_to_sector (inode, offset));
+  rwlock_release_read (&inode->rw);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   through the buffer cache for the sectors that are only partly
+   written, and for all of them unless DIRECT.
+   Returns the number of bytes actually written. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset, bool direct) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool inode_dirty = false;
+  bool handle = false;
 
-  if (inode->deny_write_cnt)
+  if (packfs_mounted ())
     return 0;
 
+  /* A write that extends INODE by more than one handle may
+     allocate takes the sectors first, a piece per handle.  The
+     length is read without the lock: if it changes meanwhile,
+     the handle below allocates what is still missing. */
+  if (size > 0
+      && offset + size - inode_length (inode)
+         > (off_t) HANDLE_SECTORS * BLOCK_SECTOR_SIZE
+      && !inode_reserve (inode, offset + size))
+    return 0;
+
+  rwlock_acquire_write (&inode->rw);
+  if (write_changes_metadata (inode, size, offset))
+    {
+      /* The handle has to come before the inode's lock. */
+      rwlock_release_write (&inode->rw);
+      journal_begin ();
+      handle = true;
+      rwlock_acquire_write (&inode->rw);
+    }
+  if (inode->deny_write_cnt
+      || (size > 0 && offset + size > inode_length (inode)
+          && !inode_grow (inode, offset + size)))
+    {
+      rwlock_release_write (&inode->rw);
+      if (handle)
+        journal_end ();
+      return 0;
+    }
+
+  /* What was derived from the old contents no longer holds. */
+  if (size > 0 && inode->aux != NULL)
+    {
+      free (inode->aux);
+      inode->aux = NULL;
+    }
+
+  if (is_inline (&inode->data))
+    {
+      if (size > 0)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          cache_log_write (inode->sector, &inode->data);
+          bytes_written = size;
+        }
+      size = 0;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -281,49 +1058,114 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      /* Write into the cached sector, which reads in the rest of
+         the sector first if the chunk does not cover all of it. */
+      if (init_sectors (inode, offset, chunk_size == BLOCK_SECTOR_SIZE))
+        inode_dirty = true;
+      if (direct && !inode->metadata && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          /* As many whole sectors as are consecutive, which are all
+             written now. */
+          size_t cnt = size < inode_left ? size : inode_left;
+          uint32_t end;
+          cnt = sector_run (inode, offset, cnt / BLOCK_SECTOR_SIZE);
+          end = offset / BLOCK_SECTOR_SIZE + cnt;
+          if (inode->data.init_cnt < end)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              inode->data.init_cnt = end;
+              inode_dirty = true;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          cache_write_direct (sector_idx, cnt, buffer + bytes_written);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
+      else if (inode->metadata)
+        cache_log_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                            chunk_size);
+      else
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  if (inode_dirty)
+    cache_log_write (inode->sector, &inode->data);
+  rwlock_release_write (&inode->rw);
+  if (handle)
+    journal_end ();
 
   return bytes_written;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if an error occurs.  A write past the end of the
+   file extends it first; that fails if the disk is full. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  return write_at (inode, buffer, size, offset, false);
+}
+
+/* Like inode_write_at(), but writes the whole sectors that are
+   not cached straight from BUFFER to disk, without caching
+   them. */
+off_t
+inode_write_direct (struct inode *inode, const void *buffer, off_t size,
+                    off_t offset)
+{
+  return write_at (inode, buffer, size, offset, true);
+}
+
+/* Writes the dirty cached sectors of INODE, its own and its
+   data's, back to disk. */
+void
+inode_sync (struct inode *inode)
+{
+  uint32_t i;
+
+  rwlock_acquire_read (&inode->rw);
+  cache_flush_range (inode->sector, 1);
+  if (!is_inline (&inode->data))
+    for (i = 0; i < inode->data.extent_cnt; i++)
+      cache_flush_range (inode->data.extents[i].start,
+                         inode->data.extents[i].cnt);
+  rwlock_release_read (&inode->rw);
+}
+
+/* Returns the data sector of INODE that holds byte OFFSET, and
+   stores in *CNT the number of sectors, at most MAX, from there on
+   that follow it on disk without a gap.  Returns -1, with *CNT set
+   to 0, if OFFSET is not within INODE or INODE has no data
+   sectors. */
+block_sector_t
+inode_sector_run (struct inode *inode, off_t offset, size_t max, size_t *cnt)
+{
+  block_sector_t sector = -1;
+
+  *cnt = 0;
+  rwlock_acquire_read (&inode->rw);
+  if (!is_inline (&inode->data) && offset < inode->data.length)
+    {
+      sector = byte_to_sector (inode, offset);
+      *cnt = sector_run (inode, offset, max);
+    }
+  rwlock_release_read (&inode->rw);
+  return sector;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,12 +1174,59 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
+}
+
+/* Returns the data attached to INODE by inode_set_aux(), or a
+   null pointer if there is none. */
+void *
+inode_get_aux (struct inode *inode)
+{
+  void *aux;
+
+  rwlock_acquire_read (&inode->rw);
+  aux = inode->aux;
+  rwlock_release_read (&inode->rw);
+  return aux;
+}
+
+/* Attaches AUX, a block obtained from malloc() that describes
+   INODE's contents, to INODE, unless something is attached
+   already, in which case returns false.  INODE frees AUX when
+   the inode is next written or leaves memory, which is neither
+   as long as the caller keeps INODE open with writes denied:
+   until then, the caller, and any other that denies writes, may
+   use AUX as returned by inode_get_aux().  No one may modify
+   it. */
+bool
+inode_set_aux (struct inode *inode, void *aux)
+{
+  bool success;
+
+  ASSERT (aux != NULL);
+
+  rwlock_acquire_write (&inode->rw);
+  success = inode->aux == NULL;
+  if (success)
+    inode->aux = aux;
+  rwlock_release_write (&inode->rw);
+  return success;
+}
+
+/* Has the writes to INODE's data journaled, like those to the
+   inode itself, for a directory or the free map file. */
+void
+inode_set_metadata (struct inode *inode)
+{
+  inode->metadata = true;
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  Without INODE's
+   lock, a concurrent write may extend it right afterward. */
 off_t
 inode_length (const struct inode *inode)
 {
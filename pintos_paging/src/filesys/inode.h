@@ -16,8 +16,19 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_direct (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_direct (struct inode *, const void *, off_t size,
+                          off_t offset);
+bool inode_reserve (struct inode *, off_t length);
+void inode_readahead (struct inode *, off_t size, off_t offset);
+void inode_sync (struct inode *);
+block_sector_t inode_sector_run (struct inode *, off_t offset, size_t max,
+                                 size_t *cnt);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void *inode_get_aux (struct inode *);
+bool inode_set_aux (struct inode *, void *aux);
+void inode_set_metadata (struct inode *);
 
 #endif /* filesys/inode.h */
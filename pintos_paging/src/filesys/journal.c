@@ -0,0 +1,517 @@
+#include "filesys/journal.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "devices/rtc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+
+   Changes to inodes, directories and the free map are not written
+   back in place one sector at a time.  The sectors they touch are
+   collected in a running transaction, pinned in the buffer cache,
+   and journal_commit() writes them together, as one record, with
+   one request, to the log: LOG_SECTORS consecutive sectors that
+   follow its header.  Only then may the buffer cache write them
+   back to their home locations, lazily, as it does for data.
+   Commits are made by the write-behind work, by fsync() and when
+   the transaction grows large; when the log is full, a checkpoint
+   writes everything back and starts it over.
+
+   journal_open() redoes the records that the log holds, so after a
+   crash the metadata reflects each operation committed, and no
+   operation in part.  File data is not journaled.
+
+   An operation that changes metadata runs in a handle, between
+   journal_begin() and journal_end(), which nest.  A commit waits
+   for the handles in progress to end, and keeps new ones from
+   starting, so that a transaction holds whole operations.  As
+   journal_begin() may wait for a commit, it must be called before
+   any file system lock is taken.
+
+   A sector that is freed while the log holds a copy of it is
+   revoked, so that recovery does not write the old copy over
+   whatever the sector is reused for.  Freed sectors are discarded
+   on the device only after the commit that frees them. */
+
+/* Log size in sectors, with its header. */
+#define LOG_SECTORS 128
+
+/* Identifies the log header and records. */
+#define LOG_MAGIC 0x4a524e4c
+
+/* Entries in a record: home sectors, then revoked sectors. */
+#define LOG_ENTRY_CNT 123
+
+/* A handle starts only if the running transaction, the dirty
+   free map sectors that its commit will add to it, and the handles
+   in progress leave room for HANDLE_CREDITS more sectors under
+   TXN_SOFT; otherwise the transaction is committed first.  That
+   keeps transactions from pinning more than about half of the
+   buffer cache.  TXN_MAX sectors is the hard limit, for which a
+   record fills 8 pages: the free map refuses allocations that
+   would dirty more of its sectors than fit under it (see
+   journal_room()), and operations that allocate or free many
+   sectors do so a piece per handle. */
+#define HANDLE_CREDITS 8
+#define TXN_SOFT 32
+#define TXN_MAX 63
+
+/* First sector of the log. */
+struct log_header
+  {
+    unsigned magic;             /* LOG_MAGIC. */
+    uint32_t seq;               /* Sequence number of the first record. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 8];
+  };
+
+/* Head of a record, followed in the log by the CNT sectors it
+   redoes.  Records follow each other, with increasing sequence
+   numbers, from the sector after the header. */
+struct log_record
+  {
+    unsigned magic;             /* LOG_MAGIC. */
+    uint32_t seq;               /* Sequence number. */
+    uint32_t cnt;               /* Sectors that follow. */
+    uint32_t revoke_cnt;        /* Sectors revoked. */
+    uint32_t checksum;          /* Of SEQ and the sectors that follow. */
+    block_sector_t entries[LOG_ENTRY_CNT]; /* Homes, then revoked. */
+  };
+
+/* The log.  Set up by journal_open(); it is not used until then,
+   so that formatting writes in place. */
+static bool log_open;           /* In use? */
+static block_sector_t log_start; /* Sector of the header. */
+static uint32_t log_head;       /* Where the next record goes. */
+static uint32_t log_seq;        /* Sequence number of the next record. */
+static struct bitmap *in_log;   /* Sectors the log holds copies of. */
+static uint8_t *record;         /* Room for a record and its sectors. */
+
+/* Handles hold `handles' for reading, commits for writing. */
+static struct rwlock handles;
+
+/* The running transaction: sectors to write to the log, sectors
+   to revoke, and the credits of the handles in progress.
+   Protected by txn_lock, which may be acquired with cache_lock or
+   free_map_lock held. */
+static struct lock txn_lock;
+static block_sector_t txn_sectors[TXN_MAX];
+static size_t txn_cnt;
+static block_sector_t txn_revokes[LOG_ENTRY_CNT];
+static size_t revoke_cnt;
+static size_t credits;
+
+static void commit (void);
+static void checkpoint (void);
+static void write_header (void);
+static bool read_record (uint32_t pos, uint32_t seq);
+static uint32_t checksum (uint32_t seq, const void *, size_t cnt);
+
+/* Initializes the journal, before the file system is formatted or
+   the log is opened. */
+void
+journal_init (void)
+{
+  ASSERT (sizeof (struct log_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct log_record) == BLOCK_SECTOR_SIZE);
+
+  rwlock_init (&handles);
+  lock_init_named (&txn_lock, "journal");
+  txn_cnt = revoke_cnt = credits = 0;
+  in_log = bitmap_create (block_size (fs_device));
+  if (in_log == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  record = palloc_get_multiple (PAL_ASSERT,
+                                DIV_ROUND_UP ((TXN_MAX + 1)
+                                              * BLOCK_SECTOR_SIZE, PGSIZE));
+}
+
+/* Returns the first sector of the log file, whose LOG_SECTORS
+   sectors must be consecutive. */
+static block_sector_t
+find_log (void)
+{
+  struct inode *inode = inode_open (LOG_SECTOR);
+  block_sector_t start;
+  size_t cnt;
+
+  if (inode == NULL)
+    PANIC ("can't open log");
+  start = inode_sector_run (inode, 0, LOG_SECTORS, &cnt);
+  inode_close (inode);
+  if (cnt < LOG_SECTORS)
+    PANIC ("log is not contiguous");
+  return start;
+}
+
+/* Creates the log file and writes an empty log to it, while the
+   file system is formatted. */
+void
+journal_create (void)
+{
+  if (!inode_create (LOG_SECTOR, LOG_SECTORS * BLOCK_SECTOR_SIZE))
+    PANIC ("log creation failed");
+  log_start = find_log ();
+
+  /* Start from the time of day, so that records that an earlier
+     file system left on the disk do not pass for ours. */
+  log_seq = (uint32_t) rtc_get_time ();
+  write_header ();
+}
+
+/* Opens the log and redoes the records it holds.  Afterward,
+   metadata is journaled. */
+void
+journal_open (void)
+{
+  struct log_header *h = (struct log_header *) record;
+  static uint32_t pos[LOG_SECTORS];
+  struct bitmap *done, *revoked;
+  uint32_t seq, n, p;
+
+  log_start = find_log ();
+  block_read (fs_device, log_start, h);
+  if (h->magic != LOG_MAGIC)
+    PANIC ("bad log header");
+  seq = h->seq;
+
+  /* Find the records, which end at the first one that does not
+     follow or was not written whole. */
+  for (n = 0, p = 1; p < LOG_SECTORS && read_record (p, seq + n); n++)
+    {
+      pos[n] = p;
+      p += 1 + ((struct log_record *) record)->cnt;
+    }
+
+  /* Redo them, newest first, writing each sector only once, and
+     not over what a later record revoked. */
+  done = bitmap_create (block_size (fs_device));
+  revoked = bitmap_create (block_size (fs_device));
+  if (done == NULL || revoked == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  for (p = n; p-- > 0; )
+    {
+      struct log_record *r = (struct log_record *) record;
+      uint32_t i;
+
+      if (!read_record (pos[p], seq + p))
+        PANIC ("log changed during recovery");
+      for (i = 0; i < r->cnt; i++)
+        {
+          block_sector_t sector = r->entries[i];
+          if (!bitmap_test (done, sector) && !bitmap_test (revoked, sector))
+            {
+              cache_write (sector, record + (i + 1) * BLOCK_SECTOR_SIZE);
+              bitmap_mark (done, sector);
+            }
+        }
+      for (i = r->cnt; i < r->cnt + r->revoke_cnt; i++)
+        bitmap_mark (revoked, r->entries[i]);
+    }
+  bitmap_destroy (done);
+  bitmap_destroy (revoked);
+  if (n > 0)
+    printf ("journal: redid %u transactions\n", (unsigned) n);
+
+  /* Start the log over, past the records redone. */
+  log_seq = seq + n;
+  checkpoint ();
+  log_open = true;
+}
+
+/* Commits the running transaction, writes everything back, and
+   stops journaling, before the file system shuts down. */
+void
+journal_close (void)
+{
+  if (!log_open)
+    return;
+  rwlock_acquire_write (&handles);
+  commit ();
+  checkpoint ();
+  log_open = false;
+  rwlock_release_write (&handles);
+}
+
+/* Starts a handle in the running transaction, committing it first
+   if it is too large, or enters one more level of the handle the
+   running thread is in. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!log_open || t->journal_depth++ > 0)
+    return;
+
+  for (;;)
+    {
+      bool room;
+
+      rwlock_acquire_read (&handles);
+      lock_acquire (&txn_lock);
+      room = (txn_cnt + free_map_dirty_cnt () + credits + HANDLE_CREDITS
+              <= TXN_SOFT);
+      if (room)
+        credits += HANDLE_CREDITS;
+      lock_release (&txn_lock);
+      if (room)
+        return;
+      rwlock_release_read (&handles);
+
+      t->journal_depth = 0;
+      journal_commit ();
+      t->journal_depth = 1;
+    }
+}
+
+/* Leaves the handle entered by the matching journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!log_open)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth == 0)
+    {
+      lock_acquire (&txn_lock);
+      credits -= HANDLE_CREDITS;
+      lock_release (&txn_lock);
+      rwlock_release_read (&handles);
+    }
+}
+
+/* Commits the running transaction to the log, after the handles in
+   progress end.  May not be called from within a handle. */
+void
+journal_commit (void)
+{
+  if (!log_open)
+    return;
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  rwlock_acquire_write (&handles);
+  commit ();
+  rwlock_release_write (&handles);
+}
+
+/* Adds metadata SECTOR, which the running thread is changing in
+   the buffer cache within a handle, to the running transaction.
+   Returns false, if the journal is not open, for the cache to
+   write it back like data. */
+bool
+journal_add (block_sector_t sector)
+{
+  size_t i;
+
+  if (!log_open)
+    return false;
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&txn_lock);
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] == sector)
+      goto done;
+
+  /* A sector reused for metadata is no longer revoked. */
+  for (i = 0; i < revoke_cnt; i++)
+    if (txn_revokes[i] == sector)
+      {
+        txn_revokes[i] = txn_revokes[--revoke_cnt];
+        break;
+      }
+
+  if (txn_cnt >= TXN_MAX || txn_cnt + revoke_cnt >= LOG_ENTRY_CNT)
+    PANIC ("journal: transaction too large");
+  txn_sectors[txn_cnt++] = sector;
+
+ done:
+  lock_release (&txn_lock);
+  return true;
+}
+
+/* Returns true if the running transaction can still be committed
+   with FREE_MAP_CNT dirty free map sectors added to it, leaving
+   room for the sectors that the handles in progress may add.
+   Called by the free map, with free_map_lock held, before it
+   dirties more of its sectors. */
+bool
+journal_room (size_t free_map_cnt)
+{
+  bool room;
+
+  if (!log_open)
+    return true;
+
+  lock_acquire (&txn_lock);
+  room = (txn_cnt + free_map_cnt + credits <= TXN_MAX
+          && txn_cnt + free_map_cnt + revoke_cnt < LOG_ENTRY_CNT);
+  lock_release (&txn_lock);
+  return room;
+}
+
+/* Notes that the CNT sectors starting at SECTOR have been freed,
+   within a handle: they leave the running transaction, and those
+   the log holds copies of are revoked.  Called with free_map_lock
+   held, so that the sectors are not reused meanwhile. */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  block_sector_t dropped[TXN_MAX];
+  size_t drop_cnt = 0;
+  size_t i;
+
+  if (!log_open)
+    return;
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&txn_lock);
+  for (i = 0; i < txn_cnt; )
+    if (txn_sectors[i] - sector < cnt)
+      {
+        dropped[drop_cnt++] = txn_sectors[i];
+        txn_sectors[i] = txn_sectors[--txn_cnt];
+      }
+    else
+      i++;
+
+  if (bitmap_contains (in_log, sector, cnt, true))
+    for (i = 0; i < cnt; i++)
+      if (bitmap_test (in_log, sector + i))
+        {
+          if (txn_cnt + revoke_cnt >= LOG_ENTRY_CNT)
+            PANIC ("journal: transaction too large");
+          txn_revokes[revoke_cnt++] = sector + i;
+        }
+  lock_release (&txn_lock);
+
+  for (i = 0; i < drop_cnt; i++)
+    cache_unlog (dropped[i]);
+}
+
+/* Writes the running transaction to the log, as one record, and
+   lets the buffer cache write its sectors back.  The free map
+   goes in with the operations that changed it.  `handles' must be
+   held for writing. */
+static void
+commit (void)
+{
+  struct thread *t = thread_current ();
+  struct log_record *r = (struct log_record *) record;
+  size_t cnt, i;
+
+  ASSERT (rwlock_held_for_write (&handles));
+
+  t->journal_depth++;
+  free_map_flush ();
+  t->journal_depth--;
+
+  lock_acquire (&txn_lock);
+  cnt = txn_cnt;
+  i = revoke_cnt;
+  lock_release (&txn_lock);
+  if (cnt == 0 && i == 0)
+    return;
+  if (log_head + 1 + cnt > LOG_SECTORS)
+    checkpoint ();
+
+  /* No handle can change the transaction meanwhile. */
+  lock_acquire (&txn_lock);
+  r->magic = LOG_MAGIC;
+  r->cnt = cnt;
+  r->revoke_cnt = revoke_cnt;
+  memcpy (r->entries, txn_sectors, cnt * sizeof *txn_sectors);
+  memcpy (r->entries + cnt, txn_revokes, revoke_cnt * sizeof *txn_revokes);
+  txn_cnt = revoke_cnt = 0;
+  lock_release (&txn_lock);
+
+  r->seq = log_seq;
+  for (i = 0; i < cnt; i++)
+    cache_read (r->entries[i], record + (i + 1) * BLOCK_SECTOR_SIZE);
+  r->checksum = checksum (r->seq, record + BLOCK_SECTOR_SIZE, cnt);
+  block_write_multiple (fs_device, log_start + log_head, 1 + cnt, record);
+  block_flush (fs_device);
+  log_head += 1 + cnt;
+  log_seq++;
+  fs_stats.journal_commits++;
+  fs_stats.journal_sectors += cnt;
+
+  for (i = 0; i < cnt; i++)
+    {
+      bitmap_mark (in_log, r->entries[i]);
+      cache_unlog (r->entries[i]);
+    }
+
+  /* The sectors that the record frees are free for good. */
+  free_map_discard ();
+}
+
+/* Writes every sector committed so far back to its home, and
+   starts the log over with record log_seq.  The sectors of the
+   running transaction stay pinned: the log will hold them. */
+static void
+checkpoint (void)
+{
+  cache_flush_wait ();
+  block_flush (fs_device);
+  log_head = 1;
+  write_header ();
+  bitmap_set_all (in_log, false);
+  fs_stats.journal_checkpoints++;
+}
+
+/* Writes the log header, for an empty log that starts with record
+   log_seq, through the record buffer. */
+static void
+write_header (void)
+{
+  struct log_header *h = (struct log_header *) record;
+
+  memset (h, 0, sizeof *h);
+  h->magic = LOG_MAGIC;
+  h->seq = log_seq;
+  block_write (fs_device, log_start, h);
+}
+
+/* Reads the record at sector POS of the log, and the sectors that
+   follow it, into the record buffer.  Returns false if it is not
+   record SEQ, or was not written whole. */
+static bool
+read_record (uint32_t pos, uint32_t seq)
+{
+  struct log_record *r = (struct log_record *) record;
+  uint32_t i;
+
+  block_read (fs_device, log_start + pos, r);
+  if (r->magic != LOG_MAGIC || r->seq != seq || r->cnt > TXN_MAX
+      || r->cnt + r->revoke_cnt > LOG_ENTRY_CNT
+      || pos + 1 + r->cnt > LOG_SECTORS)
+    return false;
+  for (i = 0; i < r->cnt + r->revoke_cnt; i++)
+    if (r->entries[i] >= block_size (fs_device))
+      return false;
+  if (r->cnt > 0)
+    block_read_multiple (fs_device, log_start + pos + 1, r->cnt,
+                         record + BLOCK_SECTOR_SIZE);
+  return r->checksum == checksum (seq, record + BLOCK_SECTOR_SIZE, r->cnt);
+}
+
+/* Returns the checksum of record SEQ, whose CNT sectors are in
+   DATA. */
+static uint32_t
+checksum (uint32_t seq, const void *data, size_t cnt)
+{
+  return hash_bytes (data, cnt * BLOCK_SECTOR_SIZE) ^ seq;
+}
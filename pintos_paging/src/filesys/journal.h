@@ -0,0 +1,21 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_commit (void);
+
+bool journal_add (block_sector_t);
+bool journal_room (size_t free_map_cnt);
+void journal_revoke (block_sector_t, size_t cnt);
+
+#endif /* filesys/journal.h */
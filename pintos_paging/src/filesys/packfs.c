@@ -0,0 +1,83 @@
+#include "filesys/packfs.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+
+/* Inode table of the mounted image, or a null pointer if none is
+   mounted.  It does not change once mounted, so it needs no
+   lock. */
+static struct packfs_inode *inodes;
+static size_t inode_cnt;
+
+/* Mounts the packed image that fs_device holds, if it holds one,
+   reading its inode table with one request.  Returns false if the
+   device holds something else.  Panics if the image is damaged or
+   of another version. */
+bool
+packfs_mount (void)
+{
+  struct packfs_super super;
+  block_sector_t dev_size = block_size (fs_device);
+  size_t table_sectors, i;
+
+  block_read (fs_device, 0, &super);
+  if (super.magic != PACKFS_MAGIC)
+    return false;
+  if (super.version != PACKFS_VERSION)
+    PANIC ("packfs: image version %"PRIu32", not %d",
+           super.version, PACKFS_VERSION);
+  if (super.size > dev_size || super.inode_cnt == 0
+      || (uint64_t) super.inode_cnt * sizeof *inodes
+         > (uint64_t) super.size * BLOCK_SECTOR_SIZE)
+    PANIC ("packfs: damaged superblock");
+
+  inode_cnt = super.inode_cnt;
+  table_sectors = DIV_ROUND_UP (inode_cnt * sizeof *inodes,
+                                BLOCK_SECTOR_SIZE);
+  if (1 + table_sectors > super.size)
+    PANIC ("packfs: damaged superblock");
+  inodes = malloc (table_sectors * BLOCK_SECTOR_SIZE);
+  if (inodes == NULL)
+    PANIC ("packfs: out of memory for %zu inodes", inode_cnt);
+  block_read_multiple (fs_device, 1, table_sectors, inodes);
+
+  /* Every file's data must be within the image, past the table. */
+  for (i = 0; i < inode_cnt; i++)
+    {
+      const struct packfs_inode *pi = &inodes[i];
+      size_t sectors = DIV_ROUND_UP (pi->length, BLOCK_SECTOR_SIZE);
+
+      if ((off_t) pi->length < 0
+          || (sectors > 0 && (pi->start < 1 + table_sectors
+                              || pi->start > super.size
+                              || sectors > super.size - pi->start)))
+        PANIC ("packfs: damaged inode %zu", i);
+    }
+
+  printf ("packfs: read-only image, %zu files\n", inode_cnt - 1);
+  return true;
+}
+
+/* Returns true if the file system is a packed image. */
+bool
+packfs_mounted (void)
+{
+  return inodes != NULL;
+}
+
+/* Stores into *START and *LENGTH the first data sector and the
+   length of the file whose inode number is INUMBER, and returns
+   true, or returns false if the image has no such file. */
+bool
+packfs_inode (block_sector_t inumber, block_sector_t *start, off_t *length)
+{
+  size_t idx = inumber - ROOT_DIR_SECTOR;
+
+  if (inodes == NULL || inumber < ROOT_DIR_SECTOR || idx >= inode_cnt)
+    return false;
+  *start = inodes[idx].start;
+  *length = inodes[idx].length;
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef FILESYS_PACKFS_H
+#define FILESYS_PACKFS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Read-only packed file system images, as written by
+   utils/pintos-mkpackfs, which must agree with the layout below.
+
+   An image starts with a packfs_super, followed from sector 1 by
+   the inode table: a packfs_inode for each file, the root
+   directory first.  Each file's data is contiguous, from a sector
+   boundary on, in the order the files were given to the tool, so
+   that a file is read with one request, and files read one after
+   another lie one after another.  The root directory's data is
+   its entries, in the format of filesys/directory.c, sorted by
+   name, so that dir_lookup() finds one by binary search.
+
+   Inode numbers are the indexes into the inode table, plus
+   ROOT_DIR_SECTOR, so that the root directory keeps its usual
+   number.  There is no free map and no journal, and nothing is
+   ever written. */
+
+/* Identifies a packed image: "PACK". */
+#define PACKFS_MAGIC 0x4b434150
+
+/* Layout version. */
+#define PACKFS_VERSION 1
+
+/* First sector of an image. */
+struct packfs_super
+  {
+    uint32_t magic;             /* PACKFS_MAGIC. */
+    uint32_t version;           /* PACKFS_VERSION. */
+    uint32_t inode_cnt;         /* Entries in the inode table. */
+    uint32_t size;              /* Sectors in the image. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 16];
+  };
+
+/* An entry in the inode table. */
+struct packfs_inode
+  {
+    uint32_t start;             /* First data sector. */
+    uint32_t length;            /* Length in bytes. */
+  };
+
+bool packfs_mount (void);
+bool packfs_mounted (void);
+bool packfs_inode (block_sector_t inumber, block_sector_t *start,
+                   off_t *length);
+
+#endif /* filesys/packfs.h */
@@ -0,0 +1,244 @@
+#include "filesys/pipe.h"
+#include <debug.h>
+#include <ring.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "userprog/process.h"
+#include "vm/page.h"
+#endif
+
+/* A reader blocked on an empty pipe, whose buffer is pinned: a
+   writer copies straight into it instead of into the ring. */
+struct pipe_reader
+  {
+    const struct vm_pin_list *pins; /* The reader's buffer. */
+    off_t done;                 /* Bytes the writer put there. */
+  };
+
+/* A pipe: a ring of PIPE_PAGES pages between the processes that
+   hold its two ends. */
+struct pipe
+  {
+    struct lock lock;           /* Protects all of the below. */
+    struct condition readable;  /* Signaled when data comes in, or
+                                   the last writer goes away. */
+    struct condition writable;  /* Signaled when room is made, or
+                                   the last reader goes away. */
+    struct ring ring;           /* Data written, not yet read. */
+    int readers;                /* Open read ends. */
+    int writers;                /* Open write ends. */
+    struct pipe_reader *reader; /* Reader waiting for a handoff. */
+  };
+
+/* Pipes. */
+static struct kmem_cache pipe_cache;
+
+/* Initializes the cache of pipes. */
+void
+pipe_init (void)
+{
+  kmem_cache_init (&pipe_cache, "pipe", sizeof (struct pipe), 0, NULL);
+}
+
+/* Creates and returns a new, empty pipe, with no ends open yet.
+   Returns a null pointer if out of memory. */
+struct pipe *
+pipe_create (void)
+{
+  struct pipe *p = kmem_cache_alloc (&pipe_cache);
+  void *buf;
+
+  if (p == NULL)
+    return NULL;
+  buf = palloc_get_multiple (0, PIPE_PAGES);
+  if (buf == NULL)
+    {
+      kmem_cache_free (&pipe_cache, p);
+      return NULL;
+    }
+
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  ring_init (&p->ring, buf, PIPE_PAGES * PGSIZE);
+  p->readers = p->writers = 0;
+  p->reader = NULL;
+  return p;
+}
+
+/* Opens another end of P, for writing if WRITE, else for
+   reading. */
+void
+pipe_open_end (struct pipe *p, bool write)
+{
+  lock_acquire (&p->lock);
+  if (write)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Closes an end of P, and frees P once no end is open.  Once all
+   the write ends are closed, readers see end of file; once all the
+   read ends are, writes fail. */
+void
+pipe_close_end (struct pipe *p, bool write)
+{
+  bool last;
+
+  lock_acquire (&p->lock);
+  if (write)
+    p->writers--;
+  else
+    p->readers--;
+  ASSERT (p->readers >= 0 && p->writers >= 0);
+  cond_broadcast (&p->readable, &p->lock);
+  cond_broadcast (&p->writable, &p->lock);
+  last = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+
+  if (last)
+    {
+      palloc_free_multiple (p->ring.buf, PIPE_PAGES);
+      kmem_cache_free (&pipe_cache, p);
+    }
+}
+
+#ifdef VM
+/* Copies SIZE bytes from BUFFER into the pinned buffer PINS,
+   through the kernel addresses of its pages, so that it need not
+   be mapped in the current address space. */
+static void
+copy_to_pins (const struct vm_pin_list *pins, const uint8_t *buffer,
+              size_t size)
+{
+  size_t ofs = pg_ofs (pins->uaddr);
+
+  while (size > 0)
+    {
+      size_t chunk = PGSIZE - ofs % PGSIZE;
+      if (chunk > size)
+        chunk = size;
+      memcpy ((uint8_t *) pins->kpages[ofs / PGSIZE] + ofs % PGSIZE,
+              buffer, chunk);
+      buffer += chunk;
+      ofs += chunk;
+      size -= chunk;
+    }
+}
+#endif
+
+/* Reads up to SIZE bytes from P into BUFFER, blocking until there
+   is at least one byte, or no writer left.  Returns the number of
+   bytes read, 0 at end of file.
+
+   PINS, if not null, is BUFFER pinned (see vm_pin_range()): if
+   the pipe is empty, the next writer then copies its data straight
+   into BUFFER, skipping the ring -- a whole page written into the
+   pipe reaches the reader in one copy. */
+off_t
+pipe_read (struct pipe *p, void *buffer, off_t size,
+           const struct vm_pin_list *pins)
+{
+  struct pipe_reader r;
+  off_t n;
+
+  if (size <= 0)
+    return 0;
+
+  lock_acquire (&p->lock);
+  r.pins = pins;
+  r.done = 0;
+  while (ring_empty (&p->ring) && p->writers > 0 && r.done == 0)
+    {
+      if (pins != NULL && p->reader == NULL)
+        p->reader = &r;
+#ifdef VM
+      if (!process_block ())
+        break;
+#endif
+      cond_wait (&p->readable, &p->lock);
+#ifdef VM
+      process_unblock ();
+#endif
+    }
+  if (p->reader == &r)
+    p->reader = NULL;
+
+  if (r.done > 0)
+    n = r.done;
+  else
+    {
+      n = ring_read (&p->ring, buffer, size);
+      if (n > 0)
+        cond_broadcast (&p->writable, &p->lock);
+    }
+  lock_release (&p->lock);
+  return n;
+}
+
+/* Writes the SIZE bytes of BUFFER into P, blocking while it is
+   full.  Returns the number of bytes written, which is less than
+   SIZE only if the last reader goes away meanwhile, or -1 if there
+   was no reader to begin with. */
+off_t
+pipe_write (struct pipe *p, const void *buffer_, off_t size)
+{
+  const uint8_t *buffer = buffer_;
+  off_t written = 0;
+
+  lock_acquire (&p->lock);
+  if (p->readers == 0)
+    {
+      lock_release (&p->lock);
+      return -1;
+    }
+
+  while (written < size && p->readers > 0)
+    {
+      size_t n;
+
+#ifdef VM
+      /* Hand the data over to the reader waiting on the empty
+         pipe, as much as it asked for. */
+      if (p->reader != NULL && ring_empty (&p->ring))
+        {
+          struct pipe_reader *r = p->reader;
+          n = size - written;
+          if (n > r->pins->len)
+            n = r->pins->len;
+          copy_to_pins (r->pins, buffer + written, n);
+          r->done = n;
+          p->reader = NULL;
+          written += n;
+          cond_broadcast (&p->readable, &p->lock);
+          continue;
+        }
+#endif
+
+      n = ring_write (&p->ring, buffer + written, size - written);
+      if (n > 0)
+        {
+          written += n;
+          cond_broadcast (&p->readable, &p->lock);
+        }
+      else
+        {
+#ifdef VM
+          if (!process_block ())
+            break;
+#endif
+          cond_wait (&p->writable, &p->lock);
+#ifdef VM
+          process_unblock ();
+#endif
+        }
+    }
+  lock_release (&p->lock);
+  return written;
+}
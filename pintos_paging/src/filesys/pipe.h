@@ -0,0 +1,22 @@
+#ifndef FILESYS_PIPE_H
+#define FILESYS_PIPE_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct pipe;
+struct vm_pin_list;
+
+/* Pages in the buffer of a pipe; a power of 2. */
+#define PIPE_PAGES 1
+
+void pipe_init (void);
+struct pipe *pipe_create (void);
+void pipe_open_end (struct pipe *, bool write);
+void pipe_close_end (struct pipe *, bool write);
+
+off_t pipe_read (struct pipe *, void *buffer, off_t size,
+                 const struct vm_pin_list *);
+off_t pipe_write (struct pipe *, const void *buffer, off_t size);
+
+#endif /* filesys/pipe.h */
@@ -69,6 +69,34 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's size if there is none.  Skips whole
+   elements that have no such bit. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t cnt = elem_cnt (b->bit_cnt);
+  size_t idx = elem_idx (start);
+  elem_type bits;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  /* The bits of interest are 1 in BITS. */
+  bits = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (bits == 0)
+    {
+      if (++idx >= cnt)
+        return b->bit_cnt;
+      bits = b->bits[idx] ^ flip;
+    }
+
+  /* The unused bits of the last element may look like a match. */
+  start = idx * ELEM_BITS + __builtin_ctzl (bits);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -250,16 +278,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && find_bit (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,17 +321,46 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+  while (start <= b->bit_cnt - cnt)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      /* Find the next run of bits set to VALUE, and where it
+         ends. */
+      size_t end;
+
+      start = find_bit (b, start, value);
+      if (start > b->bit_cnt - cnt)
+        break;
+      end = find_bit (b, start, !value);
+      if (end - start >= cnt)
+        return start;
+      start = end;
     }
   return BITMAP_ERROR;
 }
 
+/* Like bitmap_scan(), but next-fit: looks for the group at or
+   after HINT first, then from the start of B.  A caller that
+   passes the end of the group it found last does not search the
+   bits it has just set again. */
+size_t
+bitmap_scan_next (const struct bitmap *b, size_t hint, size_t cnt, bool value) 
+{
+  size_t idx;
+
+  ASSERT (b != NULL);
+
+  if (hint > b->bit_cnt)
+    hint = 0;
+  idx = bitmap_scan (b, hint, cnt, value);
+  if (idx == BITMAP_ERROR && hint > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  return idx;
+}
+
 /* Finds the first group of CNT consecutive bits in B at or after
    START that are all set to VALUE, flips them all to !VALUE,
    and returns the index of the first bit in the group.
@@ -358,6 +410,24 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes at byte offset OFS of B's file image, as
+   written by bitmap_write(), to the same place in FILE; the range
+   is cut at the end of the image.  Return true if successful,
+   false otherwise. */
+bool
+bitmap_write_at (const struct bitmap *b, struct file *file,
+                 size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == (off_t) size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -25,6 +25,10 @@ debug_panic (const char *file, int line, const char *function,
   intr_disable ();
   console_panic ();
 
+  /* Make room for the message in the serial buffer, which with
+     interrupts off would otherwise drop what does not fit. */
+  serial_flush ();
+
   level++;
   if (level == 1) 
     {
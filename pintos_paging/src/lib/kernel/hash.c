@@ -18,6 +18,7 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void move_buckets (struct hash *, size_t cnt);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -28,6 +29,9 @@ hash_init (struct hash *h,
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+  h->old_bucket_cnt = 0;
+  h->old_buckets = NULL;
+  h->moved_cnt = 0;
   h->hash = hash;
   h->less = less;
   h->aux = aux;
@@ -55,6 +59,11 @@ hash_clear (struct hash *h, hash_action_func *destructor)
 {
   size_t i;
 
+  /* Finish moving the old buckets, so that there is only one
+     array to clear. */
+  if (h->old_buckets != NULL)
+    move_buckets (h, h->old_bucket_cnt);
+
   for (i = 0; i < h->bucket_cnt; i++) 
     {
       struct list *bucket = &h->buckets[i];
@@ -88,6 +97,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 {
   if (destructor != NULL)
     hash_clear (h, destructor);
+  free (h->old_buckets);
   free (h->buckets);
 }
 
@@ -162,20 +172,18 @@ hash_delete (struct hash *h, struct hash_elem *e)
 void
 hash_apply (struct hash *h, hash_action_func *action) 
 {
-  size_t i;
+  struct hash_iterator i;
+  struct hash_elem *e;
   
   ASSERT (action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  hash_first (&i, h);
+  e = hash_next (&i);
+  while (e != NULL) 
     {
-      struct list *bucket = &h->buckets[i];
-      struct list_elem *elem, *next;
-
-      for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
-        {
-          next = list_next (elem);
-          action (list_elem_to_hash_elem (elem), h->aux);
-        }
+      struct hash_elem *next = hash_next (&i);
+      action (e, h->aux);
+      e = next;
     }
 }
 
@@ -203,7 +211,7 @@ hash_first (struct hash_iterator *i, struct hash *h)
   ASSERT (h != NULL);
 
   i->hash = h;
-  i->bucket = i->hash->buckets;
+  i->bucket = h->old_buckets != NULL ? h->old_buckets : h->buckets;
   i->elem = list_elem_to_hash_elem (list_head (i->bucket));
 }
 
@@ -218,12 +226,20 @@ hash_first (struct hash_iterator *i, struct hash *h)
 struct hash_elem *
 hash_next (struct hash_iterator *i)
 {
+  struct hash *h;
+
   ASSERT (i != NULL);
 
+  h = i->hash;
   i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem (list_end (i->bucket)))
     {
-      if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt)
+      /* The old buckets come first, then the current ones. */
+      ++i->bucket;
+      if (h->old_buckets != NULL
+          && i->bucket == h->old_buckets + h->old_bucket_cnt)
+        i->bucket = h->buckets;
+      else if (i->bucket == h->buckets + h->bucket_cnt)
         {
           i->elem = NULL;
           break;
@@ -294,19 +310,48 @@ hash_string (const char *s_)
   return hash;
 }
 
-/* Returns a hash of integer I. */
+/* Returns a hash of integer I.
+
+   This is the finalizer of MurmurHash3: a few shifts and
+   multiplications make every bit of I affect every bit of the
+   hash, without a loop over I's bytes.  Keys that differ only in
+   their high bits, such as page-aligned addresses, whose low 12
+   bits are all zero, are still spread over all the buckets. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  unsigned hash = i;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+/* Returns a hash of pointer P. */
+unsigned
+hash_ptr (const void *p) 
+{
+  return hash_int ((uintptr_t) p);
 }
 
-/* Returns the bucket in H that E belongs in. */
+/* Returns the bucket in H that E belongs in: its old bucket,
+   if that has not been moved yet, otherwise its current one. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) 
 {
-  size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-  return &h->buckets[bucket_idx];
+  unsigned hash = h->hash (e, h->aux);
+
+  if (h->old_buckets != NULL)
+    {
+      size_t old_idx = hash & (h->old_bucket_cnt - 1);
+      if (old_idx >= h->moved_cnt)
+        return &h->old_buckets[old_idx];
+    }
+  return &h->buckets[hash & (h->bucket_cnt - 1)];
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -344,21 +389,33 @@ is_power_of_2 (size_t x)
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
+/* Old buckets moved per insertion or deletion. */
+#define MOVE_BUCKETS 2
+
 /* Changes the number of buckets in hash table H to match the
    ideal.  This function can fail because of an out-of-memory
    condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+   we can still continue.
+
+   The elements are moved to the new buckets a few old buckets
+   at a time, by this and later calls, and the number of buckets
+   does not change again until they all are.  A table grows or
+   shrinks by half its elements or more between changes, which
+   leaves plenty of calls to finish moving. */
 static void
 rehash (struct hash *h) 
 {
   size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
+  struct list *new_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
+  if (h->old_buckets != NULL)
+    {
+      move_buckets (h, MOVE_BUCKETS);
+      return;
+    }
   old_bucket_cnt = h->bucket_cnt;
 
   /* Calculate the number of buckets to use now.
@@ -387,29 +444,41 @@ rehash (struct hash *h)
   for (i = 0; i < new_bucket_cnt; i++) 
     list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
+  /* Install new bucket info, keeping the old buckets until
+     their elements have been moved. */
+  h->old_buckets = h->buckets;
+  h->old_bucket_cnt = old_bucket_cnt;
+  h->moved_cnt = 0;
   h->buckets = new_buckets;
   h->bucket_cnt = new_bucket_cnt;
+  move_buckets (h, MOVE_BUCKETS);
+}
 
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
+/* Moves the elements of up to CNT more old buckets of H into the
+   current buckets.  Frees the old buckets once they are all
+   moved. */
+static void
+move_buckets (struct hash *h, size_t cnt) 
+{
+  while (cnt-- > 0 && h->moved_cnt < h->old_bucket_cnt)
     {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
+      struct list *old_bucket = &h->old_buckets[h->moved_cnt++];
 
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
+      while (!list_empty (old_bucket)) 
         {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
+          struct list_elem *elem = list_pop_front (old_bucket);
+          unsigned hash = h->hash (list_elem_to_hash_elem (elem), h->aux);
+          list_push_front (&h->buckets[hash & (h->bucket_cnt - 1)], elem);
         }
     }
 
-  free (old_buckets);
+  if (h->moved_cnt == h->old_bucket_cnt) 
+    {
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+      h->old_bucket_cnt = 0;
+      h->moved_cnt = 0;
+    }
 }
 
 /* Inserts E into BUCKET (in hash table H). */
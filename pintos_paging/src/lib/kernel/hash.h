@@ -18,7 +18,18 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   The number of buckets follows the number of elements, but the
+   elements are not all moved at once when it changes.  Instead,
+   the old array of buckets is kept and each insertion or
+   deletion moves the elements of a few of its buckets, so that
+   no single operation takes time in proportion to the size of
+   the table.
+
+   For tables keyed by an integer or a pointer, lib/kernel/ihash.h
+   has a hash table with open addressing that is faster to
+   search. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +72,9 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    size_t old_bucket_cnt;      /* Number of old buckets, a power of 2. */
+    struct list *old_buckets;   /* Buckets being moved from, or null. */
+    size_t moved_cnt;           /* Old buckets already moved, and empty. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -99,5 +113,6 @@ bool hash_empty (struct hash *);
 unsigned hash_bytes (const void *, size_t);
 unsigned hash_string (const char *);
 unsigned hash_int (int);
+unsigned hash_ptr (const void *);
 
 #endif /* lib/kernel/hash.h */
@@ -0,0 +1,168 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* Each element is the greatest of its subtree.  The children of
+   an element form a list from its `child' through their `next'
+   members; the `prev' member of the first child points to the
+   parent, and those of the others to the previous sibling. */
+
+static struct heap_elem *meld (struct heap *,
+                               struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+static void cut (struct heap_elem *);
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux)
+{
+  ASSERT (heap != NULL);
+  ASSERT (less != NULL);
+
+  heap->root = NULL;
+  heap->less = less;
+  heap->aux = aux;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (const struct heap *heap)
+{
+  return heap->root == NULL;
+}
+
+/* Returns the greatest element in HEAP, which must not be
+   empty. */
+struct heap_elem *
+heap_top (const struct heap *heap)
+{
+  ASSERT (!heap_empty (heap));
+  return heap->root;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_push (struct heap *heap, struct heap_elem *elem)
+{
+  ASSERT (elem != NULL);
+
+  elem->child = elem->next = elem->prev = NULL;
+  heap->root = heap->root != NULL ? meld (heap, heap->root, elem) : elem;
+}
+
+/* Removes the greatest element from HEAP, which must not be
+   empty, and returns it. */
+struct heap_elem *
+heap_pop (struct heap *heap)
+{
+  struct heap_elem *top = heap_top (heap);
+
+  heap->root = merge_pairs (heap, top->child);
+  return top;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem)
+{
+  struct heap_elem *sub;
+
+  if (elem == heap->root)
+    {
+      heap_pop (heap);
+      return;
+    }
+
+  cut (elem);
+  sub = merge_pairs (heap, elem->child);
+  if (sub != NULL)
+    heap->root = meld (heap, heap->root, sub);
+}
+
+/* Restores HEAP's order after ELEM, which is in HEAP, has become
+   greater. */
+void
+heap_increase (struct heap *heap, struct heap_elem *elem)
+{
+  if (elem == heap->root)
+    return;
+
+  /* ELEM is still the greatest of its own subtree, which can
+     therefore move as a whole. */
+  cut (elem);
+  heap->root = meld (heap, heap->root, elem);
+}
+
+/* Joins the trees rooted at A and B, the lesser becoming the
+   first child of the greater, and returns the new root. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b)
+{
+  if (heap->less (a, b, heap->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  a->prev = a->next = NULL;
+  return a;
+}
+
+/* Melds the list of sibling trees starting at FIRST into one
+   tree and returns its root, or a null pointer if FIRST is
+   null.  Pairs are joined from the front, and the results then
+   from the back, which is what keeps pops cheap over time. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first)
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+
+      if (b != NULL)
+        {
+          first = b->next;
+          a = meld (heap, a, b);
+        }
+      else
+        first = NULL;
+      a->next = pairs;
+      pairs = a;
+    }
+
+  while (pairs != NULL)
+    {
+      struct heap_elem *a = pairs;
+
+      pairs = a->next;
+      a->prev = a->next = NULL;
+      root = root != NULL ? meld (heap, root, a) : a;
+    }
+  return root;
+}
+
+/* Detaches the subtree rooted at ELEM, which must not be a root,
+   from its parent and siblings. */
+static void
+cut (struct heap_elem *elem)
+{
+  ASSERT (elem->prev != NULL);
+
+  if (elem->prev->child == elem)
+    elem->prev->child = elem->next;
+  else
+    elem->prev->next = elem->next;
+  if (elem->next != NULL)
+    elem->next->prev = elem->prev;
+  elem->prev = elem->next = NULL;
+}
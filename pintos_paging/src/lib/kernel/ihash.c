@@ -0,0 +1,183 @@
+/* Hash table of integer keys, with open addressing.
+
+   See ihash.h for basic information. */
+
+#include "ihash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Smallest number of slots of a non-empty table. */
+#define MIN_SLOTS 8
+
+static bool resize (struct ihash *, size_t slot_cnt);
+
+/* Returns the slot where a search for KEY in H starts. */
+static inline size_t
+home_slot (const struct ihash *h, uintptr_t key)
+{
+  /* Fibonacci hashing: the top bits of the product depend on
+     all of the key's low bits, so that keys that differ only in
+     a few bits, such as page addresses, are spread too. */
+  uint32_t hash = (uint32_t) key * 2654435769u;
+  return hash >> (32 - __builtin_ctz (h->slot_cnt));
+}
+
+/* Returns the slot of H that holds KEY, or the free slot where
+   the search for it ends.  H must have a free slot. */
+static struct ihash_slot *
+find_slot (const struct ihash *h, uintptr_t key)
+{
+  size_t mask = h->slot_cnt - 1;
+  size_t i;
+
+  for (i = home_slot (h, key); ; i = (i + 1) & mask)
+    {
+      struct ihash_slot *s = &h->slots[i];
+      if (s->elem == NULL || s->key == key)
+        return s;
+    }
+}
+
+/* Initializes H as an empty table.  The table allocates no memory
+   until its first insertion. */
+void
+ihash_init (struct ihash *h)
+{
+  h->elem_cnt = 0;
+  h->slot_cnt = 0;
+  h->slots = NULL;
+}
+
+/* Destroys table H.  If DESTRUCTOR is non-null, it is first
+   called for each element, given AUX, and may free it. */
+void
+ihash_destroy (struct ihash *h, ihash_action_func *destructor, void *aux)
+{
+  if (destructor != NULL)
+    ihash_apply (h, destructor, aux);
+  free (h->slots);
+  ihash_init (h);
+}
+
+/* Inserts E into H and returns true.  Returns false, without
+   inserting E, if H already has an element with E's key or if
+   memory for more slots is not available. */
+bool
+ihash_insert (struct ihash *h, struct ihash_elem *e)
+{
+  struct ihash_slot *s;
+
+  ASSERT (e != NULL);
+
+  /* Keep the table at most 3/4 full, so that searches stay short
+     and always meet a free slot. */
+  if ((h->elem_cnt + 1) * 4 > h->slot_cnt * 3
+      && !resize (h, h->slot_cnt > 0 ? h->slot_cnt * 2 : MIN_SLOTS)
+      && h->elem_cnt + 1 >= h->slot_cnt)
+    return false;
+
+  s = find_slot (h, e->key);
+  if (s->elem != NULL)
+    return false;
+  s->key = e->key;
+  s->elem = e;
+  h->elem_cnt++;
+  return true;
+}
+
+/* Returns the element of H with KEY, or a null pointer if there
+   is none. */
+struct ihash_elem *
+ihash_find (const struct ihash *h, uintptr_t key)
+{
+  return h->elem_cnt > 0 ? find_slot (h, key)->elem : NULL;
+}
+
+/* Removes the element of H with KEY, and returns it, or a null
+   pointer if there is none. */
+struct ihash_elem *
+ihash_delete (struct ihash *h, uintptr_t key)
+{
+  size_t mask = h->slot_cnt - 1;
+  struct ihash_slot *s;
+  struct ihash_elem *found;
+  size_t hole, i;
+
+  if (h->elem_cnt == 0)
+    return NULL;
+  s = find_slot (h, key);
+  found = s->elem;
+  if (found == NULL)
+    return NULL;
+
+  /* Fill the hole with the next element of the run that may be
+     moved back into it, that is, whose home slot is not between
+     the hole and it, and repeat with the hole it leaves.  Searches
+     then still find every element without passing a free slot. */
+  hole = s - h->slots;
+  for (i = (hole + 1) & mask; h->slots[i].elem != NULL; i = (i + 1) & mask)
+    {
+      size_t home = home_slot (h, h->slots[i].key);
+      if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+          h->slots[hole] = h->slots[i];
+          hole = i;
+        }
+    }
+  h->slots[hole].elem = NULL;
+  h->elem_cnt--;
+
+  /* Shrinking is only worth it for a sparse table; if memory is
+     short, the table just stays as it is. */
+  if (h->slot_cnt > MIN_SLOTS && h->elem_cnt * 8 < h->slot_cnt)
+    resize (h, h->slot_cnt / 2);
+  return found;
+}
+
+/* Calls ACTION for each element of H in arbitrary order, given
+   AUX.  ACTION may free the element, but must not change H. */
+void
+ihash_apply (struct ihash *h, ihash_action_func *action, void *aux)
+{
+  size_t i;
+
+  ASSERT (action != NULL);
+
+  for (i = 0; i < h->slot_cnt; i++)
+    if (h->slots[i].elem != NULL)
+      action (h->slots[i].elem, aux);
+}
+
+/* Returns the number of elements in H. */
+size_t
+ihash_size (const struct ihash *h)
+{
+  return h->elem_cnt;
+}
+
+/* Moves the elements of H into a new array of SLOT_CNT slots, a
+   power of 2 larger than the number of elements.  Returns false,
+   leaving H unchanged, if memory is not available. */
+static bool
+resize (struct ihash *h, size_t slot_cnt)
+{
+  struct ihash_slot *old_slots = h->slots;
+  size_t old_slot_cnt = h->slot_cnt;
+  size_t i;
+
+  ASSERT (slot_cnt > h->elem_cnt);
+
+  h->slots = calloc (slot_cnt, sizeof *h->slots);
+  if (h->slots == NULL)
+    {
+      h->slots = old_slots;
+      return false;
+    }
+  h->slot_cnt = slot_cnt;
+
+  for (i = 0; i < old_slot_cnt; i++)
+    if (old_slots[i].elem != NULL)
+      *find_slot (h, old_slots[i].key) = old_slots[i];
+  free (old_slots);
+  return true;
+}
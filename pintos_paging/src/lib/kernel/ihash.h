@@ -0,0 +1,68 @@
+#ifndef __LIB_KERNEL_IHASH_H
+#define __LIB_KERNEL_IHASH_H
+
+/* Hash table of integer keys.
+
+   Like the hash table in hash.h, this table does not allocate
+   its elements: each structure that can be in one embeds a
+   struct ihash_elem member, which holds its key, and the
+   ihash_entry macro converts from the element back to the
+   structure.  Refer to lib/kernel/list.h for a detailed
+   explanation.
+
+   Unlike hash.h, it is keyed by an integer (or a pointer cast
+   to one), compared for equality only, and uses open addressing
+   with linear probing: the table is one array of slots, each
+   holding the key and a pointer to its element, so that a
+   search reads consecutive slots instead of following a list,
+   and never touches the elements it does not return.  The array
+   doubles when it is 3/4 full and halves when it is 1/8 full. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Hash table element. */
+struct ihash_elem
+  {
+    uintptr_t key;              /* Key, set before insertion. */
+  };
+
+/* Converts pointer to hash element IHASH_ELEM into a pointer to
+   the structure that IHASH_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the hash element. */
+#define ihash_entry(IHASH_ELEM, STRUCT, MEMBER)         \
+        ((STRUCT *) ((uint8_t *) (IHASH_ELEM)           \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Performs some operation on hash element E, given auxiliary
+   data AUX. */
+typedef void ihash_action_func (struct ihash_elem *e, void *aux);
+
+/* A slot of the table. */
+struct ihash_slot
+  {
+    uintptr_t key;              /* Copy of elem->key. */
+    struct ihash_elem *elem;    /* Element, or null if free. */
+  };
+
+/* Hash table. */
+struct ihash
+  {
+    size_t elem_cnt;            /* Number of elements in table. */
+    size_t slot_cnt;            /* Number of slots, 0 or a power of 2. */
+    struct ihash_slot *slots;   /* Array of `slot_cnt' slots. */
+  };
+
+void ihash_init (struct ihash *);
+void ihash_destroy (struct ihash *, ihash_action_func *, void *aux);
+
+bool ihash_insert (struct ihash *, struct ihash_elem *);
+struct ihash_elem *ihash_find (const struct ihash *, uintptr_t key);
+struct ihash_elem *ihash_delete (struct ihash *, uintptr_t key);
+void ihash_apply (struct ihash *, ihash_action_func *, void *aux);
+
+size_t ihash_size (const struct ihash *);
+
+#endif /* lib/kernel/ihash.h */
@@ -0,0 +1,141 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Limits of a back reference; see lz.h. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (LZ_MIN_MATCH + 15 + 255)
+#define LZ_MAX_DIST 4095
+
+/* Hashes the 3 bytes at P. */
+static inline unsigned
+lz_hash (const uint8_t *p)
+{
+  uint32_t x = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (x * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the SRC_LEN bytes at SRC into DST, which has room for
+   DST_CAP bytes, using STATE as scratch space.  SRC_LEN must be
+   less than 65536.
+   Returns the compressed size, or 0 if it would exceed DST_CAP. */
+size_t
+lz_compress (struct lz_state *state, const void *src_, size_t src_len,
+             void *dst_, size_t dst_cap)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0, op = 0;
+  size_t ctrl = 0;
+  unsigned item = 8;
+
+  ASSERT (src_len < 65536);
+  memset (state->hash, 0, sizeof state->hash);
+
+  while (ip < src_len)
+    {
+      size_t len = 0, dist = 0;
+
+      /* Start a new group. */
+      if (item == 8)
+        {
+          if (op >= dst_cap)
+            return 0;
+          ctrl = op++;
+          dst[ctrl] = 0;
+          item = 0;
+        }
+
+      /* Look for a match with the last occurrence of the next
+         3 bytes. */
+      if (ip + LZ_MIN_MATCH <= src_len)
+        {
+          unsigned h = lz_hash (src + ip);
+          size_t cand = state->hash[h];
+          state->hash[h] = ip;
+
+          if (cand < ip && ip - cand <= LZ_MAX_DIST
+              && !memcmp (src + cand, src + ip, LZ_MIN_MATCH))
+            {
+              size_t max = src_len - ip;
+              if (max > LZ_MAX_MATCH)
+                max = LZ_MAX_MATCH;
+              len = LZ_MIN_MATCH;
+              while (len < max && src[cand + len] == src[ip + len])
+                len++;
+              dist = ip - cand;
+            }
+        }
+
+      if (len >= LZ_MIN_MATCH)
+        {
+          size_t l = len - LZ_MIN_MATCH;
+          if (op + (l >= 15 ? 3 : 2) > dst_cap)
+            return 0;
+          dst[ctrl] |= 1 << item;
+          dst[op++] = dist & 0xff;
+          dst[op++] = ((dist >> 8) << 4) | (l < 15 ? l : 15);
+          if (l >= 15)
+            dst[op++] = l - 15;
+          ip += len;
+        }
+      else
+        {
+          if (op >= dst_cap)
+            return 0;
+          dst[op++] = src[ip++];
+        }
+      item++;
+    }
+  return op;
+}
+
+/* Decompresses the SRC_LEN bytes at SRC, produced by lz_compress(),
+   into DST, which has room for DST_CAP bytes.
+   Returns the decompressed size, or 0 if SRC is corrupt or does not
+   fit in DST_CAP bytes. */
+size_t
+lz_decompress (const void *src_, size_t src_len, void *dst_, size_t dst_cap)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t ip = 0, op = 0;
+
+  while (ip < src_len)
+    {
+      uint8_t ctrl = src[ip++];
+      unsigned item;
+
+      for (item = 0; item < 8 && ip < src_len; item++)
+        if (ctrl & (1 << item))
+          {
+            size_t dist, len;
+
+            if (ip + 2 > src_len)
+              return 0;
+            dist = src[ip] | ((src[ip + 1] >> 4) << 8);
+            len = src[ip + 1] & 15;
+            ip += 2;
+            if (len == 15)
+              {
+                if (ip >= src_len)
+                  return 0;
+                len += src[ip++];
+              }
+            len += LZ_MIN_MATCH;
+
+            if (dist == 0 || dist > op || op + len > dst_cap)
+              return 0;
+            /* Byte by byte: the source may overlap the destination. */
+            for (; len > 0; len--, op++)
+              dst[op] = dst[op - dist];
+          }
+        else
+          {
+            if (op >= dst_cap)
+              return 0;
+            dst[op++] = src[ip++];
+          }
+    }
+  return op;
+}
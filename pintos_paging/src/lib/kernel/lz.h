@@ -0,0 +1,31 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A small, fast LZ77 compressor.
+
+   The output is a sequence of groups, each a control byte followed
+   by up to 8 items: bit I of the control byte (from the least
+   significant) tells whether item I is a literal byte (0) or a
+   back reference (1).  A back reference is 2 bytes: 12 bits of
+   distance (1 to 4095) and 4 bits of length minus 3; a length
+   field of 15 is followed by a third byte that is added to it.
+   Runs (such as zeroed memory) thus compress to a few bytes per
+   273 input bytes. */
+
+#define LZ_HASH_BITS 12
+
+/* Scratch space for lz_compress(). */
+struct lz_state
+  {
+    uint16_t hash[1 << LZ_HASH_BITS];   /* Last position of a 3-byte prefix. */
+  };
+
+size_t lz_compress (struct lz_state *, const void *src, size_t src_len,
+                    void *dst, size_t dst_cap);
+size_t lz_decompress (const void *src, size_t src_len,
+                      void *dst, size_t dst_cap);
+
+#endif /* lib/kernel/lz.h */
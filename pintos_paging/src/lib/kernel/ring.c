@@ -0,0 +1,126 @@
+#include "ring.h"
+#include "../debug.h"
+#include <string.h>
+#include "threads/synch.h"
+
+/* Initializes R as an empty ring that stores its data in the
+   SIZE bytes of BUF.  SIZE must be a power of 2. */
+void
+ring_init (struct ring *r, void *buf, size_t size)
+{
+  ASSERT (buf != NULL);
+  ASSERT (size > 0 && (size & (size - 1)) == 0);
+
+  r->buf = buf;
+  r->size = size;
+  r->head = r->tail = 0;
+}
+
+/* Returns the number of bytes in R.  For the consumer, there are
+   at least this many; for the producer, at most. */
+size_t
+ring_count (const struct ring *r)
+{
+  return r->head - r->tail;
+}
+
+/* Returns the number of bytes that R has room for. */
+size_t
+ring_space (const struct ring *r)
+{
+  return r->size - ring_count (r);
+}
+
+/* Returns true if R holds no data. */
+bool
+ring_empty (const struct ring *r)
+{
+  return r->head == r->tail;
+}
+
+/* Returns true if R has no room for more data. */
+bool
+ring_full (const struct ring *r)
+{
+  return ring_count (r) == r->size;
+}
+
+/* Adds up to SIZE bytes from DATA to R, as many as it has room
+   for, and returns their number.  For the producer only. */
+size_t
+ring_write (struct ring *r, const void *data, size_t size)
+{
+  size_t head = r->head;
+  size_t ofs = head & (r->size - 1);
+  size_t first;
+
+  if (size > r->size - (head - r->tail))
+    size = r->size - (head - r->tail);
+
+  /* Copy up to the end of the buffer, then from its start. */
+  first = size < r->size - ofs ? size : r->size - ofs;
+  memcpy (r->buf + ofs, data, first);
+  memcpy (r->buf, (const uint8_t *) data + first, size - first);
+
+  /* The consumer must not see the new head before the data. */
+  barrier ();
+  r->head = head + size;
+  return size;
+}
+
+/* Adds up to CNT items of ITEM_SIZE bytes each from ITEMS to R,
+   as many whole items as it has room for, and returns their
+   number.  For the producer only. */
+size_t
+ring_enqueue (struct ring *r, const void *items, size_t item_size,
+              size_t cnt)
+{
+  size_t room = ring_space (r) / item_size;
+
+  ASSERT (item_size > 0);
+
+  if (cnt > room)
+    cnt = room;
+  ring_write (r, items, cnt * item_size);
+  return cnt;
+}
+
+/* Removes up to SIZE bytes from R, as many as it holds, into
+   DATA, and returns their number.  For the consumer only. */
+size_t
+ring_read (struct ring *r, void *data, size_t size)
+{
+  size_t tail = r->tail;
+  size_t ofs = tail & (r->size - 1);
+  size_t first;
+
+  if (size > r->head - tail)
+    size = r->head - tail;
+
+  /* The data must not be read before the head that covers it. */
+  barrier ();
+  first = size < r->size - ofs ? size : r->size - ofs;
+  memcpy (data, r->buf + ofs, first);
+  memcpy ((uint8_t *) data + first, r->buf, size - first);
+
+  /* The producer must not reuse the space before it is read. */
+  barrier ();
+  r->tail = tail + size;
+  return size;
+}
+
+/* Removes up to CNT items of ITEM_SIZE bytes each from R, as
+   many whole items as it holds, into ITEMS, and returns their
+   number.  For the consumer only. */
+size_t
+ring_dequeue (struct ring *r, void *items, size_t item_size, size_t cnt)
+{
+  size_t avail = ring_count (r) / item_size;
+
+  ASSERT (item_size > 0);
+
+  if (cnt > avail)
+    cnt = avail;
+  ring_read (r, items, cnt * item_size);
+  return cnt;
+}
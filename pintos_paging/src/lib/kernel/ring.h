@@ -0,0 +1,52 @@
+#ifndef __LIB_KERNEL_RING_H
+#define __LIB_KERNEL_RING_H
+
+/* Single-producer, single-consumer ring buffer.
+
+   One thread or interrupt handler adds data to a ring and one
+   other removes it, without a lock and without turning
+   interrupts off: only the producer writes HEAD and only the
+   consumer writes TAIL, and each one updates its index only
+   after the data it covers has been written or read.  x86 does
+   not reorder stores with other stores, or loads with other
+   loads, so a compiler barrier is enough to keep that order, even
+   between CPUs.  Several producers, or several consumers, must
+   exclude one another by other means, such as a lock.
+
+   The buffer size is a power of 2, and HEAD and TAIL count all
+   the bytes ever added and removed, so that a ring can be
+   completely full.  ring_write() and ring_read() move bytes;
+   ring_enqueue() and ring_dequeue() move whole items of any
+   size. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A ring buffer. */
+struct ring
+  {
+    uint8_t *buf;               /* Buffer. */
+    size_t size;                /* Size of BUF, a power of 2. */
+    volatile size_t head;       /* Bytes added, by the producer. */
+    volatile size_t tail;       /* Bytes removed, by the consumer. */
+  };
+
+void ring_init (struct ring *, void *buf, size_t size);
+
+size_t ring_count (const struct ring *);
+size_t ring_space (const struct ring *);
+bool ring_empty (const struct ring *);
+bool ring_full (const struct ring *);
+
+/* Producer side. */
+size_t ring_write (struct ring *, const void *, size_t size);
+size_t ring_enqueue (struct ring *, const void *items, size_t item_size,
+                     size_t cnt);
+
+/* Consumer side. */
+size_t ring_read (struct ring *, void *, size_t size);
+size_t ring_dequeue (struct ring *, void *items, size_t item_size,
+                     size_t cnt);
+
+#endif /* lib/kernel/ring.h */
@@ -3,6 +3,7 @@
 #include <random.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Converts a string representation of a signed decimal integer
    in S into an `int', which is returned. */
@@ -48,55 +49,138 @@ compare_thunk (const void *a, const void *b, void *aux)
   return (*compare) (a, b);
 }
 
+/* A word, as swap_elems() moves the elements it swaps.  It may
+   alias any other type. */
+typedef uint32_t word_t __attribute__ ((__may_alias__));
+
+/* Subarrays of at most this many elements are insertion sorted:
+   below it, that does fewer comparisons and moves than going on
+   partitioning. */
+#define INSERTION_CUTOFF 12
+
+/* An array being sorted, and how to compare its elements: through
+   COMPARE with AUX for sort(), or straight through QCOMPARE for
+   qsort(), which saves a call through compare_thunk() per
+   comparison. */
+struct sorter
+  {
+    size_t size;                /* Element size in bytes. */
+    int (*compare) (const void *, const void *, void *aux);
+    int (*qcompare) (const void *, const void *);
+    void *aux;                  /* For COMPARE. */
+  };
+
+static void introsort (const struct sorter *, unsigned char *array,
+                       size_t cnt);
+
 /* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
    using COMPARE.  When COMPARE is passed a pair of elements A
    and B, respectively, it must return a strcmp()-type result,
    i.e. less than zero if A < B, zero if A == B, greater than
-   zero if A > B.  Runs in O(n lg n) time and O(1) space in
+   zero if A > B.  Runs in O(n lg n) time and O(lg n) space in
    CNT. */
 void
 qsort (void *array, size_t cnt, size_t size,
        int (*compare) (const void *, const void *)) 
 {
-  sort (array, cnt, size, compare_thunk, &compare);
+  struct sorter s;
+
+  ASSERT (array != NULL || cnt == 0);
+  ASSERT (compare != NULL);
+  ASSERT (size > 0);
+
+  s.size = size;
+  s.compare = NULL;
+  s.qcompare = compare;
+  s.aux = NULL;
+  introsort (&s, array, cnt);
 }
 
-/* Swaps elements with 1-based indexes A_IDX and B_IDX in ARRAY
-   with elements of SIZE bytes each. */
+/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
+   using COMPARE to compare elements, passing AUX as auxiliary
+   data.  When COMPARE is passed a pair of elements A and B,
+   respectively, it must return a strcmp()-type result, i.e. less
+   than zero if A < B, zero if A == B, greater than zero if A >
+   B.  Runs in O(n lg n) time and O(lg n) space in CNT. */
+void
+sort (void *array, size_t cnt, size_t size,
+      int (*compare) (const void *, const void *, void *aux),
+      void *aux) 
+{
+  struct sorter s;
+
+  ASSERT (array != NULL || cnt == 0);
+  ASSERT (compare != NULL);
+  ASSERT (size > 0);
+
+  s.size = size;
+  s.compare = compare;
+  s.qcompare = NULL;
+  s.aux = aux;
+  introsort (&s, array, cnt);
+}
+
+/* Compares elements A and B as S says, and returns a
+   strcmp()-type result. */
+static inline int
+elem_compare (const struct sorter *s, const unsigned char *a,
+              const unsigned char *b)
+{
+  return (s->qcompare != NULL
+          ? s->qcompare (a, b)
+          : s->compare (a, b, s->aux));
+}
+
+/* Swaps elements A and B, of SIZE bytes each: a word at a time
+   if both are word aligned and SIZE is a multiple of a word, as
+   is the case for arrays of ints and pointers. */
 static void
-do_swap (unsigned char *array, size_t a_idx, size_t b_idx, size_t size)
+swap_elems (unsigned char *a, unsigned char *b, size_t size)
 {
-  unsigned char *a = array + (a_idx - 1) * size;
-  unsigned char *b = array + (b_idx - 1) * size;
-  size_t i;
+  if ((((uintptr_t) a | (uintptr_t) b | size) & (sizeof (word_t) - 1)) == 0)
+    {
+      word_t *x = (word_t *) a;
+      word_t *y = (word_t *) b;
+      size_t i;
 
-  for (i = 0; i < size; i++)
+      for (i = 0; i < size / sizeof (word_t); i++)
+        {
+          word_t t = x[i];
+          x[i] = y[i];
+          y[i] = t;
+        }
+    }
+  else
     {
-      unsigned char t = a[i];
-      a[i] = b[i];
-      b[i] = t;
+      size_t i;
+
+      for (i = 0; i < size; i++)
+        {
+          unsigned char t = a[i];
+          a[i] = b[i];
+          b[i] = t;
+        }
     }
 }
 
-/* Compares elements with 1-based indexes A_IDX and B_IDX in
-   ARRAY with elements of SIZE bytes each, using COMPARE to
-   compare elements, passing AUX as auxiliary data, and returns a
-   strcmp()-type result. */
-static int
-do_compare (unsigned char *array, size_t a_idx, size_t b_idx, size_t size,
-            int (*compare) (const void *, const void *, void *aux),
-            void *aux) 
+/* Sorts the CNT elements of ARRAY by inserting each one in turn
+   into the sorted ones before it. */
+static void
+insertion_sort (const struct sorter *s, unsigned char *array, size_t cnt)
 {
-  return compare (array + (a_idx - 1) * size, array + (b_idx - 1) * size, aux);
+  unsigned char *end = array + cnt * s->size;
+  unsigned char *p, *q;
+
+  for (p = array + s->size; p < end; p += s->size)
+    for (q = p; q > array && elem_compare (s, q - s->size, q) > 0;
+         q -= s->size)
+      swap_elems (q - s->size, q, s->size);
 }
 
 /* "Float down" the element with 1-based index I in ARRAY of CNT
-   elements of SIZE bytes each, using COMPARE to compare
-   elements, passing AUX as auxiliary data. */
+   elements. */
 static void
-heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
-         int (*compare) (const void *, const void *, void *aux),
-         void *aux) 
+heapify (const struct sorter *s, unsigned char *array, size_t i, size_t cnt)
 {
   for (;;) 
     {
@@ -105,10 +189,13 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
       size_t left = 2 * i;
       size_t right = 2 * i + 1;
       size_t max = i;
-      if (left <= cnt && do_compare (array, left, max, size, compare, aux) > 0)
+      if (left <= cnt
+          && elem_compare (s, array + (left - 1) * s->size,
+                           array + (max - 1) * s->size) > 0)
         max = left;
       if (right <= cnt
-          && do_compare (array, right, max, size, compare, aux) > 0) 
+          && elem_compare (s, array + (right - 1) * s->size,
+                           array + (max - 1) * s->size) > 0)
         max = right;
 
       /* If the maximum value is already in element I, we're
@@ -117,38 +204,111 @@ heapify (unsigned char *array, size_t i, size_t cnt, size_t size,
         break;
 
       /* Swap and continue down the heap. */
-      do_swap (array, i, max, size);
+      swap_elems (array + (i - 1) * s->size, array + (max - 1) * s->size,
+                  s->size);
       i = max;
     }
 }
 
-/* Sorts ARRAY, which contains CNT elements of SIZE bytes each,
-   using COMPARE to compare elements, passing AUX as auxiliary
-   data.  When COMPARE is passed a pair of elements A and B,
-   respectively, it must return a strcmp()-type result, i.e. less
-   than zero if A < B, zero if A == B, greater than zero if A >
-   B.  Runs in O(n lg n) time and O(1) space in CNT. */
-void
-sort (void *array, size_t cnt, size_t size,
-      int (*compare) (const void *, const void *, void *aux),
-      void *aux) 
+/* Sorts the CNT elements of ARRAY by heapsort, which is
+   O(n lg n) whatever their order. */
+static void
+heap_sort (const struct sorter *s, unsigned char *array, size_t cnt)
 {
   size_t i;
 
-  ASSERT (array != NULL || cnt == 0);
-  ASSERT (compare != NULL);
-  ASSERT (size > 0);
-
   /* Build a heap. */
   for (i = cnt / 2; i > 0; i--)
-    heapify (array, i, cnt, size, compare, aux);
+    heapify (s, array, i, cnt);
 
   /* Sort the heap. */
   for (i = cnt; i > 1; i--) 
     {
-      do_swap (array, 1, i, size);
-      heapify (array, 1, i - 1, size, compare, aux); 
+      swap_elems (array, array + (i - 1) * s->size, s->size);
+      heapify (s, array, 1, i - 1);
+    }
+}
+
+/* Sorts the CNT elements of ARRAY by introsort: quicksort, taking
+   the median of the first, middle and last elements as the pivot,
+   down to subarrays of INSERTION_CUTOFF elements, which are
+   insertion sorted.  A subarray that is still large after
+   2 lg CNT levels of partitioning has pivots that split it badly,
+   and is heapsorted instead.  Recurses into the smaller side of
+   each partition only, so that the stack stays O(lg n). */
+static void
+introsort (const struct sorter *s, unsigned char *array, size_t cnt)
+{
+  size_t size = s->size;
+  int depth = 0;
+  size_t n;
+
+  for (n = cnt; n > 1; n /= 2)
+    depth += 2;
+
+  while (cnt > INSERTION_CUTOFF)
+    {
+      unsigned char *mid = array + cnt / 2 * size;
+      unsigned char *last = array + (cnt - 1) * size;
+      unsigned char *i, *j;
+      size_t left_cnt, right_cnt;
+
+      if (depth-- == 0)
+        {
+          heap_sort (s, array, cnt);
+          return;
+        }
+
+      /* Order the first, middle and last elements, then move the
+         median to the front as the pivot.  The last one, no less
+         than the pivot, stops the upward scan below. */
+      if (elem_compare (s, mid, array) < 0)
+        swap_elems (mid, array, size);
+      if (elem_compare (s, last, mid) < 0)
+        {
+          swap_elems (last, mid, size);
+          if (elem_compare (s, mid, array) < 0)
+            swap_elems (mid, array, size);
+        }
+      swap_elems (array, mid, size);
+
+      /* Partition around the pivot: elements no greater than it
+         end up before J, elements no less after it.  Stopping at
+         elements equal to the pivot keeps runs of equal elements
+         from partitioning badly. */
+      i = array;
+      j = array + cnt * size;
+      for (;;)
+        {
+          do
+            i += size;
+          while (elem_compare (s, i, array) < 0);
+          do
+            j -= size;
+          while (elem_compare (s, array, j) < 0);
+          if (i >= j)
+            break;
+          swap_elems (i, j, size);
+        }
+      swap_elems (array, j, size);
+
+      /* Sort the smaller side by recursion, the larger by going
+         around again. */
+      left_cnt = (j - array) / size;
+      right_cnt = cnt - left_cnt - 1;
+      if (left_cnt < right_cnt)
+        {
+          introsort (s, array, left_cnt);
+          array = j + size;
+          cnt = right_cnt;
+        }
+      else
+        {
+          introsort (s, j + size, right_cnt);
+          cnt = left_cnt;
+        }
     }
+  insertion_sort (s, array, cnt);
 }
 
 /* Searches ARRAY, which contains CNT elements of SIZE bytes
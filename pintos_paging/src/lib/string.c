@@ -1,5 +1,10 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* A word, as memcmp() reads the blocks it compares.  It may
+   alias any other type. */
+typedef uint32_t word_t __attribute__ ((__may_alias__));
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -9,11 +14,25 @@ memcpy (void *dst_, const void *src_, size_t size)
   unsigned char *dst = dst_;
   const unsigned char *src = src_;
 
+  size_t cnt;
+
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  /* Copy bytes up to a word boundary in DST, then whole words,
+     then the bytes left over. */
+  cnt = -(uintptr_t) dst & 3;
+  if (cnt > size)
+    cnt = size;
+  size -= cnt;
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+  cnt = size / 4;
+  asm volatile ("rep movsl"
+                : "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+  cnt = size % 4;
+  asm volatile ("rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
 
   return dst_;
 }
@@ -58,6 +77,11 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip the equal words, then find the differing byte. */
+  for (; size >= sizeof (word_t); a += sizeof (word_t),
+                                  b += sizeof (word_t), size -= sizeof (word_t))
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -279,11 +303,22 @@ void *
 memset (void *dst_, int value, size_t size) 
 {
   unsigned char *dst = dst_;
+  uint32_t word = (unsigned char) value * 0x01010101u;
+  size_t cnt;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  /* Set bytes up to a word boundary, then whole words, then the
+     bytes left over.  STOSB stores the low byte of WORD. */
+  cnt = -(uintptr_t) dst & 3;
+  if (cnt > size)
+    cnt = size;
+  size -= cnt;
+  asm volatile ("rep stosb" : "+D" (dst), "+c" (cnt) : "a" (word) : "memory");
+  cnt = size / 4;
+  asm volatile ("rep stosl" : "+D" (dst), "+c" (cnt) : "a" (word) : "memory");
+  cnt = size % 4;
+  asm volatile ("rep stosb" : "+D" (dst), "+c" (cnt) : "a" (word) : "memory");
 
   return dst_;
 }
@@ -1,6 +1,9 @@
 #ifndef __LIB_SYSCALL_NR_H
 #define __LIB_SYSCALL_NR_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* System call numbers. */
 enum 
   {
@@ -28,7 +31,382 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_MADVISE,                /* Give access hints for a memory region. */
+    SYS_PREAD,                  /* Read from a file at a given position. */
+    SYS_PWRITE,                 /* Write to a file at a given position. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_COPY_FILE_RANGE,        /* Copy data from one file to another. */
+    SYS_FSYNC,                  /* Write a file's data back to disk. */
+    SYS_SYNC,                   /* Write all file system data back. */
+    SYS_FALLOCATE,              /* Reserve disk space for a file. */
+    SYS_FSSTATS,                /* Get file system counters. */
+    SYS_BLKSTATS,               /* Get a block device's counters. */
+    SYS_CLOCK,                  /* Get the monotonic clock, in ns. */
+    SYS_USLEEP,                 /* Sleep for some microseconds. */
+    SYS_MEMSTATS,               /* Get kernel memory counters. */
+    SYS_IO_SETUP,               /* Register an I/O ring. */
+    SYS_IO_ENTER,               /* Carry out operations queued on it. */
+    SYS_SBRK,                   /* Move the end of the heap. */
+    SYS_THREAD_CREATE,          /* Start another thread in the process. */
+    SYS_THREAD_JOIN,            /* Wait for a thread to exit. */
+    SYS_THREAD_EXIT,            /* End the calling thread. */
+    SYS_FUTEX_WAIT,             /* Block while a user word holds a value. */
+    SYS_FUTEX_WAKE,             /* Wake threads blocked on a user word. */
+    SYS_SHM_MAP,                /* Map a shared-memory object. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_LOCKSTATS,              /* Get a kernel lock's counters. */
+    SYS_GETRUSAGE,              /* Get resource usage counters. */
+    SYS_SCHEDSTATS,             /* Get scheduling latency histograms. */
+    SYS_BOOTSTATS,              /* Get the time taken by each boot phase. */
+    SYS_MLOCK,                  /* Lock a memory region in memory. */
+    SYS_MUNLOCK,                /* Unlock it. */
+    SYS_FORK,                   /* Copy this process. */
+    SYS_SWAPON,                 /* Swap to a file as well. */
+    SYS_WSSTATS,                /* Get the process's working set. */
+    SYS_INTRSTATS,              /* Get an interrupt vector's counters. */
+    SYS_GETDENTS,               /* Read many directory entries. */
+    SYS_SPAWN,                  /* Start a process, not awaiting its load. */
+    SYS_LOAD_STATUS,            /* Whether a spawned child has loaded. */
+    SYS_PROFIL,                 /* Profile the process's user code. */
+    SYS_SCHED_GROUP,            /* Start a fair-share scheduling group. */
+    SYS_CHECKPOINT,             /* Save the process to a file. */
+    SYS_TUNABLE_GET,            /* Get a kernel tunable. */
+    SYS_TUNABLE_SET             /* Set a kernel tunable. */
+  };
+
+/* Weights of scheduling groups, for SYS_SCHED_GROUP.  Groups with
+   threads ready at the same priority share the CPU in proportion
+   to their weights. */
+#define SCHED_WEIGHT_MIN        1
+#define SCHED_WEIGHT_DEFAULT    100     /* Of the group threads start in. */
+#define SCHED_WEIGHT_MAX        10000
+
+/* Load states of a child, as returned by SYS_LOAD_STATUS. */
+#define LOAD_PENDING    0       /* Still loading its executable. */
+#define LOAD_OK         1       /* Loaded; it may have exited since. */
+#define LOAD_FAILED     (-1)    /* Could not load, or not a child. */
+
+/* Access hints for SYS_MADVISE. */
+#define MADV_NORMAL     0       /* No particular pattern (default). */
+#define MADV_RANDOM     1       /* Random access: no readahead. */
+#define MADV_SEQUENTIAL 2       /* Sequential access: read ahead, and
+                                   drop pages soon after their use. */
+#define MADV_WILLNEED   3       /* Will be accessed soon: read in now. */
+#define MADV_DONTNEED   4       /* Not accessed soon: evict first. */
+
+/* A buffer for SYS_READV and SYS_WRITEV. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Its size in bytes. */
+  };
+
+/* Address at which every process has the time page mapped,
+   read-only, just below the executable (see lib/user/user.lds). */
+#define TIME_PAGE ((void *) 0x08047000)
+
+/* The time page.  The timer interrupt updates it on each tick, so
+   that clock_fast() can tell the time without a system call.
+   `seq' is odd while an update is under way; a reader retries if
+   it was odd, or changed while the rest was read.  The fields
+   after `ticks' are those of timer_ns() in devices/timer.c. */
+struct time_page
+  {
+    uint32_t seq;               /* Update count, times 2. */
+    uint32_t tick_ns;           /* Nanoseconds per timer tick. */
+    int64_t ticks;              /* Timer ticks since boot. */
+    uint64_t tsc_hz;            /* TSC cycles per second, 0 if unknown. */
+    uint64_t tsc_base;          /* TSC when the clock read NS_BASE. */
+    int64_t ns_base;            /* Nanoseconds since boot then. */
+  };
+
+/* File system counters, as filled in by SYS_FSSTATS.  They count
+   from boot. */
+struct fs_stats
+  {
+    /* Buffer cache. */
+    uint64_t cache_hits;        /* Sector lookups found in the cache. */
+    uint64_t cache_misses;      /* Sector lookups that took an entry. */
+    uint64_t readahead_reads;   /* Sectors read by readahead. */
+    uint64_t readahead_hits;    /* Of those, sectors used later. */
+
+    /* Directories. */
+    uint64_t dir_lookups;       /* Name searches. */
+    uint64_t dir_index_builds;  /* Directory indexes read from disk. */
+    uint64_t dir_entries_read;  /* Entries read by those and by scans. */
+
+    /* Inodes and free map. */
+    uint64_t inode_opens;       /* Calls to inode_open(). */
+    uint64_t inode_open_hits;   /* Of those, inodes already in memory. */
+    uint64_t free_map_flushes;  /* Free map write-backs. */
+    uint64_t free_map_sectors;  /* Free map file sectors written. */
+    uint64_t free_map_allocs;   /* Runs allocated with a hint. */
+    uint64_t free_map_far;      /* Of those, outside the hint's group. */
+    uint64_t prealloc_sectors;  /* Data sectors allocated ahead of need. */
+    uint64_t prealloc_trimmed;  /* Of those, given back unused. */
+    uint64_t discard_sectors;   /* Freed sectors the device was told of. */
+
+    /* Journal. */
+    uint64_t journal_commits;   /* Transactions written to the log. */
+    uint64_t journal_sectors;   /* Metadata sectors they logged. */
+    uint64_t journal_checkpoints; /* Times the log was started over. */
+
+    /* System calls (read, pread, readv and their write sides). */
+    uint64_t read_calls;        /* Read calls. */
+    uint64_t read_bytes;        /* Bytes they returned. */
+    uint64_t write_calls;       /* Write calls. */
+    uint64_t write_bytes;       /* Bytes they wrote. */
+  };
+
+/* Number of buckets in a block device latency histogram. */
+#define BLOCK_LATENCY_BUCKETS 32
+
+/* Counters of a block device, as filled in by SYS_BLKSTATS.  A
+   request is one transfer of consecutive sectors through the
+   device's driver; those queued on a partition are counted by the
+   disk that carries them out. */
+struct block_stats
+  {
+    char name[16];              /* Device name, e.g. "hda1". */
+    uint64_t reads;             /* Read requests. */
+    uint64_t writes;            /* Write requests. */
+    uint64_t read_sectors;      /* Sectors read. */
+    uint64_t write_sectors;     /* Sectors written. */
+    uint64_t flushes;           /* Write cache flushes. */
+    uint64_t discards;          /* Discard requests. */
+    uint64_t discard_sectors;   /* Sectors discarded. */
+    uint64_t sequential;        /* Requests starting where the last ended. */
+    uint64_t cycles;            /* Total service time, in TSC cycles. */
+    uint64_t latency[BLOCK_LATENCY_BUCKETS]; /* Requests whose service
+                                   time is in [2**i, 2**(i+1)) cycles. */
+    uint32_t queued;            /* Requests in the queue now. */
+    uint32_t max_queued;        /* Most requests ever queued. */
+  };
+
+/* Whose usage SYS_GETRUSAGE reports. */
+#define RUSAGE_SELF     0       /* The process, with its exited threads. */
+#define RUSAGE_THREAD   1       /* The calling thread alone. */
+
+/* Resource usage counters of a thread or process, as filled in by
+   SYS_GETRUSAGE.  Swap I/O is charged to the thread that carries
+   it out, which for swap-outs is the one that needed a frame. */
+struct rusage
+  {
+    uint64_t minor_faults;      /* Page faults served without I/O. */
+    uint64_t major_faults;      /* Page faults read from swap or a file. */
+    uint64_t swap_ins;          /* Pages read from swap. */
+    uint64_t swap_outs;         /* Pages written to swap. */
+    uint64_t evictions;         /* Its pages evicted, by anyone. */
+    uint64_t read_bytes;        /* Bytes returned by read calls. */
+    uint64_t write_bytes;       /* Bytes written by write calls. */
+    uint64_t voluntary_switches;   /* Times it blocked or exited. */
+    uint64_t involuntary_switches; /* Times it was preempted or yielded. */
+    uint64_t user_ticks;        /* Timer ticks in user mode. */
+    uint64_t kernel_ticks;      /* Timer ticks in the kernel. */
+  };
+
+/* Number of buckets in a scheduling latency histogram. */
+#define SCHED_LATENCY_BUCKETS 32
+
+/* Scheduling latency histograms, as filled in by SYS_SCHEDSTATS.
+   Bucket I of each counts the intervals that took between 2**I
+   and 2**(I+1) TSC cycles.  They count from boot. */
+struct sched_stats
+  {
+    uint64_t wakeup[SCHED_LATENCY_BUCKETS];  /* From a thread's wakeup
+                                   to its running. */
+    uint64_t preempt[SCHED_LATENCY_BUCKETS]; /* From a request for
+                                   preemption to the switch. */
+    uint64_t switches[SCHED_LATENCY_BUCKETS]; /* Of switch_threads(). */
+    uint64_t thread_wakeup[SCHED_LATENCY_BUCKETS]; /* Wakeups of the
+                                   calling thread alone. */
+    uint64_t irqoff_max;        /* Longest stretch with interrupts
+                                   off, in TSC cycles. */
+  };
+
+/* Counters of a kernel lock, as filled in by SYS_LOCKSTATS.  Only
+   locks the kernel names are counted.  They count from boot. */
+struct lock_stats
+  {
+    char name[16];              /* Lock name, e.g. "frame". */
+    uint64_t acquisitions;      /* Times acquired. */
+    uint64_t contended;         /* Of those, times it had to wait. */
+    int64_t wait_ns;            /* Total time spent waiting. */
+    int64_t max_hold_ns;        /* Longest time held. */
+  };
+
+/* Counters of an interrupt vector, as filled in by SYS_INTRSTATS.
+   They count from boot, in TSC cycles of the handler. */
+struct intr_stats
+  {
+    char name[16];              /* Vector name, e.g. "8254 Timer". */
+    uint64_t count;             /* Times taken with a handler. */
+    uint64_t cycles;            /* Total time in the handler. */
+    uint64_t max_cycles;        /* Longest time in the handler. */
+  };
+
+/* A directory entry, as packed by SYS_GETDENTS: the next one
+   starts RECLEN bytes after this one. */
+struct dirent
+  {
+    uint32_t ino;               /* Inode number. */
+    uint16_t reclen;            /* Length of this entry, a multiple of 4. */
+    uint8_t type;               /* DT_REG or DT_DIR. */
+    char name[];                /* Null terminated file name. */
+  };
+
+#define DT_REG 1                /* Regular file. */
+#define DT_DIR 2                /* Directory. */
+
+/* Counters of a page pool, in struct mem_stats. */
+struct mem_pool_stats
+  {
+    uint32_t pages;             /* Pages in the pool. */
+    uint32_t free_pages;        /* Pages free now. */
+    uint32_t peak_used;         /* Most pages ever in use at once. */
+    uint64_t allocs;            /* Successful allocations. */
+    uint64_t frees;             /* Frees. */
+    uint64_t failures;          /* Allocations that found too few pages. */
+  };
+
+/* Most malloc() size classes. */
+#define MEM_CLASS_MAX 10
+
+/* Counters of a malloc() size class, in struct mem_stats. */
+struct mem_class_stats
+  {
+    uint32_t block_size;        /* Size of its blocks in bytes. */
+    uint32_t arenas;            /* Pages divided into its blocks now. */
+    uint32_t peak_arenas;       /* Most such pages at once. */
+    uint32_t live;              /* Blocks allocated and not freed. */
+    uint64_t allocs;            /* Allocations. */
+    uint64_t frees;             /* Frees. */
+  };
+
+/* Kernel memory counters, as filled in by SYS_MEMSTATS.  They
+   count from boot. */
+struct mem_stats
+  {
+    struct mem_pool_stats kernel_pool; /* Page pool for the kernel. */
+    struct mem_pool_stats user_pool;   /* Page pool for user pages. */
+    uint32_t class_cnt;         /* Entries used in CLASSES. */
+    struct mem_class_stats classes[MEM_CLASS_MAX];
+    uint32_t big_live;          /* malloc() blocks of whole pages now. */
+    uint32_t big_pages;         /* Pages they take. */
+    uint64_t big_allocs;        /* Allocations of such blocks. */
+    uint32_t locked_frames;     /* User frames locked by mlock() now. */
+  };
+
+/* Number of buckets in an idle page age histogram. */
+#define WSS_BUCKETS 8
+
+/* Working-set estimate of the calling process, as filled in by
+   SYS_WSSTATS, from the last scan of the working-set scanner
+   (kernel option -wss).  All but RSS are zero if it is off. */
+struct ws_stats
+  {
+    uint32_t rss;               /* Frames the process owns now. */
+    uint32_t wss;               /* Frames referenced in the last
+                                   WSS_WINDOW scans. */
+    uint32_t idle[WSS_BUCKETS]; /* Frames by the scans they have been
+                                   idle for: 0 in bucket 0, and in
+                                   [2**(I-1), 2**I) in bucket I, the
+                                   last bucket taking all the rest. */
+    uint32_t window;            /* WSS_WINDOW, in scans. */
+    uint32_t interval_ms;       /* Time between two scans. */
+    uint64_t scans;             /* Scans since boot. */
+  };
+
+/* Phases of booting, in struct boot_stats. */
+enum boot_phase
+  {
+    BOOT_MEMORY,                /* Page and object allocators, paging. */
+    BOOT_INTERRUPTS,            /* Interrupt handlers and devices. */
+    BOOT_CALIBRATE,             /* timer_calibrate(). */
+    BOOT_CPUS,                  /* Other processors, the profiler. */
+    BOOT_BLOCK,                 /* Probing disks and partitions. */
+    BOOT_FILESYS,               /* filesys_init(), formatting too. */
+    BOOT_SWAP,                  /* Swap and the paging threads. */
+    BOOT_FSUTIL,                /* Actions before the first "run". */
+    BOOT_PHASE_CNT
+  };
+
+/* Time taken by each phase of booting, as filled in by
+   SYS_BOOTSTATS, in TSC cycles.  Boot ends as the first "run"
+   action starts, or after the last action if none is "run". */
+struct boot_stats
+  {
+    uint64_t cycles[BOOT_PHASE_CNT]; /* Indexed by enum boot_phase. */
+    uint64_t total;             /* From main() to the end of boot. */
+    uint64_t tsc_hz;            /* TSC cycles per second, 0 if unknown. */
+  };
+
+/* A kernel tunable, as filled in by SYS_TUNABLE_GET.  For
+   SYS_TUNABLE_SET, only NAME and VALUE are looked at. */
+struct tunable_info
+  {
+    char name[32];              /* E.g. "vm.fault_around". */
+    int64_t value;              /* Current value. */
+    int64_t min, max;           /* Bounds of its values. */
+  };
+
+/* Most buffers in one SYS_READV or SYS_WRITEV. */
+#define IOV_MAX 16
+
+/* Operations in a struct io_sqe.  Each completes with what the
+   corresponding system call would return. */
+#define IO_OP_NOP       0       /* Nothing; completes with 0. */
+#define IO_OP_READ      1       /* read (fd, buf, len). */
+#define IO_OP_WRITE     2       /* write (fd, buf, len). */
+#define IO_OP_PREAD     3       /* pread (fd, buf, len, offset). */
+#define IO_OP_PWRITE    4       /* pwrite (fd, buf, len, offset). */
+#define IO_OP_FSYNC     5       /* fsync (fd). */
+
+/* A submission queue entry: one operation for SYS_IO_ENTER. */
+struct io_sqe
+  {
+    uint32_t opcode;            /* IO_OP_*. */
+    int32_t fd;                 /* File descriptor. */
+    void *buf;                  /* Buffer, for reads and writes. */
+    uint32_t len;               /* Its size in bytes. */
+    uint32_t offset;            /* File offset, for pread and pwrite. */
+    uint32_t user_data;         /* Copied into the completion. */
+  };
+
+/* A completion queue entry: the outcome of one operation. */
+struct io_cqe
+  {
+    uint32_t user_data;         /* From the operation's submission. */
+    int32_t result;             /* What its system call returned. */
+  };
+
+/* Most entries in each queue of an I/O ring. */
+#define IO_RING_MAX 64
+
+/* A submission and completion queue pair, in the memory of a
+   process, that it registers with SYS_IO_SETUP.  The process
+   fills sq[sq_tail % entries] and advances sq_tail, for as many
+   operations as it likes, then makes one SYS_IO_ENTER call.  The
+   kernel carries the operations out in order, advancing sq_head,
+   and posts each outcome at cq[cq_tail % entries], advancing
+   cq_tail.  The process takes outcomes from cq_head.  Heads and
+   tails count up without wrapping at ENTRIES: a queue is empty
+   when its head equals its tail, and full when they are ENTRIES
+   apart.  The kernel stops taking operations while the completion
+   queue is full. */
+struct io_ring
+  {
+    uint32_t entries;           /* A power of 2, at most IO_RING_MAX. */
+    uint32_t sq_head;           /* Next operation the kernel takes. */
+    uint32_t sq_tail;           /* Next operation the process queues. */
+    uint32_t cq_head;           /* Next outcome the process takes. */
+    uint32_t cq_tail;           /* Next outcome the kernel posts. */
+    struct io_sqe sq[IO_RING_MAX];
+    struct io_cqe cq[IO_RING_MAX];
   };
 
 #endif /* lib/syscall-nr.h */
@@ -3,6 +3,16 @@
 #include <syscall.h>
 #include <syscall-nr.h>
 
+/* Standard output buffer.  Standard output is always the
+   console, so it is line buffered: it is flushed at each
+   new-line, when full, before the process writes to standard
+   output or reads standard input itself, and by exit() and
+   halt(). */
+static char stdout_buf[4096];
+static size_t stdout_len;
+
+static void stdout_putc (char);
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
 int
@@ -30,8 +40,9 @@ hprintf (int handle, const char *format, ...)
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
-  putchar ('\n');
+  while (*s != '\0')
+    stdout_putc (*s++);
+  stdout_putc ('\n');
 
   return 0;
 }
@@ -40,10 +51,30 @@ puts (const char *s)
 int
 putchar (int c) 
 {
-  char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
+  stdout_putc (c);
   return c;
 }
+
+/* Writes out what the standard output buffer holds. */
+void
+stdout_flush (void) 
+{
+  size_t len = stdout_len;
+
+  /* Empty the buffer first: write() flushes it too. */
+  stdout_len = 0;
+  if (len > 0)
+    write (STDOUT_FILENO, stdout_buf, len);
+}
+
+/* Adds C to the standard output buffer. */
+static void
+stdout_putc (char c) 
+{
+  stdout_buf[stdout_len++] = c;
+  if (c == '\n' || stdout_len >= sizeof stdout_buf)
+    stdout_flush ();
+}
 
 /* Auxiliary data for vhprintf_helper(). */
 struct vhprintf_aux 
@@ -55,6 +86,7 @@ struct vhprintf_aux
   };
 
 static void add_char (char, void *);
+static void add_stdout_char (char, void *);
 static void flush (struct vhprintf_aux *);
 
 /* Formats the printf() format specification FORMAT with
@@ -67,11 +99,25 @@ vhprintf (int handle, const char *format, va_list args)
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
-  __vprintf (format, args, add_char, &aux);
-  flush (&aux);
+  if (handle == STDOUT_FILENO)
+    __vprintf (format, args, add_stdout_char, &aux);
+  else
+    {
+      __vprintf (format, args, add_char, &aux);
+      flush (&aux);
+    }
   return aux.char_cnt;
 }
 
+/* Adds C to the standard output buffer, counting it in AUX. */
+static void
+add_stdout_char (char c, void *aux_) 
+{
+  struct vhprintf_aux *aux = aux_;
+  stdout_putc (c);
+  aux->char_cnt++;
+}
+
 /* Adds C to the buffer in AUX, flushing it if the buffer fills
    up. */
 static void
@@ -0,0 +1,215 @@
+#include <malloc.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A simple implementation of malloc() for user programs, on
+   memory obtained from the kernel with sbrk().
+
+   Small blocks come in size classes, the powers of 2 from 16
+   bytes to 2 kB, counting a header that records the block's
+   size.  When a class has no free block, a page is obtained
+   from sbrk() and cut up into blocks of the class, so that
+   blocks of one size sit together and a request is served
+   without searching.
+
+   Larger blocks are a whole number of pages obtained from
+   sbrk() on their own.  Once freed, they are kept in a list and
+   reused, first fit, for any large request they can hold.
+
+   Memory is never given back to the kernel. */
+
+/* Heap memory is obtained in multiples of this. */
+#define HEAP_PAGE 4096
+
+/* Smallest and largest size class, as powers of 2. */
+#define CLASS_MIN 4
+#define CLASS_MAX 11
+
+/* Header of a block, free or in use.  It keeps the rest of the
+   block 8-byte aligned. */
+struct block
+  {
+    size_t size;                /* Size, including the header. */
+    struct block *next;         /* Next free block, while free. */
+  };
+
+/* Free blocks of each size class, indexed by class. */
+static struct block *free_lists[CLASS_MAX + 1];
+
+/* Free large blocks. */
+static struct block *large_list;
+
+/* Extends the heap by SIZE bytes, a multiple of HEAP_PAGE, and
+   returns its new part, or a null pointer if the kernel refuses. */
+static void *
+more_core (size_t size)
+{
+  uintptr_t brk = (uintptr_t) sbrk (0);
+  size_t pad = -brk & (HEAP_PAGE - 1);
+  uint8_t *p;
+
+  if (brk == (uintptr_t) -1)
+    return NULL;
+  p = sbrk (pad + size);
+  return p != (void *) -1 ? p + pad : NULL;
+}
+
+/* Returns the size class of blocks of SIZE bytes, header
+   included. */
+static int
+size_class (size_t size)
+{
+  int class = CLASS_MIN;
+  while ((1u << class) < size)
+    class++;
+  return class;
+}
+
+/* Cuts a new page into free blocks of size class CLASS.
+   Returns false if out of memory. */
+static bool
+refill (int class)
+{
+  size_t size = 1u << class;
+  uint8_t *page = more_core (HEAP_PAGE);
+  size_t ofs;
+
+  if (page == NULL)
+    return false;
+  for (ofs = HEAP_PAGE; ofs > 0; ofs -= size)
+    {
+      struct block *b = (struct block *) (page + ofs - size);
+      b->size = size;
+      b->next = free_lists[class];
+      free_lists[class] = b;
+    }
+  return true;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct block *b;
+  size_t need;
+
+  if (size == 0 || size > SIZE_MAX - HEAP_PAGE - sizeof *b)
+    return NULL;
+  need = size + sizeof *b;
+
+  if (need <= 1u << CLASS_MAX)
+    {
+      int class = size_class (need);
+      if (free_lists[class] == NULL && !refill (class))
+        return NULL;
+      b = free_lists[class];
+      free_lists[class] = b->next;
+    }
+  else
+    {
+      struct block **bp;
+
+      need = ROUND_UP (need, HEAP_PAGE);
+      for (bp = &large_list; *bp != NULL; bp = &(*bp)->next)
+        if ((*bp)->size >= need)
+          break;
+
+      if (*bp != NULL)
+        {
+          b = *bp;
+          *bp = b->next;
+        }
+      else
+        {
+          b = more_core (need);
+          if (b == NULL)
+            return NULL;
+          b->size = need;
+        }
+    }
+  return b + 1;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (b != 0 && size / b != a)
+    return NULL;
+
+  /* Allocate and zero memory.  Freed blocks are reused as they
+     are, so the memory need not be zero already. */
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  else if (old_block != NULL)
+    {
+      struct block *b = (struct block *) old_block - 1;
+      size_t old_size = b->size - sizeof *b;
+      void *new_block;
+
+      if (new_size <= old_size)
+        return old_block;
+
+      new_block = malloc (new_size);
+      if (new_block != NULL)
+        {
+          memcpy (new_block, old_block, old_size);
+          free (old_block);
+        }
+      return new_block;
+    }
+  else
+    return malloc (new_size);
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct block *b;
+
+  if (p == NULL)
+    return;
+
+  b = (struct block *) p - 1;
+  if (b->size <= 1u << CLASS_MAX)
+    {
+      int class = size_class (b->size);
+      b->next = free_lists[class];
+      free_lists[class] = b;
+    }
+  else
+    {
+      b->next = large_list;
+      large_list = b;
+    }
+}
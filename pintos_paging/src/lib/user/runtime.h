@@ -0,0 +1,69 @@
+#ifndef __LIB_USER_RUNTIME_H
+#define __LIB_USER_RUNTIME_H
+
+/* The shared runtime.
+
+   The library in lib/ and lib/user is linked once more into an
+   image of its own, the file "runtime" (see lib/user/runtime.lds),
+   which load() maps into each process at RUNTIME_BASE: read-only
+   text, which all processes share a copy of, and private data.
+   A program linked against it, instead of against libc.a, calls
+   each library function through a slot of RUNTIME_SLOT_SIZE bytes
+   in the jump table at RUNTIME_BASE (lib/user/runtime.S), which
+   runtime-stubs.S gives the function's name.
+
+   This header is included by both of those assembly files, so it
+   holds only macros.  The slots are in the order below, so that
+   a program keeps working with a runtime built later: new
+   functions go at the end, and none is ever removed. */
+
+/* Address of the jump table, below the time page and the
+   executable (see lib/user/user.lds). */
+#define RUNTIME_BASE 0x04000000
+
+/* Bytes per jump: a 5-byte `jmp', padded. */
+#define RUNTIME_SLOT_SIZE 8
+
+/* Calls F(NAME) for each function in the table, in order. */
+#define RUNTIME_FUNCTIONS(F)                                    \
+  /* lib/string.c. */                                           \
+  F (memcpy) F (memmove) F (memchr) F (memcmp) F (memset)       \
+  F (strchr) F (strcmp) F (strcspn) F (strlcat) F (strlcpy)     \
+  F (strlen) F (strnlen) F (strpbrk) F (strrchr) F (strspn)     \
+  F (strstr) F (strtok_r)                                       \
+  /* lib/stdio.c, lib/user/console.c. */                        \
+  F (printf) F (snprintf) F (vsnprintf) F (vprintf) F (hprintf) \
+  F (vhprintf) F (puts) F (putchar) F (stdout_flush)            \
+  F (hex_dump) F (print_human_readable_size) F (__printf)       \
+  F (__vprintf)                                                 \
+  /* lib/stdlib.c. */                                           \
+  F (atoi) F (qsort) F (bsearch) F (sort) F (binary_search)     \
+  /* lib/random.c, lib/ustar.c, lib/user/debug.c. */            \
+  F (random_init) F (random_bytes) F (random_ulong)             \
+  F (ustar_make_header) F (ustar_parse_header)                  \
+  F (debug_panic) F (debug_backtrace)                           \
+  /* lib/arithmetic.c, called by GCC. */                        \
+  F (__divdi3) F (__moddi3) F (__udivdi3) F (__umoddi3)         \
+  /* lib/user/malloc.c, lib/user/synch.c. */                    \
+  F (malloc) F (calloc) F (realloc) F (free)                    \
+  F (mutex_init) F (mutex_lock) F (mutex_trylock)               \
+  F (mutex_unlock) F (cond_init) F (cond_wait) F (cond_signal)  \
+  F (cond_broadcast)                                            \
+  /* lib/user/syscall.c. */                                     \
+  F (syscall_probe) F (halt) F (exit) F (exec) F (spawn)        \
+  F (wait) F (load_status) F (fork) F (create) F (remove)       \
+  F (open) F (filesize) F (read) F (write) F (pread)            \
+  F (pwrite) F (readv) F (writev) F (seek) F (tell) F (close)   \
+  F (pipe) F (fsync) F (sync) F (fallocate)                     \
+  F (copy_file_range) F (mmap) F (munmap) F (madvise)           \
+  F (mlock) F (munlock) F (shm_map) F (sbrk) F (swapon)         \
+  F (chdir) F (mkdir) F (readdir) F (getdents) F (isdir)        \
+  F (inumber) F (thread_create) F (thread_exit)                 \
+  F (thread_join) F (futex_wait) F (futex_wake) F (usleep)      \
+  F (clock_ns) F (clock_fast) F (getrusage) F (profil)          \
+  F (checkpoint) F (sched_group) F (io_setup) F (io_enter)      \
+  F (memstats) F (wsstats) F (fsstats) F (blkstats)             \
+  F (lockstats) F (schedstats) F (intrstats) F (bootstats)      \
+  F (tunable_get) F (tunable_set)
+
+#endif /* lib/user/runtime.h */
@@ -0,0 +1,104 @@
+#include <synch.h>
+#include <limits.h>
+#include <syscall.h>
+
+/* Atomically stores NEW in *P and returns what it held. */
+static inline int
+atomic_xchg (int *p, int new)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Atomically stores NEW in *P if it holds OLD.  Returns what *P
+   held. */
+static inline int
+atomic_cmpxchg (int *p, int old, int new)
+{
+  asm volatile ("lock cmpxchgl %2, %1"
+                : "+a" (old), "+m" (*p) : "r" (new) : "memory");
+  return old;
+}
+
+/* Initializes M as free. */
+void
+mutex_init (struct mutex *m)
+{
+  m->state = 0;
+}
+
+/* Acquires M, sleeping in the kernel while another thread holds
+   it.  A thread that has to wait marks M as waited on (2), so
+   that its holder knows to wake somebody on release. */
+void
+mutex_lock (struct mutex *m)
+{
+  int c = atomic_cmpxchg (&m->state, 0, 1);
+
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = atomic_xchg (&m->state, 2);
+  while (c != 0)
+    {
+      futex_wait (&m->state, 2);
+      c = atomic_xchg (&m->state, 2);
+    }
+}
+
+/* Acquires M if it is free.  Returns nonzero on success. */
+int
+mutex_trylock (struct mutex *m)
+{
+  return atomic_cmpxchg (&m->state, 0, 1) == 0;
+}
+
+/* Releases M, which the current thread must hold. */
+void
+mutex_unlock (struct mutex *m)
+{
+  if (atomic_xchg (&m->state, 0) == 2)
+    futex_wake (&m->state, 1);
+}
+
+/* Initializes C. */
+void
+cond_init (struct condvar *c)
+{
+  c->seq = 0;
+}
+
+/* Atomically releases M and waits for C to be signaled, then
+   reacquires M.  As with the kernel's condition variables, the
+   caller must recheck its condition on return.
+
+   A signal between releasing M and sleeping changes C->seq, so
+   futex_wait() returns at once instead of missing it.  M is
+   retaken as waited on, since other threads may have been woken
+   along with this one. */
+void
+cond_wait (struct condvar *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock (m);
+  futex_wait (&c->seq, seq);
+  while (atomic_xchg (&m->state, 2) != 0)
+    futex_wait (&m->state, 2);
+}
+
+/* Wakes one thread waiting on C, if any. */
+void
+cond_signal (struct condvar *c)
+{
+  asm volatile ("lock incl %0" : "+m" (c->seq) : : "memory");
+  futex_wake (&c->seq, 1);
+}
+
+/* Wakes all threads waiting on C. */
+void
+cond_broadcast (struct condvar *c)
+{
+  asm volatile ("lock incl %0" : "+m" (c->seq) : : "memory");
+  futex_wake (&c->seq, INT_MAX);
+}
@@ -0,0 +1,31 @@
+#ifndef __LIB_USER_SYNCH_H
+#define __LIB_USER_SYNCH_H
+
+/* Mutex for the threads of one process.  Taking a free mutex or
+   releasing one nobody waits for does not enter the kernel. */
+struct mutex
+  {
+    int state;          /* 0: free, 1: held, 2: held, maybe waited on. */
+  };
+
+#define MUTEX_INITIALIZER { 0 }
+
+void mutex_init (struct mutex *);
+void mutex_lock (struct mutex *);
+int mutex_trylock (struct mutex *);
+void mutex_unlock (struct mutex *);
+
+/* Condition variable. */
+struct condvar
+  {
+    int seq;            /* Bumped by every signal. */
+  };
+
+#define CONDVAR_INITIALIZER { 0 }
+
+void cond_init (struct condvar *);
+void cond_wait (struct condvar *, struct mutex *);
+void cond_signal (struct condvar *);
+void cond_broadcast (struct condvar *);
+
+#endif /* lib/user/synch.h */
@@ -1,31 +1,51 @@
 #include <syscall.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
+/* True if system calls enter the kernel with SYSENTER instead
+   of "int $0x30".  Set by syscall_probe(). */
+static bool use_sysenter;
+
+/* Enters the kernel for a system call whose number and
+   arguments, ARGS_SIZE bytes in all, are on top of the stack,
+   then pops them.  SYSENTER saves nothing for the return to user
+   mode, so the stack pointer goes in ECX and the address to
+   return to in EDX, and both registers are clobbered. */
+#define SYSCALL_ENTER(ARGS_SIZE)                                \
+        "cmpb $0, %[fast]; je 1f; "                             \
+        "movl %%esp, %%ecx; movl $2f, %%edx; sysenter; "        \
+        "1: int $0x30; 2: addl $" #ARGS_SIZE ", %%esp"
+
+/* What a system call may clobber besides EAX. */
+#define SYSCALL_CLOBBERS "ecx", "edx", "cc", "memory"
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_ENTER (4)              \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter)                      \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; " SYSCALL_ENTER (8) \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [fast] "m" (use_sysenter)                      \
+               : SYSCALL_CLOBBERS);                             \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +55,13 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_ENTER (12)             \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
-                 [arg1] "r" (ARG1)                              \
-               : "memory");                                     \
+                 [arg1] "r" (ARG1),                             \
+                 [fast] "m" (use_sysenter)                      \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
@@ -51,19 +72,60 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_ENTER (16)             \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [fast] "m" (use_sysenter)                      \
+               : SYSCALL_CLOBBERS);                             \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; "                                  \
+             "pushl %[number]; " SYSCALL_ENTER (20)             \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
-                 [arg2] "r" (ARG2)                              \
-               : "memory");                                     \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3),                             \
+                 [fast] "m" (use_sysenter)                      \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
+/* Chooses how system calls enter the kernel.  The kernel enables
+   SYSENTER whenever the CPU supports it, so the same check
+   applies here: CPUID function 1 reports it in bit 11 of EDX,
+   except on early Pentium Pro processors that set the bit
+   without having the instruction. */
+void
+syscall_probe (void)
+{
+  unsigned eax, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  use_sysenter = (edx & (1 << 11)) != 0
+                 && !(family == 6 && model < 3 && stepping < 3);
+}
+
 void
 halt (void) 
 {
+  stdout_flush ();
   syscall0 (SYS_HALT);
   NOT_REACHED ();
 }
@@ -71,6 +133,7 @@ halt (void)
 void
 exit (int status)
 {
+  stdout_flush ();
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -87,6 +150,24 @@ wait (pid_t pid)
   return syscall1 (SYS_WAIT, pid);
 }
 
+pid_t
+spawn (const char *file)
+{
+  return (pid_t) syscall1 (SYS_SPAWN, file);
+}
+
+int
+load_status (pid_t pid)
+{
+  return syscall1 (SYS_LOAD_STATUS, pid);
+}
+
+int
+sched_group (unsigned weight)
+{
+  return syscall1 (SYS_SCHED_GROUP, weight);
+}
+
 bool
 create (const char *file, unsigned initial_size)
 {
@@ -114,12 +195,16 @@ filesize (int fd)
 int
 read (int fd, void *buffer, unsigned size)
 {
+  if (fd == STDIN_FILENO)
+    stdout_flush ();
   return syscall3 (SYS_READ, fd, buffer, size);
 }
 
 int
 write (int fd, const void *buffer, unsigned size)
 {
+  if (fd == STDOUT_FILENO)
+    stdout_flush ();
   return syscall3 (SYS_WRITE, fd, buffer, size);
 }
 
@@ -153,6 +238,18 @@ munmap (mapid_t mapid)
   syscall1 (SYS_MUNMAP, mapid);
 }
 
+mapid_t
+shm_map (const char *name, unsigned size, void *addr)
+{
+  return syscall3 (SYS_SHM_MAP, name, size, addr);
+}
+
+int
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
 bool
 chdir (const char *dir)
 {
@@ -182,3 +279,276 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+madvise (void *addr, size_t length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+mlock (const void *addr, size_t length)
+{
+  return syscall2 (SYS_MLOCK, addr, length);
+}
+
+int
+munlock (const void *addr, size_t length)
+{
+  return syscall2 (SYS_MUNLOCK, addr, length);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  if (fd == STDIN_FILENO)
+    stdout_flush ();
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  if (fd == STDOUT_FILENO)
+    stdout_flush ();
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned size)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, size);
+}
+
+int
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+int
+fallocate (int fd, unsigned length)
+{
+  return syscall2 (SYS_FALLOCATE, fd, length);
+}
+
+void
+fsstats (struct fs_stats *stats)
+{
+  syscall1 (SYS_FSSTATS, stats);
+}
+
+int
+blkstats (int index, struct block_stats *stats)
+{
+  return syscall2 (SYS_BLKSTATS, index, stats);
+}
+
+int
+lockstats (int index, struct lock_stats *stats)
+{
+  return syscall2 (SYS_LOCKSTATS, index, stats);
+}
+
+int
+getrusage (int who, struct rusage *usage)
+{
+  return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+int
+schedstats (struct sched_stats *stats)
+{
+  return syscall1 (SYS_SCHEDSTATS, stats);
+}
+
+void
+bootstats (struct boot_stats *stats)
+{
+  syscall1 (SYS_BOOTSTATS, stats);
+}
+
+int
+intrstats (int vec, struct intr_stats *stats)
+{
+  return syscall2 (SYS_INTRSTATS, vec, stats);
+}
+
+int
+tunable_get (int index, struct tunable_info *info)
+{
+  return syscall2 (SYS_TUNABLE_GET, index, info);
+}
+
+int
+tunable_set (const struct tunable_info *info)
+{
+  return syscall1 (SYS_TUNABLE_SET, info);
+}
+
+int
+getdents (unsigned *pos, struct dirent *buf, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, pos, buf, size);
+}
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
+
+/* Returns what clock_ns() would, read from the time page
+   without entering the kernel. */
+int64_t
+clock_fast (void)
+{
+  const volatile struct time_page *tp = TIME_PAGE;
+  uint32_t seq;
+  int64_t ticks, ns_base;
+  uint64_t tsc_hz, tsc_base, cycles;
+  uint32_t lo, hi;
+
+  do
+    {
+      seq = tp->seq;
+      asm volatile ("" : : : "memory");
+      ticks = tp->ticks;
+      tsc_hz = tp->tsc_hz;
+      tsc_base = tp->tsc_base;
+      ns_base = tp->ns_base;
+      asm volatile ("" : : : "memory");
+    }
+  while ((seq & 1) != 0 || tp->seq != seq);
+
+  if (tsc_hz == 0)
+    return ticks * tp->tick_ns;
+
+  /* As in timer_ns(). */
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  cycles = (((uint64_t) hi << 32) | lo) - tsc_base;
+  return ns_base + cycles / tsc_hz * 1000000000
+         + cycles % tsc_hz * 1000000000 / tsc_hz;
+}
+
+void
+usleep (unsigned us)
+{
+  syscall1 (SYS_USLEEP, us);
+}
+
+void
+memstats (struct mem_stats *stats)
+{
+  syscall1 (SYS_MEMSTATS, stats);
+}
+
+int
+io_setup (struct io_ring *ring)
+{
+  return syscall1 (SYS_IO_SETUP, ring);
+}
+
+int
+io_enter (unsigned to_submit)
+{
+  return syscall1 (SYS_IO_ENTER, to_submit);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+swapon (const char *file, int priority)
+{
+  return syscall2 (SYS_SWAPON, file, priority);
+}
+
+void
+wsstats (struct ws_stats *stats)
+{
+  syscall1 (SYS_WSSTATS, stats);
+}
+
+int
+profil (uint16_t *buf, size_t size, unsigned long offset, unsigned scale)
+{
+  return syscall4 (SYS_PROFIL, buf, size, offset, scale);
+}
+
+int
+checkpoint (const char *file)
+{
+  return syscall1 (SYS_CHECKPOINT, file);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+/* Where a thread made by thread_create() starts: the kernel
+   passes FUNC and AUX in registers.  The thread ends when FUNC
+   returns. */
+static void __attribute__ ((regparm (2), noreturn))
+thread_start (void (*func) (void *), void *aux)
+{
+  func (aux);
+  thread_exit ();
+}
+
+tid_t
+thread_create (void (*func) (void *), void *aux)
+{
+  return syscall3 (SYS_THREAD_CREATE, thread_start, func, aux);
+}
+
+int
+thread_join (tid_t tid)
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (void)
+{
+  stdout_flush ();
+  syscall0 (SYS_THREAD_EXIT);
+  NOT_REACHED ();
+}
+
+int
+futex_wait (int *addr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, val);
+}
+
+int
+futex_wake (int *addr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
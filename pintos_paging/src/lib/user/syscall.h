@@ -2,12 +2,18 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
+#include <syscall-nr.h>
 
 /* Process identifier. */
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
@@ -19,11 +25,17 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* Called by _start() before main(). */
+void syscall_probe (void);
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
 int wait (pid_t);
+pid_t spawn (const char *file);
+int load_status (pid_t);
+int sched_group (unsigned weight);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
@@ -37,6 +49,8 @@ void close (int fd);
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+mapid_t shm_map (const char *name, unsigned size, void *addr);
+int pipe (int fds[2]);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -45,4 +59,44 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int madvise (void *addr, size_t length, int advice);
+int mlock (const void *addr, size_t length);
+int munlock (const void *addr, size_t length);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+int fsync (int fd);
+void sync (void);
+int fallocate (int fd, unsigned length);
+void fsstats (struct fs_stats *);
+int blkstats (int index, struct block_stats *);
+int lockstats (int index, struct lock_stats *);
+int getrusage (int who, struct rusage *);
+int schedstats (struct sched_stats *);
+void bootstats (struct boot_stats *);
+int intrstats (int vec, struct intr_stats *);
+int tunable_get (int index, struct tunable_info *);
+int tunable_set (const struct tunable_info *);
+int getdents (unsigned *pos, struct dirent *, unsigned size);
+int64_t clock_ns (void);
+int64_t clock_fast (void);
+void usleep (unsigned us);
+void memstats (struct mem_stats *);
+int io_setup (struct io_ring *);
+int io_enter (unsigned to_submit);
+pid_t fork (void);
+bool swapon (const char *file, int priority);
+void wsstats (struct ws_stats *);
+int profil (uint16_t *buf, size_t size, unsigned long offset, unsigned scale);
+int checkpoint (const char *file);
+void *sbrk (intptr_t increment);
+tid_t thread_create (void (*func) (void *), void *aux);
+int thread_join (tid_t);
+void thread_exit (void) NO_RETURN;
+int futex_wait (int *, int val);
+int futex_wake (int *, int cnt);
+
 #endif /* lib/user/syscall.h */
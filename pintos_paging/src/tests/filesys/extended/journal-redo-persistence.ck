@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+fail "journal was not redone after the crash\n"
+  if !grep (/^journal: redid \d+ transactions$/,
+	    read_text_file ("$test.output"));
+check_archive ({'a' => {'b' => [random_bytes (5678)]}});
+pass;
@@ -0,0 +1,33 @@
+/* Makes a directory and a file in it durable with fsync(), with
+   the kernel run with -crash, so that it powers off without
+   writing anything else back.  The committed metadata is then
+   only in the journal, which the next boot must redo for the
+   persistence check to find them. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 5678
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  /* What the test was extracted with must survive the crash. */
+  msg ("sync");
+  sync ();
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK ((fd = open ("a/b")) > 1, "open \"a/b\"");
+  CHECK (write (fd, buf, sizeof buf) == FILE_SIZE,
+         "write \"a/b\"");
+  CHECK (fsync (fd) == 0, "fsync \"a/b\"");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-redo) begin
+(journal-redo) sync
+(journal-redo) mkdir "a"
+(journal-redo) create "a/b"
+(journal-redo) open "a/b"
+(journal-redo) write "a/b"
+(journal-redo) fsync "a/b"
+(journal-redo) end
+EOF
+pass;
@@ -0,0 +1,377 @@
+/* Microbenchmarks of the kernel library and allocators, in the
+   manner of bench-sched.c: each prints a line of KEY=VALUE pairs
+   per case, with times in CPU cycles as read by rdtsc().
+
+     bench-hash     hash_insert(), hash_find() and hash_delete() on a
+                    table of HASH_ELEMS, and the worst single insert,
+                    which is the one that rehashed the table.
+     bench-bitmap   bitmap_scan() for runs of 1 to 64 free bits in a
+                    bitmap whose free bits are scattered.
+     bench-list     list_insert_ordered() and list_sort() of long
+                    lists in random order.
+     bench-malloc   malloc() and free() in each size class.
+     bench-memcpy   memcpy() and memset() of 64 bytes to 32 kB.
+     bench-lz       lz_compress() and lz_decompress() of a page of
+                    random bytes, of zeros, and of a short repeated
+                    pattern, whose matches are all of the maximum
+                    length; each must round-trip exactly.
+
+   Run one with "pintos -- run bench-hash". */
+
+#include <bitmap.h>
+#include <hash.h>
+#include <inttypes.h>
+#include <list.h>
+#include <lz.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Returns the larger of A and B. */
+static uint64_t
+max_cycles (uint64_t a, uint64_t b)
+{
+  return a > b ? a : b;
+}
+
+/* Hash table. */
+
+#define HASH_ELEMS 4096
+
+struct hash_value
+  {
+    struct hash_elem elem;
+    unsigned key;
+  };
+
+static unsigned
+value_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct hash_value, elem)->key);
+}
+
+static bool
+value_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct hash_value, elem)->key
+          < hash_entry (b, struct hash_value, elem)->key);
+}
+
+void
+test_bench_hash (void)
+{
+  struct hash_value *values, probe;
+  struct hash h;
+  uint64_t start, insert, find, delete, worst = 0;
+  int i;
+
+  values = malloc (HASH_ELEMS * sizeof *values);
+  if (values == NULL || !hash_init (&h, value_hash, value_less, NULL))
+    fail ("out of memory");
+  for (i = 0; i < HASH_ELEMS; i++)
+    values[i].key = random_ulong ();
+
+  start = rdtsc ();
+  for (i = 0; i < HASH_ELEMS; i++)
+    {
+      uint64_t one = rdtsc ();
+      hash_insert (&h, &values[i].elem);
+      worst = max_cycles (worst, rdtsc () - one);
+    }
+  insert = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < HASH_ELEMS; i++)
+    {
+      probe.key = values[i].key;
+      if (hash_find (&h, &probe.elem) == NULL)
+        fail ("key %u not found", probe.key);
+    }
+  find = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < HASH_ELEMS; i++)
+    hash_delete (&h, &values[i].elem);
+  delete = rdtsc () - start;
+
+  hash_destroy (&h, NULL);
+  free (values);
+
+  msg ("elems=%d cycles_per_insert=%"PRIu64" cycles_per_find=%"PRIu64
+       " cycles_per_delete=%"PRIu64" insert_max=%"PRIu64,
+       HASH_ELEMS, insert / HASH_ELEMS, find / HASH_ELEMS,
+       delete / HASH_ELEMS, worst);
+}
+
+/* Bitmap scan. */
+
+#define BITMAP_BITS 16384
+#define BITMAP_SCANS 64
+
+/* Scans BITMAP_SCANS times for CNT free bits in B, starting at
+   spread-out places. */
+static void
+bench_scan (const struct bitmap *b, size_t cnt)
+{
+  uint64_t start, cycles;
+  unsigned found = 0;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < BITMAP_SCANS; i++)
+    if (bitmap_scan (b, i * (BITMAP_BITS / BITMAP_SCANS), cnt, false)
+        != BITMAP_ERROR)
+      found++;
+  cycles = rdtsc () - start;
+
+  msg ("bits=%d run=%zu found=%u/%d cycles_per_scan=%"PRIu64,
+       BITMAP_BITS, cnt, found, BITMAP_SCANS, cycles / BITMAP_SCANS);
+}
+
+/* Frees runs of 1 to 32 bits at random in a full bitmap, so that
+   short runs are easy to find and long ones rare. */
+void
+test_bench_bitmap (void)
+{
+  struct bitmap *b = bitmap_create (BITMAP_BITS);
+  size_t cnt;
+  int i;
+
+  if (b == NULL)
+    fail ("out of memory");
+  bitmap_set_all (b, true);
+  for (i = 0; i < BITMAP_BITS / 64; i++)
+    {
+      size_t len = random_ulong () % 32 + 1;
+      size_t idx = random_ulong () % (BITMAP_BITS - len);
+      bitmap_set_multiple (b, idx, len, false);
+    }
+
+  for (cnt = 1; cnt <= 64; cnt *= 4)
+    bench_scan (b, cnt);
+  bitmap_destroy (b);
+}
+
+/* Ordered lists. */
+
+#define LIST_ORDERED_ELEMS 2000
+#define LIST_SORT_ELEMS 20000
+
+struct list_value
+  {
+    struct list_elem elem;
+    int value;
+  };
+
+static bool
+list_value_less (const struct list_elem *a, const struct list_elem *b,
+                 void *aux UNUSED)
+{
+  return (list_entry (a, struct list_value, elem)->value
+          < list_entry (b, struct list_value, elem)->value);
+}
+
+/* Returns CNT list_values with random values. */
+static struct list_value *
+random_values (size_t cnt)
+{
+  struct list_value *values = malloc (cnt * sizeof *values);
+  size_t i;
+
+  if (values == NULL)
+    fail ("out of memory");
+  for (i = 0; i < cnt; i++)
+    values[i].value = random_ulong ();
+  return values;
+}
+
+void
+test_bench_list (void)
+{
+  struct list_value *values;
+  struct list list;
+  uint64_t start, cycles;
+  int i;
+
+  values = random_values (LIST_ORDERED_ELEMS);
+  list_init (&list);
+  start = rdtsc ();
+  for (i = 0; i < LIST_ORDERED_ELEMS; i++)
+    list_insert_ordered (&list, &values[i].elem, list_value_less, NULL);
+  cycles = rdtsc () - start;
+  free (values);
+  msg ("op=insert_ordered elems=%d cycles=%"PRIu64
+       " cycles_per_insert=%"PRIu64,
+       LIST_ORDERED_ELEMS, cycles, cycles / LIST_ORDERED_ELEMS);
+
+  values = random_values (LIST_SORT_ELEMS);
+  list_init (&list);
+  for (i = 0; i < LIST_SORT_ELEMS; i++)
+    list_push_back (&list, &values[i].elem);
+  start = rdtsc ();
+  list_sort (&list, list_value_less, NULL);
+  cycles = rdtsc () - start;
+  free (values);
+  msg ("op=sort elems=%d cycles=%"PRIu64" cycles_per_elem=%"PRIu64,
+       LIST_SORT_ELEMS, cycles, cycles / LIST_SORT_ELEMS);
+}
+
+/* Allocator. */
+
+#define MALLOC_BLOCKS 128
+
+/* Allocates MALLOC_BLOCKS blocks of each size class, from 16
+   bytes to 1 kB, and of 2 kB, which takes a page of its own,
+   then frees them all. */
+void
+test_bench_malloc (void)
+{
+  static void *blocks[MALLOC_BLOCKS];
+  size_t size;
+
+  for (size = 16; size <= PGSIZE / 2; size *= 2)
+    {
+      uint64_t start, alloc, release;
+      int i;
+
+      start = rdtsc ();
+      for (i = 0; i < MALLOC_BLOCKS; i++)
+        if ((blocks[i] = malloc (size)) == NULL)
+          fail ("malloc(%zu) failed after %d blocks", size, i);
+      alloc = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < MALLOC_BLOCKS; i++)
+        free (blocks[i]);
+      release = rdtsc () - start;
+
+      msg ("size=%zu blocks=%d cycles_per_malloc=%"PRIu64
+           " cycles_per_free=%"PRIu64,
+           size, MALLOC_BLOCKS, alloc / MALLOC_BLOCKS,
+           release / MALLOC_BLOCKS);
+    }
+}
+
+/* Memory copy and fill. */
+
+#define MEM_PAGES 16
+#define MEM_BYTES (MEM_PAGES * PGSIZE / 2)
+
+void
+test_bench_memcpy (void)
+{
+  uint8_t *buf = palloc_get_multiple (PAL_ZERO, MEM_PAGES);
+  size_t size;
+
+  if (buf == NULL)
+    fail ("out of memory");
+  for (size = 64; size <= MEM_BYTES; size *= 8)
+    {
+      size_t rounds = MEM_BYTES / size * 16;
+      uint64_t start, copy, fill;
+      size_t i;
+
+      start = rdtsc ();
+      for (i = 0; i < rounds; i++)
+        memcpy (buf + MEM_BYTES, buf, size);
+      copy = rdtsc () - start;
+
+      start = rdtsc ();
+      for (i = 0; i < rounds; i++)
+        memset (buf, i, size);
+      fill = rdtsc () - start;
+
+      msg ("size=%zu rounds=%zu memcpy_cycles=%"PRIu64
+           " memset_cycles=%"PRIu64" memcpy_bytes_per_kcycle=%"PRIu64
+           " memset_bytes_per_kcycle=%"PRIu64,
+           size, rounds, copy / rounds, fill / rounds,
+           (uint64_t) size * rounds * 1000 / (copy + 1),
+           (uint64_t) size * rounds * 1000 / (fill + 1));
+    }
+  palloc_free_multiple (buf, MEM_PAGES);
+}
+
+/* LZ compression. */
+
+#define LZ_ROUNDS 64
+
+/* Room for a page that does not compress: a control byte per 8
+   literals. */
+#define LZ_PACKED_MAX (PGSIZE + PGSIZE / 8 + 1)
+
+/* Compresses and decompresses PAGE, using PACKED and OUT as buffers,
+   LZ_ROUNDS times each, and checks that OUT ends up the same as
+   PAGE.  Returns the compressed size. */
+static size_t
+bench_lz (const char *name, const uint8_t *page, uint8_t *packed,
+          uint8_t *out)
+{
+  static struct lz_state state;
+  size_t packed_len = 0, out_len = 0;
+  uint64_t start, compress, decompress;
+  int i;
+
+  start = rdtsc ();
+  for (i = 0; i < LZ_ROUNDS; i++)
+    packed_len = lz_compress (&state, page, PGSIZE, packed, LZ_PACKED_MAX);
+  compress = rdtsc () - start;
+  if (packed_len == 0)
+    fail ("%s: lz_compress() failed", name);
+
+  start = rdtsc ();
+  for (i = 0; i < LZ_ROUNDS; i++)
+    out_len = lz_decompress (packed, packed_len, out, PGSIZE);
+  decompress = rdtsc () - start;
+  if (out_len != PGSIZE || memcmp (out, page, PGSIZE))
+    fail ("%s: page differs after decompression", name);
+
+  msg ("page=%s packed=%zu cycles_per_compress=%"PRIu64
+       " cycles_per_decompress=%"PRIu64,
+       name, packed_len, compress / LZ_ROUNDS, decompress / LZ_ROUNDS);
+  return packed_len;
+}
+
+void
+test_bench_lz (void)
+{
+  static struct lz_state state;
+  uint8_t *page = palloc_get_multiple (0, 4);
+  uint8_t *packed = page + PGSIZE;
+  uint8_t *out = page + 3 * PGSIZE;
+  size_t i;
+
+  if (page == NULL)
+    fail ("out of memory");
+
+  /* Random bytes have no matches, and grow by their control bytes:
+     they do not fit in a page. */
+  random_bytes (page, PGSIZE);
+  if (bench_lz ("random", page, packed, out) <= PGSIZE)
+    fail ("random page compressed");
+  if (lz_compress (&state, page, PGSIZE, packed, PGSIZE) != 0)
+    fail ("random page fit in a page");
+
+  /* Zeros are a literal and then matches of the maximum length. */
+  memset (page, 0, PGSIZE);
+  if (bench_lz ("zero", page, packed, out) > PGSIZE / 32)
+    fail ("zero page compressed poorly");
+  if (lz_decompress (packed, lz_compress (&state, page, PGSIZE, packed,
+                                          LZ_PACKED_MAX),
+                     out, PGSIZE - 1) != 0)
+    fail ("zero page decompressed into less than a page");
+
+  /* A repeated pattern, likewise, but at a distance of more than 1. */
+  random_bytes (page, 16);
+  for (i = 16; i < PGSIZE; i++)
+    page[i] = page[i - 16];
+  if (bench_lz ("repeat", page, packed, out) > PGSIZE / 32)
+    fail ("repeated page compressed poorly");
+
+  palloc_free_multiple (page, 4);
+}
@@ -0,0 +1,386 @@
+/* Microbenchmarks of the scheduler and the synchronization
+   primitives, for comparing one kernel against another rather than
+   for grading: each prints a line of KEY=VALUE pairs, with times in
+   CPU cycles as read by rdtsc().
+
+     bench-pingpong   two threads passing control back and forth
+                      through a pair of semaphores.
+     bench-lock       several threads contending for one lock, each
+                      yielding while it holds it.
+     bench-condvar    cond_broadcast() to 1, 8 and 32 waiters, timed
+                      until the last of them has run.
+     bench-sleep      many threads sleeping until the same tick: how
+                      late they wake and how far apart.
+     bench-create     thread_create() of a thread that exits at once.
+
+   Run one with "pintos -- run bench-pingpong".  None of them works
+   with the MLFQS, whose priorities they would not control. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Smallest, largest and total of a series of cycle counts. */
+struct sample
+  {
+    uint64_t min, max, total;
+    unsigned cnt;
+  };
+
+static void
+sample_init (struct sample *s)
+{
+  s->min = UINT64_MAX;
+  s->max = s->total = 0;
+  s->cnt = 0;
+}
+
+static void
+sample_add (struct sample *s, uint64_t cycles)
+{
+  if (cycles < s->min)
+    s->min = cycles;
+  if (cycles > s->max)
+    s->max = cycles;
+  s->total += cycles;
+  s->cnt++;
+}
+
+static uint64_t
+sample_avg (const struct sample *s)
+{
+  return s->cnt > 0 ? s->total / s->cnt : 0;
+}
+
+/* Ping-pong. */
+
+#define PINGPONG_ROUNDS 10000
+
+static struct semaphore ping, pong, pingpong_done;
+
+static void
+pingpong_thread (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < PINGPONG_ROUNDS; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&pingpong_done);
+}
+
+/* Each round wakes the other thread and blocks until it answers,
+   so it takes two context switches. */
+void
+test_bench_pingpong (void)
+{
+  uint64_t start, cycles;
+  int i;
+
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&pingpong_done, 0);
+  thread_create ("pong", PRI_DEFAULT, pingpong_thread, NULL);
+
+  start = rdtsc ();
+  for (i = 0; i < PINGPONG_ROUNDS; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  cycles = rdtsc () - start;
+  sema_down (&pingpong_done);
+
+  msg ("rounds=%d cycles=%"PRIu64" cycles_per_round=%"PRIu64
+       " cycles_per_switch=%"PRIu64,
+       PINGPONG_ROUNDS, cycles, cycles / PINGPONG_ROUNDS,
+       cycles / (2 * PINGPONG_ROUNDS));
+}
+
+/* Lock handoff. */
+
+#define LOCK_THREADS 8
+#define LOCK_ROUNDS 2000
+
+static struct lock contended;
+static struct semaphore lock_start, lock_done;
+static struct thread *lock_last_holder;
+static unsigned lock_handoffs;
+
+/* Acquires the lock LOCK_ROUNDS times, yielding while it holds it
+   so that the other threads queue up behind it. */
+static void
+lock_thread (void *aux UNUSED)
+{
+  int i;
+
+  sema_down (&lock_start);
+  for (i = 0; i < LOCK_ROUNDS; i++)
+    {
+      lock_acquire (&contended);
+      if (lock_last_holder != thread_current ())
+        {
+          lock_handoffs++;
+          lock_last_holder = thread_current ();
+        }
+      thread_yield ();
+      lock_release (&contended);
+    }
+  sema_up (&lock_done);
+}
+
+void
+test_bench_lock (void)
+{
+  unsigned acquires = LOCK_THREADS * LOCK_ROUNDS;
+  uint64_t start, cycles;
+  int i;
+
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&contended);
+  sema_init (&lock_start, 0);
+  sema_init (&lock_done, 0);
+  lock_last_holder = NULL;
+  lock_handoffs = 0;
+  for (i = 0; i < LOCK_THREADS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "locker %d", i);
+      thread_create (name, PRI_DEFAULT, lock_thread, NULL);
+    }
+
+  start = rdtsc ();
+  for (i = 0; i < LOCK_THREADS; i++)
+    sema_up (&lock_start);
+  for (i = 0; i < LOCK_THREADS; i++)
+    sema_down (&lock_done);
+  cycles = rdtsc () - start;
+
+  msg ("threads=%d acquires=%u handoffs=%u cycles=%"PRIu64
+       " cycles_per_acquire=%"PRIu64" cycles_per_handoff=%"PRIu64,
+       LOCK_THREADS, acquires, lock_handoffs, cycles, cycles / acquires,
+       lock_handoffs > 0 ? cycles / lock_handoffs : 0);
+}
+
+/* Condition variable broadcast. */
+
+#define CONDVAR_ROUNDS 200
+
+struct broadcast
+  {
+    struct lock lock;
+    struct condition cond;
+    int waiters;                /* Number of waiting threads. */
+    int waiting;                /* Waiters in cond_wait() this round. */
+    int woken;                  /* Waiters that have run this round. */
+    unsigned generation;        /* Incremented by each broadcast. */
+    struct semaphore all_woken; /* Upped by the last waiter to run. */
+    struct semaphore done;      /* Upped by each waiter as it exits. */
+  };
+
+static void
+condvar_thread (void *b_)
+{
+  struct broadcast *b = b_;
+  int i;
+
+  lock_acquire (&b->lock);
+  for (i = 0; i < CONDVAR_ROUNDS; i++)
+    {
+      unsigned generation = b->generation;
+
+      b->waiting++;
+      while (b->generation == generation)
+        cond_wait (&b->cond, &b->lock);
+      if (++b->woken == b->waiters)
+        sema_up (&b->all_woken);
+    }
+  lock_release (&b->lock);
+  sema_up (&b->done);
+}
+
+/* Broadcasts to WAITERS threads CONDVAR_ROUNDS times, timing the
+   cond_broadcast() call and the time until every waiter has run. */
+static void
+bench_broadcast (int waiters)
+{
+  struct broadcast b;
+  struct sample call, wake;
+  int i;
+
+  lock_init (&b.lock);
+  cond_init (&b.cond);
+  b.waiters = waiters;
+  b.waiting = b.woken = 0;
+  b.generation = 0;
+  sema_init (&b.all_woken, 0);
+  sema_init (&b.done, 0);
+  sample_init (&call);
+  sample_init (&wake);
+
+  for (i = 0; i < waiters; i++)
+    {
+      char name[24];
+      snprintf (name, sizeof name, "waiter %d", i);
+      thread_create (name, PRI_DEFAULT, condvar_thread, &b);
+    }
+
+  for (i = 0; i < CONDVAR_ROUNDS; i++)
+    {
+      uint64_t start, called;
+
+      lock_acquire (&b.lock);
+      while (b.waiting < waiters)
+        {
+          lock_release (&b.lock);
+          thread_yield ();
+          lock_acquire (&b.lock);
+        }
+      start = rdtsc ();
+      b.waiting = b.woken = 0;
+      b.generation++;
+      cond_broadcast (&b.cond, &b.lock);
+      called = rdtsc ();
+      lock_release (&b.lock);
+      sema_down (&b.all_woken);
+
+      sample_add (&call, called - start);
+      sample_add (&wake, rdtsc () - start);
+    }
+
+  for (i = 0; i < waiters; i++)
+    sema_down (&b.done);
+
+  msg ("waiters=%d rounds=%d broadcast_cycles=%"PRIu64
+       " wake_all_cycles=%"PRIu64" wake_all_min=%"PRIu64
+       " wake_all_max=%"PRIu64" cycles_per_waiter=%"PRIu64,
+       waiters, CONDVAR_ROUNDS, sample_avg (&call), sample_avg (&wake),
+       wake.min, wake.max, sample_avg (&wake) / waiters);
+}
+
+void
+test_bench_condvar (void)
+{
+  ASSERT (!thread_mlfqs);
+
+  bench_broadcast (1);
+  bench_broadcast (8);
+  bench_broadcast (32);
+}
+
+/* Sleep accuracy and wakeup jitter. */
+
+#define SLEEPERS 64
+#define SLEEP_ROUNDS 20
+#define SLEEP_DELAY 5           /* Ticks from release to wake-up. */
+
+static struct semaphore sleep_start, sleep_done;
+static int64_t sleep_target;
+static int64_t sleep_late[SLEEPERS];
+static uint64_t sleep_tsc[SLEEPERS];
+
+/* Each round, sleeps until sleep_target and notes how many ticks
+   late and at what cycle it woke. */
+static void
+sleep_thread (void *slot_)
+{
+  int slot = (int) slot_;
+  int i;
+
+  for (i = 0; i < SLEEP_ROUNDS; i++)
+    {
+      sema_down (&sleep_start);
+      timer_sleep (sleep_target - timer_ticks ());
+      sleep_tsc[slot] = rdtsc ();
+      sleep_late[slot] = timer_ticks () - sleep_target;
+      sema_up (&sleep_done);
+    }
+}
+
+void
+test_bench_sleep (void)
+{
+  struct sample spread;
+  int64_t late_total = 0, late_max = 0;
+  int i, j;
+
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&sleep_start, 0);
+  sema_init (&sleep_done, 0);
+  sample_init (&spread);
+  for (i = 0; i < SLEEPERS; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "sleeper %d", i);
+      thread_create (name, PRI_DEFAULT, sleep_thread, (void *) i);
+    }
+
+  for (i = 0; i < SLEEP_ROUNDS; i++)
+    {
+      uint64_t first = UINT64_MAX, last = 0;
+
+      sleep_target = timer_ticks () + SLEEP_DELAY;
+      for (j = 0; j < SLEEPERS; j++)
+        sema_up (&sleep_start);
+      for (j = 0; j < SLEEPERS; j++)
+        sema_down (&sleep_done);
+
+      for (j = 0; j < SLEEPERS; j++)
+        {
+          if (sleep_tsc[j] < first)
+            first = sleep_tsc[j];
+          if (sleep_tsc[j] > last)
+            last = sleep_tsc[j];
+          late_total += sleep_late[j];
+          if (sleep_late[j] > late_max)
+            late_max = sleep_late[j];
+        }
+      sample_add (&spread, last - first);
+    }
+
+  msg ("sleepers=%d rounds=%d late_ticks=%"PRId64" late_ticks_max=%"PRId64
+       " spread_cycles=%"PRIu64" spread_min=%"PRIu64" spread_max=%"PRIu64,
+       SLEEPERS, SLEEP_ROUNDS, late_total, late_max, sample_avg (&spread),
+       spread.min, spread.max);
+}
+
+/* Thread creation and exit. */
+
+#define CREATE_THREADS 1000
+
+static void
+exit_thread (void *aux UNUSED)
+{
+}
+
+/* The new thread has the higher priority, so each thread_create()
+   returns only after it has run and exited. */
+void
+test_bench_create (void)
+{
+  uint64_t start, cycles;
+  int i;
+
+  ASSERT (!thread_mlfqs);
+
+  start = rdtsc ();
+  for (i = 0; i < CREATE_THREADS; i++)
+    if (thread_create ("exit", PRI_DEFAULT + 1, exit_thread, NULL)
+        == TID_ERROR)
+      fail ("thread_create() failed after %d threads", i);
+  cycles = rdtsc () - start;
+
+  msg ("threads=%d cycles=%"PRIu64" cycles_per_thread=%"PRIu64,
+       CREATE_THREADS, cycles, cycles / CREATE_THREADS);
+}
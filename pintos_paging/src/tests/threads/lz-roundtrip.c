@@ -0,0 +1,105 @@
+/* Checks that lz_compress() and lz_decompress() give back exactly
+   what they were given, for pages that compress well, poorly or
+   not at all and for short inputs, and that lz_decompress()
+   refuses output that does not fit and input that is corrupt.
+   bench-lz times the same calls. */
+
+#include <lz.h>
+#include <random.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Room for a page that does not compress: a control byte per 8
+   literals. */
+#define PACKED_MAX (PGSIZE + PGSIZE / 8 + 1)
+
+static struct lz_state state;
+
+/* Compresses the LEN bytes at SRC into PACKED, decompresses them
+   into OUT, and fails unless OUT matches SRC.  Returns the
+   compressed size. */
+static size_t
+roundtrip (const char *name, const uint8_t *src, size_t len,
+           uint8_t *packed, uint8_t *out)
+{
+  size_t packed_len = lz_compress (&state, src, len, packed, PACKED_MAX);
+
+  if (packed_len == 0 && len > 0)
+    fail ("%s: lz_compress() failed", name);
+  if (lz_decompress (packed, packed_len, out, len) != len
+      || memcmp (out, src, len))
+    fail ("%s: differs after decompression", name);
+  msg ("%s: round trip ok", name);
+  return packed_len;
+}
+
+void
+test_lz_roundtrip (void)
+{
+  static const uint8_t bad_dist[] = { 0x01, 0x05, 0x00 };
+  uint8_t *page = palloc_get_multiple (0, 4);
+  uint8_t *packed = page + PGSIZE;
+  uint8_t *out = page + 3 * PGSIZE;
+  size_t packed_len, i;
+
+  if (page == NULL)
+    fail ("out of memory");
+
+  /* Random bytes have no matches and grow by their control
+     bytes, so they do not fit back in a page. */
+  random_bytes (page, PGSIZE);
+  roundtrip ("random", page, PGSIZE, packed, out);
+  if (lz_compress (&state, page, PGSIZE, packed, PGSIZE) != 0)
+    fail ("random page fit in a page");
+
+  /* Zeros are a literal and then matches of the maximum length. */
+  memset (page, 0, PGSIZE);
+  packed_len = roundtrip ("zero", page, PGSIZE, packed, out);
+  if (packed_len > PGSIZE / 32)
+    fail ("zero page compressed to %zu bytes", packed_len);
+
+  /* Output that does not fit is refused, and so are a back
+     reference cut short and one to before the output. */
+  if (lz_decompress (packed, packed_len, out, PGSIZE - 1) != 0)
+    fail ("zero page decompressed into less than a page");
+  if (lz_decompress (packed, 3, out, PGSIZE) != 0)
+    fail ("truncated back reference accepted");
+  if (lz_decompress (bad_dist, sizeof bad_dist, out, PGSIZE) != 0)
+    fail ("back reference out of range accepted");
+  msg ("corrupt input refused");
+
+  /* A repeated pattern, at a distance of more than 1. */
+  random_bytes (page, 16);
+  for (i = 16; i < PGSIZE; i++)
+    page[i] = page[i - 16];
+  packed_len = roundtrip ("repeat", page, PGSIZE, packed, out);
+  if (packed_len > PGSIZE / 32)
+    fail ("repeated page compressed to %zu bytes", packed_len);
+
+  /* A sparse page: zeros with a random byte every so often, so
+     literals and matches alternate. */
+  memset (page, 0, PGSIZE);
+  for (i = 0; i < PGSIZE; i += 97)
+    page[i] = random_ulong ();
+  roundtrip ("sparse", page, PGSIZE, packed, out);
+
+  /* Bytes from a small alphabet, with short matches at all
+     distances. */
+  for (i = 0; i < PGSIZE; i++)
+    page[i] = "pintos"[random_ulong () % 6];
+  roundtrip ("text", page, PGSIZE, packed, out);
+
+  /* Inputs shorter than a match, and one that does not end on a
+     group of 8 items. */
+  random_bytes (page, PGSIZE);
+  roundtrip ("0 bytes", page, 0, packed, out);
+  roundtrip ("1 byte", page, 1, packed, out);
+  roundtrip ("2 bytes", page, 2, packed, out);
+  roundtrip ("3 bytes", page, 3, packed, out);
+  roundtrip ("1001 bytes", page, 1001, packed, out);
+
+  palloc_free_multiple (page, 4);
+}
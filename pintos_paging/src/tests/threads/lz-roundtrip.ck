@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(lz-roundtrip) begin
+(lz-roundtrip) random: round trip ok
+(lz-roundtrip) zero: round trip ok
+(lz-roundtrip) corrupt input refused
+(lz-roundtrip) repeat: round trip ok
+(lz-roundtrip) sparse: round trip ok
+(lz-roundtrip) text: round trip ok
+(lz-roundtrip) 0 bytes: round trip ok
+(lz-roundtrip) 1 byte: round trip ok
+(lz-roundtrip) 2 bytes: round trip ok
+(lz-roundtrip) 3 bytes: round trip ok
+(lz-roundtrip) 1001 bytes: round trip ok
+(lz-roundtrip) end
+EOF
+pass;
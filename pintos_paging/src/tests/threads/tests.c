@@ -38,6 +38,18 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"lz-roundtrip", test_lz_roundtrip},
+    {"bench-pingpong", test_bench_pingpong},
+    {"bench-lock", test_bench_lock},
+    {"bench-condvar", test_bench_condvar},
+    {"bench-sleep", test_bench_sleep},
+    {"bench-create", test_bench_create},
+    {"bench-hash", test_bench_hash},
+    {"bench-bitmap", test_bench_bitmap},
+    {"bench-list", test_bench_list},
+    {"bench-malloc", test_bench_malloc},
+    {"bench-memcpy", test_bench_memcpy},
+    {"bench-lz", test_bench_lz},
   };
 
 static const char *test_name;
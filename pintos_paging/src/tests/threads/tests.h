@@ -32,6 +32,18 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_lz_roundtrip;
+extern test_func test_bench_pingpong;
+extern test_func test_bench_lock;
+extern test_func test_bench_condvar;
+extern test_func test_bench_sleep;
+extern test_func test_bench_create;
+extern test_func test_bench_hash;
+extern test_func test_bench_bitmap;
+extern test_func test_bench_list;
+extern test_func test_bench_malloc;
+extern test_func test_bench_memcpy;
+extern test_func test_bench_lz;
 
 void msg (const char *, ...);
 void fail (const char *, ...);
@@ -0,0 +1,59 @@
+/* Child process run by pipe-from-child and pipe-to-child.
+
+   Inherits the ends of its parent's pipe, at the fds given as the
+   second and third command-line arguments, read end first.  With
+   "write" as the first argument, closes the read end and writes
+   PIPE_DATA_SIZE bytes into the pipe.  With "read", closes the
+   write end and reads until end of file, checking the data.
+   Prints nothing unless it fails, as it runs alongside its
+   parent. */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/pipe-child.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-pipe";
+
+static char buf[PIPE_DATA_SIZE + 1];
+
+int
+main (int argc, char *argv[]) 
+{
+  int rfd, wfd;
+  size_t i;
+
+  if (argc != 4 || !isdigit (*argv[2]) || !isdigit (*argv[3]))
+    fail ("bad command-line arguments");
+  rfd = atoi (argv[2]);
+  wfd = atoi (argv[3]);
+
+  if (!strcmp (argv[1], "write"))
+    {
+      close (rfd);
+      for (i = 0; i < PIPE_DATA_SIZE; i++)
+        buf[i] = pipe_data (i);
+      if (write (wfd, buf, PIPE_DATA_SIZE) != PIPE_DATA_SIZE)
+        fail ("write failed");
+    }
+  else 
+    {
+      size_t ofs = 0;
+      int n;
+
+      close (wfd);
+      while ((n = read (rfd, buf + ofs, sizeof buf - ofs)) > 0)
+        ofs += n;
+      if (n < 0)
+        fail ("read failed");
+      if (ofs != PIPE_DATA_SIZE)
+        fail ("read %zu bytes instead of %d", ofs, PIPE_DATA_SIZE);
+      for (i = 0; i < PIPE_DATA_SIZE; i++)
+        if (buf[i] != pipe_data (i))
+          fail ("byte %zu differs", i);
+    }
+
+  return 0;
+}
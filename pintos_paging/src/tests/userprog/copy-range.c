@@ -0,0 +1,68 @@
+/* Copies part of a file, across sector boundaries and past its
+   end, into the middle of an empty file, and checks the result.
+   Then checks that copy_file_range() refuses to copy a file onto
+   itself where the ranges overlap, including from and to the same
+   fd, but copies between ranges of one file that do not. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SRC_SIZE 1300           /* Two sectors and part of a third. */
+#define SRC_OFS 100             /* Where the copy starts in "src". */
+#define DST_OFS 700             /* Where it goes in "dst". */
+#define COPY_SIZE (SRC_SIZE - SRC_OFS)
+
+static char data[SRC_SIZE];
+static char buf[DST_OFS + COPY_SIZE];
+
+void
+test_main (void) 
+{
+  int src, dst, again;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  CHECK (create ("src", 0), "create \"src\"");
+  CHECK (create ("dst", 0), "create \"dst\"");
+  CHECK ((src = open ("src")) > 1, "open \"src\"");
+  CHECK ((dst = open ("dst")) > 1, "open \"dst\"");
+  CHECK (write (src, data, sizeof data) == sizeof data,
+         "write %zu bytes to \"src\"", sizeof data);
+
+  /* The copy stops at the end of "src", and "dst" grows over
+     the gap before DST_OFS, which reads as zeros. */
+  seek (src, SRC_OFS);
+  seek (dst, DST_OFS);
+  CHECK (copy_file_range (src, dst, 2000) == COPY_SIZE,
+         "copy_file_range 2000 bytes copies %d", COPY_SIZE);
+  CHECK (tell (src) == SRC_SIZE && tell (dst) == DST_OFS + COPY_SIZE,
+         "both positions advanced");
+  CHECK (copy_file_range (src, dst, 10) == 0,
+         "copy_file_range at end of \"src\"");
+  memset (buf, 0, DST_OFS);
+  memcpy (buf + DST_OFS, data + SRC_OFS, COPY_SIZE);
+  seek (dst, 0);
+  check_file_handle (dst, "dst", buf, sizeof buf);
+
+  /* Onto itself. */
+  seek (src, 0);
+  CHECK (copy_file_range (src, src, 10) == -1,
+         "copy_file_range from and to the same fd");
+  CHECK ((again = open ("src")) > 1, "open \"src\" again");
+  seek (again, 50);
+  CHECK (copy_file_range (src, again, 100) == -1,
+         "copy_file_range between overlapping ranges");
+  seek (again, SRC_SIZE);
+  CHECK (copy_file_range (src, again, 200) == 200,
+         "copy_file_range between disjoint ranges");
+  memcpy (buf, data, SRC_SIZE);
+  memcpy (buf + SRC_SIZE, data, 200);
+  seek (src, 0);
+  check_file_handle (src, "src", buf, SRC_SIZE + 200);
+
+  CHECK (copy_file_range (src, 1234, 10) == -1,
+         "copy_file_range to a bad fd");
+}
@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(copy-range) begin
+(copy-range) create "src"
+(copy-range) create "dst"
+(copy-range) open "src"
+(copy-range) open "dst"
+(copy-range) write 1300 bytes to "src"
+(copy-range) copy_file_range 2000 bytes copies 1200
+(copy-range) both positions advanced
+(copy-range) copy_file_range at end of "src"
+(copy-range) verified contents of "dst"
+(copy-range) copy_file_range from and to the same fd
+(copy-range) open "src" again
+(copy-range) copy_file_range between overlapping ranges
+(copy-range) copy_file_range between disjoint ranges
+(copy-range) verified contents of "src"
+(copy-range) copy_file_range to a bad fd
+(copy-range) end
+copy-range: exit(0)
+EOF
+pass;
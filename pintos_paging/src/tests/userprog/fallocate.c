@@ -0,0 +1,49 @@
+/* Reserves space for a file with fallocate(), which leaves its
+   size alone, then writes into the reserved range, starting past
+   the end of the file, and on across the end of the range, and
+   checks that the file reads back with zeros before the first
+   write.  Also checks that fallocate() fails for more space than
+   the disk has and for a bad fd. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define RESERVED 5000           /* Bytes reserved. */
+#define WRITE_OFS 1000          /* Where the first write starts. */
+#define WRITE_SIZE 3000         /* Size of each write. */
+#define SIZE (WRITE_OFS + 2 * WRITE_SIZE)
+
+static char data[2 * WRITE_SIZE];
+static char buf[SIZE];
+
+void
+test_main (void) 
+{
+  int handle;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  CHECK (create ("log", 0), "create \"log\"");
+  CHECK ((handle = open ("log")) > 1, "open \"log\"");
+  CHECK (fallocate (handle, RESERVED) == 0, "fallocate %d bytes", RESERVED);
+  CHECK (filesize (handle) == 0, "file size is still 0");
+
+  seek (handle, WRITE_OFS);
+  CHECK (write (handle, data, WRITE_SIZE) == WRITE_SIZE,
+         "write %d bytes into reserved range", WRITE_SIZE);
+  CHECK (write (handle, data + WRITE_SIZE, WRITE_SIZE) == WRITE_SIZE,
+         "write %d bytes across end of reserved range", WRITE_SIZE);
+  CHECK (filesize (handle) == SIZE, "file size is %d", SIZE);
+
+  CHECK (fallocate (handle, 16 * 1024 * 1024) == -1,
+         "fallocate more than the disk");
+  CHECK (fallocate (1234, RESERVED) == -1, "fallocate a bad fd");
+
+  memset (buf, 0, WRITE_OFS);
+  memcpy (buf + WRITE_OFS, data, sizeof data);
+  seek (handle, 0);
+  check_file_handle (handle, "log", buf, sizeof buf);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fallocate) begin
+(fallocate) create "log"
+(fallocate) open "log"
+(fallocate) fallocate 5000 bytes
+(fallocate) file size is still 0
+(fallocate) write 3000 bytes into reserved range
+(fallocate) write 3000 bytes across end of reserved range
+(fallocate) file size is 7000
+(fallocate) fallocate more than the disk
+(fallocate) fallocate a bad fd
+(fallocate) verified contents of "log"
+(fallocate) end
+fallocate: exit(0)
+EOF
+pass;
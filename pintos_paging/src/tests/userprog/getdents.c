@@ -0,0 +1,79 @@
+/* Creates 5 files and lists the directory with getdents(), two
+   entries per call, resuming each call where the last one left
+   off, and checks that each file is listed exactly once, and that
+   resuming from a position saved after the first call lists the
+   same entries again.  Also checks that a buffer too small for the
+   next entry gets -1 and leaves the position where it was. */
+
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 5
+
+/* Names of 6 bytes and "getdents" both take 16-byte records. */
+#define RECLEN 16
+
+static const char *names[FILE_CNT] =
+  { "file-0", "file-1", "file-2", "file-3", "file-4" };
+
+void
+test_main (void) 
+{
+  uint32_t buf[2 * RECLEN / sizeof (uint32_t)];
+  uint32_t second[sizeof buf / sizeof *buf];
+  int seen[FILE_CNT] = { 0 };
+  unsigned pos = 0, saved = 0;
+  int i, n, calls = 0, second_n = 0;
+
+  for (i = 0; i < FILE_CNT; i++)
+    CHECK (create (names[i], 0), "create \"%s\"", names[i]);
+
+  CHECK (getdents (&pos, (struct dirent *) buf, RECLEN - 1) == -1,
+         "getdents with a buffer too small for one entry");
+  if (pos != 0)
+    fail ("failed getdents moved the position to %u", pos);
+
+  msg ("list the directory");
+  while ((n = getdents (&pos, (struct dirent *) buf, sizeof buf)) != 0)
+    {
+      const char *p = (const char *) buf;
+      const char *end = p + n;
+
+      if (n < 0 || n > (int) sizeof buf)
+        fail ("getdents returned %d", n);
+      while (p < end)
+        {
+          const struct dirent *d = (const struct dirent *) p;
+
+          if (d->reclen != RECLEN || d->type != DT_REG)
+            fail ("bad entry \"%s\"", d->name);
+          for (i = 0; i < FILE_CNT; i++)
+            if (!strcmp (d->name, names[i]))
+              seen[i]++;
+          p += d->reclen;
+        }
+
+      if (++calls == 1)
+        saved = pos;
+      else if (calls == 2)
+        {
+          memcpy (second, buf, n);
+          second_n = n;
+        }
+    }
+  for (i = 0; i < FILE_CNT; i++)
+    if (seen[i] != 1)
+      fail ("\"%s\" listed %d times", names[i], seen[i]);
+  msg ("each file listed once");
+
+  CHECK (getdents (&pos, (struct dirent *) buf, sizeof buf) == 0,
+         "getdents at the end of the directory");
+
+  msg ("resume from the position after the first call");
+  n = getdents (&saved, (struct dirent *) buf, sizeof buf);
+  if (n != second_n || memcmp (buf, second, n))
+    fail ("listed other entries than the second call");
+}
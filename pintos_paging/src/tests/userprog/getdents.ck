@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents) begin
+(getdents) create "file-0"
+(getdents) create "file-1"
+(getdents) create "file-2"
+(getdents) create "file-3"
+(getdents) create "file-4"
+(getdents) getdents with a buffer too small for one entry
+(getdents) list the directory
+(getdents) each file listed once
+(getdents) getdents at the end of the directory
+(getdents) resume from the position after the first call
+(getdents) end
+getdents: exit(0)
+EOF
+pass;
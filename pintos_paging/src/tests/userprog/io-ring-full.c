@@ -0,0 +1,64 @@
+/* Fills the completion queue of a 4-entry I/O ring, and checks that
+   io_enter() then stops early, taking no operation until outcomes
+   are taken off the queue, and then only as many as there is room
+   for.  Also checks that it takes no more than it is asked to. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ENTRIES 4
+
+static struct io_ring ring;
+
+/* Queues CNT no-ops on RING. */
+static void
+queue_nops (int cnt)
+{
+  while (cnt-- > 0)
+    {
+      struct io_sqe *sqe = &ring.sq[ring.sq_tail % ENTRIES];
+
+      sqe->opcode = IO_OP_NOP;
+      sqe->user_data = ring.sq_tail;
+      ring.sq_tail++;
+    }
+}
+
+/* Takes CNT outcomes off RING, checking that they come in order. */
+static void
+take (int cnt)
+{
+  while (cnt-- > 0)
+    {
+      struct io_cqe *cqe = &ring.cq[ring.cq_head % ENTRIES];
+
+      if (cqe->user_data != ring.cq_head || cqe->result != 0)
+        fail ("completion %u has user_data %u, result %d",
+              ring.cq_head, cqe->user_data, cqe->result);
+      ring.cq_head++;
+    }
+}
+
+void
+test_main (void) 
+{
+  ring.entries = ENTRIES;
+  CHECK (io_setup (&ring) == 0, "io_setup with 4 entries");
+
+  queue_nops (3);
+  CHECK (io_enter (1) == 1, "io_enter 1 of 3 operations");
+  CHECK (io_enter (8) == 2, "io_enter the other 2");
+  queue_nops (2);
+  CHECK (io_enter (8) == 1, "io_enter 2 with room for 1");
+  CHECK (io_enter (8) == 0, "io_enter with the completion queue full");
+  if (ring.sq_head != 4 || ring.cq_tail != 4)
+    fail ("sq_head %u and cq_tail %u instead of 4",
+          ring.sq_head, ring.cq_tail);
+
+  take (1);
+  CHECK (io_enter (8) == 1, "io_enter the last after taking 1");
+  take (4);
+  CHECK (io_enter (8) == 0, "io_enter with nothing queued");
+  msg ("completions are as expected");
+}
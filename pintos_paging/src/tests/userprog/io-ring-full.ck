@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(io-ring-full) begin
+(io-ring-full) io_setup with 4 entries
+(io-ring-full) io_enter 1 of 3 operations
+(io-ring-full) io_enter the other 2
+(io-ring-full) io_enter 2 with room for 1
+(io-ring-full) io_enter with the completion queue full
+(io-ring-full) io_enter the last after taking 1
+(io-ring-full) io_enter with nothing queued
+(io-ring-full) completions are as expected
+(io-ring-full) end
+io-ring-full: exit(0)
+EOF
+pass;
@@ -0,0 +1,69 @@
+/* Queues a batch of operations on an I/O ring, one of each kind
+   and one with an unknown opcode, and carries them out with one
+   io_enter() call.  Checks the outcomes, in order, and the data
+   written and read back.  Also checks that io_enter() fails
+   without a ring, and io_setup() with a bad ring size. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct io_ring ring;
+
+/* Queues an operation on RING. */
+static void
+queue (uint32_t opcode, int fd, void *buf, uint32_t len, uint32_t offset)
+{
+  struct io_sqe *sqe = &ring.sq[ring.sq_tail % ring.entries];
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = len;
+  sqe->offset = offset;
+  sqe->user_data = ring.sq_tail + 100;
+  ring.sq_tail++;
+}
+
+void
+test_main (void) 
+{
+  static const char data[] = "Amazing Electronic Fact";
+  static const int expected[] = { 0, sizeof data, 0, sizeof data, -1 };
+  char buf[sizeof data];
+  int handle;
+  size_t i;
+
+  CHECK (io_enter (1) == -1, "io_enter without a ring");
+  ring.entries = 3;
+  CHECK (io_setup (&ring) == -1, "io_setup with 3 entries");
+  ring.entries = 8;
+  CHECK (io_setup (&ring) == 0, "io_setup with 8 entries");
+
+  CHECK (create ("ring.txt", sizeof data), "create \"ring.txt\"");
+  CHECK ((handle = open ("ring.txt")) > 1, "open \"ring.txt\"");
+
+  queue (IO_OP_NOP, 0, NULL, 0, 0);
+  queue (IO_OP_PWRITE, handle, (void *) data, sizeof data, 0);
+  queue (IO_OP_FSYNC, handle, NULL, 0, 0);
+  queue (IO_OP_PREAD, handle, buf, sizeof buf, 0);
+  queue (123, handle, NULL, 0, 0);
+  CHECK (io_enter (8) == 5, "io_enter 5 operations");
+
+  if (ring.sq_head != 5 || ring.cq_tail != 5)
+    fail ("sq_head %u and cq_tail %u instead of 5",
+          ring.sq_head, ring.cq_tail);
+  for (i = 0; i < 5; i++)
+    {
+      struct io_cqe *cqe = &ring.cq[ring.cq_head++ % ring.entries];
+      if (cqe->user_data != i + 100)
+        fail ("completion %zu has user_data %u", i, cqe->user_data);
+      if (cqe->result != expected[i])
+        fail ("completion %zu has result %d instead of %d",
+              i, cqe->result, expected[i]);
+    }
+  if (memcmp (buf, data, sizeof data))
+    fail ("data read back differs from data written");
+  msg ("completions are as expected");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(io-ring) begin
+(io-ring) io_enter without a ring
+(io-ring) io_setup with 3 entries
+(io-ring) io_setup with 8 entries
+(io-ring) create "ring.txt"
+(io-ring) open "ring.txt"
+(io-ring) io_enter 5 operations
+(io-ring) completions are as expected
+(io-ring) end
+io-ring: exit(0)
+EOF
+pass;
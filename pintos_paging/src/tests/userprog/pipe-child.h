@@ -0,0 +1,18 @@
+#ifndef TESTS_USERPROG_PIPE_CHILD_H
+#define TESTS_USERPROG_PIPE_CHILD_H
+
+#include <stddef.h>
+
+/* Bytes that pipe-from-child and pipe-to-child send through a
+   pipe: several times its capacity of a page, so that the writer
+   waits on a full pipe as well as the reader on an empty one. */
+#define PIPE_DATA_SIZE (3 * 4096 + 100)
+
+/* Returns the byte at OFS of the data sent through the pipe. */
+static inline char
+pipe_data (size_t ofs) 
+{
+  return ofs % 251;
+}
+
+#endif /* tests/userprog/pipe-child.h */
@@ -0,0 +1,43 @@
+/* Runs a child that inherits the ends of a pipe and writes several
+   pages into it, while the parent reads them and checks them.  The
+   parent's reads wait on the empty pipe, and with VM a write then
+   copies straight into the reader's buffer; the child's writes
+   wait on the full pipe.  Once the child exits, closing the last
+   write end, the parent sees end of file. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/userprog/pipe-child.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[PIPE_DATA_SIZE + 1];
+
+void
+test_main (void) 
+{
+  char cmd_line[64];
+  size_t ofs = 0, i;
+  pid_t child;
+  int fds[2];
+  int n;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  snprintf (cmd_line, sizeof cmd_line, "child-pipe write %d %d",
+            fds[0], fds[1]);
+  CHECK ((child = exec (cmd_line)) != PID_ERROR, "exec child-pipe");
+  close (fds[1]);
+
+  while ((n = read (fds[0], buf + ofs, sizeof buf - ofs)) > 0)
+    ofs += n;
+  if (n < 0)
+    fail ("read failed");
+  if (ofs != PIPE_DATA_SIZE)
+    fail ("read %zu bytes instead of %d", ofs, PIPE_DATA_SIZE);
+  for (i = 0; i < PIPE_DATA_SIZE; i++)
+    if (buf[i] != pipe_data (i))
+      fail ("byte %zu differs", i);
+  msg ("read all the data, then end of file");
+
+  msg ("wait(exec()) = %d", wait (child));
+}
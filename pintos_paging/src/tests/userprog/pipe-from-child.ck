@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-from-child) begin
+(pipe-from-child) pipe
+(pipe-from-child) exec child-pipe
+child-pipe: exit(0)
+(pipe-from-child) read all the data, then end of file
+(pipe-from-child) wait(exec()) = 0
+(pipe-from-child) end
+pipe-from-child: exit(0)
+EOF
+pass;
@@ -0,0 +1,38 @@
+/* Writes into a pipe and reads the data back from its other end.
+   Then checks that a read sees end of file once the write end is
+   closed, and that a write fails once the read end is. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static const char data[] = "Amazing Electronic Fact";
+  char buf[64];
+  int fds[2];
+
+  CHECK (pipe (fds) == 0, "pipe");
+  if (fds[0] < 2 || fds[1] < 2 || fds[0] == fds[1])
+    fail ("bad fds %d and %d", fds[0], fds[1]);
+
+  CHECK (write (fds[1], data, sizeof data) == sizeof data,
+         "write %zu bytes", sizeof data);
+  CHECK (read (fds[0], buf, sizeof buf) == sizeof data,
+         "read %zu bytes", sizeof data);
+  if (memcmp (buf, data, sizeof data))
+    fail ("read data differs from written data");
+
+  msg ("close write end");
+  close (fds[1]);
+  CHECK (read (fds[0], buf, sizeof buf) == 0, "read at end of file");
+  close (fds[0]);
+
+  CHECK (pipe (fds) == 0, "pipe");
+  msg ("close read end");
+  close (fds[0]);
+  CHECK (write (fds[1], data, sizeof data) == -1, "write without reader");
+  close (fds[1]);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-simple) begin
+(pipe-simple) pipe
+(pipe-simple) write 24 bytes
+(pipe-simple) read 24 bytes
+(pipe-simple) close write end
+(pipe-simple) read at end of file
+(pipe-simple) pipe
+(pipe-simple) close read end
+(pipe-simple) write without reader
+(pipe-simple) end
+pipe-simple: exit(0)
+EOF
+pass;
@@ -0,0 +1,36 @@
+/* Runs a child that inherits the ends of a pipe and reads what the
+   parent writes into it, several pages, until end of file, which
+   it sees only once both its own write end and the parent's are
+   closed. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/userprog/pipe-child.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[PIPE_DATA_SIZE];
+
+void
+test_main (void) 
+{
+  char cmd_line[64];
+  pid_t child;
+  int fds[2];
+  size_t i;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  snprintf (cmd_line, sizeof cmd_line, "child-pipe read %d %d",
+            fds[0], fds[1]);
+  CHECK ((child = exec (cmd_line)) != PID_ERROR, "exec child-pipe");
+  close (fds[0]);
+
+  for (i = 0; i < PIPE_DATA_SIZE; i++)
+    buf[i] = pipe_data (i);
+  CHECK (write (fds[1], buf, PIPE_DATA_SIZE) == PIPE_DATA_SIZE,
+         "write %d bytes", PIPE_DATA_SIZE);
+  msg ("close write end");
+  close (fds[1]);
+
+  msg ("wait(exec()) = %d", wait (child));
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-to-child) begin
+(pipe-to-child) pipe
+(pipe-to-child) exec child-pipe
+(pipe-to-child) write 12388 bytes
+(pipe-to-child) close write end
+child-pipe: exit(0)
+(pipe-to-child) wait(exec()) = 0
+(pipe-to-child) end
+pipe-to-child: exit(0)
+EOF
+pass;
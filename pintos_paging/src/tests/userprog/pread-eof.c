@@ -0,0 +1,48 @@
+/* Reads with pread() at and past the end of a file, which reads
+   nothing, and across it, which reads what is there.  Then writes
+   with pwrite() past the end, and checks that the file grows over
+   the gap, which reads as zeros, and that neither call moves the
+   file position. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DATA_SIZE 100           /* Size of "data" to start with. */
+#define WRITE_OFS 1000          /* Where pwrite() writes, past it. */
+
+static char data[DATA_SIZE];
+static char buf[WRITE_OFS + DATA_SIZE];
+
+void
+test_main (void) 
+{
+  int handle;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+  CHECK (write (handle, data, sizeof data) == sizeof data,
+         "write %zu bytes to \"data\"", sizeof data);
+
+  CHECK (pread (handle, buf, 10, DATA_SIZE) == 0, "pread at end of file");
+  CHECK (pread (handle, buf, 10, 5000) == 0, "pread past end of file");
+  CHECK (pread (handle, buf, 50, DATA_SIZE - 10) == 10,
+         "pread across end of file");
+  compare_bytes (buf, data + DATA_SIZE - 10, 10, DATA_SIZE - 10, "data");
+
+  CHECK (pwrite (handle, data, sizeof data, WRITE_OFS) == sizeof data,
+         "pwrite %zu bytes past end of file", sizeof data);
+  CHECK (filesize (handle) == WRITE_OFS + DATA_SIZE,
+         "file size is %d", WRITE_OFS + DATA_SIZE);
+  CHECK (tell (handle) == DATA_SIZE, "position is still %d", DATA_SIZE);
+
+  memcpy (buf, data, DATA_SIZE);
+  memset (buf + DATA_SIZE, 0, WRITE_OFS - DATA_SIZE);
+  memcpy (buf + WRITE_OFS, data, DATA_SIZE);
+  seek (handle, 0);
+  check_file_handle (handle, "data", buf, sizeof buf);
+}
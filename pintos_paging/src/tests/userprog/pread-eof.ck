@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pread-eof) begin
+(pread-eof) create "data"
+(pread-eof) open "data"
+(pread-eof) write 100 bytes to "data"
+(pread-eof) pread at end of file
+(pread-eof) pread past end of file
+(pread-eof) pread across end of file
+(pread-eof) pwrite 100 bytes past end of file
+(pread-eof) file size is 1100
+(pread-eof) position is still 100
+(pread-eof) verified contents of "data"
+(pread-eof) end
+pread-eof: exit(0)
+EOF
+pass;
@@ -0,0 +1,52 @@
+/* Checks that readv() and writev() with no buffers transfer
+   nothing.  Then writes more than two pages from three buffers
+   with writev(), so that buffers are split between pages, and
+   reads them back with readv() into three buffers of other
+   sizes. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE 9000               /* Bytes written and read back. */
+
+static char data[SIZE];
+static char buf[SIZE];
+
+void
+test_main (void) 
+{
+  struct iovec iov[3];
+  int handle;
+
+  random_init (0);
+  random_bytes (data, sizeof data);
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((handle = open ("data")) > 1, "open \"data\"");
+
+  CHECK (writev (handle, iov, 0) == 0, "writev no buffers");
+  CHECK (filesize (handle) == 0, "file size is 0");
+  CHECK (readv (handle, iov, 0) == 0, "readv no buffers");
+
+  iov[0].iov_base = data;
+  iov[0].iov_len = 100;
+  iov[1].iov_base = data + 100;
+  iov[1].iov_len = 5000;
+  iov[2].iov_base = data + 5100;
+  iov[2].iov_len = SIZE - 5100;
+  CHECK (writev (handle, iov, 3) == SIZE, "writev %d bytes", SIZE);
+  CHECK (tell (handle) == SIZE, "position is %d", SIZE);
+
+  seek (handle, 0);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 3000;
+  iov[1].iov_base = buf + 3000;
+  iov[1].iov_len = 1;
+  iov[2].iov_base = buf + 3001;
+  iov[2].iov_len = sizeof buf - 3001;
+  CHECK (readv (handle, iov, 3) == SIZE, "readv %d bytes", SIZE);
+  compare_bytes (buf, data, SIZE, 0, "data");
+  CHECK (readv (handle, iov, 3) == 0, "readv at end of file");
+}
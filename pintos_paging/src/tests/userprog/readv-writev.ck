@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "data"
+(readv-writev) open "data"
+(readv-writev) writev no buffers
+(readv-writev) file size is 0
+(readv-writev) readv no buffers
+(readv-writev) writev 9000 bytes
+(readv-writev) position is 9000
+(readv-writev) readv 9000 bytes
+(readv-writev) readv at end of file
+(readv-writev) end
+readv-writev: exit(0)
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Spawns a child whose executable does not exist, and one that
+   loads, and polls load_status() for each until it is no longer
+   pending: it must come out failed for the first and done for the
+   second.  wait() must then return -1 for the first and the exit
+   status of the second, after which load_status() knows neither.
+   Results are printed only after each wait(), so that they come
+   after the children's output. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Returns the load status of PID once it is no longer pending. */
+static int
+poll_load (pid_t pid)
+{
+  int status;
+
+  while ((status = load_status (pid)) == LOAD_PENDING)
+    usleep (1000);
+  return status;
+}
+
+void
+test_main (void) 
+{
+  pid_t pid;
+  int load, exit_status;
+
+  CHECK ((pid = spawn ("no-such-file")) != PID_ERROR,
+         "spawn(\"no-such-file\")");
+  load = poll_load (pid);
+  exit_status = wait (pid);
+  CHECK (load == LOAD_FAILED, "load_status() says it failed");
+  CHECK (exit_status == -1, "wait() = %d", exit_status);
+
+  CHECK ((pid = spawn ("child-simple")) != PID_ERROR,
+         "spawn(\"child-simple\")");
+  load = poll_load (pid);
+  exit_status = wait (pid);
+  CHECK (load == LOAD_OK, "load_status() says it loaded");
+  CHECK (exit_status == 81, "wait() = %d", exit_status);
+  CHECK (load_status (pid) == LOAD_FAILED,
+         "load_status() of a child waited for");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(spawn) begin
+(spawn) spawn("no-such-file")
+load: no-such-file: open failed
+(spawn) load_status() says it failed
+(spawn) wait() = -1
+(spawn) spawn("child-simple")
+(child-simple) run
+child-simple: exit(81)
+(spawn) load_status() says it loaded
+(spawn) wait() = 81
+(spawn) load_status() of a child waited for
+(spawn) end
+spawn: exit(0)
+EOF
+pass;
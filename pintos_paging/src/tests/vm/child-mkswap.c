@@ -0,0 +1,12 @@
+/* Creates the swap file for swapfile-boot, in a boot before the
+   one that swaps to it.  Not linked with tests/lib.c, for it
+   prints nothing. */
+
+#include <syscall.h>
+#include "tests/vm/swap-file.h"
+
+int
+main (void)
+{
+  return create ("swapfile", SWAP_FILE_SIZE) ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+/* Child process run by oom-wait: grows its heap a page at a time,
+   touching each page, until it is killed for memory.  Not linked
+   with tests/lib.c, for it prints nothing. */
+
+#include <syscall.h>
+
+int
+main (void)
+{
+  for (;;)
+    {
+      char *page = sbrk (4096);
+      if (page == (void *) -1)
+        return 1;
+      page[0] = 1;
+    }
+}
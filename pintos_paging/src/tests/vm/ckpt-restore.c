@@ -0,0 +1,79 @@
+/* Fills some data pages and a heap page, and reads the start of
+   "sample.txt", then saves itself with checkpoint().  It goes on to
+   scribble over all of it, and runs the checkpoint, which returns
+   from checkpoint() a second time, with 1: the restored process
+   must see its memory and its open file as they were when saved. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+#define SKIP 10
+
+static char data[3 * PAGE];
+
+static void
+fill (char *buf, size_t size, char seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    buf[i] = seed + i % 101;
+}
+
+static bool
+filled (const char *buf, size_t size, char seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (buf[i] != (char) (seed + i % 101))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  char buf[sizeof sample];
+  char *heap;
+  int handle;
+  int result;
+
+  fill (data, sizeof data, 'd');
+  heap = sbrk (PAGE);
+  if (heap == (void *) -1)
+    fail ("sbrk failed");
+  fill (heap, PAGE, 'h');
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  if (read (handle, buf, SKIP) != SKIP)
+    fail ("read failed");
+
+  result = checkpoint ("saved.ckpt");
+  if (result == 1)
+    {
+      /* The restored process. */
+      if (!filled (data, sizeof data, 'd') || !filled (heap, PAGE, 'h'))
+        fail ("restored: memory differs from when saved");
+      msg ("restored: memory is as saved");
+      if (tell (handle) != SKIP)
+        fail ("restored: file position is %u", tell (handle));
+      if (read (handle, buf + SKIP, sizeof sample - 1 - SKIP)
+          != (int) (sizeof sample - 1 - SKIP)
+          || memcmp (buf + SKIP, sample + SKIP, sizeof sample - 1 - SKIP))
+        fail ("restored: read of rest of file failed");
+      msg ("restored: file is open at the same position");
+      exit (0);
+    }
+  if (result != 0)
+    fail ("checkpoint returned %d", result);
+  msg ("checkpoint saved");
+
+  fill (data, sizeof data, 'x');
+  fill (heap, PAGE, 'y');
+  seek (handle, 0);
+  msg ("wait(exec()) = %d", wait (exec ("saved.ckpt")));
+}
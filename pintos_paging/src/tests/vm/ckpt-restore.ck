@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ckpt-restore) begin
+(ckpt-restore) open "sample.txt"
+(ckpt-restore) checkpoint saved
+(ckpt-restore) restored: memory is as saved
+(ckpt-restore) restored: file is open at the same position
+saved.ckpt: exit(0)
+(ckpt-restore) wait(exec()) = 0
+(ckpt-restore) end
+ckpt-restore: exit(0)
+EOF
+pass;
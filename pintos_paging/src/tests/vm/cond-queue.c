@@ -0,0 +1,78 @@
+/* PRODUCER_CNT threads put ITEMS numbers each into a bounded queue
+   that the main thread takes them from, using a mutex and two
+   condition variables.  Producers wait while the queue is full and
+   the consumer while it is empty.  Every number must come out once,
+   and the last producer to finish broadcasts. */
+
+#include <synch.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PRODUCER_CNT 3
+#define ITEMS 500
+#define QUEUE_SIZE 4
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+static struct condvar not_empty = CONDVAR_INITIALIZER;
+static struct condvar not_full = CONDVAR_INITIALIZER;
+static int queue[QUEUE_SIZE];
+static int head, tail;
+static int producers_left = PRODUCER_CNT;
+
+static void
+producer (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 1; i <= ITEMS; i++)
+    {
+      mutex_lock (&mutex);
+      while (tail - head == QUEUE_SIZE)
+        cond_wait (&not_full, &mutex);
+      queue[tail++ % QUEUE_SIZE] = i;
+      cond_signal (&not_empty);
+      mutex_unlock (&mutex);
+    }
+
+  mutex_lock (&mutex);
+  if (--producers_left == 0)
+    cond_broadcast (&not_empty);
+  mutex_unlock (&mutex);
+}
+
+void
+test_main (void)
+{
+  tid_t tids[PRODUCER_CNT];
+  long long sum = 0;
+  int taken = 0;
+  int i;
+
+  for (i = 0; i < PRODUCER_CNT; i++)
+    if ((tids[i] = thread_create (producer, NULL)) == TID_ERROR)
+      fail ("thread_create %d failed", i);
+
+  mutex_lock (&mutex);
+  for (;;)
+    {
+      while (tail == head && producers_left > 0)
+        cond_wait (&not_empty, &mutex);
+      if (tail == head)
+        break;
+      sum += queue[head++ % QUEUE_SIZE];
+      taken++;
+      cond_signal (&not_full);
+    }
+  mutex_unlock (&mutex);
+
+  for (i = 0; i < PRODUCER_CNT; i++)
+    if (thread_join (tids[i]) != 0)
+      fail ("thread_join %d failed", i);
+
+  if (taken != PRODUCER_CNT * ITEMS)
+    fail ("took %d items instead of %d", taken, PRODUCER_CNT * ITEMS);
+  if (sum != (long long) PRODUCER_CNT * ITEMS * (ITEMS + 1) / 2)
+    fail ("items add up to %lld", sum);
+  msg ("took %d items", taken);
+}
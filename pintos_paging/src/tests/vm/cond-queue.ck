@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cond-queue) begin
+(cond-queue) took 1500 items
+(cond-queue) end
+cond-queue: exit(0)
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Forks a process whose pages are resident, so that the two share
+   them copy-on-write, then has both parent and child write to
+   every shared page.  Each must see only its own writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (8 * 4096)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of buf is C. */
+static void
+check_fill (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %02hhx instead of %02hhx", who, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+
+  memset (buf, 'p', SIZE);
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      check_fill ('p', "child before writing");
+      memset (buf, 'c', SIZE);
+      check_fill ('c', "child after writing");
+      msg ("child saw its own writes");
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  memset (buf, 'q', SIZE);
+  check_fill ('q', "parent after writing");
+  msg ("wait(fork()) = %d", wait (pid));
+  check_fill ('q', "parent after child exited");
+  msg ("parent saw its own writes");
+}
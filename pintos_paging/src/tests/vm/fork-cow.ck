@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) fork
+(fork-cow) child saw its own writes
+fork-cow: exit(0)
+(fork-cow) wait(fork()) = 0
+(fork-cow) parent saw its own writes
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
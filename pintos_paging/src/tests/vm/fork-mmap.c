@@ -0,0 +1,49 @@
+/* Maps a file and writes to it through the mapping, then forks.
+   A mapping is not inherited, so the child is killed when it
+   touches the mapped address.  The parent's mapping is left as it
+   was: still there and writable, and its changes reach the file
+   when it is unmapped. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  char buf[1024];
+  int handle;
+  mapid_t map;
+  pid_t pid;
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, strlen (sample) / 2);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      msg ("child reads the mapped address");
+      msg ("child read %02hhx", *(volatile char *) ACTUAL);
+      fail ("child should have been killed");
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+  msg ("wait(fork()) = %d", wait (pid));
+
+  /* Finish writing the file through the parent's mapping. */
+  memcpy (ACTUAL + strlen (sample) / 2, sample + strlen (sample) / 2,
+          strlen (sample) - strlen (sample) / 2);
+  munmap (map);
+
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  close (handle);
+}
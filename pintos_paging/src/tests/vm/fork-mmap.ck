@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-mmap) begin
+(fork-mmap) create "sample.txt"
+(fork-mmap) open "sample.txt"
+(fork-mmap) mmap "sample.txt"
+(fork-mmap) fork
+(fork-mmap) child reads the mapped address
+fork-mmap: exit(-1)
+(fork-mmap) wait(fork()) = -1
+(fork-mmap) compare read data against written data
+(fork-mmap) end
+fork-mmap: exit(0)
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Encrypts 1 MB of memory, then forks, like page-linear.  Both
+   processes decrypt their copy, in turn breaking the sharing of
+   every page, and check that it is back to what it was.  Together
+   the two copies take more than the user pool, so pages are
+   evicted while shared, while being copied, and afterwards. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+
+static char buf[SIZE];
+
+/* Decrypts buf and fails unless it then holds only 0x5a. */
+static void
+decrypt_and_check (const char *who)
+{
+  struct arc4 arc4;
+  size_t i;
+
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("%s: byte %zu != 0x5a", who, i);
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  pid_t pid;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      decrypt_and_check ("child");
+      msg ("child's copy is intact");
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  decrypt_and_check ("parent");
+  msg ("wait(fork()) = %d", wait (pid));
+  msg ("parent's copy is intact");
+}
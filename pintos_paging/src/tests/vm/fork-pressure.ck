@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-pressure) begin
+(fork-pressure) initialize
+(fork-pressure) fork
+(fork-pressure) child's copy is intact
+fork-pressure: exit(0)
+(fork-pressure) wait(fork()) = 0
+(fork-pressure) parent's copy is intact
+(fork-pressure) end
+fork-pressure: exit(0)
+EOF
+pass;
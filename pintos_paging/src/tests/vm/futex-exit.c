@@ -0,0 +1,26 @@
+/* The main thread waits on a futex that nobody wakes, while another
+   thread calls exit().  The exit wakes the main thread, and the
+   process exits with that thread's status. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word;
+
+static void
+exiter (void *aux UNUSED)
+{
+  usleep (10000);
+  exit (7);
+}
+
+void
+test_main (void)
+{
+  CHECK (thread_create (exiter, NULL) != TID_ERROR, "thread_create");
+  msg ("futex_wait");
+  while (futex_wait (&word, 0) == 0)
+    continue;
+  fail ("main thread went on after the process exited");
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-exit) begin
+(futex-exit) thread_create
+(futex-exit) futex_wait
+futex-exit: exit(7)
+EOF
+pass;
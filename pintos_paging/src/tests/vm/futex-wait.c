@@ -0,0 +1,36 @@
+/* futex_wait() returns -1 at once if the word no longer holds the
+   value given, and futex_wake() with nobody waiting wakes nobody.
+   A thread that waits on a word until it changes is woken by the
+   thread that changes it, and sees the new value. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word;
+static int seen;
+
+static void
+waiter (void *aux UNUSED)
+{
+  while (*(volatile int *) &word == 0)
+    futex_wait (&word, 0);
+  seen = word;
+}
+
+void
+test_main (void)
+{
+  tid_t tid;
+
+  CHECK (futex_wait (&word, 1) == -1, "futex_wait on a changed word");
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake with nobody waiting");
+
+  CHECK ((tid = thread_create (waiter, NULL)) != TID_ERROR,
+         "thread_create");
+  usleep (10000);
+  *(volatile int *) &word = 7;
+  futex_wake (&word, 1);
+  CHECK (thread_join (tid) == 0, "thread_join");
+  CHECK (seen == 7, "waiter saw the new value");
+}
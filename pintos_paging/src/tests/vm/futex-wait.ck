@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wait) begin
+(futex-wait) futex_wait on a changed word
+(futex-wait) futex_wake with nobody waiting
+(futex-wait) thread_create
+(futex-wait) thread_join
+(futex-wait) waiter saw the new value
+(futex-wait) end
+futex-wait: exit(0)
+EOF
+pass;
@@ -0,0 +1,59 @@
+/* Run with -mlock-limit=4.  Locks pages up to the limit and checks
+   that mlock() refuses one more, that munlock() of pages that are
+   not locked succeeds and changes nothing, and that unlocking
+   pages makes room under the limit again.  Also checks that
+   munlock() refuses a misaligned address and pages that are not
+   mapped. */
+
+#include <round.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+#define LIMIT 4                 /* As set by -mlock-limit. */
+
+static char buf[(LIMIT + 3) * PAGE];
+
+/* Returns the number of user frames locked now, less BASE. */
+static int
+locked_frames (uint32_t base)
+{
+  struct mem_stats stats;
+
+  memstats (&stats);
+  return stats.locked_frames - base;
+}
+
+void
+test_main (void)
+{
+  char *pages = (char *) ROUND_UP ((uintptr_t) buf, PAGE);
+  struct mem_stats stats;
+  uint32_t base;
+
+  memstats (&stats);
+  base = stats.locked_frames;
+
+  CHECK (mlock (pages, LIMIT * PAGE) == 0, "mlock %d pages", LIMIT);
+  CHECK (locked_frames (base) == LIMIT, "%d frames locked", LIMIT);
+  CHECK (mlock (pages + LIMIT * PAGE, PAGE) == -1,
+         "mlock 1 page over the limit");
+  CHECK (mlock (pages, PAGE) == 0, "mlock a locked page again");
+
+  CHECK (munlock (pages + LIMIT * PAGE, 2 * PAGE) == 0,
+         "munlock 2 pages that are not locked");
+  CHECK (locked_frames (base) == LIMIT, "%d frames locked", LIMIT);
+
+  CHECK (munlock (pages, 2 * PAGE) == 0, "munlock 2 pages");
+  CHECK (locked_frames (base) == LIMIT - 2, "%d frames locked", LIMIT - 2);
+  CHECK (mlock (pages + LIMIT * PAGE, 2 * PAGE) == 0,
+         "mlock 2 other pages");
+  CHECK (mlock (pages, PAGE) == -1, "mlock 1 page over the limit");
+  CHECK (locked_frames (base) == LIMIT, "%d frames locked", LIMIT);
+
+  CHECK (munlock (pages + 1, PAGE) == -1, "munlock a misaligned address");
+  CHECK (munlock ((void *) 0x20000000, PAGE) == -1,
+         "munlock a page that is not mapped");
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlock-limit) begin
+(mlock-limit) mlock 4 pages
+(mlock-limit) 4 frames locked
+(mlock-limit) mlock 1 page over the limit
+(mlock-limit) mlock a locked page again
+(mlock-limit) munlock 2 pages that are not locked
+(mlock-limit) 4 frames locked
+(mlock-limit) munlock 2 pages
+(mlock-limit) 2 frames locked
+(mlock-limit) mlock 2 other pages
+(mlock-limit) mlock 1 page over the limit
+(mlock-limit) 4 frames locked
+(mlock-limit) munlock a misaligned address
+(mlock-limit) munlock a page that is not mapped
+(mlock-limit) end
+mlock-limit: exit(0)
+EOF
+pass;
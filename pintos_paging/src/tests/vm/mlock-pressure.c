@@ -0,0 +1,88 @@
+/* Locks 16 pages that hold a pattern, then encrypts 2 MB of other
+   memory, like page-linear, so that the user pool runs out and
+   pages are evicted.  The locked pages must not be: reading them
+   back afterward takes no page fault, and finds the pattern.
+   Once unlocked, they may be evicted again, and must still hold
+   the pattern when brought back. */
+
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+#define LOCK_PAGES 16
+#define SIZE (2 * 1024 * 1024)
+
+static char locked[(LOCK_PAGES + 1) * PAGE];
+static char buf[SIZE];
+
+/* Encrypts BUF twice, which leaves it as it was, evicting pages
+   on the way. */
+static void
+press (void)
+{
+  struct arc4 arc4;
+
+  memset (buf, 0x5a, sizeof buf);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+}
+
+/* Returns true if PAGES hold the pattern. */
+static bool
+check_pattern (const char *pages)
+{
+  size_t i;
+
+  for (i = 0; i < LOCK_PAGES * PAGE; i++)
+    if (pages[i] != (char) (i % 251))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  char *pages = (char *) ROUND_UP ((uintptr_t) locked, PAGE);
+  struct rusage before, after;
+  bool intact;
+  size_t i;
+
+  for (i = 0; i < LOCK_PAGES * PAGE; i++)
+    pages[i] = i % 251;
+  CHECK (mlock (pages, LOCK_PAGES * PAGE) == 0, "mlock %d pages", LOCK_PAGES);
+
+  msg ("encrypt 2 MB twice");
+  press ();
+
+  /* Read in place, so that the only pages touched between the two
+     calls are the locked ones, the stack and the code running. */
+  getrusage (RUSAGE_SELF, &before);
+  intact = true;
+  for (i = 0; i < LOCK_PAGES * PAGE; i++)
+    if (pages[i] != (char) (i % 251))
+      intact = false;
+  getrusage (RUSAGE_SELF, &after);
+  if (!intact)
+    fail ("locked pages changed");
+  if (after.major_faults != before.major_faults
+      || after.minor_faults != before.minor_faults)
+    fail ("reading locked pages took %d page faults",
+          (int) (after.major_faults + after.minor_faults
+                 - before.major_faults - before.minor_faults));
+  msg ("locked pages are intact and resident");
+
+  CHECK (munlock (pages, LOCK_PAGES * PAGE) == 0,
+         "munlock %d pages", LOCK_PAGES);
+  msg ("encrypt 2 MB twice");
+  press ();
+  if (!check_pattern (pages))
+    fail ("unlocked pages changed");
+  msg ("unlocked pages are intact");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mlock-pressure) begin
+(mlock-pressure) mlock 16 pages
+(mlock-pressure) encrypt 2 MB twice
+(mlock-pressure) locked pages are intact and resident
+(mlock-pressure) munlock 16 pages
+(mlock-pressure) encrypt 2 MB twice
+(mlock-pressure) unlocked pages are intact
+(mlock-pressure) end
+mlock-pressure: exit(0)
+EOF
+pass;
@@ -0,0 +1,57 @@
+/* THREAD_CNT threads each add to a counter ITERATIONS times under a
+   mutex.  Now and then a thread sleeps holding it, so that the
+   others wait for it in the kernel.  No increment may be lost.
+   Also checks mutex_trylock() on a held and on a free mutex. */
+
+#include <synch.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ITERATIONS 2000
+
+static struct mutex mutex = MUTEX_INITIALIZER;
+static int counter;
+
+static void
+adder (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      int c;
+
+      mutex_lock (&mutex);
+      c = counter;
+      if (i % 200 == 0)
+        usleep (1000);
+      counter = c + 1;
+      mutex_unlock (&mutex);
+    }
+}
+
+void
+test_main (void)
+{
+  tid_t tids[THREAD_CNT];
+  int i;
+
+  mutex_lock (&mutex);
+  CHECK (!mutex_trylock (&mutex), "mutex_trylock on a held mutex");
+  mutex_unlock (&mutex);
+  CHECK (mutex_trylock (&mutex), "mutex_trylock on a free mutex");
+  mutex_unlock (&mutex);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if ((tids[i] = thread_create (adder, NULL)) == TID_ERROR)
+      fail ("thread_create %d failed", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_join (tids[i]) != 0)
+      fail ("thread_join %d failed", i);
+
+  if (counter != THREAD_CNT * ITERATIONS)
+    fail ("counter is %d instead of %d", counter, THREAD_CNT * ITERATIONS);
+  msg ("counter is %d", counter);
+}
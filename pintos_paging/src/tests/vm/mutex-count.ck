@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mutex-count) begin
+(mutex-count) mutex_trylock on a held mutex
+(mutex-count) mutex_trylock on a free mutex
+(mutex-count) counter is 8000
+(mutex-count) end
+mutex-count: exit(0)
+EOF
+pass;
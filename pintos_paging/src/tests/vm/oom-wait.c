@@ -0,0 +1,27 @@
+/* Fills 3.5 MB of memory, then waits for a child that grows until
+   memory and swap run out.  The parent is the larger process, but,
+   blocked in wait() for the child, it would not exit if it were
+   killed: the child must be killed instead, and the parent must find
+   its memory intact. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (3584 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+  msg ("wait(exec()) = %d", wait (exec ("child-oom")));
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu of the parent's memory changed", i);
+  msg ("parent's memory is intact");
+}
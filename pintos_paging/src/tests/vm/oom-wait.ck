@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+fail "child-oom was not killed for memory\n"
+  if !grep (/^Out of memory: killed child-oom, /, @output);
+@output = grep (!/^Out of memory: killed /, @output);
+compare_output ("run", IGNORE_USER_FAULTS => 1, \@output, [<<'EOF']);
+(oom-wait) begin
+child-oom: exit(-1)
+(oom-wait) wait(exec()) = -1
+(oom-wait) parent's memory is intact
+(oom-wait) end
+oom-wait: exit(0)
+EOF
+pass;
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-big-mem) begin
+(page-big-mem) initialize
+(page-big-mem) read pass
+(page-big-mem) read/modify/write pass one
+(page-big-mem) read/modify/write pass two
+(page-big-mem) read pass
+(page-big-mem) end
+EOF
+pass;
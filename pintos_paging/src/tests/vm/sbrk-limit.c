@@ -0,0 +1,37 @@
+/* Maps a file two pages past the end of the heap, and checks that
+   sbrk() grows the heap up to the mapping but not into it, leaving
+   the break where it was when it refuses; and that once the file
+   is unmapped, the heap grows over its pages. */
+
+#include <round.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+
+void
+test_main (void)
+{
+  char *start = sbrk (0);
+  char *map_addr = (char *) ROUND_UP ((uintptr_t) start, PAGE) + 2 * PAGE;
+  int handle;
+  mapid_t map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, map_addr)) != MAP_FAILED,
+         "mmap \"sample.txt\" past the heap");
+
+  CHECK (sbrk (map_addr - start + PAGE) == (void *) -1,
+         "sbrk into the mapping");
+  if (sbrk (0) != start)
+    fail ("break moved after a failed sbrk");
+  CHECK (sbrk (map_addr - start) == start, "sbrk up to the mapping");
+  CHECK (sbrk (1) == (void *) -1, "sbrk 1 byte into the mapping");
+
+  munmap (map);
+  msg ("munmap");
+  CHECK (sbrk (PAGE) == map_addr, "sbrk over the unmapped pages");
+  map_addr[0] = 'x';
+}
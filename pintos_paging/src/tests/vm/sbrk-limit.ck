@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sbrk-limit) begin
+(sbrk-limit) open "sample.txt"
+(sbrk-limit) mmap "sample.txt" past the heap
+(sbrk-limit) sbrk into the mapping
+(sbrk-limit) sbrk up to the mapping
+(sbrk-limit) sbrk 1 byte into the mapping
+(sbrk-limit) munmap
+(sbrk-limit) sbrk over the unmapped pages
+(sbrk-limit) end
+sbrk-limit: exit(0)
+EOF
+pass;
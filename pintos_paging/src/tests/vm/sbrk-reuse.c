@@ -0,0 +1,62 @@
+/* Grows the heap by 1 MB and encrypts it, like page-linear, then
+   advises that it is not needed (MADV_DONTNEED) and shrinks it
+   back, giving its pages back.  Encrypting as much static data
+   again takes more than the user pool, evicting the heap pages
+   first.  The heap then grows back into the same pages, which
+   must still hold their data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+
+static char buf[SIZE];
+
+/* Decrypts DATA and fails unless it then holds only 0x5a. */
+static void
+decrypt_and_check (char *data, const char *what)
+{
+  struct arc4 arc4;
+  size_t i;
+
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, data, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (data[i] != 0x5a)
+      fail ("%s: byte %zu != 0x5a", what, i);
+}
+
+/* Fills DATA with 0x5a and encrypts it. */
+static void
+encrypt (char *data)
+{
+  struct arc4 arc4;
+
+  memset (data, 0x5a, SIZE);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, data, SIZE);
+}
+
+void
+test_main (void)
+{
+  char *heap = sbrk (SIZE);
+
+  if (heap == (void *) -1)
+    fail ("sbrk failed");
+  msg ("initialize heap");
+  encrypt (heap);
+  CHECK (madvise (heap, SIZE, MADV_DONTNEED) == 0, "madvise MADV_DONTNEED");
+  CHECK (sbrk (-SIZE) == heap + SIZE, "sbrk back to the start");
+
+  msg ("initialize static data");
+  encrypt (buf);
+  decrypt_and_check (buf, "static data");
+
+  CHECK (sbrk (SIZE) == heap, "sbrk into the same pages");
+  decrypt_and_check (heap, "heap");
+  msg ("heap is intact");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sbrk-reuse) begin
+(sbrk-reuse) initialize heap
+(sbrk-reuse) madvise MADV_DONTNEED
+(sbrk-reuse) sbrk back to the start
+(sbrk-reuse) initialize static data
+(sbrk-reuse) sbrk into the same pages
+(sbrk-reuse) heap is intact
+(sbrk-reuse) end
+sbrk-reuse: exit(0)
+EOF
+pass;
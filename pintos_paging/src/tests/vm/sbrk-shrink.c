@@ -0,0 +1,37 @@
+/* Grows the heap by a few pages and fills them, then shrinks it.
+   Checks the breaks that sbrk() returns, that it cannot shrink the
+   heap past its start, and that pages given back keep their
+   contents for the heap to grow into again. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE 4096
+#define PAGE_CNT 4
+
+void
+test_main (void)
+{
+  char *start = sbrk (0);
+  size_t i;
+
+  CHECK (sbrk (PAGE_CNT * PAGE) == start, "sbrk %d pages", PAGE_CNT);
+  for (i = 0; i < PAGE_CNT * PAGE; i++)
+    start[i] = i % 251;
+
+  CHECK (sbrk (-2 * PAGE) == start + PAGE_CNT * PAGE, "sbrk -2 pages");
+  if (sbrk (0) != start + (PAGE_CNT - 2) * PAGE)
+    fail ("break is not 2 pages lower");
+  CHECK (sbrk (-(intptr_t) sbrk (0) + 1) == (void *) -1,
+         "sbrk past the start of the heap");
+  if (sbrk (0) != start + (PAGE_CNT - 2) * PAGE)
+    fail ("break moved after a failed sbrk");
+
+  CHECK (sbrk (2 * PAGE) == start + (PAGE_CNT - 2) * PAGE, "sbrk 2 pages");
+  for (i = 0; i < PAGE_CNT * PAGE; i++)
+    if (start[i] != (char) (i % 251))
+      fail ("byte %zu of the heap changed", i);
+  msg ("heap is intact");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sbrk-shrink) begin
+(sbrk-shrink) sbrk 4 pages
+(sbrk-shrink) sbrk -2 pages
+(sbrk-shrink) sbrk past the start of the heap
+(sbrk-shrink) sbrk 2 pages
+(sbrk-shrink) heap is intact
+(sbrk-shrink) end
+sbrk-shrink: exit(0)
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Maps a shared-memory object twice, and checks that a write through
+   one mapping shows through the other, even after the first is
+   removed.  Removing the last mapping destroys the object: mapping
+   the name again gives a new one, all zero. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define A ((char *) 0x10000000)
+#define B ((char *) 0x20000000)
+#define PAGE 4096
+
+static void
+check_page (const char *page, char c)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE; i++)
+    if (page[i] != c)
+      fail ("byte %zu is %d, not %d", i, page[i], c);
+}
+
+void
+test_main (void)
+{
+  mapid_t a, b;
+
+  CHECK ((a = shm_map ("shm-destroy", PAGE, A)) != MAP_FAILED,
+         "shm_map at A");
+  memset (A, 'x', PAGE);
+  CHECK ((b = shm_map ("shm-destroy", PAGE, B)) != MAP_FAILED,
+         "shm_map at B");
+  check_page (B, 'x');
+  CHECK (shm_map ("shm-destroy", 2 * PAGE, B + 2 * PAGE) == MAP_FAILED,
+         "shm_map of more than the object fails");
+
+  munmap (a);
+  msg ("munmap A");
+  check_page (B, 'x');
+  munmap (b);
+  msg ("munmap B");
+
+  CHECK (shm_map ("shm-destroy", 2 * PAGE, A) != MAP_FAILED,
+         "shm_map a new object at A");
+  check_page (A, 0);
+  check_page (A + PAGE, 0);
+  msg ("the new object is all zero");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-destroy) begin
+(shm-destroy) shm_map at A
+(shm-destroy) shm_map at B
+(shm-destroy) shm_map of more than the object fails
+(shm-destroy) munmap A
+(shm-destroy) munmap B
+(shm-destroy) shm_map a new object at A
+(shm-destroy) the new object is all zero
+(shm-destroy) end
+shm-destroy: exit(0)
+EOF
+pass;
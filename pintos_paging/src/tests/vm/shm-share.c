@@ -0,0 +1,49 @@
+/* Maps a shared-memory object and writes to its first page, then
+   forks.  Mappings are not inherited, so the child maps the object
+   itself, checks that it sees the parent's data, and writes to the
+   second page, which the parent then checks in turn. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ADDR ((char *) 0x10000000)
+#define PAGE 4096
+
+static void
+check_page (const char *page, char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE; i++)
+    if (page[i] != c)
+      fail ("%s: byte %zu is %d, not %d", who, i, page[i], c);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+
+  CHECK (shm_map ("shm-share", 2 * PAGE, ADDR) != MAP_FAILED,
+         "shm_map \"shm-share\"");
+  memset (ADDR, 'p', PAGE);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      CHECK (shm_map ("shm-share", 2 * PAGE, ADDR) != MAP_FAILED,
+             "child: shm_map \"shm-share\"");
+      check_page (ADDR, 'p', "child");
+      msg ("child sees the parent's page");
+      memset (ADDR + PAGE, 'c', PAGE);
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  msg ("wait(fork()) = %d", wait (pid));
+  check_page (ADDR + PAGE, 'c', "parent");
+  msg ("parent sees the child's page");
+}
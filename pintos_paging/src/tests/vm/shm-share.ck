@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-share) begin
+(shm-share) shm_map "shm-share"
+(shm-share) child: shm_map "shm-share"
+(shm-share) child sees the parent's page
+shm-share: exit(0)
+(shm-share) wait(fork()) = 0
+(shm-share) parent sees the child's page
+(shm-share) end
+shm-share: exit(0)
+EOF
+pass;
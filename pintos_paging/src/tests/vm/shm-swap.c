@@ -0,0 +1,58 @@
+/* Encrypts a 2 MB shared-memory object, like page-linear, which is
+   more than fits in the user pool, so its pages go to swap.  A
+   forked child maps the object and decrypts it in place, bringing
+   the pages back in and sending them out again while both processes
+   map them; the parent then checks that it sees the decrypted
+   data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ADDR ((char *) 0x10000000)
+#define SIZE (2 * 1024 * 1024)
+
+/* Fails unless the object holds only 0x5a. */
+static void
+check (const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (ADDR[i] != 0x5a)
+      fail ("%s: byte %zu != 0x5a", who, i);
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  pid_t pid;
+
+  CHECK (shm_map ("shm-swap", SIZE, ADDR) != MAP_FAILED,
+         "shm_map \"shm-swap\"");
+  msg ("initialize");
+  memset (ADDR, 0x5a, SIZE);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, ADDR, SIZE);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      if (shm_map ("shm-swap", SIZE, ADDR) == MAP_FAILED)
+        fail ("child: shm_map failed");
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, ADDR, SIZE);
+      check ("child");
+      msg ("child decrypted the object");
+      exit (0);
+    }
+  if (pid == PID_ERROR)
+    fail ("fork failed");
+
+  msg ("wait(fork()) = %d", wait (pid));
+  check ("parent");
+  msg ("parent sees the decrypted object");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-swap) begin
+(shm-swap) shm_map "shm-swap"
+(shm-swap) initialize
+(shm-swap) child decrypted the object
+shm-swap: exit(0)
+(shm-swap) wait(fork()) = 0
+(shm-swap) parent sees the decrypted object
+(shm-swap) end
+shm-swap: exit(0)
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Swaps to a file, with no swap partition: fills 2 MB of memory
+   with a pattern, more than the user pool holds, and checks that
+   the pages come back from the file intact.
+
+   swapon-file creates the file and adds it with swapon(), after
+   checking that swapon() refuses a file that does not exist.
+   swapfile-boot finds it added already, by -swapfile, from a file
+   that child-mkswap created in an earlier boot.  Either way, adding
+   it again fails, and the file can no longer be written. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/swap-file.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int handle;
+  size_t i;
+
+  if (!strcmp (test_name, "swapon-file"))
+    {
+      CHECK (create ("swapfile", SWAP_FILE_SIZE), "create \"swapfile\"");
+      CHECK (!swapon ("no-such-file", 1), "swapon \"no-such-file\"");
+      CHECK (swapon ("swapfile", 1), "swapon \"swapfile\"");
+    }
+  CHECK (!swapon ("swapfile", 1), "swapon \"swapfile\" again");
+  CHECK ((handle = open ("swapfile")) > 1, "open \"swapfile\"");
+  CHECK (write (handle, buf, 1) == 0, "write to \"swapfile\"");
+  close (handle);
+
+  msg ("fill 2 MB");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+  msg ("check 2 MB");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu is %d, not %d", i, buf[i], (int) (i % 251));
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_VM_SWAP_FILE_H
+#define TESTS_VM_SWAP_FILE_H
+
+/* Size of the swap file of swapon-file and swapfile-boot: more
+   than the 2 MB they fill, so that no page needs to be dropped. */
+#define SWAP_FILE_SIZE (3 * 1024 * 1024)
+
+#endif /* tests/vm/swap-file.h */
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+fail "-swapfile did not add \"swapfile\"\n"
+  if !grep (/^swap: using file swapfile, \d+ pages, priority 1$/, @output);
+@output = grep (!/^swap: device given twice$/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(swapfile-boot) begin
+(swapfile-boot) swapon "swapfile" again
+(swapfile-boot) open "swapfile"
+(swapfile-boot) write to "swapfile"
+(swapfile-boot) fill 2 MB
+(swapfile-boot) check 2 MB
+(swapfile-boot) end
+swapfile-boot: exit(0)
+EOF
+pass;
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+fail "swapon did not add \"swapfile\"\n"
+  if !grep (/^swap: using file swapfile, \d+ pages, priority 1$/, @output);
+@output = grep (!/^swap: (using file |device given twice)/, @output);
+compare_output ("run", \@output, [<<'EOF']);
+(swapon-file) begin
+(swapon-file) create "swapfile"
+(swapon-file) swapon "no-such-file"
+(swapon-file) swapon "swapfile"
+(swapon-file) swapon "swapfile" again
+(swapon-file) open "swapfile"
+(swapon-file) write to "swapfile"
+(swapon-file) fill 2 MB
+(swapon-file) check 2 MB
+(swapon-file) end
+swapon-file: exit(0)
+EOF
+pass;
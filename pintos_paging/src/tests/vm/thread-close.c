@@ -0,0 +1,41 @@
+/* A thread blocks reading an empty pipe while the main thread
+   closes the fd it is reading from.  The read goes on with the
+   pipe end it started with, and gets the data written afterward;
+   the fd itself is closed at once. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char data[] = "closed under a reader";
+static int fds[2];
+static char buf[sizeof data];
+static int bytes_read;
+
+static void
+reader (void *aux UNUSED)
+{
+  bytes_read = read (fds[0], buf, sizeof buf);
+}
+
+void
+test_main (void)
+{
+  tid_t tid;
+
+  CHECK (pipe (fds) == 0, "pipe");
+  CHECK ((tid = thread_create (reader, NULL)) != TID_ERROR,
+         "thread_create");
+  usleep (10000);
+  msg ("close read end");
+  close (fds[0]);
+  CHECK (read (fds[0], buf, sizeof buf) == -1, "read from closed fd");
+
+  CHECK (write (fds[1], data, sizeof data) == sizeof data,
+         "write %zu bytes", sizeof data);
+  CHECK (thread_join (tid) == 0, "thread_join");
+  if (bytes_read != sizeof data || memcmp (buf, data, sizeof data))
+    fail ("reader read %d bytes", bytes_read);
+  msg ("reader got the data");
+}
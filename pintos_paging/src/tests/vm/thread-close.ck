@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-close) begin
+(thread-close) pipe
+(thread-close) thread_create
+(thread-close) close read end
+(thread-close) read from closed fd
+(thread-close) write 22 bytes
+(thread-close) thread_join
+(thread-close) reader got the data
+(thread-close) end
+thread-close: exit(0)
+EOF
+pass;
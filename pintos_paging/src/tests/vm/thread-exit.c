@@ -0,0 +1,26 @@
+/* A thread other than the main one calls exit() while the main
+   thread waits to join it.  The whole process exits, with that
+   thread's status, and the main thread never returns to user
+   mode. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+exiter (void *aux UNUSED)
+{
+  exit (42);
+}
+
+void
+test_main (void)
+{
+  tid_t tid;
+
+  CHECK ((tid = thread_create (exiter, NULL)) != TID_ERROR,
+         "thread_create");
+  msg ("thread_join");
+  thread_join (tid);
+  fail ("main thread went on after the process exited");
+}
@@ -0,0 +1,58 @@
+/* Starts THREAD_CNT threads that wait for a signal and then all
+   write to the same pages, never touched before, each its own byte
+   of every page, so that their faults on each page race.  Each
+   page must be loaded only once, keeping every thread's byte. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 8
+#define PAGE_CNT 64
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+static int go;
+
+static void
+toucher (void *aux)
+{
+  int i = (intptr_t) aux;
+  int page;
+
+  while (*(volatile int *) &go == 0)
+    futex_wait (&go, 0);
+  for (page = 0; page < PAGE_CNT; page++)
+    buf[page * PAGE_SIZE + i] = i + 1;
+}
+
+void
+test_main (void)
+{
+  tid_t tids[THREAD_CNT];
+  int i, page;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if ((tids[i] = thread_create (toucher, (void *) (intptr_t) i))
+        == TID_ERROR)
+      fail ("thread_create %d failed", i);
+  msg ("started %d threads", THREAD_CNT);
+
+  *(volatile int *) &go = 1;
+  futex_wake (&go, THREAD_CNT);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_join (tids[i]) != 0)
+      fail ("thread_join %d failed", i);
+  msg ("joined %d threads", THREAD_CNT);
+
+  for (page = 0; page < PAGE_CNT; page++)
+    for (i = 0; i < PAGE_SIZE; i++)
+      {
+        char expected = i < THREAD_CNT ? i + 1 : 0;
+        if (buf[page * PAGE_SIZE + i] != expected)
+          fail ("byte %d of page %d is %d instead of %d",
+                i, page, buf[page * PAGE_SIZE + i], expected);
+      }
+  msg ("every thread's writes are there");
+}
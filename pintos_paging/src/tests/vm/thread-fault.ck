@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-fault) begin
+(thread-fault) started 8 threads
+(thread-fault) joined 8 threads
+(thread-fault) every thread's writes are there
+(thread-fault) end
+thread-fault: exit(0)
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Starts THREAD_CNT threads that each fill in their own slot of an
+   array, then joins them all.  Joining a thread that was already
+   joined, or a thread id that is not one, fails. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 8
+
+static int squares[THREAD_CNT];
+
+static void
+square (void *aux)
+{
+  int i = (intptr_t) aux;
+  squares[i] = i * i;
+}
+
+void
+test_main (void)
+{
+  tid_t tids[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if ((tids[i] = thread_create (square, (void *) (intptr_t) i))
+        == TID_ERROR)
+      fail ("thread_create %d failed", i);
+  msg ("started %d threads", THREAD_CNT);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if (thread_join (tids[i]) != 0)
+      fail ("thread_join %d failed", i);
+  msg ("joined %d threads", THREAD_CNT);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if (squares[i] != i * i)
+      fail ("thread %d stored %d instead of %d", i, squares[i], i * i);
+
+  CHECK (thread_join (tids[0]) == -1, "join a joined thread");
+  CHECK (thread_join (tids[THREAD_CNT - 1] + 1000) == -1,
+         "join a thread that does not exist");
+}
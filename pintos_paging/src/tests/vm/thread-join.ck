@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-join) begin
+(thread-join) started 8 threads
+(thread-join) joined 8 threads
+(thread-join) join a joined thread
+(thread-join) join a thread that does not exist
+(thread-join) end
+thread-join: exit(0)
+EOF
+pass;
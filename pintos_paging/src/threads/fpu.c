@@ -0,0 +1,185 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+
+/* Control register flags used here.
+   See [IA32-v3a] 2.5 "Control Registers". */
+#define CR0_MP 0x00000002       /* WAIT/FWAIT also trap on TS. */
+#define CR0_EM 0x00000004       /* Every FPU instruction traps. */
+#define CR0_TS 0x00000008       /* Task switched: next FPU use traps. */
+#define CR0_NE 0x00000020       /* Report x87 errors as #MF. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE/FXRSTOR in use; enables SSE. */
+#define CR4_OSXMMEXCPT 0x00000400 /* SIMD errors raise #XF. */
+
+/* CPUID function 1 reports FXSAVE/FXRSTOR support in bit 24 of
+   EDX.  See [IA32-v2a] "CPUID". */
+#define CPUID_FXSR (1u << 24)
+
+/* Sizes of the areas written by FXSAVE (which must be 16-byte
+   aligned) and by the older FNSAVE. */
+#define FXSAVE_SIZE 512
+#define FNSAVE_SIZE 108
+
+/* Use FXSAVE and FXRSTOR, which also cover SSE, or FNSAVE and
+   FRSTOR? */
+static bool use_fxsr;
+
+/* Size of a state area. */
+static size_t state_size;
+
+/* State areas, one per thread that has used the FPU. */
+static struct kmem_cache state_cache;
+
+/* State right after FNINIT, copied into each new state area. */
+static uint8_t init_state[FXSAVE_SIZE] __attribute__ ((aligned (16)));
+
+/* Thread whose registers are loaded in the FPU, or a null
+   pointer.  Only the bootstrap processor runs threads, so one
+   suffices. */
+static struct thread *fpu_owner;
+
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0));
+}
+
+/* Makes the next FPU instruction raise #NM. */
+static inline void
+set_ts (void)
+{
+  write_cr0 (read_cr0 () | CR0_TS);
+}
+
+/* Lets FPU instructions run. */
+static inline void
+clear_ts (void)
+{
+  asm volatile ("clts");
+}
+
+/* Saves the FPU registers into STATE. */
+static void
+save_state (uint8_t *state)
+{
+  if (use_fxsr)
+    asm volatile ("fxsave (%0)" : : "r" (state) : "memory");
+  else
+    asm volatile ("fnsave (%0)" : : "r" (state) : "memory");
+}
+
+/* Loads the FPU registers from STATE. */
+static void
+restore_state (const uint8_t *state)
+{
+  if (use_fxsr)
+    asm volatile ("fxrstor (%0)" : : "r" (state) : "memory");
+  else
+    asm volatile ("frstor (%0)" : : "r" (state) : "memory");
+}
+
+/* Enables the FPU, and SSE where the CPU has FXSAVE, and arms
+   the #NM trap.  The loader leaves CR0.EM set, which makes every
+   FPU instruction trap for good. */
+void
+fpu_init (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  use_fxsr = (edx & CPUID_FXSR) != 0;
+  state_size = use_fxsr ? FXSAVE_SIZE : FNSAVE_SIZE;
+  if (use_fxsr)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
+
+  write_cr0 ((read_cr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+  asm volatile ("fninit");
+  save_state (init_state);
+  set_ts ();
+
+  kmem_cache_init (&state_cache, "fpu_state", state_size, 16, NULL);
+}
+
+/* Called on each switch to thread T, with interrupts off: lets T
+   use the FPU directly if its registers are still loaded, and
+   otherwise arms #NM. */
+void
+fpu_activate (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t == fpu_owner)
+    clear_ts ();
+  else
+    set_ts ();
+}
+
+/* Handles #NM in the running thread: gives it a state area on
+   first use, saves the previous owner's registers and loads its
+   own.  Returns false if no state area could be allocated. */
+bool
+fpu_trap (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (cur->fpu_state == NULL)
+    {
+      uint8_t *state = kmem_cache_alloc (&state_cache);
+      if (state == NULL)
+        return false;
+      memcpy (state, init_state, state_size);
+      cur->fpu_state = state;
+    }
+
+  old_level = intr_disable ();
+  clear_ts ();
+  if (fpu_owner != cur)
+    {
+      if (fpu_owner != NULL)
+        save_state (fpu_owner->fpu_state);
+      restore_state (cur->fpu_state);
+      fpu_owner = cur;
+    }
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Frees the running thread's state area, if any, as it exits. */
+void
+fpu_release (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (cur->fpu_state == NULL)
+    return;
+
+  old_level = intr_disable ();
+  if (fpu_owner == cur)
+    {
+      fpu_owner = NULL;
+      set_ts ();
+    }
+  intr_set_level (old_level);
+
+  kmem_cache_free (&state_cache, cur->fpu_state);
+  cur->fpu_state = NULL;
+}
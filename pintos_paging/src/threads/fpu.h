@@ -0,0 +1,24 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+
+/* Lazy switching of x87/SSE state.
+
+   The kernel itself is built with -msoft-float and never touches
+   the FPU, so switch_threads() and the interrupt stubs save only
+   integer registers.  A thread gets an FPU state area the first
+   time it executes a floating-point or SIMD instruction: CR0.TS
+   is set whenever the thread that last used the FPU is not the
+   one running, so that instruction raises #NM, whose handler
+   saves the previous owner's registers and loads the running
+   thread's.  Threads that never use the FPU pay nothing. */
+
+struct thread;
+
+void fpu_init (void);
+void fpu_activate (struct thread *);
+bool fpu_trap (void);
+void fpu_release (void);
+
+#endif /* threads/fpu.h */
@@ -15,29 +15,43 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
+#include "threads/mp.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/shrink.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
+#include "threads/tunable.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
 #include "tests/threads/tests.h"
 #endif
 #ifdef VM
+#include "devices/virtio-balloon.h"
 #include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
 #include "vm/swap.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -49,20 +63,43 @@ uint32_t *init_page_dir;
 /* -f: Format the file system? */
 static bool format_filesys;
 
-/* -filesys, -scratch, -swap: Names of block devices to use,
+/* -filesys, -scratch: Names of block devices to use,
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
-#ifdef VM
-static const char *swap_bdev_name;
-#endif
+
+/* -ramdisk: Size of the RAM disk in kB, 0 for none. */
+static size_t ramdisk_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/* -pageout-low, -pageout-high: Free-frame watermarks of the
+   pageout thread, in pages.  A low watermark of 0 disables it. */
+static size_t pageout_low = 8;
+static size_t pageout_high = 32;
+
+/* -ksm: Frames scanned for identical pages per pass, 0 disables. */
+static size_t ksm_pages = 0;
+
+/* -wss: Time between two scans of the working-set estimator, in
+   milliseconds, 0 disables it. */
+static unsigned wss_ms = 0;
+#endif
+
+/* Boot phase timing: rdtsc() at the start of main() and at the
+   end of the last phase, cycles taken by each phase, and whether
+   boot is over. */
+static uint64_t boot_start_tsc, boot_phase_tsc;
+static struct boot_stats boot_stats;
+static bool boot_done;
+
 static void bss_init (void);
 static void paging_init (void);
+static void boot_phase_end (enum boot_phase);
+static void boot_end (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -84,6 +121,7 @@ main (void)
 
   /* Clear BSS. */  
   bss_init ();
+  boot_start_tsc = boot_phase_tsc = rdtsc ();
 
   /* Break command line into arguments and parse options. */
   argv = read_command_line ();
@@ -100,18 +138,30 @@ main (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  shrink_init ();
+  tunable_init ();
   malloc_init ();
+  kmem_init ();
   paging_init ();
+  trace_init ();
 
 #ifdef VM
   /* Initialize Virtual memory system. (Project 3) */
   vm_frame_init();
+  vm_supt_init();
+  vm_shm_init();
 #endif
 
+  boot_phase_end (BOOT_MEMORY);
+
+  /* Floating point, switched lazily. */
+  fpu_init ();
+
   /* Segmentation. */
 #ifdef USERPROG
   tss_init ();
   gdt_init ();
+  pagedir_init ();
 #endif
 
   /* Initialize interrupt handlers. */
@@ -121,22 +171,38 @@ main (void)
   input_init ();
 #ifdef USERPROG
   exception_init ();
+  process_init ();
   syscall_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
+  boot_phase_end (BOOT_INTERRUPTS);
   timer_calibrate ();
+  boot_phase_end (BOOT_CALIBRATE);
+  mp_init ();
+  profile_init ();
+  boot_phase_end (BOOT_CPUS);
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init (ramdisk_kb);
   locate_block_devices ();
+  boot_phase_end (BOOT_BLOCK);
   filesys_init (format_filesys);
+  boot_phase_end (BOOT_FILESYS);
 #endif
 #ifdef VM
   vm_swap_init ();
+  vm_frame_start_pageout (pageout_low, pageout_high);
+  vm_frame_start_ksm (ksm_pages);
+  vm_frame_start_wss (wss_ms);
+  vm_supt_start_prefetch ();
+  virtio_balloon_init ();
+  boot_phase_end (BOOT_SWAP);
 #endif
 
   printf ("Boot complete.\n");
@@ -149,6 +215,54 @@ main (void)
   thread_exit ();
 }
 
+/* Charges the cycles since the end of the last phase to PHASE. */
+static void
+boot_phase_end (enum boot_phase phase)
+{
+  uint64_t now = rdtsc ();
+
+  boot_stats.cycles[phase] += now - boot_phase_tsc;
+  boot_phase_tsc = now;
+}
+
+/* Ends boot, the first time it is called, and prints the cycles
+   taken by each phase. */
+static void
+boot_end (void)
+{
+  static const char *names[BOOT_PHASE_CNT] =
+    {
+      [BOOT_MEMORY] = "memory",
+      [BOOT_INTERRUPTS] = "interrupts",
+      [BOOT_CALIBRATE] = "calibrate",
+      [BOOT_CPUS] = "cpus",
+      [BOOT_BLOCK] = "block",
+      [BOOT_FILESYS] = "filesys",
+      [BOOT_SWAP] = "swap",
+      [BOOT_FSUTIL] = "fsutil",
+    };
+  int i;
+
+  if (boot_done)
+    return;
+  boot_done = true;
+  boot_stats.total = rdtsc () - boot_start_tsc;
+  boot_stats.tsc_hz = timer_tsc_hz ();
+
+  printf ("Boot:");
+  for (i = 0; i < BOOT_PHASE_CNT; i++)
+    printf (" %"PRIu64" cycles %s,", boot_stats.cycles[i], names[i]);
+  printf (" %"PRIu64" cycles total\n", boot_stats.total);
+}
+
+/* Copies the time taken by each phase of booting into *STATS.
+   The total is 0 until boot is over. */
+void
+init_get_boot_stats (struct boot_stats *stats)
+{
+  *stats = boot_stats;
+}
+
 /* Clear the "BSS", a segment that should be initialized to
    zeros.  It isn't actually stored on disk or zeroed by the
    kernel loader, so we have to zero it ourselves.
@@ -165,13 +279,30 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Each 4 MB of RAM that holds no kernel code is mapped with a
+   single 4 MB page, so that the kernel's accesses across memory
+   need few TLB entries.  The rest, including the tail of RAM
+   past the last full 4 MB, gets page tables, so that the kernel
+   code can be read-only.
+
+   The whole kernel mapping is global, if the CPU supports it:
+   it is the same in every page directory, so switching between
+   processes need not flush it from the TLB. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+  uint32_t eax, ebx, ecx, edx;
+  uint32_t global;
+
+  /* CPUID function 1 reports PGE support in bit 13 of EDX.
+     See [IA32-v2a] "CPUID". */
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  global = edx & (1 << 13) ? PTE_G : 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -183,13 +314,21 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pte_idx == 0 && paddr + PTSPAN <= init_ram_pages * PGSIZE
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (paddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -198,6 +337,13 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  if (global)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+    }
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -259,18 +405,64 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-writeback"))
+        cache_writeback_ticks = atoi (value);
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-crash"))
+        filesys_crash = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
-        swap_bdev_name = value;
+        vm_swap_devices = value;
+      else if (!strcmp (name, "-swapfile"))
+        vm_swap_files = value;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-profile"))
+        profile_interval = atoi (value);
+      else if (!strcmp (name, "-trace"))
+        trace_pages = atoi (value);
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-rusage"))
+        process_usage_on_exit = true;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-pageout-low"))
+        pageout_low = atoi (value);
+      else if (!strcmp (name, "-pageout-high"))
+        pageout_high = atoi (value);
+      else if (!strcmp (name, "-fault-around"))
+        vm_fault_around = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        vm_zswap_pages = atoi (value);
+      else if (!strcmp (name, "-ksm"))
+        ksm_pages = atoi (value);
+      else if (!strcmp (name, "-wss"))
+        wss_ms = atoi (value);
+      else if (!strcmp (name, "-stack-prefault"))
+        vm_stack_prefault = atoi (value);
+      else if (!strcmp (name, "-stride-prefetch"))
+        vm_stride_prefetch = atoi (value);
+      else if (!strcmp (name, "-rss-limit"))
+        vm_rss_limit = atoi (value);
+      else if (!strcmp (name, "-page-policy"))
+        {
+          if (!vm_frame_set_policy (value))
+            PANIC ("unknown page-replacement policy `%s' (use -h for help)",
+                   value);
+        }
+      else if (!strcmp (name, "-mlock-limit"))
+        vm_mlock_limit = atoi (value);
+      else if (!strcmp (name, "-mlockall"))
+        vm_mlockall = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -295,6 +487,7 @@ run_task (char **argv)
 {
   const char *task = argv[1];
   
+  boot_end ();
   printf ("Executing '%s':\n", task);
 #ifdef USERPROG
   process_wait (process_execute (task));
@@ -351,8 +544,10 @@ run_actions (char **argv)
       /* Invoke action and advance. */
       a->function (argv); 
       argv += a->argc;
+      if (!boot_done)
+        boot_phase_end (BOOT_FSUTIL);
     }
-  
+  boot_end ();
 }
 
 /* Prints a kernel command line help message and powers off the
@@ -385,14 +580,36 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -writeback=TICKS   Write dirty cached sectors back every TICKS.\n"
+          "  -ramdisk=KB        Add a KB kB RAM disk, ram0, for use as BDEV.\n"
+          "  -crash             Power off without writing back the file system.\n"
 #ifdef VM
-          "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -swap=BDEV[:PRIO],... Swap to each BDEV, by PRIO, instead of default.\n"
+          "  -swapfile=FILE[:PRIO],... Swap to each FILE as well, by PRIO.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the periodic timer tick while idle.\n"
+          "  -profile=TICKS     Sample the running code every TICKS timer ticks.\n"
+          "  -trace=PAGES       Trace events into a ring of PAGES pages.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -rusage            Print each process's resource usage as it exits.\n"
+#endif
+#ifdef VM
+          "  -pageout-low=COUNT Start reclaiming frames below COUNT free pages.\n"
+          "  -pageout-high=COUNT Stop reclaiming frames at COUNT free pages.\n"
+          "  -fault-around=COUNT Map up to COUNT file pages per page fault.\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
+          "  -ksm=COUNT         Merge identical pages, scanning COUNT frames per pass.\n"
+          "  -wss=MS            Estimate working sets, scanning frames every MS ms.\n"
+          "  -stack-prefault=COUNT Map up to COUNT stack pages skipped over by esp.\n"
+          "  -stride-prefetch=COUNT Prefetch up to COUNT pages along strided faults.\n"
+          "  -rss-limit=COUNT   Keep at most COUNT frames per process resident.\n"
+          "  -page-policy=NAME  Evict by NAME: lru (default), clock, wsclock, fifo.\n"
+          "  -mlock-limit=COUNT Let each process lock COUNT pages (default 64).\n"
+          "  -mlockall          Lock each process's image in memory as it loads.\n"
 #endif
           );
   shutdown_power_off ();
@@ -405,9 +622,6 @@ locate_block_devices (void)
 {
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
-#ifdef VM
-  locate_block_device (BLOCK_SWAP, swap_bdev_name);
-#endif
 }
 
 /* Figures out what block device to use for the given ROLE: the
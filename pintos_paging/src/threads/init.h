@@ -5,8 +5,11 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <syscall-nr.h>
 
 /* Page directory with kernel mappings only. */
 extern uint32_t *init_page_dir;
 
+void init_get_boot_stats (struct boot_stats *);
+
 #endif /* threads/init.h */
@@ -3,12 +3,19 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#include "devices/lapic.h"
+#ifdef VM
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -37,15 +44,46 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Per-vector counters: invocations, and TSC cycles spent in the
+   handler, in total and at most.  A handler that sleeps, such as
+   a page fault or a system call, is charged for the time until it
+   returns, and a handler is charged for any interrupt that nests
+   inside it. */
+static uint64_t intr_count[INTR_CNT];
+static uint64_t intr_cycles[INTR_CNT];
+static uint64_t intr_max_cycles[INTR_CNT];
+
+/* Longest stretch, in TSC cycles, with interrupts off on the
+   CPU, whether by intr_disable() or by interrupt entry.  The
+   current one began at rdtsc() IRQOFF_START, or none is open if
+   it is 0. */
+static uint64_t irqoff_start;
+static uint64_t irqoff_max;
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
-   pre-empted.  Handlers for external interrupts also may not
+   pre-empted, except that one may arrive during the deferred
+   work of another (see below).  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
    interrupt returns. */
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
+static uint64_t yield_tsc;      /* rdtsc() when it was first asked for. */
+
+/* Deferred interrupt work.  An external interrupt handler does
+   only what has to be done with interrupts off, such as
+   acknowledging the device, and hands the rest to intr_defer().
+   Once the interrupt has been acknowledged on the PIC, the
+   outermost intr_handler() runs the deferred work with
+   interrupts on, so that other devices are not held off behind
+   it.  Deferred work counts as interrupt context: it may not
+   sleep, but it may call intr_yield_on_return().  An interrupt
+   that arrives meanwhile only adds to the list; the yield, if
+   any, happens once all the work is done. */
+static struct list deferred_list;  /* Queued struct intr_work. */
+static bool in_deferred;        /* Are we running deferred work? */
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -59,6 +97,11 @@ static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
 static void unexpected_interrupt (const struct intr_frame *);
+static void run_deferred (void);
+
+/* Accounting of sections with interrupts off. */
+static void irqoff_begin (void);
+static void irqoff_end (void);
 
 /* Returns the current interrupt status. */
 enum intr_level
@@ -94,6 +137,8 @@ intr_enable (void)
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
      Hardware Interrupts". */
+  if (old_level == INTR_OFF)
+    irqoff_end ();
   asm volatile ("sti");
 
   return old_level;
@@ -109,6 +154,8 @@ intr_disable (void)
      See [IA32-v2b] "CLI" and [IA32-v3a] 5.8.1 "Masking Maskable
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
+  if (old_level == INTR_ON)
+    irqoff_begin ();
 
   return old_level;
 }
@@ -122,6 +169,7 @@ intr_init (void)
 
   /* Initialize interrupt controller. */
   pic_init ();
+  list_init (&deferred_list);
 
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
@@ -176,12 +224,15 @@ register_handler (uint8_t vec_no, int dpl, enum intr_level level,
 
 /* Registers external interrupt VEC_NO to invoke HANDLER, which
    is named NAME for debugging purposes.  The handler will
-   execute with interrupts disabled. */
+   execute with interrupts disabled.  VEC_NO is the vector of a
+   PIC interrupt, 0x20...0x2f, or of a local APIC interrupt such
+   as an IPI, 0xf0...0xfe. */
 void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
                    const char *name) 
 {
-  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+  ASSERT ((vec_no >= 0x20 && vec_no <= 0x2f)
+          || (vec_no >= 0xf0 && vec_no <= 0xfe));
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -206,12 +257,12 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
-/* Returns true during processing of an external interrupt
-   and false at all other times. */
+/* Returns true during processing of an external interrupt,
+   including work it deferred, and false at all other times. */
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  return in_external_intr || in_deferred;
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,8 +273,68 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
+  if (!yield_on_return)
+    yield_tsc = rdtsc ();
   yield_on_return = true;
 }
+
+/* Initializes W to call FUNC, passing AUX, when deferred.  W is
+   not pending. */
+void
+intr_work_init (struct intr_work *w, void (*func) (void *aux), void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Arranges for W to run after the current external interrupt
+   is done.  Deferring W again before it has run has no further
+   effect, so W's function must do all of the work that has
+   accumulated, not just one unit of it.  May only be called in
+   interrupt context. */
+void
+intr_defer (struct intr_work *w)
+{
+  enum intr_level old_level;
+
+  ASSERT (intr_context ());
+
+  old_level = intr_disable ();
+  if (!w->pending)
+    {
+      w->pending = true;
+      list_push_back (&deferred_list, &w->elem);
+    }
+  intr_set_level (old_level);
+}
+
+/* Runs deferred work until there is none left.  Called with
+   interrupts off, which it turns on while each function runs. */
+static void
+run_deferred (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  in_deferred = true;
+  while (!list_empty (&deferred_list))
+    {
+      struct intr_work *w = list_entry (list_pop_front (&deferred_list),
+                                        struct intr_work, elem);
+      w->pending = false;
+
+      /* Not intr_enable(), which refuses interrupt context. */
+      irqoff_end ();
+      asm volatile ("sti" : : : "memory");
+      w->func (w->aux);
+      asm volatile ("cli" : : : "memory");
+      irqoff_begin ();
+    }
+  in_deferred = false;
+}
 
 /* 8259A Programmable Interrupt Controller. */
 
@@ -346,26 +457,46 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  uint64_t start, cycles;
+
+  /* The CPU turned interrupts off on entry.  If they were on
+     before, any section still open was left by code that turned
+     them on without telling us, such as the idle loop's `sti'. */
+  if (frame->eflags & FLAG_IF)
+    irqoff_start = 0;
+  if (intr_get_level () == INTR_OFF)
+    irqoff_begin ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  external = ((frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+              || (frame->vec_no >= 0xf0 && frame->vec_no < 0xff));
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
-      ASSERT (!intr_context ());
+      ASSERT (!in_external_intr);
 
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_deferred)
+        yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
-    handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+    {
+      start = rdtsc ();
+      handler (frame);
+      cycles = rdtsc () - start;
+      intr_count[frame->vec_no]++;
+      intr_cycles[frame->vec_no] += cycles;
+      if (cycles > intr_max_cycles[frame->vec_no])
+        intr_max_cycles[frame->vec_no] = cycles;
+    }
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == 0xff)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -378,16 +509,104 @@ intr_handler (struct intr_frame *frame)
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
-      ASSERT (intr_context ());
+      ASSERT (in_external_intr);
 
       in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      if (frame->vec_no < 0x30)
+        pic_end_of_interrupt (frame->vec_no); 
+      else
+        lapic_eoi ();
+
+      /* An interrupt that came in during deferred work returns
+         to it; the outermost handler finishes up. */
+      if (!in_deferred)
+        {
+          run_deferred ();
+          if (yield_on_return) 
+            thread_preempt (yield_tsc); 
+#ifdef VM
+          /* A thread whose process is exiting does not go back
+             to user mode. */
+          if (frame->cs == SEL_UCSEG)
+            process_poll_exit ();
+#endif
+        }
+    }
+
+  /* `iret' turns interrupts back on if they were on before. */
+  if (frame->eflags & FLAG_IF)
+    irqoff_end ();
+}
+
+/* Notes that interrupts were just turned off, unless a section
+   with them off is already open. */
+static void
+irqoff_begin (void)
+{
+  if (irqoff_start == 0)
+    irqoff_start = rdtsc ();
+}
 
-      if (yield_on_return) 
-        thread_yield (); 
+/* Notes that interrupts are about to be turned on, closing the
+   open section with them off, if any. */
+static void
+irqoff_end (void)
+{
+  if (irqoff_start != 0)
+    {
+      uint64_t cycles = rdtsc () - irqoff_start;
+      if (cycles > irqoff_max)
+        irqoff_max = cycles;
+      irqoff_start = 0;
     }
 }
 
+/* Returns the longest time, in TSC cycles, that interrupts have
+   been off at a stretch since boot. */
+uint64_t
+intr_irqoff_max (void)
+{
+  return irqoff_max;
+}
+
+/* Copies the counters of interrupt vector VEC into *STATS.
+   Returns false if VEC is not a vector. */
+bool
+intr_get_stats (unsigned vec, struct intr_stats *stats)
+{
+  enum intr_level old_level;
+
+  if (vec >= INTR_CNT)
+    return false;
+
+  old_level = intr_disable ();
+  strlcpy (stats->name, intr_names[vec], sizeof stats->name);
+  stats->count = intr_count[vec];
+  stats->cycles = intr_cycles[vec];
+  stats->max_cycles = intr_max_cycles[vec];
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Prints the counters of each interrupt vector that was taken,
+   and the longest stretch with interrupts off. */
+void
+intr_print_stats (void)
+{
+  uint64_t mhz = timer_tsc_hz () / 1000000;
+  struct intr_stats s;
+  unsigned vec;
+
+  if (mhz == 0)
+    mhz = 1;
+  for (vec = 0; intr_get_stats (vec, &s); vec++)
+    if (s.count != 0)
+      printf ("Interrupt %#04x (%s): %llu taken, %llu us handling, "
+              "%llu us longest\n", vec, s.name, s.count,
+              s.cycles / mhz, s.max_cycles / mhz);
+  printf ("Interrupts: %llu us longest off\n", intr_irqoff_max () / mhz);
+}
+
 /* Handles an unexpected interrupt with interrupt frame F.  An
    unexpected interrupt is one that has no registered handler. */
 static void
@@ -1,6 +1,7 @@
 #ifndef THREADS_INTERRUPT_H
 #define THREADS_INTERRUPT_H
 
+#include <list.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -64,7 +65,27 @@ void intr_register_int (uint8_t vec, int dpl, enum intr_level,
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+/* Work that an external interrupt handler leaves to be done
+   after the interrupt has been acknowledged, with interrupts on.
+   Initialize with intr_work_init(), queue with intr_defer(). */
+struct intr_work
+  {
+    struct list_elem elem;      /* Element in list of deferred work. */
+    void (*func) (void *aux);   /* Function to call. */
+    void *aux;                  /* Auxiliary data for FUNC. */
+    bool pending;               /* Queued but not yet run? */
+  };
+
+void intr_work_init (struct intr_work *, void (*func) (void *aux),
+                     void *aux);
+void intr_defer (struct intr_work *);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
+struct intr_stats;
+bool intr_get_stats (unsigned vec, struct intr_stats *);
+uint64_t intr_irqoff_max (void);
+void intr_print_stats (void);
+
 #endif /* threads/interrupt.h */
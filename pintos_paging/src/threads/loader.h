@@ -12,6 +12,11 @@
    Must be aligned on a 4 MB boundary. */
 #define LOADER_PHYS_BASE 0xc0000000     /* 3 GB. */
 
+/* Most physical memory used, so that its mapping at
+   LOADER_PHYS_BASE leaves the top of the address space free for
+   the local APIC's registers. */
+#define LOADER_RAM_MAX 0x38000000       /* 896 MB. */
+
 /* Important loader physical addresses. */
 #define LOADER_SIG (LOADER_END - LOADER_SIG_LEN)   /* 0xaa55 BIOS signature. */
 #define LOADER_PARTS (LOADER_SIG - LOADER_PARTS_LEN)     /* Partition table. */
@@ -1,11 +1,16 @@
 #include "threads/malloc.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
+#include "threads/interrupt.h"
+#include "threads/mp.h"
 #include "threads/palloc.h"
+#include "threads/spinlock.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -25,14 +30,29 @@
 
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   blocks, and the descriptor already keeps MAX_SPARE such arenas
+   for reuse, we remove all of the arena's blocks from the free
+   list and give the arena back to the page allocator.  Keeping
+   a spare stops a size whose use goes back and forth across a
+   page boundary from getting and freeing a page every time.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+   realloc() grows such a block in place if the pages after it
+   are free, and shrinks it by freeing its last pages.
+
+   In front of each descriptor, every CPU keeps a "magazine" of
+   up to MAG_SIZE free blocks of its size, used with interrupts
+   off instead of under the descriptor's lock.  malloc() takes a
+   block from the magazine, and free() puts one back, as long as
+   it is not empty or full.  An empty magazine is refilled with
+   MAG_BATCH blocks at once, and a full one drained down to
+   MAG_BATCH, under the lock.  The blocks in magazines count as
+   in use in their arenas, so they keep those arenas from being
+   freed. */
 
 /* Descriptor. */
 struct desc
@@ -40,9 +60,15 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t spare_cnt;           /* Arenas on free_list with no block used. */
+    size_t arena_cnt;           /* Number of arenas. */
+    size_t peak_arenas;         /* Most arenas at once. */
     struct lock lock;           /* Lock. */
   };
 
+/* Number of unused arenas a descriptor keeps. */
+#define MAX_SPARE 1
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -64,8 +90,36 @@ struct block
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Capacity of a magazine, and the number of blocks it is
+   refilled or drained to. */
+#define MAG_SIZE 16
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* A CPU's cache of free blocks of one descriptor. */
+struct magazine
+  {
+    size_t cnt;                 /* Number of blocks. */
+    struct block *blocks[MAG_SIZE]; /* Free blocks. */
+    unsigned long long alloc_cnt; /* Blocks allocated on this CPU. */
+    unsigned long long free_cnt;  /* Blocks freed on this CPU. */
+  };
+
+/* Magazines of each CPU, one per descriptor. */
+static struct magazine magazines[CPU_MAX][sizeof descs / sizeof *descs];
+
+/* Statistics of big blocks. */
+static struct spinlock big_lock;
+static size_t big_cnt;                  /* Big blocks allocated now. */
+static size_t big_pages;                /* Pages they take. */
+static unsigned long long big_allocs;   /* Big blocks ever allocated. */
+
+static void count_big (long blocks, long pages);
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct magazine *magazine_of (struct desc *);
+static struct block *desc_alloc (struct desc *);
+static void desc_free (struct desc *, struct block *);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,12 +130,17 @@ malloc_init (void)
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
+      char name[16];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      d->spare_cnt = 0;
+      d->arena_cnt = d->peak_arenas = 0;
+      snprintf (name, sizeof name, "malloc%zu", block_size);
+      lock_init_named (&d->lock, name);
     }
+  spinlock_init (&big_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -92,6 +151,8 @@ malloc (size_t size)
   struct desc *d;
   struct block *b;
   struct arena *a;
+  struct magazine *m;
+  enum intr_level old_level;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -116,40 +177,27 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      count_big (1, page_cnt);
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  /* Take a block from this CPU's magazine if it has one. */
+  old_level = intr_disable ();
+  m = magazine_of (d);
+  if (m->cnt == 0)
     {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      /* Refill the magazine.  Acquiring the lock may let other
+         threads run, so look at the magazine again. */
+      lock_acquire (&d->lock);
+      m = magazine_of (d);
+      while (m->cnt < MAG_BATCH && (b = desc_alloc (d)) != NULL)
+        m->blocks[m->cnt++] = b;
+      lock_release (&d->lock);
     }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  b = m->cnt > 0 ? m->blocks[--m->cnt] : NULL;
+  if (b != NULL)
+    m->alloc_cnt++;
+  intr_set_level (old_level);
   return b;
 }
 
@@ -185,6 +233,35 @@ block_size (void *block)
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
 
+/* Tries to make BLOCK hold NEW_SIZE bytes without moving it:
+   true if BLOCK's size class stays the same, or if BLOCK is and
+   stays a big block and its pages could be grown or shrunk in
+   place. */
+static bool
+resize_in_place (void *block, size_t new_size)
+{
+  struct arena *a = block_to_arena (block);
+  struct desc *d = a->desc;
+  size_t page_cnt;
+
+  if (d != NULL)
+    return new_size <= d->block_size
+           && (d == descs || new_size > d[-1].block_size);
+  if (new_size <= descs[desc_cnt - 1].block_size)
+    return false;
+
+  page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+  if (page_cnt < a->free_cnt)
+    palloc_free_multiple ((uint8_t *) a + page_cnt * PGSIZE,
+                          a->free_cnt - page_cnt);
+  else if (page_cnt > a->free_cnt
+           && !palloc_extend_multiple (a, a->free_cnt, page_cnt))
+    return false;
+  count_big (0, (long) page_cnt - (long) a->free_cnt);
+  a->free_cnt = page_cnt;
+  return true;
+}
+
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
    If successful, returns the new block; on failure, returns a
@@ -199,6 +276,8 @@ realloc (void *old_block, size_t new_size)
       free (old_block);
       return NULL;
     }
+  else if (old_block != NULL && resize_in_place (old_block, new_size))
+    return old_block;
   else 
     {
       void *new_block = malloc (new_size);
@@ -227,42 +306,201 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct magazine *m;
+          enum intr_level old_level;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
-
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Put the block in this CPU's magazine, draining the
+             magazine first if it is full. */
+          old_level = intr_disable ();
+          m = magazine_of (d);
+          if (m->cnt == MAG_SIZE)
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              lock_acquire (&d->lock);
+              m = magazine_of (d);
+              while (m->cnt > MAG_BATCH)
+                desc_free (d, m->blocks[--m->cnt]);
+              lock_release (&d->lock);
             }
-
-          lock_release (&d->lock);
+          m->blocks[m->cnt++] = b;
+          m->free_cnt++;
+          intr_set_level (old_level);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          count_big (-1, -(long) a->free_cnt);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Copies the statistics of the size classes and of big blocks
+   into *STATS. */
+void
+malloc_get_stats (struct mem_stats *stats)
+{
+  size_t i, j;
+
+  stats->class_cnt = desc_cnt < MEM_CLASS_MAX ? desc_cnt : MEM_CLASS_MAX;
+  for (i = 0; i < stats->class_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      struct mem_class_stats *c = &stats->classes[i];
+      enum intr_level old_level;
+
+      lock_acquire (&d->lock);
+      c->block_size = d->block_size;
+      c->arenas = d->arena_cnt;
+      c->peak_arenas = d->peak_arenas;
+      lock_release (&d->lock);
+
+      c->allocs = c->frees = 0;
+      old_level = intr_disable ();
+      for (j = 0; j < CPU_MAX; j++)
+        {
+          c->allocs += magazines[j][i].alloc_cnt;
+          c->frees += magazines[j][i].free_cnt;
+        }
+      intr_set_level (old_level);
+      c->live = c->allocs - c->frees;
+    }
+
+  spinlock_acquire (&big_lock);
+  stats->big_live = big_cnt;
+  stats->big_pages = big_pages;
+  stats->big_allocs = big_allocs;
+  spinlock_release (&big_lock);
+}
+
+/* Prints statistics of the size classes that have been used,
+   and of big blocks. */
+void
+malloc_print_stats (void)
+{
+  struct mem_stats s;
+  size_t i;
+
+  malloc_get_stats (&s);
+  for (i = 0; i < s.class_cnt; i++)
+    {
+      struct mem_class_stats *c = &s.classes[i];
+      if (c->allocs > 0)
+        printf ("Malloc %"PRIu32": %"PRIu32" live blocks, "
+                "%"PRIu32" arenas, %"PRIu32" peak, %"PRIu64" allocs\n",
+                c->block_size, c->live, c->arenas, c->peak_arenas,
+                c->allocs);
+    }
+  printf ("Malloc big: %"PRIu32" live blocks in %"PRIu32" pages, "
+          "%"PRIu64" allocs\n", s.big_live, s.big_pages, s.big_allocs);
+}
+
+/* Adds BLOCKS and PAGES, either of which may be negative, to the
+   big block counts, counting a new block if BLOCKS is 1. */
+static void
+count_big (long blocks, long pages)
+{
+  spinlock_acquire (&big_lock);
+  big_cnt += blocks;
+  big_pages += pages;
+  if (blocks > 0)
+    big_allocs++;
+  spinlock_release (&big_lock);
+}
+
+/* Returns the running CPU's magazine for descriptor D.
+   Interrupts must be off. */
+static struct magazine *
+magazine_of (struct desc *d)
+{
+  size_t cpu = cpu_cnt > 1 ? (size_t) (cpu_current () - cpus) : 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  return &magazines[cpu][d - descs];
+}
+
+/* Takes a block from D's free list, creating a new arena if the
+   list is empty, and returns it.  Returns a null pointer if no
+   page is available.  D's lock must be held. */
+static struct block *
+desc_alloc (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL) 
+        return NULL; 
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+      d->spare_cnt++;
+      if (++d->arena_cnt > d->peak_arenas)
+        d->peak_arenas = d->arena_cnt;
+    }
+
+  /* Get a block from free list and return it. */
+  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  a = block_to_arena (b);
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->spare_cnt--;
+  return b;
+}
+
+/* Returns block B to D's free list.  If B's arena is now
+   entirely unused, keeps it as a spare, or frees it if D has
+   enough spares.  D's lock must be held. */
+static void
+desc_free (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena) 
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      if (d->spare_cnt < MAX_SPARE)
+        {
+          d->spare_cnt++;
+          return;
+        }
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_remove (&b->free_elem);
+        }
+      palloc_free_page (a);
+      d->arena_cnt--;
+    }
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -0,0 +1,317 @@
+#include "threads/mp.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <packed.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/spinlock.h"
+#include "threads/vaddr.h"
+
+/* Multiprocessor support.
+
+   The CPUs are found from the tables of the Intel MultiProcessor
+   Specification, version 1.4, which the BIOS leaves in low memory.
+   The bootstrap processor (BSP) runs the kernel; mp_init() starts
+   each application processor (AP) and leaves it parked, with
+   interrupts off, in ap_main(), until the scheduler can run
+   threads on more than one CPU. */
+
+/* MP floating pointer structure. */
+struct mp_fps
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of config table. */
+    uint8_t length;             /* In 16-byte units. */
+    uint8_t revision;
+    uint8_t checksum;           /* Makes all the bytes sum to 0. */
+    uint8_t features[5];
+  }
+PACKED;
+
+/* MP configuration table header, followed by the entries. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Of header and entries, in bytes. */
+    uint8_t revision;
+    uint8_t checksum;           /* Makes all the bytes sum to 0. */
+    char oem[20];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t entry_cnt;
+    uint32_t lapic;             /* Physical address of local APICs. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  }
+PACKED;
+
+/* Configuration table entry types.  Processor entries are 20
+   bytes long, all the others 8. */
+#define MP_PROCESSOR 0
+
+/* Processor entry. */
+struct mp_processor
+  {
+    uint8_t type;               /* MP_PROCESSOR. */
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;              /* MPP_* below. */
+    uint32_t signature;
+    uint32_t features;
+    uint8_t reserved[8];
+  }
+PACKED;
+
+#define MPP_ENABLED 0x01        /* Usable. */
+#define MPP_BSP     0x02        /* Bootstrap processor. */
+
+/* The CPUs.  Before mp_init(), or without MP tables, there is
+   just one. */
+struct cpu cpus[CPU_MAX] = { { 0, true, true, NULL } };
+size_t cpu_cnt = 1;
+
+/* Descriptor table registers, as loaded by sgdt and sidt. */
+struct desc_reg
+  {
+    uint16_t limit;
+    uint32_t base;
+  }
+PACKED;
+
+/* The BSP's, for the APs to load. */
+static struct desc_reg bsp_gdtr, bsp_idtr;
+
+/* Protects online_cnt, which the APs update. */
+static struct spinlock cpu_lock;
+static size_t online_cnt = 1;
+
+extern char mpentry_start[], mpentry_end[];
+extern uint32_t mpentry_cr3, mpentry_stack, mpentry_main;
+
+static struct mp_config *find_config (void);
+static bool start_ap (struct cpu *);
+static void ap_main (void) NO_RETURN;
+
+/* Finds the CPUs and starts the APs, if there are any. */
+void
+mp_init (void)
+{
+  struct mp_config *config;
+  uint8_t *p, *end;
+  uint32_t cr4;
+  size_t i;
+
+  spinlock_init (&cpu_lock);
+
+  config = find_config ();
+  if (config == NULL)
+    return;
+
+  cpu_cnt = 0;
+  p = (uint8_t *) (config + 1);
+  end = (uint8_t *) config + config->length;
+  for (i = 0; i < config->entry_cnt && p < end; i++)
+    if (*p == MP_PROCESSOR)
+      {
+        struct mp_processor *proc = (struct mp_processor *) p;
+        if ((proc->flags & MPP_ENABLED) && cpu_cnt < CPU_MAX)
+          {
+            struct cpu *cpu = &cpus[cpu_cnt++];
+
+            /* Keep the BSP first, where the scheduler expects the
+               CPU it has run threads on since boot. */
+            if ((proc->flags & MPP_BSP) && cpu != &cpus[0])
+              {
+                *cpu = cpus[0];
+                cpu = &cpus[0];
+              }
+            cpu->apic_id = proc->apic_id;
+            cpu->bsp = (proc->flags & MPP_BSP) != 0;
+            cpu->online = cpu->bsp;
+            cpu->stack = NULL;
+          }
+        p += sizeof *proc;
+      }
+    else
+      p += 8;
+
+  if (cpu_cnt <= 1 || !lapic_init (config->lapic))
+    {
+      /* Carry on with just the BSP. */
+      cpus[0].bsp = cpus[0].online = true;
+      cpu_cnt = 1;
+      return;
+    }
+
+  asm volatile ("sgdt %0; sidt %1" : "=m" (bsp_gdtr), "=m" (bsp_idtr));
+
+  /* Map MP_ENTRY one-to-one while the APs turn on paging: point
+     the first page directory entry at the page table that maps
+     the low 4 MB at PHYS_BASE. */
+  memcpy (ptov (MP_ENTRY), mpentry_start, mpentry_end - mpentry_start);
+  init_page_dir[0] = init_page_dir[pd_no (PHYS_BASE)];
+
+  for (i = 0; i < cpu_cnt; i++)
+    if (!cpus[i].bsp && !start_ap (&cpus[i]))
+      printf ("CPU with APIC ID %"PRIu8" did not start.\n",
+              cpus[i].apic_id);
+
+  /* Unmap MP_ENTRY again.  The low 4 MB's PTEs are global, so
+     only turning CR4_PGE off and back on also flushes what the
+     TLB holds of their one-to-one mapping. */
+  init_page_dir[0] = 0;
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (cr4 & CR4_PGE)
+    {
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 & ~CR4_PGE) : "memory");
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    }
+
+  printf ("%zu CPUs, %zu online.\n", cpu_cnt, cpu_online_cnt ());
+}
+
+/* Returns the checksum of the SIZE bytes at P, which is 0 for the
+   MP structures. */
+static uint8_t
+checksum (const void *p_, size_t size)
+{
+  const uint8_t *p = p_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *p++;
+  return sum;
+}
+
+/* Looks for the MP floating pointer structure in the SIZE bytes
+   of physical memory at PADDR. */
+static struct mp_fps *
+scan_fps (uintptr_t paddr, size_t size)
+{
+  uint8_t *p = ptov (paddr);
+  uint8_t *end = p + size;
+
+  for (; p + sizeof (struct mp_fps) <= end; p += 16) 
+    if (!memcmp (p, "_MP_", 4) && checksum (p, sizeof (struct mp_fps)) == 0)
+      return (struct mp_fps *) p;
+  return NULL;
+}
+
+/* Returns the MP configuration table, or a null pointer if there
+   is none we can use.  The floating pointer structure is in the
+   first kB of the extended BIOS data area, in the last kB of base
+   memory, or in the BIOS ROM, according to the specification's
+   section 4. */
+static struct mp_config *
+find_config (void)
+{
+  uint16_t ebda_seg = *(uint16_t *) ptov (0x40e);
+  uint16_t base_kb = *(uint16_t *) ptov (0x413);
+  struct mp_fps *fps = NULL;
+  struct mp_config *config;
+
+  if (ebda_seg != 0)
+    fps = scan_fps ((uintptr_t) ebda_seg << 4, 1024);
+  if (fps == NULL && base_kb >= 1)
+    fps = scan_fps ((base_kb - 1) * 1024, 1024);
+  if (fps == NULL)
+    fps = scan_fps (0xf0000, 0x10000);
+
+  /* A zero address means one of the default configurations,
+     which are for machines too old to matter here. */
+  if (fps == NULL || fps->config == 0
+      || fps->config + sizeof *config > init_ram_pages * PGSIZE)
+    return NULL;
+
+  config = ptov (fps->config);
+  if (memcmp (config->signature, "PCMP", 4)
+      || fps->config + config->length > init_ram_pages * PGSIZE
+      || checksum (config, config->length) != 0)
+    return NULL;
+  return config;
+}
+
+/* Starts the AP CPU and waits up to 100 ms for it to come
+   online.  Returns true if it did. */
+static bool
+start_ap (struct cpu *cpu)
+{
+  uint8_t *entry = ptov (MP_ENTRY);
+  int ms;
+
+  cpu->stack = palloc_get_page (0);
+  if (cpu->stack == NULL)
+    return false;
+
+  *(uint32_t *) (entry + ((char *) &mpentry_cr3 - mpentry_start))
+    = vtop (init_page_dir);
+  *(uint32_t *) (entry + ((char *) &mpentry_stack - mpentry_start))
+    = (uint32_t) cpu->stack + PGSIZE;
+  *(uint32_t *) (entry + ((char *) &mpentry_main - mpentry_start))
+    = (uint32_t) ap_main;
+
+  lapic_start_ap (cpu->apic_id, MP_ENTRY);
+  for (ms = 0; ms < 100 && !cpu->online; ms++)
+    timer_msleep (1);
+  return cpu->online;
+}
+
+/* Returns the calling CPU. */
+struct cpu *
+cpu_current (void)
+{
+  uint8_t apic_id;
+  size_t i;
+
+  if (!lapic_present ())
+    return &cpus[0];
+
+  apic_id = lapic_id ();
+  for (i = 0; i < cpu_cnt; i++)
+    if (cpus[i].apic_id == apic_id)
+      return &cpus[i];
+  PANIC ("no CPU with APIC ID %"PRIu8, apic_id);
+}
+
+/* Returns the number of CPUs online. */
+size_t
+cpu_online_cnt (void)
+{
+  size_t cnt;
+
+  spinlock_acquire (&cpu_lock);
+  cnt = online_cnt;
+  spinlock_release (&cpu_lock);
+  return cnt;
+}
+
+/* Entry point of an AP, on its own stack page, called by
+   mpentry.S.  An AP is not a thread, so it must not use anything
+   that calls thread_current(), such as locks or printf(). */
+static void
+ap_main (void) 
+{
+  struct cpu *cpu;
+
+  /* Switch to the BSP's GDT and IDT: the GDT in the copy of
+     mpentry.S is not mapped any more once all the APs are up. */
+  asm volatile ("lgdt %0; lidt %1" : : "m" (bsp_gdtr), "m" (bsp_idtr));
+
+  lapic_init_ap ();
+  cpu = cpu_current ();
+
+  spinlock_acquire (&cpu_lock);
+  online_cnt++;
+  cpu->online = true;
+  spinlock_release (&cpu_lock);
+
+  for (;;)
+    asm volatile ("cli; hlt");
+}
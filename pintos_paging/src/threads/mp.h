@@ -0,0 +1,34 @@
+#ifndef THREADS_MP_H
+#define THREADS_MP_H
+
+/* Physical address at which application processors start, in
+   real mode.  Must be page-aligned, below 1 MB, and clear of the
+   loader and the initial thread. */
+#define MP_ENTRY 0x8000
+
+#ifndef __ASSEMBLER__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most CPUs supported. */
+#define CPU_MAX 8
+
+/* A CPU. */
+struct cpu
+  {
+    uint8_t apic_id;            /* Local APIC ID. */
+    bool bsp;                   /* Bootstrap processor? */
+    volatile bool online;       /* Started and running? */
+    void *stack;                /* Stack page of an application processor. */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern size_t cpu_cnt;
+
+void mp_init (void);
+struct cpu *cpu_current (void);
+size_t cpu_online_cnt (void);
+#endif
+
+#endif /* threads/mp.h */
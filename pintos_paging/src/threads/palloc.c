@@ -7,8 +7,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <list.h>
+#include <syscall-nr.h>
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/interrupt.h"
+#include "threads/shrink.h"
+#include "threads/spinlock.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,13 +27,67 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, pages are handed out by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**ORDER pages,
+   each aligned to its size relative to the pool's base, on one
+   free list per order.  An allocation takes a block of the
+   smallest sufficient order, splitting a larger one if need be,
+   and gives back the pages past PAGE_CNT; a freed block merges
+   with its "buddy", the other half of the next larger block,
+   for as long as the buddy is free too.  Both take time
+   proportional to the number of orders, not to the pool's size.
+
+   The free list link of a free block lives in its first page,
+   and ORDERS records the order of each page that begins a free
+   block.  USED_MAP only tracks which pages are allocated, so
+   double frees are caught.  The pool is guarded by a spinlock,
+   because the page of a dying thread is freed while the
+   scheduler runs with interrupts off.
+
+   Each pool also sets aside up to ZEROED_MAX pages that the idle
+   thread has already filled with zeros, through
+   palloc_zero_idle(), so that most single-page PAL_ZERO
+   allocations need not clear a page.  These pages still count as
+   free, and go back to the buddy lists whenever an allocation
+   cannot be met otherwise.
+
+   A free block may also have been reported to the host as free,
+   through palloc_report_take(), so that the host could reclaim
+   its memory.  Reported blocks are kept at the back of the free
+   lists, where allocations come to them last, and a block merged
+   with one that was not reported counts as not reported. */
+
+/* Largest block order. */
+#define MAX_ORDER 20
+
+/* ORDERS entry for a page that does not begin a free block. */
+#define NOT_FREE 0xff
+
+/* Flag in the ORDERS entry of a free block that was reported. */
+#define REPORTED 0x80
+
+/* Maximum number of zeroed pages set aside in a pool. */
+#define ZEROED_MAX 32
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
+    struct spinlock lock;               /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Order of each free block. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    size_t page_cnt;                    /* Number of pages. */
+    size_t free_cnt;                    /* Number of free pages. */
+    struct list zeroed;                 /* Pages already zeroed. */
+    size_t zeroed_cnt;                  /* Number of pages in `zeroed'. */
+
+    /* Statistics. */
+    size_t peak_used;                   /* Most pages in use at once. */
+    unsigned long long alloc_cnt;       /* Successful allocations. */
+    unsigned long long release_cnt;     /* Frees. */
+    unsigned long long fail_cnt;        /* Failed allocations. */
     uint8_t *base;                      /* Base of pool. */
   };
 
@@ -38,7 +96,20 @@ static struct pool kernel_pool, user_pool;
 
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
+static void count_alloc (struct pool *);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void claim_page (struct pool *, size_t page_idx);
+static void free_pages (struct pool *, size_t page_idx, size_t page_cnt,
+                        bool reported);
+static struct list_elem *block_elem (const struct pool *, size_t page_idx);
+static size_t block_idx (const struct pool *, struct list_elem *);
+static void push_block (struct pool *, size_t page_idx, uint8_t entry);
+static void *take_pages (struct pool *, size_t page_cnt);
+static void *zeroed_pop (struct pool *);
+static void zeroed_flush (struct pool *);
+static bool zeroed_refill (struct pool *);
+static bool may_reclaim (const struct pool *, enum palloc_flags);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -71,24 +142,36 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  void *pages = NULL;
+  bool zeroed = false;
+  bool reclaim = may_reclaim (pool, flags);
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  spinlock_acquire (&pool->lock);
+  if (page_cnt == 1 && flags & PAL_ZERO)
+    zeroed = (pages = zeroed_pop (pool)) != NULL;
+  if (pages == NULL)
+    pages = take_pages (pool, page_cnt);
+  if (pages == NULL && reclaim)
+    {
+      /* Have the kernel's caches give memory back, then try once
+         more. */
+      spinlock_release (&pool->lock);
+      shrink_reclaim (page_cnt);
+      spinlock_acquire (&pool->lock);
+      pages = take_pages (pool, page_cnt);
+    }
+  if (pages != NULL)
+    count_alloc (pool);
   else
-    pages = NULL;
+    pool->fail_cnt++;
+  spinlock_release (&pool->lock);
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if (flags & PAL_ZERO && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -137,8 +220,12 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  spinlock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_pages (pool, page_idx, page_cnt, false);
+  pool->release_cnt++;
+  spinlock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +235,225 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Tries to grow the PAGE_CNT allocated pages starting at PAGES
+   to NEW_CNT pages, by allocating the pages that follow them.
+   Returns true if successful, false if any of those pages is in
+   use or past the end of its pool, in which case nothing
+   changes. */
+bool
+palloc_extend_multiple (void *pages, size_t page_cnt, size_t new_cnt)
+{
+  struct pool *pool;
+  size_t page_idx, i;
+  bool success = false;
+
+  ASSERT (pg_ofs (pages) == 0);
+  ASSERT (new_cnt >= page_cnt);
+
+  if (page_from_pool (&kernel_pool, pages))
+    pool = &kernel_pool;
+  else if (page_from_pool (&user_pool, pages))
+    pool = &user_pool;
+  else
+    NOT_REACHED ();
+
+  page_idx = pg_no (pages) - pg_no (pool->base) + page_cnt;
+  new_cnt -= page_cnt;
+
+  spinlock_acquire (&pool->lock);
+  if (page_idx + new_cnt <= pool->page_cnt
+      && bitmap_none (pool->used_map, page_idx, new_cnt))
+    {
+      for (i = 0; i < new_cnt; i++)
+        claim_page (pool, page_idx + i);
+      bitmap_set_multiple (pool->used_map, page_idx, new_cnt, true);
+      pool->free_cnt -= new_cnt;
+      count_alloc (pool);
+      success = true;
+    }
+  spinlock_release (&pool->lock);
+
+  return success;
+}
+
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool. */
+size_t
+palloc_free_count (enum palloc_flags flags)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  size_t cnt;
+
+  spinlock_acquire (&pool->lock);
+  cnt = pool->free_cnt;
+  spinlock_release (&pool->lock);
+
+  return cnt;
+}
+
+/* Copies the statistics of the user pool if PAL_USER is set in
+   FLAGS, otherwise of the kernel pool, into *STATS. */
+void
+palloc_get_stats (enum palloc_flags flags, struct mem_pool_stats *stats)
+{
+  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+  spinlock_acquire (&pool->lock);
+  stats->pages = pool->page_cnt;
+  stats->free_pages = pool->free_cnt;
+  stats->peak_used = pool->peak_used;
+  stats->allocs = pool->alloc_cnt;
+  stats->frees = pool->release_cnt;
+  stats->failures = pool->fail_cnt;
+  spinlock_release (&pool->lock);
+}
+
+/* Prints page pool statistics. */
+void
+palloc_print_stats (void)
+{
+  static const char *names[] = { "Kernel", "User" };
+  enum palloc_flags flags[] = { 0, PAL_USER };
+  size_t i;
+
+  for (i = 0; i < 2; i++)
+    {
+      struct mem_pool_stats s;
+
+      palloc_get_stats (flags[i], &s);
+      printf ("%s pool: %"PRIu32" of %"PRIu32" pages used, "
+              "%"PRIu32" peak, %"PRIu64" allocs, %"PRIu64" frees, "
+              "%"PRIu64" failures\n",
+              names[i], s.pages - s.free_pages, s.pages, s.peak_used,
+              s.allocs, s.frees, s.failures);
+    }
+}
+
+/* Zeroes one free page, of the user pool if it is short of
+   zeroed pages, otherwise of the kernel pool, and sets it aside
+   for a later PAL_ZERO allocation.  Returns false if neither pool
+   needs or has such a page.
+
+   Meant for the idle thread, which calls it repeatedly while it
+   has nothing better to do. */
+bool
+palloc_zero_idle (void)
+{
+  return zeroed_refill (&user_pool) || zeroed_refill (&kernel_pool);
+}
+
+/* Returns the address of the first page of the user pool.
+   The user pool's pages are contiguous, so a user page's index
+   in the pool is (PAGE - palloc_user_base ()) / PGSIZE. */
+void *
+palloc_user_base (void)
+{
+  return user_pool.base;
+}
+
+/* Returns the number of pages in the user pool. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return user_pool.page_cnt;
+}
+
+/* Takes a block of 2**ORDER free pages of the user pool that has
+   not been reported yet, splitting a larger one if need be, and
+   returns its address, or a null pointer if there is none.  The
+   block counts as in use, and not as an allocation, until it is
+   given back with palloc_report_done(). */
+void *
+palloc_report_take (int order)
+{
+  struct pool *pool = &user_pool;
+  size_t page_idx = BITMAP_ERROR;
+  int o;
+
+  ASSERT (order >= 0 && order <= MAX_ORDER);
+
+  spinlock_acquire (&pool->lock);
+  for (o = order; o <= MAX_ORDER; o++)
+    {
+      struct list *free_list = &pool->free_lists[o];
+      size_t idx;
+
+      /* Blocks not reported are at the front. */
+      if (list_empty (free_list))
+        continue;
+      idx = block_idx (pool, list_front (free_list));
+      if (pool->orders[idx] & REPORTED)
+        continue;
+
+      list_remove (block_elem (pool, idx));
+      pool->orders[idx] = NOT_FREE;
+      while (o > order)
+        {
+          o--;
+          push_block (pool, idx + ((size_t) 1 << o), o);
+        }
+      bitmap_set_multiple (pool->used_map, idx, (size_t) 1 << order, true);
+      pool->free_cnt -= (size_t) 1 << order;
+      page_idx = idx;
+      break;
+    }
+  spinlock_release (&pool->lock);
+
+  return page_idx != BITMAP_ERROR ? user_pool.base + PGSIZE * page_idx : NULL;
+}
+
+/* Gives back the block of 2**ORDER pages at PAGES, taken by
+   palloc_report_take() and since reported. */
+void
+palloc_report_done (void *pages, int order)
+{
+  struct pool *pool = &user_pool;
+  size_t page_cnt = (size_t) 1 << order;
+  size_t page_idx;
+
+  ASSERT (page_from_pool (pool, pages));
+  page_idx = pg_no (pages) - pg_no (pool->base);
+
+  spinlock_acquire (&pool->lock);
+  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_pages (pool, page_idx, page_cnt, true);
+  spinlock_release (&pool->lock);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and orders at its base.
+     Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = ROUND_UP (bitmap_buf_size (page_cnt), sizeof (long));
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  int order;
+
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  /* Initialize the pool, with all of its pages free. */
+  spinlock_init (&p->lock);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->orders = (uint8_t *) base + bm_size;
+  memset (p->orders, NOT_FREE, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+  p->page_cnt = page_cnt;
+  p->free_cnt = 0;
+  list_init (&p->zeroed);
+  p->zeroed_cnt = 0;
+  p->peak_used = 0;
+  p->alloc_cnt = p->release_cnt = p->fail_cnt = 0;
   p->base = base + bm_pages * PGSIZE;
+  free_pages (p, 0, page_cnt, false);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +463,268 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Counts a successful allocation from POOL, and the pages it
+   leaves in use.  POOL's lock must be held. */
+static void
+count_alloc (struct pool *pool)
+{
+  size_t used = pool->page_cnt - pool->free_cnt;
+
+  pool->alloc_cnt++;
+  if (used > pool->peak_used)
+    pool->peak_used = used;
+}
+
+/* Returns the free list link in the first page of the block at
+   PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index in POOL of the block whose free list link is
+   ELEM. */
+static size_t
+block_idx (const struct pool *pool, struct list_elem *elem)
+{
+  return ((uint8_t *) elem - pool->base) / PGSIZE;
+}
+
+/* Puts the block of 2**ORDER pages at PAGE_IDX in POOL on its
+   free list, after merging it with its buddies that are free.
+   The block was reported if REPORTED; it stays so only if all of
+   its buddies were too. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order, bool reported)
+{
+  for (; order < MAX_ORDER; order++)
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+      if (buddy >= pool->page_cnt
+          || (pool->orders[buddy] & ~REPORTED) != order)
+        break;
+
+      reported = reported && pool->orders[buddy] & REPORTED;
+      list_remove (block_elem (pool, buddy));
+      pool->orders[buddy] = NOT_FREE;
+      page_idx &= buddy;
+    }
+
+  push_block (pool, page_idx, order | (reported ? REPORTED : 0));
+}
+
+/* Puts the free block at PAGE_IDX in POOL on the free list of
+   its order, given with its REPORTED flag by ENTRY, and records
+   ENTRY in ORDERS. */
+static void
+push_block (struct pool *pool, size_t page_idx, uint8_t entry)
+{
+  struct list *free_list = &pool->free_lists[entry & ~REPORTED];
+
+  pool->orders[page_idx] = entry;
+  if (entry & REPORTED)
+    list_push_back (free_list, block_elem (pool, page_idx));
+  else
+    list_push_front (free_list, block_elem (pool, page_idx));
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, as the largest
+   aligned blocks that they can be divided into, which were
+   reported if REPORTED.  POOL's lock must be held. */
+static void
+free_pages (struct pool *pool, size_t page_idx, size_t page_cnt,
+            bool reported)
+{
+  pool->free_cnt += page_cnt;
+  while (page_cnt > 0)
+    {
+      int order = 0;
+
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+
+      free_block (pool, page_idx, order, reported);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes free page PAGE_IDX out of the free block that contains
+   it, putting the rest of the block back on the free lists as
+   smaller blocks.  POOL's lock must be held. */
+static void
+claim_page (struct pool *pool, size_t page_idx)
+{
+  size_t head = page_idx;
+  uint8_t reported;
+  int order = 0;
+
+  while ((pool->orders[head] & ~REPORTED) != order)
+    {
+      order++;
+      ASSERT (order <= MAX_ORDER);
+      head = page_idx & ~(((size_t) 1 << order) - 1);
+    }
+
+  reported = pool->orders[head] & REPORTED;
+  list_remove (block_elem (pool, head));
+  pool->orders[head] = NOT_FREE;
+
+  /* Halve the block until only PAGE_IDX is left, freeing the
+     halves that do not contain it. */
+  while (order > 0)
+    {
+      size_t half, other;
+
+      order--;
+      half = head + ((size_t) 1 << order);
+      if (page_idx >= half)
+        {
+          other = head;
+          head = half;
+        }
+      else
+        other = half;
+      push_block (pool, other, order | reported);
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if no free block is large
+   enough.  POOL's lock must be held. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+  uint8_t reported;
+  int want = 0;
+  int order;
+
+  while (((size_t) 1 << want) < page_cnt)
+    if (++want > MAX_ORDER)
+      return BITMAP_ERROR;
+
+  for (order = want; list_empty (&pool->free_lists[order]); order++)
+    if (order == MAX_ORDER)
+      return BITMAP_ERROR;
+
+  page_idx = block_idx (pool, list_pop_front (&pool->free_lists[order]));
+  reported = pool->orders[page_idx] & REPORTED;
+  pool->orders[page_idx] = NOT_FREE;
+
+  /* Split the block down to the order wanted, freeing the upper
+     halves. */
+  while (order > want)
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order | reported);
+    }
+
+  /* Give back the pages past PAGE_CNT. */
+  pool->free_cnt -= (size_t) 1 << want;
+  free_pages (pool, page_idx + page_cnt, ((size_t) 1 << want) - page_cnt,
+              reported != 0);
+
+  ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  return page_idx;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL, giving back its
+   zeroed pages to the free lists if need be, and returns the
+   first, or a null pointer if no free block is large enough.
+   POOL's lock must be held. */
+static void *
+take_pages (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx = alloc_pages (pool, page_cnt);
+
+  if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+    {
+      zeroed_flush (pool);
+      page_idx = alloc_pages (pool, page_cnt);
+    }
+  return page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+}
+
+/* Removes a page from POOL's zeroed pages and returns it, or a
+   null pointer if there is none.  POOL's lock must be held. */
+static void *
+zeroed_pop (struct pool *pool)
+{
+  struct list_elem *elem;
+
+  if (list_empty (&pool->zeroed))
+    return NULL;
+
+  elem = list_pop_front (&pool->zeroed);
+  memset (elem, 0, sizeof *elem);
+  pool->zeroed_cnt--;
+  pool->free_cnt--;
+  return elem;
+}
+
+/* Returns all of POOL's zeroed pages to its free lists.
+   POOL's lock must be held. */
+static void
+zeroed_flush (struct pool *pool)
+{
+  while (!list_empty (&pool->zeroed))
+    {
+      size_t page_idx = block_idx (pool, list_pop_front (&pool->zeroed));
+
+      bitmap_reset (pool->used_map, page_idx);
+      pool->free_cnt--;
+      free_pages (pool, page_idx, 1, false);
+    }
+  pool->zeroed_cnt = 0;
+}
+
+/* Zeroes a free page of POOL and adds it to POOL's zeroed pages,
+   unless POOL already has ZEROED_MAX of them or no free page.
+   Returns true if a page was added. */
+static bool
+zeroed_refill (struct pool *pool)
+{
+  size_t page_idx = BITMAP_ERROR;
+  uint8_t *page;
+
+  spinlock_acquire (&pool->lock);
+  if (pool->zeroed_cnt < ZEROED_MAX)
+    page_idx = alloc_pages (pool, 1);
+  spinlock_release (&pool->lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* Zero the page with the pool unlocked: it is allocated, so no
+     one else touches it meanwhile. */
+  page = pool->base + PGSIZE * page_idx;
+  page_zero (page);
+
+  spinlock_acquire (&pool->lock);
+  list_push_back (&pool->zeroed, (struct list_elem *) page);
+  pool->zeroed_cnt++;
+  pool->free_cnt++;
+  spinlock_release (&pool->lock);
+  return true;
+}
+
+/* Returns true if an allocation from POOL with FLAGS that fails
+   may shrink the kernel's caches and try again: only for the
+   kernel pool, whose pages the caches hold, and only in a thread
+   that may sleep and that does not hold the lock of an allocator,
+   as told by PAL_NORECLAIM. */
+static bool
+may_reclaim (const struct pool *pool, enum palloc_flags flags)
+{
+  return (pool == &kernel_pool && !(flags & PAL_NORECLAIM)
+          && !intr_context () && intr_get_level () == INTR_ON);
+}
@@ -1,14 +1,18 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+struct mem_pool_stats;
+
 /* How to allocate pages. */
 enum palloc_flags
   {
     PAL_ASSERT = 001,           /* Panic on failure. */
     PAL_ZERO = 002,             /* Zero page contents. */
-    PAL_USER = 004              /* User page. */
+    PAL_USER = 004,             /* User page. */
+    PAL_NORECLAIM = 010         /* Do not shrink caches on failure. */
   };
 
 void palloc_init (size_t user_page_limit);
@@ -16,5 +20,14 @@ void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_extend_multiple (void *, size_t page_cnt, size_t new_cnt);
+size_t palloc_free_count (enum palloc_flags);
+void palloc_get_stats (enum palloc_flags, struct mem_pool_stats *);
+void palloc_print_stats (void);
+bool palloc_zero_idle (void);
+void *palloc_user_base (void);
+size_t palloc_user_page_cnt (void);
+void *palloc_report_take (int order);
+void palloc_report_done (void *, int order);
 
 #endif /* threads/palloc.h */
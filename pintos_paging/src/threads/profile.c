@@ -0,0 +1,203 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads/interrupt.h"
+#include "threads/mp.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "userprog/process.h"
+#endif
+
+/* Pages of samples per CPU. */
+#define PROFILE_PAGES 64
+
+/* A sample: the interrupted instruction and thread. */
+struct sample
+  {
+    uintptr_t eip;              /* Interrupted instruction. */
+    tid_t tid;                  /* Thread running it. */
+  };
+
+#define SAMPLES_PER_CPU (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+/* Samples taken on a CPU. */
+struct sample_buffer
+  {
+    struct sample *samples;     /* SAMPLES_PER_CPU of them, or null. */
+    size_t cnt;                 /* Number taken. */
+    size_t dropped;             /* Samples lost to a full buffer. */
+    unsigned countdown;         /* Ticks left until the next sample. */
+  };
+
+unsigned profile_interval;
+
+static struct sample_buffer buffers[CPU_MAX];
+
+/* Set once the buffers are allocated. */
+static bool started;
+
+/* Allocates a sample buffer for each CPU, if profiling.  Samples
+   taken before then are not kept. */
+void
+profile_init (void)
+{
+  size_t i;
+
+  if (profile_interval == 0)
+    return;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct sample_buffer *b = &buffers[i];
+      b->samples = palloc_get_multiple (0, PROFILE_PAGES);
+      if (b->samples == NULL)
+        printf ("profile: no memory for cpu %zu's samples\n", i);
+      b->countdown = profile_interval;
+    }
+  barrier ();
+  started = true;
+}
+
+/* Called by the timer interrupt handler with the interrupted
+   code's frame F.  Records a sample every profile_interval
+   calls. */
+void
+profile_tick (struct intr_frame *f)
+{
+  struct sample_buffer *b;
+
+#ifdef VM
+  /* The low bits of CS hold the interrupted code's privilege
+     level. */
+  if ((f->cs & 3) != 0)
+    process_profil_tick ((uintptr_t) f->eip);
+#endif
+
+  if (!started)
+    return;
+
+  b = &buffers[cpu_current () - cpus];
+  if (b->samples == NULL || --b->countdown > 0)
+    return;
+  b->countdown = profile_interval;
+
+  if (b->cnt < SAMPLES_PER_CPU)
+    {
+      struct sample *s = &b->samples[b->cnt++];
+      s->eip = (uintptr_t) f->eip;
+      s->tid = thread_current ()->tid;
+    }
+  else
+    b->dropped++;
+}
+
+/* Orders samples by address. */
+static int
+compare_eip (const void *a_, const void *b_)
+{
+  const struct sample *a = a_;
+  const struct sample *b = b_;
+
+  return a->eip < b->eip ? -1 : a->eip > b->eip;
+}
+
+/* Orders samples by thread. */
+static int
+compare_tid (const void *a_, const void *b_)
+{
+  const struct sample *a = a_;
+  const struct sample *b = b_;
+
+  return a->tid < b->tid ? -1 : a->tid > b->tid;
+}
+
+/* Orders counted samples, whose `tid' holds the count, from the
+   most frequent down. */
+static int
+compare_count (const void *a_, const void *b_)
+{
+  const struct sample *a = a_;
+  const struct sample *b = b_;
+
+  return a->tid > b->tid ? -1 : a->tid < b->tid;
+}
+
+/* Prints the number of samples of each thread, then each sampled
+   address followed by `*' and its count, most frequent first, on
+   "Profile samples:" lines to be passed to utils/backtrace. */
+void
+profile_print_stats (void)
+{
+  size_t cnt = 0, dropped = 0, kernel = 0;
+  size_t i, j, distinct;
+  struct sample *all;
+  enum intr_level old_level;
+
+  if (!started)
+    return;
+
+  /* Stop sampling, and gather the samples into the first
+     buffer. */
+  old_level = intr_disable ();
+  started = false;
+  intr_set_level (old_level);
+  all = buffers[0].samples;
+  if (all == NULL)
+    return;
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct sample_buffer *b = &buffers[i];
+      dropped += b->dropped;
+      for (j = 0; j < b->cnt && b->samples != NULL; j++)
+        {
+          if (cnt < SAMPLES_PER_CPU)
+            all[cnt++] = b->samples[j];
+          else
+            dropped++;
+        }
+    }
+  for (i = 0; i < cnt; i++)
+    if (is_kernel_vaddr ((void *) all[i].eip))
+      kernel++;
+  printf ("Profile: %zu samples, %zu in the kernel, %zu dropped\n",
+          cnt, kernel, dropped);
+  if (cnt == 0)
+    return;
+
+  /* Samples per thread. */
+  qsort (all, cnt, sizeof *all, compare_tid);
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i; j < cnt && all[j].tid == all[i].tid; j++)
+        continue;
+      printf ("Profile: thread %d: %zu samples\n", all[i].tid, j - i);
+    }
+
+  /* Count the samples at each address, reusing `tid' for the
+     count. */
+  qsort (all, cnt, sizeof *all, compare_eip);
+  distinct = 0;
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i; j < cnt && all[j].eip == all[i].eip; j++)
+        continue;
+      all[distinct].eip = all[i].eip;
+      all[distinct].tid = j - i;
+      distinct++;
+    }
+  qsort (all, distinct, sizeof *all, compare_count);
+
+  for (i = 0; i < distinct; i++)
+    {
+      if (i % 6 == 0)
+        printf ("%sProfile samples:", i > 0 ? "\n" : "");
+      printf (" %#"PRIxPTR"*%d", all[i].eip, all[i].tid);
+    }
+  printf ("\n");
+}
@@ -0,0 +1,22 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+struct intr_frame;
+
+/* Sampling profiler.
+
+   With the -profile=TICKS option, every TICKS'th timer interrupt
+   records where the interrupted code was, in the kernel or in a
+   user program, and which thread was running.  Each CPU has its
+   own sample buffer.  At shutdown the samples are counted by
+   address and printed in a form that utils/backtrace turns into
+   a flat profile. */
+
+/* Timer ticks between samples, or 0 if not profiling. */
+extern unsigned profile_interval;
+
+void profile_init (void);
+void profile_tick (struct intr_frame *);
+void profile_print_stats (void);
+
+#endif /* threads/profile.h */
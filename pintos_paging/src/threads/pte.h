@@ -51,7 +51,8 @@ static inline uintptr_t pd_no (const void *va) {
    |         Physical Address           |         Flags          |
    +------------------------------------+------------------------+
 
-   In a PDE, the physical address points to a page table.
+   In a PDE, the physical address points to a page table, or,
+   with PTE_PS, to a 4 MB page in place of one.
    In a PTE, the physical address points to a data or code page.
    The important flags are listed below.
    When a PDE or PTE is not "present", the other flags are
@@ -66,6 +67,16 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, kept in TLB across CR3 loads. */
+#define PTE_SWAP 0x200          /* Not present, out on swap: the address
+                                   bits hold the slot (PTEs only, OS use). */
+
+/* Page Global Enable flag in control register 4: makes the CPU
+   honor PTE_G.  Loading CR3 then leaves global translations in
+   the TLB; turning the flag off and on again flushes them too.
+   See [IA32-v3a] 3.12 "Translation Lookaside Buffers (TLBs)". */
+#define CR4_PGE 0x80
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +84,21 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the 4 MB page at physical address
+   PADDR, which must be aligned on a 4 MB boundary, for ring 0
+   code only.  The page is readable, and writable as well if
+   WRITABLE is true.  Control register 4 must have Page Size
+   Extensions enabled. */
+static inline uint32_t pde_create_large (uintptr_t paddr, bool writable) {
+  ASSERT (paddr % PTSPAN == 0);
+  return paddr | PTE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
 /* Returns a pointer to the page table that page directory entry
-   PDE, which must "present", points to. */
+   PDE, which must "present" and not map a 4 MB page, points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -0,0 +1,113 @@
+#include "threads/shrink.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+
+/* Direct reclaim asks the shrinkers for 1/2**SHRINK_PRIORITY of
+   what they could free first, then for twice as much each time
+   until the allocation can succeed, and for all of it last. */
+#define SHRINK_PRIORITY 4
+
+/* All shrinkers, most recently registered first.  Held while
+   shrinking, so that only one thread shrinks at a time and a
+   shrinker that allocates does not shrink again. */
+static struct list shrinkers;
+static struct lock shrink_lock;
+
+/* Initializes the list of shrinkers. */
+void
+shrink_init (void)
+{
+  list_init (&shrinkers);
+  lock_init_named (&shrink_lock, "shrinkers");
+}
+
+/* Adds SHRINKER, whose `name', `count' and `scan' must be set.
+   Shrinkers run in the reverse order of registration, so that
+   the object caches, registered at boot before the caches built
+   on them, give back the slabs that the others have emptied. */
+void
+shrinker_register (struct shrinker *shrinker)
+{
+  shrinker->freed_cnt = 0;
+  lock_acquire (&shrink_lock);
+  list_push_front (&shrinkers, &shrinker->elem);
+  lock_release (&shrink_lock);
+}
+
+/* Asks each shrinker to free SCANNED/TOTAL of the objects it
+   could free, rounded up, for example after the pageout daemon
+   has evicted SCANNED of TOTAL user pages.  Returns the number
+   of objects freed, which is 0 if another thread is shrinking
+   or if the running thread is a shrinker. */
+size_t
+shrink_caches (size_t scanned, size_t total)
+{
+  struct list_elem *e;
+  size_t freed = 0;
+
+  ASSERT (!intr_context ());
+
+  if (scanned == 0 || total == 0
+      || lock_held_by_current_thread (&shrink_lock)
+      || !lock_try_acquire (&shrink_lock))
+    return 0;
+
+  if (scanned > total)
+    scanned = total;
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      size_t cnt = s->count ();
+      size_t nr, done;
+
+      if (cnt == 0)
+        continue;
+      nr = DIV_ROUND_UP ((uint64_t) cnt * scanned, total);
+      done = s->scan (nr);
+      s->freed_cnt += done;
+      freed += done;
+    }
+  lock_release (&shrink_lock);
+
+  return freed;
+}
+
+/* Shrinks the caches, harder and harder, until PAGE_CNT pages
+   of the kernel pool are free or nothing is left to free.
+   Returns true if anything was freed.  Called when an allocation
+   of PAGE_CNT pages fails, from a thread that may sleep. */
+bool
+shrink_reclaim (size_t page_cnt)
+{
+  size_t freed = 0;
+  int priority;
+
+  for (priority = SHRINK_PRIORITY; priority >= 0; priority--)
+    {
+      freed += shrink_caches (1, (size_t) 1 << priority);
+      if (palloc_free_count (0) >= page_cnt)
+        break;
+    }
+  return freed > 0;
+}
+
+/* Prints statistics for each shrinker that has freed anything. */
+void
+shrink_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&shrinkers); e != list_end (&shrinkers);
+       e = list_next (e))
+    {
+      struct shrinker *s = list_entry (e, struct shrinker, elem);
+      if (s->freed_cnt > 0)
+        printf ("Shrinker %s: %llu objects freed\n", s->name, s->freed_cnt);
+    }
+}
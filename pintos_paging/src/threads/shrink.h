@@ -0,0 +1,39 @@
+#ifndef THREADS_SHRINK_H
+#define THREADS_SHRINK_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Shrinkers.
+
+   A kernel cache that keeps memory it could do without, such as
+   closed inodes or empty slabs, registers a shrinker, so that it
+   gives some of it back when memory runs short: when an
+   allocation from the kernel pool fails, and when the pageout
+   daemon has evicted user pages.  Each cache is asked to free
+   the same share of what it could free, so that the larger ones
+   give back more.
+
+   A shrinker may be called from any thread that may sleep,
+   holding any locks, so it must not wait for a lock that its
+   caller might hold: it takes its locks with lock_try_acquire(),
+   and frees nothing if it cannot.  It must not allocate memory
+   either. */
+
+struct shrinker
+  {
+    const char *name;                   /* For statistics. */
+    size_t (*count) (void);             /* Number of objects freeable. */
+    size_t (*scan) (size_t nr);         /* Frees up to NR, returns count. */
+    unsigned long long freed_cnt;       /* Number of objects freed. */
+    struct list_elem elem;              /* In list of all shrinkers. */
+  };
+
+void shrink_init (void);
+void shrinker_register (struct shrinker *);
+size_t shrink_caches (size_t scanned, size_t total);
+bool shrink_reclaim (size_t page_cnt);
+void shrink_print_stats (void);
+
+#endif /* threads/shrink.h */
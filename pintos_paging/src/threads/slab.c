@@ -0,0 +1,412 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/shrink.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   Each cache hands out objects of one fixed size.  Its memory
+   comes in pages, called "slabs", from the kernel pool of the
+   page allocator: a slab header at the start of the page is
+   followed by as many objects as fit, each in a slot of the
+   object's size rounded up to the cache's alignment.  Each slab
+   keeps its free objects on its own free list.  A cache sorts
+   its slabs into those that are full, those that are partly
+   used, and those that are empty.  Allocation comes from a
+   partly used slab if there is one, so that empty slabs stay
+   empty, and both allocation and free are a couple of list
+   operations under the cache's lock.
+
+   Empty slabs are kept for reuse, since VM metadata is reused at
+   a steady rate, until kmem_cache_shrink() gives them back to
+   the page allocator.  kmem_reap() does so for every cache, and
+   the pageout daemon runs it.  The caches' shrinker gives back
+   some of the empty slabs or all of them, as asked, when the
+   kernel pool runs short, as when a cache cannot get a new
+   slab.
+
+   A cache with a constructor calls it once for each object when
+   the object's slab is made.  The object must then be freed in
+   its constructed state, so that it can be allocated again
+   without construction.  Such a cache keeps an object's free
+   list link in a word after the object, not in the object
+   itself. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Header at the beginning of each slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    void *free_list;            /* Free objects in this slab. */
+    size_t used_cnt;            /* Number of objects in use. */
+  };
+
+/* All caches, for kmem_reap() and kmem_print_stats(). */
+static struct list all_caches;
+static struct lock all_caches_lock;
+
+static bool cache_grow (struct kmem_cache *);
+static size_t free_empty_slabs (struct kmem_cache *, size_t max);
+static void **slot_link (const struct kmem_cache *, void *obj);
+static size_t slab_shrink_count (void);
+static size_t slab_shrink_scan (size_t nr);
+
+/* Shrinker for the empty slabs of all caches. */
+static struct shrinker slab_shrinker =
+  {
+    .name = "slab",
+    .count = slab_shrink_count,
+    .scan = slab_shrink_scan,
+  };
+
+/* Initializes the list of caches. */
+void
+kmem_init (void)
+{
+  list_init (&all_caches);
+  lock_init_named (&all_caches_lock, "kmem_caches");
+  shrinker_register (&slab_shrinker);
+}
+
+/* Initializes CACHE for objects of OBJ_SIZE bytes, each aligned
+   on an ALIGN-byte boundary, where ALIGN is a power of 2 or 0 for
+   the default of a word.  If CTOR is nonnull, it is called on
+   every object when its slab is created.  NAME is used for
+   debugging and statistics.  No memory is allocated until the
+   first kmem_cache_alloc(). */
+void
+kmem_cache_init (struct kmem_cache *cache, const char *name, size_t obj_size,
+                 size_t align, kmem_ctor_func *ctor)
+{
+  size_t slot_size;
+
+  ASSERT (cache != NULL);
+  ASSERT (obj_size > 0);
+  ASSERT ((align & (align - 1)) == 0);
+
+  if (align < sizeof (void *))
+    align = sizeof (void *);
+
+  /* Every object must be able to hold the free list link, unless
+     the link goes after a constructed object. */
+  if (ctor != NULL)
+    {
+      cache->link_ofs = ROUND_UP (obj_size, sizeof (void *));
+      slot_size = cache->link_ofs + sizeof (void *);
+    }
+  else
+    {
+      cache->link_ofs = 0;
+      slot_size = obj_size < sizeof (void *) ? sizeof (void *) : obj_size;
+    }
+  slot_size = ROUND_UP (slot_size, align);
+
+  cache->name = name;
+  cache->obj_size = obj_size;
+  cache->slot_size = slot_size;
+  cache->first_ofs = ROUND_UP (sizeof (struct slab), align);
+  ASSERT (cache->first_ofs + slot_size <= PGSIZE);
+  cache->objs_per_slab = (PGSIZE - cache->first_ofs) / slot_size;
+  cache->ctor = ctor;
+  list_init (&cache->partial);
+  list_init (&cache->full);
+  list_init (&cache->empty);
+  cache->slab_cnt = 0;
+  cache->free_cnt = 0;
+  cache->alloc_cnt = 0;
+  cache->shrink_cnt = 0;
+  lock_init (&cache->lock);
+
+  lock_acquire (&all_caches_lock);
+  list_push_back (&all_caches, &cache->elem);
+  lock_release (&all_caches_lock);
+}
+
+/* Obtains an object from CACHE and returns it, or a null pointer
+   if a new slab is needed and no page is available.  The
+   object's contents are undefined, unless CACHE has a
+   constructor. */
+void *
+kmem_cache_alloc (struct kmem_cache *cache)
+{
+  struct slab *slab;
+  void *obj;
+
+  lock_acquire (&cache->lock);
+  if (list_empty (&cache->partial) && list_empty (&cache->empty)
+      && !cache_grow (cache))
+    {
+      /* Let the caches give memory back, then try once more. */
+      lock_release (&cache->lock);
+      shrink_reclaim (1);
+      lock_acquire (&cache->lock);
+      if (list_empty (&cache->partial) && list_empty (&cache->empty)
+          && !cache_grow (cache))
+        {
+          lock_release (&cache->lock);
+          return NULL;
+        }
+    }
+
+  if (!list_empty (&cache->partial))
+    slab = list_entry (list_front (&cache->partial), struct slab, elem);
+  else
+    slab = list_entry (list_front (&cache->empty), struct slab, elem);
+
+  obj = slab->free_list;
+  slab->free_list = *slot_link (cache, obj);
+  if (slab->used_cnt++ == 0 || slab->free_list == NULL)
+    {
+      list_remove (&slab->elem);
+      list_push_front (slab->free_list == NULL ? &cache->full
+                       : &cache->partial, &slab->elem);
+    }
+  cache->free_cnt--;
+  cache->alloc_cnt++;
+  lock_release (&cache->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  A null pointer is ignored. */
+void
+kmem_cache_free (struct kmem_cache *cache, void *obj)
+{
+  struct slab *slab;
+  bool was_full;
+
+  if (obj == NULL)
+    return;
+
+  slab = pg_round_down (obj);
+  ASSERT (slab->magic == SLAB_MAGIC);
+  ASSERT (slab->cache == cache);
+  ASSERT (((uintptr_t) obj - (uintptr_t) slab - cache->first_ofs)
+          % cache->slot_size == 0);
+
+  lock_acquire (&cache->lock);
+  ASSERT (slab->used_cnt > 0);
+  was_full = slab->free_list == NULL;
+  *slot_link (cache, obj) = slab->free_list;
+  slab->free_list = obj;
+  if (--slab->used_cnt == 0 || was_full)
+    {
+      list_remove (&slab->elem);
+      list_push_front (slab->used_cnt == 0 ? &cache->empty
+                       : &cache->partial, &slab->elem);
+    }
+  cache->free_cnt++;
+  lock_release (&cache->lock);
+}
+
+/* Gives CACHE's empty slabs back to the page allocator.  Returns
+   the number of pages freed. */
+size_t
+kmem_cache_shrink (struct kmem_cache *cache)
+{
+  size_t cnt;
+
+  lock_acquire (&cache->lock);
+  cnt = free_empty_slabs (cache, SIZE_MAX);
+  lock_release (&cache->lock);
+
+  return cnt;
+}
+
+/* Gives up to MAX of CACHE's empty slabs back to the page
+   allocator and returns the number freed.  CACHE's lock must be
+   held. */
+static size_t
+free_empty_slabs (struct kmem_cache *cache, size_t max)
+{
+  size_t cnt = 0;
+
+  ASSERT (lock_held_by_current_thread (&cache->lock));
+
+  while (cnt < max && !list_empty (&cache->empty))
+    {
+      struct slab *slab = list_entry (list_pop_front (&cache->empty),
+                                      struct slab, elem);
+      slab->magic = 0;
+      palloc_free_page (slab);
+      cnt++;
+    }
+  cache->slab_cnt -= cnt;
+  cache->free_cnt -= cnt * cache->objs_per_slab;
+  cache->shrink_cnt += cnt;
+  return cnt;
+}
+
+/* Frees all the slabs of CACHE at once, including any objects
+   still in use, which must not be referenced afterward.  CACHE
+   may be used again, as if just initialized. */
+void
+kmem_cache_destroy (struct kmem_cache *cache)
+{
+  struct list *lists[] = { &cache->partial, &cache->full, &cache->empty };
+  size_t i;
+
+  lock_acquire (&cache->lock);
+  for (i = 0; i < sizeof lists / sizeof *lists; i++)
+    while (!list_empty (lists[i]))
+      {
+        struct slab *slab = list_entry (list_pop_front (lists[i]),
+                                        struct slab, elem);
+        slab->magic = 0;
+        palloc_free_page (slab);
+      }
+  cache->slab_cnt = 0;
+  cache->free_cnt = 0;
+  lock_release (&cache->lock);
+}
+
+/* Gives the empty slabs of every cache back to the page
+   allocator, and returns the number of pages freed. */
+size_t
+kmem_reap (void)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  lock_acquire (&all_caches_lock);
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    cnt += kmem_cache_shrink (list_entry (e, struct kmem_cache, elem));
+  lock_release (&all_caches_lock);
+
+  return cnt;
+}
+
+/* Prints statistics for each cache that has been used. */
+void
+kmem_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *cache = list_entry (e, struct kmem_cache, elem);
+      if (cache->alloc_cnt == 0)
+        continue;
+      printf ("Slab %s: %zu of %zu objects of %zu bytes in use "
+              "in %zu slabs, %llu allocs, %llu slabs freed\n",
+              cache->name, cache->slab_cnt * cache->objs_per_slab
+              - cache->free_cnt, cache->slab_cnt * cache->objs_per_slab,
+              cache->obj_size, cache->slab_cnt, cache->alloc_cnt,
+              cache->shrink_cnt);
+    }
+}
+
+/* Tries to acquire LOCK without waiting, as a shrinker must.
+   Returns true if successful. */
+static bool
+try_lock (struct lock *lock)
+{
+  return !lock_held_by_current_thread (lock) && lock_try_acquire (lock);
+}
+
+/* Returns the number of empty slabs in the caches that can be
+   locked right away. */
+static size_t
+slab_shrink_count (void)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  if (!try_lock (&all_caches_lock))
+    return 0;
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct kmem_cache *cache = list_entry (e, struct kmem_cache, elem);
+      if (try_lock (&cache->lock))
+        {
+          cnt += list_size (&cache->empty);
+          lock_release (&cache->lock);
+        }
+    }
+  lock_release (&all_caches_lock);
+
+  return cnt;
+}
+
+/* Gives up to NR empty slabs back to the page allocator, from
+   the caches that can be locked right away.  Returns the number
+   freed. */
+static size_t
+slab_shrink_scan (size_t nr)
+{
+  struct list_elem *e;
+  size_t cnt = 0;
+
+  if (!try_lock (&all_caches_lock))
+    return 0;
+  for (e = list_begin (&all_caches);
+       e != list_end (&all_caches) && cnt < nr; e = list_next (e))
+    {
+      struct kmem_cache *cache = list_entry (e, struct kmem_cache, elem);
+      if (try_lock (&cache->lock))
+        {
+          cnt += free_empty_slabs (cache, nr - cnt);
+          lock_release (&cache->lock);
+        }
+    }
+  lock_release (&all_caches_lock);
+
+  return cnt;
+}
+
+/* Returns the free list link of OBJ in CACHE. */
+static void **
+slot_link (const struct kmem_cache *cache, void *obj)
+{
+  return (void **) ((uint8_t *) obj + cache->link_ofs);
+}
+
+/* Adds a new slab to CACHE's empty slabs, constructing all of
+   its objects.  Returns false if no page is available.
+   CACHE's lock must be held. */
+static bool
+cache_grow (struct kmem_cache *cache)
+{
+  struct slab *slab;
+  uint8_t *obj;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&cache->lock));
+
+  /* With CACHE locked, the page allocator may not shrink the
+     caches: kmem_cache_alloc() does, once CACHE is unlocked. */
+  slab = palloc_get_page (PAL_NORECLAIM);
+  if (slab == NULL)
+    return false;
+
+  slab->magic = SLAB_MAGIC;
+  slab->cache = cache;
+  slab->free_list = NULL;
+  slab->used_cnt = 0;
+  list_push_back (&cache->empty, &slab->elem);
+
+  obj = (uint8_t *) slab + cache->first_ofs
+        + (cache->objs_per_slab - 1) * cache->slot_size;
+  for (i = 0; i < cache->objs_per_slab; i++, obj -= cache->slot_size)
+    {
+      if (cache->ctor != NULL)
+        cache->ctor (obj);
+      *slot_link (cache, obj) = slab->free_list;
+      slab->free_list = obj;
+    }
+  cache->slab_cnt++;
+  cache->free_cnt += cache->objs_per_slab;
+  return true;
+}
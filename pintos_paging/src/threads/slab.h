@@ -0,0 +1,49 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Constructor for objects of a cache.  Called on each object
+   when its slab is created, not on every allocation. */
+typedef void kmem_ctor_func (void *obj);
+
+/* An object cache: allocates objects of a single type (size)
+   out of whole pages ("slabs") obtained from the page
+   allocator.  Freed objects go back onto their slab's free list,
+   so a cache that has warmed up never touches malloc() or the
+   page allocator on its fast path.  See slab.c. */
+struct kmem_cache
+  {
+    const char *name;           /* For debugging and statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t slot_size;           /* Bytes taken by each object. */
+    size_t link_ofs;            /* Offset of free list link in slot. */
+    size_t first_ofs;           /* Offset of first object in slab. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    kmem_ctor_func *ctor;       /* Constructor, or a null pointer. */
+    struct list partial;        /* Slabs with objects free and used. */
+    struct list full;           /* Slabs with no object free. */
+    struct list empty;          /* Slabs with every object free. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t free_cnt;            /* Number of free objects. */
+    unsigned long long alloc_cnt; /* Number of allocations made. */
+    unsigned long long shrink_cnt; /* Number of slabs given back. */
+    struct lock lock;           /* Protects all of the above. */
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+void kmem_init (void);
+
+void kmem_cache_init (struct kmem_cache *, const char *name, size_t obj_size,
+                      size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+size_t kmem_cache_shrink (struct kmem_cache *);
+void kmem_cache_destroy (struct kmem_cache *);
+
+size_t kmem_reap (void);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
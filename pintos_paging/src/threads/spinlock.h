@@ -0,0 +1,64 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <debug.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* Spinlock.
+
+   Protects data that interrupt handlers, or CPUs that do not run
+   threads, also use, where a lock cannot be waited for: it is
+   held with interrupts off on the holding CPU, and other CPUs
+   spin until it is free.  Hold it only briefly, and never sleep
+   while holding it. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* 1 if held, 0 otherwise. */
+    enum intr_level old_level;  /* Interrupt level before acquiring. */
+  };
+
+/* Initializes LOCK as free. */
+static inline void
+spinlock_init (struct spinlock *lock)
+{
+  lock->locked = 0;
+}
+
+/* Turns interrupts off and acquires LOCK, spinning until it is
+   free. */
+static inline void
+spinlock_acquire (struct spinlock *lock)
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t held = 1;
+
+  for (;;)
+    {
+      asm volatile ("xchgl %0, %1" : "+r" (held), "+m" (lock->locked)
+                    : : "memory");
+      if (!held)
+        break;
+      while (lock->locked)
+        asm volatile ("pause");
+      held = 1;
+    }
+  lock->old_level = old_level;
+}
+
+/* Releases LOCK and restores the interrupt level from before
+   spinlock_acquire(). */
+static inline void
+spinlock_release (struct spinlock *lock)
+{
+  enum intr_level old_level = lock->old_level;
+
+  ASSERT (lock->locked);
+
+  barrier ();
+  lock->locked = 0;
+  intr_set_level (old_level);
+}
+
+#endif /* threads/spinlock.h */
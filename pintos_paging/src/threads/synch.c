@@ -29,9 +29,43 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
 
+/* Contention counters of a lock named with lock_init_named().
+   Their storage is static, since the locks worth watching are
+   long-lived and some are initialized before malloc() works. */
+struct lock_profile
+  {
+    struct lock_stats stats;    /* Counters reported to users. */
+    int64_t acquired_at;        /* timer_ns() when last acquired. */
+  };
+
+/* Most locks profiled. */
+#define LOCK_PROFILE_MAX 32
+
+static struct lock_profile profiles[LOCK_PROFILE_MAX];
+static size_t profile_cnt;
+
+static heap_less_func waiter_less;
+static void waiter_add (struct heap *);
+static void waiter_wake (struct heap *);
+
+/* A wait that ends after a number of timer ticks if it is not
+   woken up before.  The timeout takes the thread off the heap it
+   waits on, if it is still there, and wakes it up. */
+struct timed_wait
+  {
+    struct timeout timeout;     /* Due at the end of the wait. */
+    struct thread *thread;      /* The waiting thread. */
+    bool expired;               /* Woken up by the timeout? */
+  };
+
+static void timed_wait_start (struct timed_wait *, int64_t ticks);
+static bool timed_wait_end (struct timed_wait *);
+static void lock_acquired (struct lock *, bool contended, int64_t start);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -48,7 +82,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  heap_init (&sema->waiters, waiter_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -69,24 +103,54 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      //  
-      // if (true) {
-      //   // thread_current()->locked_by = lock;
-      //   // list_insert_ordered(&lock->holder->threads_locked,
-      //   //   &lock->holder->elem, (list_less_func *) &cmp_priority, NULL);
-
-      //   // donation_acquire();
-      // }
-      //  
-      list_insert_ordered(&sema->waiters, &thread_current ()->elem, 
-        (list_less_func *)cmp_priority, NULL);
-
+      waiter_add (&sema->waiters);
       thread_block ();
     }
   sema->value--;
   intr_set_level (old_level);
 }
 
+/* Down or "P" operation on a semaphore, as sema_down() does, but
+   waits for at most TICKS timer ticks.  Returns true if SEMA is
+   decremented, false if the time ran out first.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks)
+{
+  enum intr_level old_level;
+  struct timed_wait wait;
+  bool started = false;
+  bool success;
+
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  while (sema->value == 0)
+    {
+      if (!started)
+        {
+          if (ticks <= 0)
+            break;
+          timed_wait_start (&wait, ticks);
+          started = true;
+        }
+      else if (wait.expired)
+        break;
+      waiter_add (&sema->waiters);
+      thread_block ();
+    }
+  success = sema->value > 0;
+  if (success)
+    sema->value--;
+  if (started)
+    timed_wait_end (&wait);
+  intr_set_level (old_level);
+  return success;
+}
+
 /* Down or "P" operation on a semaphore, but only if the
    semaphore is not already 0.  Returns true if the semaphore is
    decremented, false otherwise.
@@ -125,21 +189,10 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-
-  if (!list_empty (&sema->waiters)) {
-
-    //  
-    list_sort(&sema->waiters, (list_less_func *)cmp_priority, NULL);
-
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
-  }
-
+  if (!heap_empty (&sema->waiters))
+    waiter_wake (&sema->waiters);
   sema->value++;
   intr_set_level (old_level);
-
-  //  
-  // check_priority();
 }
 
 static void sema_test_helper (void *sema_);
@@ -201,6 +254,30 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  heap_init (&lock->donors, cmp_donate, NULL);
+  lock->profile = NULL;
+}
+
+/* Initializes LOCK as lock_init() does, and also counts its
+   acquisitions, how many of them had to wait and for how long,
+   and its longest hold, under NAME (truncated to 15 characters).
+   Once LOCK_PROFILE_MAX locks are named, later ones go
+   uncounted.  LOCK must never be destroyed. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  lock_init (lock);
+
+  old_level = intr_disable ();
+  if (profile_cnt < LOCK_PROFILE_MAX)
+    {
+      struct lock_profile *p = &profiles[profile_cnt++];
+      strlcpy (p->stats.name, name, sizeof p->stats.name);
+      lock->profile = p;
+    }
+  intr_set_level (old_level);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -214,31 +291,88 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct lock_profile *p;
+  enum intr_level old_level;
+  int64_t start = 0;
+  bool contended;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  //  
-  if (!thread_mlfqs && lock->holder != NULL) {
+  p = lock->profile;
+  old_level = intr_disable ();
+  contended = lock->semaphore.value == 0;
+  if (p != NULL && contended)
+    start = timer_ns ();
+  if (!thread_mlfqs && lock->holder != NULL)
+    donation_acquire (lock);
 
-    thread_current()->locked_by = lock;
-    // list_insert_ordered(&lock->holder->threads_locked,
-    //   &lock->holder->donate_elem, (list_less_func *) &cmp_donate, NULL);
-    list_insert_ordered(&lock->holder->threads_locked,
-      &thread_current()->donate_elem, (list_less_func *) &cmp_donate, NULL);
-    // list_insert_ordered(&lock->holder->threads_locked,
-    //   &thread_current()->elem, (list_less_func *) &cmp_priority, NULL);
+  sema_down (&lock->semaphore);
 
-    donation_acquire();
+  lock_acquired (lock, contended, start);
+  intr_set_level (old_level);
+}
 
-  }
+/* Acquires LOCK as lock_acquire() does, but waits for at most
+   TICKS timer ticks.  Returns true if LOCK is acquired, false if
+   the time ran out first; the priority the current thread donated
+   while waiting is then taken back from the holder.
 
-  sema_down (&lock->semaphore);
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t ticks)
+{
+  enum intr_level old_level;
+  int64_t start = 0;
+  bool contended, success;
+
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!lock_held_by_current_thread (lock));
+
+  old_level = intr_disable ();
+  contended = lock->semaphore.value == 0;
+  if (lock->profile != NULL && contended)
+    start = timer_ns ();
+  if (!thread_mlfqs && lock->holder != NULL)
+    donation_acquire (lock);
+
+  success = sema_down_timeout (&lock->semaphore, ticks);
+
+  if (success)
+    lock_acquired (lock, contended, start);
+  else if (!thread_mlfqs)
+    donation_cancel (lock);
+  intr_set_level (old_level);
+  return success;
+}
+
+/* Makes the current thread the holder of LOCK, which it has just
+   downed, and counts the acquisition, which waited since START if
+   CONTENDED.  Interrupts must be off. */
+static void
+lock_acquired (struct lock *lock, bool contended, int64_t start)
+{
+  struct lock_profile *p = lock->profile;
 
-  //  
-  thread_current()->locked_by = NULL;
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  lock->holder = thread_current ();
+  if (!thread_mlfqs)
+    donation_hold (lock);
+  else
+    lock->holder = thread_current ();
+  if (p != NULL)
+    {
+      p->acquired_at = timer_ns ();
+      p->stats.acquisitions++;
+      if (contended)
+        {
+          p->stats.contended++;
+          p->stats.wait_ns += p->acquired_at - start;
+        }
+    }
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -250,14 +384,24 @@ lock_acquire (struct lock *lock)
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
-  if (success)
+  if (success && !thread_mlfqs)
+    donation_hold (lock);
+  else if (success)
     lock->holder = thread_current ();
+  if (success && lock->profile != NULL)
+    {
+      lock->profile->acquired_at = timer_ns ();
+      lock->profile->stats.acquisitions++;
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -269,32 +413,25 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
-  //  
-  if (!thread_mlfqs) 
-  {
-    // printf("lock_release\n");
-    // list_init(&thread_current()->threads_locked);
-    struct list_elem *e = list_begin(&thread_current()->threads_locked);
-    while (e != list_end(&thread_current()->threads_locked))
+  old_level = intr_disable ();
+  if (lock->profile != NULL)
     {
-      struct thread *t = list_entry(e, struct thread, donate_elem);
-      // struct thread *t = list_entry(e, struct thread, elem);
-      // printf("eeee %d\n", t->priority);
-      struct list_elem *tmp = list_next(e);
-      if (lock == t->locked_by) list_remove(e);
-      //   // else printf("eeee %d\n", t->priority);
-      e = tmp;
+      struct lock_profile *p = lock->profile;
+      int64_t held = timer_ns () - p->acquired_at;
+      if (held > p->stats.max_hold_ns)
+        p->stats.max_hold_ns = held;
     }
-
-    donation_release();
-  }
+  if (!thread_mlfqs)
+    donation_release (lock);
 
   lock->holder = NULL;
   sema_up (&lock->semaphore);
-
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -307,28 +444,39 @@ lock_held_by_current_thread (const struct lock *lock)
 
   return lock->holder == thread_current ();
 }
-
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-    //  
-    struct thread* holder;
-  };
 
-//  
-bool 
-cmp_sema(const struct list_elem *a,
-  const struct list_elem *b,
-  void *axu)
+/* Copies the counters of the INDEX'th lock named with
+   lock_init_named() into *STATS.  Returns false if there is no
+   such lock. */
+bool
+lock_get_stats (size_t index, struct lock_stats *stats)
 {
-  struct semaphore_elem *left = list_entry(a, struct  semaphore_elem, elem);
-  struct semaphore_elem *right = list_entry(b, struct  semaphore_elem, elem);
-  
-  return left->holder->priority > right->holder->priority;
+  enum intr_level old_level;
+
+  if (index >= profile_cnt)
+    return false;
+
+  old_level = intr_disable ();
+  *stats = profiles[index].stats;
+  intr_set_level (old_level);
+  return true;
 }
 
+/* Prints the counters of each named lock that was used. */
+void
+lock_print_stats (void)
+{
+  struct lock_stats s;
+  size_t i;
+
+  for (i = 0; lock_get_stats (i, &s); i++)
+    if (s.acquisitions != 0)
+      printf ("Lock %s: %llu acquisitions, %llu contended, "
+              "%lld us waiting, %lld us longest hold\n",
+              s.name, s.acquisitions, s.contended,
+              s.wait_ns / 1000, s.max_hold_ns / 1000);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -337,7 +485,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  heap_init (&cond->waiters, waiter_less, NULL);
 }
  
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -363,25 +511,56 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
+  enum intr_level old_level;
 
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
-  
-  sema_init (&waiter.semaphore, 0);
-  // list_push_back (&cond->waiters, &waiter.elem);
-  //  
-  waiter.holder = thread_current();
-  list_insert_ordered(&cond->waiters, &waiter.elem, 
-        (list_less_func *)cmp_sema, NULL);
 
+  /* With interrupts off, no signal can come between releasing
+     LOCK and blocking. */
+  old_level = intr_disable ();
+  waiter_add (&cond->waiters);
   lock_release (lock);
-  sema_down (&waiter.semaphore);
+  thread_block ();
+  intr_set_level (old_level);
   lock_acquire (lock);
 }
 
+/* Waits on COND as cond_wait() does, but for at most TICKS timer
+   ticks.  Returns true if COND was signaled, false if the time ran
+   out first.  Either way, LOCK is reacquired before returning.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock,
+                   int64_t ticks)
+{
+  enum intr_level old_level;
+  struct timed_wait wait;
+  bool signaled = false;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+
+  if (ticks > 0)
+    {
+      old_level = intr_disable ();
+      waiter_add (&cond->waiters);
+      timed_wait_start (&wait, ticks);
+      lock_release (lock);
+      thread_block ();
+      signaled = timed_wait_end (&wait);
+      intr_set_level (old_level);
+      lock_acquire (lock);
+    }
+  return signaled;
+}
+
 /* If any threads are waiting on COND (protected by LOCK), then
    this function signals one of them to wake up from its wait.
    LOCK must be held before calling this function.
@@ -392,18 +571,17 @@ cond_wait (struct condition *cond, struct lock *lock)
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters)) {
-    //  
-    list_sort(&cond->waiters, (list_less_func *)cmp_sema, NULL);
-
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
-  }
+  old_level = intr_disable ();
+  if (!heap_empty (&cond->waiters))
+    waiter_wake (&cond->waiters);
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -418,6 +596,181 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!heap_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW as a readers-writer lock, held by nobody. */
+void
+rwlock_init (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->write);
+  sema_init (&rw->drained, 0);
+  rw->reader_cnt = 0;
+  rw->draining = false;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it.  RW must not already be held for writing by the
+   current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->write);
+  old_level = intr_disable ();
+  rw->reader_cnt++;
+  intr_set_level (old_level);
+  lock_release (&rw->write);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0 && rw->draining)
+    {
+      rw->draining = false;
+      sema_up (&rw->drained);
+    }
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until neither readers nor
+   another writer hold it.  RW must not already be held by the
+   current thread.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  lock_acquire (&rw->write);
+  old_level = intr_disable ();
+  if (rw->reader_cnt > 0)
+    {
+      rw->draining = true;
+      sema_down (&rw->drained);
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread holds for writing.  The
+   highest-priority waiter, reader or writer, goes next. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  lock_release (&rw->write);
+}
+
+/* Returns true if the current thread holds RW for writing,
+   false otherwise. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return lock_held_by_current_thread (&rw->write);
+}
+
+/* Returns true if waiting thread A has a lower priority than
+   B. */
+static bool
+waiter_less (const struct heap_elem *a, const struct heap_elem *b,
+             void *aux UNUSED)
+{
+  return (heap_entry (a, struct thread, wait_elem)->priority
+          < heap_entry (b, struct thread, wait_elem)->priority);
+}
+
+/* Adds the current thread to WAITERS, which it must then block
+   on.  Interrupts must be off. */
+static void
+waiter_add (struct heap *waiters)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  cur->wait_heap = waiters;
+  heap_push (waiters, &cur->wait_elem);
+}
+
+/* Ends the timed wait of the thread, if it still waits. */
+static void
+timed_wait_expired (struct timeout *to)
+{
+  struct timed_wait *wait = to->aux;
+  struct thread *t = wait->thread;
+
+  if (t->wait_heap == NULL)
+    return;                     /* Woken up already. */
+  heap_remove (t->wait_heap, &t->wait_elem);
+  t->wait_heap = NULL;
+  wait->expired = true;
+  thread_unblock (t);
+}
+
+/* Starts WAIT, for the current thread, to end in TICKS timer
+   ticks.  Interrupts must be off. */
+static void
+timed_wait_start (struct timed_wait *wait, int64_t ticks)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  wait->thread = thread_current ();
+  wait->expired = false;
+  timeout_init (&wait->timeout, timed_wait_expired, wait);
+  timeout_set (&wait->timeout, timer_ticks () + ticks);
+}
+
+/* Ends WAIT, after the current thread is woken up, and returns
+   true if it was not woken by the timeout.  Interrupts must be
+   off. */
+static bool
+timed_wait_end (struct timed_wait *wait)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  timeout_cancel (&wait->timeout);
+  return !wait->expired;
+}
+
+/* Unblocks the highest-priority thread in WAITERS, which must
+   not be empty.  Interrupts must be off. */
+static void
+waiter_wake (struct heap *waiters)
+{
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t = heap_entry (heap_pop (waiters), struct thread, wait_elem);
+  t->wait_heap = NULL;
+  thread_unblock (t);
+}
@@ -6,12 +6,18 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/spinlock.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/tunable.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 // add
 #include "threads/fixed_point.h"
@@ -29,13 +35,94 @@ static const int DEPTH = 8;
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, in the run queue: a
+   queue for each priority, and a mask of the priorities whose
+   queue is not empty, so that the highest one is found in
+   constant time.
+
+   The queue of a priority is fair among scheduling groups: it is
+   a heap of the groups with threads ready at that priority, each
+   with its threads in FIFO order, and the group that has run the
+   least virtual time there, weighted by its share, goes first.
+   With one group, the queue is plain FIFO.
+
+   Only the bootstrap processor runs threads (see threads/mp.c),
+   so there is one run queue, protected by turning interrupts
+   off. */
+struct runqueue
+  {
+    struct list dl_queue;               /* Active deadline threads,
+                                           earliest deadline first. */
+    struct heap queues[PRI_MAX + 1];    /* Groups with ready threads,
+                                           by priority. */
+    int64_t min_vruntime[PRI_MAX + 1];  /* Least vruntime run, by
+                                           priority. */
+    uint64_t mask;                      /* Priorities with threads. */
+    size_t cnt;                         /* Number of ready threads. */
+    struct thread *running;             /* Thread running. */
+  };
+static struct runqueue runqueue;
+
+/* Fair-share scheduling groups.
+
+   Each thread is in a group, which the threads it creates
+   inherit, and so do the processes it starts.  Among the threads
+   ready at the same priority, CPU time is divided among groups
+   in proportion to their weights first, and among the threads of
+   a group by round robin second.  Priorities and deadline threads
+   still come first: the groups only share out a priority.
+
+   A group has a group_entity for each priority,
+   which holds its threads ready there and the virtual time it has
+   run there: the ticks its threads ran, charged when they are
+   made ready again, times VRUNTIME_UNIT / weight.  A group that
+   had no thread ready at a priority starts from the least
+   virtual time run there meanwhile, so that it cannot save up
+   time while idle. */
+#define VRUNTIME_UNIT ((int64_t) 1 << 20)
+
+struct group_entity
+  {
+    struct heap_elem elem;      /* In its run queue's queue, if ready. */
+    struct list threads;        /* Ready threads, in FIFO order. */
+    int64_t vruntime;           /* Weighted ticks run. */
+  };
+
+struct sched_group
+  {
+    int id;                     /* Identifier, 0 for the default. */
+    unsigned weight;            /* Share, relative to other groups'. */
+    unsigned ref_cnt;           /* Threads in it. */
+    struct group_entity *ents;  /* By priority. */
+  };
 
-/* List of processes in THREAD_BLOCK state, that is, processes
-   that are blocked. */
-static struct list block_list;
+static struct sched_group default_group;
+static struct group_entity default_ents[PRI_MAX + 1];
+static int next_group_id = 1;
+
+/* Deadline scheduling class.
+
+   A thread that calls thread_set_deadline (RUNTIME, PERIOD) is
+   guaranteed RUNTIME ticks of CPU in every PERIOD ticks.  Periods
+   start at ticks of the timer wheel, by a timeout that hands the
+   thread a fresh budget of RUNTIME ticks and moves its deadline,
+   the end of the period, one period on.  While it has budget
+   left, the thread is "active": it runs ahead of any thread
+   scheduled by priority, and among active threads the one with
+   the earliest deadline runs.  thread_tick() charges the budget;
+   once it runs out, the thread falls back to its priority until
+   its next period, so that it cannot take more than it reserved.
+
+   The guarantee holds because admission control keeps the sum of
+   RUNTIME / PERIOD over all deadline threads at or below
+   DL_BW_MAX.  Deadline threads are not moved between run queues,
+   and only one CPU's worth of bandwidth is handed out, which is
+   all there is while only the bootstrap processor runs threads.
+   Bandwidths are fixed-point fractions of a CPU. */
+#define DL_BW_SHIFT 16
+#define DL_BW_MAX ((95 << DL_BW_SHIFT) / 100)
+static int64_t dl_bandwidth;    /* Reserved by deadline threads. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -47,8 +134,21 @@ static struct thread *idle_thread;
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
+/* Threads in all_list by tid, for thread_lookup(): a chained
+   hash, indexed by the low bits of the tid, which tids being
+   handed out in sequence spread evenly.  Like all_list, it is
+   protected by turning interrupts off. */
+#define TID_BUCKETS 256
+static struct list tid_buckets[TID_BUCKETS];
+
+/* Pages of dead threads kept for new ones, linked through their
+   first word, so that spawning threads does not go through the
+   page allocator each time.  A page is not zeroed: init_thread()
+   clears its struct thread, and the stack needs nothing. */
+#define THREAD_CACHE_MAX 8
+static void *thread_cache;
+static size_t thread_cache_cnt;
+static struct spinlock thread_cache_lock;
 
 /* Stack frame for kernel_thread(). */
 struct kernel_thread_frame 
@@ -63,17 +163,47 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Scheduling latency histograms, as reported in struct
+   sched_stats. */
+static uint64_t wakeup_hist[SCHED_LATENCY_BUCKETS];
+static uint64_t preempt_hist[SCHED_LATENCY_BUCKETS];
+static uint64_t switch_hist[SCHED_LATENCY_BUCKETS];
+static uint64_t preempt_tsc;    /* When preemption was asked for, or 0. */
+static uint64_t switch_tsc;     /* rdtsc() before switch_threads(), or 0. */
+
 /* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define TIME_SLICE 4            /* Default time slice. */
+static unsigned time_slice = TIME_SLICE; /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+static struct tunable thread_tunables[] =
+  {
+    TUNABLE ("sched.time_slice", time_slice, 1, TIMER_FREQ, NULL),
+  };
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
-// add
-fixed_point load_avg;
+/* 4.4BSD scheduler.
+
+   The running thread's recent_cpu is charged each tick, and only
+   its priority is recomputed every fourth tick.  The once-a-second
+   decay of every thread's recent_cpu is not done all at once:
+   each second's decay coefficient is recorded, and a thread
+   applies the decays it has missed when it is next refreshed,
+   which happens when it is woken up or scheduled, and by a sweep
+   over all threads that refreshes a share of them at each tick,
+   so that each one is refreshed about once a second.  A thread
+   not refreshed for over DECAY_HISTORY seconds only gets the last
+   DECAY_HISTORY decays. */
+fixed_point load_avg;           /* System load average. */
+#define DECAY_HISTORY 16
+static fixed_point decay_coefs[DECAY_HISTORY]; /* Of second N at N % 16. */
+static unsigned mlfqs_seconds;  /* Seconds elapsed. */
+static size_t thread_cnt;       /* Number of threads in all_list. */
+static struct list_elem *sweep_elem; /* Next thread to refresh. */
 
 static void kernel_thread (thread_func *, void *aux);
 
@@ -86,23 +216,9 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void); 
 void thread_schedule_tail (struct thread *prev); 
 static tid_t allocate_tid (void);
-
-//  
-void print_list(const struct list *list) 
-{
-  ASSERT(list != NULL);
-
-  printf("print list:");
-  struct list_elem *e;
-
-  for (e = list_begin (list); e != list_end (list); e = list_next (e))
-  {
-    struct thread *t = list_entry (e, struct thread, donate_elem);
-    // printf("%s %d\t", t->name, t->sleep_until);
-    printf("%d \n", t->priority);
-  }
-  printf("\n");
-}
+static struct thread *thread_page_alloc (void);
+static void thread_page_free (struct thread *);
+static void group_put (struct sched_group *);
 
 //  
 bool 
@@ -115,48 +231,367 @@ cmp_priority (const struct list_elem *a,
   return left->priority > right->priority;
 }
 
-//  
-bool 
-cmp_donate (const struct list_elem *a, 
-  const struct list_elem *b, 
-  void *aux) 
+/* Returns true if thread A, waiting for a lock, has a lower
+   priority than B, which waits for the same lock. */
+bool
+cmp_donate (const struct heap_elem *a, const struct heap_elem *b,
+            void *aux UNUSED)
 {
-  struct thread *left = list_entry(a, struct thread, donate_elem);
-  struct thread *right = list_entry(b, struct thread, donate_elem);
-  return left->priority > right->priority;
+  return (heap_entry (a, struct thread, donate_elem)->priority
+          < heap_entry (b, struct thread, donate_elem)->priority);
 }
 
-//  
-bool 
-cmp_sleep_until (const struct list_elem *a, 
-  const struct list_elem *b, 
-  void *aux) 
+/* Returns the priority LOCK's waiters donate to its holder, or
+   PRI_MIN - 1 if it has none. */
+static int
+lock_donation (const struct lock *lock)
 {
-  struct thread *left = list_entry(a, struct thread, elem);
-  struct thread *right = list_entry(b, struct thread, elem);
-  return left->sleep_until < right->sleep_until;
+  if (heap_empty (&lock->donors))
+    return PRI_MIN - 1;
+  return heap_entry (heap_top (&lock->donors),
+                     struct thread, donate_elem)->priority;
 }
 
-//  
-void check_priority(void) {
+/* Returns true if held lock A receives a lower donation than
+   B. */
+static bool
+cmp_held_lock (const struct heap_elem *a, const struct heap_elem *b,
+               void *aux UNUSED)
+{
+  return (lock_donation (heap_entry (a, struct lock, held_elem))
+          < lock_donation (heap_entry (b, struct lock, held_elem)));
+}
+
+/* Returns the highest priority of a thread in RQ, or -1 if RQ is
+   empty. */
+static int
+rq_max_priority (const struct runqueue *rq)
+{
+  uint32_t high = rq->mask >> 32, low = rq->mask;
+
+  if (high != 0)
+    return 63 - __builtin_clz (high);
+  else if (low != 0)
+    return 31 - __builtin_clz (low);
+  else
+    return -1;
+}
+
+/* Returns true if T is a deadline thread with budget left in its
+   current period. */
+static bool
+dl_active (const struct thread *t)
+{
+  return t->dl_period != 0 && t->dl_budget > 0;
+}
+
+/* Returns the share of a CPU that deadline thread T reserves. */
+static int64_t
+dl_thread_bandwidth (const struct thread *t)
+{
+  return (t->dl_runtime << DL_BW_SHIFT) / t->dl_period;
+}
+
+/* Returns true if thread T, ready, should run before RUNNING. */
+static bool
+thread_preempts (const struct thread *t, const struct thread *running)
+{
+  if (dl_active (t))
+    return !dl_active (running) || t->dl_deadline < running->dl_deadline;
+  return !dl_active (running) && t->priority > running->priority;
+}
+
+/* Returns true if active deadline thread A's deadline is earlier
+   than B's. */
+static bool
+cmp_deadline (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return (list_entry (a, struct thread, elem)->dl_deadline
+          < list_entry (b, struct thread, elem)->dl_deadline);
+}
+
+/* Returns true if group entity A has run more virtual time than
+   B, so that the least run is on top of a run queue's heap. */
+static bool
+cmp_vruntime (const struct heap_elem *a, const struct heap_elem *b,
+              void *aux UNUSED)
+{
+  return (heap_entry (a, struct group_entity, elem)->vruntime
+          > heap_entry (b, struct group_entity, elem)->vruntime);
+}
+
+/* Returns the entity of group G on RQ at PRIORITY. */
+static struct group_entity *
+group_entity (struct sched_group *g, const struct runqueue *rq, int priority)
+{
+  ASSERT (rq == &runqueue);
+  return &g->ents[priority];
+}
+
+/* Returns the first thread of the group first in line at
+   PRIORITY in RQ, which must have one. */
+static struct thread *
+rq_front (struct runqueue *rq, int priority)
+{
+  struct group_entity *e = heap_entry (heap_top (&rq->queues[priority]),
+                                       struct group_entity, elem);
+  return list_entry (list_front (&e->threads), struct thread, elem);
+}
+
+/* Adds T to RQ: to the deadline queue if T is an active deadline
+   thread, otherwise to the back of its group's threads at its
+   priority, charging the group for the ticks T ran since it was
+   last made ready.  Interrupts must be off. */
+static void
+rq_push (struct runqueue *rq, struct thread *t)
+{
+  ASSERT (t->priority >= PRI_MIN && t->priority <= PRI_MAX);
+
+  if (dl_active (t))
+    list_insert_ordered (&rq->dl_queue, &t->elem, cmp_deadline, NULL);
+  else
+    {
+      struct heap *queue = &rq->queues[t->priority];
+      struct group_entity *e = group_entity (t->group, rq, t->priority);
+      int64_t charge = t->group_ticks * VRUNTIME_UNIT / t->group->weight;
+
+      t->group_ticks = 0;
+      if (list_empty (&e->threads))
+        {
+          if (e->vruntime < rq->min_vruntime[t->priority])
+            e->vruntime = rq->min_vruntime[t->priority];
+          e->vruntime += charge;
+          heap_push (queue, &e->elem);
+        }
+      else if (charge != 0)
+        {
+          heap_remove (queue, &e->elem);
+          e->vruntime += charge;
+          heap_push (queue, &e->elem);
+        }
+      list_push_back (&e->threads, &t->elem);
+      rq->mask |= (uint64_t) 1 << t->priority;
+    }
+  rq->cnt++;
+  t->rq = rq;
+}
+
+/* Removes T from RQ, which it must be in.  Interrupts must be
+   off. */
+static void
+rq_remove (struct runqueue *rq, struct thread *t)
+{
+  ASSERT (t->rq == rq);
+
+  list_remove (&t->elem);
+  if (!dl_active (t))
+    {
+      struct heap *queue = &rq->queues[t->priority];
+      struct group_entity *e = group_entity (t->group, rq, t->priority);
+
+      if (list_empty (&e->threads))
+        {
+          heap_remove (queue, &e->elem);
+          if (heap_empty (queue))
+            rq->mask &= ~((uint64_t) 1 << t->priority);
+        }
+    }
+  rq->cnt--;
+}
+
+/* Returns true if the best ready thread should run before T.
+   Interrupts must be off. */
+static bool
+ready_preempts (const struct thread *t)
+{
+  struct runqueue *rq = &runqueue;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!list_empty (&rq->dl_queue))
+    return thread_preempts (list_entry (list_front (&rq->dl_queue),
+                                        struct thread, elem), t);
+  return !dl_active (t) && rq_max_priority (rq) > t->priority;
+}
+
+/* Returns the number of ready threads. */
+static size_t
+ready_cnt (void)
+{
+  return runqueue.cnt;
+}
+
+/* Adds T to the back of the queue of its priority in the run
+   queue.  Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  struct runqueue *rq = &runqueue;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  rq_push (rq, t);
 
-  if (!list_empty(&ready_list)) {
-    struct thread * next_thread = 
-      list_entry(list_begin(&ready_list), struct thread, elem);
+  /* A thread woken by an interrupt handler takes over on return
+     from the interrupt, rather than at the end of the time
+     slice. */
+  if (rq->running != NULL && thread_preempts (t, rq->running)
+      && intr_context ())
+    intr_yield_on_return ();
+}
+
+/* Removes T, which must be ready, from its run queue.
+   Interrupts must be off. */
+static void
+ready_remove (struct thread *t)
+{
+  struct runqueue *rq = t->rq;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  rq_remove (rq, t);
+}
+
+/* Sets T's (effective) priority to PRIORITY, moving T to the
+   matching ready queue if it is ready, or within the waiters of
+   what it waits for. */
+static void
+set_priority (struct thread *t, int priority)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->priority == priority)
+    ;
+  else if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else if (t->wait_heap != NULL)
+    {
+      heap_remove (t->wait_heap, &t->wait_elem);
+      t->priority = priority;
+      heap_push (t->wait_heap, &t->wait_elem);
+    }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
+}
+
+/* Recomputes T's priority as the greater of its own and the
+   best donation to any lock it holds. */
+static void
+donation_refresh (struct thread *t)
+{
+  int priority = t->original_priority;
+
+  if (!heap_empty (&t->held_locks))
+    {
+      struct lock *lock = heap_entry (heap_top (&t->held_locks),
+                                      struct lock, held_elem);
+      if (lock_donation (lock) > priority)
+        priority = lock_donation (lock);
+    }
+  set_priority (t, priority);
+}
+
+/* Returns T's priority under the 4.4BSD scheduler, from its
+   recent_cpu and nice values. */
+static int
+mlfqs_priority (const struct thread *t)
+{
+  fixed_point priority_fp = (FP_CONVT (PRI_MAX) - t->recent_cpu / 4
+                             - FP_CONVT (t->nice * 2));
+  int priority = FP_INT_PART (priority_fp);
+
+  if (priority < PRI_MIN)
+    return PRI_MIN;
+  if (priority > PRI_MAX)
+    return PRI_MAX;
+  return priority;
+}
+
+/* Applies to T the recent_cpu decays of the seconds since it was
+   last refreshed and recomputes its priority. */
+static void
+mlfqs_refresh (struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned missed = mlfqs_seconds - t->mlfqs_second;
+
+  if (missed > DECAY_HISTORY)
+    missed = DECAY_HISTORY;
+  for (; missed > 0; missed--)
+    {
+      fixed_point coef = decay_coefs[(mlfqs_seconds - missed + 1)
+                                     % DECAY_HISTORY];
+      t->recent_cpu = FP_ADD_MIX (FP_MULT (coef, t->recent_cpu), t->nice);
+    }
+  t->mlfqs_second = mlfqs_seconds;
 
-      // printf("check_priority %d\n", next_thread->priority);
+  if (t != idle_thread)
+    set_priority (t, mlfqs_priority (t));
+  intr_set_level (old_level);
+}
+
+/* Does the 4.4BSD scheduler's work for timer tick NOW, while T
+   is running, in time proportional to the number of threads over
+   TIMER_FREQ. */
+static void
+mlfqs_tick (struct thread *t, int64_t now)
+{
+  size_t batch;
+
+  ASSERT (intr_context ());
+
+  if (t != idle_thread)
+    t->recent_cpu = FP_ADD_MIX (t->recent_cpu, 1);
+
+  if (now % TIMER_FREQ == 0)
+    {
+      int ready = ready_cnt () + (t != idle_thread ? 1 : 0);
+      fixed_point twice_load;
+
+      load_avg = (59 * load_avg + FP_CONVT (ready)) / 60;
+      twice_load = 2 * load_avg;
+      mlfqs_seconds++;
+      decay_coefs[mlfqs_seconds % DECAY_HISTORY]
+        = FP_DIV (twice_load, FP_ADD_MIX (twice_load, 1));
+
+      /* T's ticks so far this second must be decayed now. */
+      mlfqs_refresh (t);
+    }
+  else if (now % 4 == 0)
+    mlfqs_refresh (t);
 
-    if (thread_current()->priority < next_thread->priority) {
+  for (batch = thread_cnt / TIMER_FREQ + 1; batch > 0; batch--)
+    {
+      if (sweep_elem == NULL || sweep_elem == list_end (&all_list))
+        sweep_elem = list_begin (&all_list);
+      mlfqs_refresh (list_entry (sweep_elem, struct thread, allelem));
+      sweep_elem = list_next (sweep_elem);
+    }
+
+  if (ready_preempts (t))
+    intr_yield_on_return ();
+}
+
+//  
+void check_priority(void) {
+  enum intr_level old_level = intr_disable ();
+  bool preempt = ready_preempts (thread_current ());
+  intr_set_level (old_level);
+
+  if (preempt) {
       // thread_yield();
       thread_yield__(thread_current());
-      // printf("check_priority %d\n", thread_current()->priority);
-    }
-      
   }
 }
 
 // static bool cmp_priority (const struct list_elem *a, const struct list_elem *b, void *aux);
-// static bool cmp_sleep_until (const struct list_elem *a, const struct list_elem *b, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -177,20 +612,35 @@ void check_priority(void) {
 void
 thread_init (void) 
 {
+  int i;
+
   // printf("thread_init begin\n");
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
-  list_init (&block_list);
+  for (i = 0; i < TID_BUCKETS; i++)
+    list_init (&tid_buckets[i]);
+  spinlock_init (&thread_cache_lock);
+  list_init (&runqueue.dl_queue);
+  for (i = 0; i <= PRI_MAX; i++)
+    {
+      heap_init (&runqueue.queues[i], cmp_vruntime, NULL);
+      runqueue.min_vruntime[i] = 0;
+    }
+  runqueue.mask = 0;
+  runqueue.cnt = 0;
+  runqueue.running = NULL;
   list_init (&all_list);
+  default_group.id = 0;
+  default_group.weight = SCHED_WEIGHT_DEFAULT;
+  default_group.ents = default_ents;
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&default_ents[i].threads);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   // init_thread (initial_thread, "main", PRI_MIN);
   initial_thread->status = THREAD_RUNNING;
-  initial_thread->tid = allocate_tid ();
   // printf("thread_init end\n");
 }
 
@@ -203,6 +653,8 @@ thread_start (void)
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
+  tunable_register (thread_tunables,
+                    sizeof thread_tunables / sizeof *thread_tunables);
 
   /* Start preemptive thread scheduling. */
   intr_enable ();
@@ -211,33 +663,18 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-//  
-void check_block_list(int64_t current_ticks) {
-  // check block_list and wake up unsleep threads
-  struct list_elem *e = list_begin(&block_list);
-  while (e != list_end(&block_list))
-  {
-    struct thread *t = list_entry(e, struct thread, elem);      
-    
-    if (current_ticks < t->sleep_until) break;
- 
-    list_remove(e);
-    thread_unblock(t);
-    e = list_begin(&block_list);
-    // printf("delete %s status %d from list ", t->name, t->status);
-    // print_list(&block_list);
-  }
-}
-
-
 /* Called by the timer interrupt handler at each timer tick.
    Thus, this function runs in an external interrupt context. */
 void
-thread_tick (int64_t current_ticks) 
+thread_tick (int64_t current_ticks, bool user) 
 {
   struct thread *t = thread_current ();
 
   /* Update statistics. */
+  if (user)
+    t->usage.user_ticks++;
+  else
+    t->usage.kernel_ticks++;
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
@@ -247,11 +684,49 @@ thread_tick (int64_t current_ticks)
   else
     kernel_ticks++;
 
+  /* Charged to its group when it is made ready again. */
+  if (t != idle_thread && !dl_active (t))
+    t->group_ticks++;
+
+  if (thread_mlfqs)
+    mlfqs_tick (t, current_ticks);
+
+  /* Charge a deadline thread's budget.  One that runs out makes
+     way for active deadline threads and higher priorities. */
+  if (dl_active (t) && --t->dl_budget == 0)
+    intr_yield_on_return ();
+
   /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  if (++thread_ticks >= time_slice)
     intr_yield_on_return ();
 
-  check_block_list(current_ticks);
+}
+
+/* Returns the bucket of a latency histogram that counts an
+   interval of CYCLES. */
+static size_t
+latency_bucket (uint64_t cycles)
+{
+  size_t bucket;
+
+  for (bucket = 0; bucket < SCHED_LATENCY_BUCKETS - 1
+                   && (cycles >> (bucket + 1)) != 0; bucket++)
+    continue;
+  return bucket;
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, as
+   "log2-cycles:count" pairs, on a line that starts with WHAT. */
+static void
+print_latency_hist (const char *what, const uint64_t *hist)
+{
+  size_t i;
+
+  printf ("Thread: %s latency, log2 cycles:", what);
+  for (i = 0; i < SCHED_LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %zu:%llu", i, hist[i]);
+  printf ("\n");
 }
 
 /* Prints thread statistics. */
@@ -260,6 +735,28 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  print_latency_hist ("wakeup", wakeup_hist);
+  print_latency_hist ("preemption", preempt_hist);
+  print_latency_hist ("switch", switch_hist);
+}
+
+/* Copies the scheduling latency histograms, and those of the
+   running thread, into *STATS. */
+void
+thread_get_sched_stats (struct sched_stats *stats)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  memcpy (stats->wakeup, wakeup_hist, sizeof stats->wakeup);
+  memcpy (stats->preempt, preempt_hist, sizeof stats->preempt);
+  memcpy (stats->switches, switch_hist, sizeof stats->switches);
+  for (i = 0; i < SCHED_LATENCY_BUCKETS; i++)
+    stats->thread_wakeup[i] = cur->wakeup_hist[i];
+  stats->irqoff_max = intr_irqoff_max ();
+  intr_set_level (old_level);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -294,13 +791,13 @@ thread_create (const char *name, int priority,
 
   // printf("create %d\n", priority);
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_alloc ();
   if (t == NULL)
     return TID_ERROR;
 
   /* Initialize thread. */
   init_thread (t, name, priority);
-  tid = t->tid = allocate_tid ();
+  tid = t->tid;
 
   /* Prepare thread for first run by initializing its stack.
      Do this atomically so intermediate values for the 'stack' 
@@ -330,12 +827,6 @@ thread_create (const char *name, int priority,
   //  
   // printf("check\n");
 
-  t->parent = thread_current();
-    //  
-  // printf("%s has child %s \n", thread_current()->name, name);
-  list_push_back(&thread_current()->children, &t->child_elem);
-  thread_current()->child_load_status = tid;
-
   // check_priority();
   
   return tid;
@@ -379,34 +870,43 @@ thread_unblock (struct thread *t)
   // printf("unblock %s status %d\n", t->name, t->status);
   ASSERT (t->status == THREAD_BLOCKED);
 
-  //list_push_back (&ready_list, &t->elem);
-  //  
-  list_insert_ordered(&ready_list, &t->elem, (list_less_func *)cmp_priority, NULL);
+  if (thread_mlfqs)
+    mlfqs_refresh (t);
+  ready_push (t);
 
   t->status = THREAD_READY;
+  t->wake_tsc = rdtsc ();
+  TRACE (TRACE_WAKEUP, t->tid, 0);
 
   intr_set_level (old_level);
 }
 
 
 
-//  
+/* Wakes up the thread sleeping on TO, preempting the running
+   thread if it has a lower priority. */
+static void
+sleep_expired (struct timeout *to)
+{
+  struct thread *t = to->aux;
+
+  thread_unblock (t);
+  if (intr_context () && thread_preempts (t, thread_current ()))
+    intr_yield_on_return ();
+}
+
+/* Sleeps until timer tick SLEEP_UNTIL. */
 void
 thread_sleep_until (int64_t sleep_until) 
 {
-  // printf("[begin]thread_sleep_until\n");
+  struct timeout to;
   enum intr_level old_level = intr_disable ();
 
-  struct thread *t = thread_current ();
-  t->sleep_until = sleep_until;
-  list_insert_ordered(&block_list, &t->elem, (list_less_func *)cmp_sleep_until, NULL);
-
-  // print_list(&block_list);
-  thread_block();
+  timeout_init (&to, sleep_expired, thread_current ());
+  timeout_set (&to, sleep_until);
+  thread_block ();
 
   intr_set_level (old_level);
-
-  // printf("[end]thread_sleep_until\n");
 }
 
 
@@ -453,17 +953,40 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  fpu_release ();
+  group_put (thread_current ()->group);
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  if (thread_current ()->dl_period != 0)
+    {
+      timeout_cancel (&thread_current ()->dl_release);
+      dl_bandwidth -= dl_thread_bandwidth (thread_current ());
+    }
+  if (sweep_elem == &thread_current ()->allelem)
+    sweep_elem = list_next (sweep_elem);
   list_remove (&thread_current()->allelem);
+  list_remove (&thread_current()->tidelem);
+  thread_cnt--;
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
 }
 
+/* Yields the CPU on the way out of an interrupt handler that
+   called intr_yield_on_return() when the time stamp counter read
+   REQUESTED, which is counted as the latency of the preemption. */
+void
+thread_preempt (uint64_t requested)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  preempt_tsc = requested;
+  thread_yield ();
+}
+
 /* Yields the CPU.  The current thread is not put to sleep and
    may be scheduled again immediately at the scheduler's whim. */
 void
@@ -476,8 +999,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered(&ready_list, &cur->elem, (list_less_func *)cmp_priority, NULL);
-    // list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -492,13 +1014,114 @@ thread_yield__ (struct thread *cur)
 
   old_level = intr_disable ();
   if (cur != idle_thread) 
-    list_insert_ordered(&ready_list, &cur->elem, (list_less_func *)cmp_priority, NULL);
-    // list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
 }
 
+/* A preemption point for long loops in the kernel: yields if a
+   thread of higher priority than the running thread is ready on
+   this CPU, for instance one made ready by a thread that did not
+   yield to it.  Does nothing in interrupt context or with
+   interrupts off, so it is safe to call anywhere, but it should
+   be called where no more locks are held than necessary. */
+void
+thread_preempt_point (void)
+{
+  bool yield;
+
+  if (intr_context () || intr_get_level () == INTR_OFF)
+    return;
+
+  intr_disable ();
+  yield = ready_preempts (thread_current ());
+  intr_enable ();
+  if (yield)
+    thread_yield ();
+}
+
+/* Puts the running thread in a new scheduling group of WEIGHT,
+   between SCHED_WEIGHT_MIN and SCHED_WEIGHT_MAX, which the
+   threads and processes it starts from now on inherit.  Returns
+   the group's identifier, or -1 if WEIGHT is out of range or
+   memory is short. */
+int
+thread_new_group (unsigned weight)
+{
+  struct thread *cur = thread_current ();
+  struct sched_group *g, *old;
+  enum intr_level old_level;
+  size_t i;
+
+  if (weight < SCHED_WEIGHT_MIN || weight > SCHED_WEIGHT_MAX)
+    return -1;
+  g = malloc (sizeof *g);
+  if (g == NULL)
+    return -1;
+  g->ents = malloc ((PRI_MAX + 1) * sizeof *g->ents);
+  if (g->ents == NULL)
+    {
+      free (g);
+      return -1;
+    }
+  for (i = 0; i <= PRI_MAX; i++)
+    {
+      list_init (&g->ents[i].threads);
+      g->ents[i].vruntime = 0;
+    }
+  g->weight = weight;
+  g->ref_cnt = 1;
+
+  /* The running thread is in no queue.  What it ran in its old
+     group since it was last charged goes uncharged. */
+  old_level = intr_disable ();
+  g->id = next_group_id++;
+  old = cur->group;
+  cur->group = g;
+  cur->group_ticks = 0;
+  intr_set_level (old_level);
+
+  group_put (old);
+  return g->id;
+}
+
+/* Drops a thread's reference to group G, which is freed once no
+   thread is in it. */
+static void
+group_put (struct sched_group *g)
+{
+  enum intr_level old_level = intr_disable ();
+  bool last = --g->ref_cnt == 0;
+  intr_set_level (old_level);
+
+  if (last && g != &default_group)
+    {
+      free (g->ents);
+      free (g);
+    }
+}
+
+/* Returns the thread with tid TID, or a null pointer if there is
+   none (any more).  This function must be called with interrupts
+   off, which keep the thread from going away meanwhile. */
+struct thread *
+thread_lookup (tid_t tid)
+{
+  struct list *bucket = &tid_buckets[tid % TID_BUCKETS];
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, tidelem);
+      if (t->tid == tid)
+        return t;
+    }
+  return NULL;
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -520,15 +1143,16 @@ thread_foreach (thread_action_func *func, void *aux)
 void
 thread_set_priority (int new_priority) 
 {
-  int old_priority = thread_current()->priority;
-  thread_current()->priority = new_priority;
-  thread_current()->original_priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
-  if (old_priority > new_priority) 
-  {
-    donation_release();
-    // check_priority();
-  }
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->original_priority = new_priority;
+  donation_refresh (cur);
+  intr_set_level (old_level);
 }
 
 /* Returns the current thread's priority. */
@@ -538,6 +1162,97 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
+/* Starts the next period of deadline thread T, for
+   thread_set_deadline(), and wakes T if it is waiting for it. */
+static void
+dl_release (struct timeout *to)
+{
+  struct thread *t = to->aux;
+  bool ready = t->status == THREAD_READY;
+
+  if (ready)
+    ready_remove (t);
+  t->dl_deadline += t->dl_period;
+  t->dl_budget = t->dl_runtime;
+  timeout_set (&t->dl_release, t->dl_deadline);
+  if (ready)
+    ready_push (t);
+
+  if (t->dl_waiting)
+    {
+      t->dl_waiting = false;
+      thread_unblock (t);
+    }
+}
+
+/* Puts the current thread in the deadline class, with RUNTIME
+   ticks of CPU reserved in every PERIOD ticks, starting now, or,
+   if RUNTIME and PERIOD are both 0, takes it out again.  Returns
+   false, changing nothing, if RUNTIME is not between 1 and
+   PERIOD or the reservation would take the deadline threads over
+   their share of the CPU. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int64_t bandwidth = dl_bandwidth;
+  bool yield;
+
+  if ((runtime != 0 || period != 0) && (runtime <= 0 || runtime > period))
+    return false;
+
+  old_level = intr_disable ();
+  if (cur->dl_period != 0)
+    bandwidth -= dl_thread_bandwidth (cur);
+  if (period != 0)
+    {
+      bandwidth += (runtime << DL_BW_SHIFT) / period;
+      if (bandwidth > DL_BW_MAX)
+        {
+          intr_set_level (old_level);
+          return false;
+        }
+    }
+  dl_bandwidth = bandwidth;
+
+  if (cur->dl_period != 0)
+    timeout_cancel (&cur->dl_release);
+  cur->dl_runtime = runtime;
+  cur->dl_period = period;
+  cur->dl_budget = runtime;
+  if (period != 0)
+    {
+      cur->dl_deadline = timer_ticks () + period;
+      timeout_init (&cur->dl_release, dl_release, cur);
+      timeout_set (&cur->dl_release, cur->dl_deadline);
+    }
+  yield = ready_preempts (cur);
+  intr_set_level (old_level);
+
+  if (yield)
+    thread_yield ();
+  return true;
+}
+
+/* Gives up the rest of the current deadline thread's budget and
+   waits for its next period to begin, as a periodic task does
+   at the end of each job. */
+void
+thread_wait_period (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (cur->dl_period != 0);
+
+  old_level = intr_disable ();
+  cur->dl_budget = 0;
+  cur->dl_waiting = true;
+  thread_block ();
+  intr_set_level (old_level);
+}
+
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
@@ -559,8 +1274,21 @@ idle (void *idle_started_ UNUSED)
     {
       /* Let someone else run. */
       intr_disable ();
+      timer_idle_exit ();
       thread_block ();
 
+      /* With nothing else to run, zero free pages ahead of
+         PAL_ZERO allocations, one page at a time, until a thread
+         becomes ready or there are enough zeroed pages. */
+      intr_enable ();
+      while (ready_cnt () == 0 && palloc_zero_idle ())
+        continue;
+      intr_disable ();
+      if (ready_cnt () > 0)
+        continue;
+
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -615,6 +1343,8 @@ static void
 init_thread (struct thread *t, const char *name, int priority)
 {
   // printf("init_thread begin\n");
+  enum intr_level old_level;
+
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
@@ -625,21 +1355,58 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
+  t->tid = allocate_tid ();
+  old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
+  list_push_back (&tid_buckets[t->tid % TID_BUCKETS], &t->tidelem);
+  thread_cnt++;
+  intr_set_level (old_level);
+
+  /* A new thread inherits its creator's nice, recent_cpu and
+     scheduling group. */
+  t->group = &default_group;
+  if (t != running_thread ())
+    {
+      struct thread *parent = running_thread ();
+      t->nice = parent->nice;
+      t->recent_cpu = parent->recent_cpu;
+      t->mlfqs_second = parent->mlfqs_second;
+      t->group = parent->group;
+    }
+  old_level = intr_disable ();
+  t->group->ref_cnt++;
+  intr_set_level (old_level);
+  if (thread_mlfqs)
+    t->priority = t->original_priority = mlfqs_priority (t);
 
   //  
   // Init donation 
   // t->is_donated = false;
   t->original_priority = priority;
+  t->rq = NULL;
+  t->wait_heap = NULL;
   t->locked_by = NULL;
-  list_init(&t->threads_locked);
-  list_init(&t->open_fd);
-  list_init(&t->children);
-  sema_init(&t->process_wait, 0);
+  heap_init (&t->held_locks, cmp_held_lock, NULL);
+#ifdef USERPROG
+  t->fd_table = NULL;
+  t->fd_map = NULL;
+  t->io_ring = NULL;
+  t->children = NULL;
+  t->child_status = NULL;
+  t->exit_status = -1;
+#endif
 
-// #ifdef VM
-//   list_init(&t->mmap_list);
-// #endif
+#ifdef VM
+  list_init(&t->mmap_list);
+  t->rss = 0;
+  t->heap_start = t->heap_break = t->heap_mapped = NULL;
+  t->process = t;
+  t->user_thread = NULL;
+  t->profil_buf = NULL;
+  lock_init (&t->process_lock);
+  list_init (&t->user_threads);
+  sema_init (&t->threads_exited, 0);
+#endif
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -663,10 +1430,21 @@ alloc_frame (struct thread *t, size_t size)
 static struct thread *
 next_thread_to_run (void) 
 {
-  if (list_empty (&ready_list))
+  struct runqueue *rq = &runqueue;
+  struct group_entity *e;
+  struct thread *t;
+  int priority;
+
+  priority = rq_max_priority (rq);
+  if (priority < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  t = rq_front (rq, priority);
+  e = group_entity (t->group, rq, priority);
+  if (e->vruntime > rq->min_vruntime[priority])
+    rq->min_vruntime[priority] = e->vruntime;
+  ready_remove (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -689,14 +1467,35 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  uint64_t now = rdtsc ();
   
   ASSERT (intr_get_level () == INTR_OFF);
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  runqueue.running = cur;
+
+  /* Account the switch, and the wait since our wakeup. */
+  if (switch_tsc != 0)
+    {
+      switch_hist[latency_bucket (now - switch_tsc)]++;
+      switch_tsc = 0;
+    }
+  if (cur->wake_tsc != 0)
+    {
+      size_t bucket = latency_bucket (now - cur->wake_tsc);
+      wakeup_hist[bucket]++;
+      cur->wakeup_hist[bucket]++;
+      cur->wake_tsc = 0;
+    }
 
   /* Start new time slice. */
   thread_ticks = 0;
+  if (thread_mlfqs)
+    mlfqs_refresh (cur);
+
+  /* Trap its first FPU instruction unless it owns the FPU. */
+  fpu_activate (cur);
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -711,10 +1510,47 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_free (prev);
     }
 }
 
+/* Returns a page for a new thread, from the cache if it has one,
+   or a null pointer if memory allocation fails. */
+static struct thread *
+thread_page_alloc (void)
+{
+  void *page;
+
+  spinlock_acquire (&thread_cache_lock);
+  page = thread_cache;
+  if (page != NULL)
+    {
+      thread_cache = *(void **) page;
+      thread_cache_cnt--;
+    }
+  spinlock_release (&thread_cache_lock);
+
+  return page != NULL ? page : palloc_get_page (0);
+}
+
+/* Frees the page of thread T, which is dead, into the cache if it
+   has room. */
+static void
+thread_page_free (struct thread *t)
+{
+  spinlock_acquire (&thread_cache_lock);
+  if (thread_cache_cnt < THREAD_CACHE_MAX)
+    {
+      *(void **) t = thread_cache;
+      thread_cache = t;
+      thread_cache_cnt++;
+      t = NULL;
+    }
+  spinlock_release (&thread_cache_lock);
+  if (t != NULL)
+    palloc_free_page (t);
+}
+
 /* Schedules a new process.  At entry, interrupts must be off and
    the running process's state must have been changed from
    running to some other state.  This function finds another
@@ -733,8 +1569,21 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (cur->status == THREAD_READY)
+    cur->usage.involuntary_switches++;
+  else
+    cur->usage.voluntary_switches++;
+  if (preempt_tsc != 0)
+    {
+      preempt_hist[latency_bucket (rdtsc () - preempt_tsc)]++;
+      preempt_tsc = 0;
+    }
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      TRACE (TRACE_SWITCH, cur->tid, next->tid);
+      switch_tsc = rdtsc ();
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -743,12 +1592,10 @@ static tid_t
 allocate_tid (void) 
 {
   static tid_t next_tid = 1;
-  tid_t tid;
-
-  lock_acquire (&tid_lock);
-  tid = next_tid++;
-  lock_release (&tid_lock);
+  tid_t tid = 1;
 
+  asm volatile ("lock xaddl %0, %1" : "+r" (tid), "+m" (next_tid)
+                : : "memory");
   return tid;
 }
 
@@ -756,143 +1603,139 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-//  
+/* Makes the current thread wait for LOCK, donating its priority
+   to LOCK's holder, and on along the chain of holders that are
+   themselves waiting for a lock, for as long as that raises
+   them. */
 void
-donation_acquire(void) 
+donation_acquire (struct lock *lock)
 {
-  // printf("donation_acquire\n");
-  int depth = DEPTH;
-  struct thread* cur = thread_current();
+  struct thread *cur = thread_current ();
+  int depth;
 
-  // printf("donation %d\n", thread_current()->name);
-  // if (cur->locked_by == NULL) {
-  //   printf("donation depth %d\n", depth);
-  // }
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  while (cur->locked_by != NULL && depth > 0) 
-  {
-    depth -= 1;
-    struct thread* pre = cur->locked_by->holder;
-    // printf("donation_acquire : %s %d\n", 
-    //     pre->name, pre->priority);
-
-    if (pre != NULL && pre->priority < cur->priority) {
-      pre->priority = cur->priority;
-
-      cur = pre;
-    } 
-    else 
-      return;
-  }
+  cur->locked_by = lock;
+  heap_push (&lock->donors, &cur->donate_elem);
+
+  for (depth = DEPTH; depth > 0; depth--)
+    {
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL)
+        return;
+      heap_increase (&holder->held_locks, &lock->held_elem);
+      if (holder->priority >= cur->priority)
+        return;
+      set_priority (holder, cur->priority);
+
+      lock = holder->locked_by;
+      if (lock == NULL)
+        return;
+      heap_increase (&lock->donors, &holder->donate_elem);
+    }
 }
 
-//  
-void 
-donation_release(void)
-{ 
-  // printf("release\n");
-  struct thread *cur = thread_current();
-  cur->priority = cur->original_priority;
+/* Makes the current thread the holder of LOCK, which it may have
+   been waiting for, taking on the donations of LOCK's other
+   waiters. */
+void
+donation_hold (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
 
-  if (!list_empty(&cur->threads_locked)) 
-  {
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cur->locked_by == lock)
+    {
+      heap_remove (&lock->donors, &cur->donate_elem);
+      cur->locked_by = NULL;
+    }
+  lock->holder = cur;
+  heap_push (&cur->held_locks, &lock->held_elem);
+  donation_refresh (cur);
+}
 
-    // print_list(&cur->threads_locked);
-    struct thread *next = list_entry(list_begin(&cur->threads_locked),
-      struct thread, donate_elem);
-    // struct thread *next = list_entry(list_begin(&cur->threads_locked),
-    //   struct thread, elem);
+/* Gives up the donations the current thread receives through
+   LOCK, which it is releasing. */
+void
+donation_release (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  heap_remove (&cur->held_locks, &lock->held_elem);
+  donation_refresh (cur);
+}
+
+/* Takes back the donation of the current thread, which waited
+   for LOCK and gave up.  The holder's priority drops accordingly;
+   a donation it passed on along a chain of locks wears off as
+   those are released. */
+void
+donation_cancel (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct thread *holder = lock->holder;
+
+  ASSERT (intr_get_level () == INTR_OFF);
 
-    if (next->priority > cur->priority) {
-      cur->priority = next->priority;
+  if (cur->locked_by != lock)
+    return;
+  heap_remove (&lock->donors, &cur->donate_elem);
+  cur->locked_by = NULL;
+  if (holder != NULL)
+    {
+      heap_remove (&holder->held_locks, &lock->held_elem);
+      heap_push (&holder->held_locks, &lock->held_elem);
+      donation_refresh (holder);
     }
+}
 
-  }
+/* Sets the current thread's nice value to NICE, and yields if
+   it no longer has the highest priority. */
+void
+thread_set_nice (int nice) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool yield;
+
+  ASSERT (nice >= NICE_MIN && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  mlfqs_refresh (cur);
+  yield = ready_preempts (cur);
+  intr_set_level (old_level);
+
+  if (yield)
+    thread_yield ();
 }
 
-// // add
-// /* Sets the current thread's nice value to NICE. */
-// void
-// thread_set_nice (int nice) 
-// {
-//   thread_current () -> nice = nice;
-//   thread_mlfqs_update_priority (thread_current ());
-//   thread_yield ();
-// }
-
-// /* Returns the current thread's nice value. */
-// int
-// thread_get_nice (void) 
-// {
-//   return thread_current () -> nice;
-// }
-
-// /* Returns 100 times the system load average. */
-// int
-// thread_get_load_avg (void) 
-// {
-//   return FP_ROUND (FP_MULT_MIX (load_avg, 100));
-// }
-
-// /* Returns 100 times the current thread's recent_cpu value. */
-// int
-// thread_get_recent_cpu (void) 
-// {
-//   return FP_ROUND (FP_MULT_MIX (thread_current () -> recent_cpu, 100));
-// }
-
-// // add
-// /* Increase recent_cpu value by 1. */
-// void
-// thread_mlfqs_increase_recent_cpu (void)
-// {
-//   ASSERT (thread_mlfqs);
-//   ASSERT (intr_context ());
-
-//   struct thread *current_thread = thread_current ();
-//   if (current_thread == idle_thread)
-//     return;
-//   current_thread->recent_cpu = FP_ADD_MIX (current_thread->recent_cpu, 1);
-// }
-
-// // add
-// /* Update load_avg and recent_cpu value for all threads. */
-// void
-// thread_mlfqs_update_load_avg_and_recent_cpu (void)
-// {
-//   ASSERT (thread_mlfqs);
-//   ASSERT (intr_context ());
-
-//   size_t ready_threads = list_size (&ready_list);
-//   if (thread_current () != idle_thread)
-//     ready_threads++;
-//   load_avg = FP_ADD (FP_DIV_MIX (FP_MULT_MIX (load_avg, 59), 60), FP_DIV_MIX (FP_CONVT (ready_threads), 60));
-
-//   struct thread *t;
-//   struct list_elem *e = list_begin (&all_list);
-//   for (; e != list_end (&all_list); e = list_next (e))
-//   {
-//     t = list_entry(e, struct thread, allelem);
-//     if (t != idle_thread)
-//     {
-//       t->recent_cpu = FP_ADD_MIX (FP_MULT (FP_DIV (FP_MULT_MIX (load_avg, 2), FP_ADD_MIX (FP_MULT_MIX (load_avg, 2), 1)), t->recent_cpu), t->nice);
-//       thread_mlfqs_update_priority (t);
-//     }
-//   }
-// }
-
-// // add
-// /* Update priority. */
-// void
-// thread_mlfqs_update_priority (struct thread *t)
-// {
-//   if (t == idle_thread)
-//     return;
-
-//   ASSERT (thread_mlfqs);
-//   ASSERT (t != idle_thread);
-
-//   t->priority = FP_INT_PART (FP_SUB_MIX (FP_SUB (FP_CONVT (PRI_MAX), FP_DIV_MIX (t->recent_cpu, 4)), 2 * t->nice));
-//   t->priority = t->priority < PRI_MIN ? PRI_MIN : t->priority;
-//   t->priority = t->priority > PRI_MAX ? PRI_MAX : t->priority;
-// }
\ No newline at end of file
+/* Returns the current thread's nice value. */
+int
+thread_get_nice (void) 
+{
+  return thread_current ()->nice;
+}
+
+/* Returns 100 times the system load average. */
+int
+thread_get_load_avg (void) 
+{
+  return FP_ROUND (FP_MULT_MIX (load_avg, 100));
+}
+
+/* Returns 100 times the current thread's recent_cpu value. */
+int
+thread_get_recent_cpu (void) 
+{
+  struct thread *cur = thread_current ();
+  fixed_point recent_cpu;
+
+  mlfqs_refresh (cur);
+  recent_cpu = FP_MULT_MIX (cur->recent_cpu, 100);
+  return FP_ROUND (recent_cpu);
+}
\ No newline at end of file
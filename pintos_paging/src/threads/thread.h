@@ -8,6 +8,8 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#include <syscall-nr.h>
+#include "devices/timer.h"
 
 #ifdef VM
 #include "vm/page.h"
@@ -33,6 +35,11 @@ typedef int tid_t;
 #define PRI_MAX 63                      /* Highest priority. */
 // #define PRI_MAX 630
 
+/* Thread niceness, for the 4.4BSD scheduler. */
+#define NICE_MIN -20                    /* Least nice. */
+#define NICE_DEFAULT 0                  /* Default. */
+#define NICE_MAX 20                     /* Nicest. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -59,7 +66,7 @@ typedef int tid_t;
              |              magic              |
              |                :                |
              |                :                |
-             |               name              |
+             |              stack              |
              |              status             |
         0 kB +---------------------------------+
 
@@ -82,59 +89,127 @@ typedef int tid_t;
    an assertion failure in thread_current(), which checks that
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
-   value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+   value, triggering the assertion.
+
+   The members that the scheduler reads or writes on every timer
+   tick and context switch come first, so that they share the
+   page's first 64-byte cache line; the rest are grouped by owner
+   and come after them, with the rarely used statistics last. */
+/* The `elem' member is an element in a ready queue (thread.c).
+   A thread blocked on a semaphore or condition variable is
+   instead in that object's `waiters' heap (synch.c) through
+   `wait_elem', which `wait_heap' points back to so that a change
+   of priority can reorder it. */
 struct thread
   {
-    /* Owned by thread.c. */
-    tid_t tid;                          /* Thread identifier. */
+    /* Hot: used by thread_tick(), schedule() and
+       thread_schedule_tail(), in the first cache line. */
     enum thread_status status;          /* Thread state. */
-    char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    struct list_elem elem;              /* List element. */
+    struct runqueue *rq;                /* Run queue it is or was last on. */
+    struct sched_group *group;          /* Scheduling group. */
+    int64_t group_ticks;                /* Ticks run, not yet charged. */
+    int64_t dl_period;                  /* Deadline: ticks per period, or 0. */
+    int64_t dl_budget;                  /* Deadline: ticks left in period. */
+    uint8_t *fpu_state;                 /* Saved FPU registers, or null
+                                           (threads/fpu.c). */
+    uint32_t *pagedir;                  /* Page directory
+                                           (userprog/process.c). */
+
+    /* Owned by thread.c. */
+    tid_t tid;                          /* Thread identifier. */
+    uint64_t wake_tsc;                  /* rdtsc() when unblocked, or 0. */
+    char name[16];                      /* Name (for debugging purposes). */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct list_elem tidelem;           /* List element in a tid hash bucket. */
 
     /* Shared between thread.c and synch.c. */
-    struct list_elem elem;              /* List element. */
+    struct heap_elem wait_elem;         /* In a `waiters' heap. */
+    struct heap *wait_heap;             /* Heap holding wait_elem, or null. */
 
-    // 
-    int64_t sleep_until;                /* End timestamp of sleep*/
-    int original_priority;   
-    struct lock *locked_by;
-    struct list threads_locked;
-    struct list_elem donate_elem;
+    /* Priority donation. */
+    int original_priority;              /* Priority before donations. */
+    struct lock *locked_by;             /* Lock being waited for. */
+    struct heap held_locks;             /* Locks held, by best donor. */
+    struct heap_elem donate_elem;       /* In locked_by's `donors'. */
 
-    /* Owned by userprog/process.c. */
-    uint32_t *pagedir;                  /* Page directory. */
+    /* 4.4BSD scheduler. */
+    int nice;                           /* Niceness. */
+    fixed_point recent_cpu;             /* Recent CPU time, decayed. */
+    unsigned mlfqs_second;              /* Seconds decayed in recent_cpu. */
+
+    /* Deadline scheduling, if dl_period is nonzero (see thread.c);
+       dl_period and dl_budget are with the hot members. */
+    int64_t dl_runtime;                 /* Ticks of CPU per period. */
+    int64_t dl_deadline;                /* End of the current period. */
+    bool dl_waiting;                    /* In thread_wait_period()? */
+    struct timeout dl_release;          /* Starts the next period. */
+
+    /* Resource usage, charged as it is incurred. */
+    struct rusage usage;                /* This thread's counters. */
+
+    /* Scheduling latency (see thread_schedule_tail()). */
+    uint32_t wakeup_hist[SCHED_LATENCY_BUCKETS]; /* Its wakeup latencies. */
 
 #ifdef USERPROG
 
     // -- proj2
-    struct thread *parent;              /* Which thread creates this one. */
+    struct hash *children;              /* Child processes' struct
+                                           child_status, by tid, or null
+                                           (userprog/process.c). */
+    struct child_status *child_status;  /* Own, shared with the parent. */
+    int exit_status;                    /* As passed to exit(). */
     
-    struct list children;               /* Threads that this one creates. */
-    struct list_elem child_elem;        /* List element for list children. */
-    int child_load_status;              /* Load status of its child*/
-    int child_exit_status;              /* Exit status of its child*/ 
-    
-    struct list open_fd;                /* Fds the thread opens*/
+    struct file **fd_table;             /* Open files, indexed by fd - 2. */
+    struct bitmap *fd_map;              /* Fds in use in fd_table. */
     struct file *file;                  /* Executable file of this thread. */
-    
-    struct semaphore process_wait;      /* Determine whether thread should wait. */
+    struct file *runtime_file;          /* Shared runtime mapped, or null
+                                           (userprog/process.c). */
+
     uint8_t *current_esp;               /* The current value of the user program’s stack pointer.
                                         A page fault might occur in the kernel, so we might
                                         need to store esp on transition to kernel mode. (4.3.3) */
+    struct io_ring *io_ring;            /* I/O ring in user memory, or null. */
+    uint32_t io_ring_entries;           /* Its entries, as registered. */
 
 #endif
+#ifdef FILESYS
+    int journal_depth;                  /* Depth of journal handles
+                                           (filesys/journal.c). */
+#endif
 #ifdef VM
     // Project 3: Supplemental page table.
     struct supplemental_page_table *supt;   /* Supplemental Page Table. */
-   //  struct list mmap_list;             
+    struct list mmap_list;              /* Memory-mapped files (struct mmap_desc). */
+    size_t rss;                         /* Resident set: frames owned (vm/frame.c). */
+    size_t wss;                         /* Main: working set, as estimated ... */
+    uint32_t idle_hist[WSS_BUCKETS];    /* Main: ... and frames by idle age (vm/frame.c). */
+    uint8_t *heap_start;                /* Start of the heap, past the executable. */
+    uint8_t *heap_break;                /* End of the heap, as set by sbrk(). */
+    uint8_t *heap_mapped;               /* End of the heap pages in supt. */
+
+    /* Threads of a process (userprog/process.c).  The process's
+       address space, files and heap belong to its main thread;
+       the members marked "main" are only used in that one. */
+    struct thread *process;             /* Main thread of its process. */
+    struct user_thread *user_thread;    /* Own status, if not main. */
+    struct lock process_lock;           /* Main: guards fds and threads. */
+    struct list user_threads;           /* Main: others' statuses. */
+    size_t live_threads;                /* Main: others not yet exited. */
+    struct semaphore threads_exited;    /* Main: upped as each exits. */
+    uint32_t stack_slots;               /* Main: thread stacks in use. */
+    bool exiting;                       /* Main: exit() has been called. */
+    unsigned blocked_cnt;               /* Main: threads in waits that exiting
+                                           does not end (process_block()). */
+    struct rusage exited_usage;         /* Main: others' usage, once exited. */
+    uint8_t *profil_buf;                /* Main: profil() counters, or null. */
+    size_t profil_size;                 /* Main: their size in bytes. */
+    uintptr_t profil_offset;            /* Main: lowest address profiled. */
+    unsigned profil_scale;              /* Main: 16.16 counters per 2 bytes. */
+    struct file *ckpt_file;             /* Main: checkpoint restored from,
+                                           or null (vm/checkpoint.c). */
 #endif
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
@@ -147,14 +222,15 @@ extern bool thread_mlfqs;
 
 // 
 bool cmp_priority (const struct list_elem *a, const struct list_elem *b, void *aux);
-bool cmp_donate (const struct list_elem *a, const struct list_elem *b, void *aux);
+bool cmp_donate (const struct heap_elem *a, const struct heap_elem *b, void *aux);
 void check_priority(void);
 
 void thread_init (void);
 void thread_start (void);
 
-void thread_tick (int64_t current_ticks);
+void thread_tick (int64_t current_ticks, bool user);
 void thread_print_stats (void);
+void thread_get_sched_stats (struct sched_stats *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -171,23 +247,31 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (uint64_t requested);
 void thread_yield__ (struct thread*);
+void thread_preempt_point (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
 void thread_foreach (thread_action_func *, void *);
+struct thread *thread_lookup (tid_t);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
-
-// int thread_get_nice (void);
-// void thread_set_nice (int);
-// int thread_get_recent_cpu (void);
-// int thread_get_load_avg (void);
-
-// 
-void donation_acquire(void);
-void donation_release(void);
+bool thread_set_deadline (int64_t runtime, int64_t period);
+void thread_wait_period (void);
+int thread_new_group (unsigned weight);
+
+int thread_get_nice (void);
+void thread_set_nice (int);
+int thread_get_recent_cpu (void);
+int thread_get_load_avg (void);
+
+/* Priority donation, with interrupts off. */
+void donation_acquire (struct lock *);
+void donation_hold (struct lock *);
+void donation_release (struct lock *);
+void donation_cancel (struct lock *);
 
 
 #endif /* threads/thread.h */
@@ -0,0 +1,113 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* A traced event. */
+struct trace_entry
+  {
+    uint64_t tsc;               /* Time stamp counter. */
+    uint32_t event;             /* A TRACE_* value. */
+    tid_t tid;                  /* Running thread. */
+    uint32_t a, b;              /* Arguments, as for EVENT. */
+  };
+
+size_t trace_pages;
+bool trace_enabled;
+
+static struct trace_entry *ring; /* The buffer. */
+static uint32_t ring_cnt;       /* Entries it holds. */
+static uint32_t ring_head;      /* Entries ever claimed. */
+
+/* Names of events, as printed. */
+static const char *event_names[TRACE_EVENT_CNT] =
+  {
+    [TRACE_FAULT] = "fault",
+    [TRACE_FAULT_DONE] = "fault-done",
+    [TRACE_EVICT] = "evict",
+    [TRACE_SWAP_OUT] = "swap-out",
+    [TRACE_SWAP_OUT_DONE] = "swap-out-done",
+    [TRACE_SWAP_IN] = "swap-in",
+    [TRACE_SWAP_IN_DONE] = "swap-in-done",
+    [TRACE_SWITCH] = "switch",
+    [TRACE_WAKEUP] = "wakeup",
+    [TRACE_BLOCK_SUBMIT] = "block-submit",
+    [TRACE_BLOCK_DONE] = "block-done",
+    [TRACE_REF_FAULT] = "ref-fault",
+    [TRACE_REF_SAMPLE] = "ref-sample",
+  };
+
+/* Allocates the trace buffer and starts tracing, if asked for. */
+void
+trace_init (void)
+{
+  if (trace_pages == 0)
+    return;
+
+  ring = palloc_get_multiple (0, trace_pages);
+  if (ring == NULL)
+    {
+      printf ("trace: no memory for %zu pages of events\n", trace_pages);
+      return;
+    }
+  ring_cnt = trace_pages * PGSIZE / sizeof *ring;
+  trace_enabled = true;
+}
+
+/* Records EVENT with arguments A and B.  Use TRACE() instead,
+   which skips the call when tracing is off. */
+void
+trace_record (enum trace_event event, uint32_t a, uint32_t b)
+{
+  uint32_t idx = 1;
+  struct trace_entry *e;
+  struct thread *t;
+  uint32_t *esp;
+
+  /* Claim a slot. */
+  asm volatile ("lock xaddl %0, %1" : "+r" (idx), "+m" (ring_head)
+                : : "memory");
+  e = &ring[idx % ring_cnt];
+
+  /* Find the running thread as running_thread() does: the
+     thread's own checks do not hold everywhere we trace, such as
+     halfway through schedule(). */
+  asm ("mov %%esp, %0" : "=g" (esp));
+  t = pg_round_down (esp);
+
+  e->tsc = rdtsc ();
+  e->event = event;
+  e->tid = t->tid;
+  e->a = a;
+  e->b = b;
+}
+
+/* Stops tracing and prints the events in the buffer, oldest
+   first, one per "Trace:" line. */
+void
+trace_print_stats (void)
+{
+  uint32_t first, i;
+
+  if (!trace_enabled)
+    return;
+  trace_enabled = false;
+  barrier ();
+
+  first = ring_head > ring_cnt ? ring_head - ring_cnt : 0;
+  printf ("Trace: %"PRIu32" events, %"PRIu32" kept\n",
+          ring_head, ring_head - first);
+  for (i = first; i != ring_head; i++)
+    {
+      const struct trace_entry *e = &ring[i % ring_cnt];
+      const char *name = e->event < TRACE_EVENT_CNT ? event_names[e->event]
+                                                    : "?";
+      printf ("Trace: %"PRIu64" %d %s %#"PRIx32" %#"PRIx32"\n",
+              e->tsc, e->tid, name, e->a, e->b);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Static tracepoints.
+
+   With the -trace=PAGES option, each TRACE() below stamps an
+   event with the time stamp counter and the running thread into
+   a ring buffer of PAGES pages, overwriting the oldest events
+   once it is full.  Slots are claimed with an atomic increment,
+   so tracepoints take no lock and may be hit in interrupt
+   handlers.  The buffer is printed at shutdown, for
+   utils/trace-latency to turn into latencies and timelines, and
+   the page references (TRACE_REF_*) for utils/evict-sim to replay
+   against eviction policies.
+   With tracing off, a tracepoint costs a load and a branch. */
+
+/* Traced events, with the meaning of their two arguments. */
+enum trace_event
+  {
+    TRACE_FAULT,                /* Page fault: address, write? */
+    TRACE_FAULT_DONE,           /* Handled: address, loaded? */
+    TRACE_EVICT,                /* Frame chosen to evict: upage, owner. */
+    TRACE_SWAP_OUT,             /* Writing pages to swap: count. */
+    TRACE_SWAP_OUT_DONE,        /* Written: first slot, count. */
+    TRACE_SWAP_IN,              /* Reading a page from swap: slot. */
+    TRACE_SWAP_IN_DONE,         /* Read: slot. */
+    TRACE_SWITCH,               /* Context switch: from tid, to tid. */
+    TRACE_WAKEUP,               /* Thread unblocked: tid. */
+    TRACE_BLOCK_SUBMIT,         /* Block request queued: request, sector. */
+    TRACE_BLOCK_DONE,           /* Carried out: request, sector. */
+    TRACE_REF_FAULT,            /* User page faulted on: upage, process. */
+    TRACE_REF_SAMPLE,           /* Accessed bit found set: upage, process. */
+    TRACE_EVENT_CNT
+  };
+
+/* Pages of trace buffer, or 0 if not tracing. */
+extern size_t trace_pages;
+
+/* True once the trace buffer is allocated. */
+extern bool trace_enabled;
+
+#define TRACE(EVENT, A, B)                                              \
+        do                                                              \
+          {                                                             \
+            if (trace_enabled)                                          \
+              trace_record (EVENT, (uint32_t) (A), (uint32_t) (B));     \
+          }                                                             \
+        while (0)
+
+void trace_init (void);
+void trace_record (enum trace_event, uint32_t a, uint32_t b);
+void trace_print_stats (void);
+
+#endif /* threads/trace.h */
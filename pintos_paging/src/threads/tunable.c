@@ -0,0 +1,112 @@
+#include "threads/tunable.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/synch.h"
+
+/* All tunables, in the order registered.  TUNABLE_LOCK serializes
+   setting them, so that `changed' functions run one at a time. */
+static struct list tunables;
+static struct lock tunable_lock;
+
+static int64_t get (const struct tunable *);
+
+/* Initializes the list of tunables. */
+void
+tunable_init (void)
+{
+  list_init (&tunables);
+  lock_init_named (&tunable_lock, "tunables");
+}
+
+/* Adds the CNT tunables in T, whose members but `elem' must be
+   set, for example with TUNABLE. */
+void
+tunable_register (struct tunable *t, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&tunable_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (t[i].size == sizeof (bool) || t[i].size == sizeof (int32_t)
+              || t[i].size == sizeof (int64_t));
+      ASSERT (t[i].size != sizeof (int32_t)
+              || (t[i].min >= INT32_MIN && t[i].max <= INT32_MAX));
+      ASSERT (t[i].min <= t[i].max);
+      ASSERT (strlen (t[i].name) < sizeof ((struct tunable_info *) 0)->name);
+      list_push_back (&tunables, &t[i].elem);
+    }
+  lock_release (&tunable_lock);
+}
+
+/* Fills in INFO with the IDX'th tunable.  Returns false if there
+   is no such tunable. */
+bool
+tunable_get_info (size_t idx, struct tunable_info *info)
+{
+  struct list_elem *e;
+  bool found = false;
+
+  lock_acquire (&tunable_lock);
+  for (e = list_begin (&tunables); e != list_end (&tunables);
+       e = list_next (e))
+    if (idx-- == 0)
+      {
+        struct tunable *t = list_entry (e, struct tunable, elem);
+        strlcpy (info->name, t->name, sizeof info->name);
+        info->value = get (t);
+        info->min = t->min;
+        info->max = t->max;
+        found = true;
+        break;
+      }
+  lock_release (&tunable_lock);
+  return found;
+}
+
+/* Sets the tunable named NAME to VALUE.  Returns false, changing
+   nothing, if there is no such tunable or VALUE is out of its
+   bounds. */
+bool
+tunable_set_value (const char *name, int64_t value)
+{
+  struct list_elem *e;
+  bool done = false;
+
+  lock_acquire (&tunable_lock);
+  for (e = list_begin (&tunables); e != list_end (&tunables);
+       e = list_next (e))
+    {
+      struct tunable *t = list_entry (e, struct tunable, elem);
+      if (strcmp (t->name, name))
+        continue;
+
+      if (value >= t->min && value <= t->max)
+        {
+          if (t->size == sizeof (bool))
+            *(volatile bool *) t->var = value != 0;
+          else if (t->size == sizeof (int32_t))
+            *(volatile int32_t *) t->var = value;
+          else
+            *(volatile int64_t *) t->var = value;
+          if (t->changed != NULL)
+            t->changed ();
+          done = true;
+        }
+      break;
+    }
+  lock_release (&tunable_lock);
+  return done;
+}
+
+/* Returns the value of T. */
+static int64_t
+get (const struct tunable *t)
+{
+  if (t->size == sizeof (bool))
+    return *(volatile bool *) t->var;
+  else if (t->size == sizeof (int32_t))
+    return *(volatile int32_t *) t->var;
+  else
+    return *(volatile int64_t *) t->var;
+}
@@ -0,0 +1,43 @@
+#ifndef THREADS_TUNABLE_H
+#define THREADS_TUNABLE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <syscall-nr.h>
+
+/* Tunables.
+
+   A subsystem that has a knob worth turning on a running system,
+   such as a window size or an interval, registers it as a tunable:
+   a named integer variable, with the bounds of the values it may
+   take.  User programs can then read and set it by name with the
+   tunable_get() and tunable_set() system calls, without a rebuild
+   or a reboot.
+
+   The variable is set with a plain store, so its users must take
+   it as it is each time they need it, and cope with it changing in
+   between.  One that must act on a change, say to start a thread,
+   gives a `changed' function. */
+
+struct tunable
+  {
+    const char *name;           /* E.g. "vm.fault_around". */
+    void *var;                  /* The variable: a bool, or an integer... */
+    size_t size;                /* ...of 4 or 8 bytes. */
+    int64_t min, max;           /* Bounds of its values. */
+    void (*changed) (void);     /* Called after it is set, or null. */
+    struct list_elem elem;      /* In the list of all tunables. */
+  };
+
+/* Initializer of a struct tunable for variable VAR. */
+#define TUNABLE(NAME, VAR, MIN, MAX, CHANGED) \
+  { NAME, &(VAR), sizeof (VAR), MIN, MAX, CHANGED, { NULL, NULL } }
+
+void tunable_init (void);
+void tunable_register (struct tunable *, size_t cnt);
+bool tunable_get_info (size_t idx, struct tunable_info *);
+bool tunable_set_value (const char *name, int64_t value);
+
+#endif /* threads/tunable.h */
@@ -40,6 +40,28 @@ static inline void *pg_round_down (const void *va) {
   return (void *) ((uintptr_t) va & ~PGMASK);
 }
 
+/* Fills page PAGE with zeros. */
+static inline void
+page_zero (void *page)
+{
+  size_t cnt = PGSIZE / 4;
+
+  ASSERT (pg_ofs (page) == 0);
+  asm volatile ("rep stosl"
+                : "+D" (page), "+c" (cnt) : "a" (0) : "memory");
+}
+
+/* Copies page SRC to page DST. */
+static inline void
+page_copy (void *dst, const void *src)
+{
+  size_t cnt = PGSIZE / 4;
+
+  ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+  asm volatile ("rep movsl"
+                : "+D" (dst), "+S" (src), "+c" (cnt) : : "memory");
+}
+
 /* Base address of the 1:1 physical-to-virtual mapping.  Physical
    memory is mapped starting at this virtual address.  Thus,
    physical address 0 is accessible at PHYS_BASE, physical
@@ -0,0 +1,183 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* The queue's members are protected by turning interrupts off,
+   since interrupt handlers queue work too; workers sleep on
+   ITEMS, and bounded queueing on SPACE. */
+
+static thread_func worker_thread;
+static void delay_expired (struct timeout *);
+static void take (struct workqueue *, struct work *);
+
+/* Initializes WQ, named NAME, and starts WORKER_CNT worker
+   threads at PRIORITY for it.  If MAX_CNT is nonzero, at most
+   MAX_CNT items are queued at once.  Returns false if not even
+   one worker could be started. */
+bool
+workqueue_init (struct workqueue *wq, const char *name, int priority,
+                size_t worker_cnt, size_t max_cnt)
+{
+  size_t started = 0;
+  size_t i;
+
+  ASSERT (wq != NULL);
+  ASSERT (worker_cnt > 0);
+
+  wq->name = name;
+  list_init (&wq->pending);
+  wq->cnt = 0;
+  wq->max_cnt = max_cnt;
+  sema_init (&wq->items, 0);
+  sema_init (&wq->space, 0);
+  wq->space_waiters = 0;
+
+  for (i = 0; i < worker_cnt; i++)
+    if (thread_create (name, priority, worker_thread, wq) != TID_ERROR)
+      started++;
+  return started > 0;
+}
+
+/* Initializes W to call FUNC, which may use AUX, when it runs. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+  w->wq = NULL;
+  timeout_init (&w->timeout, delay_expired, w);
+}
+
+/* Queues W on WQ, to be run by one of WQ's workers.  If WQ is
+   bounded and full, waits for room, unless called from an
+   interrupt handler.  Returns false, doing nothing, if W was
+   already queued and has not started running yet.
+
+   W may be queued again from its own function, or while it is
+   running, to run once more. */
+bool
+work_queue (struct workqueue *wq, struct work *w)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (w->pending)
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+
+  while (wq->max_cnt > 0 && wq->cnt >= wq->max_cnt && !intr_context ())
+    {
+      wq->space_waiters++;
+      sema_down (&wq->space);
+      if (w->pending)
+        {
+          intr_set_level (old_level);
+          return false;
+        }
+    }
+
+  list_push_back (&wq->pending, &w->elem);
+  wq->cnt++;
+  w->pending = true;
+  w->wq = wq;
+  sema_up (&wq->items);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Queues W on WQ after TICKS timer ticks.  If W is already
+   delayed, its delay is restarted. */
+void
+work_queue_delayed (struct workqueue *wq, struct work *w, int64_t ticks)
+{
+  if (ticks <= 0)
+    {
+      work_queue (wq, w);
+      return;
+    }
+
+  w->wq = wq;
+  timeout_set (&w->timeout, timer_ticks () + ticks);
+}
+
+/* Called from the timer interrupt when a delay expires. */
+static void
+delay_expired (struct timeout *to)
+{
+  struct work *w = to->aux;
+
+  work_queue (w->wq, w);
+}
+
+/* Keeps W from running, if it is delayed or queued and not yet
+   started.  Returns true if it was.  If W's function is already
+   running, it is not waited for. */
+bool
+work_cancel (struct work *w)
+{
+  enum intr_level old_level = intr_disable ();
+  bool canceled = timeout_cancel (&w->timeout);
+
+  if (w->pending)
+    {
+      /* A worker may already have downed ITEMS for W, and will
+         then find the queue short of an item. */
+      take (w->wq, w);
+      sema_try_down (&w->wq->items);
+      canceled = true;
+    }
+  intr_set_level (old_level);
+  return canceled;
+}
+
+/* Removes W, which is pending, from WQ, letting in a thread that
+   waits for room.  Interrupts must be off. */
+static void
+take (struct workqueue *wq, struct work *w)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (w->pending);
+
+  list_remove (&w->elem);
+  w->pending = false;
+  wq->cnt--;
+  if (wq->space_waiters > 0)
+    {
+      wq->space_waiters--;
+      sema_up (&wq->space);
+    }
+}
+
+/* A worker: runs the items of the work queue WQ_ as they come. */
+static void
+worker_thread (void *wq_)
+{
+  struct workqueue *wq = wq_;
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      sema_down (&wq->items);
+
+      old_level = intr_disable ();
+      if (list_empty (&wq->pending))
+        {
+          /* Canceled meanwhile. */
+          intr_set_level (old_level);
+          continue;
+        }
+      w = list_entry (list_front (&wq->pending), struct work, elem);
+      take (wq, w);
+      intr_set_level (old_level);
+
+      w->func (w);
+    }
+}
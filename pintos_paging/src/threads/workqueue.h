@@ -0,0 +1,59 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+
+/* Work queues.
+
+   A work queue runs work items, functions to be called later,
+   in a pool of worker threads that it creates at the priority
+   it was given, so that a subsystem can hand off work that need
+   not, or cannot, be done by the thread or interrupt handler
+   that comes across it.  Items run in the order queued, and as
+   many at once as there are workers.
+
+   A queue may be bounded: then a thread queueing an item waits
+   while the queue is full.  Interrupt handlers do not wait, and
+   may take the queue over its bound. */
+
+struct work;
+typedef void work_func (struct work *);
+
+/* A work item.  Owned by its user, which must keep it alive
+   while it is queued or delayed. */
+struct work
+  {
+    struct list_elem elem;      /* In the work queue's `pending'. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* For FUNC's use. */
+    bool pending;               /* Queued, and not yet taken? */
+    struct workqueue *wq;       /* Target of work_queue_delayed(). */
+    struct timeout timeout;     /* Delay of work_queue_delayed(). */
+  };
+
+/* A work queue. */
+struct workqueue
+  {
+    const char *name;           /* For the worker threads. */
+    struct list pending;        /* Queued items, oldest first. */
+    size_t cnt;                 /* Number of queued items. */
+    size_t max_cnt;             /* Bound on CNT, or 0 for none. */
+    struct semaphore items;     /* Upped for each queued item. */
+    struct semaphore space;     /* Upped when a full queue has room. */
+    unsigned space_waiters;     /* Threads waiting on SPACE. */
+  };
+
+bool workqueue_init (struct workqueue *, const char *name, int priority,
+                     size_t worker_cnt, size_t max_cnt);
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct workqueue *, struct work *);
+void work_queue_delayed (struct workqueue *, struct work *, int64_t ticks);
+bool work_cancel (struct work *);
+
+#endif /* threads/workqueue.h */
@@ -2,22 +2,24 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
 #ifdef VM
 #include "vm/page.h"
 #include "vm/frame.h"
 #endif
 
-#define MAX_STACK_SIZE 0x80000
-
 /* Number of page faults processed. */
 static long long page_fault_cnt = 0;
 
 static void kill (struct intr_frame *);
+static void fpu_unavailable (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
@@ -54,7 +56,7 @@ exception_init (void)
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
+  intr_register_int (7, 0, INTR_ON, fpu_unavailable,
                      "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
@@ -117,6 +119,16 @@ kill (struct intr_frame *f)
     }
 }
 
+/* #NM handler: a user thread used the FPU while CR0.TS was set,
+   so load its FPU state (see threads/fpu.c).  The kernel never
+   uses the FPU, so anything else is a bug. */
+static void
+fpu_unavailable (struct intr_frame *f)
+{
+  if (f->cs != SEL_UCSEG || !fpu_trap ())
+    kill (f);
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -152,6 +164,7 @@ page_fault (struct intr_frame *f)
 
   /* Count page faults. */
   page_fault_cnt++;
+  TRACE (TRACE_FAULT, fault_addr, (f->error_code & PF_W) != 0);
 
   /* Determine cause. */
   not_present = (f->error_code & PF_P) == 0;
@@ -163,6 +176,16 @@ page_fault (struct intr_frame *f)
   //         not_present ? "not present" : "rights violation",
   //         write ? "writing" : "reading",
   //         user ? "user" : "kernel");
+#ifdef VM
+  /* A write to a page mapped to the shared zero page, or to a merged
+     frame -- merged by contents, or shared by fork() -- is not a
+     violation: the page gets a frame of its own (see vm/page.c). */
+  if (!not_present && write && is_user_vaddr (fault_addr)
+      && thread_current ()->supt != NULL
+      && vm_supt_is_copy_on_write (thread_current ()->supt, pg_round_down (fault_addr)))
+    not_present = true;
+#endif
+
   if (!not_present){
     // printf("\n---------Huong: exit since present\n");
     exit(-1);}
@@ -184,6 +207,7 @@ page_fault (struct intr_frame *f)
    * First, bring in the page to which fault_addr refers. */
   struct thread *curr = thread_current(); /* Current thread. */
   void* fault_page = (void*) pg_round_down(fault_addr);
+  TRACE (TRACE_REF_FAULT, fault_page, curr->process->tid);
 
   if (!not_present) {
     // attempt to write to a read-only region is always killed.
@@ -200,17 +224,40 @@ page_fault (struct intr_frame *f)
   bool on_stack_frame, is_stack_addr;
   on_stack_frame = (esp <= fault_addr || fault_addr == f->esp - 4 || fault_addr == f->esp - 32);
   is_stack_addr = (PHYS_BASE - MAX_STACK_SIZE <= fault_addr && fault_addr < PHYS_BASE);
-  if (on_stack_frame && is_stack_addr) {
+
+  // the other threads of the process may fault on the same page.
+  // A page out on swap says so in its PTE (see pagedir_set_swap()):
+  // it exists, and the fault is a major one, without looking it up.
+  lock_acquire (&curr->supt->lock);
+  bool swapped = pagedir_get_swap (curr->pagedir, fault_page) != SWAP_NONE;
+  if (!swapped && on_stack_frame && is_stack_addr) {
 
     // OK. Do not die, and grow.
     // we need to add new page entry in the SUPT, if there was no page entry in the SUPT.
-    // A promising choice is assign a new zero-page.
+    // A promising choice is assign a new zero-page, along with the
+    // ones skipped over by a big move of esp (see vm/page.c).
     if (vm_supt_has_entry(curr->supt, fault_page) == false)
-      vm_supt_install_zeropage (curr->supt, fault_page);
+      vm_supt_grow_stack (curr->supt, curr->pagedir, fault_page);
   }
 
-  // continue of lazy loading
-  if(! vm_load_page(curr->supt, curr->pagedir, fault_page) ) {
+  // continue of lazy loading. A page that comes from swap or a file
+  // is a major fault, any other a minor one.
+  bool major = swapped;
+  if (!major) {
+    struct supplemental_page_table_entry *spte = vm_supt_lookup (curr->supt, fault_page);
+    major = spte != NULL
+            && (spte->status == ON_SWAP || spte->status == FROM_FILESYS);
+  }
+  bool loaded = vm_load_page(curr->supt, curr->pagedir, fault_page, write);
+  if (loaded && major)
+    vm_supt_note_fault (curr->supt, fault_page);
+  lock_release (&curr->supt->lock);
+  if (loaded && major)
+    curr->usage.major_faults++;
+  else if (loaded)
+    curr->usage.minor_faults++;
+  TRACE (TRACE_FAULT_DONE, fault_addr, loaded);
+  if (!loaded) {
     goto PAGE_FAULT_VIOLATED_ACCESS;
   }
 
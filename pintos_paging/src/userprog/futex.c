@@ -0,0 +1,197 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <limits.h>
+#include <list.h>
+#include "userprog/syscall.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Threads waiting on one user word.  A word is named by the page
+   directory of its process and its user address, so that the same
+   address in two processes is two futexes. */
+struct futex
+  {
+    struct hash_elem elem;      /* Element in futex_table. */
+    uint32_t *pagedir;          /* Page directory of the process. */
+    int *uaddr;                 /* User address of the word. */
+    struct list waiters;        /* List of struct futex_waiter. */
+  };
+
+/* A thread blocked in futex_wait(), on its own stack. */
+struct futex_waiter
+  {
+    struct list_elem elem;      /* Element in struct futex's waiters. */
+    struct semaphore sema;      /* Upped by the waker. */
+  };
+
+/* Futexes with at least one waiter.  A futex is freed once its
+   last waiter is woken. */
+static struct hash futex_table;
+static struct lock futex_lock;
+static struct kmem_cache futex_cache;
+
+static unsigned
+futex_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct futex *f = hash_entry (e, struct futex, elem);
+  return hash_bytes (&f->pagedir, sizeof f->pagedir)
+         ^ hash_bytes (&f->uaddr, sizeof f->uaddr);
+}
+
+static bool
+futex_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct futex *a = hash_entry (a_, struct futex, elem);
+  const struct futex *b = hash_entry (b_, struct futex, elem);
+  if (a->pagedir != b->pagedir)
+    return a->pagedir < b->pagedir;
+  return a->uaddr < b->uaddr;
+}
+
+/* Initializes the futex table. */
+void
+futex_init (void)
+{
+  hash_init (&futex_table, futex_hash, futex_less, NULL);
+  lock_init_named (&futex_lock, "futex");
+  kmem_cache_init (&futex_cache, "futex", sizeof (struct futex), 0, NULL);
+}
+
+/* Returns the futex for UADDR in the current process, or a null
+   pointer if nobody waits on it.  futex_lock must be held. */
+static struct futex *
+futex_lookup (int *uaddr)
+{
+  struct futex key;
+  struct hash_elem *e;
+
+  key.pagedir = thread_current ()->pagedir;
+  key.uaddr = uaddr;
+  e = hash_find (&futex_table, &key.elem);
+  return e != NULL ? hash_entry (e, struct futex, elem) : NULL;
+}
+
+/* Wakes up to CNT of the waiters on F, freeing F if that leaves
+   none, and returns how many were woken.  futex_lock must be
+   held. */
+static int
+wake_waiters (struct futex *f, int cnt)
+{
+  int woken = 0;
+
+  while (woken < cnt && !list_empty (&f->waiters))
+    {
+      struct futex_waiter *w = list_entry (list_pop_front (&f->waiters),
+                                           struct futex_waiter, elem);
+      sema_up (&w->sema);
+      woken++;
+    }
+  if (list_empty (&f->waiters))
+    {
+      hash_delete (&futex_table, &f->elem);
+      kmem_cache_free (&futex_cache, f);
+    }
+  return woken;
+}
+
+/* Blocks the current thread on the user word at UADDR, if it
+   still holds VAL, until futex_wake() is called on it.  The word
+   is read under futex_lock, so a waker that changes it and then
+   calls futex_wake() cannot be missed.  Returns 0 once woken, or
+   -1 if the word held another value, was bad, or the process is
+   exiting. */
+int
+futex_wait (int *uaddr, int val)
+{
+  struct thread *cur = thread_current ();
+  struct futex_waiter w;
+  struct futex *f;
+  int cur_val;
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+    return -1;
+
+  lock_acquire (&futex_lock);
+  if (!copy_from_user (&cur_val, uaddr, sizeof cur_val)
+      || cur_val != val
+#ifdef VM
+      || cur->process->exiting
+#endif
+      )
+    {
+      lock_release (&futex_lock);
+      return -1;
+    }
+
+  f = futex_lookup (uaddr);
+  if (f == NULL)
+    {
+      f = kmem_cache_alloc (&futex_cache);
+      if (f == NULL)
+        {
+          lock_release (&futex_lock);
+          return -1;
+        }
+      f->pagedir = cur->pagedir;
+      f->uaddr = uaddr;
+      list_init (&f->waiters);
+      hash_insert (&futex_table, &f->elem);
+    }
+  sema_init (&w.sema, 0);
+  list_push_back (&f->waiters, &w.elem);
+  lock_release (&futex_lock);
+
+  sema_down (&w.sema);
+  return 0;
+}
+
+/* Wakes up to CNT threads blocked on the user word at UADDR, in
+   the order they began waiting.  Returns how many were woken. */
+int
+futex_wake (int *uaddr, int cnt)
+{
+  struct futex *f;
+  int woken = 0;
+
+  if (cnt <= 0)
+    return 0;
+
+  lock_acquire (&futex_lock);
+  f = futex_lookup (uaddr);
+  if (f != NULL)
+    woken = wake_waiters (f, cnt);
+  lock_release (&futex_lock);
+  return woken;
+}
+
+/* Wakes every thread of the process with PAGEDIR that is blocked
+   in futex_wait(), so that they see the process is exiting.  The
+   process must already be marked exiting, so that none starts
+   waiting again. */
+void
+futex_wake_process (uint32_t *pagedir)
+{
+  struct hash_iterator i;
+  struct futex *f;
+
+  lock_acquire (&futex_lock);
+  do
+    {
+      f = NULL;
+      hash_first (&i, &futex_table);
+      while (hash_next (&i))
+        if (hash_entry (hash_cur (&i), struct futex, elem)->pagedir == pagedir)
+          {
+            f = hash_entry (hash_cur (&i), struct futex, elem);
+            break;
+          }
+      if (f != NULL)
+        wake_waiters (f, INT_MAX);
+    }
+  while (f != NULL);
+  lock_release (&futex_lock);
+}
@@ -1,13 +1,48 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <round.h>
 #include <string.h>
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/spinlock.h"
+
+/* Page-table pages kept for reuse, already zeroed, so that the
+   many short-lived processes do not go through the page allocator
+   for each of their page tables.  Linked through their first
+   word, which is zeroed again when one is taken. */
+#define PT_CACHE_MAX 16
+static void *pt_cache;
+static size_t pt_cache_cnt;
+static struct spinlock pt_cache_lock;
+
+/* Number of present entries of each page table, by page number of
+   the page it is in, so that pagedir_destroy() skips the empty
+   tables and stops at the last present entry of the others. */
+static uint16_t *pt_present;
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *vpage);
+static uint32_t *pt_alloc (void);
+static void pt_free (uint32_t *pt);
+static void pt_count (uint32_t *pte, int delta);
+
+/* Initializes the page-table bookkeeping. */
+void
+pagedir_init (void)
+{
+  pt_present = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+      DIV_ROUND_UP (init_ram_pages * sizeof *pt_present, PGSIZE));
+  spinlock_init (&pt_cache_lock);
+}
+
+/* Returns the count of present entries of page table PT. */
+static inline uint16_t *
+pt_present_cnt (const uint32_t *pt)
+{
+  return &pt_present[vtop (pt) >> PGBITS];
+}
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -18,7 +53,7 @@ pagedir_create (void)
 {
   uint32_t *pd = palloc_get_page (0);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    page_copy (pd, init_page_dir);
   return pd;
 }
 
@@ -37,22 +72,91 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
+        uint16_t *cnt = pt_present_cnt (pt);
         uint32_t *pte;
         
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+        for (pte = pt; *cnt > 0; pte++)
           if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+            {
+              palloc_free_page (pte_get_page (*pte));
+              --*cnt;
+            }
+        pt_free (pt);
       }
   palloc_free_page (pd);
 }
 
+/* Adds DELTA to the number of present entries of the page table
+   that PTE is in.  Atomic: the threads of a process may map and
+   unmap its pages at once. */
+static void
+pt_count (uint32_t *pte, int delta)
+{
+  uint16_t *cnt = pt_present_cnt (pg_round_down (pte));
+  if (delta > 0)
+    asm volatile ("lock incw %0" : "+m" (*cnt) : : "memory");
+  else
+    asm volatile ("lock decw %0" : "+m" (*cnt) : : "memory");
+}
+
+/* Returns a zeroed page for a page table, or a null pointer if
+   memory allocation fails. */
+static uint32_t *
+pt_alloc (void)
+{
+  uint32_t *pt;
+
+  spinlock_acquire (&pt_cache_lock);
+  pt = pt_cache;
+  if (pt != NULL)
+    {
+      pt_cache = *(void **) pt;
+      pt_cache_cnt--;
+    }
+  spinlock_release (&pt_cache_lock);
+
+  if (pt == NULL)
+    return palloc_get_page (PAL_ZERO);
+  pt[0] = 0;
+  return pt;
+}
+
+/* Frees page table PT, which has no present entries, into the
+   cache if it has room. */
+static void
+pt_free (uint32_t *pt)
+{
+  ASSERT (*pt_present_cnt (pt) == 0);
+
+  if (pt_cache_cnt >= PT_CACHE_MAX)
+    {
+      palloc_free_page (pt);
+      return;
+    }
+
+  /* Entries not present may still hold bits. */
+  memset (pt, 0, PGSIZE);
+  spinlock_acquire (&pt_cache_lock);
+  if (pt_cache_cnt < PT_CACHE_MAX)
+    {
+      *(void **) pt = pt_cache;
+      pt_cache = pt;
+      pt_cache_cnt++;
+      pt = NULL;
+    }
+  spinlock_release (&pt_cache_lock);
+  if (pt != NULL)
+    palloc_free_page (pt);
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.  A null pointer is also returned for the
+   kernel's RAM above the first 4 MB, mapped by 4 MB pages that
+   have no page table (see paging_init()). */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -70,7 +174,7 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = pt_alloc ();
           if (pt == NULL) 
             return NULL; 
       
@@ -79,6 +183,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    return NULL;
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -112,6 +218,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     {
       ASSERT ((*pte & PTE_P) == 0);
       *pte = pte_create_user (kpage, writable);
+      pt_count (pte, 1);
       return true;
     }
   else
@@ -138,7 +245,8 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
-   bits in the page table entry are preserved.
+   bits in the page table entry are preserved, but for a swap
+   slot recorded by pagedir_set_swap().
    UPAGE need not be mapped. */
 void
 pagedir_clear_page (uint32_t *pd, void *upage) 
@@ -152,10 +260,56 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      pt_count (pte, -1);
+      invalidate_page (pd, upage);
     }
+  else if (pte != NULL && (*pte & PTE_SWAP) != 0)
+    *pte &= ~(PTE_ADDR | PTE_SWAP);
 }
 
+#ifdef VM
+/* Records in the PTE of user virtual page UPAGE in PD, which must
+   not be present, that the page is out on swap in SLOT, for
+   pagedir_get_swap() to tell without the supplemental page table.
+   Only a hint: nothing is recorded if UPAGE has no page table or
+   SLOT does not fit in the address bits.  Mapping the page, or
+   pagedir_clear_page(), drops it. */
+void
+pagedir_set_swap (uint32_t *pd, void *upage, swap_index_t slot)
+{
+  uint32_t *pte;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte == NULL)
+    return;
+  ASSERT ((*pte & PTE_P) == 0);
+  if (slot <= PTE_ADDR >> PGBITS)
+    *pte = (*pte & PTE_FLAGS) | PTE_SWAP | slot << PGBITS;
+  else
+    *pte &= ~(PTE_ADDR | PTE_SWAP);
+}
+
+/* Returns the swap slot recorded by pagedir_set_swap() for user
+   virtual page UPAGE in PD, or SWAP_NONE if none is.  Where one
+   is, the page is out on swap in that slot, as long as the
+   process's supplemental page table lock is held. */
+swap_index_t
+pagedir_get_swap (uint32_t *pd, const void *upage)
+{
+  uint32_t *pte;
+
+  ASSERT (is_user_vaddr (upage));
+
+  pte = lookup_page (pd, upage, false);
+  if (pte != NULL && (*pte & (PTE_P | PTE_SWAP)) == PTE_SWAP)
+    return *pte >> PGBITS;
+  return SWAP_NONE;
+}
+#endif
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -180,7 +334,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -209,18 +363,21 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded: loading it again would
+   only flush the TLB. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (pd == active_pd ())
+    return;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -245,19 +402,18 @@ active_pd (void)
 
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry of the page whose PTE changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the TLB entry for VPAGE if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Unlike re-activating PD, it leaves the rest of the
+   TLB alone.  See [IA32-v2a] "INVLPG" and [IA32-v3a] 3.12
+   "Translation Lookaside Buffers (TLBs)". */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vpage) 
 {
   if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
 }
@@ -3,12 +3,20 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#ifdef VM
+#include "vm/swap.h"
+#endif
 
+void pagedir_init (void);
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
 void *pagedir_get_page (uint32_t *pd, const void *upage);
 void pagedir_clear_page (uint32_t *pd, void *upage);
+#ifdef VM
+void pagedir_set_swap (uint32_t *pd, void *upage, swap_index_t slot);
+swap_index_t pagedir_get_swap (uint32_t *pd, const void *upage);
+#endif
 bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
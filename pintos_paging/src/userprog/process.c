@@ -1,135 +1,362 @@
 #include "userprog/process.h"
 #include <debug.h>
+#include <hash.h>
 #include <inttypes.h>
 #include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syscall-nr.h>
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/spinlock.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #ifdef VM
+#include "vm/checkpoint.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 #endif
 
 static thread_func start_process NO_RETURN;
+static tid_t execute (const char *file_name, bool wait_load);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
+/* The status of a child process, shared by the child and its
+   parent: the child posts its load result and its exit status
+   here, each with its own semaphore, so that neither has to wait
+   for the other except to learn them.  Whichever of the two lets
+   go of it last frees it. */
+struct child_status
+  {
+    tid_t tid;                  /* The child's thread id. */
+    struct hash_elem elem;      /* Element in the parent's children. */
+    struct semaphore started;   /* Upped once it is done with the parent. */
+    struct semaphore loaded;    /* Upped once the child has loaded. */
+    struct semaphore exited;    /* Upped when the child exits. */
+    volatile int load_state;    /* LOAD_PENDING, LOAD_OK or LOAD_FAILED. */
+    int exit_status;            /* Exit status, once EXITED is up. */
+    struct spinlock lock;       /* Protects REF_CNT. */
+    int ref_cnt;                /* Number of the two that hold it. */
+  };
+
+/* What process_execute() passes to start_process(), at the start
+   of the page that holds the command line. */
+struct process_start
+  {
+    struct child_status *status; /* The child's status. */
+    struct thread *parent;      /* The thread that started the child. */
+    char *args;                 /* Command line after the file name. */
+  };
+
+bool process_usage_on_exit;
+
+/* Child statuses. */
+static struct kmem_cache child_status_cache;
+
+#ifdef VM
+/* The status of a thread of a process other than its main
+   thread, in the main thread's user_threads from the thread's
+   creation until it is joined or the process exits. */
+struct user_thread
+  {
+    tid_t tid;                  /* The thread's id. */
+    struct list_elem elem;      /* Element in user_threads. */
+    struct semaphore exited;    /* Upped when the thread exits. */
+    size_t slot;                /* Its stack slot. */
+    bool joining;               /* Is a thread joining it? */
+  };
+
+/* What process_thread_create() passes to start_thread().  The
+   new thread starts at EIP with its arguments in registers, so
+   that nothing has to be written to its stack beforehand. */
+struct thread_start
+  {
+    struct thread *process;     /* Main thread of its process. */
+    struct user_thread *status; /* Its status. */
+    void (*eip) (void);         /* First user instruction. */
+    void *esp;                  /* Top of its user stack. */
+    uint32_t eax, edx;          /* Initial EAX and EDX. */
+  };
+
+/* What process_fork() passes to start_fork(), on the stack of
+   the parent, which waits until the child has started. */
+struct fork_start
+  {
+    struct child_status *status; /* The child's status. */
+    struct thread *parent;      /* The thread that called fork(). */
+    struct intr_frame if_;      /* Its user registers. */
+  };
+
+static thread_func start_thread NO_RETURN;
+static thread_func start_fork NO_RETURN;
+
+/* User thread statuses. */
+static struct kmem_cache user_thread_cache;
+#endif
+
+/* Initializes the process module. */
+void
+process_init (void)
+{
+  kmem_cache_init (&child_status_cache, "child_status",
+                   sizeof (struct child_status), 0, NULL);
+#ifdef VM
+  kmem_cache_init (&user_thread_cache, "user_thread",
+                   sizeof (struct user_thread), 0, NULL);
+#endif
+}
+
+#ifdef VM
+/* Adds the counters of B to those of A. */
+static void
+usage_add (struct rusage *a, const struct rusage *b)
+{
+  uint64_t *dst = (uint64_t *) a;
+  const uint64_t *src = (const uint64_t *) b;
+  size_t i;
+
+  /* All the members of struct rusage are uint64_t counters. */
+  for (i = 0; i < sizeof *a / sizeof *dst; i++)
+    dst[i] += src[i];
+}
+#endif
+
+/* Returns a hash value for the child status in E. */
+static unsigned
+child_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct child_status, elem)->tid);
+}
+
+/* Returns true if the child status in A precedes the one in B. */
+static bool
+child_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct child_status, elem)->tid
+          < hash_entry (b, struct child_status, elem)->tid);
+}
+
+/* Lets go of STATUS, freeing it if the other of the child and its
+   parent has let go already. */
+static void
+release_child_status (struct child_status *status)
+{
+  int ref_cnt;
+
+  spinlock_acquire (&status->lock);
+  ref_cnt = --status->ref_cnt;
+  spinlock_release (&status->lock);
+  if (ref_cnt == 0)
+    kmem_cache_free (&child_status_cache, status);
+}
+
+/* Lets go of the child status in E, for hash_destroy(). */
+static void
+release_child_elem (struct hash_elem *e, void *aux UNUSED)
+{
+  release_child_status (hash_entry (e, struct child_status, elem));
+}
+
+/* Makes sure that CUR has a hash of its children, and returns a
+   new status for a child that CUR is about to start, or a null
+   pointer if out of memory. */
+static struct child_status *
+child_status_create (struct thread *cur)
+{
+  struct child_status *status;
+
+  if (cur->children == NULL)
+    {
+      cur->children = malloc (sizeof *cur->children);
+      if (cur->children == NULL)
+        return NULL;
+      if (!hash_init (cur->children, child_hash, child_less, NULL))
+        {
+          free (cur->children);
+          cur->children = NULL;
+          return NULL;
+        }
+    }
+
+  status = kmem_cache_alloc (&child_status_cache);
+  if (status == NULL)
+    return NULL;
+  sema_init (&status->started, 0);
+  sema_init (&status->loaded, 0);
+  sema_init (&status->exited, 0);
+  status->load_state = LOAD_PENDING;
+  status->exit_status = -1;
+  spinlock_init (&status->lock);
+  status->ref_cnt = 2;
+  return status;
+}
+
+/* Adds the child TID, just started by CUR with STATUS, to CUR's
+   children, and waits until it knows whether the child could
+   start.  Returns TID, or TID_ERROR if it could not. */
+static tid_t
+child_wait_started (struct thread *cur, struct child_status *status, tid_t tid)
+{
+  status->tid = tid;
+  hash_insert (cur->children, &status->elem);
+
+  sema_down (&status->loaded);
+  if (status->load_state != LOAD_OK)
+    {
+      hash_delete (cur->children, &status->elem);
+      release_child_status (status);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
-   thread id, or TID_ERROR if the thread cannot be created. */
+   thread id, or TID_ERROR if the thread cannot be created or
+   the program cannot be loaded. */
 tid_t
 process_execute (const char *file_name) 
 {
-  // printf("process_execute: %s, tid: %d, priority: %d\n", 
-    // thread_current()->name, thread_current()->tid, thread_current()->priority);
+  return execute (file_name, true);
+}
 
-  char *fn_copy;
+/* Like process_execute(), but returns as soon as the child no
+   longer needs its parent, before it has loaded its executable.
+   Whether it could is learned from process_load_status(), or
+   from process_wait(), which returns -1 if it could not.  Returns
+   TID_ERROR only if the thread cannot be created. */
+tid_t
+process_spawn (const char *file_name)
+{
+  return execute (file_name, false);
+}
+
+/* Common part of the above: waits for the child to load if
+   WAIT_LOAD. */
+static tid_t
+execute (const char *file_name, bool wait_load)
+{
+  struct thread *cur = thread_current ();
+  struct process_start *start;
+  struct child_status *status;
+  char *cmd_line;
   tid_t tid;
 
-  // printf("\n----------Huong: processing %s\n", file_name);
   /* Make a copy of FILE_NAME.
      Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  start = palloc_get_page (0);
+  if (start == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
+  cmd_line = (char *) (start + 1);
+  strlcpy (cmd_line, file_name, PGSIZE - sizeof *start);
+
+  status = child_status_create (cur);
+  if (status == NULL)
+    {
+      palloc_free_page (start);
+      return TID_ERROR;
+    }
+  start->status = status;
+  start->parent = cur;
 
-  /* Create a new thread to execute FILE_NAME. */
-  // tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
-  
-  //   
   /* Seperate filen_name into 2 parts --  
      argv0 for filename, save_ptr for other arguments  */
-  char *argv0, *save_ptr;
-  argv0 = strtok_r(fn_copy, " ", &save_ptr);
-  tid = thread_create (argv0, thread_current()->priority,
-   start_process, save_ptr);
-  
-  /*The parent process should wait until it knows
-     whether the child process successfully loaded its executable. */
-  sema_down(&thread_current()->process_wait);
-  //  
-
+  char *argv0;
+  argv0 = strtok_r (cmd_line, " ", &start->args);
+#ifdef VM
+  /* Not while the running processes' working sets fill memory. */
+  vm_frame_admit ();
+#endif
+  tid = thread_create (argv0, cur->priority, start_process, start);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy); 
-
-  // return tid;
+    {
+      palloc_free_page (start);
+      kmem_cache_free (&child_status_cache, status);
+      return TID_ERROR;
+    }
 
-  //  
-  return thread_current()->child_load_status;
-  //  
+  /* The parent process should wait until it knows
+     whether the child process successfully loaded its executable. */
+  if (wait_load)
+    return child_wait_started (cur, status, tid);
+
+  /* Or only until the child has the pipe ends it inherits.  A
+     child that fails to load stays among the children, for wait()
+     to reap. */
+  status->tid = tid;
+  hash_insert (cur->children, &status->elem);
+  sema_down (&status->started);
+  return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *args_)
+start_process (void *start_)
 {
   // printf("start_thread: %s, tid: %d, priority: %d\n", 
   //   thread_current()->name, thread_current()->tid, thread_current()->priority);
-  char * args = args_;
+  struct process_start *start = start_;
+  struct thread *cur = thread_current ();
   struct intr_frame if_;
   bool success;
 
+  cur->child_status = start->status;
+
+  /* The parent is waiting for us below: its fd table stays.  Past
+     sema_up(), it may have gone on, even if it waits for the load
+     result. */
+  success = inherit_pipes (start->parent);
+  sema_up (&cur->child_status->started);
+
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  success = load (args, &if_.eip, &if_.esp);
-
-  /* If load failed, quit. */
-  // palloc_free_page (args);
-
-  //  
-  palloc_free_page(pg_round_down(args));
-
-  /* Limit on the depth of threads*/
-  // if (success)
-  // {
-  //   struct thread *t = thread_current();
-  //   int depth = 0;
-  //   while (t != NULL)
-  //   {
-  //     depth++;
-  //     t = t->parent;
-  //   }
-
-  //   if (depth > 37)
-  //     success = false;
-  // }
-
-  /* if loading fails, set the load_status -1 and exit. */
-  if (!success) 
-  {
-    if (thread_current()->parent != NULL)
-      thread_current()->parent->child_load_status = -1;
-    thread_exit();
-  }
-
-  /* If loading succeed, its parent ends waiting,
-     and the child thread starts waiting for its parent. */
-  sema_up(&thread_current()->parent->process_wait);
-  sema_down(&thread_current()->process_wait);
-  // printf("running %s\n", thread_current()->name);
-  
+  if (success)
+    {
+#ifdef VM
+      /* A checkpoint is restored instead of loaded. */
+      struct file *ckpt = vm_checkpoint_open (thread_name ());
+      if (ckpt != NULL)
+        success = vm_checkpoint_restore (ckpt, &if_);
+      else
+#endif
+      success = load (start->args, &if_.eip, &if_.esp);
+    }
+  palloc_free_page (start);
+
   /* Ensure that the executable of a running process cannot
      be modified. */
-  thread_current()->file = filesys_open (thread_name());
-  file_deny_write(thread_current()->file);
-  //  
+  if (success && cur->file == NULL)
+    {
+      cur->file = filesys_open (thread_name ());
+      file_deny_write (cur->file);
+    }
+
+  /* Tell the parent how loading went, and quit if it failed. */
+  cur->child_status->load_state = success ? LOAD_OK : LOAD_FAILED;
+  sema_up (&cur->child_status->loaded);
+  if (!success) 
+    thread_exit ();
 
   /* Start the user process by simulating a return from an
      interrupt, implemented by intr_exit (in
@@ -152,38 +379,594 @@ start_process (void *args_)
    does nothing. */
 int
 process_wait (tid_t child_tid) 
-{ 
-  //  
-  int status = -1;
+{
+  struct thread *cur = thread_current ();
+  struct child_status probe;
+  struct hash_elem *e;
+  struct child_status *status;
+  int exit_status;
+
+  /* child_tid should be its direct child, not waited for yet. */
+  if (cur->children == NULL)
+    return -1;
+  probe.tid = child_tid;
+  e = hash_delete (cur->children, &probe.elem);
+  if (e == NULL)
+    return -1;
+
+  status = hash_entry (e, struct child_status, elem);
+#ifdef VM
+  if (!process_block ())
+    {
+      release_child_status (status);
+      return -1;
+    }
+#endif
+  sema_down (&status->exited);
+#ifdef VM
+  process_unblock ();
+#endif
+  exit_status = status->exit_status;
+  release_child_status (status);
+  return exit_status;
+}
+
+/* Returns whether the child TID of the running process, started
+   by process_spawn(), has loaded its executable: LOAD_PENDING if
+   it is still loading, LOAD_OK if it has, or LOAD_FAILED if it
+   could not or if TID is not a child not waited for yet.  Does
+   not wait. */
+int
+process_load_status (tid_t child_tid)
+{
+  struct thread *cur = thread_current ();
+  struct child_status probe;
+  struct hash_elem *e;
+
+  if (cur->children == NULL)
+    return LOAD_FAILED;
+  probe.tid = child_tid;
+  e = hash_find (cur->children, &probe.elem);
+  if (e == NULL)
+    return LOAD_FAILED;
+  return hash_entry (e, struct child_status, elem)->load_state;
+}
+
+#ifdef VM
+/* Returns the top of the user stack in slot SLOT. */
+static uint8_t *
+stack_slot_top (size_t slot)
+{
+  return (uint8_t *) PHYS_BASE - MAX_STACK_SIZE - slot * THREAD_STACK_SIZE;
+}
+
+/* Starts another thread in the current process, sharing its
+   address space, files and heap.  It begins in user mode at EIP
+   with EAX and EDX as given, on a stack of its own of
+   THREAD_STACK_SIZE below the main thread's.  Returns the new
+   thread's id, or TID_ERROR if the process already has
+   THREAD_MAX other threads, is exiting, or memory is short. */
+tid_t
+process_thread_create (void (*eip) (void), uint32_t eax, uint32_t edx)
+{
+  struct thread *cur = thread_current ();
+  struct thread *proc = cur->process;
+  struct user_thread *status;
+  struct thread_start *start;
+  uint8_t *top, *page;
+  size_t slot;
+  tid_t tid = TID_ERROR;
+
+  status = kmem_cache_alloc (&user_thread_cache);
+  start = malloc (sizeof *start);
+  if (status == NULL || start == NULL)
+    goto done;
+
+  lock_acquire (&proc->process_lock);
+  if (proc->exiting || proc->stack_slots == UINT32_MAX)
+    goto done_locked;
+
+  /* Map the stack as zero pages, but for the guard page below
+     it.  A slot keeps its pages from one thread to the next. */
+  slot = __builtin_ctz (~proc->stack_slots);
+  top = stack_slot_top (slot);
+  lock_acquire (&proc->supt->lock);
+  for (page = top - THREAD_STACK_SIZE + PGSIZE; page < top; page += PGSIZE)
+    if (!vm_supt_has_entry (proc->supt, page)
+        && !vm_supt_install_zeropage (proc->supt, page))
+      break;
+  lock_release (&proc->supt->lock);
+  if (page < top)
+    goto done_locked;
+
+  sema_init (&status->exited, 0);
+  status->slot = slot;
+  status->joining = false;
+  start->process = proc;
+  start->status = status;
+  start->eip = eip;
+  start->esp = top - sizeof (void *);
+  start->eax = eax;
+  start->edx = edx;
+
+  /* The new thread cannot exit before it is in user_threads: it
+     needs the lock to. */
+  tid = thread_create (proc->name, cur->priority, start_thread, start);
+  if (tid != TID_ERROR)
+    {
+      status->tid = tid;
+      list_push_back (&proc->user_threads, &status->elem);
+      proc->stack_slots |= (uint32_t) 1 << slot;
+      proc->live_threads++;
+      status = NULL;
+      start = NULL;
+    }
+
+ done_locked:
+  lock_release (&proc->process_lock);
+ done:
+  if (status != NULL)
+    kmem_cache_free (&user_thread_cache, status);
+  free (start);
+  return tid;
+}
+
+/* A thread function that enters user mode in a thread started
+   by process_thread_create(). */
+static void
+start_thread (void *start_)
+{
+  struct thread_start *start = start_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+
+  cur->process = start->process;
+  cur->user_thread = start->status;
+  cur->supt = cur->process->supt;
+  cur->pagedir = cur->process->pagedir;
+  process_activate ();
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = start->eip;
+  if_.esp = start->esp;
+  if_.eax = start->eax;
+  if_.edx = start->edx;
+  free (start);
+
+  /* The process may have started exiting meanwhile. */
+  process_poll_exit ();
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Starts a new process, a copy of the current one, which returns
+   from the system call being handled as the current thread does,
+   but with 0 in EAX.  Only the current thread is copied.  Returns
+   the new process's thread id, or TID_ERROR if out of memory or
+   swap. */
+tid_t
+process_fork (void)
+{
+  struct thread *cur = thread_current ();
+  struct fork_start start;
+  tid_t tid;
+
+  start.status = child_status_create (cur);
+  if (start.status == NULL)
+    return TID_ERROR;
+  start.parent = cur;
+
+  /* The user registers are at the top of the kernel stack, where
+     the CPU, or sysenter_entry, saved them on entry. */
+  start.if_ = ((struct intr_frame *) ((uint8_t *) cur + PGSIZE))[-1];
+
+  vm_frame_admit ();
+  tid = thread_create (cur->process->name, cur->priority, start_fork, &start);
+  if (tid == TID_ERROR)
+    {
+      kmem_cache_free (&child_status_cache, start.status);
+      return TID_ERROR;
+    }
+  return child_wait_started (cur, start.status, tid);
+}
+
+/* Copies the address space of PARENT, the main thread of the
+   process being forked, into the current process. */
+static bool
+fork_memory (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  bool success;
+
+  cur->pagedir = pagedir_create ();
+  cur->supt = vm_supt_create ();
+  if (cur->pagedir == NULL || cur->supt == NULL)
+    return false;
+  process_activate ();
+  if (!pagedir_set_page (cur->pagedir, TIME_PAGE, timer_time_page (), false))
+    return false;
+
+  lock_acquire (&parent->supt->lock);
+  success = vm_supt_fork (cur->supt, cur->pagedir, parent);
+  lock_release (&parent->supt->lock);
+
+  cur->heap_start = parent->heap_start;
+  cur->heap_break = parent->heap_break;
+  cur->heap_mapped = parent->heap_mapped;
+  return success;
+}
+
+/* A thread function that copies the process of the thread that
+   called process_fork() into a new one, and returns to user mode
+   in it. */
+static void
+start_fork (void *start_)
+{
+  struct fork_start *start = start_;
+  struct thread *cur = thread_current ();
+  struct thread *parent = start->parent;
+  struct intr_frame if_ = start->if_;
+  bool success;
+
+  cur->child_status = start->status;
+  cur->file = file_dup (parent->process->file);
+  if (parent->process->runtime_file != NULL)
+    cur->runtime_file = file_dup (parent->process->runtime_file);
+  if (parent->process->ckpt_file != NULL)
+    cur->ckpt_file = file_dup (parent->process->ckpt_file);
+  success = fork_memory (parent->process) && fork_fds (parent);
+
+  /* Forked from a thread other than the main one, the process runs
+     on that thread's stack: keep its slot. */
+  if (parent->user_thread != NULL)
+    cur->stack_slots = (uint32_t) 1 << parent->user_thread->slot;
+
+  /* START is gone once the parent knows. */
+  cur->child_status->load_state = success ? LOAD_OK : LOAD_FAILED;
+  sema_up (&cur->child_status->loaded);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Waits for thread TID, another thread of the current process
+   than the current one, to exit.  Returns 0 once it has, or -1
+   at once if it is not such a thread or another thread is
+   already joining it. */
+int
+process_thread_join (tid_t tid)
+{
+  struct thread *cur = thread_current ();
+  struct thread *proc = cur->process;
+  struct user_thread *status = NULL;
   struct list_elem *e;
-  struct thread *cur = thread_current();
-  // printf("process_wait %s\n", cur->name);
 
-  /* child_tid should be its direct child.*/
-  struct thread *child = NULL;
-  for (e = list_begin (&cur->children); e != list_end (&cur->children);
-     e = list_next (e))
-  {
-    struct thread *tmp = list_entry (e, struct thread, child_elem);
-    if (tmp->tid == child_tid)
+  lock_acquire (&proc->process_lock);
+  for (e = list_begin (&proc->user_threads);
+       e != list_end (&proc->user_threads); e = list_next (e))
     {
-      // printf("wait for child %s\n", tmp->name);
-      child = tmp;
-      break;
+      struct user_thread *s = list_entry (e, struct user_thread, elem);
+      if (s->tid == tid && !s->joining && s != cur->user_thread)
+        {
+          status = s;
+          status->joining = true;
+          break;
+        }
     }
-  }
+  lock_release (&proc->process_lock);
+  if (status == NULL)
+    return -1;
+
+  sema_down (&status->exited);
+  lock_acquire (&proc->process_lock);
+  list_remove (&status->elem);
+  lock_release (&proc->process_lock);
+  kmem_cache_free (&user_thread_cache, status);
+  return 0;
+}
 
-  /* If process child_tid is its child, let it wait for its child. */
-  if (child != NULL) {
-    // the order is important !!!!
-    sema_up(&child->process_wait);
-    sema_down(&cur->process_wait);   
-    status = cur->child_exit_status;
-    // printf("child_exit status %d\n", cur->child_exit_status);
-  }
-  
-  return status;
-  //  
+/* Makes the other threads of the current process, of which it
+   must be the main thread, exit, and waits until they have.  Each
+   stops when it next enters or leaves the kernel (see
+   process_poll_exit()); one blocked in the kernel stops once it
+   wakes up. */
+void
+process_stop_threads (void)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (cur->process == cur);
+
+  lock_acquire (&cur->process_lock);
+  cur->exiting = true;
+  lock_release (&cur->process_lock);
+  futex_wake_process (cur->pagedir);
+
+  lock_acquire (&cur->process_lock);
+  while (cur->live_threads > 0)
+    {
+      lock_release (&cur->process_lock);
+      sema_down (&cur->threads_exited);
+      lock_acquire (&cur->process_lock);
+    }
+  lock_release (&cur->process_lock);
+
+  while (!list_empty (&cur->user_threads))
+    kmem_cache_free (&user_thread_cache,
+                     list_entry (list_pop_front (&cur->user_threads),
+                                 struct user_thread, elem));
+}
+
+/* Makes process PROC, of which it must be the main thread, exit
+   with status -1, as if one of its threads had called exit(-1):
+   each stops when it next enters or leaves the kernel, as in
+   process_stop_threads().  Threads blocked on a futex are the
+   caller's to wake.  Interrupts must be off: process_lock is not
+   taken, so that the VM can kill a process for memory with its own
+   locks held. */
+void
+process_kill (struct thread *proc)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (proc->process == proc);
+
+  if (!proc->exiting)
+    proc->exit_status = -1;
+  proc->exiting = true;
+}
+
+/* Notes that the current thread is about to block in a wait that
+   does not end when its process starts exiting -- for a child, a
+   pipe or the keyboard -- until process_unblock().  The VM does not
+   kill such a process for memory (see oom_kill() in vm/frame.c):
+   it would not exit until the wait ended.
+   Returns false, noting nothing, if the process is exiting already:
+   the caller must not wait then. */
+bool
+process_block (void)
+{
+  struct thread *proc = thread_current ()->process;
+  enum intr_level old_level = intr_disable ();
+  bool exiting = proc->exiting;
+
+  if (!exiting)
+    proc->blocked_cnt++;
+  intr_set_level (old_level);
+  return !exiting;
+}
+
+/* Notes that the wait of process_block() is over. */
+void
+process_unblock (void)
+{
+  struct thread *proc = thread_current ()->process;
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (proc->blocked_cnt > 0);
+  proc->blocked_cnt--;
+  intr_set_level (old_level);
+}
+
+/* Ends the current thread if its process is exiting: the main
+   thread exits the process with the status that was given to
+   exit(), any other thread just stops.  Called on the ways into
+   and out of the kernel, possibly with interrupts off. */
+void
+process_poll_exit (void)
+{
+  struct thread *cur = thread_current ();
+
+  if (!cur->process->exiting)
+    return;
+
+  intr_enable ();
+  if (cur->process == cur)
+    exit (cur->exit_status);
+  thread_exit ();
+}
+
+/* Returns the first page of the profil() buffer BUF of SIZE
+   bytes, and stores the number of its pages in *CNT. */
+static uint8_t *
+profil_pages (uint8_t *buf, size_t size, size_t *cnt)
+{
+  uint8_t *first = pg_round_down (buf);
+
+  *cnt = DIV_ROUND_UP (buf + size - first, PGSIZE);
+  return first;
+}
+
+/* Stops profiling process PROC, if it is, and unlocks the pages of
+   its buffer. */
+static void
+profil_stop (struct thread *proc)
+{
+  uint8_t *buf = proc->profil_buf;
+  uint8_t *first;
+  enum intr_level old_level;
+  size_t cnt, i;
+
+  if (buf == NULL)
+    return;
+  old_level = intr_disable ();
+  proc->profil_buf = NULL;
+  intr_set_level (old_level);
+
+  /* The counters were written through the kernel's mapping, which
+     the pages' dirty bits do not see. */
+  first = profil_pages (buf, proc->profil_size, &cnt);
+  for (i = 0; i < cnt; i++)
+    pagedir_set_dirty (proc->pagedir, first + i * PGSIZE, true);
+
+  lock_acquire (&proc->supt->lock);
+  vm_supt_unlock (proc->supt, first, cnt);
+  lock_release (&proc->supt->lock);
+}
+
+/* Starts profiling the user code of the running process, as
+   profil() does, or stops it if BUF is null or SCALE is 0.  From
+   then on, each timer tick that finds the process in user mode at
+   EIP adds one to the 16-bit counter number
+   (EIP - OFFSET) / 2 * SCALE / 65536 of BUF, of SIZE bytes, if
+   there is one.  SCALE is a 16.16 fixed-point fraction: 0x10000
+   gives each 2 bytes of code a counter of its own.
+
+   The pages of BUF, which must be writable, are locked in memory
+   until profiling stops or the process exits, as by mlock(), and
+   unlocked then as by munlock().  Returns false, not profiling, if
+   BUF is not aligned or not in writable user memory, or if its
+   pages cannot be locked. */
+bool
+process_profil (void *buf_, size_t size, uintptr_t offset, unsigned scale)
+{
+  struct thread *proc = thread_current ()->process;
+  uint8_t *buf = buf_;
+  uint8_t *first;
+  enum intr_level old_level;
+  size_t cnt, i;
+  bool success = true;
+
+  profil_stop (proc);
+  if (buf == NULL || scale == 0)
+    return true;
+  if (size < sizeof (uint16_t) || (uintptr_t) buf % sizeof (uint16_t) != 0
+      || buf + size < buf || !is_user_vaddr (buf + size - 1))
+    return false;
+
+  first = profil_pages (buf, size, &cnt);
+  lock_acquire (&proc->supt->lock);
+  for (i = 0; i < cnt && success; i++)
+    {
+      struct supplemental_page_table_entry *spte =
+        vm_supt_lookup (proc->supt, first + i * PGSIZE);
+      success = spte != NULL && spte->writable;
+    }
+  if (success && !vm_supt_lock (proc->supt, proc->pagedir, first, cnt))
+    {
+      vm_supt_unlock (proc->supt, first, cnt);
+      success = false;
+    }
+  lock_release (&proc->supt->lock);
+  if (!success)
+    return false;
+
+  proc->profil_size = size;
+  proc->profil_offset = offset;
+  proc->profil_scale = scale;
+  old_level = intr_disable ();
+  proc->profil_buf = buf;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Called by the timer interrupt handler when it interrupts user
+   code at EIP: counts a sample in the process's profil() buffer,
+   if it has one.  A counter whose page was unlocked by munlock()
+   and is no longer present loses the sample. */
+void
+process_profil_tick (uintptr_t eip)
+{
+  struct thread *proc = thread_current ()->process;
+  uint16_t *counter;
+  uint64_t idx;
+
+  if (proc->profil_buf == NULL || eip < proc->profil_offset)
+    return;
+  idx = (uint64_t) ((eip - proc->profil_offset) / 2) * proc->profil_scale >> 16;
+  if (idx >= proc->profil_size / sizeof *counter)
+    return;
+
+  counter = pagedir_get_page (proc->pagedir,
+                              proc->profil_buf + idx * sizeof *counter);
+  if (counter != NULL)
+    ++*counter;
+}
+
+/* Ends the current thread, which is not the main thread of its
+   process.  Its stack stays mapped for the next thread put in
+   its slot, but its frames are the first to be evicted. */
+static void
+user_thread_exit (void)
+{
+  struct thread *cur = thread_current ();
+  struct thread *proc = cur->process;
+  struct user_thread *status = cur->user_thread;
+  uint8_t *top = stack_slot_top (status->slot);
+
+  lock_acquire (&proc->supt->lock);
+  vm_supt_advise (proc->supt, proc->pagedir,
+                  top - THREAD_STACK_SIZE + PGSIZE,
+                  THREAD_STACK_SIZE / PGSIZE - 1, MADV_DONTNEED);
+  lock_release (&proc->supt->lock);
+
+  /* Let go of the address space before the main thread can
+     destroy it. */
+  cur->supt = NULL;
+  cur->pagedir = NULL;
+  pagedir_activate (NULL);
+
+  /* The lock is held until the end so that the main thread,
+     which then may free everything, waits for us to be done. */
+  lock_acquire (&proc->process_lock);
+  usage_add (&proc->exited_usage, &cur->usage);
+  proc->stack_slots &= ~((uint32_t) 1 << status->slot);
+  proc->live_threads--;
+  if (proc->exiting)
+    sema_up (&proc->threads_exited);
+  sema_up (&status->exited);
+  lock_release (&proc->process_lock);
+}
+#endif
+
+/* Stores into *U the resource usage of the running thread, if
+   WHO is RUSAGE_THREAD, or of its process, if RUSAGE_SELF.  The
+   latter includes the threads of the process that have exited,
+   but not those still running besides the caller. */
+void
+process_get_usage (int who, struct rusage *u)
+{
+  struct thread *cur = thread_current ();
+
+  *u = cur->usage;
+#ifdef VM
+  if (who == RUSAGE_SELF)
+    {
+      struct thread *proc = cur->process;
+
+      lock_acquire (&proc->process_lock);
+      if (proc != cur)
+        usage_add (u, &proc->usage);
+      usage_add (u, &proc->exited_usage);
+      lock_release (&proc->process_lock);
+    }
+#else
+  (void) who;
+#endif
+}
+
+/* Prints the resource usage of the running process, which is
+   exiting. */
+void
+process_print_usage (void)
+{
+  struct rusage u;
+
+  process_get_usage (RUSAGE_SELF, &u);
+  printf ("%s: usage: %llu minor/%llu major faults, "
+          "%llu/%llu pages swapped in/out, %llu evicted, "
+          "%llu/%llu bytes read/written, "
+          "%llu/%llu voluntary/involuntary switches, "
+          "%llu/%llu user/kernel ticks\n",
+          thread_name (), u.minor_faults, u.major_faults,
+          u.swap_ins, u.swap_outs, u.evictions, u.read_bytes, u.write_bytes,
+          u.voluntary_switches, u.involuntary_switches,
+          u.user_ticks, u.kernel_ticks);
 }
 
 /* Free the current process's resources. */
@@ -192,28 +975,42 @@ process_exit (void)
 {
     struct thread *cur = thread_current ();
 
-  /* Deal with its parent -- 
-     If its parent is still waiting for it, 
-     remove itself from children list of its parent
-     and stop its parent waiting. */
-  if (cur->parent != NULL)
-  {
-    list_remove(&cur->child_elem);
-    sema_up(&cur->parent->process_wait);
-    // printf("parent %s: child_exit(%d)\n", cur->parent, cur->parent->child_exit_status);
-  }
+  /* Post its exit status to its parent, which may be waiting. */
+  if (cur->child_status != NULL)
+    {
+      cur->child_status->exit_status = cur->exit_status;
+      sema_up (&cur->child_status->exited);
+      release_child_status (cur->child_status);
+      cur->child_status = NULL;
+    }
 
-  /* Deal with its chidren --
-     Stop all its children waiting. */
-  struct list_elem *e;
-  for (e = list_begin (&cur->children); e != list_end (&cur->children);
-     e = list_next (e))
-  {
-    struct thread *tmp = list_entry (e, struct thread, child_elem);
-    sema_up(&tmp->process_wait);
-  }
+  /* Let go of its children's statuses: no one waits for them any
+     more. */
+  if (cur->children != NULL)
+    {
+      hash_destroy (cur->children, release_child_elem);
+      free (cur->children);
+      cur->children = NULL;
+    }
 
 #ifdef VM
+  /* The rest of the process goes with its main thread, after the
+     others. */
+  if (cur->process != cur)
+    {
+      user_thread_exit ();
+      return;
+    }
+  process_stop_threads ();
+
+  /* Its pages go with the SUPT, locked or not. */
+  cur->profil_buf = NULL;
+
+  // Unmap the memory-mapped files first: their modified pages are
+  // written back, instead of being discarded with the SUPT.
+  while (!list_empty (&cur->mmap_list))
+    munmap (list_entry (list_begin (&cur->mmap_list), struct mmap_desc, elem)->id);
+
   // Destroy the SUPT, its all SPTEs, all the frames, and swaps.
   // Important: All the frames held by this thread should ALSO be freed
   // (see the destructor of SPTE). Otherwise an access to frame with
@@ -222,6 +1019,18 @@ process_exit (void)
   cur->supt = NULL;
 #endif
 
+  /* Close its executable file and the runtime's.  With VM, only
+     after their pages are gone: shared frames are identified by
+     the file's inode. */
+  file_close (cur->file);
+  cur->file = NULL;
+  file_close (cur->runtime_file);
+  cur->runtime_file = NULL;
+#ifdef VM
+  file_close (cur->ckpt_file);
+  cur->ckpt_file = NULL;
+#endif
+
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   uint32_t *pd = cur->pagedir;
@@ -236,18 +1045,33 @@ process_exit (void)
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
+      pagedir_clear_page (pd, TIME_PAGE);
       pagedir_destroy (pd);
     }
+#ifdef VM
+  vm_frame_exited (cur);
+#endif
 }
 
 /* Sets up the CPU for running user code in the current
    thread.
-   This function is called on every context switch. */
+   This function is called on every context switch.
+
+   A kernel thread, which has no page directory of its own, keeps
+   running on whichever one is active: the kernel's mappings are
+   the same in all of them, so there is no TLB flush to switch
+   to or away from it.  A process that exits activates the base
+   page directory before freeing its own, so the one borrowed is
+   never freed under a kernel thread.  Kernel threads never enter
+   user mode, so neither do they need the TSS updated. */
 void
 process_activate (void)
 {
   struct thread *t = thread_current ();
 
+  if (t->pagedir == NULL)
+    return;
+
   /* Activate thread's page tables. */
   pagedir_activate (t->pagedir);
 
@@ -319,7 +1143,43 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
+/* A loadable segment of an executable, as load_segment() takes
+   it. */
+struct exec_segment
+  {
+    uint32_t file_page;         /* Page-aligned offset in the file. */
+    uint32_t mem_page;          /* Page-aligned user virtual address. */
+    uint32_t read_bytes;        /* Bytes to read from the file. */
+    uint32_t zero_bytes;        /* Bytes to zero after them. */
+    bool writable;              /* Writable by the process? */
+  };
+
+/* What load() learns from an executable's headers, once they
+   have been read and checked.  It is attached to the
+   executable's inode (see inode_set_aux()), so that executing
+   the same program again, as long as the file has not been
+   written since, reads and checks no headers at all. */
+struct exec_info
+  {
+    Elf32_Addr entry;           /* Entry point. */
+    size_t segment_cnt;         /* Number of loadable segments. */
+    struct exec_segment segments[]; /* The loadable segments. */
+  };
+
+/* Bytes of an executable's segments read ahead by load(): as many
+   sectors as the buffer cache queues for readahead, and half the
+   cache, so that it keeps the sectors of the files in use. */
+#define EXEC_READAHEAD_BYTES (32 * BLOCK_SECTOR_SIZE)
+
+/* The shared runtime (see lib/user/runtime.h), mapped into each
+   process if there is such a file. */
+#define RUNTIME_FILE "/runtime"
+
 static bool setup_stack (void **esp, const char *args);
+static struct exec_info *get_exec_info (struct file *, const char *);
+static struct exec_info *read_exec_info (struct file *, const char *);
+static bool runtime_overlaps (const struct exec_info *);
+static bool load_runtime (void);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
@@ -333,11 +1193,10 @@ bool
 load (const char *args, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_info *info;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
-  int i;
+  size_t i;
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
@@ -350,6 +1209,11 @@ load (const char *args, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
+  /* Map the time page, ahead of the segments so that none can
+     take its place. */
+  if (!pagedir_set_page (t->pagedir, TIME_PAGE, timer_time_page (), false))
+    goto done;
+
   /* Open executable file. */
   const char *file_name = thread_name();
   file = filesys_open (file_name);
@@ -359,6 +1223,224 @@ load (const char *args, void (**eip) (void), void **esp)
       goto done; 
     }
 
+  /* Keep the file as it is while we look at it, and, with VM,
+     while the process runs. */
+  file_deny_write (file);
+
+  info = get_exec_info (file, file_name);
+  if (info == NULL)
+    goto done;
+
+  /* Set up the segments. */
+  for (i = 0; i < info->segment_cnt; i++)
+    {
+      const struct exec_segment *seg = &info->segments[i];
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+#ifdef VM
+      /* The heap starts past the highest segment. */
+      uint8_t *end = (uint8_t *) seg->mem_page + seg->read_bytes
+                     + seg->zero_bytes;
+      if (end > t->heap_start)
+        t->heap_start = t->heap_break = t->heap_mapped = end;
+#endif
+    }
+  if (!load_runtime ())
+    goto done;
+
+#ifdef VM
+  /* The segments are only read as they fault, in the order the
+     program runs.  Start reading their first pages meanwhile, in
+     file order, so that those faults find them in the cache. */
+  off_t readahead = EXEC_READAHEAD_BYTES;
+  for (i = 0; i < info->segment_cnt && readahead > 0; i++)
+    {
+      const struct exec_segment *seg = &info->segments[i];
+      off_t size = seg->read_bytes < (uint32_t) readahead
+                   ? (off_t) seg->read_bytes : readahead;
+      if (size > 0)
+        inode_readahead (file_get_inode (file), size, seg->file_page);
+      readahead -= size;
+    }
+#endif
+
+  /* Set up stack. */
+  if (!setup_stack (esp, args))
+    goto done;
+
+#ifdef VM
+  /* With -mlockall, fault in and lock the segments and the stack,
+     so that the process never waits for a page of its image. */
+  if (vm_mlockall)
+    {
+      bool locked = true;
+      uint8_t *stack = pg_round_down (*esp);
+
+      lock_acquire (&t->supt->lock);
+      for (i = 0; i < info->segment_cnt && locked; i++)
+        {
+          const struct exec_segment *seg = &info->segments[i];
+          locked = vm_supt_lock (t->supt, t->pagedir, (void *) seg->mem_page,
+                                 DIV_ROUND_UP (seg->read_bytes + seg->zero_bytes,
+                                               PGSIZE));
+        }
+      if (locked)
+        locked = vm_supt_lock (t->supt, t->pagedir, stack,
+                               ((uint8_t *) PHYS_BASE - stack) / PGSIZE);
+      lock_release (&t->supt->lock);
+      if (!locked)
+        {
+          printf ("load: %s: cannot lock image in memory\n", file_name);
+          goto done;
+        }
+    }
+#endif
+
+  /* Start address. */
+  *eip = (void (*) (void)) info->entry;
+
+  success = true;
+
+ done:
+  /* We arrive here whether the load is successful or not. */
+#ifdef VM
+  /* The segments are loaded lazily from FILE, so it must stay open
+     while the process runs.  It is closed in exit(). */
+  if (success)
+    t->file = file;
+  else
+#endif
+  file_close (file);
+  return success;
+}
+
+/* load() helpers. */
+
+static bool install_page (void *upage, void *kpage, bool writable);
+
+/* Returns the loadable segments and entry point of executable
+   FILE, named FILE_NAME for error messages, reading its headers
+   unless they are known, or a null pointer if FILE cannot be
+   loaded. */
+static struct exec_info *
+get_exec_info (struct file *file, const char *file_name)
+{
+  struct exec_info *info = inode_get_aux (file_get_inode (file));
+
+  if (info == NULL)
+    {
+      info = read_exec_info (file, file_name);
+      if (info == NULL)
+        return NULL;
+      if (!inode_set_aux (file_get_inode (file), info))
+        {
+          /* Another process got there first. */
+          free (info);
+          info = inode_get_aux (file_get_inode (file));
+        }
+    }
+  return info;
+}
+
+/* Returns true if a page of the segments in INFO is already in
+   use in the current process, and says so. */
+static bool
+runtime_overlaps (const struct exec_info *info)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < info->segment_cnt; i++)
+    {
+      const struct exec_segment *seg = &info->segments[i];
+      uint32_t end = seg->mem_page + seg->read_bytes + seg->zero_bytes;
+      uint32_t page;
+
+      for (page = seg->mem_page; page < end; page += PGSIZE)
+        {
+#ifdef VM
+          bool used = vm_supt_has_entry (t->supt, (void *) page);
+#else
+          bool used = pagedir_get_page (t->pagedir, (void *) page) != NULL;
+#endif
+          if (used)
+            {
+              printf ("load: %s: overlaps %s\n", thread_name (),
+                      RUNTIME_FILE);
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+/* Maps the segments of RUNTIME_FILE into the current process, if
+   there is such a file.  With VM, its text comes in as it faults,
+   into the frames that every other process shares it through
+   (see vm_frame_set_shared()), and its data into private pages.
+   Returns false only if the file is there but cannot be mapped,
+   for example because the executable overlaps it. */
+static bool
+load_runtime (void)
+{
+  struct file *file = filesys_open (RUNTIME_FILE);
+  struct exec_info *info;
+  bool success;
+  size_t i;
+
+  if (file == NULL)
+    return true;
+  file_deny_write (file);
+
+  info = get_exec_info (file, RUNTIME_FILE);
+  success = info != NULL && !runtime_overlaps (info);
+  for (i = 0; success && i < info->segment_cnt; i++)
+    {
+      const struct exec_segment *seg = &info->segments[i];
+      success = load_segment (file, seg->file_page, (void *) seg->mem_page,
+                              seg->read_bytes, seg->zero_bytes,
+                              seg->writable);
+    }
+
+#ifdef VM
+  /* With -mlockall, lock it in memory with the rest of the image. */
+  if (success && vm_mlockall)
+    {
+      struct thread *t = thread_current ();
+
+      lock_acquire (&t->supt->lock);
+      for (i = 0; success && i < info->segment_cnt; i++)
+        {
+          const struct exec_segment *seg = &info->segments[i];
+          success = vm_supt_lock (t->supt, t->pagedir, (void *) seg->mem_page,
+                                  DIV_ROUND_UP (seg->read_bytes
+                                                + seg->zero_bytes, PGSIZE));
+        }
+      lock_release (&t->supt->lock);
+    }
+
+  /* Its pages are loaded lazily, like the executable's, so it
+     stays open until exit(), as do those mapped before a failure. */
+  thread_current ()->runtime_file = file;
+#else
+  file_close (file);
+#endif
+  return success;
+}
+
+/* Reads and checks the headers of executable FILE, named
+   FILE_NAME for error messages.  Returns its loadable segments
+   and entry point, in a block obtained from malloc(), or a null
+   pointer if FILE cannot be loaded. */
+static struct exec_info *
+read_exec_info (struct file *file, const char *file_name)
+{
+  struct Elf32_Ehdr ehdr;
+  struct exec_info *info = NULL;
+  off_t file_ofs;
+  int i;
+
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
@@ -369,9 +1451,15 @@ load (const char *args, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return NULL;
     }
 
+  info = malloc (sizeof *info);
+  if (info == NULL)
+    return NULL;
+  info->entry = ehdr.e_entry;
+  info->segment_cnt = 0;
+
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
@@ -379,11 +1467,11 @@ load (const char *args, void (**eip) (void), void **esp)
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        goto fail;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        goto fail;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -397,58 +1485,53 @@ load (const char *args, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto fail;
         case PT_LOAD:
           if (validate_segment (&phdr, file)) 
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+              struct exec_segment *seg;
+              struct exec_info *bigger;
+
+              bigger = realloc (info, sizeof *info + (info->segment_cnt + 1)
+                                      * sizeof *info->segments);
+              if (bigger == NULL)
+                goto fail;
+              info = bigger;
+              seg = &info->segments[info->segment_cnt++];
+
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz,
+                                               PGSIZE)
+                                     - seg->read_bytes);
                 }
               else 
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz,
+                                              PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            goto fail;
           break;
         }
     }
+  return info;
 
-  /* Set up stack. */
-  if (!setup_stack (esp, args))
-    goto done;
-
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
-
-  success = true;
-
- done:
-  /* We arrive here whether the load is successful or not. */
-  file_close (file);
-  return success;
+ fail:
+  free (info);
+  return NULL;
 }
-
-/* load() helpers. */
-
-static bool install_page (void *upage, void *kpage, bool writable);
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -567,102 +1650,114 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   return true;
 }
 
-/* Used for inserting argument address into list. */
-struct argument_addr
+/* Returns the first word of S, in which words are separated by
+   spaces, storing its length into *LEN, or a null pointer if S
+   has no more words. */
+static const char *
+next_word (const char *s, size_t *len)
 {
-  struct list_elem list_elem;
-  uint32_t addr;
-};
+  while (*s == ' ')
+    s++;
+  *len = strcspn (s, " ");
+  return *len > 0 ? s : NULL;
+}
 
-/* Push one arugment into stack and 
-   push its address into the list.  */
-void push_argument_(void **esp, const char *arg, struct list *list) 
+/* Makes the user stack reach down to BOTTOM, a page address:
+   setup_stack() maps only the top page.  With VM, the pages below
+   it are zero pages that come in when the arguments are written
+   to them. */
+static bool
+extend_stack (uint8_t *bottom)
 {
-  int len = strlen(arg) + 1;
-  *esp -= len;
-
-  struct argument_addr *addr = malloc(sizeof(struct argument_addr));
-  memcpy(*esp, arg, len);
+  uint8_t *upage;
 
-  addr->addr = *esp;
-  // error -- list_push_back(&list, &addr->list_elem);
-  list_push_back(list, &addr->list_elem);
+  for (upage = (uint8_t *) PHYS_BASE - 2 * PGSIZE; upage >= bottom;
+       upage -= PGSIZE)
+    {
+#ifdef VM
+      if (!vm_supt_install_zeropage (thread_current ()->supt, upage))
+        return false;
+#else
+      uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (kpage == NULL)
+        return false;
+      if (!install_page (upage, kpage, true))
+        {
+          palloc_free_page (kpage);
+          return false;
+        }
+#endif
+    }
+  return true;
 }
 
-//  
-/* Push all arguments into stack.
-   The arrangement of stack is as following:
+/* Pushes the program name and the words of ARGS onto the user
+   stack, as the arguments of main(), and stores the resulting
+   stack pointer into *ESP.  The stack is laid out as follows, and
+   computed in advance, so that each string and each argv[]
+   element is written just once, straight to its place:
+
     |  0          | <-- stack pointer
     |  argc       |
     |  argv       |
     |  argv[0]    |
-    |  argv[1]    | 
-    |  argv[2]    |
+    |  argv[1]    |
+    |  ...        |
     |  null       | (sentinel)
-    |  argument2  | 
+    |  (padding)  | to a word boundary
+    |  argument0  | (filename)
     |  argument1  |
-    |  argument0  | (filename)  
-   */
-void push_arguments(void **esp, const char *args) 
+    |  ...        | <-- PHYS_BASE
+
+   Arguments that take more than a page spill onto more stack
+   pages.  Returns false if memory runs out. */
+static bool
+push_arguments (void **esp, const char *args)
 {
-  struct list list;
-  list_init (&list);
+  const char *name = thread_name ();
+  const char *word;
+  size_t len, i;
+  size_t argc = 1;
+  size_t str_size = strlen (name) + 1;
 
-  *esp = PHYS_BASE; 
-  uint32_t arg_num = 1;
+  for (word = args; (word = next_word (word, &len)) != NULL; word += len)
+    {
+      argc++;
+      str_size += len + 1;
+    }
 
-  /* Push filename into stack. */
-  const char *arg = thread_name();
-  push_argument_(esp, arg, &list);
+  char *strs = (char *) PHYS_BASE - str_size;
+  char **argv = (char **) ROUND_DOWN ((uintptr_t) strs, sizeof (char *))
+                - (argc + 1);
+  uint32_t *frame = (uint32_t *) argv - 3;
+  uint32_t top[3] = { 0, argc, (uint32_t) argv };
+  char *null = NULL;
 
-  /* Push other arguments into stack. */
-  char *token, *save_ptr;
-  for (token = strtok_r(args, " ", &save_ptr); 
-    token != NULL;
-    token = strtok_r(NULL, " ", &save_ptr))
-  {
-    arg_num += 1;
-    push_argument_(esp, token, &list);
-  }
-
-  /* Set alignment. */
-  int total = PHYS_BASE - *esp;
-  *esp = *esp - (4 - total % 4) - 4;
-
-  /* Push a null pointer sentinel. */
-  *esp -= 4;
-  // error : * (uint32_t *) esp = (uint32_t) NULL;
-  * (uint32_t *) *esp = (uint32_t) NULL;
-
-  /* Push all the addresses of arguments into stack. 
-     The addresses are popped out from list. */
-  while (!list_empty(&list)) {
-    struct argument_addr *addr = 
-      list_entry(list_pop_back(&list), struct argument_addr, list_elem);
-    *esp -= 4;
-    * (uint32_t *) *esp = addr->addr;
-    // hex_dump(*esp, *esp, 64, true);
-    // printf("%x\n", addr->addr);
-  }
-
-  /* Push argv -- the first argument address. */
-  *esp -= 4;
-  * (uint32_t *) *esp = (uint32_t *)(*esp + 4);
-
-  /* Push argc -- the total number of arguments. */
-  *esp -= 4;
-  * (uint32_t *) *esp = arg_num;
-
-  /* Push 0 as a fake return address. */
-  *esp -= 4;
-  * (uint32_t *) *esp = 0x0;
-
-  // hex_dump(*esp, *esp, 64, true);
-  // hex_dump(PHYS_BASE - 64, PHYS_BASE - 64, 64, true);
+  if (!extend_stack (pg_round_down (frame)))
+    return false;
+
+  /* The strings and argv[], in one pass. */
+  len = strlen (name);
+  word = name;
+  for (i = 0; i < argc; i++)
+    {
+      if (!copy_to_user (strs, word, len)
+          || !copy_to_user (strs + len, "", 1)
+          || !copy_to_user (&argv[i], &strs, sizeof strs))
+        return false;
+      strs += len + 1;
+      word = next_word (i == 0 ? args : word + len, &len);
+    }
+  if (!copy_to_user (&argv[argc], &null, sizeof null)
+      || !copy_to_user (frame, top, sizeof top))
+    return false;
+
+  *esp = frame;
+  return true;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory, and push the arguments onto it. */
 static bool
 setup_stack (void **esp, const char *args) 
 {
@@ -674,16 +1769,7 @@ setup_stack (void **esp, const char *args)
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
       if (success) 
-      {
-        *esp = PHYS_BASE;
-
-        //  
-        push_arguments(esp, args);
-        // hex_dump(0, PHYS_BASE - 12, 64, true);
-        // printf("%x\n", PHYS_BASE - 12);
-        //  
-      }
-        
+        success = push_arguments (esp, args);
       else
         palloc_free_page (kpage);
     }
@@ -3,10 +3,29 @@
 
 #include "threads/thread.h"
 
+/* Most the user stack may grow to, below PHYS_BASE. */
+#define MAX_STACK_SIZE 0x80000
+
+/* Stacks of the other threads of a process, in THREAD_MAX slots
+   of THREAD_STACK_SIZE below the main thread's.  They do not
+   grow: the lowest page of each slot is left unmapped, so that an
+   overflow faults instead of running into the next. */
+#define THREAD_STACK_SIZE 0x10000
+#define THREAD_MAX 32
+#define THREAD_STACKS_SIZE (THREAD_STACK_SIZE * THREAD_MAX)
+
+void process_init (void);
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (const char *file_name);
 int process_wait (tid_t);
+int process_load_status (tid_t);
 void process_exit (void);
 void process_activate (void);
+void process_get_usage (int who, struct rusage *);
+void process_print_usage (void);
+
+/* Print each process's resource usage as it exits? */
+extern bool process_usage_on_exit;
 
 #ifdef VM
 typedef int mmapid_t;
@@ -18,7 +37,19 @@ struct mmap_desc {
 
   void *addr;   // where it is mapped to? store the user virtual address
   size_t size;  // file size
+  struct vm_shm *shm;  // shared-memory object instead of file, or NULL
 };
+
+tid_t process_fork (void);
+tid_t process_thread_create (void (*eip) (void), uint32_t eax, uint32_t edx);
+int process_thread_join (tid_t);
+void process_stop_threads (void);
+void process_poll_exit (void);
+void process_kill (struct thread *);
+bool process_block (void);
+void process_unblock (void);
+bool process_profil (void *buf, size_t size, uintptr_t offset, unsigned scale);
+void process_profil_tick (uintptr_t eip);
 #endif
 
 #endif /* userprog/process.h */
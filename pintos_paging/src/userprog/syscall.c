@@ -1,40 +1,61 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include "userprog/tss.h"
 #include <stdio.h>
 #include <syscall-nr.h>
+#include <bitmap.h>
 #include <stdlib.h>
+#include <string.h>
+#include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/tunable.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "devices/shutdown.h"
 #include "devices/block.h"
-
-
-const int MIN_FILENAME = 1;
-const int MAX_FILENAME = 14;
+#include "devices/input.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/pipe.h"
+#include "userprog/process.h"
+#ifdef VM
+#include <round.h>
+#include "userprog/futex.h"
+#include "vm/checkpoint.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
+#endif
+
+
+/* Shortest and longest file names accepted. */
+#define MIN_FILENAME 1
+#define MAX_FILENAME 14
 
 typedef int pid_t;
 
-struct file_descriptor
-{
-  int fd;
-  struct file *file;
-  struct list_elem elem;
-
-};
-
-static struct lock filesys_lock; 
+/* Number of fds a process's fd table starts with. */
+#define FD_TABLE_MIN 16
 
 // helper function
-bool is_valid_ptr(const void *ptr);
-bool is_valid_filename(const void *file);
+static bool copy_in_filename(char *kfile, const char *ufile);
+#ifndef VM
+static bool probe_user(const void *uaddr, size_t size, bool write);
+#endif
 
-static void syscall_handler (struct intr_frame *);
 
 static void halt(void);
 
-static pid_t exec(const char *cmd_line);
+static pid_t exec(const char *cmd_line, bool wait_load);
 static int wait(pid_t pid);
 
 static bool create(const char *file, unsigned initial_size);
@@ -42,6 +63,10 @@ static bool remove(const char *file);
 
 static int open(const char *file);
 static void close(int fd);
+static void close_fds(void);
+static bool grow_fd_table(void);
+static bool inherit_fds(struct thread *parent, bool fork);
+static int pipe(int *fds);
 
 static filesize(int fd);
 static int read(int fd, void *buffer, unsigned size);
@@ -50,459 +75,2259 @@ static int write(int fd, const void *buffer, unsigned size);
 static void seek(int fd, unsigned position);
 static unsigned tell(int fd);
 
-void
-syscall_init (void) 
+static int pread(int fd, void *buffer, unsigned size, unsigned offset);
+static int pwrite(int fd, const void *buffer, unsigned size, unsigned offset);
+
+static int transfer_iov(int fd, const struct iovec *iov, int iovcnt, bool write);
+static int copy_file_range(int fd_in, int fd_out, unsigned size);
+static int fsync(int fd);
+static void sync(void);
+static int fallocate(int fd, unsigned length);
+static void fsstats(struct fs_stats *stats);
+static int blkstats(int index, struct block_stats *stats);
+static int lockstats(int index, struct lock_stats *stats);
+static void clock_ns(int64_t *ns);
+static void memstats(struct mem_stats *stats);
+static int io_setup(struct io_ring *ring);
+static int io_enter(unsigned to_submit);
+static void count_io(bool write, int bytes);
+static int getrusage(int who, struct rusage *usage);
+static int schedstats(struct sched_stats *stats);
+static void bootstats(struct boot_stats *stats);
+static int intrstats(int vec, struct intr_stats *stats);
+static int tunable_get(int index, struct tunable_info *info);
+static int tunable_set(const struct tunable_info *info);
+static int getdents(unsigned *upos, struct dirent *ubuf, unsigned size);
+
+#ifdef VM
+static mmapid_t mmap(int fd, void *addr);
+static mmapid_t shm_map(const char *name, size_t size, void *addr);
+static mmapid_t add_mapping(struct thread *cur, struct mmap_desc *mmap_d);
+static int madvise(void *addr, size_t length, int advice);
+static int mlock(void *addr, size_t length, bool lock);
+static bool swapon(const char *ufile, int priority);
+static int checkpoint(const char *ufile);
+static void wsstats(struct ws_stats *stats);
+static void *sbrk(intptr_t increment);
+static void *move_break(struct thread *cur, intptr_t increment);
+#endif
+
+/* System call handlers, one per system call number.  Each takes
+   the call's argument words, already copied from the user stack,
+   and returns the value for the caller's EAX. */
+typedef uint32_t syscall_func(const uint32_t *args);
+
+static uint32_t
+sys_halt(const uint32_t *args UNUSED)
 {
-  intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
+  halt();
+  NOT_REACHED();
 }
 
-static void
-syscall_handler (struct intr_frame *f) 
+static uint32_t
+sys_exit(const uint32_t *args)
 {
-  // printf("%04x\n", f->cs);
-  uint32_t *esp = f->esp;
-  uint32_t *argv0 = esp + 1;
-  uint32_t *argv1 = esp + 2;
-  uint32_t *argv2 = esp + 3;
-
-  if (!is_valid_ptr(esp) || !is_valid_ptr(argv0) 
-    || !is_valid_ptr(argv1) || !is_valid_ptr(argv2)) 
-  {
-    exit(-1);
-  }
+  exit(args[0]);
+  NOT_REACHED();
+}
 
-  uint32_t syscall_num = *esp;
-  // printf("System call : %d\n", syscall_num);
-  // printf("System call : %x\n", esp);
-  // printf("argv number : %d\n", *(esp + 5));
-  // hex_dump(esp, esp, 64, true);
-  switch (syscall_num) 
-  {
-  	case SYS_HALT:
-      halt();
-  		break;
-  	case SYS_EXIT:
-      exit(*argv0);
-  		break;
-  	case SYS_EXEC:
-      f->eax = exec((char *)*argv0);
-  		break;
-  	case SYS_WAIT:
-      f->eax = wait(*argv0);
-  		break;
-  	case SYS_CREATE:
-      f->eax = create((char *)*argv0, *argv1);
-  		break;
-  	case SYS_REMOVE:
-      f->eax = remove((char *)*argv0);
-  		break;
-  	case SYS_OPEN:
-      f->eax = open((char *)*argv0);
-  		break;
-  	case SYS_FILESIZE:
-      f->eax = filesize(*argv0);
-  		break;
-  	case SYS_READ:
-      f->eax = read(*argv0, (void *)*argv1, *argv2);
-  		break;
-  	case SYS_WRITE:
-  		f->eax = write(*argv0, (void *)*argv1, *argv2);
-  		break;
-  	case SYS_SEEK:
-      seek(*argv0, *argv1);
-  		break;
-  	case SYS_TELL:
-      f->eax = tell(*argv0);
-  		break;
-  	case SYS_CLOSE:
-      close(*argv0);
-  		break; 
-  	default:
-  		break; 		  	
-  }
-  // thread_exit ();
-  // hex_dump(f->eip, f->eip, 64, true);
-}
-
-/* Check whether *ptr is valid -- 
-   1. ptr shouldn't be a null pointer;
-   2. ptr should point to user memory;
-   3. ptr shouldn't point to unmapped virtual memory.*/
-bool 
-is_valid_ptr(const void *ptr) 
-{
-  if (ptr == NULL 
-    || !is_user_vaddr(ptr) 
-    || pagedir_get_page(thread_current()->pagedir, ptr) == NULL)
-    return false;
+static uint32_t
+sys_exec(const uint32_t *args)
+{
+  return exec((const char *) args[0], true);
+}
 
-  return true;
+static uint32_t
+sys_spawn(const uint32_t *args)
+{
+  return exec((const char *) args[0], false);
 }
 
-/* Check whether *file is a valid filename. */
-bool 
-is_valid_filename(const void *file)
+static uint32_t
+sys_wait(const uint32_t *args)
 {
-  if (!is_valid_ptr(file)) 
-    exit(-1);
+  return wait(args[0]);
+}
 
-  int len = strlen(file);
-  return len >= MIN_FILENAME && len <= MAX_FILENAME;
+static uint32_t
+sys_load_status(const uint32_t *args)
+{
+  return process_load_status(args[0]);
 }
 
-struct file_descriptor *
-get_openfile(int fd)
+static uint32_t
+sys_sched_group(const uint32_t *args)
 {
-  struct list *list = &thread_current()->open_fd;
-  for (struct list_elem *e = list_begin (list); 
-                          e != list_end (list); 
-                          e = list_next (e))
-  {
-    struct file_descriptor *f = 
-        list_entry(e, struct file_descriptor, elem);
-    if (f->fd == fd)
-      return f;
-    else if (f->fd > fd)
-      return NULL;
-  }
-  return NULL;
+  return thread_new_group(args[0]);
 }
 
-void 
-close_openfile(int fd)
+static uint32_t
+sys_create(const uint32_t *args)
 {
-  struct list *list = &thread_current()->open_fd;
-  for (struct list_elem *e = list_begin (list); 
-                          e != list_end (list); 
-                          e = list_next (e))
-  {
-    struct file_descriptor *f = 
-        list_entry(e, struct file_descriptor, elem);
-    if (f->fd == fd)
-    { 
-      list_remove(e);
-      file_close(f->file);
-      free(f);
-      return;
-    }
-    else if (f->fd > fd)
-      return ;
-  }
-  return ;
+  return create((const char *) args[0], args[1]);
 }
 
-/* Terminates Pintos. */
-static void 
-halt(void) 
+static uint32_t
+sys_remove(const uint32_t *args)
 {
-  shutdown_power_off();
+  return remove((const char *) args[0]);
 }
 
-/* Terminates the current user program.
+static uint32_t
+sys_open(const uint32_t *args)
+{
+  return open((const char *) args[0]);
+}
 
-   Returning status to the kernel. 
-   status = 0 -- success
-   status = nonzero -- error */
-void 
-exit(int status)
+static uint32_t
+sys_filesize(const uint32_t *args)
 {
-  struct thread *cur = thread_current();
+  return filesize(args[0]);
+}
 
-  printf("%s: exit(%d)\n", cur->name, status);
+static uint32_t
+sys_seek(const uint32_t *args)
+{
+  seek(args[0], args[1]);
+  return 0;
+}
 
-    /* If its parent is still waiting for it, 
-     tell its parent its exit status. */
-  if (cur->parent != NULL)
-  {
-    cur->parent->child_exit_status = status;
-    // printf("parent %s: child_exit(%d)\n", cur->parent->name, cur->parent->child_exit_status);
-  }
+static uint32_t
+sys_tell(const uint32_t *args)
+{
+  return tell(args[0]);
+}
 
-  /* Close all the files it's opened. */
-  // mmb -- the key to multi-oom
-  while (!list_empty(&cur->open_fd)) 
-  {
-    close(list_entry(list_begin(&cur->open_fd), struct file_descriptor, elem)->fd);  
-  }
+static uint32_t
+sys_close(const uint32_t *args)
+{
+  close(args[0]);
+  return 0;
+}
 
-  /* Close its executable file. */
-  file_close(cur->file);
-  //  
+static uint32_t
+sys_pipe(const uint32_t *args)
+{
+  return pipe((int *) args[0]);
+}
 
-  thread_exit();
+static uint32_t
+sys_copy_file_range(const uint32_t *args)
+{
+  return copy_file_range(args[0], args[1], args[2]);
 }
 
-/* Run the executable whose name is given in cmd_line, 
-   passing any given arguments.
+static uint32_t
+sys_fsync(const uint32_t *args)
+{
+  return fsync(args[0]);
+}
 
-   Return the new process's program id(pid). 
-   Must return pid -1, which otherwise should not be a valid pid,
-   if the program cannot load or run for any reason.*/
-static pid_t 
-exec(const char *cmd_line)
-{  
-  // printf("exec %s\n", cmd_line);
+static uint32_t
+sys_sync(const uint32_t *args UNUSED)
+{
+  sync();
+  return 0;
+}
 
-  if (!is_valid_ptr(cmd_line))
-    exit(-1);
+static uint32_t
+sys_fallocate(const uint32_t *args)
+{
+  return fallocate(args[0], args[1]);
+}
 
-  // for (char *p = cmd_line; *p != '\0'; p++)
-  //   if (!is_valid_ptr(p + 1))
-  //     exit(-1);
+static uint32_t
+sys_fsstats(const uint32_t *args)
+{
+  fsstats((struct fs_stats *) args[0]);
+  return 0;
+}
 
-  lock_acquire(&filesys_lock);
-  tid_t tid = process_execute(cmd_line);
-  lock_release(&filesys_lock);
-  
-  return tid;
+static uint32_t
+sys_blkstats(const uint32_t *args)
+{
+  return blkstats(args[0], (struct block_stats *) args[1]);
 }
 
-/* Wait for a child process pid. 
-   If pid still alive, wait until it terminate.
-   
-   Return the child's exit status.*/
-static int 
-wait(pid_t pid)
+static uint32_t
+sys_getrusage(const uint32_t *args)
 {
-  return process_wait(pid);
+  return getrusage(args[0], (struct rusage *) args[1]);
 }
 
-/* Create a new file called *file that has intial_size size.   
-   Return true if successful, false otherwise. */
-static bool 
-create(const char *file, unsigned initial_size)
+static uint32_t
+sys_schedstats(const uint32_t *args)
 {
-  if (!is_valid_filename(file))
-    return false;
+  return schedstats((struct sched_stats *) args[0]);
+}
 
-  lock_acquire(&filesys_lock);
-  // bool status = filesys_create(file, initial_size);
-  // status goes wrong !!! I don't know why ... 
+static uint32_t
+sys_bootstats(const uint32_t *args)
+{
+  bootstats((struct boot_stats *) args[0]);
+  return 0;
+}
 
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, file, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+static uint32_t
+sys_intrstats(const uint32_t *args)
+{
+  return intrstats(args[0], (struct intr_stats *) args[1]);
+}
 
-  lock_release(&filesys_lock);
+static uint32_t
+sys_getdents(const uint32_t *args)
+{
+  return getdents((unsigned *) args[0], (struct dirent *) args[1], args[2]);
+}
 
-  return success;
-  // return status;
+static uint32_t
+sys_tunable_get(const uint32_t *args)
+{
+  return tunable_get(args[0], (struct tunable_info *) args[1]);
 }
 
-/* Delete the file called *file.
-   Return true if successful, false otherwise. */
-static bool 
-remove(const char *file)
+static uint32_t
+sys_tunable_set(const uint32_t *args)
 {
-  if (!is_valid_filename(file))
-    return false;
+  return tunable_set((const struct tunable_info *) args[0]);
+}
 
-  bool status;
+static uint32_t
+sys_lockstats(const uint32_t *args)
+{
+  return lockstats(args[0], (struct lock_stats *) args[1]);
+}
 
-  lock_acquire(&filesys_lock);
-  status = filesys_remove(file);
-  lock_release(&filesys_lock);
+static uint32_t
+sys_clock(const uint32_t *args)
+{
+  clock_ns((int64_t *) args[0]);
+  return 0;
+}
 
-  return status;
+static uint32_t
+sys_usleep(const uint32_t *args)
+{
+  timer_usleep(args[0]);
+  return 0;
 }
 
-/* Assign unique fd to a file.
-   Return fd.
-   This function needs modification -- Overflow 
-   -- new fd is max(fd in open_fd list) + 1.
-   What if open a large number of files 
-   and some low-value fd is closed ? */
-int 
-assign_fd() 
+static uint32_t
+sys_memstats(const uint32_t *args)
 {
-  struct list *list = &thread_current()->open_fd;
-  if (list_empty(list)) 
-    return 2; 
-  else
-  {
-    struct file_descriptor *f = 
-        list_entry(list_back(list), struct file_descriptor, elem);
-    // printf("fd : %d\n", f->fd);
-        // assume there are sufficient fd space
-    return f->fd + 1;
-  }
+  memstats((struct mem_stats *) args[0]);
+  return 0;
 }
 
-/* Compare fd values as list_elem.
-   Return true if fd(a) < fd(b), otherwise false. */
-bool 
-cmp_fd(const struct list_elem *a, const struct list_elem *b, void *aux)
+static uint32_t
+sys_io_setup(const uint32_t *args)
 {
-  struct file_descriptor *left = list_entry(a, struct file_descriptor, elem);
-  struct file_descriptor *right = list_entry(b, struct file_descriptor, elem);
-  return left->fd < right->fd;
+  return io_setup((struct io_ring *) args[0]);
 }
 
-/* Open the file called *file, assign the opened file a fd 
-   and the current process should keep track of it in open_fd list.
+static uint32_t
+sys_io_enter(const uint32_t *args)
+{
+  return io_enter(args[0]);
+}
 
-   Return fd if the file can be opend, otherwise -1.*/
-static int 
-open(const char *file)
+/* The calls that move data also count themselves. */
+static uint32_t
+sys_read(const uint32_t *args)
 {
-  // printf("hahaha\n");
-  int fd = -1;
+  int n = read(args[0], (void *) args[1], args[2]);
+  count_io(false, n);
+  return n;
+}
 
-  if (!is_valid_filename(file))
-    return fd;
+static uint32_t
+sys_write(const uint32_t *args)
+{
+  int n = write(args[0], (const void *) args[1], args[2]);
+  count_io(true, n);
+  return n;
+}
 
-  lock_acquire(&filesys_lock);
-  struct list *list = &thread_current()->open_fd;
-  struct file *file_struct = filesys_open(file);
-  if (file_struct != NULL) 
-  {
-    struct file_descriptor *tmp = malloc(sizeof(struct file_descriptor));    
-    tmp->fd = assign_fd();
-    tmp->file = file_struct;
-    // tmp->tid = thread_current()->tid;
-    fd = tmp->fd;
-    list_insert_ordered(list, &tmp->elem, (list_less_func *)cmp_fd, NULL);
-  }
-  lock_release(&filesys_lock);
+static uint32_t
+sys_pread(const uint32_t *args)
+{
+  int n = pread(args[0], (void *) args[1], args[2], args[3]);
+  count_io(false, n);
+  return n;
+}
 
-  // printf("open %d\n", fd);
-  return fd;
+static uint32_t
+sys_pwrite(const uint32_t *args)
+{
+  int n = pwrite(args[0], (const void *) args[1], args[2], args[3]);
+  count_io(true, n);
+  return n;
 }
 
-/* Close file of fd. */
-static void 
-close(int fd)
+static uint32_t
+sys_readv(const uint32_t *args)
 {
-  lock_acquire(&filesys_lock);
-  close_openfile(fd);
-  lock_release(&filesys_lock);
+  int n = transfer_iov(args[0], (const struct iovec *) args[1], args[2], false);
+  count_io(false, n);
+  return n;
+}
 
+static uint32_t
+sys_writev(const uint32_t *args)
+{
+  int n = transfer_iov(args[0], (const struct iovec *) args[1], args[2], true);
+  count_io(true, n);
+  return n;
 }
 
-/* Get the size of fd file.
-   Return its size. */
-static int
-filesize(int fd)
+#ifdef VM
+static uint32_t
+sys_mmap(const uint32_t *args)
 {
-  int size = -1;
+  return mmap(args[0], (void *) args[1]);
+}
 
-  lock_acquire(&filesys_lock);
+static uint32_t
+sys_shm_map(const uint32_t *args)
+{
+  return shm_map((const char *) args[0], args[1], (void *) args[2]);
+}
 
-  struct file_descriptor *file_descriptor = get_openfile(fd);
-    if (file_descriptor != NULL)
-      size = file_length(file_descriptor->file);
+static uint32_t
+sys_munmap(const uint32_t *args)
+{
+  munmap(args[0]);
+  return 0;
+}
 
-  lock_release(&filesys_lock);
-  
-  return size;
+static uint32_t
+sys_madvise(const uint32_t *args)
+{
+  return madvise((void *) args[0], args[1], args[2]);
 }
 
-/* Read size bytes from fd into buffer.
-   Return the number of bytes actully read. 
-   Fd 0 -- read from the keyboard. */
-static int 
-read(int fd, void *buffer, unsigned size)
+static uint32_t
+sys_mlock(const uint32_t *args)
 {
-  // printf("reading\n");
-  int status = -1;
+  return mlock((void *) args[0], args[1], true);
+}
 
-  if (!is_valid_ptr(buffer) || !is_valid_ptr(buffer + size - 1)) 
-    exit(-1);
+static uint32_t
+sys_munlock(const uint32_t *args)
+{
+  return mlock((void *) args[0], args[1], false);
+}
 
-  lock_acquire(&filesys_lock);
-  if (fd == STDIN_FILENO) /* Fead from the keyboard.*/
-  {
-    uint8_t *p = buffer;
-    uint8_t c;
-    unsigned counter = 0;
-    while (counter < size && (c = input_getc()) != 0)
-    {
-      *p = c;
-      p++;
-      counter++;
-    }
-    *p = 0;
-    status = size - counter;
+static uint32_t
+sys_sbrk(const uint32_t *args)
+{
+  return (uint32_t) sbrk(args[0]);
+}
 
-  } else if (fd != STDOUT_FILENO)
-  { 
-    struct file_descriptor *file_descriptor = get_openfile(fd);
-    if (file_descriptor != NULL)
-      status = file_read(file_descriptor->file, buffer, size);
-  }
+static uint32_t
+sys_fork(const uint32_t *args UNUSED)
+{
+  return process_fork();
+}
 
-  lock_release(&filesys_lock);
+static uint32_t
+sys_swapon(const uint32_t *args)
+{
+  return swapon((const char *) args[0], args[1]);
+}
 
-  // printf("read %d\n", fd);
-  return status;
+static uint32_t
+sys_wsstats(const uint32_t *args)
+{
+  wsstats((struct ws_stats *) args[0]);
+  return 0;
 }
 
-/* Write size bytes from buffer to fd.
-   Return the number of bytes actually written.
-   Fd 1 -- write to the console*/
-static int
-write(int fd, const void *buffer, unsigned size) 
+static uint32_t
+sys_profil(const uint32_t *args)
 {
-  int status = 0;
+  return process_profil((void *) args[0], args[1], args[2], args[3]) ? 0 : -1;
+}
 
-  if (buffer == NULL || !is_valid_ptr(buffer) || !is_valid_ptr(buffer + size - 1)) 
-    exit(-1);
+static uint32_t
+sys_checkpoint(const uint32_t *args)
+{
+  return checkpoint((const char *) args[0]);
+}
 
-  lock_acquire(&filesys_lock);
-	if (fd == STDOUT_FILENO) /* Write to the console.*/
-	{
-		putbuf(buffer, size);
-		// hex_dump(buffer, buffer, 64, true);
-		status = size;
-	} else if (fd != STDIN_FILENO) 
-  {
-    struct file_descriptor *file_descriptor = get_openfile(fd);
-    // printf("file %d\n", file_descriptor->file->deny_write);
-    if (file_descriptor != NULL)
-      status = file_write(file_descriptor->file, buffer, size);
-  }
+static uint32_t
+sys_thread_create(const uint32_t *args)
+{
+  return process_thread_create((void (*) (void)) args[0], args[1], args[2]);
+}
 
-  lock_release(&filesys_lock);
+static uint32_t
+sys_thread_join(const uint32_t *args)
+{
+  return process_thread_join(args[0]);
+}
 
-  // printf("write %d %d\n", fd, status);
-  return status;
+/* The main thread ends the whole process. */
+static uint32_t
+sys_thread_exit(const uint32_t *args UNUSED)
+{
+  if (thread_current()->process == thread_current())
+    exit(0);
+  thread_exit();
 }
 
-/* Change the next byte to be read/written in open fd to position,
-   expressed in bytes from the beginning of the file. */
-static void 
-seek(int fd, unsigned position)
+static uint32_t
+sys_futex_wait(const uint32_t *args)
 {
-  lock_acquire(&filesys_lock);
-  struct file_descriptor *file_descriptor = get_openfile(fd);
-    if (file_descriptor != NULL)
-      file_seek(file_descriptor->file, position);
-  lock_release(&filesys_lock);
+  return futex_wait((int *) args[0], args[1]);
+}
 
-  return ;
+static uint32_t
+sys_futex_wake(const uint32_t *args)
+{
+  return futex_wake((int *) args[0], args[1]);
 }
+#endif
 
-/* Get the position of the next byte te be read/writen in open fd,
-   expressed in bytes from the beginning of the file.*/
-static unsigned 
-tell(int fd)
+/* Describes a system call. */
+struct syscall_desc
 {
-  int status = -1;
+  syscall_func *func;           /* Handler, or null if not implemented. */
+  uint8_t arg_cnt;              /* Number of argument words. */
+  uint8_t ptr_args;             /* Bit i set if argument i is a pointer
+                                   the call dereferences. */
+};
+
+/* Argument i is a pointer, for syscall_desc's ptr_args. */
+#define PTR(I) (1u << (I))
+
+/* System calls, indexed by number.  A call's argument words follow
+   its number on the user stack. */
+static const struct syscall_desc syscall_table[] =
+  {
+    [SYS_HALT]            = { sys_halt, 0, 0 },
+    [SYS_EXIT]            = { sys_exit, 1, 0 },
+    [SYS_EXEC]            = { sys_exec, 1, PTR(0) },
+    [SYS_WAIT]            = { sys_wait, 1, 0 },
+    [SYS_CREATE]          = { sys_create, 2, PTR(0) },
+    [SYS_REMOVE]          = { sys_remove, 1, PTR(0) },
+    [SYS_OPEN]            = { sys_open, 1, PTR(0) },
+    [SYS_FILESIZE]        = { sys_filesize, 1, 0 },
+    [SYS_READ]            = { sys_read, 3, PTR(1) },
+    [SYS_WRITE]           = { sys_write, 3, PTR(1) },
+    [SYS_SEEK]            = { sys_seek, 2, 0 },
+    [SYS_TELL]            = { sys_tell, 1, 0 },
+    [SYS_CLOSE]           = { sys_close, 1, 0 },
+#ifdef VM
+    [SYS_MMAP]            = { sys_mmap, 2, 0 },
+    [SYS_MUNMAP]          = { sys_munmap, 1, 0 },
+    [SYS_MADVISE]         = { sys_madvise, 3, 0 },
+#endif
+    [SYS_PREAD]           = { sys_pread, 4, PTR(1) },
+    [SYS_PWRITE]          = { sys_pwrite, 4, PTR(1) },
+    [SYS_READV]           = { sys_readv, 3, PTR(1) },
+    [SYS_WRITEV]          = { sys_writev, 3, PTR(1) },
+    [SYS_COPY_FILE_RANGE] = { sys_copy_file_range, 3, 0 },
+    [SYS_FSYNC]           = { sys_fsync, 1, 0 },
+    [SYS_SYNC]            = { sys_sync, 0, 0 },
+    [SYS_FALLOCATE]       = { sys_fallocate, 2, 0 },
+    [SYS_FSSTATS]         = { sys_fsstats, 1, PTR(0) },
+    [SYS_BLKSTATS]        = { sys_blkstats, 2, PTR(1) },
+    [SYS_CLOCK]           = { sys_clock, 1, PTR(0) },
+    [SYS_USLEEP]          = { sys_usleep, 1, 0 },
+    [SYS_MEMSTATS]        = { sys_memstats, 1, PTR(0) },
+    [SYS_IO_SETUP]        = { sys_io_setup, 1, 0 },
+    [SYS_IO_ENTER]        = { sys_io_enter, 1, 0 },
+    [SYS_PIPE]            = { sys_pipe, 1, PTR(0) },
+    [SYS_LOCKSTATS]       = { sys_lockstats, 2, PTR(1) },
+    [SYS_GETRUSAGE]       = { sys_getrusage, 2, PTR(1) },
+    [SYS_SCHEDSTATS]      = { sys_schedstats, 1, PTR(0) },
+    [SYS_BOOTSTATS]       = { sys_bootstats, 1, PTR(0) },
+    [SYS_INTRSTATS]       = { sys_intrstats, 2, PTR(1) },
+    [SYS_TUNABLE_GET]     = { sys_tunable_get, 2, PTR(1) },
+    [SYS_TUNABLE_SET]     = { sys_tunable_set, 1, PTR(0) },
+    [SYS_GETDENTS]        = { sys_getdents, 3, PTR(0) | PTR(1) },
+    [SYS_SPAWN]           = { sys_spawn, 1, PTR(0) },
+    [SYS_LOAD_STATUS]     = { sys_load_status, 1, 0 },
+    [SYS_SCHED_GROUP]     = { sys_sched_group, 1, 0 },
+#ifdef VM
+    [SYS_SBRK]            = { sys_sbrk, 1, 0 },
+    [SYS_THREAD_CREATE]   = { sys_thread_create, 3, PTR(0) },
+    [SYS_THREAD_JOIN]     = { sys_thread_join, 1, 0 },
+    [SYS_THREAD_EXIT]     = { sys_thread_exit, 0, 0 },
+    [SYS_FUTEX_WAIT]      = { sys_futex_wait, 2, 0 },
+    [SYS_FUTEX_WAKE]      = { sys_futex_wake, 2, 0 },
+    [SYS_SHM_MAP]         = { sys_shm_map, 3, PTR(0) },
+    [SYS_MLOCK]           = { sys_mlock, 2, 0 },
+    [SYS_MUNLOCK]         = { sys_munlock, 2, 0 },
+    [SYS_FORK]            = { sys_fork, 0, 0 },
+    [SYS_SWAPON]          = { sys_swapon, 2, PTR(0) },
+    [SYS_WSSTATS]         = { sys_wsstats, 1, PTR(0) },
+    [SYS_PROFIL]          = { sys_profil, 4, 0 },
+    [SYS_CHECKPOINT]      = { sys_checkpoint, 1, PTR(0) },
+#endif
+  };
+
+/* Most argument words any system call takes. */
+#define SYSCALL_ARGS_MAX 4
 
-  lock_acquire(&filesys_lock);
+void
+syscall_init (void) 
+{
+  extern void sysenter_entry (void);
+
+  intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  tss_init_sysenter (sysenter_entry);
+#ifdef VM
+  futex_init ();
+#endif
+}
 
-  struct file_descriptor *file_descriptor = get_openfile(fd);
-    if (file_descriptor != NULL)
-      status = file_tell(file_descriptor->file);
+/* Handles a system call made with "int $0x30" or, through
+   sysenter_entry, with SYSENTER. */
+void
+syscall_handler (struct intr_frame *f) 
+{
+  uint32_t *esp = f->esp;
+  uint32_t syscall_num;
+  uint32_t args[SYSCALL_ARGS_MAX];
+  const struct syscall_desc *d;
+  unsigned i;
+
+  /* Remember where the user stack is, in case the kernel faults
+     on it (see page_fault()). */
+  thread_current()->current_esp = f->esp;
+#ifdef VM
+  process_poll_exit();
+#endif
+
+  if (!copy_from_user(&syscall_num, esp, sizeof syscall_num))
+    exit(-1);
+  // printf("System call : %d\n", syscall_num);
+  if (syscall_num >= sizeof syscall_table / sizeof *syscall_table
+      || syscall_table[syscall_num].func == NULL)
+    return;
+  d = &syscall_table[syscall_num];
+
+  /* Fetch exactly the arguments the call takes, in one copy, and
+     reject at once pointers into the kernel.  The memory they
+     point to is checked as the call uses it. */
+  ASSERT (d->arg_cnt <= SYSCALL_ARGS_MAX);
+  if (!copy_from_user(args, esp + 1, d->arg_cnt * sizeof *args))
+    exit(-1);
+  for (i = 0; i < d->arg_cnt; i++)
+    if ((d->ptr_args & PTR(i)) && !is_user_vaddr((void *) args[i]))
+      exit(-1);
+
+  f->eax = d->func(args);
+#ifdef VM
+  process_poll_exit();
+#endif
+}
 
-  lock_release(&filesys_lock);
+/* User memory access.
+
+   User pointers are not looked up in the page table before use.
+   The kernel accesses user memory only through the functions
+   below, which check just that the addresses are below PHYS_BASE
+   and then go ahead.  If an access faults, page_fault() brings
+   the page in as it would for the user program itself; if it
+   cannot, it resumes the kernel at the address that these
+   functions leave in EAX, with EAX set to -1 (0xffffffff).  A
+   valid pointer thus costs nothing to check, and a buffer may
+   come and go from memory in the middle of a copy. */
+
+/* Return true if the size bytes at uaddr all lie in user memory. */
+static bool
+is_user_range(const void *uaddr, size_t size)
+{
+  uintptr_t start = (uintptr_t) uaddr;
 
-  return status;
-}
\ No newline at end of file
+  return start + size >= start && start + size <= (uintptr_t) PHYS_BASE;
+}
+
+/* Read the byte at user address uaddr, which must be below
+   PHYS_BASE.
+   Return the byte, or -1 if it cannot be read. */
+static int
+get_user(const uint8_t *uaddr)
+{
+  int result;
+  asm volatile ("movl $1f, %0; movzbl %1, %0; 1:"
+                : "=&a" (result) : "m" (*uaddr));
+  return result;
+}
+
+#ifndef VM
+/* Write byte to user address udst, which must be below PHYS_BASE.
+   Return false if it cannot be written. */
+static bool
+put_user(uint8_t *udst, uint8_t byte)
+{
+  int error_code;
+  asm volatile ("movl $1f, %0; movb %b2, %1; 1:"
+                : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+  return error_code != -1;
+}
+#endif
+
+/* Copy size bytes from src to dst, either of which may be a user
+   address below PHYS_BASE.
+   Return the number of bytes that could not be copied. */
+static size_t
+copy_user(void *dst, const void *src, size_t size)
+{
+  asm volatile ("movl $1f, %%eax; rep movsb; 1:"
+                : "+D" (dst), "+S" (src), "+c" (size)
+                : : "eax", "memory");
+  return size;
+}
+
+/* Copy size bytes from user address usrc to kernel address kdst.
+   Return false if some of them cannot be read. */
+bool
+copy_from_user(void *kdst, const void *usrc, size_t size)
+{
+  return is_user_range(usrc, size) && copy_user(kdst, usrc, size) == 0;
+}
+
+/* Copy size bytes from kernel address ksrc to user address udst.
+   Return false if some of them cannot be written. */
+bool
+copy_to_user(void *udst, const void *ksrc, size_t size)
+{
+  return is_user_range(udst, size) && copy_user(udst, ksrc, size) == 0;
+}
+
+/* Copy the null-terminated string at user address usrc, null
+   included, into the size bytes at kdst.
+   Return the length of the string, size if it does not fit (kdst
+   is then not null-terminated), or -1 if it cannot be read. */
+int
+strncpy_from_user(char *kdst, const char *usrc, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+  {
+    const uint8_t *p = (const uint8_t *) usrc + i;
+    int c;
+
+    if (!is_user_vaddr(p) || (c = get_user(p)) == -1)
+      return -1;
+    kdst[i] = c;
+    if (c == '\0')
+      return i;
+  }
+  return size;
+}
+
+#ifndef VM
+/* Touch a byte of every page of the size bytes at user address
+   uaddr, writing it back in place if write is true, so that the
+   kernel may then access them directly: without VM, a page that
+   is there once stays there.
+   Return false if some page cannot be accessed. */
+static bool
+probe_user(const void *uaddr, size_t size, bool write)
+{
+  uint8_t *p = (uint8_t *) uaddr;
+  uint8_t *last = p + size - 1;
+
+  if (size == 0)
+    return true;
+  if (!is_user_range(uaddr, size))
+    return false;
+  for (;;)
+  {
+    int c = get_user(p);
+    if (c == -1 || (write && !put_user(p, c)))
+      return false;
+    if (pg_no(p) == pg_no(last))
+      return true;
+    p = (uint8_t *) pg_round_down(p) + PGSIZE;
+  }
+}
+#endif
+
+/* Copy the file name at user address ufile into kfile, which must
+   have room for MAX_FILENAME + 1 bytes.  Terminate the process if
+   ufile cannot be read.
+   Return true if the name has a valid length. */
+static bool
+copy_in_filename(char *kfile, const char *ufile)
+{
+  int len = strncpy_from_user(kfile, ufile, MAX_FILENAME + 1);
+
+  if (len < 0)
+    exit(-1);
+  return len >= MIN_FILENAME && len <= MAX_FILENAME;
+}
+
+/* Return the thread that holds the current process's fds, heap
+   and mappings: with VM, the main thread of the process. */
+static struct thread *
+current_process(void)
+{
+#ifdef VM
+  return thread_current()->process;
+#else
+  return thread_current();
+#endif
+}
+
+/* Keep the other threads of the current process off its fd table
+   until unlock_fds(). */
+static void
+lock_fds(void)
+{
+#ifdef VM
+  lock_acquire(&current_process()->process_lock);
+#endif
+}
+
+static void
+unlock_fds(void)
+{
+#ifdef VM
+  lock_release(&current_process()->process_lock);
+#endif
+}
+
+/* Get the file open as fd in the current process, with its fd
+   table locked.  Return NULL if fd is not open. */
+static struct file *
+lookup_fd(int fd)
+{
+  struct thread *cur = current_process();
+  size_t idx = fd - FD_BASE;
+
+  if (fd < FD_BASE || cur->fd_map == NULL 
+    || idx >= bitmap_size(cur->fd_map) || !bitmap_test(cur->fd_map, idx))
+    return NULL;
+  return cur->fd_table[idx];
+}
+
+/* Get the file open as fd in the current process, as a reference of
+   its own (see file_dup()) that the caller must file_close(): another
+   thread of the process may close fd meanwhile.
+   Return NULL if fd is not open. */
+struct file *
+get_openfile(int fd)
+{
+  struct file *file;
+
+  lock_fds();
+  file = lookup_fd(fd);
+  if (file != NULL)
+    file_dup(file);
+  unlock_fds();
+  return file;
+}
+
+/* Close the file open as fd in the current process, if any. */
+void 
+close_openfile(int fd)
+{
+  struct thread *cur = current_process();
+  struct file *file;
+
+  lock_fds();
+  file = lookup_fd(fd);
+  if (file != NULL)
+  {
+    bitmap_reset(cur->fd_map, fd - FD_BASE);
+    cur->fd_table[fd - FD_BASE] = NULL;
+  }
+  unlock_fds();
+  if (file != NULL)
+    file_close(file);
+}
+
+/* Terminates Pintos. */
+static void 
+halt(void) 
+{
+  shutdown_power_off();
+}
+
+/* Terminates the current user program.
+
+   Returning status to the kernel. 
+   status = 0 -- success
+   status = nonzero -- error */
+void 
+exit(int status)
+{
+  struct thread *cur = thread_current();
+
+#ifdef VM
+  /* Another thread leaves the rest to the main thread, which
+     stops it and the others first. */
+  if (cur->process != cur)
+  {
+    lock_acquire(&cur->process->process_lock);
+    if (!cur->process->exiting)
+      cur->process->exit_status = status;
+    cur->process->exiting = true;
+    lock_release(&cur->process->process_lock);
+    futex_wake_process(cur->pagedir);
+    thread_exit();
+  }
+  process_stop_threads();
+#endif
+
+  printf("%s: exit(%d)\n", cur->name, status);
+  if (process_usage_on_exit)
+    process_print_usage();
+
+    /* Its parent gets it in process_exit(). */
+  cur->exit_status = status;
+
+  close_fds();
+  thread_exit();
+}
+
+/* Close all the files the current process has opened, and free its
+   fd table. */
+static void
+close_fds(void)
+{
+  struct thread *cur = current_process();
+
+  // mmb -- the key to multi-oom
+  if (cur->fd_map != NULL)
+  {
+    size_t idx;
+    for (idx = 0; idx < bitmap_size(cur->fd_map); idx++)
+      if (bitmap_test(cur->fd_map, idx))
+        close(idx + FD_BASE);
+    bitmap_destroy(cur->fd_map);
+    free(cur->fd_table);
+    cur->fd_map = NULL;
+    cur->fd_table = NULL;
+  }
+}
+
+/* Give the current process, which parent has just started and
+   which has no fds yet, the pipe ends open in parent, at the same
+   fds: a process connects the children it starts by a pipe that
+   way.  Return false, giving it none, if out of memory. */
+bool
+inherit_pipes(struct thread *parent)
+{
+  return inherit_fds(parent, false);
+}
+
+/* Give the current process, which parent has just forked and which
+   has no fds yet, all the files open in parent, at the same fds and
+   by reference: the two share their positions.  Return false,
+   giving it none, if out of memory. */
+bool
+fork_fds(struct thread *parent)
+{
+  return inherit_fds(parent, true);
+}
+
+/* Common part of the above: all the files if fork, else the pipe
+   ends, reopened. */
+static bool
+inherit_fds(struct thread *parent, bool fork)
+{
+  struct thread *cur = current_process();
+  bool success = true;
+  size_t idx;
+
+#ifdef VM
+  parent = parent->process;
+  lock_acquire(&parent->process_lock);
+#endif
+  for (idx = 0; parent->fd_map != NULL && idx < bitmap_size(parent->fd_map)
+                && success; idx++)
+  {
+    struct file *file = parent->fd_table[idx];
+    if (!bitmap_test(parent->fd_map, idx)
+        || (!fork && file_get_pipe(file, false) == NULL
+            && file_get_pipe(file, true) == NULL))
+      continue;
+
+    while (success && (cur->fd_map == NULL || idx >= bitmap_size(cur->fd_map)))
+      success = grow_fd_table();
+    if (success)
+      success = (cur->fd_table[idx] = fork ? file_dup(file)
+                                           : file_reopen(file)) != NULL;
+    if (success)
+      bitmap_mark(cur->fd_map, idx);
+  }
+#ifdef VM
+  lock_release(&parent->process_lock);
+#endif
+
+  if (!success)
+    close_fds();
+  return success;
+}
+
+/* Run the executable whose name is given in cmd_line, 
+   passing any given arguments.
+
+   Return the new process's program id(pid). 
+   Must return pid -1, which otherwise should not be a valid pid,
+   if the program cannot load or run for any reason.
+   Unless wait_load, return before it has loaded: a child that
+   could not load exits with status -1. */
+static pid_t 
+exec(const char *cmd_line, bool wait_load)
+{  
+  // printf("exec %s\n", cmd_line);
+
+  /* Command lines longer than a page are cut short, as
+     process_execute() would cut them. */
+  char *kcmd_line = palloc_get_page(0);
+  if (kcmd_line == NULL)
+    return TID_ERROR;
+  if (strncpy_from_user(kcmd_line, cmd_line, PGSIZE) < 0)
+  {
+    palloc_free_page(kcmd_line);
+    exit(-1);
+  }
+  kcmd_line[PGSIZE - 1] = '\0';
+
+  tid_t tid = wait_load ? process_execute(kcmd_line)
+                        : process_spawn(kcmd_line);
+  palloc_free_page(kcmd_line);
+  
+  return tid;
+}
+
+/* Wait for a child process pid. 
+   If pid still alive, wait until it terminate.
+   
+   Return the child's exit status.*/
+static int 
+wait(pid_t pid)
+{
+  return process_wait(pid);
+}
+
+/* Create a new file called *file that has intial_size size.   
+   Return true if successful, false otherwise. */
+static bool 
+create(const char *ufile, unsigned initial_size)
+{
+  char file[MAX_FILENAME + 1];
+
+  if (!copy_in_filename(file, ufile))
+    return false;
+
+  // bool status = filesys_create(file, initial_size);
+  // status goes wrong !!! I don't know why ... 
+
+  block_sector_t inode_sector = 0;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && dir_alloc_inode (dir, &inode_sector)
+             && inode_create (inode_sector, initial_size)
+             && dir_add (dir, file, inode_sector));
+  if (!success && inode_sector != 0) 
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+  // return status;
+}
+
+/* Delete the file called *file.
+   Return true if successful, false otherwise. */
+static bool 
+remove(const char *ufile)
+{
+  char file[MAX_FILENAME + 1];
+
+  if (!copy_in_filename(file, ufile))
+    return false;
+
+  bool status;
+
+  status = filesys_remove(file);
+
+  return status;
+}
+
+/* Double the current process's fd table, or create it.  The
+   table must be locked.  Return false if out of memory. */
+static bool
+grow_fd_table(void)
+{
+  struct thread *cur = current_process();
+  size_t old_cnt = cur->fd_map != NULL ? bitmap_size(cur->fd_map) : 0;
+  size_t new_cnt = old_cnt > 0 ? old_cnt * 2 : FD_TABLE_MIN;
+
+  struct file **table = realloc(cur->fd_table, new_cnt * sizeof *table);
+  if (table == NULL)
+    return false;
+  cur->fd_table = table;
+
+  struct bitmap *map = bitmap_create(new_cnt);
+  if (map == NULL)
+    return false;
+  if (cur->fd_map != NULL)
+  {
+    size_t idx;
+    for (idx = 0; idx < old_cnt; idx++)
+      bitmap_set(map, idx, bitmap_test(cur->fd_map, idx));
+    bitmap_destroy(cur->fd_map);
+  }
+  cur->fd_map = map;
+  return true;
+}
+
+/* Assign the lowest free fd to file in the current process.
+   Return fd, or -1 if out of memory. */
+static int 
+assign_fd(struct file *file) 
+{
+  struct thread *cur = current_process();
+  size_t idx = BITMAP_ERROR;
+
+  lock_fds();
+  if (cur->fd_map != NULL)
+    idx = bitmap_scan_and_flip(cur->fd_map, 0, 1, false);
+  if (idx == BITMAP_ERROR)
+  {
+    if (!grow_fd_table())
+    {
+      unlock_fds();
+      return -1;
+    }
+    idx = bitmap_scan_and_flip(cur->fd_map, 0, 1, false);
+  }
+  cur->fd_table[idx] = file;
+  unlock_fds();
+  return idx + FD_BASE;
+}
+
+#ifdef VM
+/* Open file as fd in the current process, at which it has none
+   open: a process restored from a checkpoint gets its files back
+   that way.  Return false if fd is taken or out of range, or if
+   out of memory. */
+bool
+install_fd(int fd, struct file *file)
+{
+  struct thread *cur = current_process();
+  size_t idx = fd - FD_BASE;
+  bool success = fd >= FD_BASE;
+
+  lock_fds();
+  while (success && (cur->fd_map == NULL || idx >= bitmap_size(cur->fd_map)))
+    success = grow_fd_table();
+  if (success && bitmap_test(cur->fd_map, idx))
+    success = false;
+  if (success)
+  {
+    cur->fd_table[idx] = file;
+    bitmap_mark(cur->fd_map, idx);
+  }
+  unlock_fds();
+  return success;
+}
+#endif
+
+/* Open the file called *file, assign the opened file a fd 
+   and the current process should keep track of it in its fd table.
+
+   Return fd if the file can be opend, otherwise -1.*/
+static int 
+open(const char *ufile)
+{
+  // printf("hahaha\n");
+  char file[MAX_FILENAME + 1];
+  int fd = -1;
+
+  if (!copy_in_filename(file, ufile))
+    return fd;
+
+  struct file *file_struct = filesys_open(file);
+  if (file_struct != NULL) 
+  {
+    fd = assign_fd(file_struct);
+    if (fd == -1)
+      file_close(file_struct);
+  }
+
+  // printf("open %d\n", fd);
+  return fd;
+}
+
+/* Close file of fd. */
+static void 
+close(int fd)
+{
+  close_openfile(fd);
+}
+
+/* Create a pipe, and store the fd of its read end into fds[0] and
+   the fd of its write end into fds[1].  Reads block until there
+   is data, and return 0 once every write end is closed; writes
+   block while the pipe is full, and fail once every read end is
+   closed.  Children started by exec() inherit the pipe ends.
+   Return 0, or -1 if out of memory. */
+static int
+pipe(int *ufds)
+{
+  struct file *ends[2];
+  int fds[2];
+
+  if (!file_open_pipe(ends))
+    return -1;
+
+  fds[0] = assign_fd(ends[0]);
+  fds[1] = fds[0] != -1 ? assign_fd(ends[1]) : -1;
+  if (fds[1] == -1)
+  {
+    if (fds[0] != -1)
+      close_openfile(fds[0]);
+    else
+      file_close(ends[0]);
+    file_close(ends[1]);
+    return -1;
+  }
+
+  /* The fds are closed with the others. */
+  if (!copy_to_user(ufds, fds, sizeof fds))
+    exit(-1);
+  return 0;
+}
+
+/* Get the size of fd file.
+   Return its size. */
+static int
+filesize(int fd)
+{
+  int size = -1;
+
+  struct file *file = get_openfile(fd);
+    if (file != NULL)
+      size = file_length(file);
+  file_close(file);
+  
+  return size;
+}
+
+/* Read size bytes from fd into buffer.
+   Return the number of bytes actully read. 
+   Fd 0 -- read from the keyboard: wait for a key, then take what
+   has been typed so far. */
+static int 
+read(int fd, void *buffer, unsigned size)
+{
+  // printf("reading\n");
+  int status = -1;
+
+#ifdef VM
+  // fault the buffer in before reading, and keep it resident
+  struct thread *cur = thread_current();
+  struct vm_pin_list pins;
+  if (buffer == NULL
+      || !vm_pin_range(cur->supt, cur->pagedir, buffer, size, true, &pins))
+    exit(-1);
+#else
+  if (buffer == NULL || !probe_user(buffer, size, true))
+    exit(-1);
+#endif
+
+  if (fd == STDIN_FILENO) /* Read from the keyboard. */
+  {
+#ifdef VM
+    if (process_block())
+    {
+      status = input_read(buffer, size);
+      process_unblock();
+    }
+#else
+    status = input_read(buffer, size);
+#endif
+  }
+  else if (fd != STDOUT_FILENO)
+  { 
+    struct file *file = get_openfile(fd);
+#ifdef VM
+    /* A writer may copy straight into the pinned buffer. */
+    struct pipe *p = file != NULL ? file_get_pipe(file, false) : NULL;
+    if (p != NULL)
+      status = pipe_read(p, buffer, size, &pins);
+    else
+#endif
+    if (file != NULL)
+      status = file_read(file, buffer, size);
+    file_close(file);
+  }
+
+#ifdef VM
+  vm_unpin_range(&pins);
+#endif
+
+  // printf("read %d\n", fd);
+  return status;
+}
+
+/* Write size bytes from buffer to fd.
+   Return the number of bytes actually written.
+   Fd 1 -- write to the console*/
+static int
+write(int fd, const void *buffer, unsigned size) 
+{
+  int status = 0;
+
+#ifdef VM
+  struct thread *cur = thread_current();
+  struct vm_pin_list pins;
+  if (buffer == NULL
+      || !vm_pin_range(cur->supt, cur->pagedir, buffer, size, false, &pins))
+    exit(-1);
+#else
+  if (buffer == NULL || !probe_user(buffer, size, false))
+    exit(-1);
+#endif
+
+	if (fd == STDOUT_FILENO) /* Write to the console.*/
+	{
+		putbuf(buffer, size);
+		// hex_dump(buffer, buffer, 64, true);
+		status = size;
+	} else if (fd != STDIN_FILENO) 
+  {
+    struct file *file = get_openfile(fd);
+    if (file != NULL)
+      status = file_write(file, buffer, size);
+    file_close(file);
+  }
+
+#ifdef VM
+  vm_unpin_range(&pins);
+#endif
+
+  // printf("write %d %d\n", fd, status);
+  return status;
+}
+
+/* Change the next byte to be read/written in open fd to position,
+   expressed in bytes from the beginning of the file. */
+static void 
+seek(int fd, unsigned position)
+{
+  struct file *file = get_openfile(fd);
+    if (file != NULL)
+      file_seek(file, position);
+  file_close(file);
+
+  return ;
+}
+
+/* Get the position of the next byte te be read/writen in open fd,
+   expressed in bytes from the beginning of the file.*/
+static unsigned 
+tell(int fd)
+{
+  int status = -1;
+
+  struct file *file = get_openfile(fd);
+    if (file != NULL)
+      status = file_tell(file);
+  file_close(file);
+
+  return status;
+}
+
+/* Read size bytes from fd into buffer, starting at byte offset of
+   the file, without moving the fd's position.
+   Return the number of bytes actually read, or -1 if fd is not an
+   open file. */
+static int
+pread(int fd, void *buffer, unsigned size, unsigned offset)
+{
+  int status = -1;
+
+#ifdef VM
+  struct thread *cur = thread_current();
+  struct vm_pin_list pins;
+  if (buffer == NULL
+      || !vm_pin_range(cur->supt, cur->pagedir, buffer, size, true, &pins))
+    exit(-1);
+#else
+  if (buffer == NULL || !probe_user(buffer, size, true))
+    exit(-1);
+#endif
+
+  struct file *file = get_openfile(fd);
+  if (file != NULL && (off_t) offset >= 0)
+    status = file_read_at(file, buffer, size, offset);
+  file_close(file);
+
+#ifdef VM
+  vm_unpin_range(&pins);
+#endif
+  return status;
+}
+
+/* Write size bytes from buffer to fd, starting at byte offset of
+   the file, without moving the fd's position.
+   Return the number of bytes actually written, or -1 if fd is not
+   an open file. */
+static int
+pwrite(int fd, const void *buffer, unsigned size, unsigned offset)
+{
+  int status = -1;
+
+#ifdef VM
+  struct thread *cur = thread_current();
+  struct vm_pin_list pins;
+  if (buffer == NULL
+      || !vm_pin_range(cur->supt, cur->pagedir, buffer, size, false, &pins))
+    exit(-1);
+#else
+  if (buffer == NULL || !probe_user(buffer, size, false))
+    exit(-1);
+#endif
+
+  struct file *file = get_openfile(fd);
+  if (file != NULL && (off_t) offset >= 0)
+    status = file_write_at(file, buffer, size, offset);
+  file_close(file);
+
+#ifdef VM
+  vm_unpin_range(&pins);
+#endif
+  return status;
+}
+
+/* Read (readv) or write (writev) fd from or to the iovcnt buffers
+   of iov, in order, as one transfer: the data goes through a page of
+   kernel memory, so that a whole page is read or written with a
+   single file_read() or file_write().  Only the console can be
+   written besides files.
+   Return the number of bytes actually transferred, or -1 if fd is
+   not open or iovcnt is out of range. */
+static int
+transfer_iov(int fd, const struct iovec *uiov, int iovcnt, bool write)
+{
+  struct iovec iov[IOV_MAX];
+  int i;
+
+  if (iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+  if (iovcnt == 0)
+    return 0;
+  if (!copy_from_user(iov, uiov, iovcnt * sizeof *iov))
+    exit(-1);
+
+  struct file *file = get_openfile(fd);
+  if (file == NULL && !(write && fd == STDOUT_FILENO))
+    return -1;
+
+  /* Pin every buffer before touching any of them. */
+#ifdef VM
+  struct thread *cur = thread_current();
+  struct vm_pin_list pins[IOV_MAX];
+  for (i = 0; i < iovcnt; i++)
+    if ((iov[i].iov_base == NULL && iov[i].iov_len > 0)
+        || !vm_pin_range(cur->supt, cur->pagedir, iov[i].iov_base,
+                         iov[i].iov_len, !write, &pins[i]))
+    {
+      while (i-- > 0)
+        vm_unpin_range(&pins[i]);
+      file_close(file);
+      exit(-1);
+    }
+#else
+  for (i = 0; i < iovcnt; i++)
+    if (!probe_user(iov[i].iov_base, iov[i].iov_len, !write))
+    {
+      file_close(file);
+      exit(-1);
+    }
+#endif
+
+  int status = 0;
+  if (file == NULL)
+  {
+    for (i = 0; i < iovcnt; i++)
+      putbuf(iov[i].iov_base, iov[i].iov_len);
+    for (i = 0; i < iovcnt; i++)
+      status += iov[i].iov_len;
+    goto done;
+  }
+
+  uint8_t *bounce = palloc_get_page(0);
+  if (bounce == NULL)
+  {
+    status = -1;
+    goto done;
+  }
+
+  /* Cursor into the buffers: buffer i, byte ofs. */
+  size_t ofs = 0;
+  i = 0;
+  while (i < iovcnt)
+  {
+    size_t n = 0, want = 0;
+    int j = i;
+    size_t j_ofs = ofs;
+
+    /* Gather (writev) or measure (readv) up to a page. */
+    while (j < iovcnt && want < PGSIZE)
+    {
+      size_t chunk = iov[j].iov_len - j_ofs;
+      if (chunk > PGSIZE - want)
+        chunk = PGSIZE - want;
+      if (write)
+        memcpy(bounce + want, (uint8_t *)iov[j].iov_base + j_ofs, chunk);
+      want += chunk;
+      j_ofs += chunk;
+      if (j_ofs == iov[j].iov_len)
+      {
+        j++;
+        j_ofs = 0;
+      }
+    }
+    if (want == 0)
+      break;
+
+    n = write ? (size_t) file_write(file, bounce, want)
+              : (size_t) file_read(file, bounce, want);
+
+    /* Scatter (readv) what came in, and advance past it. */
+    size_t done_bytes = 0;
+    while (done_bytes < n)
+    {
+      size_t chunk = iov[i].iov_len - ofs;
+      if (chunk > n - done_bytes)
+        chunk = n - done_bytes;
+      if (!write)
+        memcpy((uint8_t *)iov[i].iov_base + ofs, bounce + done_bytes, chunk);
+      done_bytes += chunk;
+      ofs += chunk;
+      if (ofs == iov[i].iov_len)
+      {
+        i++;
+        ofs = 0;
+      }
+    }
+    status += n;
+    if (n < want)
+      break;
+  }
+  palloc_free_page(bounce);
+
+done:
+#ifdef VM
+  for (i = 0; i < iovcnt; i++)
+    vm_unpin_range(&pins[i]);
+#endif
+  file_close(file);
+  return status;
+}
+
+/* Return true if in and out are the same file and the size bytes
+   from the position of in overlap those from the position of out,
+   as they always do if in and out are the same open file. */
+static bool
+copy_overlaps(struct file *in, struct file *out, off_t size)
+{
+  off_t in_pos = file_tell(in), out_pos = file_tell(out);
+
+  return (file_get_inode(in) != NULL
+          && file_get_inode(in) == file_get_inode(out)
+          && size > 0
+          && in_pos < out_pos + size && out_pos < in_pos + size);
+}
+
+/* Copy size bytes from fd_in to fd_out, from and to their current
+   positions, without the data passing through user memory.
+   Return the number of bytes actually copied, or -1 if either fd is
+   not an open file or the two ranges are of the same file and
+   overlap, which includes fd_in and fd_out being the same. */
+static int
+copy_file_range(int fd_in, int fd_out, unsigned size)
+{
+  struct file *in = get_openfile(fd_in);
+  struct file *out = get_openfile(fd_out);
+  int status = -1;
+
+  if (in != NULL && out != NULL && (off_t) size >= 0
+      && !copy_overlaps(in, out, size))
+    status = file_copy(out, in, size);
+  file_close(in);
+  file_close(out);
+  return status;
+}
+
+/* Write the data of fd, and the allocation of its sectors, back to
+   disk, and out of the disk's write cache.
+   Return 0 if successful, -1 if fd is not an open file. */
+static int
+fsync(int fd)
+{
+  struct file *file = get_openfile(fd);
+
+  if (file == NULL)
+    return -1;
+  file_sync(file);
+  file_close(file);
+  free_map_sync();
+  block_flush(fs_device);
+  return 0;
+}
+
+/* Write everything the file system has cached back to disk, and
+   out of the disk's write cache. */
+static void
+sync(void)
+{
+  filesys_sync();
+  block_flush(fs_device);
+}
+
+/* Reserve the disk space for the file open as fd to grow to length
+   bytes, without changing its size or writing anything: what the
+   file later grows over reads as zeros, and appends go to sectors
+   allocated together. Returns 0 on success, -1 if fd is not a file
+   or the disk is full. */
+static int
+fallocate(int fd, unsigned length)
+{
+  struct file *file = get_openfile(fd);
+  int status = -1;
+
+  if (file != NULL && (off_t) length >= 0)
+    status = file_reserve(file, length) ? 0 : -1;
+  file_close(file);
+  return status;
+}
+
+/* Copy the file system counters into stats. */
+static void
+fsstats(struct fs_stats *stats)
+{
+  if (!copy_to_user(stats, &fs_stats, sizeof *stats))
+    exit(-1);
+}
+
+/* Copy the counters of the index'th block device, in probe order,
+   into stats. Return 0, or -1 if there are not that many devices. */
+static int
+blkstats(int index, struct block_stats *stats)
+{
+  struct block *block;
+  struct block_stats s;
+
+  for (block = block_first(); block != NULL && index > 0;
+       block = block_next(block))
+    index--;
+  if (block == NULL || index != 0)
+    return -1;
+
+  block_get_stats(block, &s);
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+  return 0;
+}
+
+/* Copy the counters of the index'th named kernel lock into stats.
+   Return -1 if there is no such lock. */
+static int
+lockstats(int index, struct lock_stats *stats)
+{
+  struct lock_stats s;
+
+  if (index < 0 || !lock_get_stats(index, &s))
+    return -1;
+
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+  return 0;
+}
+
+/* Copy the index'th kernel tunable into info.  Return -1 if there
+   is no such tunable. */
+static int
+tunable_get(int index, struct tunable_info *info)
+{
+  struct tunable_info t;
+
+  if (index < 0 || !tunable_get_info(index, &t))
+    return -1;
+
+  if (!copy_to_user(info, &t, sizeof *info))
+    exit(-1);
+  return 0;
+}
+
+/* Set the kernel tunable named in info to its value.  Return -1
+   if there is no such tunable, or the value is out of bounds. */
+static int
+tunable_set(const struct tunable_info *info)
+{
+  struct tunable_info t;
+
+  if (!copy_from_user(&t, info, sizeof t))
+    exit(-1);
+  t.name[sizeof t.name - 1] = '\0';
+  return tunable_set_value(t.name, t.value) ? 0 : -1;
+}
+
+/* Copy the scheduling latency histograms into stats.  They are
+   too big for the kernel stack, so return -1 if they cannot be
+   put together in memory. */
+static int
+schedstats(struct sched_stats *stats)
+{
+  struct sched_stats *s = malloc(sizeof *s);
+  bool ok;
+
+  if (s == NULL)
+    return -1;
+  thread_get_sched_stats(s);
+  ok = copy_to_user(stats, s, sizeof *stats);
+  free(s);
+  if (!ok)
+    exit(-1);
+  return 0;
+}
+
+/* Copy the counters of interrupt vector vec into stats.  Return
+   -1 if there is no such vector. */
+static int
+intrstats(int vec, struct intr_stats *stats)
+{
+  struct intr_stats s;
+
+  if (vec < 0 || !intr_get_stats(vec, &s))
+    return -1;
+
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+  return 0;
+}
+
+/* A buffer that getdents() packs entries into. */
+struct dirent_buf
+{
+  uint8_t *data;
+  size_t size, used;
+  bool full;                    /* An entry did not fit? */
+};
+
+/* Pack the entry name, with inode sector inumber, into the
+   struct dirent_buf aux.  Return false if it does not fit. */
+static bool
+pack_dirent(const char *name, block_sector_t inumber, void *aux)
+{
+  struct dirent_buf *b = aux;
+  size_t len = strlen(name);
+  size_t reclen = ROUND_UP(offsetof(struct dirent, name) + len + 1, 4);
+  struct dirent *d = (struct dirent *) (b->data + b->used);
+
+  if (b->used + reclen > b->size)
+  {
+    b->full = true;
+    return false;
+  }
+  d->ino = inumber;
+  d->reclen = reclen;
+  d->type = DT_REG;
+  memcpy(d->name, name, len + 1);
+  b->used += reclen;
+  return true;
+}
+
+/* Fill the size bytes at ubuf with as many entries of the root
+   directory, the only one, as fit, in one pass, starting where the
+   previous call left off, as recorded in *upos, which starts at 0.
+   Every entry is a file (DT_REG).  A single call packs at most a
+   page of entries.
+   Return the number of bytes filled, 0 at the end of the
+   directory, or -1 if the next entry does not fit in size bytes
+   or memory runs out. */
+static int
+getdents(unsigned *upos, struct dirent *ubuf, unsigned size)
+{
+  struct dirent_buf b;
+  struct dir *dir;
+  unsigned upos_val;
+  off_t pos;
+  bool ok;
+
+  if (!copy_from_user(&upos_val, upos, sizeof upos_val))
+    exit(-1);
+
+  b.data = palloc_get_page(0);
+  if (b.data == NULL)
+    return -1;
+  b.size = size < PGSIZE ? size : PGSIZE;
+  b.used = 0;
+  b.full = false;
+
+  pos = upos_val;
+  dir = dir_open_root();
+  ok = (dir != NULL && dir_read_entries(dir, &pos, pack_dirent, &b)
+        && !(b.full && b.used == 0));
+  dir_close(dir);
+
+  upos_val = pos;
+  if (ok && (!copy_to_user(ubuf, b.data, b.used)
+             || !copy_to_user(upos, &upos_val, sizeof upos_val)))
+  {
+    palloc_free_page(b.data);
+    exit(-1);
+  }
+  palloc_free_page(b.data);
+  return ok ? (int) b.used : -1;
+}
+
+/* Copy the time taken by each phase of booting into stats. */
+static void
+bootstats(struct boot_stats *stats)
+{
+  struct boot_stats s;
+
+  init_get_boot_stats(&s);
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+}
+
+/* Store the nanoseconds since boot into ns. */
+static void
+clock_ns(int64_t *ns)
+{
+  int64_t now = timer_ns();
+
+  if (!copy_to_user(ns, &now, sizeof *ns))
+    exit(-1);
+}
+
+/* Copy the page allocator and malloc() counters into stats. */
+static void
+memstats(struct mem_stats *stats)
+{
+  struct mem_stats s;
+
+  palloc_get_stats(0, &s.kernel_pool);
+  palloc_get_stats(PAL_USER, &s.user_pool);
+  malloc_get_stats(&s);
+#ifdef VM
+  s.locked_frames = vm_frame_locked_cnt();
+#else
+  s.locked_frames = 0;
+#endif
+
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+}
+
+/* Register ring as the process's I/O ring, replacing any other, or
+   unregister it if ring is null.
+   Return 0 if successful, -1 if ring's entries is not a power of 2
+   no greater than IO_RING_MAX. */
+static int
+io_setup(struct io_ring *ring)
+{
+  struct thread *cur = thread_current();
+  uint32_t entries;
+
+  if (ring == NULL)
+  {
+    cur->io_ring = NULL;
+    return 0;
+  }
+  if (!copy_from_user(&entries, &ring->entries, sizeof entries))
+    exit(-1);
+  if (entries == 0 || entries > IO_RING_MAX || (entries & (entries - 1)))
+    return -1;
+
+  cur->io_ring = ring;
+  cur->io_ring_entries = entries;
+  return 0;
+}
+
+/* Carry out one operation from an I/O ring.
+   Return what its system call returns, or -1 for an unknown
+   opcode. */
+static int
+io_do_sqe(const struct io_sqe *sqe)
+{
+  int result;
+
+  switch (sqe->opcode)
+  {
+    case IO_OP_NOP:
+      return 0;
+    case IO_OP_READ:
+      result = read(sqe->fd, sqe->buf, sqe->len);
+      count_io(false, result);
+      return result;
+    case IO_OP_WRITE:
+      result = write(sqe->fd, sqe->buf, sqe->len);
+      count_io(true, result);
+      return result;
+    case IO_OP_PREAD:
+      result = pread(sqe->fd, sqe->buf, sqe->len, sqe->offset);
+      count_io(false, result);
+      return result;
+    case IO_OP_PWRITE:
+      result = pwrite(sqe->fd, sqe->buf, sqe->len, sqe->offset);
+      count_io(true, result);
+      return result;
+    case IO_OP_FSYNC:
+      return fsync(sqe->fd);
+    default:
+      return -1;
+  }
+}
+
+/* Carry out up to to_submit operations queued on the process's I/O
+   ring, in order, posting the outcome of each, as many as there
+   are and the completion queue has room for.  One call thus pays
+   the cost of entering the kernel for a whole batch.
+   Return the number of operations carried out, or -1 if there is
+   no ring. */
+static int
+io_enter(unsigned to_submit)
+{
+  struct thread *cur = thread_current();
+  struct io_ring *ring = cur->io_ring;
+  uint32_t mask = cur->io_ring_entries - 1;
+  uint32_t idx[4];              /* sq_head, sq_tail, cq_head, cq_tail. */
+  unsigned cnt = 0;
+
+  if (ring == NULL)
+    return -1;
+  if (!copy_from_user(idx, &ring->sq_head, sizeof idx))
+    exit(-1);
+
+  while (cnt < to_submit && idx[0] != idx[1] && idx[3] - idx[2] <= mask)
+  {
+    struct io_sqe sqe;
+    struct io_cqe cqe;
+
+    if (!copy_from_user(&sqe, &ring->sq[idx[0] & mask], sizeof sqe))
+      exit(-1);
+    idx[0]++;
+
+    cqe.user_data = sqe.user_data;
+    cqe.result = io_do_sqe(&sqe);
+    if (!copy_to_user(&ring->cq[idx[3] & mask], &cqe, sizeof cqe))
+      exit(-1);
+    idx[3]++;
+    cnt++;
+  }
+
+  if (!copy_to_user(&ring->sq_head, &idx[0], sizeof idx[0])
+      || !copy_to_user(&ring->cq_tail, &idx[3], sizeof idx[3]))
+    exit(-1);
+  return cnt;
+}
+
+/* Count a read or write call, of any kind, and the bytes it
+   transferred, if it did not fail. */
+static void
+count_io(bool write, int bytes)
+{
+  struct rusage *usage = &thread_current()->usage;
+
+  if (write)
+  {
+    fs_stats.write_calls++;
+    if (bytes > 0)
+    {
+      fs_stats.write_bytes += bytes;
+      usage->write_bytes += bytes;
+    }
+  }
+  else
+  {
+    fs_stats.read_calls++;
+    if (bytes > 0)
+    {
+      fs_stats.read_bytes += bytes;
+      usage->read_bytes += bytes;
+    }
+  }
+}
+
+/* Copy the resource usage of the calling thread or process, as who
+   says, into usage.  Return -1 if who is neither RUSAGE_SELF nor
+   RUSAGE_THREAD. */
+static int
+getrusage(int who, struct rusage *usage)
+{
+  struct rusage u;
+
+  if (who != RUSAGE_SELF && who != RUSAGE_THREAD)
+    return -1;
+
+  process_get_usage(who, &u);
+  if (!copy_to_user(usage, &u, sizeof *usage))
+    exit(-1);
+  return 0;
+}
+
+#ifdef VM
+/* Give mmap_d the next id of cur's mappings, and add it to them.
+   Return the id. */
+static mmapid_t
+add_mapping(struct thread *cur, struct mmap_desc *mmap_d)
+{
+  if (list_empty(&cur->mmap_list))
+    mmap_d->id = 1;
+  else
+    mmap_d->id = list_entry(list_back(&cur->mmap_list),
+                            struct mmap_desc, elem)->id + 1;
+  list_push_back(&cur->mmap_list, &mmap_d->elem);
+  return mmap_d->id;
+}
+
+/* Map the file open as fd into the process's virtual address space,
+   at the consecutive pages starting from addr. The pages are loaded
+   lazily on page faults, and modified pages go back to the file.
+
+   Return the id of the mapping, or -1 if the file cannot be mapped
+   there (addr not page-aligned, file empty, or pages already in use). */
+static mmapid_t
+mmap(int fd, void *addr)
+{
+  struct thread *cur = current_process();
+  mmapid_t id = -1;
+
+  if (addr == NULL || pg_ofs(addr) != 0 
+    || fd == STDIN_FILENO || fd == STDOUT_FILENO)
+    return id;
+
+  struct file *open = get_openfile(fd);
+  struct file *file = open != NULL ? file_reopen(open) : NULL;
+  file_close(open);
+  if (file == NULL)
+    goto done;
+
+  size_t size = file_length(file);
+  size_t ofs;
+
+  lock_acquire(&cur->supt->lock);
+
+  /* Every page must be a free user page. */
+  for (ofs = 0; ofs < size; ofs += PGSIZE)
+  {
+    void *page = addr + ofs;
+    if (!is_user_vaddr(page) || page == TIME_PAGE
+        || vm_supt_has_entry(cur->supt, page))
+      break;
+  }
+  if (size == 0 || ofs < size)
+    goto done_locked;
+
+  struct mmap_desc *mmap_d = malloc(sizeof(struct mmap_desc));
+  if (mmap_d == NULL)
+    goto done_locked;
+
+  for (ofs = 0; ofs < size; ofs += PGSIZE)
+  {
+    size_t bytes = size - ofs < PGSIZE ? size - ofs : PGSIZE;
+    if (!vm_supt_mm_map(cur->supt, addr + ofs, file, ofs, bytes))
+    {
+      /* Undo the pages installed so far. */
+      while (ofs > 0)
+      {
+        ofs -= PGSIZE;
+        vm_supt_mm_unmap(cur->supt, cur->pagedir, addr + ofs, file, ofs, PGSIZE);
+      }
+      free(mmap_d);
+      goto done_locked;
+    }
+  }
+
+  mmap_d->file = file;
+  mmap_d->addr = addr;
+  mmap_d->size = size;
+  mmap_d->shm = NULL;
+  id = add_mapping(cur, mmap_d);
+  file = NULL;
+
+done_locked:
+  lock_release(&cur->supt->lock);
+done:
+  if (file != NULL)
+    file_close(file);
+  return id;
+}
+
+/* Map the first size bytes of the shared-memory object called name
+   at the consecutive pages starting from addr, creating the object,
+   all zero, with that size if there is none.  Every process mapping
+   the object sees the same pages; it is destroyed once the last of
+   its mappings is removed.
+
+   Return the id of the mapping, for munmap(), or -1 if the object
+   cannot be mapped there (addr not page-aligned, size 0 or larger
+   than the object, name too long, or pages already in use). */
+static mmapid_t
+shm_map(const char *name, size_t size, void *addr)
+{
+  struct thread *cur = current_process();
+  char kname[SHM_NAME_MAX + 1];
+  mmapid_t id = -1;
+
+  int len = strncpy_from_user(kname, name, sizeof kname);
+  if (len < 0)
+    exit(-1);
+  if (len == 0 || len > SHM_NAME_MAX || addr == NULL || pg_ofs(addr) != 0
+    || size == 0 || size > SHM_MAX_PAGES * PGSIZE)
+    return id;
+
+  size_t page_cnt = DIV_ROUND_UP(size, PGSIZE);
+  size_t i;
+
+  lock_acquire(&cur->supt->lock);
+
+  /* Every page must be a free user page. */
+  for (i = 0; i < page_cnt; i++)
+  {
+    void *page = addr + i * PGSIZE;
+    if (!is_user_vaddr(page) || page == TIME_PAGE
+        || vm_supt_has_entry(cur->supt, page))
+      goto done;
+  }
+
+  struct mmap_desc *mmap_d = malloc(sizeof(struct mmap_desc));
+  if (mmap_d == NULL)
+    goto done;
+
+  struct vm_shm *shm = vm_shm_open(kname, page_cnt);
+  if (shm == NULL || !vm_shm_map(cur->supt, addr, shm, page_cnt))
+  {
+    if (shm != NULL)
+      vm_shm_close(shm);
+    free(mmap_d);
+    goto done;
+  }
+
+  mmap_d->file = NULL;
+  mmap_d->addr = addr;
+  mmap_d->size = page_cnt * PGSIZE;
+  mmap_d->shm = shm;
+  id = add_mapping(cur, mmap_d);
+
+done:
+  lock_release(&cur->supt->lock);
+  return id;
+}
+
+/* Unmap the mapping mapid, writing the modified pages back to its file;
+   those of a shared-memory object are kept for its other mappings.
+   Return false if there is no such mapping. */
+bool
+munmap(mmapid_t mapid)
+{
+  struct thread *cur = current_process();
+  struct mmap_desc *mmap_d = NULL;
+
+  lock_acquire(&cur->supt->lock);
+  struct list *list = &cur->mmap_list;
+  for (struct list_elem *e = list_begin (list); 
+                          e != list_end (list); 
+                          e = list_next (e))
+  {
+    struct mmap_desc *tmp = list_entry(e, struct mmap_desc, elem);
+    if (tmp->id == mapid)
+    {
+      mmap_d = tmp;
+      break;
+    }
+  }
+  if (mmap_d == NULL)
+  {
+    lock_release(&cur->supt->lock);
+    return false;
+  }
+
+  size_t ofs;
+  if (mmap_d->shm != NULL)
+    vm_shm_unmap(cur->supt, cur->pagedir, mmap_d->addr, mmap_d->shm,
+                 mmap_d->size / PGSIZE);
+  else
+    for (ofs = 0; ofs < mmap_d->size; ofs += PGSIZE)
+    {
+      size_t bytes = mmap_d->size - ofs < PGSIZE ? mmap_d->size - ofs : PGSIZE;
+      vm_supt_mm_unmap(cur->supt, cur->pagedir, mmap_d->addr + ofs,
+                       mmap_d->file, ofs, bytes);
+    }
+
+  list_remove(&mmap_d->elem);
+  lock_release(&cur->supt->lock);
+  file_close(mmap_d->file);
+  free(mmap_d);
+
+  return true;
+}
+
+/* Give the access hint advice (MADV_*) for the length bytes starting
+   at addr, which must be page-aligned and all be valid pages of the
+   process (mapped file, executable, or stack).
+   Return 0 if successful, -1 otherwise. */
+static int
+madvise(void *addr, size_t length, int advice)
+{
+  struct thread *cur = thread_current();
+
+  if (addr == NULL || pg_ofs(addr) != 0 || length == 0
+    || advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return -1;
+
+  size_t cnt = DIV_ROUND_UP(length, PGSIZE);
+  if (!is_user_vaddr(addr + (cnt - 1) * PGSIZE)
+    || (uintptr_t) addr + (cnt - 1) * PGSIZE < (uintptr_t) addr)
+    return -1;
+
+  lock_acquire(&cur->supt->lock);
+  bool success = vm_supt_advise(cur->supt, cur->pagedir, addr, cnt, advice);
+  lock_release(&cur->supt->lock);
+  return success ? 0 : -1;
+}
+
+/* Lock the length bytes starting at addr in memory, if lock, or
+   unlock them.  addr must be page-aligned, and the pages all valid
+   pages of the process.  Locked pages are loaded at once, and are
+   not evicted until unlocked or the process exits; a process can
+   lock at most vm_mlock_limit pages.
+   Return 0 if successful, -1 otherwise: pages locked before a
+   failure stay locked. */
+static int
+mlock(void *addr, size_t length, bool lock)
+{
+  struct thread *cur = current_process();
+
+  if (addr == NULL || pg_ofs(addr) != 0 || length == 0)
+    return -1;
+
+  size_t cnt = DIV_ROUND_UP(length, PGSIZE);
+  if (!is_user_vaddr(addr + (cnt - 1) * PGSIZE)
+    || (uintptr_t) addr + (cnt - 1) * PGSIZE < (uintptr_t) addr)
+    return -1;
+
+  lock_acquire(&cur->supt->lock);
+  bool success = lock
+    ? vm_supt_lock(cur->supt, cur->pagedir, addr, cnt)
+    : vm_supt_unlock(cur->supt, addr, cnt);
+  lock_release(&cur->supt->lock);
+  return success ? 0 : -1;
+}
+
+/* Swap to the file called *file as well, at priority: see
+   vm_swap_add_file().  Return true if successful. */
+static bool
+swapon(const char *ufile, int priority)
+{
+  char file[MAX_FILENAME + 1];
+
+  if (!copy_in_filename(file, ufile))
+    return false;
+  return vm_swap_add_file(file, priority);
+}
+
+/* Save the current process, which must have no other thread and
+   no mappings, to the file called *file, replacing it.  Running
+   that file resumes the process from here, with 1 returned.
+   Return 0 once saved, or -1 on failure. */
+static int
+checkpoint(const char *ufile)
+{
+  char file[MAX_FILENAME + 1];
+
+  if (!copy_in_filename(file, ufile))
+    return -1;
+  return vm_checkpoint_save(file) ? 0 : -1;
+}
+
+/* Copy the working-set estimate of the process into stats. */
+static void
+wsstats(struct ws_stats *stats)
+{
+  struct ws_stats s;
+
+  vm_frame_get_ws_stats(current_process(), &s);
+  if (!copy_to_user(stats, &s, sizeof *stats))
+    exit(-1);
+}
+
+/* Move the end of the heap, which starts past the executable, by
+   increment bytes.  The heap grows by zero pages, which only take
+   a frame once touched.  Pages it gives back stay mapped for it to
+   grow into again, keeping their contents, but are evicted first.
+   Return the previous end of the heap, or (void *) -1 if the heap
+   would overlap another mapping or the space of the stacks. */
+static void *
+sbrk(intptr_t increment)
+{
+  struct thread *cur = current_process();
+
+  lock_acquire(&cur->supt->lock);
+  void *old_break = move_break(cur, increment);
+  lock_release(&cur->supt->lock);
+  return old_break;
+}
+
+/* sbrk() for process cur, with its SUPT locked. */
+static void *
+move_break(struct thread *cur, intptr_t increment)
+{
+  uint8_t *old_break = cur->heap_break;
+  uint8_t *new_break = old_break + increment;
+
+  if (cur->heap_start == NULL)
+    return (void *) -1;
+  if (increment < 0
+      ? new_break > old_break || new_break < cur->heap_start
+      : new_break < old_break
+        || new_break > ((uint8_t *) PHYS_BASE - MAX_STACK_SIZE
+                        - THREAD_STACKS_SIZE))
+    return (void *) -1;
+
+  uint8_t *old_end = (uint8_t *) ROUND_UP((uintptr_t) old_break, PGSIZE);
+  uint8_t *new_end = (uint8_t *) ROUND_UP((uintptr_t) new_break, PGSIZE);
+  uint8_t *page;
+
+  /* Install the pages never part of the heap. */
+  if (new_end > cur->heap_mapped)
+  {
+    for (page = cur->heap_mapped; page < new_end; page += PGSIZE)
+      if (vm_supt_has_entry(cur->supt, page))
+        return (void *) -1;
+
+    for (page = cur->heap_mapped; page < new_end; page += PGSIZE)
+      if (!vm_supt_install_zeropage(cur->supt, page))
+      {
+        cur->heap_mapped = page;
+        return (void *) -1;
+      }
+    cur->heap_mapped = new_end;
+  }
+
+  /* Pages given back earlier are in use again, or more pages are
+     given back. */
+  if (new_end > old_end)
+    vm_supt_advise(cur->supt, cur->pagedir, old_end,
+                   (new_end - old_end) / PGSIZE,
+                   MADV_NORMAL);
+  else if (new_end < old_end)
+    vm_supt_advise(cur->supt, cur->pagedir, new_end,
+                   (old_end - new_end) / PGSIZE, MADV_DONTNEED);
+
+  cur->heap_break = new_break;
+  return old_break;
+}
+#endif
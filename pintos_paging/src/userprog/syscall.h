@@ -1,7 +1,32 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/* First fd given to an open file; 0 and 1 are the console. */
+#define FD_BASE 2
+
+struct intr_frame;
+struct thread;
+struct file;
+
 void syscall_init (void);
+void syscall_handler (struct intr_frame *);
+
+bool copy_from_user (void *kdst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *ksrc, size_t size);
+int strncpy_from_user (char *kdst, const char *usrc, size_t size);
+
 void exit(int status);
+void close_openfile(int fd);
+bool inherit_pipes(struct thread *parent);
+bool fork_fds(struct thread *parent);
+
+#ifdef VM
+#include "userprog/process.h"
+bool munmap(mmapid_t mapid);
+bool install_fd(int fd, struct file *);
+#endif
 
 #endif /* userprog/syscall.h */
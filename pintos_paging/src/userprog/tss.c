@@ -104,3 +104,45 @@ tss_update (void)
   ASSERT (tss != NULL);
   tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
 }
+
+/* Model-specific registers that SYSENTER loads the kernel code
+   segment, stack pointer, and instruction pointer from.  See
+   [IA32-v3a] 5.8.7 "Performing Fast Calls to System
+   Procedures with the SYSENTER and SYSEXIT Instructions". */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* Writes VALUE to model-specific register MSR. */
+static void
+wrmsr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* Makes SYSENTER in user mode jump to ENTRY in the kernel code
+   segment.  SYSENTER does not consult the TSS, so its stack
+   pointer is set to the address of the TSS's esp0 member instead:
+   ENTRY's first instruction must load the thread's kernel stack
+   pointer from there.  Does nothing if the CPU lacks SYSENTER. */
+void
+tss_init_sysenter (void (*entry) (void))
+{
+  uint32_t eax, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  /* CPUID function 1 reports SYSENTER support in bit 11 of EDX,
+     but early Pentium Pro processors set the bit without really
+     having the instruction.  See [IA32-v2b] "SYSENTER". */
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  if (!(edx & (1 << 11)) || (family == 6 && model < 3 && stepping < 3))
+    return;
+
+  ASSERT (tss != NULL);
+  wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+  wrmsr (MSR_SYSENTER_ESP, (uint32_t) &tss->esp0);
+  wrmsr (MSR_SYSENTER_EIP, (uint32_t) entry);
+}
@@ -0,0 +1,469 @@
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/flags.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/gdt.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "vm/checkpoint.h"
+#include "vm/page.h"
+
+/* Process checkpoints.
+
+   vm_checkpoint_save() writes the running process to a file: its
+   registers as they were on entry to the system call, the layout
+   of its address space, the contents of the pages it has written,
+   and the files it has open.  Executing that file restores the
+   process, which returns from the system call a second time.
+   Nothing is read back at once: each page is installed as a
+   FROM_FILESYS page of the checkpoint, or of the executable if it
+   was never written, and faults in when it is touched, from the
+   buffer cache, or from a frame shared with another process
+   restored from the same checkpoint.
+
+   Only a process with one thread and no memory-mapped files or
+   shared memory can be saved.  Pipe ends are not saved, nor are
+   files that no longer have a name in the root directory.  The
+   executable and the files are found again by name when the
+   process is restored, and must be the same inodes as when it
+   was saved.
+
+   A checkpoint file is laid out as follows:
+
+    |  header          | struct ckpt_header
+    |  page records    | header.page_cnt struct ckpt_page
+    |  file records    | header.fd_cnt struct ckpt_fd
+    |  (padding)       | to a page boundary, header.data_ofs
+    |  saved pages     | one page for each CKPT_DATA record
+*/
+
+/* Identifies a checkpoint: "CKPT". */
+#define CKPT_MAGIC 0x54504b43
+
+/* Start of a checkpoint. */
+struct ckpt_header
+  {
+    uint32_t magic;             /* CKPT_MAGIC. */
+    uint32_t page_cnt;          /* Number of page records. */
+    uint32_t fd_cnt;            /* Number of file records. */
+    uint32_t data_ofs;          /* Offset of the saved pages. */
+    char exec_name[NAME_MAX + 1];   /* Executable file. */
+    block_sector_t exec_inumber;    /* Its inode. */
+    uint32_t heap_start, heap_break, heap_mapped;
+    struct intr_frame regs;     /* User registers. */
+  };
+
+/* Where a page comes from when it is restored. */
+enum ckpt_kind
+  {
+    CKPT_ZERO,                  /* All zero. */
+    CKPT_EXEC,                  /* The executable, never written. */
+    CKPT_DATA                   /* Saved in the checkpoint. */
+  };
+
+/* A page of the process. */
+struct ckpt_page
+  {
+    uint32_t upage;             /* User virtual address. */
+    uint32_t ofs;               /* Offset in the executable or checkpoint. */
+    uint16_t read_bytes;        /* CKPT_EXEC: bytes from the executable. */
+    uint8_t kind;               /* enum ckpt_kind. */
+    uint8_t writable;
+  };
+
+/* A file open in the process. */
+struct ckpt_fd
+  {
+    int32_t fd;
+    off_t pos;                  /* File position. */
+    block_sector_t inumber;
+    char name[NAME_MAX + 1];
+  };
+
+/* Pages of the process being saved, for save_page(). */
+struct ckpt_walk
+  {
+    struct file *exec;          /* The process's executable. */
+    struct ckpt_page *pages;    /* Records, or null to count pages. */
+    size_t cnt;                 /* Number of pages seen. */
+  };
+
+static void save_page (struct supplemental_page_table_entry *, void *walk);
+static bool find_name (struct inode *, char name[NAME_MAX + 1]);
+static void *read_record (struct file *, void *buf, off_t ofs, size_t i,
+    size_t cnt, size_t size);
+static bool restore_page (struct supplemental_page_table *,
+    const struct ckpt_page *, struct file *exec, struct file *ckpt);
+static bool restore_fds (struct file *ckpt, void *buf,
+    const struct ckpt_header *);
+
+/**
+ * Save the current process, which called a system call, to the file
+ * NAME, which is replaced.  Executing NAME then restores the process
+ * as it is, returning from the system call with 1 in EAX.
+ * Returns false if the process has other threads or mappings, if
+ * out of memory, or if the file cannot be written.
+ */
+bool
+vm_checkpoint_save (const char *name)
+{
+  struct thread *cur = thread_current ();
+  struct ckpt_header *hdr = palloc_get_page (PAL_ZERO);
+  uint8_t *buf = palloc_get_page (0);
+  struct ckpt_walk walk = { cur->file, NULL, 0 };
+  struct ckpt_fd *fds = NULL;
+  struct file *file = NULL;
+  size_t fd_cnt = 0, data_cnt = 0, i;
+  bool success = false;
+
+  if (hdr == NULL || buf == NULL || cur->process != cur || cur->file == NULL)
+    goto done;
+
+  lock_acquire (&cur->process_lock);
+  bool alone = cur->live_threads == 0 && list_empty (&cur->mmap_list);
+  lock_release (&cur->process_lock);
+  if (!alone)
+    goto done;
+
+  // the executable, which must not be overwritten by the checkpoint
+  struct inode *exec_inode = file_get_inode (cur->file);
+  if (!find_name (exec_inode, hdr->exec_name) || !strcmp (name, hdr->exec_name))
+    goto done;
+  hdr->exec_inumber = inode_get_inumber (exec_inode);
+
+  // the pages: counted, then recorded.  Only this thread adds pages.
+  lock_acquire (&cur->supt->lock);
+  vm_supt_walk (cur->supt, save_page, &walk);
+  lock_release (&cur->supt->lock);
+  walk.pages = malloc (walk.cnt * sizeof *walk.pages);
+  if (walk.pages == NULL && walk.cnt > 0)
+    goto done;
+  walk.cnt = 0;
+  lock_acquire (&cur->supt->lock);
+  vm_supt_walk (cur->supt, save_page, &walk);
+  lock_release (&cur->supt->lock);
+
+  // the files with a name; there is no other thread to open or
+  // close any meanwhile.
+  if (cur->fd_map != NULL) {
+    fds = malloc (bitmap_size (cur->fd_map) * sizeof *fds);
+    if (fds == NULL)
+      goto done;
+    for (i = 0; i < bitmap_size (cur->fd_map); i++) {
+      struct inode *inode;
+      if (!bitmap_test (cur->fd_map, i)
+          || (inode = file_get_inode (cur->fd_table[i])) == NULL
+          || !find_name (inode, fds[fd_cnt].name))
+        continue;
+      fds[fd_cnt].fd = i + FD_BASE;
+      fds[fd_cnt].pos = file_tell (cur->fd_table[i]);
+      fds[fd_cnt].inumber = inode_get_inumber (inode);
+      fd_cnt++;
+    }
+  }
+
+  hdr->magic = CKPT_MAGIC;
+  hdr->page_cnt = walk.cnt;
+  hdr->fd_cnt = fd_cnt;
+  hdr->data_ofs = ROUND_UP (sizeof *hdr + walk.cnt * sizeof *walk.pages
+                            + fd_cnt * sizeof *fds, PGSIZE);
+  hdr->heap_start = (uintptr_t) cur->heap_start;
+  hdr->heap_break = (uintptr_t) cur->heap_break;
+  hdr->heap_mapped = (uintptr_t) cur->heap_mapped;
+  // as saved on entry, where process_fork() finds them too
+  hdr->regs = ((struct intr_frame *) ((uint8_t *) cur + PGSIZE))[-1];
+  for (i = 0; i < walk.cnt; i++)
+    if (walk.pages[i].kind == CKPT_DATA)
+      walk.pages[i].ofs = hdr->data_ofs + data_cnt++ * PGSIZE;
+
+  filesys_remove (name);
+  if (!filesys_create (name, 0) || (file = filesys_open (name)) == NULL)
+    goto done;
+  file_reserve (file, hdr->data_ofs + data_cnt * PGSIZE);
+
+  off_t size = walk.cnt * sizeof *walk.pages;
+  if (file_write (file, hdr, sizeof *hdr) != sizeof *hdr
+      || file_write (file, walk.pages, size) != size
+      || file_write (file, fds, fd_cnt * sizeof *fds) != (off_t) (fd_cnt * sizeof *fds))
+    goto done;
+
+  // copied in from user memory, which brings back the pages on swap
+  for (i = 0; i < walk.cnt; i++) {
+    const struct ckpt_page *p = &walk.pages[i];
+    if (p->kind != CKPT_DATA)
+      continue;
+    if (!copy_from_user (buf, (void *) p->upage, PGSIZE)
+        || file_write_at (file, buf, PGSIZE, p->ofs) != PGSIZE)
+      goto done;
+  }
+  file_sync (file);
+  success = true;
+
+ done:
+  if (file != NULL) {
+    file_close (file);
+    if (!success)
+      filesys_remove (name);
+  }
+  free (fds);
+  free (walk.pages);
+  palloc_free_page (buf);
+  palloc_free_page (hdr);
+  return success;
+}
+
+/* Record the page of SPTE in WALK_, for vm_checkpoint_save(); or
+   only count it, on the first walk. */
+static void
+save_page (struct supplemental_page_table_entry *spte, void *walk_)
+{
+  struct ckpt_walk *walk = walk_;
+
+  if (walk->pages == NULL) {
+    walk->cnt++;
+    return;
+  }
+
+  struct ckpt_page *p = &walk->pages[walk->cnt++];
+  p->upage = (uintptr_t) spte->upage;
+  p->ofs = 0;
+  p->read_bytes = 0;
+  p->writable = spte->writable;
+
+  // a page of the executable that cannot have been written since it
+  // was loaded: read-only, or not brought in since it last was.
+  bool exec = spte->file == walk->exec && !spte->mmap
+    && ((spte->status == FROM_FILESYS && !spte->dirty)
+        || (spte->status == ON_FRAME && !spte->writable));
+
+  if (spte->status == ALL_ZERO || spte->status == ZERO_MAPPED)
+    p->kind = CKPT_ZERO;
+  else if (exec) {
+    p->kind = CKPT_EXEC;
+    p->ofs = spte->file_offset;
+    p->read_bytes = spte->read_bytes;
+  }
+  else
+    p->kind = CKPT_DATA;
+}
+
+/* Find a name of the file of INODE in the root directory and store
+   it into NAME.  Returns false if it has none. */
+static bool
+find_name (struct inode *inode, char name[NAME_MAX + 1])
+{
+  struct dir *dir = dir_open_root ();
+  bool found = false;
+
+  if (dir == NULL)
+    return false;
+  while (!found && dir_readdir (dir, name)) {
+    struct inode *other;
+    if (dir_lookup (dir, name, &other)) {
+      found = inode_get_inumber (other) == inode_get_inumber (inode);
+      inode_close (other);
+    }
+  }
+  dir_close (dir);
+  return found;
+}
+
+/**
+ * Open NAME if it is a checkpoint, made by vm_checkpoint_save().
+ * Returns the file, or NULL if it is not one or cannot be opened.
+ */
+struct file *
+vm_checkpoint_open (const char *name)
+{
+  struct file *file = filesys_open (name);
+  uint32_t magic;
+
+  if (file != NULL
+      && (file_read_at (file, &magic, sizeof magic, 0) != sizeof magic
+          || magic != CKPT_MAGIC)) {
+    file_close (file);
+    file = NULL;
+  }
+  return file;
+}
+
+/**
+ * Restore the process saved in CKPT, opened by vm_checkpoint_open(),
+ * into the current thread, which has no address space yet, in place
+ * of loading an executable; and set IF_ to return to it.  CKPT is
+ * closed when the process exits.
+ * Returns false if the checkpoint is damaged, if a file it names is
+ * gone, or if out of memory.
+ */
+bool
+vm_checkpoint_restore (struct file *ckpt, struct intr_frame *if_)
+{
+  struct thread *t = thread_current ();
+  struct ckpt_header *hdr = palloc_get_page (0);
+  uint8_t *buf = palloc_get_page (0);
+  bool success = false;
+  size_t i;
+
+  // the saved pages are loaded from CKPT as they fault
+  t->ckpt_file = ckpt;
+  file_deny_write (ckpt);
+
+  if (hdr == NULL || buf == NULL
+      || file_read_at (ckpt, hdr, sizeof *hdr, 0) != sizeof *hdr)
+    goto done;
+
+  t->pagedir = pagedir_create ();
+  t->supt = vm_supt_create ();
+  if (t->pagedir == NULL || t->supt == NULL)
+    goto done;
+  process_activate ();
+  if (!pagedir_set_page (t->pagedir, TIME_PAGE, timer_time_page (), false))
+    goto done;
+
+  hdr->exec_name[NAME_MAX] = '\0';
+  t->file = filesys_open (hdr->exec_name);
+  if (t->file == NULL
+      || inode_get_inumber (file_get_inode (t->file)) != hdr->exec_inumber) {
+    printf ("restore: %s: executable %s is gone\n", thread_name (), hdr->exec_name);
+    goto done;
+  }
+  file_deny_write (t->file);
+
+  for (i = 0; i < hdr->page_cnt; i++) {
+    const struct ckpt_page *p = read_record (ckpt, buf, sizeof *hdr, i,
+        hdr->page_cnt, sizeof *p);
+    if (p == NULL || !restore_page (t->supt, p, t->file, ckpt))
+      goto done;
+  }
+  if (!restore_fds (ckpt, buf, hdr))
+    goto done;
+
+  t->heap_start = (uint8_t *) hdr->heap_start;
+  t->heap_break = (uint8_t *) hdr->heap_break;
+  t->heap_mapped = (uint8_t *) hdr->heap_mapped;
+
+  // back into the system call, as if it returned 1; only the
+  // registers that user code may set are taken from the file.
+  *if_ = hdr->regs;
+  if_->gs = if_->fs = if_->es = if_->ds = if_->ss = SEL_UDSEG;
+  if_->cs = SEL_UCSEG;
+  if_->eflags = FLAG_IF | FLAG_MBS;
+  if_->eax = 1;
+  success = true;
+
+ done:
+  palloc_free_page (buf);
+  palloc_free_page (hdr);
+  return success;
+}
+
+/* Return record I of the CNT records of SIZE bytes at OFS in FILE,
+   read into BUF, a page, along with those that follow it, unless
+   BUF already holds it.  Returns NULL on a short read. */
+static void *
+read_record (struct file *file, void *buf, off_t ofs, size_t i,
+    size_t cnt, size_t size)
+{
+  size_t per_page = PGSIZE / size;
+
+  if (i % per_page == 0) {
+    size_t n = cnt - i < per_page ? cnt - i : per_page;
+    if (file_read_at (file, buf, n * size, ofs + i * size) != (off_t) (n * size))
+      return NULL;
+  }
+  return (uint8_t *) buf + i % per_page * size;
+}
+
+/* Install the page of P into SUPT, to be loaded from EXEC or CKPT.
+   Returns false if P is not a valid page, or if out of memory. */
+static bool
+restore_page (struct supplemental_page_table *supt,
+    const struct ckpt_page *p, struct file *exec, struct file *ckpt)
+{
+  void *upage = (void *) p->upage;
+
+  if (pg_ofs (upage) != 0 || !is_user_vaddr (upage) || upage == TIME_PAGE
+      || p->read_bytes > PGSIZE || vm_supt_has_entry (supt, upage))
+    return false;
+
+  switch (p->kind)
+  {
+  case CKPT_ZERO:
+    if (p->writable)
+      return vm_supt_install_zeropage (supt, upage);
+    return vm_supt_lazy_load (supt, upage, exec, 0, 0, PGSIZE, false);
+
+  case CKPT_EXEC:
+    return vm_supt_lazy_load (supt, upage, exec, p->ofs, p->read_bytes,
+        PGSIZE - p->read_bytes, p->writable);
+
+  case CKPT_DATA:
+    return vm_supt_lazy_load (supt, upage, ckpt, p->ofs, PGSIZE, 0, p->writable);
+
+  default:
+    return false;
+  }
+}
+
+/* Reopen the files recorded in CKPT, whose header is HDR, at their
+   fds and positions, using BUF, a page.  They take the place of
+   the pipe ends inherited at the same fds.  Returns false, with
+   none open, if one of them is gone, or if out of memory. */
+static bool
+restore_fds (struct file *ckpt, void *buf, const struct ckpt_header *hdr)
+{
+  off_t ofs = sizeof *hdr + hdr->page_cnt * sizeof (struct ckpt_page);
+  size_t i;
+
+  for (i = 0; i < hdr->fd_cnt; i++) {
+    struct ckpt_fd *r = read_record (ckpt, buf, ofs, i, hdr->fd_cnt, sizeof *r);
+    struct file *file = NULL;
+
+    if (r != NULL) {
+      r->name[NAME_MAX] = '\0';
+      file = filesys_open (r->name);
+      if (file != NULL && inode_get_inumber (file_get_inode (file)) != r->inumber) {
+        file_close (file);
+        file = NULL;
+      }
+      if (file == NULL)
+        printf ("restore: %s: file %s is gone\n", thread_name (), r->name);
+    }
+    if (file != NULL) {
+      // in place of a pipe end inherited at the same fd
+      file_seek (file, r->pos);
+      close_openfile (r->fd);
+      if (!install_fd (r->fd, file)) {
+        file_close (file);
+        file = NULL;
+      }
+    }
+    if (file == NULL) {
+      while (i-- > 0) {
+        struct ckpt_fd undo;
+        if (file_read_at (ckpt, &undo, sizeof undo, ofs + i * sizeof undo)
+            == sizeof undo)
+          close_openfile (undo.fd);
+      }
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,13 @@
+#ifndef VM_CHECKPOINT_H
+#define VM_CHECKPOINT_H
+
+#include <stdbool.h>
+
+struct file;
+struct intr_frame;
+
+bool vm_checkpoint_save (const char *name);
+struct file *vm_checkpoint_open (const char *name);
+bool vm_checkpoint_restore (struct file *, struct intr_frame *);
+
+#endif /* vm/checkpoint.h */
@@ -1,117 +1,769 @@
 #include <hash.h>
 #include <list.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "lib/kernel/hash.h"
 #include "lib/kernel/list.h"
 
 #include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
 #include "vm/swap.h"
+#include "threads/interrupt.h"
 #include "threads/thread.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/palloc.h"
+#include "threads/shrink.h"
+#include "threads/trace.h"
+#include "threads/tunable.h"
+#include "userprog/futex.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "devices/virtio-balloon.h"
+#include "filesys/file.h"
 
 
 /* A global lock, to ensure critical sections on frame operations.
-  for synchronization */
+  for synchronization
+  It is not held while evicted frames are written to swap: those
+  frames are marked busy instead (see vm_frame_do_evict()). */
 static struct lock frame_lock;
 
-/* A mapping from (kpage) physical address to frame table entry. */
-static struct hash frame_map;
+/* Signaled (with frame_lock) whenever frames stop being busy. */
+static struct condition frame_transit;
+static size_t frame_busy_cnt;       /* Number of busy frames. */
 
-/* A (circular) list of frames for the clock eviction algorithm. */
-static struct list frame_list;      /* the list */
-static struct list_elem *clock_ptr; /* the pointer in clock algorithm */
+/* The frame table: one entry per page of the user pool, indexed by
+   its page number in the pool (see vm_frame_lookup() / frame_kpage()). */
+static struct frame_table_entry *frame_table;
+static uint8_t *frame_base;         /* palloc_user_base() */
+static size_t frame_cnt;            /* Number of entries. */
+static size_t frame_used;           /* Number of entries in use. */
+static size_t frame_locked;         /* Number of entries with locks. */
 
-static unsigned frame_hash_func(const struct hash_elem *elem, void *aux);
-static bool     frame_less_func(const struct hash_elem *, const struct hash_elem *, void *aux);
+/* Shared read-only file pages: a mapping from (inode, offset) to
+   the frame holding that page of the file.  All the processes
+   mapping the page share that one frame, and reads of the file
+   are served from it too (see vm_frame_read_shared()). */
+static struct hash shared_map;
 
-/* One element of the frame table, or like a frame
+/* Merged anonymous pages: a mapping from the contents of a page to
+   the frame holding it, read-only, for all the processes that had an
+   identical copy of it (see "Page merging" below).  These frames are
+   shared frames with a null inode. */
+static struct hash ksm_map;
+
+/* The shared zero page, mapped read-only by all the pages that are
+   all zero until they are first written (see vm/page.c).  It is not
+   in the frame table, and never evicted. */
+static void *zero_page;
+
+/* Per-process resident-set limit (-rss-limit): a process owning this
+   many frames gets new ones by evicting its own (see
+   vm_frame_do_allocate()).  Each thread's count is its `rss', kept up
+   to date under frame_lock; a shared frame counts for its owner only. */
+size_t vm_rss_limit = 0;
+
+/* The page-replacement policy (see "Replacement Policies" below),
+   chosen by the kernel command-line option "-page-policy". */
+struct frame_policy;
+static const struct frame_policy *policy;
+
+/* The frames in use, on two LRU lists for eviction by the "lru"
+   policy (see lru_pick_victim()): most recently used at the front. */
+static struct list active_list;     /* Referenced again since they came in. */
+static struct list inactive_list;   /* New, or not referenced lately. */
+static size_t active_cnt, inactive_cnt;
+
+/* The frames in use, oldest first, for the "fifo" policy. */
+static struct list fifo_list;
+
+/* Index of the next frame looked at by the "clock" and "wsclock"
+   policies, which sweep the frame table. */
+static size_t clock_hand;
+
+/* The process killed for memory and not yet gone (see oom_kill()),
+   or null: only one at a time. */
+static struct thread *oom_victim;
+
+/* The pageout thread: free-frame watermarks (in pages), and its wakeup. */
+static size_t pageout_low, pageout_high;
+static bool pageout_active;         /* Woken up and not yet done (frame_lock). */
+static struct semaphore pageout_wakeup;
+static void pageout_tuned (void);
+
+static struct tunable frame_tunables[] =
+  {
+    TUNABLE ("vm.rss_limit", vm_rss_limit, 0, INT32_MAX, NULL),
+  };
+
+/* Set while the pageout thread runs: LOW == 0 stops the wakeups. */
+static struct tunable pageout_tunables[] =
+  {
+    TUNABLE ("vm.pageout_low", pageout_low, 0, INT32_MAX, pageout_tuned),
+    TUNABLE ("vm.pageout_high", pageout_high, 0, INT32_MAX, pageout_tuned),
+  };
+
+/* The wss thread (see vm_frame_start_wss()): a frame not referenced
+   in the last WSS_WINDOW scans is out of the working set. */
+#define WSS_WINDOW 4
+static unsigned wss_interval;       /* Time between two scans (ms), 0 if off. */
+static uint64_t wss_scans;          /* Scans done. */
+static size_t wss_total;            /* Sum of the working sets (frame_lock). */
+static struct condition wss_published; /* Signaled after each scan. */
+
+/* Object caches for the sharing state of shared frames and for
+   their further mappings. */
+static struct kmem_cache shared_cache;
+static struct kmem_cache mapping_cache;
+
+static unsigned shared_hash_func(const struct hash_elem *elem, void *aux);
+static bool     shared_less_func(const struct hash_elem *, const struct hash_elem *, void *aux);
+static unsigned ksm_hash_func(const struct hash_elem *elem, void *aux);
+static bool     ksm_less_func(const struct hash_elem *, const struct hash_elem *, void *aux);
+
+/* One element of the frame table, or like a frame.
+ * Its kernel address (kpage) is implied by its index in the table.
  */
 struct frame_table_entry
   {
-    void *kpage;               /* Kernel (virtual memory) address, pointer to frame (coi nhu vay), also the key to hash funtion*/
     void *upage;               /* User (virtual memory) address, pointer to page */
-
-    struct hash_elem helem;    /* belong to frame_map */
-    struct list_elem lelem;    /* belong to frame_list */
-
-    struct thread *t;          /* The associated thread. */
+    struct thread *t;          /* The associated thread, or NULL if the frame is free. */
+    struct shared_frame *shared; /* Sharing state, or NULL if the frame is private. */
+    struct list_elem lru_elem;  /* In the policy's lists, if in use. */
+    bool active;               /* In active_list? */
+    bool once;                 /* Referenced once while inactive: promoted to
+                                  active_list if referenced again. */
     bool pinned;               /* Used to prevent a frame from being evicted, while it is acquiring some resources.
                                   If it is true, it is never evicted. */
+    bool busy;                 /* Being written to swap: unmapped, but the owner's
+                                  SPTE is still ON_FRAME until the write is done. */
+    bool cold;                 /* Not needed again soon (madvise): evicted first. */
+    uint16_t locks;            /* Pages locked in memory (mlock) mapped to it: while
+                                  nonzero, it is never evicted nor merged. Unlike
+                                  `pinned', it is not cleared by vm_frame_unpin(). */
+    bool referenced;           /* Accessed bit cleared by the wss thread, not yet
+                                  seen by eviction. */
+    uint8_t idle;              /* Scans of the wss thread since it was last
+                                  referenced (saturating). */
+    int64_t last_used;         /* Timer tick it was last seen referenced
+                                  at, for the "wsclock" policy. */
+  };
+
+/* The sharing state of a frame holding a read-only page of a file,
+   a merged page, or a page of a shared-memory object. */
+struct shared_frame
+  {
+    struct frame_table_entry *frame;
+    struct inode *inode;       /* The file, the key of shared_map with */
+    off_t file_offset;         /* ... the offset */
+    uint32_t read_bytes;       /* ... and the length of the page's data. */
+    unsigned checksum;         /* Of the contents, if merged (inode == NULL). */
+    bool forked;               /* Merged by fork(), not by contents: it is
+                                  not in ksm_map (see vm_frame_fork()). */
+    struct vm_shm *shm;        /* The shared-memory object, if the page is
+                                  one of its (not in any hash then) ... */
+    size_t shm_idx;            /* ... and its index there. */
+    struct hash_elem elem;     /* belong to shared_map (or ksm_map, if merged) */
+    struct list sharers;       /* Mappings other than (t, upage), of struct frame_mapping. */
+  };
+
+/* A further mapping of a shared frame, in another process
+   (or at another address). */
+struct frame_mapping
+  {
+    struct thread *t;
+    void *upage;
+    swap_index_t swap_index;   /* Its copy, while a merged frame is being evicted. */
+    struct list_elem elem;     /* belong to frame_table_entry's sharers */
+  };
+
+/* A page-replacement policy (see "Replacement Policies" below).
+   Its operations are called with frame_lock held. */
+struct frame_policy
+  {
+    const char *name;          /* Its name for "-page-policy". */
+    void (*on_alloc) (struct frame_table_entry *);  /* F came into use. */
+    void (*on_free) (struct frame_table_entry *);   /* F is no longer in use. */
+    void (*on_cold) (struct frame_table_entry *);   /* F was made cold. */
+    void (*on_access_sample) (struct frame_table_entry *, bool accessed);
+                               /* The wss thread looked at F; may be null. */
+    struct frame_table_entry *(*pick_victim) (struct thread *only);
+                               /* Frame to evict, or null if none can go. */
   };
 
 
-static struct frame_table_entry* clock_pick_evict_frame(uint32_t* pagedir);
+static bool vm_frame_do_evict (struct thread *only);
 static void vm_frame_do_free (void *kpage, bool free_page);
+static void pageout_thread (void *aux);
+static struct frame_table_entry* vm_frame_lookup (void *kpage);
+static void* vm_frame_do_allocate (void *upage, enum palloc_flags,
+    bool may_evict);
+static void vm_frame_unmap_shared (struct frame_table_entry *);
+static bool frame_test_and_clear_accessed (struct frame_table_entry *);
+static bool frame_has_sharers (struct frame_table_entry *);
+static bool vm_frame_evict_merged (struct frame_table_entry *);
+static bool vm_frame_evict_shm (struct frame_table_entry *);
+static void frame_drop_mapping (struct frame_table_entry *, struct thread *, void *upage);
+static void ksm_thread (void *aux);
+static void wss_thread (void *aux);
+static bool oom_kill (struct thread *cur);
+
+/* Returns whether the frame F is a merged anonymous page. */
+static inline bool
+frame_is_merged (struct frame_table_entry *f)
+{
+  return f->shared != NULL && f->shared->inode == NULL && f->shared->shm == NULL;
+}
+
+/* Returns whether the frame F is a page of a shared-memory object. */
+static inline bool
+frame_is_shm (struct frame_table_entry *f)
+{
+  return f->shared != NULL && f->shared->shm != NULL;
+}
+
+/* Returns the kernel address of the page of frame F. */
+static inline void*
+frame_kpage (struct frame_table_entry *f)
+{
+  return frame_base + (size_t) (f - frame_table) * PGSIZE;
+}
 
 
 // init frame table
 void
 vm_frame_init ()
 {
-  lock_init (&frame_lock);
-  hash_init (&frame_map, frame_hash_func, frame_less_func, NULL);
-  list_init (&frame_list);
-  clock_ptr = NULL;
+  lock_init_named (&frame_lock, "frame");
+  cond_init (&frame_transit);
+  frame_busy_cnt = 0;
+  hash_init (&shared_map, shared_hash_func, shared_less_func, NULL);
+  hash_init (&ksm_map, ksm_hash_func, ksm_less_func, NULL);
+
+  frame_base = palloc_user_base ();
+  frame_cnt = palloc_user_page_cnt ();
+  frame_used = 0;
+  frame_table = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+      DIV_ROUND_UP (frame_cnt * sizeof *frame_table, PGSIZE));
+  list_init (&active_list);
+  list_init (&inactive_list);
+  active_cnt = inactive_cnt = 0;
+  list_init (&fifo_list);
+  clock_hand = 0;
+  if (policy == NULL)
+    vm_frame_set_policy ("lru");
+
+  kmem_cache_init (&shared_cache, "shared frame", sizeof (struct shared_frame),
+      0, NULL);
+  kmem_cache_init (&mapping_cache, "frame mapping",
+      sizeof (struct frame_mapping), 0, NULL);
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  tunable_register (frame_tunables,
+                    sizeof frame_tunables / sizeof *frame_tunables);
+}
+
+/* Returns the shared zero page. */
+void*
+vm_frame_zero_page (void)
+{
+  return zero_page;
+}
+
+/**
+ * Evict one frame chosen by the policy: unmap it from its
+ * owner, write it to swap (or just drop it, if it is a clean
+ * file-backed page) and free the physical page.
+ *
+ * A victim that goes to swap takes along the unreferenced, unpinned
+ * resident pages that follow it in its owner's address space (up
+ * to vm_swap_cluster pages), so that they land in contiguous swap
+ * slots and can be read back together (see vm/page.c).
+ *
+ * The cluster is claimed (unmapped and marked busy) under frame_lock,
+ * but the lock is released while it is written to swap, so that other
+ * faults can go on meanwhile; the frames are freed once it is back.
+ *
+ * If ONLY is not NULL, the victim is one of the frames owned by ONLY
+ * (local eviction), otherwise any frame.
+ *
+ * Returns false if there was no frame that could be evicted.
+ * MUST BE CALLED with 'frame_lock' held, which may be released
+ * and re-acquired in between.
+ */
+static bool
+vm_frame_do_evict (struct thread *only)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  // pick a victim
+  struct frame_table_entry *f_evicted = policy->pick_victim(only);
+  if (f_evicted == NULL)
+    return false;
+  TRACE (TRACE_EVICT, f_evicted->upage, f_evicted->t->tid);
+
+  ASSERT (f_evicted->t != NULL);
+
+  struct thread *owner = f_evicted->t;
+  uint32_t *pagedir = owner->pagedir;
+  owner->usage.evictions++; // under frame_lock, whoever is evicting
+
+  // a shared-memory page goes to the swap of its object
+  if (frame_is_shm (f_evicted))
+    return vm_frame_evict_shm (f_evicted);
+
+  // a merged page has to be swapped out for every process mapping it
+  if (frame_is_merged (f_evicted))
+    return vm_frame_evict_merged (f_evicted);
+
+  // a shared page is read-only, and thus clean: unmap it from every sharer.
+  if (f_evicted->shared != NULL) {
+    vm_frame_unmap_shared (f_evicted);
+    vm_frame_do_free(frame_kpage (f_evicted), true); // f_evicted is also invalidated
+    return true;
+  }
+
+  // clear the mapping to page tables, and replace it with swap
+  ASSERT (pagedir != (void*)0xcccccccc);
+  bool is_dirty = pagedir_is_dirty(pagedir, f_evicted->upage);
+  pagedir_clear_page(pagedir, f_evicted->upage);
+
+  // a modified page of a memory-mapped file goes back to its file,
+  // written without frame_lock like a swap-out (see below).
+  struct supplemental_page_table_entry *spte_evicted =
+    vm_supt_lookup(owner->supt, f_evicted->upage);
+  if (spte_evicted->mmap && (is_dirty || spte_evicted->dirty)) {
+    f_evicted->busy = true;
+    frame_busy_cnt++;
+
+    lock_release (&frame_lock);
+    file_write_at (spte_evicted->file, frame_kpage (f_evicted),
+        spte_evicted->read_bytes, spte_evicted->file_offset);
+    lock_acquire (&frame_lock);
+
+    f_evicted->busy = false;
+    frame_busy_cnt--;
+    spte_evicted->dirty = false;
+    is_dirty = false;
+  }
+
+  // a page swapped in and not modified since still has its copy on
+  // swap: it goes back to that slot without a write.
+  if (spte_evicted->swap_index != SWAP_NONE) {
+    if (!is_dirty) {
+      vm_supt_set_swap(owner->supt, pagedir, f_evicted->upage,
+          spte_evicted->swap_index);
+      vm_frame_do_free(frame_kpage (f_evicted), true); // f_evicted is also invalidated
+      cond_broadcast (&frame_transit, &frame_lock);
+      return true;
+    }
+    vm_supt_drop_swap_cache (owner->supt, spte_evicted);
+  }
+
+  // a clean file-backed page is simply dropped, and re-read from its file
+  // on the next fault. Otherwise, swap.
+  if (vm_supt_set_filesys(owner->supt, f_evicted->upage, is_dirty)) {
+    vm_frame_do_free(frame_kpage (f_evicted), true); // f_evicted is also invalidated
+    cond_broadcast (&frame_transit, &frame_lock);
+    return true;
+  }
+
+  // gather the cluster: the victim, then its virtually-following
+  // neighbours. Each is marked busy as it is unmapped, so that a fault
+  // on it waits for the write instead of finding it ON_FRAME but not
+  // mapped (see vm_frame_wait_transit()).
+  struct frame_table_entry *cluster[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t n = 0;
+  f_evicted->busy = true;
+  frame_busy_cnt++;
+  cluster[n] = f_evicted;
+  kpages[n++] = frame_kpage (f_evicted);
+
+  uint8_t *upage = (uint8_t *) f_evicted->upage + PGSIZE;
+  size_t cluster_max = vm_swap_cluster;
+  for (; n < cluster_max && is_user_vaddr (upage); upage += PGSIZE) {
+    struct supplemental_page_table_entry *spte = vm_supt_lookup(owner->supt, upage);
+    if (spte == NULL || spte->status != ON_FRAME || spte->kpage == NULL) break;
+
+    struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+    if (f == NULL || f->pinned || f->busy || f->locks > 0 || f->t != owner) break;
+    if (f->shared != NULL) break;
+    if (pagedir_is_accessed(pagedir, upage)) break;
+
+    // a memory-mapped page is never swapped
+    if (spte->mmap) break;
+
+    // a clean file-backed page is cheaper to drop than to swap
+    bool dirty = pagedir_is_dirty(pagedir, upage);
+    if (!dirty && spte->file != NULL && !spte->dirty) break;
+    // and so is a clean one that still has its copy on swap
+    if (spte->swap_index != SWAP_NONE) {
+      if (!dirty) break;
+      vm_supt_drop_swap_cache (owner->supt, spte);
+    }
+
+    pagedir_clear_page(pagedir, upage);
+    f->busy = true;
+    frame_busy_cnt++;
+    spte->dirty = spte->dirty || dirty;
+    cluster[n] = f;
+    kpages[n++] = spte->kpage;
+  }
+
+  // write it out, without holding frame_lock. The owner waits for the
+  // busy frames if it faults on them again or exits (see vm/page.c).
+  size_t i;
+  lock_release (&frame_lock);
+  swap_index_t swap_idx;
+  size_t written = vm_swap_out_cluster (kpages, n, &swap_idx);
+  lock_acquire (&frame_lock);
+
+  // the tail that does not fit into contiguous slots is mapped back in
+  // again: all of the cluster, if the swap is full.
+  for (i = 0; i < n; i++) {
+    struct frame_table_entry *f = cluster[i];
+    f->busy = false;
+    frame_busy_cnt--;
+    if (i < written) {
+      vm_supt_set_swap(owner->supt, pagedir, f->upage, swap_idx + i);
+      vm_frame_do_free(frame_kpage (f), true); // f is also invalidated
+    }
+    else {
+      struct supplemental_page_table_entry *spte = vm_supt_lookup(owner->supt, f->upage);
+      if (!pagedir_set_page (pagedir, f->upage, frame_kpage (f), spte->writable))
+        PANIC ("Cannot restore the mapping of an unclustered page");
+    }
+  }
+  cond_broadcast (&frame_transit, &frame_lock);
+  return written > 0;
+}
+
+/**
+ * Evict the merged frame F, for vm_frame_do_evict(): every process
+ * mapping it gets a copy of the page on swap of its own, as if it
+ * had never been merged.
+ *
+ * The copies are written without frame_lock, with F busy. The
+ * mappings are detached from F meanwhile, so a thread exiting in
+ * between waits for every busy merged frame (see
+ * vm_frame_release_all()). Their slots are reserved beforehand:
+ * returns false, leaving F as it was, if the swap is full.
+ */
+static bool
+vm_frame_evict_merged (struct frame_table_entry *f)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  struct list_elem *e, *r;
+  swap_index_t swap_idx = vm_swap_alloc ();
+  if (swap_idx == SWAP_NONE) return false;
+  for (e = list_begin (&f->shared->sharers); e != list_end (&f->shared->sharers);
+       e = list_next (e)) {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    m->swap_index = vm_swap_alloc ();
+    if (m->swap_index == SWAP_NONE) {
+      vm_swap_free (swap_idx);
+      for (r = list_begin (&f->shared->sharers); r != e; r = list_next (r))
+        vm_swap_free (list_entry (r, struct frame_mapping, elem)->swap_index);
+      return false;
+    }
+  }
+
+  struct list mappings;
+  list_init (&mappings);
+  while (!list_empty (&f->shared->sharers))
+    list_push_back (&mappings, list_pop_front (&f->shared->sharers));
+
+  pagedir_clear_page (f->t->pagedir, f->upage);
+  for (e = list_begin (&mappings); e != list_end (&mappings); e = list_next (e)) {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    pagedir_clear_page (m->t->pagedir, m->upage);
+  }
+
+  f->busy = true;
+  frame_busy_cnt++;
+
+  lock_release (&frame_lock);
+  vm_swap_write (swap_idx, frame_kpage (f));
+  for (e = list_begin (&mappings); e != list_end (&mappings); e = list_next (e))
+    vm_swap_write (list_entry (e, struct frame_mapping, elem)->swap_index, frame_kpage (f));
+  lock_acquire (&frame_lock);
+
+  f->busy = false;
+  frame_busy_cnt--;
+  vm_supt_set_swap (f->t->supt, f->t->pagedir, f->upage, swap_idx);
+  while (!list_empty (&mappings)) {
+    struct frame_mapping *m =
+      list_entry (list_pop_front (&mappings), struct frame_mapping, elem);
+    vm_supt_set_swap (m->t->supt, m->t->pagedir, m->upage, m->swap_index);
+    kmem_cache_free (&mapping_cache, m);
+  }
+
+  vm_frame_do_free (frame_kpage (f), true); // f is also invalidated
+  cond_broadcast (&frame_transit, &frame_lock);
+  return true;
 }
 
 /**
  * Allocate a new frame, insert it to frame table
  * and return the address of the associated page.
  * while input is pointer to the required page
+ *
+ * The new frame is pinned; the caller unpins it once the page
+ * has been loaded and mapped. With PAL_ZERO in FLAGS it comes
+ * zeroed, usually by the idle thread ahead of time.
+ */
+void*
+vm_frame_allocate (void *upage, enum palloc_flags flags)
+{
+  return vm_frame_do_allocate (upage, flags, true);
+}
+
+/**
+ * Like vm_frame_allocate(), but only succeeds if there is a free
+ * frame: never evicts. Returns NULL otherwise.
  */
 void*
-vm_frame_allocate (void *upage)
+vm_frame_try_allocate (void *upage, enum palloc_flags flags)
+{
+  return vm_frame_do_allocate (upage, flags, false);
+}
+
+/* Common part of the above; evicts a frame only if MAY_EVICT. */
+static void*
+vm_frame_do_allocate (void *upage, enum palloc_flags flags, bool may_evict)
 {
   lock_acquire (&frame_lock);
 
-  void *frame_page = palloc_get_page (PAL_USER);
+  // over its resident-set limit, a process pays with its own frames,
+  // not with the working sets of the others. If none of them can go
+  // (all pinned or being written out), fall back to global eviction.
+  // Frames belong to the main thread, whichever thread faulted.
+  struct thread *cur = thread_current ()->process;
+  while (may_evict && vm_rss_limit > 0 && cur->rss >= vm_rss_limit)
+    if (!vm_frame_do_evict (cur)) break;
+
+  void *frame_page;
+  size_t misses = 0;
+  while ((frame_page = palloc_get_page (PAL_USER | flags)) == NULL) {
+    if (!may_evict) {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+
+    // page allocation failed. Pages the host let us put in the
+    // balloon come back first, with no I/O.
+    if (virtio_balloon_reclaim () > 0)
+      continue;
 
-  if (frame_page == NULL) {
-    // page allocation failed.
-    /* first, swap out the page */
+    /* then, swap out the page. frame_lock is dropped during the write,
+       so another thread may take the freed frame first: try again. */
+    if (vm_frame_do_evict (NULL)) {
+      misses = 0;
+      continue;
+    }
+    // everything evictable is already being written out
+    if (frame_busy_cnt > 0) {
+      cond_wait (&frame_transit, &frame_lock);
+      continue;
+    }
+    // with the swap full, the lists may yet come to a page that needs
+    // no slot: one of a file, or one still on swap
+    if (vm_swap_is_full () && ++misses < frame_cnt)
+      continue;
 
-    // pick a victim
-    struct frame_table_entry *f_evicted = clock_pick_evict_frame( thread_current()->pagedir );
- 
-    // printf("f_evicted: %x th=%x, pagedir = %x, up = %x, kp = %x, hash_size=%d\n", f_evicted, f_evicted->t,
-    //     f_evicted->t->pagedir, f_evicted->upage, f_evicted->kpage, hash_size(&frame_map));
-    ASSERT (f_evicted != NULL && f_evicted->t != NULL);
+    // out of memory: a process has to go
+    misses = 0;
+    if (!oom_kill (cur)) {
+      lock_release (&frame_lock);
+      return NULL;
+    }
+  }
 
-    // clear the mapping to page tables, and replace it with swap
-    ASSERT (f_evicted->t->pagedir != (void*)0xcccccccc);
-    pagedir_clear_page(f_evicted->t->pagedir, f_evicted->upage);
+  struct frame_table_entry *frame = &frame_table[pg_no (frame_page) - pg_no (frame_base)];
+  ASSERT (frame->t == NULL);
 
-    // swap
-    swap_index_t swap_idx = vm_swap_out( f_evicted->kpage );
-    vm_supt_set_swap(f_evicted->t->supt, f_evicted->upage, swap_idx);
-   
-    vm_frame_do_free(f_evicted->kpage, true); // f_evicted is also invalidated
+  frame->t = cur;
+  frame->upage = upage;
+  frame->pinned = true;          // can't be evicted yet
+  frame->busy = false;
+  frame->cold = false;
+  frame->locks = 0;
+  frame->referenced = false;
+  frame->idle = 0;
+  frame->shared = NULL;
+  frame_used++;
+  cur->rss++;
+  policy->on_alloc (frame);
 
-    frame_page = palloc_get_page (PAL_USER);
-    ASSERT (frame_page != NULL); // should success in this chance
+  // running short of free frames: let the pageout thread reclaim some
+  // ahead of demand.
+  if (pageout_low > 0 && !pageout_active
+      && palloc_free_count (PAL_USER) < pageout_low) {
+    pageout_active = true;
+    sema_up (&pageout_wakeup);
   }
 
-  struct frame_table_entry *frame = malloc(sizeof(struct frame_table_entry));
-  if(frame == NULL) {
-    // frame allocation failed. a critical state or panic?
+  lock_release (&frame_lock);
+  return frame_page;
+}
+
+/**
+ * Start the pageout thread, which keeps the number of free user
+ * frames between LOW and HIGH pages.  It is woken up when fewer
+ * than LOW frames are free, and evicts frames until HIGH frames
+ * are free again.  LOW == 0 disables the thread.
+ */
+void
+vm_frame_start_pageout (size_t low, size_t high)
+{
+  if (low == 0)
+    return;
+  if (high < low)
+    high = low;
+
+  pageout_high = high;
+  sema_init (&pageout_wakeup, 0);
+  thread_create ("pageout", PRI_DEFAULT, pageout_thread, NULL);
+
+  // only now allocations may wake the thread up
+  pageout_low = low;
+  tunable_register (pageout_tunables,
+                    sizeof pageout_tunables / sizeof *pageout_tunables);
+}
+
+/* Keeps the high watermark no lower than the low one, when either
+   is tuned. */
+static void
+pageout_tuned (void)
+{
+  if (pageout_high < pageout_low)
+    pageout_high = pageout_low;
+}
+
+/* Body of the pageout thread. */
+static void
+pageout_thread (void *aux UNUSED)
+{
+  for (;;) {
+    sema_down (&pageout_wakeup);
+
+    lock_acquire (&frame_lock);
+    size_t lru_cnt = frame_used;
+    lock_release (&frame_lock);
+
+    // one frame at a time, so that faulting processes are not held
+    // off frame_lock for the whole batch.
+    size_t evicted_cnt = 0;
+    while (palloc_free_count (PAL_USER) < pageout_high) {
+      lock_acquire (&frame_lock);
+      bool evicted = vm_frame_do_evict (NULL);
+      lock_release (&frame_lock);
+      if (!evicted) break;
+      evicted_cnt++;
+      thread_preempt_point ();
+    }
+
+    // put the kernel's caches under the same pressure as the user
+    // pages, then, since the page tables and metadata of the pages
+    // evicted or freed come from the kernel pool, hand back slabs
+    // left empty.
+    shrink_caches (evicted_cnt, lru_cnt);
+    kmem_reap ();
+
+    lock_acquire (&frame_lock);
+    pageout_active = false;
     lock_release (&frame_lock);
-    return NULL;
   }
+}
 
-  frame->t = thread_current ();
-  frame->upage = upage;
-  frame->kpage = frame_page;
-  frame->pinned = false;         // can't be evicted yet
+/* The process chosen by oom_consider() so far, and its pages. */
+struct oom_choice
+  {
+    struct thread *victim;
+    size_t pages;
+  };
+
+/* Makes T, if it is the main thread of a process that is not
+   exiting yet, the victim of CHOICE_ if it has more pages on frames
+   and on swap than the one chosen so far.  A process with a thread
+   blocked where exiting does not wake it, such as a parent waiting
+   for the child that is short of memory, is spared: it would not
+   give its memory back (see process_block()). */
+static void
+oom_consider (struct thread *t, void *choice_)
+{
+  struct oom_choice *choice = choice_;
+
+  if (t->process != t || t->supt == NULL || t->exiting
+      || t->blocked_cnt > 0) return;
+
+  size_t pages = t->rss + t->supt->swap_cnt;
+  if (choice->victim == NULL || pages > choice->pages) {
+    choice->victim = t;
+    choice->pages = pages;
+  }
+}
+
+/* Out of memory -- every frame pinned, or the swap full -- for an
+   allocation by process CUR: kills the process with the most pages
+   on frames and on swap, as if it had called exit(-1), and waits
+   until its memory is freed (see vm_frame_exited()).  Only one
+   process is killed at a time; the others short of memory wait for
+   it too.  Returns false, without waiting, if the victim is CUR
+   itself: the allocation fails then, and CUR exits on its way out
+   of the kernel; or if no process can be killed: the allocation
+   just fails. */
+static bool
+oom_kill (struct thread *cur)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  if (oom_victim == NULL) {
+    struct oom_choice choice = { NULL, 0 };
+    enum intr_level old_level = intr_disable ();
+    thread_foreach (oom_consider, &choice);
+    if (choice.victim != NULL)
+      process_kill (choice.victim);
+    intr_set_level (old_level);
+    if (choice.victim == NULL)
+      return false;
+
+    oom_victim = choice.victim;
+    printf ("Out of memory: killed %s, %zu frames, %zu pages on swap\n",
+            oom_victim->name, oom_victim->rss, oom_victim->supt->swap_cnt);
 
-  // insert into hash table: frame table
-  hash_insert (&frame_map, &frame->helem);
-  list_push_back (&frame_list, &frame->lelem);
+    // wake its threads blocked on futexes (futex_lock comes first)
+    uint32_t *pagedir = oom_victim->pagedir;
+    lock_release (&frame_lock);
+    futex_wake_process (pagedir);
+    lock_acquire (&frame_lock);
+  }
+
+  if (oom_victim == cur) return false;
+  while (oom_victim != NULL)
+    cond_wait (&frame_transit, &frame_lock);
+  return true;
+}
 
+/**
+ * Note that the process T, exiting, has freed its frames and swap
+ * slots: if it was killed for memory, the allocations waiting for
+ * that go on.
+ */
+void
+vm_frame_exited (struct thread *t)
+{
+  lock_acquire (&frame_lock);
+  if (oom_victim == t) {
+    oom_victim = NULL;
+    cond_broadcast (&frame_transit, &frame_lock);
+  }
   lock_release (&frame_lock);
-  return frame_page;
 }
 
 /**
@@ -125,134 +777,1737 @@ vm_frame_free (void *kpage)
   lock_release (&frame_lock);
 }
 
+/* Waits until the frame of SPTE, if it is being written to swap, is
+   done; SPTE is then no longer ON_FRAME. frame_lock must be held. */
+static void
+frame_wait_transit (struct supplemental_page_table_entry *spte)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  while (spte->status == ON_FRAME) {
+    struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+    if (f == NULL || !f->busy) break;
+    cond_wait (&frame_transit, &frame_lock);
+  }
+}
+
 /**
- * Just removes then entry from table, do not palloc free.
+ * Wait until the page of SPTE is no longer being evicted: it is then
+ * either on its frame, and mapped in PAGEDIR again, or on swap.
+ * Returns false if it is on its frame but not mapped: a page is only
+ * unmapped from its frame, outside frame_lock, while it is busy, or
+ * while it is being removed for good.
  */
-void
-vm_frame_remove_entry (void *kpage)
+bool
+vm_frame_wait_transit (struct supplemental_page_table_entry *spte,
+    uint32_t *pagedir)
 {
   lock_acquire (&frame_lock);
-  vm_frame_do_free (kpage, false);
+  frame_wait_transit (spte);
+  bool mapped = spte->status != ON_FRAME
+    || pagedir_get_page (pagedir, spte->upage) != NULL;
   lock_release (&frame_lock);
+  return mapped;
 }
 
 /**
- * An (internal, private) method --
- * Deallocates a frame or page (internal procedure)
- * MUST BE CALLED with 'frame_lock' held.
+ * Mark the frame of the page of SPTE, if it is on one, as cold: the
+ * policy evicts it before the others (see on_cold below).
  */
 void
-vm_frame_do_free (void *kpage, bool free_page)
+vm_frame_set_cold (struct supplemental_page_table_entry *spte, bool cold)
 {
-  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
-  ASSERT (is_kernel_vaddr(kpage));
-  ASSERT (pg_ofs (kpage) == 0); // should be aligned
-
-  // hash lookup : a temporary entry
-  struct frame_table_entry f_tmp;
-  f_tmp.kpage = kpage;
+  lock_acquire (&frame_lock);
 
-  struct hash_elem *h = hash_find (&frame_map, &(f_tmp.helem));
-  if (h == NULL) {
-    return;//"The page to be freed is not stored in the table");
+  if (spte->status == ON_FRAME) {
+    struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+    if (f != NULL) {
+      f->cold = cold;
+      if (cold)
+        policy->on_cold (f);
+    }
   }
 
-  struct frame_table_entry *f;
-  f = hash_entry(h, struct frame_table_entry, helem);
+  lock_release (&frame_lock);
+}
+
+/**
+ * Pin the frame of the page of SPTE, after waiting for it to be
+ * written out if it is being evicted.
+ * Returns false (pinning nothing) if the page is not on a frame then.
+ */
+bool
+vm_frame_pin_resident (struct supplemental_page_table_entry *spte)
+{
+  lock_acquire (&frame_lock);
 
-  hash_delete (&frame_map, &f->helem);
-  list_remove (&f->lelem);
+  frame_wait_transit (spte);
+  bool resident = spte->status == ON_FRAME;
+  if (resident) {
+    struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+    ASSERT (f != NULL);
+    f->pinned = true;
+  }
 
-  // Free resources
-  if(free_page) palloc_free_page(kpage);
-  free(f);
+  lock_release (&frame_lock);
+  return resident;
 }
 
-/** Frame Eviction: The Clock Algorithm */
-struct frame_table_entry* clock_next_frame(void);
-struct frame_table_entry* clock_pick_evict_frame( uint32_t *pagedir )
+/**
+ * Lock the frame of the page of SPTE in memory, for vm_supt_lock(),
+ * after waiting for it to be written out if it is being evicted.
+ * Returns false (locking nothing) if the page is not on a frame
+ * then, or is merged and writable: it must be loaded for writing.
+ */
+bool
+vm_frame_lock (struct supplemental_page_table_entry *spte)
 {
-  size_t n = hash_size(&frame_map);
-  if(n == 0) PANIC("Frame table is empty, can't happen - there is a leak somewhere");
-
-  size_t it;
-  for(it = 0; it <= n + n; ++ it) 
-  /* to prevent infinite loop, set 2n iterations,
-      worst case all frame are given second chance, 
-      at the second loop there is defenitely a victim*/
-  {
-    struct frame_table_entry *e = clock_next_frame();
-    // if pinned, continue
-    if(e->pinned) continue;
-    
-    // if referenced, give a second chance.
-    if( pagedir_is_accessed(pagedir, e->upage)) {
-      pagedir_set_accessed(pagedir, e->upage, false);
-      continue;
-    }
+  lock_acquire (&frame_lock);
 
-    return e;
-  }
+  frame_wait_transit (spte);
+  bool resident = spte->status == ON_FRAME
+    && !(spte->merged && spte->writable);
+  // the first page of the stack is not in the frame table, and
+  // never evicted anyway (see setup_stack())
+  struct frame_table_entry *f = resident ? vm_frame_lookup (spte->kpage) : NULL;
+  if (f != NULL && f->locks++ == 0)
+    frame_locked++;
 
-  PANIC ("Can't evict any frame -- Not enough memory!\n");
+  lock_release (&frame_lock);
+  return resident;
 }
-struct frame_table_entry* clock_next_frame(void)
+
+/**
+ * Unlock the frame of the page of SPTE, locked by vm_frame_lock().
+ */
+void
+vm_frame_unlock (struct supplemental_page_table_entry *spte)
 {
-  if (list_empty(&frame_list))
-    PANIC("Frame table is empty, can't happen - there is a leak somewhere");
+  lock_acquire (&frame_lock);
 
-  if (clock_ptr == NULL || clock_ptr == list_end(&frame_list))
-    clock_ptr = list_begin (&frame_list);
-  else
-    clock_ptr = list_next (clock_ptr);
+  ASSERT (spte->status == ON_FRAME);
+  struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+  if (f != NULL) {
+    ASSERT (f->locks > 0);
+    if (--f->locks == 0)
+      frame_locked--;
+  }
 
-  struct frame_table_entry *e = list_entry(clock_ptr, struct frame_table_entry, lelem);
-  return e;
+  lock_release (&frame_lock);
 }
 
+/**
+ * The number of frames locked in memory now.
+ */
+size_t
+vm_frame_locked_cnt (void)
+{
+  return frame_locked;
+}
 
-static void
-vm_frame_set_pinned (void *kpage, bool new_value)
+/**
+ * Like vm_frame_pin_resident(), for each of the CNT pages of SPTES at
+ * once: KPAGES[i] is set to the kernel address of the frame of
+ * SPTES[i] if it could be pinned, to NULL otherwise.
+ * If WRITE, merged pages are not pinned: they must be unmerged first.
+ * Returns the number of frames pinned.
+ */
+size_t
+vm_frame_pin_resident_range (struct supplemental_page_table_entry **sptes,
+    size_t cnt, void **kpages, bool write)
 {
+  size_t pinned = 0;
+  size_t i;
+
   lock_acquire (&frame_lock);
 
-  // hash lookup : a temporary entry
-  struct frame_table_entry f_tmp;
-  f_tmp.kpage = kpage;
-  struct hash_elem *h = hash_find (&frame_map, &(f_tmp.helem));
-  if (h == NULL) {
-    PANIC ("The frame to be pinned/unpinned does not exist");
-  }
+  for (i = 0; i < cnt; i++) {
+    kpages[i] = NULL;
+    frame_wait_transit (sptes[i]);
+    if (sptes[i]->status != ON_FRAME) continue;
+    if (write && sptes[i]->merged) continue;
 
-  struct frame_table_entry *f;
-  f = hash_entry(h, struct frame_table_entry, helem);
-  f->pinned = new_value;
+    struct frame_table_entry *f = vm_frame_lookup (sptes[i]->kpage);
+    ASSERT (f != NULL);
+    f->pinned = true;
+    kpages[i] = sptes[i]->kpage;
+    pinned++;
+  }
 
   lock_release (&frame_lock);
+  return pinned;
 }
 
+/**
+ * Unpin the frames of the CNT kernel pages of KPAGES. Pages that are
+ * not frames (the zero page, or NULL) are ignored.
+ */
 void
-vm_frame_unpin (void* kpage) {
-  vm_frame_set_pinned (kpage, false);
-}
+vm_frame_unpin_range (void **kpages, size_t cnt)
+{
+  size_t i;
 
-void
-vm_frame_pin (void* kpage) {
-  vm_frame_set_pinned (kpage, true);
-}
+  lock_acquire (&frame_lock);
 
+  for (i = 0; i < cnt; i++) {
+    struct frame_table_entry *f =
+      kpages[i] != NULL ? vm_frame_lookup (kpages[i]) : NULL;
+    if (f != NULL) f->pinned = false;
+  }
 
-/* Helpers */
+  lock_release (&frame_lock);
+}
 
-// Hash Functions required for [frame_map]. Uses 'kpage' as key.
-static unsigned frame_hash_func(const struct hash_elem *elem, void *aux UNUSED)
+/**
+ * Detach all the frames of T, which must be the current, exiting
+ * thread, from the frame table in one pass under frame_lock, after
+ * waiting for the ones being written to swap (whose pages are then
+ * ON_SWAP). The physical pages, still mapped in T's page directory,
+ * are freed along with it by pagedir_destroy().
+ *
+ * The mappings of T to frames shared with other processes are
+ * dropped (and cleared from T's page directory, so that
+ * pagedir_destroy() does not free the page); a shared frame owned by
+ * T is handed over to the next sharer.
+ *
+ * The SPTEs of T are left as they are, and must not be used to reach
+ * a frame afterwards.
+ */
+void
+vm_frame_release_all (struct thread *t)
 {
-  struct frame_table_entry *entry = hash_entry(elem, struct frame_table_entry, helem);
-  return hash_bytes( &entry->kpage, sizeof entry->kpage );
-}
-static bool frame_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+  ASSERT (t == thread_current ());
+
+  lock_acquire (&frame_lock);
+
+  // pin the frames, so that no more eviction starts, waiting for
+  // the ones already being written. T may also be among the detached
+  // mappings of a merged frame being evicted (see
+  // vm_frame_evict_merged()): wait for those too.
+  size_t i;
+  for (i = 0; i < frame_cnt; i++) {
+    struct frame_table_entry *f = &frame_table[i];
+    while (f->busy && (f->t == t || frame_is_merged (f)))
+      cond_wait (&frame_transit, &frame_lock);
+    if (f->t == t)
+      f->pinned = true;
+  }
+
+  for (i = 0; i < frame_cnt; i++) {
+    struct frame_table_entry *f = &frame_table[i];
+    if (f->t == NULL || f->shared == NULL) continue;
+
+    // hand the frame over to the next sharer outside T, if any
+    bool owned = f->t == t;
+    while (f->t == t && frame_has_sharers (f)) {
+      struct frame_mapping *m =
+        list_entry (list_pop_front (&f->shared->sharers), struct frame_mapping, elem);
+      pagedir_clear_page (t->pagedir, f->upage);
+      t->rss--;
+      f->t = m->t;
+      f->t->rss++;
+      f->upage = m->upage;
+      kmem_cache_free (&mapping_cache, m);
+    }
+    if (owned && f->t != t)
+      f->pinned = false;
+
+    struct list *sharers = &f->shared->sharers;
+    struct list_elem *e = list_begin (sharers);
+    while (e != list_end (sharers)) {
+      struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+      e = list_next (e);
+      if (m->t == t) {
+        pagedir_clear_page (t->pagedir, m->upage);
+        list_remove (&m->elem);
+        kmem_cache_free (&mapping_cache, m);
+      }
+    }
+  }
+
+  for (i = 0; i < frame_cnt && t->rss > 0; i++)
+    if (frame_table[i].t == t)
+      vm_frame_do_free (frame_kpage (&frame_table[i]), false);
+
+  lock_release (&frame_lock);
+}
+
+/**
+ * Map the shared frame holding the page of the file described by
+ * SPTE (a read-only FROM_FILESYS page), if there is one, into
+ * PAGEDIR at SPTE->upage, and mark SPTE as ON_FRAME.
+ * Returns the frame, or NULL if the page is not shared (yet)
+ * and must be loaded from the file.
+ */
+void*
+vm_frame_share (struct supplemental_page_table_entry *spte, uint32_t *pagedir)
+{
+  ASSERT (spte->status == FROM_FILESYS && !spte->writable);
+
+  lock_acquire (&frame_lock);
+
+  struct shared_frame s_tmp;
+  s_tmp.inode = file_get_inode (spte->file);
+  s_tmp.file_offset = spte->file_offset;
+  struct hash_elem *h = hash_find (&shared_map, &s_tmp.elem);
+  if (h == NULL) {
+    lock_release (&frame_lock);
+    return NULL;
+  }
+
+  // the same page of the file, mapped with another length, is
+  // loaded privately
+  struct shared_frame *sh = hash_entry(h, struct shared_frame, elem);
+  if (sh->read_bytes != spte->read_bytes) {
+    lock_release (&frame_lock);
+    return NULL;
+  }
+  void *kpage = frame_kpage (sh->frame);
+  struct frame_mapping *m = kmem_cache_alloc (&mapping_cache);
+  if (m == NULL) {
+    lock_release (&frame_lock);
+    return NULL;
+  }
+  if (!pagedir_set_page (pagedir, spte->upage, kpage, false)) {
+    kmem_cache_free (&mapping_cache, m);
+    lock_release (&frame_lock);
+    return NULL;
+  }
+
+  m->t = thread_current ()->process;
+  m->upage = spte->upage;
+  list_push_back (&sh->sharers, &m->elem);
+
+  spte->kpage = kpage;
+  spte->status = ON_FRAME;
+
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/**
+ * Offer the frame KPAGE, just loaded with READ_BYTES bytes at
+ * OFFSET of INODE (and zeros beyond), to be shared by the other
+ * processes mapping the same read-only page.
+ */
+void
+vm_frame_set_shared (void *kpage, struct inode *inode, off_t offset, uint32_t read_bytes)
+{
+  lock_acquire (&frame_lock);
+
+  struct frame_table_entry *f = vm_frame_lookup (kpage);
+  if (f != NULL && f->shared == NULL) {
+    struct shared_frame *sh = kmem_cache_alloc (&shared_cache);
+    if (sh != NULL) {
+      sh->frame = f;
+      sh->inode = inode;
+      sh->file_offset = offset;
+      sh->read_bytes = read_bytes;
+      sh->forked = false;
+      sh->shm = NULL;
+      list_init (&sh->sharers);
+      // someone else loaded the same page meanwhile: keep this one private
+      if (hash_insert (&shared_map, &sh->elem) == NULL)
+        f->shared = sh;
+      else
+        kmem_cache_free (&shared_cache, sh);
+    }
+  }
+
+  lock_release (&frame_lock);
+}
+
+/**
+ * Copy the SIZE bytes of INODE at OFFSET, which lie within one page
+ * of the file, into BUFFER from the shared frame holding that page,
+ * if there is one: a page of an executable that processes run is
+ * then read without going to the buffer cache.  BUFFER must not
+ * fault.  Returns false, copying nothing, if no shared frame holds
+ * all of those bytes.
+ */
+bool
+vm_frame_read_shared (struct inode *inode, off_t offset, void *buffer, off_t size)
+{
+  struct shared_frame s_tmp;
+  struct hash_elem *h;
+  bool found = false;
+
+  ASSERT (offset / PGSIZE == (offset + size - 1) / PGSIZE);
+
+  s_tmp.inode = inode;
+  s_tmp.file_offset = ROUND_DOWN (offset, PGSIZE);
+  lock_acquire (&frame_lock);
+  h = hash_find (&shared_map, &s_tmp.elem);
+  if (h != NULL) {
+    struct shared_frame *sh = hash_entry(h, struct shared_frame, elem);
+    found = offset + size <= sh->file_offset + (off_t) sh->read_bytes;
+    if (found)
+      memcpy (buffer, (uint8_t *) frame_kpage (sh->frame)
+              + (offset - sh->file_offset), size);
+  }
+  lock_release (&frame_lock);
+  return found;
+}
+
+/**
+ * Map the page of the shared-memory object of SPTE (FROM_SHM) into
+ * PAGEDIR at SPTE->upage, writable, and mark SPTE as ON_FRAME.  If
+ * another process has the page on a frame, that one is mapped;
+ * otherwise it is brought in, zeroed or from the object's swap slot,
+ * without frame_lock -- the page is in transit meanwhile, and others
+ * faulting on it wait.
+ * Returns false, leaving SPTE as it was, if out of memory.
+ */
+bool
+vm_frame_shm_map (struct supplemental_page_table_entry *spte, uint32_t *pagedir)
+{
+  ASSERT (spte->status == FROM_SHM);
+
+  struct vm_shm_page *p = &spte->shm->pages[spte->shm_idx];
+  struct thread *cur = thread_current ()->process;
+
+  lock_acquire (&frame_lock);
+  while (p->status == SHM_TRANSIT)
+    cond_wait (&frame_transit, &frame_lock);
+
+  if (p->status == SHM_FRAME) {
+    struct frame_mapping *m = kmem_cache_alloc (&mapping_cache);
+    if (m == NULL || !pagedir_set_page (pagedir, spte->upage, p->kpage, true)) {
+      if (m != NULL) kmem_cache_free (&mapping_cache, m);
+      lock_release (&frame_lock);
+      return false;
+    }
+
+    m->t = cur;
+    m->upage = spte->upage;
+    list_push_back (&vm_frame_lookup (p->kpage)->shared->sharers, &m->elem);
+    spte->kpage = p->kpage;
+    spte->status = ON_FRAME;
+
+    lock_release (&frame_lock);
+    return true;
+  }
+
+  enum shm_page_status status = p->status;
+  p->status = SHM_TRANSIT;
+  lock_release (&frame_lock);
+
+  struct shared_frame *sh = kmem_cache_alloc (&shared_cache);
+  void *kpage = NULL;
+  if (sh != NULL)
+    kpage = vm_frame_allocate (spte->upage, status == SHM_ZERO ? PAL_ZERO : 0);
+  // map first: a failure must not consume the swap slot
+  bool success = kpage != NULL
+    && pagedir_set_page (pagedir, spte->upage, kpage, true);
+  if (success && status == SHM_SWAP)
+    vm_swap_in (p->swap_index, kpage);
+
+  lock_acquire (&frame_lock);
+  if (success) {
+    struct frame_table_entry *f = vm_frame_lookup (kpage);
+    sh->frame = f;
+    sh->inode = NULL;
+    sh->file_offset = 0;
+    sh->read_bytes = 0;
+    sh->forked = false;
+    sh->shm = spte->shm;
+    sh->shm_idx = spte->shm_idx;
+    list_init (&sh->sharers);
+    f->shared = sh;
+    f->pinned = false;
+
+    p->kpage = kpage;
+    p->status = SHM_FRAME;
+    spte->kpage = kpage;
+    spte->status = ON_FRAME;
+  }
+  else {
+    if (kpage != NULL) vm_frame_do_free (kpage, true);
+    if (sh != NULL) kmem_cache_free (&shared_cache, sh);
+    p->status = status;
+  }
+  cond_broadcast (&frame_transit, &frame_lock);
+
+  lock_release (&frame_lock);
+  return success;
+}
+
+/**
+ * Unmap the page of the shared-memory object of SPTE (ON_FRAME) from
+ * PAGEDIR, and mark SPTE as FROM_SHM.  If no other process maps the
+ * frame, it is written to swap for the object if KEEP, and else just
+ * freed, the page being all zero again.
+ */
+void
+vm_frame_shm_unmap (struct supplemental_page_table_entry *spte, uint32_t *pagedir,
+    bool keep)
+{
+  lock_acquire (&frame_lock);
+
+  if (spte->status == ON_FRAME) {
+    struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+    ASSERT (f != NULL && frame_is_shm (f));
+
+    if (frame_has_sharers (f)) {
+      pagedir_clear_page (pagedir, spte->upage);
+      frame_drop_mapping (f, thread_current ()->process, spte->upage);
+    }
+    else if (keep)
+      vm_frame_evict_shm (f);
+    else {
+      struct vm_shm_page *p = &spte->shm->pages[spte->shm_idx];
+      pagedir_clear_page (pagedir, spte->upage);
+      p->status = SHM_ZERO;
+      p->kpage = NULL;
+      vm_frame_do_free (spte->kpage, true);
+    }
+    spte->status = FROM_SHM;
+    spte->kpage = NULL;
+  }
+
+  lock_release (&frame_lock);
+}
+
+/**
+ * Release the pages of the shared-memory object SHM, which nobody
+ * maps any more: they are no longer on any frame, but may still be
+ * on swap, or on their way there.
+ */
+void
+vm_frame_shm_release (struct vm_shm *shm)
+{
+  lock_acquire (&frame_lock);
+
+  size_t i;
+  for (i = 0; i < shm->page_cnt; i++) {
+    struct vm_shm_page *p = &shm->pages[i];
+    while (p->status == SHM_TRANSIT)
+      cond_wait (&frame_transit, &frame_lock);
+
+    ASSERT (p->status != SHM_FRAME);
+    if (p->status == SHM_SWAP)
+      vm_swap_free (p->swap_index);
+    p->status = SHM_ZERO;
+  }
+
+  lock_release (&frame_lock);
+}
+
+/* Unmaps UPAGE of T, a page of a shared-memory object being evicted:
+   T faults it back in from the object. */
+static void
+shm_detach (struct thread *t, void *upage)
+{
+  struct supplemental_page_table_entry *spte = vm_supt_lookup (t->supt, upage);
+
+  pagedir_clear_page (t->pagedir, upage);
+  spte->status = FROM_SHM;
+  spte->kpage = NULL;
+}
+
+/**
+ * Evict the frame F of a page of a shared-memory object, for
+ * vm_frame_do_evict(): it is unmapped from every process mapping it,
+ * and written to a swap slot of the object's, without frame_lock.
+ * The page is in transit meanwhile (see vm_frame_shm_map()).
+ * Returns false, leaving F as it was, if the swap is full.
+ */
+static bool
+vm_frame_evict_shm (struct frame_table_entry *f)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  struct vm_shm_page *p = &f->shared->shm->pages[f->shared->shm_idx];
+  void *kpage = frame_kpage (f);
+  swap_index_t swap_idx = vm_swap_alloc ();
+  if (swap_idx == SWAP_NONE) return false;
+
+  shm_detach (f->t, f->upage);
+  while (!list_empty (&f->shared->sharers)) {
+    struct frame_mapping *m =
+      list_entry (list_pop_front (&f->shared->sharers), struct frame_mapping, elem);
+    shm_detach (m->t, m->upage);
+    kmem_cache_free (&mapping_cache, m);
+  }
+
+  p->status = SHM_TRANSIT;
+  p->kpage = NULL;
+  f->busy = true;
+  frame_busy_cnt++;
+
+  lock_release (&frame_lock);
+  vm_swap_write (swap_idx, kpage);
+  lock_acquire (&frame_lock);
+
+  f->busy = false;
+  frame_busy_cnt--;
+  p->swap_index = swap_idx;
+  p->status = SHM_SWAP;
+
+  vm_frame_do_free (kpage, true); // f is also invalidated
+  cond_broadcast (&frame_transit, &frame_lock);
+  return true;
+}
+
+/**
+ * Give the merged page of SPTE, on its first write, NEW_KPAGE (a
+ * frame just allocated for it) with a copy of its contents, and map
+ * that one writable into PAGEDIR instead.  If no other page is mapped
+ * to the merged frame any more, the frame itself is made private and
+ * writable again, and NEW_KPAGE is freed.
+ * Returns false, freeing NEW_KPAGE, if the page is no longer merged
+ * (e.g. it has been evicted meanwhile).
+ */
+bool
+vm_frame_unmerge (struct supplemental_page_table_entry *spte, uint32_t *pagedir,
+    void *new_kpage)
+{
+  lock_acquire (&frame_lock);
+
+  frame_wait_transit (spte);
+  if (spte->status != ON_FRAME || !spte->merged) {
+    vm_frame_do_free (new_kpage, true);
+    lock_release (&frame_lock);
+    return false;
+  }
+
+  struct frame_table_entry *f = vm_frame_lookup (spte->kpage);
+  ASSERT (f != NULL && frame_is_merged (f));
+  pagedir_clear_page (pagedir, spte->upage);
+
+  if (!frame_has_sharers (f)) {
+    if (!f->shared->forked)
+      hash_delete (&ksm_map, &f->shared->elem);
+    kmem_cache_free (&shared_cache, f->shared);
+    f->shared = NULL;
+    vm_frame_do_free (new_kpage, true);
+  }
+  else {
+    page_copy (new_kpage, spte->kpage);
+    frame_drop_mapping (f, thread_current ()->process, spte->upage);
+    vm_frame_lookup (new_kpage)->pinned = false;
+    spte->kpage = new_kpage;
+  }
+
+  spte->merged = false;
+  if (!pagedir_set_page (pagedir, spte->upage, spte->kpage, true))
+    PANIC ("Cannot map an unmerged page");
+
+  lock_release (&frame_lock);
+  return true;
+}
+
+/**
+ * Give the current process, being forked from PARENT, the page of
+ * SRC, which PARENT has on a frame, into SPTE (a copy of SRC, in the
+ * current process's SUPT already) and PAGEDIR.
+ *
+ * A clean page of a file is left to be read from it again.  Any
+ * other is shared with PARENT as a merged page, mapped read-only in
+ * both until either of them writes to it (see vm_frame_unmerge()):
+ * the frame is marked `forked', as it is not merged by contents.  A
+ * page that cannot be shared -- pinned or locked in PARENT, or not in
+ * the frame table at all, as the initial stack page -- is copied
+ * instead, into KPAGE, a frame that the caller allocates on
+ * VM_FORK_COPY.  KPAGE is freed if it is not used.
+ *
+ * PARENT's SUPT lock must be held.
+ */
+enum vm_fork_result
+vm_frame_fork (struct supplemental_page_table_entry *src, struct thread *parent,
+    struct supplemental_page_table_entry *spte, uint32_t *pagedir, void *kpage)
+{
+  enum vm_fork_result result = VM_FORK_FAILED;
+
+  lock_acquire (&frame_lock);
+
+  frame_wait_transit (src);
+  if (src->status != ON_FRAME) {
+    result = VM_FORK_MOVED;
+    goto done;
+  }
+
+  struct frame_table_entry *f = vm_frame_lookup (src->kpage);
+  uint32_t *ppd = parent->pagedir;
+  bool dirty = src->dirty || pagedir_is_dirty (ppd, src->upage);
+
+  if (src->file != NULL && !dirty) {
+    spte->status = FROM_FILESYS;
+    result = VM_FORK_DONE;
+    goto done;
+  }
+
+  if (kpage == NULL && (f == NULL || f->pinned || f->locks > 0)) {
+    result = VM_FORK_COPY;
+    goto done;
+  }
+
+  if (kpage != NULL) {
+    page_copy (kpage, src->kpage);
+    if (!pagedir_set_page (pagedir, spte->upage, kpage, src->writable))
+      goto done;
+    vm_frame_lookup (kpage)->pinned = false;
+    spte->kpage = kpage;
+    spte->status = ON_FRAME;
+    spte->dirty = dirty;
+    kpage = NULL;
+    result = VM_FORK_DONE;
+    goto done;
+  }
+
+  ASSERT (f->shared == NULL || frame_is_merged (f));
+  struct frame_mapping *m = kmem_cache_alloc (&mapping_cache);
+  if (m == NULL) goto done;
+
+  if (f->shared == NULL) {
+    struct shared_frame *sh = kmem_cache_alloc (&shared_cache);
+    if (sh == NULL) {
+      kmem_cache_free (&mapping_cache, m);
+      goto done;
+    }
+    sh->frame = f;
+    sh->inode = NULL;
+    sh->file_offset = 0;
+    sh->read_bytes = 0;
+    sh->checksum = 0;
+    sh->forked = true;
+    sh->shm = NULL;
+    list_init (&sh->sharers);
+    f->shared = sh;
+
+    // a write by PARENT faults from now on, as one by the child does.
+    // pagedir_clear_page() shoots the old, writable entry down on
+    // the CPUs that run PARENT's threads; this one loaded the child's
+    // page directory in fork_memory(), which flushed it here.
+    // The dirty bit goes with the mapping: keep it in the SPTE.
+    bool accessed = pagedir_is_accessed (ppd, src->upage);
+    pagedir_clear_page (ppd, src->upage);
+    if (!pagedir_set_page (ppd, src->upage, src->kpage, false))
+      PANIC ("Cannot restore the mapping of a forked page");
+    pagedir_set_accessed (ppd, src->upage, accessed);
+    vm_supt_drop_swap_cache (parent->supt, src);
+    src->dirty = dirty;
+    src->merged = true;
+  }
+
+  if (!pagedir_set_page (pagedir, spte->upage, src->kpage, false)) {
+    kmem_cache_free (&mapping_cache, m);
+    goto done;
+  }
+  m->t = thread_current ()->process;
+  m->upage = spte->upage;
+  list_push_back (&f->shared->sharers, &m->elem);
+
+  spte->kpage = src->kpage;
+  spte->status = ON_FRAME;
+  spte->dirty = dirty;
+  spte->merged = true;
+  result = VM_FORK_DONE;
+
+ done:
+  if (kpage != NULL)
+    vm_frame_do_free (kpage, true);
+  lock_release (&frame_lock);
+  return result;
+}
+
+/**
+ * Drop the mapping of the shared frame F by T at UPAGE, which must
+ * not be the only one: if it is the owner's, the frame is handed
+ * over to the next sharer.
+ * MUST BE CALLED with 'frame_lock' held.
+ */
+static void
+frame_drop_mapping (struct frame_table_entry *f, struct thread *t, void *upage)
+{
+  ASSERT (frame_has_sharers (f));
+
+  struct list *sharers = &f->shared->sharers;
+  if (f->t == t && f->upage == upage) {
+    struct frame_mapping *m =
+      list_entry (list_pop_front (sharers), struct frame_mapping, elem);
+    t->rss--;
+    f->t = m->t;
+    f->t->rss++;
+    f->upage = m->upage;
+    kmem_cache_free (&mapping_cache, m);
+    return;
+  }
+
+  struct list_elem *e;
+  for (e = list_begin (sharers); e != list_end (sharers); e = list_next (e)) {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    if (m->t == t && m->upage == upage) {
+      list_remove (e);
+      kmem_cache_free (&mapping_cache, m);
+      return;
+    }
+  }
+  NOT_REACHED ();
+}
+
+/**
+ * Unmap the shared frame F from all the processes mapping it, which
+ * will re-load (or re-share) the page from the file on their next
+ * access, and release the sharers.
+ * MUST BE CALLED with 'frame_lock' held.
+ */
+static void
+vm_frame_unmap_shared (struct frame_table_entry *f)
+{
+  pagedir_clear_page (f->t->pagedir, f->upage);
+  vm_supt_set_filesys (f->t->supt, f->upage, false);
+
+  while (!list_empty (&f->shared->sharers)) {
+    struct frame_mapping *m =
+      list_entry (list_pop_front (&f->shared->sharers), struct frame_mapping, elem);
+    pagedir_clear_page (m->t->pagedir, m->upage);
+    vm_supt_set_filesys (m->t->supt, m->upage, false);
+    kmem_cache_free (&mapping_cache, m);
+  }
+}
+
+/**
+ * An (internal, private) method --
+ * Deallocates a frame or page (internal procedure)
+ * MUST BE CALLED with 'frame_lock' held.
+ */
+void
+vm_frame_do_free (void *kpage, bool free_page)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+  ASSERT (is_kernel_vaddr(kpage));
+  ASSERT (pg_ofs (kpage) == 0); // should be aligned
+
+  struct frame_table_entry *f = vm_frame_lookup (kpage);
+  if (f == NULL) {
+    return;//"The page to be freed is not stored in the table");
+  }
+
+  ASSERT (!frame_has_sharers (f));
+  ASSERT (!f->busy);
+
+  if (f->shared != NULL) {
+    if (!frame_is_shm (f) && !f->shared->forked)
+      hash_delete (frame_is_merged (f) ? &ksm_map : &shared_map, &f->shared->elem);
+    kmem_cache_free (&shared_cache, f->shared);
+    f->shared = NULL;
+  }
+  if (f->locks > 0) {
+    f->locks = 0;
+    frame_locked--;
+  }
+  f->t->rss--;
+  f->t = NULL;
+  f->upage = NULL;
+  frame_used--;
+  policy->on_free (f);
+
+  // Free resources
+  if(free_page) palloc_free_page(kpage);
+}
+
+/**
+ * Find the frame table entry of the physical page KPAGE.
+ * Returns NULL if KPAGE is not in the frame table.
+ * MUST BE CALLED with 'frame_lock' held.
+ */
+static struct frame_table_entry*
+vm_frame_lookup (void *kpage)
+{
+  if ((uint8_t *) kpage < frame_base) return NULL;
+
+  size_t idx = pg_no (kpage) - pg_no (frame_base);
+  if (idx >= frame_cnt || frame_table[idx].t == NULL) return NULL;
+  return &frame_table[idx];
+}
+
+/* Returns whether the frame F is mapped by more than its owner. */
+static bool
+frame_has_sharers (struct frame_table_entry *f)
+{
+  return f->shared != NULL && !list_empty (&f->shared->sharers);
+}
+
+/** Replacement Policies
+ *
+ * Which frame is evicted is up to the policy chosen at boot: it is
+ * told when a frame comes into use, goes out of use, or is made
+ * cold, and when the wss thread samples its accessed bit, and it
+ * picks the victims.  The policies are:
+ *
+ *   lru      Active and inactive lists (the default).
+ *   clock    Second chance: a hand sweeps the frame table.
+ *   wsclock  Clock over the working set: a frame goes once it has
+ *            not been referenced for WSCLOCK_TAU, clean ones first.
+ *   fifo     The oldest frame goes, referenced or not.
+ *
+ * For all of them, the reference bit of a frame is read from (and
+ * cleared in) the page directory of the thread owning the frame
+ * (and of its sharers), not the one of the faulting thread; the wss
+ * thread may have seen the reference first.  Frames pinned, locked
+ * or being written out are never picked.  If ONLY is not NULL, the
+ * frames not owned by ONLY, and those mapped by other processes
+ * too, are passed over as well, without being looked at.
+ * pick_victim() returns NULL if there is no frame that can be
+ * evicted.
+ */
+
+/* Returns whether frame F may be evicted, for ONLY (see above). */
+static bool
+frame_evictable (struct frame_table_entry *f, struct thread *only)
+{
+  if (f->pinned || f->busy || f->locks > 0) return false;
+  return only == NULL || (f->t == only && !frame_has_sharers (f));
+}
+
+/* Consults (and clears) the reference of frame F since it was last
+   looked at. */
+static bool
+frame_referenced (struct frame_table_entry *f)
+{
+  bool accessed = frame_test_and_clear_accessed (f) || f->referenced;
+  f->referenced = false;
+  if (accessed) {
+    f->idle = 0;
+    f->last_used = timer_ticks ();
+  }
+  return accessed;
+}
+
+/* Does nothing, for the operations a policy has no use for. */
+static void
+policy_nop (struct frame_table_entry *f UNUSED)
+{
+}
+
+/** The "lru" Policy: Active and Inactive Lists
+ *
+ * The frames in use are on two lists, most recently used first.  A
+ * new frame enters the inactive list, and eviction takes from the
+ * tail of that list.  A frame referenced since it was last looked
+ * at is spared and goes back to the front; if it had already been
+ * referenced once while inactive, it is promoted to the active list.
+ * So pages touched once, as by a sequential scan, only go through
+ * the inactive list, and do not push the working set out of the
+ * active one.  Whenever the inactive list is shorter than the active
+ * one, it is refilled from the tail of the active list: a frame
+ * referenced meanwhile goes back to the front of the active list,
+ * and one that was not is deactivated.
+ * A cold frame (madvise) goes to the tail of the inactive list, is
+ * never promoted, and is deactivated whenever it is met on the
+ * active list.
+ * If every frame was referenced in two passes over the inactive
+ * list, the least recently used one is evicted anyway.
+ */
+
+/* Takes frame F, in use, off its list. */
+static void
+lru_remove (struct frame_table_entry *f)
+{
+  list_remove (&f->lru_elem);
+  if (f->active)
+    active_cnt--;
+  else
+    inactive_cnt--;
+}
+
+/* Puts frame F at the front of the active list if ACTIVE, else of
+   the inactive list. */
+static void
+lru_push (struct frame_table_entry *f, bool active)
+{
+  f->active = active;
+  f->once = false;
+  if (active) {
+    list_push_front (&active_list, &f->lru_elem);
+    active_cnt++;
+  }
+  else {
+    list_push_front (&inactive_list, &f->lru_elem);
+    inactive_cnt++;
+  }
+}
+
+/* A new frame has to be referenced again to become active. */
+static void
+lru_on_alloc (struct frame_table_entry *f)
+{
+  lru_push (f, false);
+}
+
+static void
+lru_on_cold (struct frame_table_entry *f)
+{
+  lru_remove (f);
+  f->active = f->once = false;
+  list_push_back (&inactive_list, &f->lru_elem);
+  inactive_cnt++;
+}
+
+/* Deactivates frames from the tail of the active list, looking at
+   each one once at most, until the inactive list is no shorter. */
+static void
+lru_refill (void)
+{
+  size_t n;
+  for (n = active_cnt; n > 0 && inactive_cnt < active_cnt; n--) {
+    struct frame_table_entry *f =
+      list_entry (list_back (&active_list), struct frame_table_entry, lru_elem);
+    lru_remove (f);
+    if (f->pinned || f->busy || f->locks > 0)
+      lru_push (f, true);
+    else
+      lru_push (f, frame_referenced (f) && !f->cold);
+  }
+}
+
+static struct frame_table_entry*
+lru_pick_victim (struct thread *only)
 {
-  struct frame_table_entry *a_entry = hash_entry(a, struct frame_table_entry, helem);
-  struct frame_table_entry *b_entry = hash_entry(b, struct frame_table_entry, helem);
-  return a_entry->kpage < b_entry->kpage;
+  if(frame_used == 0) return NULL;
+
+  int pass;
+  for (pass = 0; pass < 2; pass++) {
+    lru_refill ();
+
+    // from the tail, each frame once: those spared go to a front
+    struct list_elem *e = list_rbegin (&inactive_list);
+    size_t n;
+    for (n = inactive_cnt; n > 0; n--) {
+      struct frame_table_entry *f = list_entry (e, struct frame_table_entry, lru_elem);
+      e = list_prev (e);
+      if (!frame_evictable (f, only)) continue;
+
+      bool once = f->once;
+      bool accessed = frame_referenced (f);
+      lru_remove (f);
+      if (!accessed) {
+        // at the front, so that the next eviction takes another frame
+        // if this one cannot go (e.g. the swap is full)
+        lru_push (f, false);
+        return f;
+      }
+      lru_push (f, once && !f->cold);
+      f->once = !f->active;
+    }
+  }
+
+  // everything is referenced: the least recently used frame goes
+  struct list *lists[2] = { &inactive_list, &active_list };
+  int i;
+  for (i = 0; i < 2; i++) {
+    struct list_elem *e;
+    for (e = list_rbegin (lists[i]); e != list_rend (lists[i]); e = list_prev (e)) {
+      struct frame_table_entry *f = list_entry (e, struct frame_table_entry, lru_elem);
+      if (frame_evictable (f, only)) {
+        lru_remove (f);
+        lru_push (f, false);
+        return f;
+      }
+    }
+  }
+
+  // null if every frame is pinned or being written out
+  return NULL;
+}
+
+/** The "clock" Policy
+ *
+ * The hand sweeps the frame table, and takes the first frame in use
+ * that was not referenced since the hand last passed it; those that
+ * were are spared, with the reference cleared.  A cold frame gets no
+ * second chance.  After two sweeps every frame has been looked at
+ * with its reference cleared, so the first one that can go goes.
+ */
+
+/* Returns the frame under the clock hand, and advances the hand. */
+static struct frame_table_entry*
+clock_next (void)
+{
+  struct frame_table_entry *f = &frame_table[clock_hand];
+  clock_hand = clock_hand + 1 < frame_cnt ? clock_hand + 1 : 0;
+  return f;
+}
+
+static struct frame_table_entry*
+clock_pick_victim (struct thread *only)
+{
+  size_t n;
+  for (n = 0; n < 2 * frame_cnt; n++) {
+    struct frame_table_entry *f = clock_next ();
+    if (f->t == NULL || !frame_evictable (f, only)) continue;
+    if (!frame_referenced (f) || f->cold)
+      return f;
+  }
+  for (n = 0; n < frame_cnt; n++) {
+    struct frame_table_entry *f = clock_next ();
+    if (f->t != NULL && frame_evictable (f, only))
+      return f;
+  }
+  return NULL;
+}
+
+/** The "wsclock" Policy
+ *
+ * Like "clock", but a frame referenced since the hand last passed
+ * it only records the time, and a frame is taken once that is more
+ * than WSCLOCK_TAU ago: it has left the working set of its process.
+ * Of those, the first clean one goes, which needs no write to swap
+ * or to its file; a dirty one only if a whole sweep finds no clean
+ * one.  The wss thread's samples count as references too.  A cold
+ * frame counts as out of the working set.  If every frame is in a
+ * working set, the one unused for the longest goes.
+ */
+
+/* Working-set window of the "wsclock" policy, in timer ticks. */
+#define WSCLOCK_TAU TIMER_FREQ
+
+/* Returns whether frame F, in use, can be evicted without writing
+   it anywhere: a read-only page of a file, a page not modified
+   since it was read from its file, or one that still has its copy
+   on swap. */
+static bool
+frame_is_clean (struct frame_table_entry *f)
+{
+  if (f->shared != NULL)
+    return !frame_is_merged (f) && !frame_is_shm (f);
+
+  uint32_t *pagedir = f->t->pagedir;
+  if (pagedir_is_dirty (pagedir, f->upage))
+    return false;
+
+  struct supplemental_page_table_entry *spte =
+    f->t->supt != NULL ? vm_supt_lookup (f->t->supt, f->upage) : NULL;
+  return spte != NULL
+    && (spte->swap_index != SWAP_NONE || (spte->file != NULL && !spte->dirty));
+}
+
+static void
+wsclock_on_alloc (struct frame_table_entry *f)
+{
+  f->last_used = timer_ticks ();
+}
+
+static void
+wsclock_on_cold (struct frame_table_entry *f)
+{
+  f->last_used = 0;
+}
+
+static void
+wsclock_on_access_sample (struct frame_table_entry *f, bool accessed)
+{
+  if (accessed)
+    f->last_used = timer_ticks ();
+}
+
+static struct frame_table_entry*
+wsclock_pick_victim (struct thread *only)
+{
+  struct frame_table_entry *dirty = NULL, *oldest = NULL;
+  int64_t now = timer_ticks ();
+  size_t n;
+
+  for (n = 0; n < frame_cnt; n++) {
+    struct frame_table_entry *f = clock_next ();
+    if (f->t == NULL || !frame_evictable (f, only)) continue;
+    if (frame_referenced (f) && !f->cold) continue;
+
+    if (f->cold || now - f->last_used > WSCLOCK_TAU) {
+      if (frame_is_clean (f))
+        return f;
+      if (dirty == NULL)
+        dirty = f;
+    }
+    if (oldest == NULL || f->last_used < oldest->last_used)
+      oldest = f;
+  }
+  if (dirty != NULL)
+    return dirty;
+  if (oldest != NULL)
+    return oldest;
+
+  // every frame was referenced: one sweep has cleared them all
+  return clock_pick_victim (only);
+}
+
+/** The "fifo" Policy
+ *
+ * The frames in use are on a list in the order they came in, and
+ * the oldest one that can go goes, whether it is referenced or not;
+ * it is then put at the end, so that the next eviction takes
+ * another one if this one cannot go after all.  A cold frame is put
+ * at the front, to go next.
+ */
+
+static void
+fifo_on_alloc (struct frame_table_entry *f)
+{
+  list_push_back (&fifo_list, &f->lru_elem);
+}
+
+static void
+fifo_on_free (struct frame_table_entry *f)
+{
+  list_remove (&f->lru_elem);
+}
+
+static void
+fifo_on_cold (struct frame_table_entry *f)
+{
+  list_remove (&f->lru_elem);
+  list_push_front (&fifo_list, &f->lru_elem);
+}
+
+static struct frame_table_entry*
+fifo_pick_victim (struct thread *only)
+{
+  struct list_elem *e;
+  for (e = list_begin (&fifo_list); e != list_end (&fifo_list); e = list_next (e)) {
+    struct frame_table_entry *f = list_entry (e, struct frame_table_entry, lru_elem);
+    if (frame_evictable (f, only)) {
+      list_remove (&f->lru_elem);
+      list_push_back (&fifo_list, &f->lru_elem);
+      return f;
+    }
+  }
+  return NULL;
+}
+
+/* All the policies; the first one is the default. */
+static const struct frame_policy policies[] =
+  {
+    { "lru", lru_on_alloc, lru_remove, lru_on_cold, NULL, lru_pick_victim },
+    { "clock", policy_nop, policy_nop, policy_nop, NULL, clock_pick_victim },
+    { "wsclock", wsclock_on_alloc, policy_nop, wsclock_on_cold,
+      wsclock_on_access_sample, wsclock_pick_victim },
+    { "fifo", fifo_on_alloc, fifo_on_free, fifo_on_cold, NULL, fifo_pick_victim },
+  };
+
+/**
+ * Choose the page-replacement policy named NAME: "lru", "clock",
+ * "wsclock" or "fifo".  Must be called before vm_frame_init(), which
+ * otherwise takes "lru".  Returns false if there is no such policy.
+ */
+bool
+vm_frame_set_policy (const char *name)
+{
+  size_t i;
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (name, policies[i].name)) {
+      policy = &policies[i];
+      return true;
+    }
+  return false;
+}
+/**
+ * Consult (and clear) the accessed bit of frame F, in the page
+ * directory of its owner and of every sharer.
+ */
+static bool
+frame_test_and_clear_accessed (struct frame_table_entry *f)
+{
+  bool accessed = false;
+
+  ASSERT (f->t->pagedir != NULL);
+  if (pagedir_is_accessed (f->t->pagedir, f->upage)) {
+    pagedir_set_accessed (f->t->pagedir, f->upage, false);
+    TRACE (TRACE_REF_SAMPLE, f->upage, f->t->tid);
+    accessed = true;
+  }
+
+  if (f->shared == NULL) return accessed;
+
+  struct list *sharers = &f->shared->sharers;
+  struct list_elem *e;
+  for (e = list_begin (sharers); e != list_end (sharers); e = list_next (e)) {
+    struct frame_mapping *m = list_entry (e, struct frame_mapping, elem);
+    if (pagedir_is_accessed (m->t->pagedir, m->upage)) {
+      pagedir_set_accessed (m->t->pagedir, m->upage, false);
+      TRACE (TRACE_REF_SAMPLE, m->upage, m->t->tid);
+      accessed = true;
+    }
+  }
+  return accessed;
+}
+
+static void
+vm_frame_set_pinned (void *kpage, bool new_value)
+{
+  lock_acquire (&frame_lock);
+
+  struct frame_table_entry *f = vm_frame_lookup (kpage);
+  if (f == NULL) {
+    PANIC ("The frame to be pinned/unpinned does not exist");
+  }
+
+  f->pinned = new_value;
+
+  lock_release (&frame_lock);
+}
+
+void
+vm_frame_unpin (void* kpage) {
+  vm_frame_set_pinned (kpage, false);
+}
+
+void
+vm_frame_pin (void* kpage) {
+  vm_frame_set_pinned (kpage, true);
+}
+
+
+/** Page Merging
+ *
+ * The ksm thread scans the frame table, a given number of frames per
+ * pass, for private anonymous pages (or modified, thus swapped, file
+ * pages) with identical contents, and merges them into one frame,
+ * mapped read-only by all of them -- the shared zero page, for a page
+ * that is all zero.  The first write to a merged page makes a private
+ * copy of it again (see vm_frame_unmerge()).
+ *
+ * Only a page that has not been modified for a whole pass is merged:
+ * its dirty bit is cleared at every visit.  Such a page is looked up
+ * by contents first among the merged frames (ksm_map), then in a
+ * direct-mapped table of the pages last seen with the same checksum;
+ * if that one is still unmodified and identical, the two are merged.
+ * A page being compared is unmapped meanwhile: its owner touching it
+ * waits on frame_lock (see vm_load_page()).
+ */
+
+/* Time between two passes, in timer ticks. */
+#define KSM_INTERVAL (TIMER_FREQ / 5)
+
+static size_t ksm_pages;            /* Frames scanned per pass. */
+static size_t ksm_cursor;           /* Next frame to scan. */
+static size_t *ksm_unstable;        /* Checksum -> 1 + frame index, or 0. */
+
+static struct supplemental_page_table_entry *ksm_candidate (struct frame_table_entry *);
+static void ksm_scan_frame (struct frame_table_entry *);
+
+/**
+ * Start the ksm thread, which scans PAGES frames every pass.
+ * PAGES == 0 disables it.
+ */
+void
+vm_frame_start_ksm (size_t pages)
+{
+  if (pages == 0)
+    return;
+
+  ksm_unstable = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+      DIV_ROUND_UP (frame_cnt * sizeof *ksm_unstable, PGSIZE));
+  ksm_pages = pages;
+  ksm_cursor = 0;
+  thread_create ("ksm", PRI_DEFAULT, ksm_thread, NULL);
+}
+
+/* Body of the ksm thread. */
+static void
+ksm_thread (void *aux UNUSED)
+{
+  for (;;) {
+    timer_sleep (KSM_INTERVAL);
+
+    // one frame at a time, like the pageout thread
+    size_t i;
+    for (i = 0; i < ksm_pages; i++) {
+      lock_acquire (&frame_lock);
+      if (++ksm_cursor >= frame_cnt)
+        ksm_cursor = 0;
+      ksm_scan_frame (&frame_table[ksm_cursor]);
+      lock_release (&frame_lock);
+      thread_preempt_point ();
+    }
+  }
+}
+
+/* Returns the SPTE of the page on frame F, if it may be merged and
+   has not been modified since the last pass, NULL otherwise.
+   It is still mapped as it was. */
+static struct supplemental_page_table_entry *
+ksm_candidate (struct frame_table_entry *f)
+{
+  if (f->t == NULL || f->pinned || f->busy || f->locks > 0 || f->shared != NULL)
+    return NULL;
+
+  struct thread *t = f->t;
+  if (t->supt == NULL || t->pagedir == NULL) return NULL;
+
+  struct supplemental_page_table_entry *spte = vm_supt_lookup (t->supt, f->upage);
+  if (spte == NULL || spte->status != ON_FRAME || spte->kpage != frame_kpage (f)
+      || spte->mmap || !spte->writable)
+    return NULL;
+
+  if (pagedir_is_dirty (t->pagedir, f->upage)) return NULL;
+  // a clean file page can be dropped and re-read instead
+  if (spte->file != NULL && !spte->dirty) return NULL;
+  return spte;
+}
+
+/* Maps UPAGE of T to KPAGE again, after ksm_scan_frame() unmapped it. */
+static void
+ksm_remap (struct thread *t, void *upage, void *kpage, bool writable, bool accessed)
+{
+  if (!pagedir_set_page (t->pagedir, upage, kpage, writable))
+    PANIC ("Cannot restore the mapping of a scanned page");
+  pagedir_set_accessed (t->pagedir, upage, accessed);
+}
+
+/* Returns whether PAGE is all zero. */
+static bool
+page_is_zero (const void *page)
+{
+  const uint32_t *p = page;
+  size_t i;
+  for (i = 0; i < PGSIZE / sizeof *p; i++)
+    if (p[i] != 0) return false;
+  return true;
+}
+
+/* Maps the page of F (with SPTE, unmapped) to the merged frame SH
+   instead, and frees F.  Returns false, changing nothing, if out of
+   memory. */
+static bool
+ksm_merge_into (struct shared_frame *sh, struct frame_table_entry *f,
+    struct supplemental_page_table_entry *spte, bool accessed)
+{
+  struct frame_mapping *m = kmem_cache_alloc (&mapping_cache);
+  if (m == NULL) return false;
+
+  m->t = f->t;
+  m->upage = f->upage;
+  list_push_back (&sh->sharers, &m->elem);
+
+  vm_supt_drop_swap_cache (f->t->supt, spte); // swapped out separately, if ever
+  spte->kpage = frame_kpage (sh->frame);
+  spte->merged = true;
+  ksm_remap (m->t, m->upage, spte->kpage, false, accessed);
+  vm_frame_do_free (frame_kpage (f), true);
+  return true;
+}
+
+/* Turns F (with SPTE, unmapped) into a merged frame with the contents
+   of CHECKSUM, mapped read-only.  Returns NULL, changing nothing, if
+   out of memory. */
+static struct shared_frame *
+ksm_promote (struct frame_table_entry *f, struct supplemental_page_table_entry *spte,
+    unsigned checksum, bool accessed)
+{
+  struct shared_frame *sh = kmem_cache_alloc (&shared_cache);
+  if (sh == NULL) return NULL;
+
+  sh->frame = f;
+  sh->inode = NULL;
+  sh->file_offset = 0;
+  sh->read_bytes = 0;
+  sh->checksum = checksum;
+  sh->forked = false;
+  sh->shm = NULL;
+  list_init (&sh->sharers);
+  if (hash_insert (&ksm_map, &sh->elem) != NULL)
+    PANIC ("Merging a page that is already merged");
+
+  f->shared = sh;
+  vm_supt_drop_swap_cache (f->t->supt, spte);
+  spte->merged = true;
+  ksm_remap (f->t, f->upage, frame_kpage (f), false, accessed);
+  return sh;
+}
+
+/* Visits the frame F for merging.  frame_lock must be held. */
+static void
+ksm_scan_frame (struct frame_table_entry *f)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  if (f->t != NULL && f->t->pagedir != NULL && f->shared == NULL
+      && pagedir_is_dirty (f->t->pagedir, f->upage)) {
+    // modified since the last pass: watch the next one
+    struct supplemental_page_table_entry *spte =
+      f->t->supt != NULL ? vm_supt_lookup (f->t->supt, f->upage) : NULL;
+    if (spte != NULL) {
+      // the dirty bit is cleared below, which would hide the change
+      // from the eviction of a page with a copy on swap
+      spte->dirty = true;
+      vm_supt_drop_swap_cache (f->t->supt, spte);
+    }
+    pagedir_set_dirty (f->t->pagedir, f->upage, false);
+    return;
+  }
+
+  struct supplemental_page_table_entry *spte = ksm_candidate (f);
+  if (spte == NULL) return;
+
+  struct thread *t = f->t;
+  void *upage = f->upage;
+  void *kpage = frame_kpage (f);
+  bool accessed = pagedir_is_accessed (t->pagedir, upage);
+  pagedir_clear_page (t->pagedir, upage);
+
+  if (page_is_zero (kpage)) {
+    ksm_remap (t, upage, zero_page, false, accessed);
+    vm_supt_drop_swap_cache (t->supt, spte);
+    spte->status = ZERO_MAPPED;
+    spte->kpage = NULL;
+    vm_frame_do_free (kpage, true);
+    return;
+  }
+
+  struct shared_frame probe;
+  probe.frame = f;
+  probe.checksum = hash_bytes (kpage, PGSIZE);
+  struct hash_elem *h = hash_find (&ksm_map, &probe.elem);
+  if (h != NULL
+      && ksm_merge_into (hash_entry (h, struct shared_frame, elem), f, spte, accessed))
+    return;
+
+  // the page last seen with the same checksum
+  size_t *slot = &ksm_unstable[probe.checksum % frame_cnt];
+  size_t idx = f - frame_table;
+  if (h == NULL && *slot != 0 && *slot - 1 != idx) {
+    struct frame_table_entry *g = &frame_table[*slot - 1];
+    struct supplemental_page_table_entry *g_spte = ksm_candidate (g);
+    if (g_spte != NULL) {
+      bool g_accessed = pagedir_is_accessed (g->t->pagedir, g->upage);
+      pagedir_clear_page (g->t->pagedir, g->upage);
+
+      struct shared_frame *sh = NULL;
+      if (memcmp (frame_kpage (g), kpage, PGSIZE) == 0)
+        sh = ksm_promote (g, g_spte, probe.checksum, g_accessed);
+      if (sh == NULL)
+        ksm_remap (g->t, g->upage, frame_kpage (g), true, g_accessed);
+      else if (ksm_merge_into (sh, f, spte, accessed)) {
+        *slot = 0;
+        return;
+      }
+    }
+  }
+
+  *slot = idx + 1;
+  ksm_remap (t, upage, kpage, true, accessed);
+}
+
+
+/* Helpers */
+
+// Hash Functions required for [shared_map]. Uses (inode, offset) as key:
+// one frame per page of a file, whatever length of it is mapped.
+static unsigned shared_hash_func(const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct shared_frame *entry = hash_entry(elem, struct shared_frame, elem);
+  return hash_ptr( entry->inode ) ^ hash_int( entry->file_offset );
+}
+static bool shared_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct shared_frame *a_entry = hash_entry(a, struct shared_frame, elem);
+  struct shared_frame *b_entry = hash_entry(b, struct shared_frame, elem);
+  if (a_entry->inode != b_entry->inode)
+    return a_entry->inode < b_entry->inode;
+  return a_entry->file_offset < b_entry->file_offset;
+}
+
+// Hash Functions required for [ksm_map]. Uses the contents of the page as key.
+static unsigned ksm_hash_func(const struct hash_elem *elem, void *aux UNUSED)
+{
+  return hash_entry(elem, struct shared_frame, elem)->checksum;
+}
+static bool ksm_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  struct shared_frame *a_entry = hash_entry(a, struct shared_frame, elem);
+  struct shared_frame *b_entry = hash_entry(b, struct shared_frame, elem);
+  if (a_entry->checksum != b_entry->checksum)
+    return a_entry->checksum < b_entry->checksum;
+  return memcmp (frame_kpage (a_entry->frame), frame_kpage (b_entry->frame), PGSIZE) < 0;
+}
+
+
+/** Working-set Estimation
+ *
+ * The wss thread samples and clears the accessed bit of every frame
+ * once per scan, a batch at a time, and counts for each frame the
+ * scans it has been idle for.  A reference it clears is kept in the
+ * frame (`referenced') for eviction to see too.  At the end of
+ * a scan, each process gets a histogram of its frames by idle age,
+ * and a working-set size: its frames referenced in the last
+ * WSS_WINDOW scans.  The estimates steer the admission of new
+ * processes (see vm_frame_admit()).
+ */
+
+/* Frames sampled under frame_lock at once. */
+#define WSS_BATCH 64
+
+/* Longest time a new process waits for memory (see vm_frame_admit()). */
+#define WSS_ADMIT_WAIT (2 * TIMER_FREQ)
+
+static void wss_sample (struct frame_table_entry *);
+static void wss_publish (void);
+
+/**
+ * Start the wss thread, which scans all the frames every MS
+ * milliseconds.  MS == 0 disables it.
+ */
+void
+vm_frame_start_wss (unsigned ms)
+{
+  if (ms == 0)
+    return;
+
+  wss_interval = ms;
+  cond_init (&wss_published);
+  thread_create ("wss", PRI_DEFAULT - 1, wss_thread, NULL);
+}
+
+/* Body of the wss thread: below the processes it watches, it only
+   takes the time they leave. */
+static void
+wss_thread (void *aux UNUSED)
+{
+  for (;;) {
+    timer_msleep (wss_interval);
+
+    size_t i = 0;
+    while (i < frame_cnt) {
+      lock_acquire (&frame_lock);
+      size_t end = i + WSS_BATCH < frame_cnt ? i + WSS_BATCH : frame_cnt;
+      for (; i < end; i++)
+        wss_sample (&frame_table[i]);
+      lock_release (&frame_lock);
+      thread_preempt_point ();
+    }
+
+    lock_acquire (&frame_lock);
+    wss_scans++;
+    wss_publish ();
+    lock_release (&frame_lock);
+  }
+}
+
+/* Samples (and clears) the accessed bit of the frame F.  frame_lock
+   must be held. */
+static void
+wss_sample (struct frame_table_entry *f)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  // free, or unmapped while it is written out
+  if (f->t == NULL || f->busy || f->t->pagedir == NULL) return;
+
+  // in use by the kernel (perhaps not mapped yet)
+  if (f->pinned) {
+    f->idle = 0;
+    return;
+  }
+
+  bool accessed = frame_test_and_clear_accessed (f);
+  if (accessed) {
+    f->referenced = true;
+    f->idle = 0;
+  }
+  else if (f->idle < UINT8_MAX)
+    f->idle++;
+  if (policy->on_access_sample != NULL)
+    policy->on_access_sample (f, accessed);
+}
+
+/* Returns the bucket of an idle page age histogram for a frame idle
+   for IDLE scans. */
+static size_t
+wss_bucket (unsigned idle)
+{
+  size_t b = 0;
+  while (idle > 0 && b < WSS_BUCKETS - 1) {
+    idle >>= 1;
+    b++;
+  }
+  return b;
+}
+
+/* Clears the estimates of T, a main thread. */
+static void
+wss_clear (struct thread *t, void *aux UNUSED)
+{
+  if (t->process != t) return;
+  t->wss = 0;
+  memset (t->idle_hist, 0, sizeof t->idle_hist);
+}
+
+/* Adds the working set of T, a main thread, to the total at AUX. */
+static void
+wss_sum (struct thread *t, void *total_)
+{
+  size_t *total = total_;
+  if (t->process == t)
+    *total += t->wss;
+}
+
+/* Rebuilds the estimates of every process from the frame table.
+   frame_lock must be held: no frame changes hands meanwhile. */
+static void
+wss_publish (void)
+{
+  ASSERT (lock_held_by_current_thread(&frame_lock) == true);
+
+  enum intr_level old_level = intr_disable ();
+  thread_foreach (wss_clear, NULL);
+  intr_set_level (old_level);
+
+  size_t i;
+  for (i = 0; i < frame_cnt; i++) {
+    struct frame_table_entry *f = &frame_table[i];
+    if (f->t == NULL) continue;
+    f->t->idle_hist[wss_bucket (f->idle)]++;
+    if (f->idle < WSS_WINDOW)
+      f->t->wss++;
+  }
+
+  size_t total = 0;
+  old_level = intr_disable ();
+  thread_foreach (wss_sum, &total);
+  intr_set_level (old_level);
+  wss_total = total;
+  cond_broadcast (&wss_published, &frame_lock);
+}
+
+/**
+ * Hold off a new process while the working sets of those running do
+ * not fit in memory together, by the wss thread's estimate: it would
+ * only make them all thrash.  Waits for at most WSS_ADMIT_WAIT, for
+ * the scans to come; does nothing if the wss thread is off.
+ */
+void
+vm_frame_admit (void)
+{
+  if (wss_interval == 0)
+    return;
+
+  int64_t deadline = timer_ticks () + WSS_ADMIT_WAIT;
+  lock_acquire (&frame_lock);
+  while (wss_total >= frame_cnt && timer_ticks () < deadline)
+    cond_wait_timeout (&wss_published, &frame_lock, deadline - timer_ticks ());
+  lock_release (&frame_lock);
+}
+
+/**
+ * Fill in ST with the working-set estimate of the process PROC,
+ * a main thread.
+ */
+void
+vm_frame_get_ws_stats (struct thread *proc, struct ws_stats *st)
+{
+  memset (st, 0, sizeof *st);
+
+  lock_acquire (&frame_lock);
+  st->rss = proc->rss;
+  if (wss_interval > 0) {
+    size_t i;
+    st->wss = proc->wss;
+    for (i = 0; i < WSS_BUCKETS; i++)
+      st->idle[i] = proc->idle_hist[i];
+    st->window = WSS_WINDOW;
+    st->interval_ms = wss_interval;
+    st->scans = wss_scans;
+  }
+  lock_release (&frame_lock);
 }
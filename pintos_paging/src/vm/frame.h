@@ -6,16 +6,69 @@
 
 #include "threads/synch.h"
 #include "threads/palloc.h"
+#include "filesys/off_t.h"
 
+struct inode;
+struct thread;
+struct supplemental_page_table_entry;
+struct vm_shm;
+struct ws_stats;
+
+
+/* Per-process resident-set limit, in frames; 0 means none. */
+extern size_t vm_rss_limit;
 
 /* Functions for Frame manipulation. */
 
+bool vm_frame_set_policy (const char *name);
 void vm_frame_init (void);
-void* vm_frame_allocate (void *upage);
+void vm_frame_start_pageout (size_t low, size_t high);
+void vm_frame_start_ksm (size_t pages);
+void vm_frame_start_wss (unsigned ms);
+void vm_frame_admit (void);
+void vm_frame_get_ws_stats (struct thread *proc, struct ws_stats *);
+void* vm_frame_zero_page (void);
+void* vm_frame_allocate (void *upage, enum palloc_flags);
+void* vm_frame_try_allocate (void *upage, enum palloc_flags);
 
 void vm_frame_free (void*);
-void vm_frame_remove_entry (void*);
+void vm_frame_release_all (struct thread *);
+void vm_frame_exited (struct thread *);
+bool vm_frame_wait_transit (struct supplemental_page_table_entry *spte,
+    uint32_t *pagedir);
+
+void* vm_frame_share (struct supplemental_page_table_entry *spte, uint32_t *pagedir);
+void vm_frame_set_shared (void *kpage, struct inode *, off_t, uint32_t read_bytes);
+bool vm_frame_read_shared (struct inode *, off_t offset, void *buffer, off_t size);
+bool vm_frame_unmerge (struct supplemental_page_table_entry *spte, uint32_t *pagedir,
+    void *new_kpage);
+
+/* Outcomes of vm_frame_fork(). */
+enum vm_fork_result
+  {
+    VM_FORK_DONE,             /* The child's page is set up. */
+    VM_FORK_MOVED,            /* The page is not on a frame any more. */
+    VM_FORK_COPY,             /* It must be copied, into a frame. */
+    VM_FORK_FAILED            /* Out of memory. */
+  };
+
+enum vm_fork_result vm_frame_fork (struct supplemental_page_table_entry *src,
+    struct thread *parent, struct supplemental_page_table_entry *spte,
+    uint32_t *pagedir, void *kpage);
+
+bool vm_frame_shm_map (struct supplemental_page_table_entry *spte, uint32_t *pagedir);
+void vm_frame_shm_unmap (struct supplemental_page_table_entry *spte, uint32_t *pagedir,
+    bool keep);
+void vm_frame_shm_release (struct vm_shm *);
 
+void vm_frame_set_cold (struct supplemental_page_table_entry *spte, bool cold);
+bool vm_frame_pin_resident (struct supplemental_page_table_entry *spte);
+bool vm_frame_lock (struct supplemental_page_table_entry *spte);
+void vm_frame_unlock (struct supplemental_page_table_entry *spte);
+size_t vm_frame_locked_cnt (void);
+size_t vm_frame_pin_resident_range (struct supplemental_page_table_entry **sptes,
+    size_t cnt, void **kpages, bool write);
+void vm_frame_unpin_range (void **kpages, size_t cnt);
 void vm_frame_pin (void* kpage);
 void vm_frame_unpin (void* kpage);
 
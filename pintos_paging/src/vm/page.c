@@ -1,28 +1,118 @@
-#include <hash.h>
 #include <string.h>
-#include "lib/kernel/hash.h"
+#include <syscall-nr.h>
 
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/tunable.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 
-static unsigned spte_hash_func(const struct hash_elem *elem, void *aux);
-static bool     spte_less_func(const struct hash_elem *, const struct hash_elem *, void *aux);
-static void     spte_destroy_func(struct hash_elem *elem, void *aux);
+/* Fault-around window, in pages: a fault on a page loaded from
+   the file system also maps the other file-system pages of the
+   aligned window around it, as long as frames are free.
+   Set by the kernel command-line option "-fault-around".
+   0 or 1 disables fault-around. */
+size_t vm_fault_around = 8;
 
+/* Stack prefault, in pages: when the stack grows by more than a
+   page at once, up to this many of the pages skipped over are
+   mapped right away, as long as frames are free.
+   Set by the kernel command-line option "-stack-prefault". */
+size_t vm_stack_prefault = 4;
+
+/* Stride prefetch, in pages: once a process's major faults come
+   at a constant stride, the next pages at that stride are brought
+   in ahead of it, twice as many each time it turns out right, up
+   to this many at once.  Set by the kernel command-line option
+   "-stride-prefetch".  0 disables stride prefetch. */
+size_t vm_stride_prefetch = 16;
+
+/* Pages prefetched on the first fault that confirms a stride. */
+#define STRIDE_WINDOW_MIN 2
+
+/* Locked-memory limit, in pages: a process can have at most this
+   many pages locked in memory (see vm_supt_lock()).
+   Set by the kernel command-line option "-mlock-limit".
+   0 means no limit. */
+size_t vm_mlock_limit = 64;
+
+/* Whether each process has its image locked in memory as it is
+   loaded, as if it had called mlock() on it (see load()).
+   Set by the kernel command-line option "-mlockall". */
+bool vm_mlockall = false;
+
+static struct tunable page_tunables[] =
+  {
+    TUNABLE ("vm.fault_around", vm_fault_around, 0, 1024, NULL),
+    TUNABLE ("vm.stack_prefault", vm_stack_prefault, 0, 1024, NULL),
+    TUNABLE ("vm.stride_prefetch", vm_stride_prefetch, 0, 1024, NULL),
+    TUNABLE ("vm.mlock_limit", vm_mlock_limit, 0, INT32_MAX, NULL),
+    TUNABLE ("vm.mlockall", vm_mlockall, 0, 1, NULL),
+  };
+
+/* Object cache of the SPTEs of all the processes. */
+static struct kmem_cache spte_cache;
+
+/* Runs the stride prefetch of all the processes, if started. */
+static struct workqueue prefetch_wq;
+static bool prefetch_started;
+
+static struct supplemental_page_table_entry **
+    spte_slot(struct supplemental_page_table *, void *upage, bool create);
+static bool     spte_insert(struct supplemental_page_table *, struct supplemental_page_table_entry *);
+static void     spte_destroy_func(struct supplemental_page_table_entry *);
+static void     unlock_page(struct supplemental_page_table *,
+    struct supplemental_page_table_entry *);
+static void     supt_unlock_all(struct supplemental_page_table *);
+static bool     fork_page(struct supplemental_page_table *, uint32_t *pagedir,
+                          struct thread *parent,
+                          struct supplemental_page_table_entry *, void **buf);
+static bool     pin_range(struct supplemental_page_table *, uint32_t *pagedir,
+                          const void *uaddr, size_t len, bool write,
+                          struct vm_pin_list *);
+static void     stride_stop(struct supplemental_page_table *);
+static work_func stride_prefetch;
+
+
+void
+vm_supt_init (void)
+{
+  kmem_cache_init (&spte_cache, "spte",
+      sizeof (struct supplemental_page_table_entry), 0, NULL);
+  tunable_register (page_tunables,
+                    sizeof page_tunables / sizeof *page_tunables);
+}
+
+/**
+ * Starts the kernel thread of the stride prefetch, unless it is
+ * disabled.  Called once threads can be created.
+ */
+void
+vm_supt_start_prefetch (void)
+{
+  if (vm_stride_prefetch > 0)
+    prefetch_started = workqueue_init (&prefetch_wq, "prefetch",
+                                       PRI_DEFAULT, 1, 0);
+}
 
 struct supplemental_page_table*
 vm_supt_create (void)
 {
   struct supplemental_page_table *supt =
-    (struct supplemental_page_table*) malloc(sizeof(struct supplemental_page_table));
+    (struct supplemental_page_table*) calloc(1, sizeof(struct supplemental_page_table));
 
-  hash_init (&supt->page_map, spte_hash_func, spte_less_func, NULL);
+  if (supt != NULL) {
+    lock_init (&supt->lock);
+    work_init (&supt->stride.work, stride_prefetch, supt);
+    sema_init (&supt->stride.done, 0);
+  }
   return supt;
 }
 
@@ -31,10 +121,185 @@ vm_supt_destroy (struct supplemental_page_table *supt)
 {
   ASSERT (supt != NULL);
 
-  hash_destroy (&supt->page_map, spte_destroy_func);
+  stride_stop (supt);
+
+  // the frames of locked pages may be shared with other processes,
+  // which keep them locked only for their own pages
+  if (supt->locked_cnt > 0)
+    supt_unlock_all (supt);
+
+  // detach all the frames at once, rather than one lock round-trip
+  // per page. Pages being written to swap are ON_SWAP afterwards.
+  vm_frame_release_all (thread_current ());
+
+  // walk only the tables that exist; each one covers 4 MB.
+  // Swap slots are freed in runs: clustered swap-outs put
+  // consecutive pages into consecutive slots. A page on a frame
+  // may hold a slot too (see vm_supt_drop_swap_cache()).
+  swap_index_t run_start = 0;
+  size_t run_cnt = 0;
+  size_t pde, pte;
+  for (pde = 0; pde < SUPT_DIR_CNT; pde++) {
+    struct supplemental_page_table_entry **table = supt->dir[pde];
+    if (table == NULL) continue;
+
+    for (pte = 0; pte < SUPT_TABLE_CNT; pte++) {
+      struct supplemental_page_table_entry *entry = table[pte];
+      if (entry == NULL) continue;
+
+      if (entry->swap_index != SWAP_NONE) {
+        if (run_cnt == 0 || entry->swap_index != run_start + run_cnt) {
+          if (run_cnt > 0)
+            vm_swap_free_range (run_start, run_cnt);
+          run_start = entry->swap_index;
+          run_cnt = 0;
+        }
+        run_cnt++;
+      }
+      spte_destroy_func (entry);
+    }
+    palloc_free_page (table);
+    thread_preempt_point ();
+  }
+  if (run_cnt > 0)
+    vm_swap_free_range (run_start, run_cnt);
   free (supt);
 }
 
+/**
+ * Copy the address space of PARENT into SUPT and PAGEDIR, those of
+ * the current process, which is being forked from it: its pages on a
+ * frame are shared copy-on-write (see vm_frame_fork()), its pages on
+ * swap get a slot of their own, and the others are installed to be
+ * loaded as PARENT's would.  Memory-mapped files and shared-memory
+ * objects are not inherited.
+ *
+ * PARENT's SUPT lock must be held.  Returns false if out of memory or
+ * swap, leaving the pages copied so far for vm_supt_destroy().
+ */
+bool
+vm_supt_fork (struct supplemental_page_table *supt, uint32_t *pagedir,
+    struct thread *parent)
+{
+  struct supplemental_page_table *psupt = parent->supt;
+  void *buf = NULL;             // scratch page to copy swap slots
+  bool success = true;
+  size_t pde, pte;
+
+  for (pde = 0; pde < SUPT_DIR_CNT && success; pde++) {
+    struct supplemental_page_table_entry **table = psupt->dir[pde];
+    if (table == NULL) continue;
+
+    for (pte = 0; pte < SUPT_TABLE_CNT && success; pte++)
+      if (table[pte] != NULL)
+        success = fork_page (supt, pagedir, parent, table[pte], &buf);
+    thread_preempt_point ();
+  }
+
+  if (buf != NULL)
+    palloc_free_page (buf);
+  return success;
+}
+
+/**
+ * Call FUNC with AUX on each SPTE of SUPT, in address order.
+ * SUPT's lock must be held; FUNC may not change the table.
+ */
+void
+vm_supt_walk (struct supplemental_page_table *supt,
+    void (*func) (struct supplemental_page_table_entry *, void *aux), void *aux)
+{
+  size_t pde, pte;
+
+  ASSERT (lock_held_by_current_thread (&supt->lock));
+
+  for (pde = 0; pde < SUPT_DIR_CNT; pde++) {
+    struct supplemental_page_table_entry **table = supt->dir[pde];
+    if (table == NULL) continue;
+
+    for (pte = 0; pte < SUPT_TABLE_CNT; pte++)
+      if (table[pte] != NULL)
+        func (table[pte], aux);
+  }
+}
+
+/* Copy the page of SRC, of PARENT, into SUPT and PAGEDIR, for
+   vm_supt_fork(). *BUF is its scratch page, allocated on first use. */
+static bool
+fork_page (struct supplemental_page_table *supt, uint32_t *pagedir,
+    struct thread *parent, struct supplemental_page_table_entry *src, void **buf)
+{
+  if (src->mmap || src->shm != NULL)
+    return true;
+
+  // in the SUPT before it is mapped: once its frame is shared, an
+  // eviction may look it up.
+  struct supplemental_page_table_entry *spte = kmem_cache_alloc (&spte_cache);
+  if (spte == NULL) return false;
+  *spte = *src;
+  spte->kpage = NULL;
+  spte->swap_index = SWAP_NONE;
+  spte->merged = false;
+  spte->locked = false;
+  if (!spte_insert (supt, spte)) {
+    kmem_cache_free (&spte_cache, spte);
+    return false;
+  }
+
+  void *kpage = NULL;
+  for (;;) {
+    switch (src->status)
+    {
+    case ALL_ZERO:
+    case ZERO_MAPPED:
+      spte->status = ALL_ZERO;
+      return true;
+
+    case FROM_FILESYS:
+      spte->status = FROM_FILESYS;
+      spte->dirty = src->dirty;
+      return true;
+
+    case ON_SWAP:
+      spte->status = ON_SWAP;
+      spte->dirty = src->dirty;
+      if (*buf == NULL && (*buf = palloc_get_page (0)) == NULL)
+        goto fail;
+      spte->swap_index = vm_swap_dup (src->swap_index, *buf);
+      if (spte->swap_index == SWAP_NONE)
+        goto fail;
+      supt->swap_cnt++;
+      return true;
+
+    case ON_FRAME:
+      // evicted meanwhile, or to be copied: look again
+      switch (vm_frame_fork (src, parent, spte, pagedir, kpage)) {
+      case VM_FORK_DONE:
+        return true;
+      case VM_FORK_MOVED:
+        kpage = NULL;
+        continue;
+      case VM_FORK_COPY:
+        kpage = vm_frame_allocate (spte->upage, 0);
+        if (kpage == NULL)
+          goto fail;
+        continue;
+      case VM_FORK_FAILED:
+        goto fail;
+      }
+      NOT_REACHED ();
+
+    default:
+      PANIC ("unreachable state");
+    }
+  }
+
+ fail:
+  *spte_slot (supt, spte->upage, false) = NULL;
+  kmem_cache_free (&spte_cache, spte);
+  return false;
+}
+
 
 /* Install a page (specified by the starting address `upage`) which
  * is currently on the frame, in the supplemental page table.
@@ -46,22 +311,29 @@ bool
 vm_supt_install_frame (struct supplemental_page_table *supt, void *upage, void *kpage)
 {
   struct supplemental_page_table_entry *spte;
-  spte = (struct supplemental_page_table_entry *) malloc(sizeof(struct supplemental_page_table_entry));
+  spte = kmem_cache_alloc (&spte_cache);
+  if (spte == NULL) return false;
 
   spte->upage = upage;
   spte->kpage = kpage;
   spte->status = ON_FRAME;
-  spte->swap_index = -1;
+  spte->swap_index = SWAP_NONE;
+  spte->file = NULL;
+  spte->writable = true;
+  spte->dirty = false;
+  spte->mmap = false;
+  spte->merged = false;
+  spte->shm = NULL;
+  spte->advice = MADV_NORMAL;
+  spte->locked = false;
 
-  struct hash_elem *prev_elem;
-  prev_elem = hash_insert (&supt->page_map, &spte->elem);
-  if (prev_elem == NULL) {
+  if (spte_insert (supt, spte)) {
     // successfully inserted into the supplemental page table.
     return true;
   }
   else {
     // failed. there is already an entry.
-    free (spte);
+    kmem_cache_free (&spte_cache, spte);
     return false;
   }
 }
@@ -75,35 +347,95 @@ bool
 vm_supt_install_zeropage (struct supplemental_page_table *supt, void *upage)
 {
   struct supplemental_page_table_entry *spte;
-  spte = (struct supplemental_page_table_entry *) malloc(sizeof(struct supplemental_page_table_entry));
+  spte = kmem_cache_alloc (&spte_cache);
+  if (spte == NULL) return false;
 
   spte->upage = upage;
   spte->kpage = NULL;
   spte->status = ALL_ZERO;
+  spte->swap_index = SWAP_NONE;
+  spte->file = NULL;
+  spte->writable = true;
+  spte->dirty = false;
+  spte->mmap = false;
+  spte->merged = false;
+  spte->shm = NULL;
+  spte->advice = MADV_NORMAL;
+  spte->locked = false;
 
-  struct hash_elem *prev_elem;
-  prev_elem = hash_insert (&supt->page_map, &spte->elem);
-  if (prev_elem == NULL) return true;
+  if (spte_insert (supt, spte)) return true;
 
   // there is already an entry -- impossible state
-  PANIC("Duplicated SUPT entry for zeropage");
+  if (vm_supt_has_entry (supt, upage))
+    PANIC("Duplicated SUPT entry for zeropage");
+
+  // out of memory for the second-level table
+  kmem_cache_free (&spte_cache, spte);
   return false;
 }
 
 /**
  * Mark an existent page to be swapped out,
- * and update swap_index in the SPTE.
+ * and update swap_index in the SPTE. The slot is recorded in its
+ * PTE in PAGEDIR too, where it is no longer present, so that a
+ * fault on it can tell without the SUPT (see pagedir_set_swap()).
  */
 bool
-vm_supt_set_swap (struct supplemental_page_table *supt, void *page, swap_index_t swap_index)
+vm_supt_set_swap (struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, swap_index_t swap_index)
 {
   struct supplemental_page_table_entry *spte;
   spte = vm_supt_lookup(supt, page);
   if(spte == NULL) return false;
 
+  ASSERT (spte->swap_index == SWAP_NONE || spte->swap_index == swap_index);
+  if (spte->swap_index == SWAP_NONE) supt->swap_cnt++;
   spte->status = ON_SWAP;
   spte->kpage = NULL;
   spte->swap_index = swap_index;
+  spte->merged = false;
+  pagedir_set_swap (pagedir, page, swap_index);
+  return true;
+}
+
+/**
+ * Release the swap slot that a page on a frame still holds, as the
+ * copy of its contents from when it was swapped in (see
+ * vm_swap_in_keep()). To be called once the page is modified, or is
+ * about to be, since the copy is stale from then on.
+ */
+void
+vm_supt_drop_swap_cache (struct supplemental_page_table *supt,
+    struct supplemental_page_table_entry *spte)
+{
+  if (spte->swap_index == SWAP_NONE) return;
+
+  vm_swap_free (spte->swap_index);
+  spte->swap_index = SWAP_NONE;
+  supt->swap_cnt--;
+}
+
+/**
+ * Mark an existent page, that was loaded from the file system
+ * and has never been modified since, to be lazily re-loaded from
+ * its file instead of being swapped out.
+ * DIRTY tells whether the page was modified while on the frame.
+ *
+ * Returns false if the page has no clean file backing (it must
+ * then be swapped out), true otherwise.
+ */
+bool
+vm_supt_set_filesys (struct supplemental_page_table *supt, void *page, bool dirty)
+{
+  struct supplemental_page_table_entry *spte;
+  spte = vm_supt_lookup(supt, page);
+  if(spte == NULL) return false;
+
+  if (dirty) spte->dirty = true;
+  if (spte->file == NULL || spte->dirty) return false;
+
+  spte->status = FROM_FILESYS;
+  spte->kpage = NULL;
   return true;
 }
 
@@ -117,26 +449,151 @@ vm_supt_lazy_load (struct supplemental_page_table *supt, void *upage,
     struct file * file, off_t offset, uint32_t read_bytes, uint32_t zero_bytes, bool writable)
 {
   struct supplemental_page_table_entry *spte;
-  spte = (struct supplemental_page_table_entry *) malloc(sizeof(struct supplemental_page_table_entry));
+  spte = kmem_cache_alloc (&spte_cache);
+  if (spte == NULL) return false;
  
   spte->upage = upage;
   spte->kpage = NULL;
   spte->status = FROM_FILESYS;
+  spte->swap_index = SWAP_NONE;
   spte->file = file;
   spte->file_offset = offset;
   spte->read_bytes = read_bytes;
   spte->zero_bytes = zero_bytes;
   spte->writable = writable;
+  spte->dirty = false;
+  spte->mmap = false;
+  spte->merged = false;
+  spte->shm = NULL;
+  spte->advice = MADV_NORMAL;
+  spte->locked = false;
 
-  struct hash_elem *prev_elem;
-  prev_elem = hash_insert (&supt->page_map, &spte->elem);
-  if (prev_elem == NULL) return true;
+  if (spte_insert (supt, spte)) return true;
 
   // there is already an entry -- impossible state
-  PANIC("Duplicated SUPT entry for filesys-page");
+  if (vm_supt_has_entry (supt, upage))
+    PANIC("Duplicated SUPT entry for filesys-page");
+
+  // out of memory for the second-level table
+  kmem_cache_free (&spte_cache, spte);
   return false;
 }
 
+/**
+ * Install a page (specified by the starting address `upage`) of a
+ * memory-mapped file: the first BYTES bytes of the page are at
+ * OFFSET of F, the rest are zero. It is lazily loaded like any
+ * FROM_FILESYS page, but written back to F when it is evicted or
+ * unmapped (see vm_supt_mm_unmap()).
+ */
+bool
+vm_supt_mm_map (struct supplemental_page_table *supt, void *upage,
+    struct file *f, off_t offset, size_t bytes)
+{
+  ASSERT (bytes > 0 && bytes <= PGSIZE);
+
+  if (!vm_supt_lazy_load (supt, upage, f, offset, bytes, PGSIZE - bytes, true))
+    return false;
+
+  vm_supt_lookup (supt, upage)->mmap = true;
+  return true;
+}
+
+/**
+ * Unmap a page of a memory-mapped file (see vm_supt_mm_map()):
+ * write it back to F if it was modified, release its frame and
+ * remove it from the SUPT.
+ */
+bool
+vm_supt_mm_unmap(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, struct file *f, off_t offset, size_t bytes)
+{
+  struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, page);
+  if(spte == NULL) return false;
+
+  ASSERT (spte->mmap);
+  unlock_page(supt, spte);
+
+  // keep the frame from being evicted while it is written back;
+  // fails if it was evicted (and thus written back) meanwhile.
+  if (spte->status == ON_FRAME && vm_frame_pin_resident (spte)) {
+    void *kpage = spte->kpage;
+    bool is_dirty = spte->dirty || pagedir_is_dirty(pagedir, page);
+    if (is_dirty)
+      file_write_at (f, kpage, bytes, offset);
+
+    pagedir_clear_page (pagedir, page);
+    vm_frame_free (kpage);
+  }
+  else if (spte->status == ON_SWAP) {
+    // an mmap page is never swapped out; just in case, do not lose it
+    void *tmp = palloc_get_page (PAL_ASSERT);
+    vm_swap_in (spte->swap_index, tmp);
+    supt->swap_cnt--;
+    file_write_at (f, tmp, bytes, offset);
+    palloc_free_page (tmp);
+    pagedir_clear_page (pagedir, page);
+  }
+
+  *spte_slot(supt, page, false) = NULL;
+  kmem_cache_free (&spte_cache, spte);
+  return true;
+}
+
+/**
+ * Install page IDX of the shared-memory object SHM at PAGE, of type
+ * FROM_SHM: it is mapped to the object's frame on first access
+ * (see vm_frame_shm_map()).
+ */
+bool
+vm_supt_install_shm(struct supplemental_page_table *supt, void *page,
+    struct vm_shm *shm, size_t idx)
+{
+  struct supplemental_page_table_entry *spte;
+  spte = kmem_cache_alloc (&spte_cache);
+  if (spte == NULL) return false;
+
+  spte->upage = page;
+  spte->kpage = NULL;
+  spte->status = FROM_SHM;
+  spte->swap_index = SWAP_NONE;
+  spte->file = NULL;
+  spte->writable = true;
+  spte->dirty = false;
+  spte->mmap = false;
+  spte->merged = false;
+  spte->shm = shm;
+  spte->shm_idx = idx;
+  spte->advice = MADV_NORMAL;
+  spte->locked = false;
+
+  if (spte_insert (supt, spte)) return true;
+
+  kmem_cache_free (&spte_cache, spte);
+  return false;
+}
+
+/**
+ * Unmap a page of a shared-memory object (see vm_supt_install_shm())
+ * and remove it from the SUPT.  If KEEP, its contents are kept for
+ * the other processes mapping the object, on swap if none of them
+ * has it mapped.
+ */
+void
+vm_supt_shm_unmap(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, bool keep)
+{
+  struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, page);
+  ASSERT (spte != NULL && spte->shm != NULL);
+  unlock_page(supt, spte);
+
+  if (spte->status == ON_FRAME)
+    vm_frame_shm_unmap (spte, pagedir, keep);
+
+  *spte_slot(supt, page, false) = NULL;
+  kmem_cache_free (&spte_cache, spte);
+}
+
 
 /**
  * Lookup the SUPT and find a SPTE object given the user page address.
@@ -145,13 +602,9 @@ vm_supt_lazy_load (struct supplemental_page_table *supt, void *upage,
 struct supplemental_page_table_entry*
 vm_supt_lookup (struct supplemental_page_table *supt, void *page)
 {
-  // create a temporary object, just for looking up the hash table.
-  struct supplemental_page_table_entry spte_temp;
-  spte_temp.upage = page;
-
-  struct hash_elem *elem = hash_find (&supt->page_map, &spte_temp.elem);
-  if(elem == NULL) return NULL;
-  return hash_entry(elem, struct supplemental_page_table_entry, elem);
+  struct supplemental_page_table_entry **slot = spte_slot(supt, page, false);
+  if(slot == NULL) return NULL;
+  return *slot;
 }
 
 /**
@@ -169,13 +622,46 @@ vm_supt_has_entry (struct supplemental_page_table *supt, void *page)
 
 
 static bool vm_load_page_FROM_FILESYS(struct supplemental_page_table_entry *, void *);
+static void vm_swap_readahead(struct supplemental_page_table *, uint32_t *pagedir,
+    void *upage, swap_index_t swap_index);
+static void vm_load_fault_around(struct supplemental_page_table *, uint32_t *pagedir,
+    void *upage, bool sequential);
+static bool vm_prefetch_page(struct supplemental_page_table *, uint32_t *pagedir,
+    struct supplemental_page_table_entry *);
+
+/* Pages read ahead of a fault in a MADV_SEQUENTIAL region. */
+#define SEQUENTIAL_READAHEAD 16
+
+/* Returns whether frames of pages with ADVICE are evicted first. */
+static inline bool
+advice_is_cold (uint8_t advice)
+{
+  return advice == MADV_SEQUENTIAL || advice == MADV_DONTNEED;
+}
+
+/**
+ * Returns if the page is mapped read-only to a frame shared with
+ * identical pages -- the shared zero page, or a merged frame -- i.e.
+ * a write to it (that faults) must give it a frame of its own.
+ */
+bool
+vm_supt_is_copy_on_write (struct supplemental_page_table *supt, void *page)
+{
+  struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, page);
+  return spte != NULL
+    && (spte->status == ZERO_MAPPED || (spte->status == ON_FRAME && spte->merged));
+}
 
 /**
  * Load the page, specified by the address `upage`, back into the memory.
    Only happend after page fault
+ *
+ * WRITE tells whether the faulting access was a write. Until then, a
+ * page that is all zero is just mapped (read-only) to the shared zero
+ * page, and only gets a frame of its own on the first write.
  */
 bool
-vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upage)
+vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upage, bool write)
 {
   /* see also userprog/exception.c */
   // printf("\n---------Huong: lazy loading...\n");
@@ -186,23 +672,72 @@ vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upag
     return false;
   }
 
+  if(spte->status == ON_FRAME && spte->merged && write) {
+    // first write to a merged page: copy it to a frame of its own.
+    // If it was evicted meanwhile, it is loaded as usual below.
+    void *frame_page = vm_frame_allocate(upage, 0);
+    if(frame_page == NULL) {
+      return false;
+    }
+    if (vm_frame_unmerge(spte, pagedir, frame_page))
+      return true;
+  }
+
+  if(spte->status == ON_FRAME) {
+    // being written out to swap (the reason for the fault): wait for
+    // it, after which it is mapped again unless it went to swap
+    if(!vm_frame_wait_transit (spte, pagedir))
+      return false;
+  }
   if(spte->status == ON_FRAME) {
     // already loaded
     return true;
   }
 
-  // 2. Obtain a frame to store the page
-  void *frame_page = vm_frame_allocate(upage);
+  if(spte->status == FROM_SHM)
+    return vm_frame_shm_map(spte, pagedir);
+
+  if(!write) {
+    if(spte->status == ZERO_MAPPED)
+      return true;
+    if(spte->status == ALL_ZERO) {
+      if(!pagedir_set_page (pagedir, upage, vm_frame_zero_page (), false))
+        return false;
+      spte->status = ZERO_MAPPED;
+      return true;
+    }
+  }
+  else if(spte->status == ZERO_MAPPED) {
+    // first write: drop the zero page, a real frame is installed below
+    pagedir_clear_page (pagedir, upage);
+  }
+
+  // A read-only page of a file may already be on a frame of
+  // another process: just share it.
+  if(spte->status == FROM_FILESYS && !spte->writable
+      && vm_frame_share(spte, pagedir) != NULL) {
+    if (spte->advice != MADV_RANDOM)
+      vm_load_fault_around(supt, pagedir, upage, spte->advice == MADV_SEQUENTIAL);
+    return true;
+  }
+
+  // 2. Obtain a frame to store the page, already zeroed if that
+  // is all it needs
+  bool zero = spte->status == ALL_ZERO || spte->status == ZERO_MAPPED;
+  void *frame_page = vm_frame_allocate(upage, zero ? PAL_ZERO : 0);
   if(frame_page == NULL) {
     return false;
   }
 
   // 3. Fetch the data into the frame
   bool writable = true;
+  bool from_swap = false, from_filesys = false;
+  swap_index_t swap_index = spte->swap_index;
   switch (spte->status)
   {
   case ALL_ZERO:
-    memset (frame_page, 0, PGSIZE);
+  case ZERO_MAPPED:
+    /* zeroed by the allocator */
     break;
 
   case ON_FRAME:
@@ -210,8 +745,14 @@ vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upag
     break;
 
   case ON_SWAP:
-    // Swap in: load the data from the swap disc
-    vm_swap_in (spte->swap_index, frame_page);
+    // Swap in: load the data from the swap disc. The slot keeps
+    // its copy until the page is modified, so that evicting it
+    // again while clean needs no write.
+    if (!vm_swap_in_keep (spte->swap_index, frame_page)) {
+      spte->swap_index = SWAP_NONE;
+      supt->swap_cnt--;
+    }
+    from_swap = true;
     break;
 
   case FROM_FILESYS:
@@ -221,6 +762,7 @@ vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upag
     }
 
     writable = spte->writable;
+    from_filesys = true;
     break;
 
   default:
@@ -237,20 +779,457 @@ vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upag
   spte->kpage = frame_page;
   spte->status = ON_FRAME;
 
-  pagedir_set_dirty (pagedir, frame_page, false);
+  // offer read-only file pages to other processes
+  if (from_filesys && !writable)
+    vm_frame_set_shared(frame_page, file_get_inode(spte->file),
+        spte->file_offset, spte->read_bytes);
+
+  // a page that will not be used again soon is the first to go
+  if (advice_is_cold (spte->advice))
+    vm_frame_set_cold(spte, true);
 
   // unpin frame
   vm_frame_unpin(frame_page);
 
+  if (spte->advice == MADV_RANDOM)
+    return true;
+  if (from_swap)
+    vm_swap_readahead(supt, pagedir, upage, swap_index);
+  else if (from_filesys)
+    vm_load_fault_around(supt, pagedir, upage, spte->advice == MADV_SEQUENTIAL);
+
   return true;
 }
 
-static bool vm_load_page_FROM_FILESYS(struct supplemental_page_table_entry *spte, void *kpage)
+/**
+ * Stride prefetch: note a major fault of the process of SUPT at
+ * UPAGE, just loaded, and predict the next ones from it.
+ *
+ * A fault the same number of pages away from the last one as that
+ * one was from the one before it -- or one at, or just past, the
+ * pages already predicted at that stride -- confirms the stride:
+ * then the next pages along it are handed to the prefetch thread,
+ * from 2 at first to vm_stride_prefetch, doubling each time they
+ * run out.  Sequential access is just a stride of 1.  Any other
+ * fault is a misprediction: the prefetch thread stops at once, and
+ * the distance to that fault is the stride to try next.
+ *
+ * SUPT's lock must be held.
+ */
+void
+vm_supt_note_fault(struct supplemental_page_table *supt, void *upage)
+{
+  struct vm_stride *s = &supt->stride;
+  uintptr_t page = (uintptr_t) upage;
+
+  if (!prefetch_started || vm_stride_prefetch == 0) return;
+  struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, upage);
+  if (spte == NULL || spte->advice == MADV_RANDOM) return;
+
+  intptr_t delta = (intptr_t) (page - s->last) / (intptr_t) PGSIZE;
+  intptr_t steps = 0;
+  if (s->last != 0 && s->stride != 0 && delta % s->stride == 0)
+    steps = delta / s->stride;
+
+  if (steps > 0 && (size_t) steps <= s->ahead + 1) {
+    s->hits++;
+    s->ahead = s->ahead >= (size_t) steps ? s->ahead - steps : 0;
+  }
+  else {
+    s->stride = s->last != 0 ? delta : 0;
+    s->hits = 0;
+    s->ahead = 0;
+    s->window = STRIDE_WINDOW_MIN;
+    s->cnt = 0;
+  }
+  s->last = page;
+
+  // refill once half of the pages predicted have been used
+  if (s->hits == 0 || s->stride == 0 || s->ahead > s->window / 2)
+    return;
+  if (s->cnt == 0)
+    s->next = page + (s->ahead + 1) * s->stride * PGSIZE;
+  s->cnt += s->window;
+  s->ahead += s->window;
+  s->window = s->window * 2 <= vm_stride_prefetch ? s->window * 2 : vm_stride_prefetch;
+
+  s->process = thread_current ()->process;
+  if (!s->running) {
+    s->running = true;
+    work_queue (&prefetch_wq, &s->work);
+  }
+}
+
+/**
+ * Stops the stride prefetch of SUPT, waiting for the prefetch thread
+ * if it is working on it, so that SUPT can be destroyed.
+ */
+static void
+stride_stop(struct supplemental_page_table *supt)
+{
+  struct vm_stride *s = &supt->stride;
+
+  lock_acquire (&supt->lock);
+  s->cnt = 0;
+  if (s->running && work_cancel (&s->work))
+    s->running = false;
+  bool wait = s->waiting = s->running;
+  lock_release (&supt->lock);
+
+  if (wait)
+    sema_down (&s->done);
+}
+
+/**
+ * The prefetch thread's work for the SUPT in W: bring in the pages
+ * predicted by vm_supt_note_fault(), one at a time, letting the
+ * process's own faults in between.  It acts for the process the way
+ * the process's other threads do (see thread.h): the frames it
+ * allocates are charged to the process and owned by it.  Stops at
+ * a page that is not mapped, or when no frame is free.
+ */
+static void
+stride_prefetch(struct work *w)
+{
+  struct supplemental_page_table *supt = w->aux;
+  struct vm_stride *s = &supt->stride;
+  struct thread *cur = thread_current ();
+
+  lock_acquire (&supt->lock);
+  while (s->cnt > 0) {
+    void *upage = (void *) s->next;
+    s->next += s->stride * PGSIZE;
+    s->cnt--;
+
+    struct supplemental_page_table_entry *spte =
+      is_user_vaddr (upage) ? vm_supt_lookup(supt, upage) : NULL;
+    if (spte == NULL) {
+      s->cnt = 0;
+      break;
+    }
+    if (spte->status != ON_SWAP && spte->status != FROM_FILESYS)
+      continue;
+
+    cur->process = s->process;
+    bool ok = vm_prefetch_page(supt, s->process->pagedir, spte);
+    cur->process = cur;
+    if (!ok) {
+      s->cnt = 0;
+      break;
+    }
+
+    lock_release (&supt->lock);
+    lock_acquire (&supt->lock);
+  }
+  s->running = false;
+  bool wake = s->waiting;
+  lock_release (&supt->lock);
+
+  // SUPT may be freed as soon as this is up
+  if (wake)
+    sema_up (&s->done);
+}
+
+/**
+ * Grow the stack down to FAULT_PAGE, which has no SPTE yet.
+ *
+ * A single access may move the stack down by more than a page (a
+ * large `sub esp', then a touch at the new esp; or PUSHA across a page
+ * boundary).  Not only FAULT_PAGE, but all the missing pages above it,
+ * up to the stack already in place, are installed as zero pages, so
+ * that they do not fault one by one to be recognized as stack.  The
+ * first `vm_stack_prefault' of them are also mapped right away, as
+ * long as frames are free; FAULT_PAGE itself is left to the caller.
+ *
+ * Returns false if FAULT_PAGE could not be installed.
+ */
+bool
+vm_supt_grow_stack(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *fault_page)
+{
+  if (!vm_supt_install_zeropage (supt, fault_page))
+    return false;
+
+  size_t prefault = vm_stack_prefault;
+  uint8_t *page;
+  for (page = (uint8_t *) fault_page + PGSIZE;
+       is_user_vaddr (page) && !vm_supt_has_entry (supt, page); page += PGSIZE) {
+    if (!vm_supt_install_zeropage (supt, page))
+      break;
+    if (prefault > 0) {
+      if (vm_prefetch_page (supt, pagedir, vm_supt_lookup (supt, page)))
+        prefault--;
+      else
+        prefault = 0;           // out of free frames
+    }
+  }
+  return true;
+}
+
+/**
+ * Apply the access hint ADVICE (MADV_*) to the CNT pages starting
+ * at PAGE: it selects the readahead done on their faults (see
+ * vm_load_page()) and whether their frames are evicted first.
+ * MADV_WILLNEED does not change the hint, but reads the pages in right
+ * away, as far as there are free frames.
+ *
+ * Returns false, without applying anything, if a page of the range
+ * is not in the SUPT.
+ */
+bool
+vm_supt_advise(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, size_t cnt, int advice)
+{
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    if (!vm_supt_has_entry(supt, (uint8_t *) page + i * PGSIZE))
+      return false;
+
+  for (i = 0; i < cnt; i++) {
+    struct supplemental_page_table_entry *spte =
+      vm_supt_lookup(supt, (uint8_t *) page + i * PGSIZE);
+
+    if (advice == MADV_WILLNEED) {
+      if ((spte->status == FROM_FILESYS || spte->status == ON_SWAP)
+          && !vm_prefetch_page(supt, pagedir, spte))
+        break;
+      continue;
+    }
+
+    spte->advice = advice;
+    if (spte->status == ON_FRAME)
+      vm_frame_set_cold(spte, advice_is_cold (advice));
+  }
+  return true;
+}
+
+/**
+ * Lock the CNT pages from PAGE on in memory (mlock): each one is
+ * loaded now if it is not resident, and its frame is not evicted
+ * until vm_supt_unlock() or the process exits.  A writable page gets
+ * a frame of its own, not merged nor the zero page, so that writing
+ * it does not fault either.
+ *
+ * Returns false if a page is not in the SUPT, cannot be loaded, or
+ * would take the process over vm_mlock_limit; the pages before that
+ * one stay locked.  SUPT's lock must be held.
+ */
+bool
+vm_supt_lock(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, size_t cnt)
+{
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    if (!vm_supt_has_entry(supt, (uint8_t *) page + i * PGSIZE))
+      return false;
+
+  for (i = 0; i < cnt; i++) {
+    struct supplemental_page_table_entry *spte =
+      vm_supt_lookup(supt, (uint8_t *) page + i * PGSIZE);
+    if (spte->locked) continue;
+    if (vm_mlock_limit > 0 && supt->locked_cnt >= vm_mlock_limit)
+      return false;
+
+    // a page evicted or merged between its load and its lock
+    // is loaded again
+    bool write = spte->writable;
+    do {
+      bool resident = spte->status == ON_FRAME && !(write && spte->merged);
+      if (!resident && !vm_load_page(supt, pagedir, spte->upage, write))
+        return false;
+    } while (!vm_frame_lock(spte));
+
+    spte->locked = true;
+    supt->locked_cnt++;
+  }
+  return true;
+}
+
+/**
+ * Unlock the CNT pages from PAGE on (munlock): their frames can be
+ * evicted again.  Pages that are not locked are left alone.
+ * Returns false, unlocking nothing, if a page is not in the SUPT.
+ * SUPT's lock must be held.
+ */
+bool
+vm_supt_unlock(struct supplemental_page_table *supt, void *page, size_t cnt)
+{
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    if (!vm_supt_has_entry(supt, (uint8_t *) page + i * PGSIZE))
+      return false;
+
+  for (i = 0; i < cnt; i++)
+    unlock_page(supt, vm_supt_lookup(supt, (uint8_t *) page + i * PGSIZE));
+  return true;
+}
+
+/* Unlocks the page of SPTE, if it is locked. */
+static void
+unlock_page(struct supplemental_page_table *supt,
+    struct supplemental_page_table_entry *spte)
 {
-  file_seek (spte->file, spte->file_offset);
+  if (!spte->locked) return;
+
+  vm_frame_unlock(spte);
+  spte->locked = false;
+  supt->locked_cnt--;
+}
+
+/* Unlocks every page of SUPT. */
+static void
+supt_unlock_all(struct supplemental_page_table *supt)
+{
+  size_t pde, pte;
+  for (pde = 0; pde < SUPT_DIR_CNT && supt->locked_cnt > 0; pde++) {
+    struct supplemental_page_table_entry **table = supt->dir[pde];
+    if (table == NULL) continue;
+
+    for (pte = 0; pte < SUPT_TABLE_CNT; pte++)
+      if (table[pte] != NULL)
+        unlock_page(supt, table[pte]);
+  }
+}
+
+/**
+ * Swap readahead: the pages following UPAGE that were swapped out
+ * into the slots following SWAP_INDEX (see the clustered eviction
+ * in vm/frame.c) are likely to be faulted next, so bring them in
+ * now while the swap disk is positioned there, up to a cluster of
+ * vm_swap_cluster pages.  This only uses
+ * frames that are free; it never evicts.
+ */
+static void
+vm_swap_readahead(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *upage, swap_index_t swap_index)
+{
+  size_t k;
+  size_t cluster = vm_swap_cluster;
+  for (k = 1; k < cluster; k++) {
+    uint8_t *next = (uint8_t *) upage + k * PGSIZE;
+    if (!is_user_vaddr (next)) break;
+
+    // the PTE tells whether the page is in the next slot; only
+    // one that is needs looking up
+    if (pagedir_get_swap (pagedir, next) != swap_index + k) break;
+    struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, next);
+    if (spte == NULL || spte->status != ON_SWAP) break;
 
-  // read bytes from the file
-  int n_read = file_read (spte->file, kpage, spte->read_bytes);
+    if (!vm_prefetch_page(supt, pagedir, spte)) break;
+  }
+}
+
+/**
+ * Fault-around: load the other FROM_FILESYS pages in the aligned
+ * window of `vm_fault_around' pages around UPAGE, so that e.g. the
+ * text of an executable is brought in with a few faults instead of
+ * one per page.  In a MADV_SEQUENTIAL region, the window is instead
+ * the SEQUENTIAL_READAHEAD pages following UPAGE.
+ * This only uses frames that are free; it never evicts.
+ */
+static void
+vm_load_fault_around(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *upage, bool sequential)
+{
+  uint8_t *start, *end;
+  if (sequential) {
+    start = (uint8_t *) upage + PGSIZE;
+    end = start + SEQUENTIAL_READAHEAD * PGSIZE;
+  }
+  else {
+    if (vm_fault_around <= 1) return;
+
+    uintptr_t window = vm_fault_around * PGSIZE;
+    start = (uint8_t *) ((uintptr_t) upage / window * window);
+    end = start + window;
+  }
+
+  uint8_t *page;
+  for (page = start; page < end && is_user_vaddr (page); page += PGSIZE) {
+    if (page == upage) continue;
+
+    struct supplemental_page_table_entry *spte = vm_supt_lookup(supt, page);
+    if (spte == NULL || spte->status != FROM_FILESYS) continue;
+
+    if (!vm_prefetch_page(supt, pagedir, spte)) break;
+  }
+}
+
+/**
+ * Bring the page of SPTE, which is FROM_FILESYS, ON_SWAP or ALL_ZERO,
+ * in ahead of its use: map it into PAGEDIR, on a free frame (or the
+ * shared frame of a read-only file page).  Never evicts.
+ * Returns false if there was no free frame, or the page could not be
+ * loaded; the page is then left as it was.
+ */
+static bool
+vm_prefetch_page(struct supplemental_page_table *supt, uint32_t *pagedir,
+    struct supplemental_page_table_entry *spte)
+{
+  ASSERT (spte->status == FROM_FILESYS || spte->status == ON_SWAP
+      || spte->status == ALL_ZERO);
+
+  if (spte->status == FROM_FILESYS && !spte->writable
+      && vm_frame_share(spte, pagedir) != NULL) return true;
+
+  void *frame_page = vm_frame_try_allocate(spte->upage,
+      spte->status == ALL_ZERO ? PAL_ZERO : 0);
+  if (frame_page == NULL) return false;
+
+  if (spte->status == FROM_FILESYS) {
+    if (!vm_load_page_FROM_FILESYS(spte, frame_page)
+        || !pagedir_set_page (pagedir, spte->upage, frame_page, spte->writable)) {
+      vm_frame_free(frame_page);
+      return false;
+    }
+  }
+  else if (spte->status == ALL_ZERO) {
+    if (!pagedir_set_page (pagedir, spte->upage, frame_page, spte->writable)) {
+      vm_frame_free(frame_page);
+      return false;
+    }
+  }
+  else {
+    // fill the frame before mapping it, as vm_load_page() does: another
+    // thread of the process may touch the page while this one waits
+    // for the read, and must not see the frame's old contents
+    if (!vm_swap_in_keep (spte->swap_index, frame_page)) {
+      spte->swap_index = SWAP_NONE;
+      supt->swap_cnt--;
+    }
+    if (!pagedir_set_page (pagedir, spte->upage, frame_page, spte->writable)) {
+      vm_frame_free(frame_page);
+      return false;
+    }
+  }
+
+  bool from_filesys = spte->status == FROM_FILESYS;
+  spte->kpage = frame_page;
+  spte->status = ON_FRAME;
+
+  if (from_filesys && !spte->writable)
+    vm_frame_set_shared(frame_page, file_get_inode(spte->file),
+        spte->file_offset, spte->read_bytes);
+  if (advice_is_cold (spte->advice))
+    vm_frame_set_cold(spte, true);
+  vm_frame_unpin(frame_page);
+  return true;
+}
+
+static bool vm_load_page_FROM_FILESYS(struct supplemental_page_table_entry *spte, void *kpage)
+{
+  // read bytes from the file, at its offset: the file (and its
+  // position) is shared by every thread of the process, and faults
+  // on it may be served at once.  A read-only page becomes the
+  // shared frame that later reads of the file are served from, so
+  // its sectors need not be kept in the buffer cache as well
+  int n_read;
+  if (spte->writable)
+    n_read = file_read_at (spte->file, kpage, spte->read_bytes,
+                           spte->file_offset);
+  else
+    n_read = inode_read_direct (file_get_inode (spte->file), kpage,
+                                spte->read_bytes, spte->file_offset);
   if(n_read != (int)spte->read_bytes)
     return false;
 
@@ -289,37 +1268,172 @@ vm_unpin_page(struct supplemental_page_table *supt, void *page)
   }
 }
 
+/**
+ * Fault in and pin all the pages of the user buffer of LEN bytes at
+ * UADDR, to be written to by the kernel if WRITE, and fill in PINS.
+ * Pages pinned for writing are marked dirty.
+ * The pages stay resident (and mapped) until vm_unpin_range(PINS),
+ * so the kernel can access the buffer without faulting, in particular
+ * while holding locks that the page fault handler may need.
+ * A buffer that is only read may stay on the shared zero page.
+ *
+ * The frames that are already resident are pinned together, with
+ * one round-trip on the frame table.  A buffer of at most
+ * VM_PIN_INLINE_CNT pages, the common case of a system call, is
+ * pinned without any heap allocation.
+ *
+ * Returns false, pinning nothing, if a page is not in the SUPT, is
+ * read-only while WRITE, or cannot be loaded.
+ */
+bool
+vm_pin_range(struct supplemental_page_table *supt, uint32_t *pagedir,
+    const void *uaddr, size_t len, bool write, struct vm_pin_list *pins)
+{
+  lock_acquire (&supt->lock);
+  bool success = pin_range (supt, pagedir, uaddr, len, write, pins);
+  lock_release (&supt->lock);
+  return success;
+}
+
+/* vm_pin_range() with SUPT's lock held. */
+static bool
+pin_range(struct supplemental_page_table *supt, uint32_t *pagedir,
+    const void *uaddr, size_t len, bool write, struct vm_pin_list *pins)
+{
+  pins->uaddr = (uint8_t *) uaddr;
+  pins->len = len;
+  pins->page_cnt = 0;
+  pins->kpages = NULL;
+  if (len == 0)
+    return true;
+
+  uint8_t *first = pg_round_down (uaddr);
+  uint8_t *last = pg_round_down ((const uint8_t *) uaddr + len - 1);
+  if (last < first)
+    return false;             // wraps around
+  size_t cnt = (last - first) / PGSIZE + 1;
+
+  struct supplemental_page_table_entry *inline_sptes[VM_PIN_INLINE_CNT];
+  struct supplemental_page_table_entry **sptes = inline_sptes;
+  void **kpages = pins->inline_kpages;
+  if (cnt > VM_PIN_INLINE_CNT) {
+    sptes = malloc (cnt * sizeof *sptes);
+    kpages = malloc (cnt * sizeof *kpages);
+    if (sptes == NULL || kpages == NULL)
+      goto fail;
+  }
+
+  // look the pages up, and load those which are not resident yet
+  size_t i;
+  for (i = 0; i < cnt; i++) {
+    struct supplemental_page_table_entry *spte =
+      vm_supt_lookup(supt, first + i * PGSIZE);
+    if (spte == NULL || (write && !spte->writable))
+      goto fail;
+    // the kernel is not stopped by read-only mappings: break any
+    // sharing before writing
+    bool resident = spte->status == ON_FRAME && !(write && spte->merged);
+    if (!resident && (write || spte->status != ZERO_MAPPED)
+        && !vm_load_page(supt, pagedir, spte->upage, write))
+      goto fail;
+    sptes[i] = spte;
+  }
+
+  // pin them together; a page evicted meanwhile is loaded again
+  if (vm_frame_pin_resident_range (sptes, cnt, kpages, write) < cnt) {
+    for (i = 0; i < cnt; i++) {
+      if (kpages[i] != NULL) continue;
+
+      if (!write && sptes[i]->status == ZERO_MAPPED) {
+        kpages[i] = vm_frame_zero_page ();
+        continue;
+      }
+      while (vm_frame_pin_resident_range (&sptes[i], 1, &kpages[i], write) == 0)
+        if (!vm_load_page(supt, pagedir, sptes[i]->upage, write)) {
+          vm_frame_unpin_range (kpages, cnt);
+          goto fail;
+        }
+    }
+  }
+
+  // the kernel writes through the frames' kernel addresses, whose
+  // dirty bits nobody looks at: mark the pages' own
+  if (write)
+    for (i = 0; i < cnt; i++)
+      pagedir_set_dirty (pagedir, first + i * PGSIZE, true);
+
+  if (sptes != inline_sptes)
+    free (sptes);
+  pins->page_cnt = cnt;
+  pins->kpages = kpages;
+  return true;
+
+ fail:
+  if (sptes != inline_sptes) {
+    free (sptes);
+    free (kpages);
+  }
+  return false;
+}
+
+/** Unpin the buffer pinned by vm_pin_range(). */
+void
+vm_unpin_range(struct vm_pin_list *pins)
+{
+  vm_frame_unpin_range (pins->kpages, pins->page_cnt);
+  if (pins->kpages != pins->inline_kpages)
+    free (pins->kpages);
+  pins->kpages = NULL;
+  pins->page_cnt = 0;
+}
+
 
 /* Helpers */
 
-// Hash Functions required for [frame_map]. Uses 'kaddr' as key.
-static unsigned
-spte_hash_func(const struct hash_elem *elem, void *aux UNUSED)
+/**
+ * Returns the slot of the SUPT that holds the SPTE for UPAGE.
+ * The second-level table is allocated if it is missing and CREATE
+ * is true; otherwise (or if that allocation fails, or UPAGE is not
+ * a user address) returns NULL.
+ */
+static struct supplemental_page_table_entry **
+spte_slot(struct supplemental_page_table *supt, void *upage, bool create)
 {
-  struct supplemental_page_table_entry *entry = hash_entry(elem, struct supplemental_page_table_entry, elem);
-  return hash_int( (int)entry->upage );
+  if (!is_user_vaddr (upage)) return NULL;
+
+  struct supplemental_page_table_entry ***pde = &supt->dir[pd_no (upage)];
+  if (*pde == NULL) {
+    if (!create) return NULL;
+
+    // one table is exactly one page (see SUPT_TABLE_CNT)
+    *pde = palloc_get_page (PAL_ZERO);
+    if (*pde == NULL) return NULL;
+  }
+  return &(*pde)[pt_no (upage)];
 }
+
+/* Insert SPTE, keyed by its upage. Returns false if there is already
+   an entry for that page (or no memory for its table). */
 static bool
-spte_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+spte_insert(struct supplemental_page_table *supt, struct supplemental_page_table_entry *spte)
 {
-  struct supplemental_page_table_entry *a_entry = hash_entry(a, struct supplemental_page_table_entry, elem);
-  struct supplemental_page_table_entry *b_entry = hash_entry(b, struct supplemental_page_table_entry, elem);
-  return a_entry->upage < b_entry->upage;
+  struct supplemental_page_table_entry **slot = spte_slot(supt, spte->upage, true);
+  if (slot == NULL || *slot != NULL) return false;
+
+  *slot = spte;
+  return true;
 }
+
 static void
-spte_destroy_func(struct hash_elem *elem, void *aux UNUSED)
+spte_destroy_func(struct supplemental_page_table_entry *entry)
 {
-  struct supplemental_page_table_entry *entry = hash_entry(elem, struct supplemental_page_table_entry, elem);
-
-  // Clean up the associated frame
-  if (entry->kpage != NULL) {
-    ASSERT (entry->status == ON_FRAME);
-    vm_frame_remove_entry (entry->kpage);
-  }
-  else if(entry->status == ON_SWAP) {
-    vm_swap_free (entry->swap_index);
+  // The frame (see vm_frame_release_all()) and the swap slot are
+  // released in bulk by vm_supt_destroy().
+  if(entry->status == ZERO_MAPPED) {
+    // the zero page must not be freed along with the page directory
+    pagedir_clear_page (thread_current ()->pagedir, entry->upage);
   }
 
   // Clean up SPTE entry.
-  free (entry);
+  kmem_cache_free (&spte_cache, entry);
 }
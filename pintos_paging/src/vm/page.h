@@ -2,7 +2,11 @@
 #define VM_PAGE_H
 
 #include "vm/swap.h"
-#include <hash.h>
+#include <stdint.h>
+#include "threads/pte.h"
+#include "threads/loader.h"
+#include "threads/synch.h"
+#include "threads/workqueue.h"
 #include "filesys/off_t.h"
 
 /**
@@ -10,19 +14,68 @@
  */
 enum page_status {
   ALL_ZERO,
+  ZERO_MAPPED,      /* All zero, mapped read-only to the shared zero page. */
   ON_FRAME,         
   ON_SWAP,          
-  FROM_FILESYS      
+  FROM_FILESYS,
+  FROM_SHM          /* Page of a shared-memory object, not mapped in yet. */
 };
 
+struct vm_shm;
+struct thread;
+
+/* Number of top-level slots, one per page directory entry that
+   covers user virtual memory. */
+#define SUPT_DIR_CNT (LOADER_PHYS_BASE >> PDSHIFT)
+
+/* Number of entries of a second-level table; one table fills
+   exactly one page, like a hardware page table. */
+#define SUPT_TABLE_CNT (1 << PTBITS)
+
+/**
+ * Stride detector of a process's major faults (see vm/page.c).
+ * Once faults come at the same distance from each other, the pages
+ * further along at that distance are brought in ahead of the
+ * program by a kernel thread, NEXT and CNT telling it which.
+ * Protected by the lock of the SUPT it is in.
+ */
+struct vm_stride
+  {
+    uintptr_t last;           /* Page of the last major fault. */
+    intptr_t stride;          /* Its distance from the one before, in pages. */
+    size_t hits;              /* Faults at STRIDE since it changed. */
+    size_t ahead;             /* Pages after LAST requested already. */
+    size_t window;            /* Pages to request at the next refill. */
+    uintptr_t next;           /* Next page to prefetch. */
+    size_t cnt;               /* Pages left to prefetch from NEXT on. */
+    struct thread *process;   /* The process the pages belong to. */
+    struct work work;         /* Prefetches them. */
+    bool running;             /* WORK is queued or running. */
+    bool waiting;             /* vm_supt_destroy() waits for WORK. */
+    struct semaphore done;    /* Upped for it when WORK ends. */
+  };
+
 /**
  * Supplemental page table,
- * There is one for each process
+ * There is one for each process.
+ *
+ * Laid out like the x86 page directory: `dir' is indexed by pd_no(upage)
+ * and points to a page-sized table, indexed by pt_no(upage), of pointers
+ * to the SPTEs. Tables are allocated on the first install in their 4 MB
+ * range, so both lookup and install are two array accesses.
+ *
+ * The threads of a process share it. `lock' is held around page faults
+ * and the calls that change the table on a process's behalf, so that two
+ * of them never load the same page at once; eviction goes by frame_lock
+ * as before, and it is never held while the kernel touches user memory.
  */
 struct supplemental_page_table
   {
-    /* The hash table, page_map -> spte */
-    struct hash page_map;
+    struct supplemental_page_table_entry **dir[SUPT_DIR_CNT];
+    struct lock lock;
+    size_t swap_cnt;          /* Swap slots held by its pages. */
+    size_t locked_cnt;        /* Pages locked in memory (vm_supt_lock()). */
+    struct vm_stride stride;  /* Prefetching of strided faults. */
   };
 
 struct supplemental_page_table_entry
@@ -31,44 +84,118 @@ struct supplemental_page_table_entry
     void *kpage;              /* Kernel page (frame) associated to it.
                                  Only effective when status == ON_FRAME.
                                  If the page is not on the frame, should be NULL. */
-    struct hash_elem elem;
 
     enum page_status status;
 
     // if ON_SWAP
-    swap_index_t swap_index;  /* Stores the swap index if the page is swapped out.
-                                 Only effective when status == ON_SWAP */
+    swap_index_t swap_index;  /* Stores the swap index if the page is swapped out,
+                                 or SWAP_NONE. A page on a frame keeps the slot
+                                 it was swapped in from until it is modified. */
 
     // if FROM_FILESYS
-    struct file *file;
+    struct file *file;        /* Backing file, or NULL if the page has none. */
     off_t file_offset;
     uint32_t read_bytes, zero_bytes;
     bool writable;
+    bool dirty;               /* Modified since loaded from the file. A dirty page
+                                 can never be re-loaded from `file' again,
+                                 unless it is written back to it (mmap). */
+    bool mmap;                /* Part of a memory-mapped file: modifications are
+                                 written back to `file', never to swap. */
+    uint8_t advice;           /* Access hint, MADV_* (see vm_supt_advise()). */
+    bool merged;              /* ON_FRAME, mapped read-only to a frame merged
+                                 with identical pages (see vm/frame.c). */
+    bool locked;              /* Locked in memory: ON_FRAME, and its frame is
+                                 never evicted (see vm_supt_lock()). */
+
+    // if part of a shared-memory object (FROM_SHM, or ON_FRAME)
+    struct vm_shm *shm;       /* The object, or NULL. */
+    size_t shm_idx;           /* Index of the page in the object. */
   };
 
 
+/* Fault-around window, in pages (see vm/page.c). */
+extern size_t vm_fault_around;
+
+/* Stack prefault window, in pages (see vm_supt_grow_stack()). */
+extern size_t vm_stack_prefault;
+
+/* Largest stride prefetch, in pages (see vm_supt_note_fault()). */
+extern size_t vm_stride_prefetch;
+
+/* Locked-memory limit per process, in pages, and whether each
+   process's image is locked as it is loaded (see vm/page.c). */
+extern size_t vm_mlock_limit;
+extern bool vm_mlockall;
+
 /*
  * Methods for manipulating supplemental page tables.
  */
 
+void vm_supt_init (void);
+void vm_supt_start_prefetch (void);
 struct supplemental_page_table* vm_supt_create (void);
 void vm_supt_destroy (struct supplemental_page_table *);
+bool vm_supt_fork (struct supplemental_page_table *, uint32_t *pagedir,
+    struct thread *parent);
+void vm_supt_walk (struct supplemental_page_table *,
+    void (*func) (struct supplemental_page_table_entry *, void *aux), void *aux);
 
 bool vm_supt_install_frame (struct supplemental_page_table *supt, void *upage, void *kpage);
 bool vm_supt_install_zeropage (struct supplemental_page_table *supt, void *);
-bool vm_supt_set_swap (struct supplemental_page_table *supt, void *, swap_index_t);
+bool vm_supt_set_swap (struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *, swap_index_t);
+void vm_supt_drop_swap_cache (struct supplemental_page_table *,
+    struct supplemental_page_table_entry *);
+bool vm_supt_set_filesys (struct supplemental_page_table *supt, void *, bool dirty);
 bool vm_supt_lazy_load (struct supplemental_page_table *supt, void *page,
     struct file * file, off_t offset, uint32_t read_bytes, uint32_t zero_bytes, bool writable);
 
 struct supplemental_page_table_entry* vm_supt_lookup (struct supplemental_page_table *supt, void *);
 bool vm_supt_has_entry (struct supplemental_page_table *, void *page);
 
-bool vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upage);
+bool vm_supt_is_copy_on_write (struct supplemental_page_table *, void *page);
 
+bool vm_load_page(struct supplemental_page_table *supt, uint32_t *pagedir, void *upage, bool write);
+void vm_supt_note_fault(struct supplemental_page_table *supt, void *upage);
+bool vm_supt_grow_stack(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *fault_page);
+bool vm_supt_advise(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, size_t cnt, int advice);
+bool vm_supt_lock(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, size_t cnt);
+bool vm_supt_unlock(struct supplemental_page_table *supt, void *page, size_t cnt);
+
+bool vm_supt_mm_map(struct supplemental_page_table *supt, void *page,
+    struct file *f, off_t offset, size_t bytes);
 bool vm_supt_mm_unmap(struct supplemental_page_table *supt, uint32_t *pagedir,
     void *page, struct file *f, off_t offset, size_t bytes);
+bool vm_supt_install_shm(struct supplemental_page_table *supt, void *page,
+    struct vm_shm *, size_t idx);
+void vm_supt_shm_unmap(struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *page, bool keep);
 
 void vm_pin_page(struct supplemental_page_table *supt, void *page);
 void vm_unpin_page(struct supplemental_page_table *supt, void *page);
 
+/* Buffers of up to this many pages are pinned without allocating
+   memory. */
+#define VM_PIN_INLINE_CNT 4
+
+/* A user buffer pinned by vm_pin_range(): the kernel address of
+   each of its pages, in order.  The buffer starts at offset
+   pg_ofs (uaddr) of kpages[0]. */
+struct vm_pin_list
+  {
+    uint8_t *uaddr;           /* Start of the buffer. */
+    size_t len;               /* Length of the buffer, in bytes. */
+    size_t page_cnt;          /* Number of pages spanned. */
+    void **kpages;            /* Their kernel addresses. */
+    void *inline_kpages[VM_PIN_INLINE_CNT]; /* kpages, if it fits. */
+  };
+
+bool vm_pin_range(struct supplemental_page_table *supt, uint32_t *pagedir,
+    const void *uaddr, size_t len, bool write, struct vm_pin_list *);
+void vm_unpin_range(struct vm_pin_list *);
+
 #endif
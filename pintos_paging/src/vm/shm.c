@@ -0,0 +1,157 @@
+#include <string.h>
+
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+
+/* The shared-memory objects, by name, and a lock for the table and
+   for their map_cnt.  It is never held while a page is touched:
+   the pages themselves go by frame_lock. */
+static struct hash shm_table;
+static struct lock shm_lock;
+
+static unsigned shm_hash_func(const struct hash_elem *elem, void *aux);
+static bool     shm_less_func(const struct hash_elem *, const struct hash_elem *, void *aux);
+
+
+void
+vm_shm_init (void)
+{
+  hash_init (&shm_table, shm_hash_func, shm_less_func, NULL);
+  lock_init_named (&shm_lock, "shm");
+}
+
+/**
+ * Find the shared-memory object NAME, or create it with PAGE_CNT
+ * pages, all zero, if there is none; and take a mapping's reference
+ * to it, dropped by vm_shm_close().
+ * Returns NULL if the object is smaller than PAGE_CNT pages, or out
+ * of memory.
+ */
+struct vm_shm *
+vm_shm_open (const char *name, size_t page_cnt)
+{
+  ASSERT (strlen (name) <= SHM_NAME_MAX);
+  ASSERT (page_cnt > 0 && page_cnt <= SHM_MAX_PAGES);
+
+  lock_acquire (&shm_lock);
+
+  struct vm_shm key;
+  strlcpy (key.name, name, sizeof key.name);
+  struct hash_elem *h = hash_find (&shm_table, &key.elem);
+  struct vm_shm *shm = NULL;
+  if (h != NULL) {
+    shm = hash_entry (h, struct vm_shm, elem);
+    if (page_cnt > shm->page_cnt)
+      shm = NULL;
+  }
+  else {
+    shm = malloc (sizeof *shm);
+    if (shm != NULL) {
+      // calloc(): every page starts out SHM_ZERO
+      shm->pages = calloc (page_cnt, sizeof *shm->pages);
+      if (shm->pages == NULL) {
+        free (shm);
+        shm = NULL;
+      }
+    }
+    if (shm != NULL) {
+      strlcpy (shm->name, name, sizeof shm->name);
+      shm->linked = true;
+      shm->map_cnt = 0;
+      shm->page_cnt = page_cnt;
+      hash_insert (&shm_table, &shm->elem);
+    }
+  }
+  if (shm != NULL)
+    shm->map_cnt++;
+
+  lock_release (&shm_lock);
+  return shm;
+}
+
+/**
+ * Drop a mapping's reference to SHM.  The last one destroys the
+ * object, along with the swap slots of its pages.
+ */
+void
+vm_shm_close (struct vm_shm *shm)
+{
+  lock_acquire (&shm_lock);
+  bool last = --shm->map_cnt == 0;
+  if (last && shm->linked)
+    hash_delete (&shm_table, &shm->elem);
+  lock_release (&shm_lock);
+
+  if (last) {
+    vm_frame_shm_release (shm);
+    free (shm->pages);
+    free (shm);
+  }
+}
+
+/**
+ * Map the first PAGE_CNT pages of SHM at ADDR, where all of them
+ * must be free user pages. They are faulted in on first access.
+ * Returns false, installing nothing, if out of memory.
+ */
+bool
+vm_shm_map (struct supplemental_page_table *supt, void *addr,
+    struct vm_shm *shm, size_t page_cnt)
+{
+  ASSERT (page_cnt <= shm->page_cnt);
+
+  size_t i;
+  for (i = 0; i < page_cnt; i++)
+    if (!vm_supt_install_shm (supt, (uint8_t *) addr + i * PGSIZE, shm, i)) {
+      // undo the pages installed so far
+      while (i-- > 0)
+        vm_supt_shm_unmap (supt, NULL, (uint8_t *) addr + i * PGSIZE, true);
+      return false;
+    }
+  return true;
+}
+
+/**
+ * Unmap the PAGE_CNT pages of SHM mapped at ADDR by vm_shm_map(),
+ * then drop the reference of that mapping (see vm_shm_close()).
+ *
+ * A page mapped by no other process is saved to swap for the ones
+ * that will map it later -- unless this is the last mapping of the
+ * object: the object is first unlinked then, so that nobody can map
+ * it any more, and the pages are just freed.
+ */
+void
+vm_shm_unmap (struct supplemental_page_table *supt, uint32_t *pagedir,
+    void *addr, struct vm_shm *shm, size_t page_cnt)
+{
+  lock_acquire (&shm_lock);
+  bool keep = shm->map_cnt > 1;
+  if (!keep && shm->linked) {
+    hash_delete (&shm_table, &shm->elem);
+    shm->linked = false;
+  }
+  lock_release (&shm_lock);
+
+  size_t i;
+  for (i = 0; i < page_cnt; i++)
+    vm_supt_shm_unmap (supt, pagedir, (uint8_t *) addr + i * PGSIZE, keep);
+  vm_shm_close (shm);
+}
+
+
+/* Helpers */
+
+// Hash Functions required for [shm_table]. Uses the name as key.
+static unsigned shm_hash_func(const struct hash_elem *elem, void *aux UNUSED)
+{
+  return hash_string (hash_entry (elem, struct vm_shm, elem)->name);
+}
+static bool shm_less_func(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  return strcmp (hash_entry (a, struct vm_shm, elem)->name,
+                 hash_entry (b, struct vm_shm, elem)->name) < 0;
+}
@@ -0,0 +1,63 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "vm/swap.h"
+
+struct supplemental_page_table;
+
+/* Longest name of a shared-memory object. */
+#define SHM_NAME_MAX 14
+
+/* Most pages of a shared-memory object. */
+#define SHM_MAX_PAGES 1024
+
+/**
+ * Indicates where a page of a shared-memory object is.
+ */
+enum shm_page_status {
+  SHM_ZERO,         /* Never brought in: all zero. */
+  SHM_FRAME,        /* On a frame, mapped by at least one process. */
+  SHM_SWAP,         /* On swap, mapped by none. */
+  SHM_TRANSIT       /* Being brought in or written out. */
+};
+
+/* A page of a shared-memory object.  Changes under frame_lock
+   (see vm/frame.c). */
+struct vm_shm_page
+  {
+    enum shm_page_status status;
+    void *kpage;              /* Its frame, if SHM_FRAME. */
+    swap_index_t swap_index;  /* Its swap slot, if SHM_SWAP. */
+  };
+
+/**
+ * A named shared-memory object: anonymous pages that several
+ * processes map into their address spaces, and see each other's
+ * writes to.  A page on a frame is the same frame in every process
+ * mapping it, tracked by the frame table with the rest of its
+ * mappings; an object lives as long as it is mapped somewhere.
+ */
+struct vm_shm
+  {
+    struct hash_elem elem;    /* belong to shm_table, unless unlinked */
+    char name[SHM_NAME_MAX + 1];
+    bool linked;              /* Still found by its name. */
+    size_t map_cnt;           /* Number of mappings of the object. */
+    size_t page_cnt;
+    struct vm_shm_page *pages;
+  };
+
+void vm_shm_init (void);
+struct vm_shm *vm_shm_open (const char *name, size_t page_cnt);
+void vm_shm_close (struct vm_shm *);
+
+bool vm_shm_map (struct supplemental_page_table *, void *addr,
+    struct vm_shm *, size_t page_cnt);
+void vm_shm_unmap (struct supplemental_page_table *, uint32_t *pagedir,
+    void *addr, struct vm_shm *, size_t page_cnt);
+
+#endif /* vm/shm.h */
@@ -1,83 +1,635 @@
 #include <bitmap.h>
+#include <inttypes.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/shrink.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/tunable.h"
 #include "threads/vaddr.h"
 #include "devices/block.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/packfs.h"
 #include "vm/swap.h"
 
-static struct block *swap_block;
+/* Swap devices.
+
+   Swap slots are numbered across all the swap devices, each of
+   which owns a range of the numbers, so a swap index says which
+   device the page is on.  Clustered swap-outs go round-robin to
+   the devices of the highest priority that have room, so that
+   with devices on different disks consecutive clusters are
+   written, and later read, in parallel.
+
+   A swap device is either a block device, usually a swap
+   partition, or a swap file.  The pages of a swap file are looked
+   up once, when it is added, as runs of slots that are
+   contiguous on the file system's device, so that swapping to it
+   goes to the block layer as directly as to a partition.  Swap
+   files may be added at any time, growing the swap. */
+char *vm_swap_devices = NULL;
+char *vm_swap_files = NULL;
+
+/* Free extents: the maximal runs of free slots of a device, in
+   order of their start.  Slots are allocated next-fit, from the
+   extent at the device's cursor onwards, so that successive
+   swap-outs land in contiguous slots and the extents in front of
+   the cursor are not scanned over and over again. swap_available
+   mirrors them slot by slot. */
+struct swap_extent
+  {
+    size_t start;               /* First free slot. */
+    size_t cnt;                 /* Number of free slots. */
+    struct list_elem elem;      /* In the device's `extents'. */
+  };
+
+/* A run of the slots of a swap file that are contiguous on its
+   block device. */
+struct swap_file_run
+  {
+    size_t slot;                /* First slot, from the device's base. */
+    block_sector_t sector;      /* Sector of that slot. */
+    size_t cnt;                 /* Number of slots. */
+  };
+
+struct swap_device
+  {
+    struct block *block;
+    int priority;                 /* Higher ones are used first. */
+    size_t base;                  /* First slot. */
+    size_t size;                  /* Number of slots. */
+    struct list extents;          /* Free extents. */
+    struct list_elem *cursor;     /* Next extent to allocate from. */
+    struct file *file;            /* Swap file, or NULL. */
+    struct swap_file_run *runs;   /* Slots of FILE, by slot. */
+    size_t run_cnt;
+    bool discard;                 /* Can BLOCK discard freed slots? */
+  };
+
+/* The devices, in the order they were added.  An entry never
+   moves, and is set up before swap_dev_cnt counts it, so that
+   slot_device() needs no lock. */
+#define SWAP_DEV_MAX 8
+static struct swap_device swap_devs[SWAP_DEV_MAX];
+static struct swap_device *swap_order[SWAP_DEV_MAX]; /* By priority. */
+static size_t swap_dev_cnt;
+static size_t swap_rotor;      /* Round-robin among equal priorities. */
+static bool swap_full;         /* A reservation failed; no slot freed since. */
+
 static struct bitmap *swap_available;
 
+/* Protects swap_available, the free extents, swap_order, swap_rotor and
+   swap_full, and serializes the adding of devices. The
+   disk I/O itself runs without it, since slots are reserved
+   before they are written and released only after they are read. */
+static struct lock swap_lock;
+
+static struct kmem_cache extent_cache;
+
+/* Freed slots on devices that can discard, which stay reserved,
+   so that no swap-out writes them, until they are discarded in a
+   batch once SWAP_DISCARD_RUNS runs of them are waiting.  Each run
+   is on one device.  Protected by swap_lock. */
+#define SWAP_DISCARD_RUNS 32
+struct swap_run
+  {
+    size_t slot;                /* First slot. */
+    size_t cnt;                 /* Number of slots. */
+  };
+static struct swap_run discard_runs[SWAP_DISCARD_RUNS];
+static size_t discard_run_cnt;
+
+static size_t swap_alloc (struct swap_device *, size_t cnt);
+static size_t swap_alloc_any (size_t cnt);
+static void swap_release (size_t slot, size_t cnt);
+static bool swap_free (size_t slot, size_t cnt);
+static void swap_undefer (void);
+static void swap_discard (void);
+static void swap_write (swap_index_t first, void **pages, size_t cnt);
+static bool add_swap_device (const struct swap_device *);
+static bool swap_grow (size_t size);
+
 static const size_t SECTORS_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
 
 // the number of possible (swapped) pages.
 static size_t swap_size;
 
+/* Compressed swap cache ("zswap").
+
+   Swapped-out pages that compress to at most half a page are kept,
+   compressed, in RAM instead of being written to the swap disk, so
+   swapping them back in is a decompression rather than 8 sector
+   reads.  Every cached page still owns its (reserved) swap slot:
+   when the cache is full, the least recently stored pages are
+   written to their slots to make room, and from then on they are
+   on the disk like any other page.  The same happens when the
+   kernel pool runs short, through the cache's shrinker. */
+size_t vm_zswap_pages = 0;
+
+size_t vm_swap_cluster = SWAP_CLUSTER;
+
+// Discard freed slots on devices that can, for thin-provisioned
+// disk images to give back their space.
+static bool vm_swap_discard = true;
+
+static struct tunable swap_tunables[] =
+  {
+    TUNABLE ("vm.swap_cluster", vm_swap_cluster, 1, SWAP_CLUSTER, NULL),
+    TUNABLE ("vm.swap_discard", vm_swap_discard, 0, 1, NULL),
+  };
+
+/* A page in the compressed swap cache. */
+struct zswap_entry
+  {
+    swap_index_t slot;          /* Swap slot the page belongs to. */
+    size_t len;                 /* Compressed size, in bytes. */
+    struct list_elem elem;      /* In zswap_lru. */
+    uint8_t data[];             /* Compressed data. */
+  };
+
+static struct lock zswap_lock;         /* Protects all the zswap state. */
+static struct zswap_entry **zswap_map; /* Slot -> entry, NULL if on disk. */
+static struct list zswap_lru;          /* Entries, least recent first. */
+static size_t zswap_used, zswap_cap;   /* Bytes stored, and the limit. */
+static struct lz_state zswap_lz;       /* Scratch for lz_compress(). */
+static uint8_t *zswap_buf;             /* Scratch page. */
+
+static void zswap_init (void);
+static bool zswap_grow (size_t size);
+static bool zswap_store (swap_index_t, void *page);
+static bool zswap_load (swap_index_t, void *page);
+static void zswap_drop (swap_index_t);
+static size_t zswap_shrink_count (void);
+static size_t zswap_shrink_scan (size_t nr);
+
+static struct shrinker zswap_shrinker = {
+  .name = "zswap",
+  .count = zswap_shrink_count,
+  .scan = zswap_shrink_scan,
+};
+
+/* Adds BLOCK as a swap device of the given PRIORITY. */
+static void
+add_swap_block (struct block *block, int priority)
+{
+  struct swap_device dev;
+
+  dev.block = block;
+  dev.priority = priority;
+  dev.size = block_size (block) / SECTORS_PER_PAGE;
+  dev.file = NULL;
+  dev.runs = NULL;
+  dev.run_cnt = 0;
+  if (!add_swap_device (&dev))
+    PANIC ("Error: Can't swap to %s", block_name (block));
+
+  printf ("swap: using %s, priority %d\n", block_name (block), priority);
+}
+
 void
 vm_swap_init ()
 { 
   ASSERT (SECTORS_PER_PAGE > 0); // 4096/512 = 8?
 
-  // Initialize the swap disk
-  swap_block = block_get_role(BLOCK_SWAP);
-  if(swap_block == NULL) {
-    PANIC ("Error: Can't initialize swap block");
+  lock_init_named (&swap_lock, "swap");
+  tunable_register (swap_tunables,
+                    sizeof swap_tunables / sizeof *swap_tunables);
+  kmem_cache_init (&extent_cache, "swap extent", sizeof (struct swap_extent),
+      0, NULL);
+  // before any device: its map grows with the swap
+  zswap_init ();
+
+  // Find the swap devices: those named by "-swap", or else all the
+  // block devices of the swap type, at the same priority, and the
+  // swap files named by "-swapfile".
+  char *name, *save_ptr;
+  if (vm_swap_devices != NULL) {
+    for (name = strtok_r (vm_swap_devices, ",", &save_ptr); name != NULL;
+         name = strtok_r (NULL, ",", &save_ptr)) {
+      char *prio = strchr (name, ':');
+      if (prio != NULL)
+        *prio++ = '\0';
+
+      struct block *block = block_get_by_name (name);
+      if (block == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      add_swap_block (block, prio != NULL ? atoi (prio) : 0);
+    }
+  }
+  else {
+    struct block *block;
+    for (block = block_first (); block != NULL; block = block_next (block))
+      if (block_type (block) == BLOCK_SWAP)
+        add_swap_block (block, 0);
+  }
+  if (vm_swap_files != NULL) {
+    for (name = strtok_r (vm_swap_files, ",", &save_ptr); name != NULL;
+         name = strtok_r (NULL, ",", &save_ptr)) {
+      char *prio = strchr (name, ':');
+      if (prio != NULL)
+        *prio++ = '\0';
+
+      if (!vm_swap_add_file (name, prio != NULL ? atoi (prio) : 0))
+        PANIC ("Error: Can't swap to file \"%s\"", name);
+    }
   }
 
-  // Initialize swap_available (a list to save each block of sector avalabality)
+  // swap files may still be added later
+  if (swap_dev_cnt == 0)
+    printf ("swap: no swap devices\n");
+
+  size_t i;
+  for (i = 0; i < swap_dev_cnt; i++)
+    if (swap_order[i]->file == NULL) {
+      block_set_role (BLOCK_SWAP, swap_order[i]->block);
+      break;
+    }
+}
+
+/* Looks up the pages of the swap file of DEV on its block device,
+   setting its SIZE and RUNS.  A page whose sectors are not
+   contiguous, where the file goes from one extent into the next,
+   is left out.  Returns false if no page is left, or memory runs
+   out. */
+static bool
+map_swap_file (struct swap_device *dev)
+{
+  struct inode *inode = file_get_inode (dev->file);
+  off_t length = file_length (dev->file) / PGSIZE * PGSIZE;
+  size_t run_max = 0;
+  off_t ofs = 0;
+
+  dev->size = 0;
+  dev->runs = NULL;
+  dev->run_cnt = 0;
+  while (ofs < length) {
+    size_t cnt;
+    block_sector_t sector = inode_sector_run (inode, ofs,
+        (length - ofs) / BLOCK_SECTOR_SIZE, &cnt);
+    size_t pages = cnt / SECTORS_PER_PAGE;
+    if (pages == 0) {
+      ofs += PGSIZE;
+      continue;
+    }
+
+    struct swap_file_run *last = dev->run_cnt > 0
+      ? &dev->runs[dev->run_cnt - 1] : NULL;
+    if (last != NULL && last->sector + last->cnt * SECTORS_PER_PAGE == sector)
+      last->cnt += pages;
+    else {
+      if (dev->run_cnt == run_max) {
+        run_max = run_max > 0 ? 2 * run_max : 4;
+        struct swap_file_run *runs = realloc (dev->runs, run_max * sizeof *runs);
+        if (runs == NULL) {
+          free (dev->runs);
+          return false;
+        }
+        dev->runs = runs;
+      }
+      last = &dev->runs[dev->run_cnt++];
+      last->slot = dev->size;
+      last->sector = sector;
+      last->cnt = pages;
+    }
+    dev->size += pages;
+    ofs += pages * PGSIZE;
+  }
+
+  if (dev->size == 0) {
+    free (dev->runs);
+    return false;
+  }
+  return true;
+}
+
+bool
+vm_swap_add_file (const char *name, int priority)
+{
+  struct block *block = block_get_role (BLOCK_FILESYS);
+  struct file *file;
+
+  // a packed image is read-only, and its files' sectors are shared
+  // by nothing else: swapping to one would overwrite its data.
+  if (packfs_mounted ()) {
+    printf ("swap: file system is read-only\n");
+    return false;
+  }
+
+  file = block != NULL ? filesys_open (name) : NULL;
+  if (file == NULL)
+    return false;
+
+  struct swap_device dev;
+  dev.block = block;
+  dev.priority = priority;
+  dev.file = file;
+  if (!map_swap_file (&dev)) {
+    file_close (file);
+    return false;
+  }
+
+  // the sectors are written behind the file system's back from now
+  // on: no write may go through it any more, and none of the
+  // file's cached sectors may be written back over a swapped page.
+  file_deny_write (file);
+  inode_sync (file_get_inode (file));
+
+  if (!add_swap_device (&dev)) {
+    free (dev.runs);
+    file_close (file);
+    return false;
+  }
+
+  printf ("swap: using file %s, %zu pages, priority %d\n",
+          name, dev.size, priority);
+  return true;
+}
+
+/* Adds a swap device like DEV, of which BLOCK, PRIORITY, SIZE,
+   FILE and RUNS are set, numbering its slots after those of the
+   devices already there.  Returns false if it is there already,
+   if there are too many devices, or if memory runs out. */
+static bool
+add_swap_device (const struct swap_device *dev)
+{
+  bool success = false;
+
+  lock_acquire (&swap_lock);
+
+  size_t i;
+  for (i = 0; i < swap_dev_cnt; i++) {
+    const struct swap_device *other = &swap_devs[i];
+    if (dev->file == NULL
+        ? other->file == NULL && other->block == dev->block
+        : other->file != NULL
+          && file_get_inode (other->file) == file_get_inode (dev->file)) {
+      printf ("swap: device given twice\n");
+      goto done;
+    }
+  }
+  if (swap_dev_cnt >= SWAP_DEV_MAX) {
+    printf ("swap: more than %d swap devices\n", SWAP_DEV_MAX);
+    goto done;
+  }
+
+  // all of the device is one free extent
+  struct swap_extent *ext = NULL;
+  if (dev->size > 0) {
+    ext = kmem_cache_alloc (&extent_cache);
+    if (ext == NULL)
+      goto done;
+    if (!swap_grow (swap_size + dev->size)) {
+      kmem_cache_free (&extent_cache, ext);
+      goto done;
+    }
+  }
+
+  struct swap_device *new = &swap_devs[swap_dev_cnt];
+  *new = *dev;
+  new->base = swap_size;
+  new->discard = block_can_discard (new->block);
+  list_init (&new->extents);
+  new->cursor = NULL;
+  if (ext != NULL) {
+    ext->start = new->base;
+    ext->cnt = new->size;
+    list_push_back (&new->extents, &ext->elem);
+    new->cursor = &ext->elem;
+  }
+
+  for (i = swap_dev_cnt; i > 0 && swap_order[i - 1]->priority < new->priority; i--)
+    swap_order[i] = swap_order[i - 1];
+  swap_order[i] = new;
+  swap_dev_cnt++;
+  swap_size += new->size;
+  swap_full = false;
+  success = true;
+
+ done:
+  lock_release (&swap_lock);
+  return success;
+}
+
+/* Makes room for SIZE slots, past the current ones, which are
+   free.  swap_lock must be held. */
+static bool
+swap_grow (size_t size)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  ASSERT (size > swap_size);
+
   // each single bit of `swap_available` corresponds to a block region,
   // which consists of contiguous [SECTORS_PER_PAGE] sectors,
   // their total size being equal to PGSIZE.
-  swap_size = block_size(swap_block) / SECTORS_PER_PAGE;
-  swap_available = bitmap_create(swap_size);
-  // set all entry true since all is emty
-  bitmap_set_all(swap_available, true);
+  struct bitmap *available = bitmap_create (size);
+  if (available == NULL || !zswap_grow (size)) {
+    if (available != NULL)
+      bitmap_destroy (available);
+    return false;
+  }
+
+  // set all entry true since all is emty, but for those in use
+  bitmap_set_all (available, true);
+  size_t i;
+  for (i = 0; i < swap_size; i++)
+    if (!bitmap_test (swap_available, i))
+      bitmap_reset (available, i);
+  if (swap_available != NULL)
+    bitmap_destroy (swap_available);
+  swap_available = available;
+  return true;
+}
+
+/* Returns the swap device that SLOT is on. */
+static struct swap_device *
+slot_device (size_t slot)
+{
+  size_t i;
+  for (i = 0; i < swap_dev_cnt; i++)
+    if (slot - swap_devs[i].base < swap_devs[i].size)
+      return &swap_devs[i];
+  NOT_REACHED ();
+}
+
+/* Returns the first sector of SLOT on its device DEV. */
+static block_sector_t
+slot_sector (const struct swap_device *dev, size_t slot)
+{
+  slot -= dev->base;
+  if (dev->file == NULL)
+    return slot * SECTORS_PER_PAGE;
+
+  const struct swap_file_run *run;
+  for (run = dev->runs; slot - run->slot >= run->cnt; run++)
+    continue;
+  return run->sector + (slot - run->slot) * SECTORS_PER_PAGE;
+}
+
+
+swap_index_t vm_swap_alloc (void)
+{
+  lock_acquire (&swap_lock);
+  size_t swap_index = swap_alloc_any (1);
+  if (swap_index == BITMAP_ERROR)
+    swap_full = true;
+  lock_release (&swap_lock);
+  return swap_index == BITMAP_ERROR ? SWAP_NONE : swap_index;
+}
+
+
+void vm_swap_write (swap_index_t swap_index, void *page)
+{
+  ASSERT (swap_index < swap_size);
+  TRACE (TRACE_SWAP_OUT, 1, 0);
+  swap_write (swap_index, &page, 1);
 }
 
 
 swap_index_t vm_swap_out (void *page)
 {
-  // Ensure that the page is on user's virtual memory.
-  ASSERT (page >= PHYS_BASE);
+  swap_index_t swap_index;
+  if (vm_swap_out_cluster (&page, 1, &swap_index) == 0)
+    return SWAP_NONE;
+  return swap_index;
+}
 
-  // Find an available block region to use from 0 (start)
-  // return the first index of a block contain 1(cnt) bits true (value) 
-  // in bitmap name swap_available
-  size_t swap_index = bitmap_scan (swap_available, /*start*/0, /*cnt*/1, /*value*/true);
 
-  size_t i;
-  for (i = 0; i < SECTORS_PER_PAGE; ++ i) {
-    block_write(swap_block,
-        /* sector number */  swap_index * SECTORS_PER_PAGE + i,
-        /* target address */ page + (BLOCK_SECTOR_SIZE * i)
-        );
+size_t vm_swap_out_cluster (void **pages, size_t cnt, swap_index_t *first)
+{
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+  TRACE (TRACE_SWAP_OUT, cnt, 0);
+
+  // Find an available run of block regions, halving the cluster
+  // until it fits.
+  size_t swap_index = BITMAP_ERROR;
+  lock_acquire (&swap_lock);
+  for (; cnt > 0; cnt /= 2) {
+    swap_index = swap_alloc_any (cnt);
+    if (swap_index != BITMAP_ERROR) break;
+  }
+  if (swap_index == BITMAP_ERROR)
+    swap_full = true;
+  lock_release (&swap_lock);
+  if (swap_index == BITMAP_ERROR) {
+    *first = SWAP_NONE;
+    return 0;
   }
 
-  // occupy the slot: available becomes false
-  bitmap_set(swap_available, swap_index, false);
-  return swap_index;
+  swap_write (swap_index, pages, cnt);
+  *first = swap_index;
+  return cnt;
+}
+
+bool
+vm_swap_is_full (void)
+{
+  return swap_full;
 }
 
+/* Writes the CNT PAGES into the reserved slots from FIRST on, all
+   on one device.  The writes are queued all at once, for the swap
+   device's elevator to order and merge, then waited for. */
+static void
+swap_write (swap_index_t first, void **pages, size_t cnt)
+{
+  struct swap_device *dev = slot_device (first);
+  struct block_request reqs[SWAP_CLUSTER];
+  bool queued[SWAP_CLUSTER];
+  size_t p;
+  for (p = 0; p < cnt; ++ p) {
+    // Ensure that the page is on user's virtual memory.
+    ASSERT (pages[p] >= PHYS_BASE);
+
+    queued[p] = !zswap_store (first + p, pages[p]);
+    if (!queued[p])
+      continue;
 
-void vm_swap_in (swap_index_t swap_index, void *page)
+    block_request_init (&reqs[p], true, slot_sector (dev, first + p),
+                        SECTORS_PER_PAGE, pages[p]);
+    block_submit (dev->block, &reqs[p]);
+  }
+  for (p = 0; p < cnt; ++ p)
+    if (queued[p])
+      block_wait (&reqs[p]);
+
+  TRACE (TRACE_SWAP_OUT_DONE, first, cnt);
+  thread_current ()->usage.swap_outs += cnt;
+}
+
+/* Reads the page of SWAP_INDEX into PAGE.  Returns true if it was
+   read from the disk, false if from the compressed swap cache,
+   which no longer has it then. */
+static bool
+swap_read (swap_index_t swap_index, void *page)
 {
   // Ensure that the page is on user's virtual memory.
   ASSERT (page >= PHYS_BASE);
 
   // check the input: swap region
   ASSERT (swap_index < swap_size);
-  if (bitmap_test(swap_available, swap_index) == true) {
+  TRACE (TRACE_SWAP_IN, swap_index, 0);
+  thread_current ()->usage.swap_ins++;
+  lock_acquire (&swap_lock);
+  bool unassigned = bitmap_test(swap_available, swap_index);
+  lock_release (&swap_lock);
+  if (unassigned) {
     // still available slot, error
     PANIC ("Error, invalid read access to unassigned swap block");
   }
 
-  size_t i;
-  for (i = 0; i < SECTORS_PER_PAGE; ++ i) {
-    block_read (swap_block,
-        /* sector number */  swap_index * SECTORS_PER_PAGE + i,
-        /* target address */ page + (BLOCK_SECTOR_SIZE * i)
-        );
+  bool from_disk = !zswap_load (swap_index, page);
+  if (from_disk) {
+    struct swap_device *dev = slot_device (swap_index);
+    block_read_multiple (dev->block, slot_sector (dev, swap_index),
+                         SECTORS_PER_PAGE, page);
   }
+  TRACE (TRACE_SWAP_IN_DONE, swap_index, 0);
+  return from_disk;
+}
+
+void vm_swap_in (swap_index_t swap_index, void *page)
+{
+  swap_read (swap_index, page);
 
-  bitmap_set(swap_available, swap_index, true);
+  lock_acquire (&swap_lock);
+  swap_release (swap_index, 1);
+  lock_release (&swap_lock);
+}
+
+bool
+vm_swap_in_keep (swap_index_t swap_index, void *page)
+{
+  if (swap_read (swap_index, page))
+    return true;
+
+  lock_acquire (&swap_lock);
+  swap_release (swap_index, 1);
+  lock_release (&swap_lock);
+  return false;
+}
+
+swap_index_t
+vm_swap_dup (swap_index_t swap_index, void *buf)
+{
+  swap_index_t copy = vm_swap_alloc ();
+  if (copy == SWAP_NONE)
+    return SWAP_NONE;
+
+  // a page read from the compressed swap cache is not there any
+  // more: put it back for the original slot.
+  if (!swap_read (swap_index, buf))
+    swap_write (swap_index, &buf, 1);
+  swap_write (copy, &buf, 1);
+  return copy;
 }
 
 void
@@ -85,8 +637,434 @@ vm_swap_free (swap_index_t swap_index)
 {
   // check the swap region
   ASSERT (swap_index < swap_size);
+
+  // before the slot can be reserved again
+  zswap_drop (swap_index);
+
+  lock_acquire (&swap_lock);
   if (bitmap_test(swap_available, swap_index) == true) {
     PANIC ("Error, invalid free request to unassigned swap block");
   }
-  bitmap_set(swap_available, swap_index, true);
+  bool batch = swap_free (swap_index, 1);
+  lock_release (&swap_lock);
+  if (batch)
+    swap_discard ();
+}
+
+void
+vm_swap_free_range (swap_index_t first, size_t cnt)
+{
+  ASSERT (cnt > 0);
+  ASSERT (first < swap_size && cnt <= swap_size - first);
+
+  size_t i;
+  for (i = 0; i < cnt; i++)
+    zswap_drop (first + i);
+
+  lock_acquire (&swap_lock);
+  if (!bitmap_none (swap_available, first, cnt)) {
+    PANIC ("Error, invalid free request to unassigned swap block");
+  }
+  // the run may go on from one device into the next
+  bool batch = false;
+  while (cnt > 0) {
+    struct swap_device *dev = slot_device (first);
+    size_t n = dev->base + dev->size - first;
+    if (n > cnt)
+      n = cnt;
+    batch |= swap_free (first, n);
+    first += n;
+    cnt -= n;
+  }
+  lock_release (&swap_lock);
+  if (batch)
+    swap_discard ();
+}
+
+/* Frees the CNT reserved slots starting at SLOT, all on one
+   device: at once, or after they are discarded if the device can
+   discard.  Returns true if a batch of slots is then waiting for
+   swap_discard().  swap_lock must be held. */
+static bool
+swap_free (size_t slot, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  struct swap_device *dev = slot_device (slot);
+  if (!dev->discard || !vm_swap_discard) {
+    swap_release (slot, cnt);
+    return false;
+  }
+  // swap_alloc_any() takes waiting slots back if it needs them
+  swap_full = false;
+
+  // extend a waiting run of the device that the slots adjoin
+  size_t i;
+  for (i = 0; i < discard_run_cnt; i++) {
+    struct swap_run *run = &discard_runs[i];
+    if (slot_device (run->slot) != dev)
+      continue;
+    if (run->slot + run->cnt == slot) {
+      run->cnt += cnt;
+      return false;
+    }
+    if (slot + cnt == run->slot) {
+      run->slot = slot;
+      run->cnt += cnt;
+      return false;
+    }
+  }
+
+  if (discard_run_cnt == SWAP_DISCARD_RUNS) {
+    // another thread is about to discard the batch
+    swap_release (slot, cnt);
+    return false;
+  }
+  discard_runs[discard_run_cnt].slot = slot;
+  discard_runs[discard_run_cnt].cnt = cnt;
+  return ++discard_run_cnt == SWAP_DISCARD_RUNS;
+}
+
+/* Frees the slots waiting to be discarded without discarding
+   them, when they are needed for a swap-out.  swap_lock must be
+   held. */
+static void
+swap_undefer (void)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  size_t i;
+  for (i = 0; i < discard_run_cnt; i++)
+    swap_release (discard_runs[i].slot, discard_runs[i].cnt);
+  discard_run_cnt = 0;
+}
+
+/* Discards the slots waiting to be discarded, in runs of those
+   contiguous on their block device, then frees them.  swap_lock
+   must not be held: the discards are made without it. */
+static void
+swap_discard (void)
+{
+  struct swap_run runs[SWAP_DISCARD_RUNS];
+  size_t run_cnt, i;
+
+  lock_acquire (&swap_lock);
+  run_cnt = discard_run_cnt;
+  memcpy (runs, discard_runs, run_cnt * sizeof *runs);
+  discard_run_cnt = 0;
+  lock_release (&swap_lock);
+
+  for (i = 0; i < run_cnt; i++) {
+    struct swap_device *dev = slot_device (runs[i].slot);
+    size_t slot = runs[i].slot;
+    size_t left = runs[i].cnt;
+    while (left > 0) {
+      block_sector_t sector = slot_sector (dev, slot);
+      size_t n = 1;
+      while (n < left
+             && slot_sector (dev, slot + n) == sector + n * SECTORS_PER_PAGE)
+        n++;
+      block_discard (dev->block, sector, n * SECTORS_PER_PAGE);
+      slot += n;
+      left -= n;
+    }
+  }
+
+  lock_acquire (&swap_lock);
+  for (i = 0; i < run_cnt; i++)
+    swap_release (runs[i].slot, runs[i].cnt);
+  lock_release (&swap_lock);
+}
+
+
+/* Reserves a run of CNT free slots on one of the devices of the
+   highest priority that has one, taking turns among devices of
+   equal priority, and returns the first slot, or BITMAP_ERROR if
+   no device has such a run.  swap_lock must be held. */
+static size_t
+swap_alloc_any (size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  size_t start, end;
+  for (start = 0; start < swap_dev_cnt; start = end) {
+    // the devices [start, end) have the same priority
+    for (end = start + 1; end < swap_dev_cnt; end++)
+      if (swap_order[end]->priority != swap_order[start]->priority)
+        break;
+
+    size_t i;
+    for (i = 0; i < end - start; i++) {
+      struct swap_device *dev =
+        swap_order[start + (swap_rotor + i) % (end - start)];
+      size_t slot = swap_alloc (dev, cnt);
+      if (slot != BITMAP_ERROR) {
+        swap_rotor++;
+        return slot;
+      }
+    }
+  }
+
+  // slots waiting to be discarded are better used than discarded
+  if (discard_run_cnt > 0) {
+    swap_undefer ();
+    return swap_alloc_any (cnt);
+  }
+  return BITMAP_ERROR;
+}
+
+/* Reserves a run of CNT free slots of DEV, next-fit from its
+   cursor, and returns the first one, or BITMAP_ERROR if there is
+   no such run.  swap_lock must be held. */
+static size_t
+swap_alloc (struct swap_device *dev, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+  ASSERT (cnt > 0);
+
+  if (list_empty (&dev->extents))
+    return BITMAP_ERROR;
+
+  struct list_elem *e = dev->cursor;
+  do {
+    struct swap_extent *ext = list_entry (e, struct swap_extent, elem);
+    if (ext->cnt >= cnt) {
+      size_t start = ext->start;
+      ext->start += cnt;
+      ext->cnt -= cnt;
+      if (ext->cnt == 0) {
+        e = list_remove (e);
+        kmem_cache_free (&extent_cache, ext);
+      }
+
+      if (list_empty (&dev->extents))
+        dev->cursor = NULL;
+      else if (e == list_end (&dev->extents))
+        dev->cursor = list_begin (&dev->extents);
+      else
+        dev->cursor = e;
+      bitmap_set_multiple (swap_available, start, cnt, false);
+      return start;
+    }
+
+    e = list_next (e);
+    if (e == list_end (&dev->extents))
+      e = list_begin (&dev->extents);
+  } while (e != dev->cursor);
+
+  return BITMAP_ERROR;
+}
+
+/* Returns the CNT reserved slots starting at SLOT, all on one
+   device, to its free extents, merging them with their
+   neighbours.  swap_lock must be held. */
+static void
+swap_release (size_t slot, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  struct swap_device *dev = slot_device (slot);
+  ASSERT (slot + cnt <= dev->base + dev->size);
+
+  bitmap_set_multiple (swap_available, slot, cnt, true);
+  swap_full = false;
+
+  // the first extent after SLOT, and the one before it (if any)
+  struct list_elem *e;
+  for (e = list_begin (&dev->extents); e != list_end (&dev->extents); e = list_next (e))
+    if (list_entry (e, struct swap_extent, elem)->start > slot)
+      break;
+  struct swap_extent *next = e != list_end (&dev->extents)
+    ? list_entry (e, struct swap_extent, elem) : NULL;
+  struct swap_extent *prev = e != list_begin (&dev->extents)
+    ? list_entry (list_prev (e), struct swap_extent, elem) : NULL;
+
+  bool merge_prev = prev != NULL && prev->start + prev->cnt == slot;
+  bool merge_next = next != NULL && slot + cnt == next->start;
+
+  if (merge_prev && merge_next) {
+    prev->cnt += cnt + next->cnt;
+    if (dev->cursor == &next->elem)
+      dev->cursor = &prev->elem;
+    list_remove (&next->elem);
+    kmem_cache_free (&extent_cache, next);
+  }
+  else if (merge_prev)
+    prev->cnt += cnt;
+  else if (merge_next) {
+    next->start -= cnt;
+    next->cnt += cnt;
+  }
+  else {
+    struct swap_extent *ext = kmem_cache_alloc (&extent_cache);
+    if (ext == NULL)
+      PANIC ("Error: Out of memory for swap extents");
+    ext->start = slot;
+    ext->cnt = cnt;
+    list_insert (e, &ext->elem);
+    if (dev->cursor == NULL)
+      dev->cursor = &ext->elem;
+  }
+}
+
+/* Sets up the compressed swap cache, unless it is disabled. */
+static void
+zswap_init (void)
+{
+  lock_init_named (&zswap_lock, "zswap");
+  list_init (&zswap_lru);
+  zswap_used = 0;
+  zswap_cap = vm_zswap_pages * PGSIZE;
+  if (zswap_cap == 0)
+    return;
+
+  // the map of slots grows with the swap, from none
+  zswap_map = NULL;
+  zswap_buf = palloc_get_page (0);
+  if (zswap_buf == NULL) {
+    printf ("zswap: out of memory, disabled\n");
+    zswap_cap = 0;
+    return;
+  }
+  shrinker_register (&zswap_shrinker);
+}
+
+/* Makes room in the cache's map for SIZE slots, the new ones
+   not cached.  Returns false if memory runs out. */
+static bool
+zswap_grow (size_t size)
+{
+  if (zswap_cap == 0)
+    return true;
+
+  lock_acquire (&zswap_lock);
+  struct zswap_entry **map = realloc (zswap_map, size * sizeof *map);
+  if (map != NULL) {
+    memset (map + swap_size, 0, (size - swap_size) * sizeof *map);
+    zswap_map = map;
+  }
+  lock_release (&zswap_lock);
+  return map != NULL;
+}
+
+/* Remove the cached page E from the cache.
+   zswap_lock must be held. */
+static void
+zswap_remove (struct zswap_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  list_remove (&e->elem);
+  zswap_map[e->slot] = NULL;
+  zswap_used -= e->len;
+  free (e);
+}
+
+/* Write the cached page E back to its swap slot, and drop it from
+   the cache.  zswap_lock must be held. */
+static void
+zswap_spill (struct zswap_entry *e)
+{
+  if (lz_decompress (e->data, e->len, zswap_buf, PGSIZE) != PGSIZE)
+    PANIC ("zswap: corrupt page in slot %"PRIu32, e->slot);
+  struct swap_device *dev = slot_device (e->slot);
+  block_write_multiple (dev->block, slot_sector (dev, e->slot),
+                        SECTORS_PER_PAGE, zswap_buf);
+
+  zswap_remove (e);
+}
+
+/* Try to keep PAGE, to be swapped out into SLOT, compressed in RAM.
+   Returns false if it must be written to the disk instead. */
+static bool
+zswap_store (swap_index_t slot, void *page)
+{
+  if (zswap_cap == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+
+  bool stored = false;
+  size_t len = lz_compress (&zswap_lz, page, PGSIZE, zswap_buf, PGSIZE / 2);
+  if (len > 0 && len <= zswap_cap) {
+    struct zswap_entry *e = malloc (sizeof *e + len);
+    if (e != NULL) {
+      memcpy (e->data, zswap_buf, len);
+      e->slot = slot;
+      e->len = len;
+
+      // make room: spill the oldest pages to the disk
+      while (zswap_used + len > zswap_cap)
+        zswap_spill (list_entry (list_front (&zswap_lru), struct zswap_entry, elem));
+
+      ASSERT (zswap_map[slot] == NULL);
+      zswap_map[slot] = e;
+      list_push_back (&zswap_lru, &e->elem);
+      zswap_used += len;
+      stored = true;
+    }
+  }
+
+  lock_release (&zswap_lock);
+  return stored;
+}
+
+/* If the page of SLOT is in the cache, decompress it into PAGE and
+   drop it from the cache.  Returns false if it is on the disk. */
+static bool
+zswap_load (swap_index_t slot, void *page)
+{
+  if (zswap_cap == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+
+  struct zswap_entry *e = zswap_map[slot];
+  bool found = e != NULL;
+  if (found) {
+    if (lz_decompress (e->data, e->len, page, PGSIZE) != PGSIZE)
+      PANIC ("zswap: corrupt page in slot %"PRIu32, slot);
+    zswap_remove (e);
+  }
+
+  lock_release (&zswap_lock);
+  return found;
+}
+
+/* Returns the number of pages in the cache, or 0 if it is busy. */
+static size_t
+zswap_shrink_count (void)
+{
+  if (lock_held_by_current_thread (&zswap_lock) || !lock_try_acquire (&zswap_lock))
+    return 0;
+  size_t cnt = list_size (&zswap_lru);
+  lock_release (&zswap_lock);
+  return cnt;
+}
+
+/* Write up to NR of the least recently stored pages to the disk,
+   unless the cache is busy.  Returns the number written. */
+static size_t
+zswap_shrink_scan (size_t nr)
+{
+  if (lock_held_by_current_thread (&zswap_lock) || !lock_try_acquire (&zswap_lock))
+    return 0;
+  size_t cnt;
+  for (cnt = 0; cnt < nr && !list_empty (&zswap_lru); cnt++)
+    zswap_spill (list_entry (list_front (&zswap_lru), struct zswap_entry, elem));
+  lock_release (&zswap_lock);
+  return cnt;
+}
+
+/* Drop the page of SLOT from the cache, if it is there. */
+static void
+zswap_drop (swap_index_t slot)
+{
+  if (zswap_cap == 0)
+    return;
+
+  lock_acquire (&zswap_lock);
+  if (zswap_map[slot] != NULL)
+    zswap_remove (zswap_map[slot]);
+  lock_release (&zswap_lock);
 }
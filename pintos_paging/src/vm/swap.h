@@ -1,32 +1,119 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef uint32_t swap_index_t;
 
+/* No swap slot. */
+#define SWAP_NONE ((swap_index_t) -1)
+
+/* Maximum number of pages moved together by one clustered
+   swap-out, and read ahead by one swap-in. */
+#define SWAP_CLUSTER 8
+
+/* Number of pages moved together, at most SWAP_CLUSTER.  Tunable
+   as "vm.swap_cluster". */
+extern size_t vm_swap_cluster;
+
+/* Size of the compressed swap cache, in pages, 0 if disabled.
+   Set by the kernel command-line option "-zswap". */
+extern size_t vm_zswap_pages;
+
+/* Swap devices, as a comma-separated list of block device names,
+   each optionally followed by ":" and a priority, or NULL for all
+   the swap partitions.  Set by the kernel command-line option
+   "-swap". */
+extern char *vm_swap_devices;
+
+/* Swap files, as a comma-separated list of file names, each
+   optionally followed by ":" and a priority, or NULL for none.
+   Set by the kernel command-line option "-swapfile". */
+extern char *vm_swap_files;
+
 
 /* Functions for Swap Table manipulation. */
 
 /**
  * Initialize the swap. Must be called ONLY ONCE at the initializtion phase.
+ * Also sets up the compressed swap cache, if `vm_zswap_pages' > 0.
  */
 void vm_swap_init (void);
 
+/**
+ * Add a Swap File: swap to the file `name` as well from now on, at
+ * `priority`, like a swap partition.  The file keeps its size, and
+ * may no longer be written through the file system.
+ * Returns false if there is no such file, it has no whole page,
+ * or it is a swap file already.
+ */
+bool vm_swap_add_file (const char *name, int priority);
+
 /**
  * Swap Out: write the content of `page` into the swap disk,
- * and return the index of swap region in which it is placed.
+ * and return the index of swap region in which it is placed,
+ * or SWAP_NONE if the swap is full.
  */
 swap_index_t vm_swap_out (void *page);
 
+/**
+ * Swap Out in two steps, for a caller that must know that there
+ * is a slot before it commits to evicting: reserve a slot (or get
+ * SWAP_NONE if the swap is full), then write `page` into it.
+ */
+swap_index_t vm_swap_alloc (void);
+void vm_swap_write (swap_index_t swap_index, void *page);
+
+/**
+ * Clustered Swap Out: write the CNT pages of `pages` into
+ * contiguous swap slots, `pages[i]` going to slot `*first + i`.
+ * If there is no free run of CNT slots, only a prefix of `pages`
+ * is written: none at all if the swap is full.
+ * Returns the number of pages written.
+ */
+size_t vm_swap_out_cluster (void **pages, size_t cnt, swap_index_t *first);
+
+/**
+ * Whether the swap was found full, by the last reservation that
+ * failed, with no slot freed since.
+ */
+bool vm_swap_is_full (void);
+
 /**
  * Swap In: read the content of from the specified swap index,
  * from the mapped swap block, and store PGSIZE bytes into `page`.
  */
 void vm_swap_in (swap_index_t swap_index, void *page);
 
+/**
+ * Swap In, keeping the slot: like vm_swap_in(), but the slot stays
+ * reserved and holds a valid copy of the page, so that the page can
+ * be evicted again into it without a write as long as it is not
+ * modified.  A page that was in the compressed swap cache has no
+ * copy on the disk, and its slot is released as by vm_swap_in().
+ * Returns true if the slot was kept.
+ */
+bool vm_swap_in_keep (swap_index_t swap_index, void *page);
+
+/**
+ * Duplicate Swap: copy the page of `swap_index` into a new slot,
+ * going through `buf`, a scratch page, and return the new slot, or
+ * SWAP_NONE if the swap is full.  The original slot is left as it was.
+ */
+swap_index_t vm_swap_dup (swap_index_t swap_index, void *buf);
+
 /**
  * Free Swap: drop the swap region.
  */
 void vm_swap_free (swap_index_t swap_index);
 
+/**
+ * Free Swap, in bulk: drop the CNT swap regions from `first` on,
+ * all of which must be in use.
+ */
+void vm_swap_free_range (swap_index_t first, size_t cnt);
+
 
 #endif /* vm/swap.h */